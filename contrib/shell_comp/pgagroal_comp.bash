@@ -10,13 +10,13 @@ pgagroal_cli_completions()
     if [ "${#COMP_WORDS[@]}" == "2" ]; then
         # main completion: the user has specified nothing at all
         # or a single word, that is a command
-        COMPREPLY=($(compgen -W "flush ping enable disable shutdown status switch-to conf clear" "${COMP_WORDS[1]}"))
+        COMPREPLY=($(compgen -W "flush ping enable disable shutdown status switch-to conf clear tracker slowlog activity" "${COMP_WORDS[1]}"))
     else
         # the user has specified something else
         # subcommand required?
         case ${COMP_WORDS[1]} in
             flush)
-                COMPREPLY+=($(compgen -W "gracefully idle all" "${COMP_WORDS[2]}"))
+                COMPREPLY+=($(compgen -W "gracefully idle all progressive" "${COMP_WORDS[2]}"))
                 ;;
             shutdown)
                 COMPREPLY+=($(compgen -W "gracefully immediate cancel" "${COMP_WORDS[2]}"))
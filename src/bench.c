@@ -0,0 +1,1186 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <configuration.h>
+#include <logging.h>
+#include <memory.h>
+#include <message.h>
+#include <network.h>
+#include <security.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SCENARIO_IDLE      0
+#define SCENARIO_RECONNECT 1
+#define SCENARIO_IDLE_TX   2
+#define SCENARIO_CANCEL    3
+
+#define HISTOGRAM_SIZE     1024
+#define MAX_CLIENTS        100000
+#define MAX_WORKERS        4096
+#define QUERY_BUFFER_SIZE  1024
+
+#define CANCEL_QUERY       "SELECT pg_sleep(60)"
+#define QUERY_CANCELED     "C57014"
+
+/** @struct worker_result
+ * The result of a worker process, in memory shared with the parent
+ */
+struct worker_result
+{
+   uint64_t connects;                   /**< The established sessions */
+   uint64_t queries;                    /**< The completed queries */
+   uint64_t cancels;                    /**< The queries that were canceled */
+   uint64_t uncanceled;                 /**< The queries that completed despite the cancel request */
+   uint64_t transactions;               /**< The idle transactions held and committed */
+   uint64_t errors;                     /**< The failed sessions and queries */
+   uint64_t connect[HISTOGRAM_SIZE];    /**< The connect latency histogram, up to ReadyForQuery */
+   uint64_t query[HISTOGRAM_SIZE];      /**< The query latency histogram */
+   uint64_t cancel[HISTOGRAM_SIZE];     /**< The cancel latency histogram, up to ReadyForQuery */
+};
+
+/** @struct session
+ * Defines a client session to pgagroal
+ */
+struct session
+{
+   int fd;         /**< The socket descriptor, or -1 */
+   int pid;        /**< The backend process identifier */
+   int secret;     /**< The backend secret key */
+   int64_t next;   /**< The next query time of an idle session */
+};
+
+static char* host = "localhost";
+static int port = 2345;
+static char* username = NULL;
+static char* password = NULL;
+static char* database = NULL;
+static int timeout = 30;
+static char query_buffer[QUERY_BUFFER_SIZE];
+static struct message query_message;
+static char cancel_buffer[QUERY_BUFFER_SIZE];
+static struct message cancel_message;
+static volatile sig_atomic_t stop = 0;
+
+static int session_open(struct session* s, struct worker_result* result);
+static void session_close(struct session* s);
+static int session_query(struct session* s, struct message* msg, bool* canceled);
+static int session_cancel(struct session* s);
+static int wait_ready(struct session* s, bool startup, bool* canceled);
+static int create_query(char* query, char* buffer, struct message* msg);
+static void active_client(int64_t end, struct worker_result* result);
+static void idle_clients(int count, int interval, int64_t end, struct worker_result* result);
+static void reconnect_client(int64_t end, struct worker_result* result);
+static void idle_tx_client(int hold, int64_t end, struct worker_result* result);
+static void cancel_client(int delay, int64_t end, struct worker_result* result);
+static int64_t now_ns(void);
+static void sleep_ns(int64_t ns);
+static int histogram_index(uint64_t ns);
+static uint64_t histogram_value(int index);
+static uint64_t percentile(uint64_t* histogram, uint64_t total, double p);
+static void report(char* name, uint64_t* histogram, uint64_t total);
+
+static void
+version(void)
+{
+   printf("pgagroal-bench %s\n", PGAGROAL_VERSION);
+   exit(1);
+}
+
+static void
+usage(void)
+{
+   printf("pgagroal-bench %s\n", PGAGROAL_VERSION);
+   printf("  Load generator for pgagroal\n");
+   printf("\n");
+
+   printf("Usage:\n");
+   printf("  pgagroal-bench [ OPTIONS ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -h, --host HOST          Set the host name, or the Unix Domain Socket directory (default: localhost)\n");
+   printf("  -p, --port PORT          Set the port number (default: 2345)\n");
+   printf("  -U, --user USERNAME      Set the user name (default: $USER)\n");
+   printf("  -P, --password PASSWORD  Set the password (default: $PGPASSWORD)\n");
+   printf("  -d, --database DATABASE  Set the database (default: the user name)\n");
+   printf("  -s, --scenario SCENARIO  Set the scenario (default: idle)\n");
+   printf("  -c, --clients NUMBER     Set the number of clients (default: 100)\n");
+   printf("  -a, --active NUMBER      Set the number of active clients in the idle and idle-tx scenarios (default: 10)\n");
+   printf("  -j, --jobs NUMBER        Set the number of processes for the idle sessions (default: 4)\n");
+   printf("  -i, --interval SECONDS   Set the query interval of an idle session (default: 5)\n");
+   printf("  -w, --wait MS            Set the hold time in idle-tx, or the cancel delay in cancel (default: 1000 / 10)\n");
+   printf("  -T, --time SECONDS       Set the duration (default: 10)\n");
+   printf("  -q, --query QUERY        Set the query (default: SELECT 1)\n");
+   printf("  -t, --timeout SECONDS    Set the read timeout (default: 30)\n");
+   printf("  -V, --version            Display version information\n");
+   printf("  -?, --help               Display help\n");
+   printf("\n");
+   printf("Scenarios:\n");
+   printf("  idle                     Many idle sessions with a few active clients\n");
+   printf("  reconnect                A new session for every query\n");
+   printf("  idle-tx                  Clients holding an idle transaction with active clients\n");
+   printf("  cancel                   Cancel requests for running queries\n");
+   printf("\n");
+   printf("pgagroal: %s\n", PGAGROAL_HOMEPAGE);
+   printf("Report bugs: %s\n", PGAGROAL_ISSUES);
+}
+
+static void
+stop_handler(int sig __attribute__((unused)))
+{
+   stop = 1;
+}
+
+int
+main(int argc, char** argv)
+{
+   int c;
+   int option_index = 0;
+   int scenario = SCENARIO_IDLE;
+   char* scenario_name = "idle";
+   int clients = 100;
+   int active = 10;
+   int jobs = 4;
+   int interval = 5;
+   int wait = -1;
+   int duration = 10;
+   char* query = "SELECT 1";
+   int workers = 0;
+   int idle = 0;
+   int status;
+   int64_t start;
+   int64_t end;
+   double elapsed;
+   uint64_t operations;
+   pid_t* pids = NULL;
+   size_t shmem_size = 0;
+   size_t results_size = 0;
+   struct worker_result* results = NULL;
+   struct worker_result* total = NULL;
+   struct main_configuration* config = NULL;
+   struct sigaction sa;
+
+   while (1)
+   {
+      static struct option long_options[] =
+      {
+         {"host", required_argument, 0, 'h'},
+         {"port", required_argument, 0, 'p'},
+         {"user", required_argument, 0, 'U'},
+         {"password", required_argument, 0, 'P'},
+         {"database", required_argument, 0, 'd'},
+         {"scenario", required_argument, 0, 's'},
+         {"clients", required_argument, 0, 'c'},
+         {"active", required_argument, 0, 'a'},
+         {"jobs", required_argument, 0, 'j'},
+         {"interval", required_argument, 0, 'i'},
+         {"wait", required_argument, 0, 'w'},
+         {"time", required_argument, 0, 'T'},
+         {"query", required_argument, 0, 'q'},
+         {"timeout", required_argument, 0, 't'},
+         {"version", no_argument, 0, 'V'},
+         {"help", no_argument, 0, '?'}
+      };
+
+      c = getopt_long(argc, argv, "V?h:p:U:P:d:s:c:a:j:i:w:T:q:t:",
+                      long_options, &option_index);
+
+      if (c == -1)
+      {
+         break;
+      }
+
+      switch (c)
+      {
+         case 'h':
+            host = optarg;
+            break;
+         case 'p':
+            port = atoi(optarg);
+            break;
+         case 'U':
+            username = optarg;
+            break;
+         case 'P':
+            password = optarg;
+            break;
+         case 'd':
+            database = optarg;
+            break;
+         case 's':
+            scenario_name = optarg;
+            break;
+         case 'c':
+            clients = atoi(optarg);
+            break;
+         case 'a':
+            active = atoi(optarg);
+            break;
+         case 'j':
+            jobs = atoi(optarg);
+            break;
+         case 'i':
+            interval = atoi(optarg);
+            break;
+         case 'w':
+            wait = atoi(optarg);
+            break;
+         case 'T':
+            duration = atoi(optarg);
+            break;
+         case 'q':
+            query = optarg;
+            break;
+         case 't':
+            timeout = atoi(optarg);
+            break;
+         case 'V':
+            version();
+            break;
+         case '?':
+            usage();
+            exit(1);
+            break;
+         default:
+            break;
+      }
+   }
+
+   if (!strcmp(scenario_name, "idle"))
+   {
+      scenario = SCENARIO_IDLE;
+   }
+   else if (!strcmp(scenario_name, "reconnect"))
+   {
+      scenario = SCENARIO_RECONNECT;
+   }
+   else if (!strcmp(scenario_name, "idle-tx"))
+   {
+      scenario = SCENARIO_IDLE_TX;
+   }
+   else if (!strcmp(scenario_name, "cancel"))
+   {
+      scenario = SCENARIO_CANCEL;
+   }
+   else
+   {
+      warnx("pgagroal-bench: Unknown scenario: %s", scenario_name);
+      exit(1);
+   }
+
+   if (username == NULL)
+   {
+      username = getenv("USER");
+   }
+   if (password == NULL)
+   {
+      password = getenv("PGPASSWORD");
+   }
+   if (database == NULL)
+   {
+      database = username;
+   }
+   if (wait < 0)
+   {
+      wait = scenario == SCENARIO_CANCEL ? 10 : 1000;
+   }
+
+   if (username == NULL)
+   {
+      warnx("pgagroal-bench: A user name is required");
+      exit(1);
+   }
+
+   if (clients < 1 || clients > MAX_CLIENTS || active < 0 || jobs < 1 || interval < 0 ||
+       duration < 1 || timeout < 1 || port < 1)
+   {
+      usage();
+      exit(1);
+   }
+
+   if (scenario == SCENARIO_IDLE || scenario == SCENARIO_IDLE_TX)
+   {
+      if (active > clients)
+      {
+         active = clients;
+      }
+      idle = clients - active;
+   }
+
+   /* The idle sessions are spread over the jobs, every other client is a process */
+   if (scenario == SCENARIO_IDLE)
+   {
+      if (jobs > idle)
+      {
+         jobs = idle;
+      }
+      workers = active + jobs;
+   }
+   else
+   {
+      workers = clients;
+   }
+
+   if (workers > MAX_WORKERS)
+   {
+      warnx("pgagroal-bench: Too many processes: %d (max %d)", workers, MAX_WORKERS);
+      exit(1);
+   }
+
+   if (create_query(query, &query_buffer[0], &query_message) ||
+       create_query(CANCEL_QUERY, &cancel_buffer[0], &cancel_message))
+   {
+      warnx("pgagroal-bench: Query too long");
+      exit(1);
+   }
+
+   /* The protocol helpers of libpgagroal use the configuration for logging and the SCRAM key cache */
+   shmem_size = sizeof(struct main_configuration);
+   if (pgagroal_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+      warnx("pgagroal-bench: Error in creating shared memory");
+      goto error;
+   }
+
+   pgagroal_init_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+   config->common.port = port;
+   config->common.log_level = PGAGROAL_LOGGING_LEVEL_WARN;
+   config->keep_alive = true;
+   config->nodelay = true;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   results_size = (workers + 1) * sizeof(struct worker_result);
+   results = mmap(NULL, results_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   pids = calloc(workers, sizeof(pid_t));
+   if (results == MAP_FAILED || pids == NULL)
+   {
+      results = NULL;
+      warnx("pgagroal-bench: Out of memory");
+      goto error;
+   }
+   memset(results, 0, results_size);
+   total = &results[workers];
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = stop_handler;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   signal(SIGPIPE, SIG_IGN);
+
+   fflush(stdout);
+
+   start = now_ns();
+   end = start + (int64_t)duration * 1000000000LL;
+
+   for (int i = 0; i < workers; i++)
+   {
+      pids[i] = fork();
+      if (pids[i] == -1)
+      {
+         pids[i] = 0;
+         warnx("pgagroal-bench: Couldn't create process");
+         goto error;
+      }
+      else if (pids[i] == 0)
+      {
+         switch (scenario)
+         {
+            case SCENARIO_IDLE:
+               if (i < active)
+               {
+                  active_client(end, &results[i]);
+               }
+               else
+               {
+                  int job = i - active;
+                  idle_clients(idle / jobs + (job < idle % jobs ? 1 : 0), interval, end, &results[i]);
+               }
+               break;
+            case SCENARIO_RECONNECT:
+               reconnect_client(end, &results[i]);
+               break;
+            case SCENARIO_IDLE_TX:
+               if (i < active)
+               {
+                  idle_tx_client(wait, end, &results[i]);
+               }
+               else
+               {
+                  active_client(end, &results[i]);
+               }
+               break;
+            case SCENARIO_CANCEL:
+               cancel_client(wait, end, &results[i]);
+               break;
+            default:
+               break;
+         }
+         exit(0);
+      }
+   }
+
+   for (int i = 0; i < workers; i++)
+   {
+      while (waitpid(pids[i], &status, 0) == -1 && errno == EINTR)
+      {
+         if (stop)
+         {
+            for (int j = i; j < workers; j++)
+            {
+               kill(pids[j], SIGTERM);
+            }
+         }
+      }
+      pids[i] = 0;
+   }
+
+   elapsed = (double)(now_ns() - start) / 1000000000.0;
+
+   for (int i = 0; i < workers; i++)
+   {
+      total->connects += results[i].connects;
+      total->queries += results[i].queries;
+      total->cancels += results[i].cancels;
+      total->uncanceled += results[i].uncanceled;
+      total->transactions += results[i].transactions;
+      total->errors += results[i].errors;
+      for (int j = 0; j < HISTOGRAM_SIZE; j++)
+      {
+         total->connect[j] += results[i].connect[j];
+         total->query[j] += results[i].query[j];
+         total->cancel[j] += results[i].cancel[j];
+      }
+   }
+
+   operations = total->connects + total->queries + total->cancels + total->uncanceled + total->transactions;
+
+   printf("scenario %s clients %d active %d processes %d duration %.1fs\n",
+          scenario_name, clients, scenario == SCENARIO_IDLE || scenario == SCENARIO_IDLE_TX ? active : clients,
+          workers, elapsed);
+   printf("throughput %.0f queries/s %.0f connects/s\n",
+          (double)total->queries / elapsed, (double)total->connects / elapsed);
+   printf("sessions %llu queries %llu errors %llu error rate %.2f%%\n",
+          (unsigned long long)total->connects, (unsigned long long)total->queries,
+          (unsigned long long)total->errors,
+          operations + total->errors > 0 ? 100.0 * total->errors / (operations + total->errors) : 0.0);
+   report("connect", &total->connect[0], total->connects);
+   report("query", &total->query[0], total->queries);
+   if (scenario == SCENARIO_IDLE_TX)
+   {
+      printf("transactions %llu\n", (unsigned long long)total->transactions);
+   }
+   if (scenario == SCENARIO_CANCEL)
+   {
+      printf("canceled %llu uncanceled %llu\n",
+             (unsigned long long)total->cancels, (unsigned long long)total->uncanceled);
+      report("cancel", &total->cancel[0], total->cancels + total->uncanceled);
+   }
+
+   munmap(results, results_size);
+   free(pids);
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+   pgagroal_destroy_shared_memory(shmem, shmem_size);
+
+   return 0;
+
+error:
+
+   if (pids != NULL)
+   {
+      for (int i = 0; i < workers; i++)
+      {
+         if (pids[i] > 0)
+         {
+            kill(pids[i], SIGTERM);
+            waitpid(pids[i], &status, 0);
+         }
+      }
+   }
+
+   if (results != NULL)
+   {
+      munmap(results, results_size);
+   }
+   free(pids);
+
+   if (shmem != NULL)
+   {
+      pgagroal_memory_destroy();
+      pgagroal_stop_logging();
+      pgagroal_destroy_shared_memory(shmem, shmem_size);
+   }
+
+   return 1;
+}
+
+static int
+session_open(struct session* s, struct worker_result* result)
+{
+   int64_t start;
+   struct main_configuration* config = (struct main_configuration*)shmem;
+   struct message* msg = NULL;
+
+   s->fd = -1;
+   s->pid = 0;
+   s->secret = 0;
+
+   start = now_ns();
+
+   if (host[0] == '/')
+   {
+      if (pgagroal_connect_unix_socket(host, ".s.PGSQL", &s->fd))
+      {
+         goto error;
+      }
+   }
+   else if (pgagroal_connect(host, port, &s->fd, config->keep_alive, config->nodelay))
+   {
+      goto error;
+   }
+
+   if (pgagroal_create_startup_message(username, database, &msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   if (pgagroal_write_message(NULL, s->fd, msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+   pgagroal_free_message(msg);
+   msg = NULL;
+
+   if (wait_ready(s, true, NULL))
+   {
+      goto error;
+   }
+
+   result->connects++;
+   result->connect[histogram_index(now_ns() - start)]++;
+
+   return 0;
+
+error:
+
+   pgagroal_free_message(msg);
+   session_close(s);
+   result->errors++;
+
+   return 1;
+}
+
+static void
+session_close(struct session* s)
+{
+   if (s->fd != -1)
+   {
+      pgagroal_write_terminate(NULL, s->fd);
+      pgagroal_disconnect(s->fd);
+      s->fd = -1;
+   }
+}
+
+static int
+session_query(struct session* s, struct message* msg, bool* canceled)
+{
+   if (pgagroal_write_message(NULL, s->fd, msg) != MESSAGE_STATUS_OK)
+   {
+      return 1;
+   }
+
+   return wait_ready(s, false, canceled);
+}
+
+/**
+ * Send a CancelRequest on a new connection, like libpq does
+ */
+static int
+session_cancel(struct session* s)
+{
+   int fd = -1;
+   struct main_configuration* config = (struct main_configuration*)shmem;
+   struct message* msg = NULL;
+
+   if (host[0] == '/')
+   {
+      if (pgagroal_connect_unix_socket(host, ".s.PGSQL", &fd))
+      {
+         goto error;
+      }
+   }
+   else if (pgagroal_connect(host, port, &fd, config->keep_alive, config->nodelay))
+   {
+      goto error;
+   }
+
+   if (pgagroal_create_cancel_request_message(s->pid, s->secret, &msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   if (pgagroal_write_message(NULL, fd, msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   pgagroal_free_message(msg);
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   pgagroal_free_message(msg);
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+/**
+ * Read until ReadyForQuery, answering the authentication requests
+ * of the startup phase on the way
+ * @param s The session
+ * @param startup Is the session in the startup phase
+ * @param canceled Set when the query ended with query_canceled, or NULL
+ * @return 0 upon ReadyForQuery without an error, otherwise 1
+ */
+static int
+wait_ready(struct session* s, bool startup, bool* canceled)
+{
+   int offset;
+   int type;
+   int status;
+   bool failed = false;
+   struct message* msg = NULL;
+   struct message* reply = NULL;
+   struct message_stream stream;
+   struct message_frame frame;
+
+   memset(&stream, 0, sizeof(stream));
+
+   if (canceled != NULL)
+   {
+      *canceled = false;
+   }
+
+   while (!stop)
+   {
+      if (msg == NULL)
+      {
+         status = pgagroal_read_timeout_message(NULL, s->fd, timeout, &msg);
+         if (status != MESSAGE_STATUS_OK)
+         {
+            goto error;
+         }
+      }
+
+      offset = 0;
+      while (msg != NULL && pgagroal_message_stream_next(&stream, msg, &offset, startup ? "EKRZ" : "EZ", &frame))
+      {
+         switch (frame.kind)
+         {
+            case 'R':
+               if (frame.available < 4)
+               {
+                  goto error;
+               }
+
+               type = pgagroal_read_int32(frame.body);
+               if (type == 0 || type == 12)
+               {
+                  /* AuthenticationOk or the end of AuthenticationSASLFinal */
+                  break;
+               }
+               else if (type == 3)
+               {
+                  if (password == NULL)
+                  {
+                     pgagroal_log_error("pgagroal-bench: A password is required for user: %s", username);
+                     goto error;
+                  }
+
+                  if (pgagroal_create_auth_password_response(password, &reply) != MESSAGE_STATUS_OK)
+                  {
+                     goto error;
+                  }
+                  status = pgagroal_write_message(NULL, s->fd, reply);
+                  pgagroal_free_message(reply);
+                  reply = NULL;
+                  if (status != MESSAGE_STATUS_OK)
+                  {
+                     goto error;
+                  }
+
+                  /* The server waits for the password, nothing follows */
+                  msg = NULL;
+               }
+               else if (type == 10)
+               {
+                  if (password == NULL)
+                  {
+                     pgagroal_log_error("pgagroal-bench: A password is required for user: %s", username);
+                     goto error;
+                  }
+
+                  if (pgagroal_scram_client_auth(username, password, s->fd, NULL, &reply) != AUTH_SUCCESS)
+                  {
+                     goto error;
+                  }
+
+                  /* Continue with the AuthenticationSASLFinal message */
+                  memset(&stream, 0, sizeof(stream));
+                  msg = reply;
+                  reply = NULL;
+                  offset = 0;
+               }
+               else
+               {
+                  pgagroal_log_error("pgagroal-bench: Unsupported authentication type: %d", type);
+                  goto error;
+               }
+               break;
+            case 'K':
+               if (frame.available >= 8)
+               {
+                  s->pid = pgagroal_read_int32(frame.body);
+                  s->secret = pgagroal_read_int32(frame.body + 4);
+               }
+               break;
+            case 'E':
+               if (canceled != NULL && memmem(frame.body, frame.available, QUERY_CANCELED, strlen(QUERY_CANCELED) + 1) != NULL)
+               {
+                  *canceled = true;
+               }
+               else
+               {
+                  failed = true;
+               }
+
+               /* No ReadyForQuery follows an error in the startup phase */
+               if (startup)
+               {
+                  goto error;
+               }
+               break;
+            case 'Z':
+               return failed ? 1 : 0;
+            default:
+               break;
+         }
+      }
+
+      msg = NULL;
+   }
+
+error:
+
+   return 1;
+}
+
+static int
+create_query(char* query, char* buffer, struct message* msg)
+{
+   size_t length = strlen(query);
+
+   if (MESSAGE_HEADER_SIZE + length + 1 > QUERY_BUFFER_SIZE)
+   {
+      return 1;
+   }
+
+   pgagroal_write_byte(buffer, 'Q');
+   pgagroal_write_int32(buffer + 1, 4 + length + 1);
+   pgagroal_write_string(buffer + MESSAGE_HEADER_SIZE, query);
+
+   memset(msg, 0, sizeof(struct message));
+   msg->kind = 'Q';
+   msg->length = MESSAGE_HEADER_SIZE + length + 1;
+   msg->data = buffer;
+
+   return 0;
+}
+
+static void
+active_client(int64_t end, struct worker_result* result)
+{
+   int64_t start;
+   struct session s;
+
+   s.fd = -1;
+
+   while (!stop && now_ns() < end)
+   {
+      if (s.fd == -1 && session_open(&s, result))
+      {
+         sleep_ns(10000000LL);
+         continue;
+      }
+
+      start = now_ns();
+      if (session_query(&s, &query_message, NULL))
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      result->queries++;
+      result->query[histogram_index(now_ns() - start)]++;
+   }
+
+   session_close(&s);
+}
+
+/**
+ * Keep many sessions open, each running a query every interval
+ */
+static void
+idle_clients(int count, int interval, int64_t end, struct worker_result* result)
+{
+   int64_t start;
+   int64_t next;
+   struct session* sessions = NULL;
+
+   sessions = calloc(count, sizeof(struct session));
+   if (sessions == NULL)
+   {
+      result->errors += count;
+      return;
+   }
+
+   for (int i = 0; i < count && !stop; i++)
+   {
+      session_open(&sessions[i], result);
+      sessions[i].next = now_ns() + (int64_t)interval * 1000000000LL * (i + 1) / count;
+   }
+
+   while (!stop && now_ns() < end)
+   {
+      next = end;
+
+      for (int i = 0; i < count && !stop; i++)
+      {
+         if (interval > 0 && sessions[i].next <= now_ns())
+         {
+            if (sessions[i].fd == -1 && session_open(&sessions[i], result))
+            {
+               sessions[i].next = now_ns() + (int64_t)interval * 1000000000LL;
+               continue;
+            }
+
+            start = now_ns();
+            if (session_query(&sessions[i], &query_message, NULL))
+            {
+               result->errors++;
+               session_close(&sessions[i]);
+            }
+            else
+            {
+               result->queries++;
+               result->query[histogram_index(now_ns() - start)]++;
+            }
+            sessions[i].next = now_ns() + (int64_t)interval * 1000000000LL;
+         }
+
+         if (sessions[i].next < next)
+         {
+            next = sessions[i].next;
+         }
+      }
+
+      start = now_ns();
+      if (next > start)
+      {
+         sleep_ns(next - start < 100000000LL ? next - start : 100000000LL);
+      }
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      session_close(&sessions[i]);
+   }
+
+   free(sessions);
+}
+
+static void
+reconnect_client(int64_t end, struct worker_result* result)
+{
+   int64_t start;
+   struct session s;
+
+   while (!stop && now_ns() < end)
+   {
+      if (session_open(&s, result))
+      {
+         sleep_ns(10000000LL);
+         continue;
+      }
+
+      start = now_ns();
+      if (session_query(&s, &query_message, NULL))
+      {
+         result->errors++;
+      }
+      else
+      {
+         result->queries++;
+         result->query[histogram_index(now_ns() - start)]++;
+      }
+
+      session_close(&s);
+   }
+}
+
+/**
+ * Hold a transaction open and idle, so the server connection stays
+ * assigned in the transaction pipeline
+ */
+static void
+idle_tx_client(int hold, int64_t end, struct worker_result* result)
+{
+   char begin_buffer[QUERY_BUFFER_SIZE];
+   char commit_buffer[QUERY_BUFFER_SIZE];
+   struct message begin;
+   struct message commit;
+   struct session s;
+
+   create_query("BEGIN", &begin_buffer[0], &begin);
+   create_query("COMMIT", &commit_buffer[0], &commit);
+
+   s.fd = -1;
+
+   while (!stop && now_ns() < end)
+   {
+      if (s.fd == -1 && session_open(&s, result))
+      {
+         sleep_ns(10000000LL);
+         continue;
+      }
+
+      if (session_query(&s, &begin, NULL) ||
+          session_query(&s, &query_message, NULL))
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      sleep_ns((int64_t)hold * 1000000LL);
+
+      if (session_query(&s, &commit, NULL))
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      result->transactions++;
+   }
+
+   session_close(&s);
+}
+
+static void
+cancel_client(int delay, int64_t end, struct worker_result* result)
+{
+   int64_t start;
+   bool canceled;
+   struct session s;
+
+   s.fd = -1;
+
+   while (!stop && now_ns() < end)
+   {
+      if (s.fd == -1 && session_open(&s, result))
+      {
+         sleep_ns(10000000LL);
+         continue;
+      }
+
+      if (pgagroal_write_message(NULL, s.fd, &cancel_message) != MESSAGE_STATUS_OK)
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      sleep_ns((int64_t)delay * 1000000LL);
+
+      start = now_ns();
+      if (session_cancel(&s))
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      if (wait_ready(&s, false, &canceled))
+      {
+         result->errors++;
+         session_close(&s);
+         continue;
+      }
+
+      if (canceled)
+      {
+         result->cancels++;
+      }
+      else
+      {
+         result->uncanceled++;
+      }
+      result->cancel[histogram_index(now_ns() - start)]++;
+   }
+
+   session_close(&s);
+}
+
+static int64_t
+now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+sleep_ns(int64_t ns)
+{
+   struct timespec ts;
+
+   if (ns <= 0)
+   {
+      return;
+   }
+
+   ts.tv_sec = ns / 1000000000LL;
+   ts.tv_nsec = ns % 1000000000LL;
+
+   nanosleep(&ts, NULL);
+}
+
+/**
+ * Log-linear buckets, 16 per power of two
+ */
+static int
+histogram_index(uint64_t ns)
+{
+   int e;
+
+   if (ns < 16)
+   {
+      return (int)ns;
+   }
+
+   e = 63 - __builtin_clzll(ns);
+
+   return (e - 3) * 16 + (int)((ns >> (e - 4)) & 15);
+}
+
+static uint64_t
+histogram_value(int index)
+{
+   int e;
+
+   if (index < 16)
+   {
+      return (uint64_t)index;
+   }
+
+   e = index / 16 + 3;
+
+   return ((uint64_t)(16 + index % 16 + 1) << (e - 4)) - 1;
+}
+
+static uint64_t
+percentile(uint64_t* histogram, uint64_t total, double p)
+{
+   uint64_t count = 0;
+   uint64_t wanted;
+
+   wanted = (uint64_t)(p * total);
+   if (wanted == 0)
+   {
+      wanted = 1;
+   }
+
+   for (int i = 0; i < HISTOGRAM_SIZE; i++)
+   {
+      count += histogram[i];
+      if (count >= wanted)
+      {
+         return histogram_value(i);
+      }
+   }
+
+   return 0;
+}
+
+static void
+report(char* name, uint64_t* histogram, uint64_t total)
+{
+   if (total == 0)
+   {
+      printf("%-8s -\n", name);
+      return;
+   }
+
+   printf("%-8s p50 %.3fms p90 %.3fms p99 %.3fms p99.9 %.3fms max %.3fms\n", name,
+          percentile(histogram, total, 0.50) / 1000000.0,
+          percentile(histogram, total, 0.90) / 1000000.0,
+          percentile(histogram, total, 0.99) / 1000000.0,
+          percentile(histogram, total, 0.999) / 1000000.0,
+          percentile(histogram, total, 1.0) / 1000000.0);
+}
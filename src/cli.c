@@ -60,6 +60,7 @@
 #define COMMAND_CANCELSHUTDOWN "cancel-shutdown"
 #define COMMAND_CLEAR          "clear"
 #define COMMAND_CLEAR_SERVER   "clear-server"
+#define COMMAND_CLEARAUTHQUERY "clear-auth-query"
 #define COMMAND_DISABLEDB      "disable-db"
 #define COMMAND_ENABLEDB       "enable-db"
 #define COMMAND_FLUSH          "flush"
@@ -74,6 +75,9 @@
 #define COMMAND_CONFIG_GET     "conf-get"
 #define COMMAND_CONFIG_SET     "conf-set"
 #define COMMAND_CONFIG_ALIAS   "conf-alias"
+#define COMMAND_TRACKER        "tracker"
+#define COMMAND_SLOWLOG        "slowlog"
+#define COMMAND_ACTIVITY       "activity"
 
 #define OUTPUT_FORMAT_JSON     "json"
 #define OUTPUT_FORMAT_TEXT     "text"
@@ -92,6 +96,9 @@ static void help_ping(void);
 static void help_shutdown(void);
 static void help_status_details(void);
 static void help_switch_to(void);
+static void help_tracker(void);
+static void help_slowlog(void);
+static void help_activity(void);
 
 static int cancel_shutdown(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int conf_get(SSL* ssl, int socket, char* config_key, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -107,8 +114,15 @@ static int ping(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, i
 static int reload(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int clear(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int clear_server(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int clear_auth_query(SSL* ssl, int socket, char* username, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int status(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int switch_to(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int tracker(SSL* ssl, int socket, char* sequence, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int slowlog(SSL* ssl, int socket, char* sequence, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int activity(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
+
+static int execute(SSL* ssl, int socket, struct pgagroal_parsed_command* parsed, int64_t timeout, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int batch(SSL* ssl, int* socket, bool remote_connection, char* path, int64_t timeout, uint8_t compression, uint8_t encryption, int32_t output_format);
 
 static int process_result(SSL* ssl, int socket, int32_t output_format);
 static int process_get_result(SSL* ssl, int socket, char* config_key, int32_t output_format);
@@ -297,6 +311,16 @@ const struct pgagroal_command command_table[] = {
       .deprecated = false,
       .log_message = "<flush all> [%s]",
    },
+   {
+      .command = "flush",
+      .subcommand = "progressive",
+      .accepted_argument_count = {0, 1},
+      .action = MANAGEMENT_FLUSH,
+      .mode = FLUSH_PROGRESSIVE,
+      .default_argument = "all",
+      .deprecated = false,
+      .log_message = "<flush progressive> [%s]",
+   },
    {
       .command = "clear",
       .subcommand = "prometheus",
@@ -305,6 +329,15 @@ const struct pgagroal_command command_table[] = {
       .deprecated = false,
       .log_message = "<clear prometheus>"
    },
+   {
+      .command = "clear",
+      .subcommand = "auth_query",
+      .accepted_argument_count = {0, 1},
+      .action = MANAGEMENT_CLEAR_AUTH_QUERY,
+      .default_argument = "all",
+      .deprecated = false,
+      .log_message = "<clear auth_query> [%s]",
+   },
    {
       .command = "status",
       .subcommand = "details",
@@ -313,6 +346,32 @@ const struct pgagroal_command command_table[] = {
       .deprecated = false,
       .log_message = "<status details>"
    },
+   {
+      .command = "tracker",
+      .subcommand = "",
+      .accepted_argument_count = {0, 1},
+      .action = MANAGEMENT_TRACKER,
+      .default_argument = "0",
+      .deprecated = false,
+      .log_message = "<tracker> [%s]",
+   },
+   {
+      .command = "slowlog",
+      .subcommand = "",
+      .accepted_argument_count = {0, 1},
+      .action = MANAGEMENT_SLOWLOG,
+      .default_argument = "0",
+      .deprecated = false,
+      .log_message = "<slowlog> [%s]",
+   },
+   {
+      .command = "activity",
+      .subcommand = "",
+      .accepted_argument_count = {0},
+      .action = MANAGEMENT_ACTIVITY,
+      .deprecated = false,
+      .log_message = "<activity>",
+   },
 };
 // clang-format on
 
@@ -346,7 +405,7 @@ usage(void)
    printf("  -E, --encrypt none|aes|aes256|aes192|aes128  Encrypt the wire protocol using AES-GCM\n");
    printf("                |aes256gcm|aes192gcm|aes128gcm (Note: non-GCM AES modes are not supported)\n");
    printf("  -T, --timeout DURATION                       Deadline for 'shutdown [gracefully]' and\n");
-   printf("                                                 'flush [gracefully]'. DURATION is a non-negative\n");
+   printf("                                                 'flush [gracefully|progressive]'. DURATION is a non-negative\n");
    printf("                                                 number with an optional unit suffix:\n");
    printf("                                                 s (seconds, default), m (minutes), h (hours),\n");
    printf("                                                 d (days), w (weeks). E.g. '30', '30s', '5m',\n");
@@ -354,6 +413,8 @@ usage(void)
    printf("                                                 'flush_timeout' from pgagroal.conf. '--timeout 0'\n");
    printf("                                                 explicitly disables the timer (runs unbounded);\n");
    printf("                                                 same meaning as 'flush_timeout = 0' in pgagroal.conf.\n");
+   printf("  -b, --batch FILE                             Run the commands in FILE, one per line, over one\n");
+   printf("                                                 session. Use '-' to read the commands from stdin\n");
    printf("  -v, --verbose                                Output text string of result\n");
    printf("  -V, --version                                Display version information\n");
    printf("  -?, --help                                   Display help\n");
@@ -364,9 +425,11 @@ usage(void)
    printf("                           - 'gracefully' (default) to flush all connections gracefully\n");
    printf("                           - 'idle' to flush only idle connections\n");
    printf("                           - 'all' to flush all connections. USE WITH CAUTION!\n");
+   printf("                           - 'progressive' to flush flush_rate connections per second,\n");
+   printf("                             and return when all of them are replaced\n");
    printf("                           If no [database] name is specified, applies to all databases.\n");
-   printf("                           With '--timeout DURATION' on 'gracefully', remaining marked\n");
-   printf("                           connections are terminated (flush all) on expiry.\n");
+   printf("                           With '--timeout DURATION' on 'gracefully' or 'progressive',\n");
+   printf("                           remaining marked connections are terminated on expiry.\n");
    printf("  ping                     Verifies if pgagroal is up and checks PostgreSQL server connectivity\n");
    printf("  enable   [database]      Enables the specified databases (or all databases)\n");
    printf("  disable  [database]      Disables the specified databases (or all databases)\n");
@@ -393,6 +456,11 @@ usage(void)
    printf("                           - 'server' (default) followed by a server name\n");
    printf("                           - a server name on its own\n");
    printf("                           - 'prometheus' to reset the Prometheus metrics\n");
+   printf("                           - 'auth_query' to drop the cached authentication query results,\n");
+   printf("                             optionally followed by a user name\n");
+   printf("  tracker [sequence]       Shows the tracker events newer than [sequence]\n");
+   printf("  slowlog [sequence]       Shows the slow connection waits and transactions newer than [sequence]\n");
+   printf("  activity                 Shows the state of the clients\n");
    printf("\n");
    printf("pgagroal: <%s>\n", PGAGROAL_HOMEPAGE);
    printf("Report bugs: <%s>\n", PGAGROAL_ISSUES);
@@ -412,6 +480,7 @@ main(int argc, char** argv)
    char* password = NULL;
    bool verbose = false;
    char* logfile = NULL;
+   char* batch_path = NULL;
    int c;
    int option_index = 0;
    size_t size;
@@ -440,11 +509,12 @@ main(int argc, char** argv)
             {"compress", required_argument, 0, 'C'},
             {"encrypt", required_argument, 0, 'E'},
             {"timeout", required_argument, 0, 'T'},
+            {"batch", required_argument, 0, 'b'},
             {"verbose", no_argument, 0, 'v'},
             {"version", no_argument, 0, 'V'},
             {"help", no_argument, 0, '?'}};
 
-      c = getopt_long(argc, argv, "vV?c:h:p:U:P:L:F:C:E:T:",
+      c = getopt_long(argc, argv, "vV?c:h:p:U:P:L:F:C:E:T:b:",
                       long_options, &option_index);
 
       if (c == -1)
@@ -560,6 +630,9 @@ main(int argc, char** argv)
             timeout = v;
             break;
          }
+         case 'b':
+            batch_path = optarg;
+            break;
          case 'v':
             verbose = true;
             break;
@@ -677,7 +750,16 @@ main(int argc, char** argv)
       }
    }
 
-   if (!parse_command(argc, argv, optind, &parsed, command_table, command_count))
+   if (batch_path != NULL)
+   {
+      if (argc > optind)
+      {
+         warnx("pgagroal-cli: Use either a command or --batch");
+         exit_code = 1;
+         goto done;
+      }
+   }
+   else if (!parse_command(argc, argv, optind, &parsed, command_table, command_count))
    {
       if (argc > optind)
       {
@@ -787,104 +869,209 @@ username:
       }
    }
 
-   if (parsed.cmd->action == MANAGEMENT_FLUSH)
+   if (batch_path != NULL)
+   {
+      exit_code = batch(s_ssl, &socket, remote_connection, batch_path, timeout, compression, encryption, output_format);
+   }
+   else
+   {
+      exit_code = execute(s_ssl, socket, &parsed, timeout, compression, encryption, output_format);
+   }
+
+done:
+
+   if (s_ssl != NULL)
+   {
+      int res;
+      res = SSL_shutdown(s_ssl);
+      if (res == 0)
+      {
+         SSL_shutdown(s_ssl);
+      }
+      SSL_free(s_ssl);
+   }
+
+   pgagroal_disconnect(socket);
+   pgagroal_stop_logging();
+   pgagroal_destroy_shared_memory(shmem, size);
+
+   free(password);
+
+   if (verbose)
+   {
+      warnx("%s (%d)", exit_code == 0 ? "Success" : "Error", exit_code);
+   }
+
+   return exit_code;
+}
+
+static int
+execute(SSL* ssl, int socket, struct pgagroal_parsed_command* parsed, int64_t timeout, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   if (parsed->cmd->action == MANAGEMENT_FLUSH)
+   {
+      return flush(ssl, socket, parsed->cmd->mode, parsed->args[0], timeout, compression, encryption, output_format);
+   }
+   else if (parsed->cmd->action == MANAGEMENT_ENABLEDB)
    {
-      exit_code = flush(s_ssl, socket, parsed.cmd->mode, parsed.args[0], timeout, compression, encryption, output_format);
+      return enabledb(ssl, socket, parsed->args[0], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_ENABLEDB)
+   else if (parsed->cmd->action == MANAGEMENT_DISABLEDB)
    {
-      exit_code = enabledb(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
+      return disabledb(ssl, socket, parsed->args[0], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_DISABLEDB)
+   else if (parsed->cmd->action == MANAGEMENT_GRACEFULLY)
    {
-      exit_code = disabledb(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
+      return gracefully(ssl, socket, timeout, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_GRACEFULLY)
+   else if (parsed->cmd->action == MANAGEMENT_SHUTDOWN)
    {
-      exit_code = gracefully(s_ssl, socket, timeout, compression, encryption, output_format);
+      return pgagroal_shutdown(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_SHUTDOWN)
+   else if (parsed->cmd->action == MANAGEMENT_CANCEL_SHUTDOWN)
    {
-      exit_code = pgagroal_shutdown(s_ssl, socket, compression, encryption, output_format);
+      return cancel_shutdown(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CANCEL_SHUTDOWN)
+   else if (parsed->cmd->action == MANAGEMENT_STATUS)
    {
-      exit_code = cancel_shutdown(s_ssl, socket, compression, encryption, output_format);
+      return status(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_STATUS)
+   else if (parsed->cmd->action == MANAGEMENT_DETAILS)
    {
-      exit_code = status(s_ssl, socket, compression, encryption, output_format);
+      return details(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_DETAILS)
+   else if (parsed->cmd->action == MANAGEMENT_PING)
    {
-      exit_code = details(s_ssl, socket, compression, encryption, output_format);
+      return ping(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_PING)
+   else if (parsed->cmd->action == MANAGEMENT_CLEAR)
    {
-      exit_code = ping(s_ssl, socket, compression, encryption, output_format);
+      return clear(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CLEAR)
+   else if (parsed->cmd->action == MANAGEMENT_CLEAR_SERVER)
    {
-      exit_code = clear(s_ssl, socket, compression, encryption, output_format);
+      return clear_server(ssl, socket, parsed->args[0], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CLEAR_SERVER)
+   else if (parsed->cmd->action == MANAGEMENT_CLEAR_AUTH_QUERY)
    {
-      exit_code = clear_server(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
+      return clear_auth_query(ssl, socket, parsed->args[0], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_SWITCH_TO)
+   else if (parsed->cmd->action == MANAGEMENT_SWITCH_TO)
    {
-      exit_code = switch_to(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
+      return switch_to(ssl, socket, parsed->args[0], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_RELOAD)
+   else if (parsed->cmd->action == MANAGEMENT_RELOAD)
    {
-      exit_code = reload(s_ssl, socket, compression, encryption, output_format);
+      return reload(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CONFIG_LS)
+   else if (parsed->cmd->action == MANAGEMENT_CONFIG_LS)
    {
-      exit_code = conf_ls(s_ssl, socket, compression, encryption, output_format);
+      return conf_ls(ssl, socket, compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CONFIG_GET)
+   else if (parsed->cmd->action == MANAGEMENT_CONFIG_GET)
    {
-      if (parsed.args[0])
+      if (parsed->args[0])
       {
-         exit_code = conf_get(s_ssl, socket, parsed.args[0], compression, encryption, output_format);
+         return conf_get(ssl, socket, parsed->args[0], compression, encryption, output_format);
       }
       else
       {
-         exit_code = conf_get(s_ssl, socket, NULL, compression, encryption, output_format);
+         return conf_get(ssl, socket, NULL, compression, encryption, output_format);
       }
    }
-   else if (parsed.cmd->action == MANAGEMENT_CONFIG_SET)
+   else if (parsed->cmd->action == MANAGEMENT_CONFIG_SET)
    {
-      exit_code = conf_set(s_ssl, socket, parsed.args[0], parsed.args[1], compression, encryption, output_format);
+      return conf_set(ssl, socket, parsed->args[0], parsed->args[1], compression, encryption, output_format);
    }
-   else if (parsed.cmd->action == MANAGEMENT_CONFIG_ALIAS)
+   else if (parsed->cmd->action == MANAGEMENT_CONFIG_ALIAS)
    {
-      exit_code = conf_alias(s_ssl, socket, compression, encryption, output_format);
+      return conf_alias(ssl, socket, compression, encryption, output_format);
+   }
+   else if (parsed->cmd->action == MANAGEMENT_TRACKER)
+   {
+      return tracker(ssl, socket, parsed->args[0], compression, encryption, output_format);
+   }
+   else if (parsed->cmd->action == MANAGEMENT_SLOWLOG)
+   {
+      return slowlog(ssl, socket, parsed->args[0], compression, encryption, output_format);
+   }
+   else if (parsed->cmd->action == MANAGEMENT_ACTIVITY)
+   {
+      return activity(ssl, socket, compression, encryption, output_format);
    }
 
-done:
+   return 0;
+}
 
-   if (s_ssl != NULL)
+static int
+batch(SSL* ssl, int* socket, bool remote_connection, char* path, int64_t timeout, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   int exit_code = 0;
+   int count = 0;
+   char* line = NULL;
+   size_t line_size = 0;
+   FILE* file = NULL;
+   size_t command_count = sizeof(command_table) / sizeof(struct pgagroal_command);
+   struct main_configuration* config = (struct main_configuration*)shmem;
+
+   file = !strcmp(path, "-") ? stdin : fopen(path, "r");
+   if (file == NULL)
    {
-      int res;
-      res = SSL_shutdown(s_ssl);
-      if (res == 0)
+      warnx("pgagroal-cli: Could not open batch file <%s>", path);
+      return 1;
+   }
+
+   while (getline(&line, &line_size, file) != -1)
+   {
+      int argc = 1;
+      char* argv[MISC_LENGTH];
+      char* saveptr = NULL;
+      struct pgagroal_parsed_command parsed = {.cmd = NULL, .args = {0}};
+
+      argv[0] = "pgagroal-cli";
+      for (char* t = strtok_r(line, " \t\r\n", &saveptr); t != NULL && argc < MISC_LENGTH; t = strtok_r(NULL, " \t\r\n", &saveptr))
       {
-         SSL_shutdown(s_ssl);
+         argv[argc++] = t;
       }
-      SSL_free(s_ssl);
-   }
 
-   pgagroal_disconnect(socket);
-   pgagroal_stop_logging();
-   pgagroal_destroy_shared_memory(shmem, size);
+      if (argc == 1 || argv[1][0] == '#')
+      {
+         continue;
+      }
 
-   free(password);
+      if (!parse_command(argc, argv, 1, &parsed, command_table, command_count))
+      {
+         exit_code = 1;
+         continue;
+      }
 
-   if (verbose)
+      /* The local management socket serves one command per connection, the remote session stays open */
+      if (!remote_connection && count > 0)
+      {
+         pgagroal_disconnect(*socket);
+         *socket = -1;
+
+         if (pgagroal_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, socket))
+         {
+            warnx("pgagroal-cli: Could not connect to the management socket");
+            exit_code = 1;
+            break;
+         }
+      }
+
+      if (execute(ssl, *socket, &parsed, timeout, compression, encryption, output_format))
+      {
+         exit_code = 1;
+      }
+
+      count++;
+   }
+
+   free(line);
+
+   if (file != stdin)
    {
-      warnx("%s (%d)", exit_code == 0 ? "Success" : "Error", exit_code);
+      fclose(file);
    }
 
    return exit_code;
@@ -956,15 +1143,19 @@ static void
 help_clear(void)
 {
    printf("Reset data\n");
-   printf("  pgagroal-cli clear [prometheus]\n");
+   printf("  pgagroal-cli clear [prometheus|server <server>|auth_query [<user>]]\n");
 }
 
 static void
 help_flush(void)
 {
    printf("Flush connections\n");
-   printf("  pgagroal-cli flush [gracefully|idle|all] [all|<database>]\n");
-   printf("  pgagroal-cli flush [gracefully] [all|<database>] --timeout <DURATION>\n");
+   printf("  pgagroal-cli flush [gracefully|idle|all|progressive] [all|<database>]\n");
+   printf("  pgagroal-cli flush [gracefully|progressive] [all|<database>] --timeout <DURATION>\n");
+   printf("    'progressive' terminates flush_rate idle connections per second, marks the ones in use to be\n");
+   printf("    recycled when they are returned and prefills the replacements. It returns when the flush is\n");
+   printf("    done with the number of connections flushed, recycled and forced. On expiry of '--timeout' the\n");
+   printf("    connections still in use are terminated, still at flush_rate.\n");
    printf("    '--timeout' bounds a graceful flush; DURATION overrides 'flush_timeout' from pgagroal.conf.\n");
    printf("    DURATION is a non-negative number with an optional unit suffix: s (seconds, default), m (minutes),\n");
    printf("    h (hours), d (days), w (weeks); e.g. '30', '30s', '5m', '1h', '2d', '1w'.\n");
@@ -982,6 +1173,31 @@ help_switch_to(void)
    printf("  pgagroal-cli switch-to <server>\n");
 }
 
+static void
+help_tracker(void)
+{
+   printf("Show the tracker events\n");
+   printf("  pgagroal-cli tracker [sequence]\n");
+   printf("    Only the events after [sequence] are shown, pass the returned 'Sequence'\n");
+   printf("    to the next call to follow the events.\n");
+}
+
+static void
+help_slowlog(void)
+{
+   printf("Show the slow connection waits and transactions\n");
+   printf("  pgagroal-cli slowlog [sequence]\n");
+   printf("    Only the entries after [sequence] are shown, pass the returned 'Sequence'\n");
+   printf("    to the next call to follow the entries.\n");
+}
+
+static void
+help_activity(void)
+{
+   printf("Show the state of the clients\n");
+   printf("  pgagroal-cli activity\n");
+}
+
 static void
 display_helper(char* command)
 {
@@ -1030,6 +1246,18 @@ display_helper(char* command)
    {
       help_switch_to();
    }
+   else if (!strcmp(command, COMMAND_TRACKER))
+   {
+      help_tracker();
+   }
+   else if (!strcmp(command, COMMAND_SLOWLOG))
+   {
+      help_slowlog();
+   }
+   else if (!strcmp(command, COMMAND_ACTIVITY))
+   {
+      help_activity();
+   }
    else
    {
       usage();
@@ -1256,6 +1484,26 @@ error:
    return 1;
 }
 
+static int
+clear_auth_query(SSL* ssl, int socket, char* username, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   if (pgagroal_management_request_clear_auth_query(ssl, socket, username, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (process_result(ssl, socket, output_format))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
 switch_to(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -1276,6 +1524,96 @@ error:
    return 1;
 }
 
+static int
+tracker(SSL* ssl, int socket, char* sequence, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   char* end = NULL;
+   long long since = 0;
+
+   if (sequence != NULL)
+   {
+      errno = 0;
+      since = strtoll(sequence, &end, 10);
+
+      if (errno != 0 || end == sequence || *end != '\0' || since < 0)
+      {
+         warnx("pgagroal-cli: Invalid sequence '%s'", sequence);
+         goto error;
+      }
+   }
+
+   if (pgagroal_management_request_tracker(ssl, socket, (int64_t)since, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (process_result(ssl, socket, output_format))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+slowlog(SSL* ssl, int socket, char* sequence, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   char* end = NULL;
+   long long since = 0;
+
+   if (sequence != NULL)
+   {
+      errno = 0;
+      since = strtoll(sequence, &end, 10);
+
+      if (errno != 0 || end == sequence || *end != '\0' || since < 0)
+      {
+         warnx("pgagroal-cli: Invalid sequence '%s'", sequence);
+         goto error;
+      }
+   }
+
+   if (pgagroal_management_request_slowlog(ssl, socket, (int64_t)since, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (process_result(ssl, socket, output_format))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+activity(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   if (pgagroal_management_request_activity(ssl, socket, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (process_result(ssl, socket, output_format))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
 reload(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -2086,6 +2424,9 @@ translate_command(int32_t cmd_code)
       case MANAGEMENT_CLEAR_SERVER:
          command_output = pgagroal_append(command_output, COMMAND_CLEAR_SERVER);
          break;
+      case MANAGEMENT_CLEAR_AUTH_QUERY:
+         command_output = pgagroal_append(command_output, COMMAND_CLEARAUTHQUERY);
+         break;
       case MANAGEMENT_SHUTDOWN:
          command_output = pgagroal_append(command_output, COMMAND_SHUTDOWN);
          break;
@@ -2095,6 +2436,15 @@ translate_command(int32_t cmd_code)
       case MANAGEMENT_SWITCH_TO:
          command_output = pgagroal_append(command_output, COMMAND_SWITCH_TO);
          break;
+      case MANAGEMENT_TRACKER:
+         command_output = pgagroal_append(command_output, COMMAND_TRACKER);
+         break;
+      case MANAGEMENT_SLOWLOG:
+         command_output = pgagroal_append(command_output, COMMAND_SLOWLOG);
+         break;
+      case MANAGEMENT_ACTIVITY:
+         command_output = pgagroal_append(command_output, COMMAND_ACTIVITY);
+         break;
       default:
          break;
    }
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_ACTIVITY_H
+#define PGAGROAL_ACTIVITY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <json.h>
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#define ACTIVITY_STARTING            0
+#define ACTIVITY_IDLE                1
+#define ACTIVITY_ACTIVE              2
+#define ACTIVITY_IDLE_IN_TRANSACTION 3
+#define ACTIVITY_STATES              4
+
+#define ACTIVITY_WAIT_NONE           0
+#define ACTIVITY_WAIT_CONNECTION     1
+#define ACTIVITY_WAIT_SERVER         2
+#define ACTIVITY_WAIT_CLIENT         3
+
+#define ACTIVITY_ENTRIES             (4 * MAX_NUMBER_OF_CONNECTIONS)
+#define ACTIVITY_NAME_LENGTH         64
+
+/** @struct client_activity
+ * Defines the activity of a client, written by its process with plain stores
+ */
+struct client_activity
+{
+   atomic_int pid;                       /**< The process, 0 for a free entry */
+   atomic_int state;                     /**< The state */
+   atomic_int wait;                      /**< The wait reason */
+   atomic_int slot;                      /**< The slot, or -1 */
+   atomic_llong state_change;            /**< The time of the last state change (milliseconds) */
+   long long start;                      /**< The time the client connected (milliseconds) */
+   char username[ACTIVITY_NAME_LENGTH];  /**< The user name */
+   char database[ACTIVITY_NAME_LENGTH];  /**< The database */
+   char appname[ACTIVITY_NAME_LENGTH];   /**< The application name */
+   char address[INET6_ADDRSTRLEN];       /**< The client address */
+} __attribute__((aligned(64)));
+
+/**
+ * Initialize the client activity table
+ * @param p_size The size of the shared memory
+ * @param p_shmem The shared memory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_activity_init(size_t* p_size, void** p_shmem);
+
+/**
+ * Claim the entry of the client of the process
+ * @param address The client address
+ */
+void
+pgagroal_activity_start(char* address);
+
+/**
+ * Set the user name, database and application name of the client
+ * @param username The user name
+ * @param database The database
+ * @param appname The application name, or NULL
+ */
+void
+pgagroal_activity_client(char* username, char* database, char* appname);
+
+/**
+ * Set the state and the wait reason of the client, the state change time
+ * only moves when the state changes
+ * @param state The state
+ * @param wait The wait reason
+ */
+void
+pgagroal_activity_state(int state, int wait);
+
+/**
+ * Set the slot that serves the client
+ * @param slot The slot, or -1
+ */
+void
+pgagroal_activity_slot(int slot);
+
+/**
+ * Release the entry of the client of the process
+ */
+void
+pgagroal_activity_stop(void);
+
+/**
+ * Read the activity of the clients
+ * @param response The response to add the clients to
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_activity_read(struct json* response);
+
+/**
+ * Count the clients per state
+ * @param counts The counts, ACTIVITY_STATES entries
+ */
+void
+pgagroal_activity_count(int* counts);
+
+/**
+ * Get the name of a state
+ * @param state The state
+ * @return The name
+ */
+char*
+pgagroal_activity_state_name(int state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -93,6 +93,44 @@ pgagroal_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsign
 int
 pgagroal_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** dec_buffer, size_t* dec_size, int mode);
 
+/**
+ * Start encrypting a buffer that is provided in pieces, the result has the
+ * same layout as pgagroal_encrypt_buffer()
+ * @param mode The aes mode, only the GCM modes are supported
+ * @param prefix The salt and IV to put in front of the data, PBKDF2_SALT_LENGTH + PBKDF2_IV_LENGTH bytes
+ * @param ctx The resulting cipher context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_encrypt_stream_create(int mode, unsigned char* prefix, EVP_CIPHER_CTX** ctx);
+
+/**
+ * Encrypt the next piece of a buffer
+ * @param ctx The cipher context
+ * @param in The piece
+ * @param length The length of the piece
+ * @param out The encrypted piece, of the same length
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_encrypt_stream_update(EVP_CIPHER_CTX* ctx, unsigned char* in, size_t length, unsigned char* out);
+
+/**
+ * Finish encrypting a buffer
+ * @param ctx The cipher context
+ * @param tag The tag to put after the data, GCM_TAG_LENGTH bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_encrypt_stream_finish(EVP_CIPHER_CTX* ctx, unsigned char* tag);
+
+/**
+ * Release a cipher context
+ * @param ctx The cipher context
+ */
+void
+pgagroal_encrypt_stream_destroy(EVP_CIPHER_CTX* ctx);
+
 /**
  * Clear the thread-local AES cache securely
  */
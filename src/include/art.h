@@ -49,8 +49,9 @@ typedef void (*value_destroy_callback)(void* value);
  */
 struct art
 {
-   struct art_node* root; /**< The root node of ART */
-   uint64_t size;         /**< The size of the ART */
+   struct art_node* root;   /**< The root node of ART */
+   uint64_t size;           /**< The size of the ART */
+   struct art_arena* arena; /**< The memory of the nodes and leaves, NULL until the first insert */
 };
 
 /** @struct art_iterator
@@ -208,7 +209,7 @@ pgagroal_art_to_string(struct art* t, int32_t format, char* tag, int indent);
  * @return 0 on success, 1 if otherwise
  */
 int
-pgagroal_art_destroy(struct art* tree);
+pgagroal_art_destroy(struct art* t);
 
 #ifdef __cplusplus
 }
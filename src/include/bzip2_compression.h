@@ -33,6 +33,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 /**
@@ -55,6 +56,35 @@ pgagroal_bzip2_string(char* s, unsigned char** buffer, size_t* buffer_size);
 int
 pgagroal_bunzip2_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string);
 
+/**
+ * Create a BZip2 stream, the output is the same as for the string based function
+ * @param stream The resulting stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_bzip2_stream_create(void** stream);
+
+/**
+ * BZip2 the next piece of a string
+ * @param stream The stream
+ * @param data The piece
+ * @param length The length of the piece
+ * @param last Is this the last piece
+ * @param buffer The compressed data buffer, grown as needed
+ * @param buffer_size The size of the compressed data buffer
+ * @param buffer_length The length of the compressed data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_bzip2_stream_compress(void* stream, char* data, size_t length, bool last, unsigned char** buffer, size_t* buffer_size, size_t* buffer_length);
+
+/**
+ * Destroy a BZip2 stream
+ * @param stream The stream
+ */
+void
+pgagroal_bzip2_stream_destroy(void* stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_CLUSTER_H
+#define PGAGROAL_CLUSTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <json.h>
+
+#include <stdlib.h>
+
+#define CLUSTER_EXCHANGES 4 /**< The number of exchanges within a lease */
+
+/**
+ * Set the share of every limit entry to an equal part of max_size, which
+ * is what the instance holds until the peers have reported
+ */
+void
+pgagroal_cluster_reset(void);
+
+/**
+ * Exchange the demand of the limit entries with the peers, and update the
+ * share of the instance from it. This function is always in a fork()
+ */
+void
+pgagroal_cluster_exchange(void);
+
+/**
+ * Report the demand and the backend connections of the limit entries to a peer
+ * @param response The response to add the limit entries to
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_cluster_report(struct json* response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -83,7 +83,9 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE            "metrics_cache_max_age"
 #define CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_SIZE           "metrics_cache_max_size"
 #define CONFIGURATION_ARGUMENT_MANAGEMENT                       "management"
+#define CONFIGURATION_ARGUMENT_MANAGEMENT_TIMEOUT               "management_timeout"
 #define CONFIGURATION_ARGUMENT_CONSOLE                          "console"
+#define CONFIGURATION_ARGUMENT_CONSOLE_REFRESH                  "console_refresh"
 #define CONFIGURATION_ARGUMENT_LOG_TYPE                         "log_type"
 #define CONFIGURATION_ARGUMENT_LOG_LEVEL                        "log_level"
 #define CONFIGURATION_ARGUMENT_LOG_PATH                         "log_path"
@@ -96,10 +98,12 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT                 "blocking_timeout"
 #define CONFIGURATION_ARGUMENT_CONNECTION_RETRY_DELAY           "connection_retry_delay"
 #define CONFIGURATION_ARGUMENT_IDLE_TIMEOUT                     "idle_timeout"
+#define CONFIGURATION_ARGUMENT_ADAPTIVE_POOL_INTERVAL           "adaptive_pool_interval"
 #define CONFIGURATION_ARGUMENT_ROTATE_FRONTEND_PASSWORD_TIMEOUT "rotate_frontend_password_timeout"
 #define CONFIGURATION_ARGUMENT_ROTATE_FRONTEND_PASSWORD_LENGTH  "rotate_frontend_password_length"
 #define CONFIGURATION_ARGUMENT_MAX_CONNECTION_AGE               "max_connection_age"
 #define CONFIGURATION_ARGUMENT_FLUSH_TIMEOUT                    "flush_timeout"
+#define CONFIGURATION_ARGUMENT_FLUSH_RATE                       "flush_rate"
 #define CONFIGURATION_ARGUMENT_VALIDATION                       "validation"
 #define CONFIGURATION_ARGUMENT_STARTUP_VALIDATION               "startup_validation"
 #define CONFIGURATION_ARGUMENT_BACKGROUND_INTERVAL              "background_interval"
@@ -107,30 +111,84 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_HEALTH_CHECK_PERIOD              "health_check_period"
 #define CONFIGURATION_ARGUMENT_HEALTH_CHECK_TIMEOUT             "health_check_timeout"
 #define CONFIGURATION_ARGUMENT_HEALTH_CHECK_USER                "health_check_user"
+#define CONFIGURATION_ARGUMENT_REPLICA_APPLICATION_NAME         "replica_application_name"
+#define CONFIGURATION_ARGUMENT_REPLICA_MAX_LAG                  "replica_max_lag"
+#define CONFIGURATION_ARGUMENT_REPLICA_BALANCE                  "replica_balance"
 #define CONFIGURATION_ARGUMENT_MAX_RETRIES                      "max_retries"
 #define CONFIGURATION_ARGUMENT_MAX_CONNECTIONS                  "max_connections"
+#define CONFIGURATION_ARGUMENT_MAX_CONNECTIONS_RESERVE          "max_connections_reserve"
+#define CONFIGURATION_ARGUMENT_PREFILL_CONCURRENCY              "prefill_concurrency"
+#define CONFIGURATION_ARGUMENT_CONNECTION_RATE                  "connection_rate"
+#define CONFIGURATION_ARGUMENT_MAX_QUEUE_LENGTH                 "max_queue_length"
+#define CONFIGURATION_ARGUMENT_CLIENT_CONNECTION_RATE           "client_connection_rate"
 #define CONFIGURATION_ARGUMENT_ALLOW_UNKNOWN_USERS              "allow_unknown_users"
 #define CONFIGURATION_ARGUMENT_AUTHENTICATION_TIMEOUT           "authentication_timeout"
 #define CONFIGURATION_ARGUMENT_PIPELINE                         "pipeline"
 #define CONFIGURATION_ARGUMENT_AUTH_QUERY                       "auth_query"
+#define CONFIGURATION_ARGUMENT_AUTH_QUERY_CACHE_TIMEOUT         "auth_query_cache_timeout"
 #define CONFIGURATION_ARGUMENT_FAILOVER                         "failover"
 #define CONFIGURATION_ARGUMENT_FAILOVER_SCRIPT                  "failover_script"
 #define CONFIGURATION_ARGUMENT_FAILOVER_NOTIFY_SCRIPT           "failover_notify_script"
 #define CONFIGURATION_ARGUMENT_TLS                              "tls"
+#define CONFIGURATION_ARGUMENT_TLS_DIRECT                       "tls_direct"
 #define CONFIGURATION_ARGUMENT_TLS_CERT_FILE                    "tls_cert_file"
 #define CONFIGURATION_ARGUMENT_TLS_KEY_FILE                     "tls_key_file"
 #define CONFIGURATION_ARGUMENT_TLS_CA_FILE                      "tls_ca_file"
+#define CONFIGURATION_ARGUMENT_TLS_KTLS                         "tls_ktls"
 #define CONFIGURATION_ARGUMENT_METRICS_CERT_FILE                "metrics_cert_file"
 #define CONFIGURATION_ARGUMENT_METRICS_KEY_FILE                 "metrics_key_file"
 #define CONFIGURATION_ARGUMENT_METRICS_CA_FILE                  "metrics_ca_file"
 #define CONFIGURATION_ARGUMENT_EV_BACKEND                       "ev_backend"
+#define CONFIGURATION_ARGUMENT_IO_URING_BATCH                   "io_uring_batch"
+#define CONFIGURATION_ARGUMENT_IO_URING_SQPOLL                  "io_uring_sqpoll"
+#define CONFIGURATION_ARGUMENT_IO_URING_SQPOLL_CPU              "io_uring_sqpoll_cpu"
+#define CONFIGURATION_ARGUMENT_IO_URING_ZERO_COPY               "io_uring_zero_copy"
+#define CONFIGURATION_ARGUMENT_EV_EDGE_TRIGGERED                "ev_edge_triggered"
+#define CONFIGURATION_ARGUMENT_COALESCE_WRITES                  "coalesce_writes"
+#define CONFIGURATION_ARGUMENT_METRICS_ACCOUNTING               "metrics_accounting"
+#define CONFIGURATION_ARGUMENT_PERFORMANCE_SPLICE               "performance_splice"
 #define CONFIGURATION_ARGUMENT_KEEP_ALIVE                       "keep_alive"
 #define CONFIGURATION_ARGUMENT_NODELAY                          "nodelay"
+#define CONFIGURATION_ARGUMENT_TCP_USER_TIMEOUT                 "tcp_user_timeout"
+#define CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_IDLE               "tcp_keepalive_idle"
+#define CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_INTERVAL           "tcp_keepalive_interval"
+#define CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_COUNT              "tcp_keepalive_count"
+#define CONFIGURATION_ARGUMENT_WRITE_TIMEOUT                    "write_timeout"
+#define CONFIGURATION_ARGUMENT_DNS_CACHE_TTL                    "dns_cache_ttl"
+#define CONFIGURATION_ARGUMENT_CONNECT_TIMEOUT                  "connect_timeout"
 #define CONFIGURATION_ARGUMENT_BACKLOG                          "backlog"
+#define CONFIGURATION_ARGUMENT_PREFORK_WORKERS                  "prefork_workers"
+#define CONFIGURATION_ARGUMENT_STARTUP_GATE                     "startup_gate"
+#define CONFIGURATION_ARGUMENT_MULTIPLEX_WORKERS                "multiplex_workers"
+#define CONFIGURATION_ARGUMENT_LOG_ASYNC                        "log_async"
+#define CONFIGURATION_ARGUMENT_LAZY_RESET                       "lazy_reset"
+#define CONFIGURATION_ARGUMENT_TRANSACTION_STICKINESS           "transaction_stickiness"
+#define CONFIGURATION_ARGUMENT_BUSY_POLL                        "busy_poll"
+#define CONFIGURATION_ARGUMENT_IDLE_TRANSACTION_TIMEOUT         "idle_transaction_timeout"
+#define CONFIGURATION_ARGUMENT_IDLE_TRANSACTION_ACTION          "idle_transaction_action"
+#define CONFIGURATION_ARGUMENT_NOTIFY_RELAY                     "notify_relay"
+#define CONFIGURATION_ARGUMENT_QUERY_CACHE_MAX_SIZE             "query_cache_max_size"
+#define CONFIGURATION_ARGUMENT_QUERY_CACHE_MAX_AGE              "query_cache_max_age"
+#define CONFIGURATION_ARGUMENT_QUERY_STATISTICS                 "query_statistics"
+#define CONFIGURATION_ARGUMENT_QUERY_STATISTICS_SAMPLE          "query_statistics_sample"
+#define CONFIGURATION_ARGUMENT_QUERY_STATISTICS_TOP             "query_statistics_top"
+#define CONFIGURATION_ARGUMENT_ACCEPTORS                        "acceptors"
 #define CONFIGURATION_ARGUMENT_HUGEPAGE                         "hugepage"
+#define CONFIGURATION_ARGUMENT_NUMA_NODE                        "numa_node"
 #define CONFIGURATION_ARGUMENT_TRACKER                          "tracker"
+#define CONFIGURATION_ARGUMENT_SLOW_ACQUIRE_THRESHOLD           "slow_acquire_threshold"
+#define CONFIGURATION_ARGUMENT_SLOW_TRANSACTION_THRESHOLD       "slow_transaction_threshold"
 #define CONFIGURATION_ARGUMENT_TRACK_PREPARED_STATEMENTS        "track_prepared_statements"
+#define CONFIGURATION_ARGUMENT_TRACK_SESSION_PARAMETERS         "track_session_parameters"
 #define CONFIGURATION_ARGUMENT_PIDFILE                          "pidfile"
+#define CONFIGURATION_ARGUMENT_CLUSTER_PEERS                    "cluster_peers"
+#define CONFIGURATION_ARGUMENT_CLUSTER_USER                     "cluster_user"
+#define CONFIGURATION_ARGUMENT_CLUSTER_LEASE                    "cluster_lease"
+#define CONFIGURATION_ARGUMENT_TUNNEL                           "tunnel"
+#define CONFIGURATION_ARGUMENT_TUNNEL_LINKS                     "tunnel_links"
+#define CONFIGURATION_ARGUMENT_TUNNEL_COMPRESSION               "tunnel_compression"
+#define CONFIGURATION_ARGUMENT_TUNNEL_TLS                       "tunnel_tls"
+#define CONFIGURATION_ARGUMENT_TUNNEL_PORT                      "tunnel_port"
 #define CONFIGURATION_ARGUMENT_UPDATE_PROCESS_TITLE             "update_process_title"
 #define CONFIGURATION_ARGUMENT_PRIMARY                          "primary"
 
@@ -166,6 +224,8 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_LIMIT_MAX_SIZE          "max_size"
 #define CONFIGURATION_ARGUMENT_LIMIT_MIN_SIZE          "min_size"
 #define CONFIGURATION_ARGUMENT_LIMIT_INITIAL_SIZE      "initial_size"
+#define CONFIGURATION_ARGUMENT_LIMIT_GUARANTEED_SIZE   "guaranteed_size"
+#define CONFIGURATION_ARGUMENT_LIMIT_PRIORITY          "priority"
 #define CONFIGURATION_ARGUMENT_LIMIT_ALIASES           "aliases"
 #define CONFIGURATION_ARGUMENT_LIMIT_NUMBER_OF_ALIASES "number_of_aliases"
 #define CONFIGURATION_ARGUMENT_LIMIT_LINENO            "line_number"
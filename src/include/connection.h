@@ -41,12 +41,19 @@ extern "C" {
 
 #include <openssl/ssl.h>
 
-#define CONNECTION_TRANSFER    0
-#define CONNECTION_RETURN      1
-#define CONNECTION_KILL        2
-#define CONNECTION_CLIENT_FD   3
-#define CONNECTION_REMOVE_FD   4
-#define CONNECTION_CLIENT_DONE 5
+#define CONNECTION_TRANSFER        0
+#define CONNECTION_RETURN          1
+#define CONNECTION_KILL            2
+#define CONNECTION_CLIENT_FD       3
+#define CONNECTION_REMOVE_FD       4
+#define CONNECTION_CLIENT_DONE     5
+#define CONNECTION_MULTIPLEX       6
+#define CONNECTION_NOTIFY          7
+#define CONNECTION_NOTIFY_LISTEN   8
+#define CONNECTION_NOTIFY_UNLISTEN 9
+#define CONNECTION_TAKEOVER        10
+#define CONNECTION_TUNNEL          11
+#define CONNECTION_CONSOLE         12
 
 /**
  * Connection: Get a connection
@@ -56,6 +63,27 @@ extern "C" {
 int
 pgagroal_connection_get(int* client_fd);
 
+/**
+ * Connection: Put back a connection from pgagroal_connection_get. The
+ * connection of a batch stays open until the batch ends
+ * @param client_fd The client descriptor
+ */
+void
+pgagroal_connection_put(int client_fd);
+
+/**
+ * Connection: Begin a batch, where the transfers to the main process share
+ * one connection. Batches nest
+ */
+void
+pgagroal_connection_batch_begin(void);
+
+/**
+ * Connection: End a batch, and close its connection
+ */
+void
+pgagroal_connection_batch_end(void);
+
 /**
  * Connection: Get a connection based on a PID
  * @param client_fd The client descriptor
@@ -91,6 +119,16 @@ pgagroal_connection_id_read(int client_fd, int* id);
 int
 pgagroal_connection_transfer_write(int client_fd, int32_t slot);
 
+/**
+ * Connection: Transfer an arbitrary descriptor
+ * @param client_fd The client descriptor
+ * @param slot The slot, or -1 if the descriptor isn't a server connection
+ * @param fd The file descriptor to transfer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_connection_fd_write(int client_fd, int32_t slot, int fd);
+
 /**
  * Connection: Transfer read
  * @param client_fd The client descriptor
@@ -149,6 +187,26 @@ pgagroal_connection_pid_write(int client_fd, pid_t pid);
 int
 pgagroal_connection_pid_read(int client_fd, pid_t* pid);
 
+/**
+ * Connection: Buffer write
+ * @param client_fd The client descriptor
+ * @param buf The buffer
+ * @param size The size of the buffer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_connection_buffer_write(int client_fd, void* buf, size_t size);
+
+/**
+ * Connection: Buffer read
+ * @param client_fd The client descriptor
+ * @param buf The buffer
+ * @param size The size of the buffer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_connection_buffer_read(int client_fd, void* buf, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
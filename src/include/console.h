@@ -43,6 +43,23 @@ extern "C" {
 void
 pgagroal_console(SSL* client_ssl, int client_fd);
 
+/**
+ * Run the console process. The process keeps the rendered console page,
+ * refreshes it while it is watched, and serves the requests handed over
+ * by the main process from it
+ * @param argv The argv
+ */
+void
+pgagroal_console_cache(char** argv) __attribute__((noreturn));
+
+/**
+ * Hand a console client over to the console process
+ * @param client_fd The client descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_console_hand_off(int client_fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,11 +55,13 @@ struct deque_node
  */
 struct deque
 {
-   uint32_t size;            /**< The size of the deque */
-   bool thread_safe;         /**< If the deque is thread safe */
-   pthread_rwlock_t mutex;   /**< The mutex of the deque */
-   struct deque_node* start; /**< The start node */
-   struct deque_node* end;   /**< The end node */
+   uint32_t size;              /**< The size of the deque */
+   bool thread_safe;           /**< If the deque is thread safe */
+   pthread_rwlock_t mutex;     /**< The mutex of the deque */
+   struct deque_node* start;   /**< The start node */
+   struct deque_node* end;     /**< The end node */
+   struct deque_block* blocks; /**< The blocks the nodes are allocated from */
+   struct deque_node* free;    /**< The released nodes */
 };
 
 /**
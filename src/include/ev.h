@@ -59,16 +59,20 @@ extern "C" {
 #include <sys/signalfd.h>
 #endif /* HAVE_LINUX */
 
-#define EXPERIMENTAL_FEATURE_ZERO_COPY_ENABLED      0
 #define EXPERIMENTAL_FEATURE_FAST_POLL_ENABLED      0
 #define EXPERIMENTAL_FEATURE_USE_HUGE_ENABLED       0
-#define EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED 0
 #define EXPERIMENTAL_FEATURE_IOVECS                 0
 #define PGAGROAL_CONTEXT_MAIN                       0
 #define PGAGROAL_CONTEXT_VAULT                      1
 
 #define ALIGNMENT                                   sysconf(_SC_PAGESIZE)
 #define MAX_EVENTS                                  32
+#define MAX_ACCEPTS                                 64
+#define MAX_READS                                   64 /* Callbacks per edge-triggered wakeup */
+#define IO_URING_BUFFERS                            16 /* Provided buffers per loop, power of two */
+#define IO_URING_BUFFER_GROUP                       0
+#define IO_URING_BATCH_SIZE                         32   /* Deferred sends per loop pass */
+#define IO_URING_SQPOLL_IDLE                        1000 /* Milliseconds before the SQ thread sleeps */
 #define INITIAL_BUFFER_COUNT                        1
 #if HAVE_LINUX
 #define PGAGROAL_NSIG _NSIG
@@ -121,6 +125,7 @@ struct event_loop;
 typedef struct event_watcher
 {
    enum event_type type; /**<Type of the watcher. */
+   int index;            /**< Position in the list of events of the loop */
 } event_watcher_t;
 
 /**
@@ -177,7 +182,7 @@ struct periodic_watcher
    struct __kernel_timespec ts; /**< Timespec struct for io_uring loop. */
 #endif
 #if HAVE_LINUX
-   int fd; /**< File descriptor for epoll-based periodic watcher. */
+   int64_t deadline; /**< Next expiry in CLOCK_MONOTONIC nanoseconds, 0 when idle (epoll backend). */
 #else
    int64_t interval; /**< Interval for kqueue timer. */
 #endif                /* HAVE_LINUX */
@@ -196,21 +201,31 @@ struct event_loop
 {
    atomic_bool running;                 /**< Flag indicating if the event loop is running. */
    sigset_t sigset;                     /**< Signal set used for handling signals in the event loop. */
-   event_watcher_t* events[MAX_EVENTS]; /**< List of events */
+   event_watcher_t** events;            /**< List of events */
    int events_nr;                       /**< Size of list of events */
+   int events_size;                     /**< Capacity of the list of events */
 
 #if HAVE_LINUX && HAVE_IO_URING
    struct
    {
       struct io_uring_buf_ring* br; /**< Buffer ring used internally by io_uring */
-      void* buf;                    /**< Pointer to the actual buffer being used */
-      bool pending_send;            /**< A send is still pending */
+      void* buf;                    /**< The memory backing the provided buffers */
       int cnt;                      /**< The number of buffers */
    } br;                            /**< The buffer ring struct */
 
+   struct
+   {
+      int fd;                          /**< The socket to send on */
+      int bid;                         /**< The provided buffer holding the data */
+      void* data;                      /**< The data */
+      ssize_t length;                  /**< The length of the data */
+   } sends[IO_URING_BATCH_SIZE];       /**< Sends deferred until the end of the loop pass */
+   int sends_nr;                       /**< The number of deferred sends */
+   int lent;                           /**< The buffer lent to the running callback, or -1 */
+   int held[IO_URING_BUFFERS];         /**< The number of deferred sends per buffer */
+
    struct io_uring ring_rcv; /**< io_uring ring for receive operations */
    struct io_uring ring_snd; /**< io_uring ring for send operations (separate to avoid CQE mixing) */
-   int bid;                  /**< Next buffer id */
 #if EXPERIMENTAL_FEATURE_IOVECS
    /* XXX: Test with iovecs for send/recv io_uring */
    int iovecs_nr;
@@ -219,12 +234,14 @@ struct event_loop
 #endif /* HAVE_LINUX && HAVE_IO_URING */
 #if HAVE_LINUX
    int epollfd; /**< File descriptor for the epoll instance (used with epoll backend). */
+   int timerfd; /**< Timer shared by all periodic watchers (used with epoll backend). */
 #else
    int kqueuefd; /**< File descriptor for the kqueue instance (used with kqueue backend). */
 #endif                 /* HAVE_LINUX */
    void* buffer;       /**< Pointer to a buffer used to read in bytes. */
    pid_t owner_pid;    /**< PID of the process that owns this event loop instance. */
    atomic_bool forked; /**< True in children after pgagroal_event_loop_fork() is called. */
+   int busy_poll;      /**< The microseconds to spin for events before blocking, 0 for none */
 };
 
 /**
@@ -276,6 +293,14 @@ pgagroal_event_loop_destroy(void);
 int
 pgagroal_event_loop_fork(void);
 
+/**
+ * Spin for events without blocking for a while before each wait of the loop,
+ * trading CPU for the wakeup latency
+ * @param usec The microseconds to spin, 0 for none
+ */
+void
+pgagroal_event_loop_busy_poll(int usec);
+
 /**
  * Check if the event loop is currently running
  * @param loop Pointer to the event loop struct
@@ -389,7 +414,8 @@ struct message;
  *
  * Prepares and submits an asynchronous send operation for the given message via io_uring.
  * The function sets up the submission queue entry (SQE), submits it, and waits for the completion.
- * The number of bytes sent is then returned.
+ * The number of bytes sent is then returned. With io_uring_batch, data that still lives in the
+ * received buffer is queued instead and submitted with the other sends of the loop pass.
  *
  * @param watcher Pointer to the I/O watcher structure.
  * @param msg Pointer to the message structure containing data to send.
@@ -399,6 +425,15 @@ struct message;
 int
 pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg);
 
+/**
+ * @brief Submit the sends deferred by io_uring batching.
+ *
+ * Does nothing unless the io_uring backend runs with io_uring_batch. Called before
+ * any write that bypasses the event loop so the data on a socket stays in order.
+ */
+void
+pgagroal_event_flush_sends(void);
+
 /**
  * @brief Submit a send operation from outside the event loop using io_uring.
  *
@@ -42,6 +42,9 @@ extern "C" {
 /* System */
 #include <stdarg.h>
 
+#define JSON_WRITER_MAX_DEPTH  16
+#define JSON_WRITER_CHUNK_SIZE 65536
+
 enum json_type {
    JSONUnknown,
    JSONItem,
@@ -201,6 +204,16 @@ pgagroal_json_iterator_destroy(struct json_iterator* iter);
 int
 pgagroal_json_parse_string(char* str, struct json** obj);
 
+/**
+ * Parse a buffer into json item, the strings are decoded in place
+ * so the buffer is modified and can't be reused as JSON afterwards
+ * @param str The buffer, owned by the caller
+ * @param obj [out] The json object
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgagroal_json_parse_buffer(char* str, struct json** obj);
+
 /**
  * Clone a json object
  * @param from The from object
@@ -285,6 +298,129 @@ pgagroal_json_put_time_value(struct json* res, char* key, pgagroal_time_t t, enu
 void
 pgagroal_json_put_size_value(struct json* res, char* key, unsigned int bytes);
 
+/** @struct json_writer
+ * Writes compact JSON text directly into a buffer, the buffer is kept
+ * between uses of the writer. With a sink the text is handed over in
+ * chunks of JSON_WRITER_CHUNK_SIZE instead of being kept in full
+ */
+struct json_writer
+{
+   char* data;                                          /**< The buffer */
+   size_t size;                                         /**< The size of the buffer */
+   size_t length;                                       /**< The length of the text */
+   size_t flushed;                                      /**< The length of the text handed to the sink */
+   int depth;                                           /**< The nesting depth */
+   bool first[JSON_WRITER_MAX_DEPTH];                   /**< Is the next member the first at the depth */
+   bool error;                                          /**< Has an error occurred */
+   int (*flush)(void* sink, char* data, size_t length); /**< The sink callback */
+   void* sink;                                          /**< The sink */
+};
+
+/**
+ * Start a new document, keeping the buffer
+ * @param writer The writer
+ */
+void
+pgagroal_json_writer_reset(struct json_writer* writer);
+
+/**
+ * Hand the text to a sink in chunks, must be set after a reset
+ * @param writer The writer
+ * @param flush The sink callback, 0 upon success, otherwise 1
+ * @param sink The sink
+ */
+void
+pgagroal_json_writer_sink(struct json_writer* writer, int (*flush)(void* sink, char* data, size_t length), void* sink);
+
+/**
+ * Begin an object
+ * @param writer The writer
+ * @param key The key, or NULL inside an array or at the top
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_begin_object(struct json_writer* writer, char* key);
+
+/**
+ * End an object
+ * @param writer The writer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_end_object(struct json_writer* writer);
+
+/**
+ * Begin an array
+ * @param writer The writer
+ * @param key The key, or NULL inside an array or at the top
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_begin_array(struct json_writer* writer, char* key);
+
+/**
+ * End an array
+ * @param writer The writer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_end_array(struct json_writer* writer);
+
+/**
+ * Write a string member, NULL is written as null
+ * @param writer The writer
+ * @param key The key, or NULL inside an array
+ * @param value The value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_string(struct json_writer* writer, char* key, char* value);
+
+/**
+ * Write an integer member
+ * @param writer The writer
+ * @param key The key, or NULL inside an array
+ * @param value The value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_int(struct json_writer* writer, char* key, int64_t value);
+
+/**
+ * Write a boolean member
+ * @param writer The writer
+ * @param key The key, or NULL inside an array
+ * @param value The value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_bool(struct json_writer* writer, char* key, bool value);
+
+/**
+ * Write a JSON object as a member
+ * @param writer The writer
+ * @param key The key, or NULL inside an array
+ * @param value The JSON object
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_json_writer_json(struct json_writer* writer, char* key, struct json* value);
+
+/**
+ * Finish the document, the rest of the text is handed to the sink if there is one
+ * @param writer The writer
+ * @return 0 if the text is a complete document, otherwise 1
+ */
+int
+pgagroal_json_writer_finish(struct json_writer* writer);
+
+/**
+ * Release the buffer of a writer
+ * @param writer The writer
+ */
+void
+pgagroal_json_writer_destroy(struct json_writer* writer);
+
 #ifdef __cplusplus
 }
 #endif
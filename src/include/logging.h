@@ -35,7 +35,9 @@ extern "C" {
 
 #include <utils.h>
 
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #define PGAGROAL_LOGGING_TYPE_CONSOLE            0
 #define PGAGROAL_LOGGING_TYPE_FILE               1
@@ -58,6 +60,9 @@ extern "C" {
 
 #define PGAGROAL_LOGGING_DEFAULT_LOG_LINE_PREFIX "%Y-%m-%d %H:%M:%S"
 
+#define PGAGROAL_LOGGING_RING_LINES              2048
+#define PGAGROAL_LOGGING_RING_LINE_LENGTH        1024
+
 #define pgagroal_log_trace(...)                  pgagroal_log_line(PGAGROAL_LOGGING_LEVEL_DEBUG5, __FILE__, __LINE__, __VA_ARGS__)
 #define pgagroal_log_debug(...)                  pgagroal_log_line(PGAGROAL_LOGGING_LEVEL_DEBUG1, __FILE__, __LINE__, __VA_ARGS__)
 #define pgagroal_log_info(...)                   pgagroal_log_line(PGAGROAL_LOGGING_LEVEL_INFO, __FILE__, __LINE__, __VA_ARGS__)
@@ -92,6 +97,52 @@ pgagroal_start_logging(void);
 int
 pgagroal_stop_logging(void);
 
+/** @struct log_ring_line
+ * A formatted line in the asynchronous log ring
+ */
+struct log_ring_line
+{
+   atomic_ullong sequence;                       /**< The ticket of the line */
+   int level;                                    /**< The log level */
+   int length;                                   /**< The length of the text */
+   char text[PGAGROAL_LOGGING_RING_LINE_LENGTH]; /**< The formatted text */
+} __attribute__((aligned(64)));
+
+/** @struct log_ring
+ * The asynchronous log ring, filled by all processes and drained by the logger process
+ */
+struct log_ring
+{
+   atomic_bool running;                                     /**< Is the logger process running */
+   atomic_int pid;                                          /**< The pid of the logger process */
+   atomic_ullong head;                                      /**< The next ticket for a producer */
+   atomic_ullong tail;                                      /**< The next ticket for the logger */
+   struct log_ring_line lines[PGAGROAL_LOGGING_RING_LINES]; /**< The lines */
+};
+
+/**
+ * Create the shared memory for the asynchronous log ring
+ * @param size The resulting size
+ * @param shmem The resulting shared memory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_log_ring_init(size_t* size, void** shmem);
+
+/**
+ * Start the logger process that drains the asynchronous log ring
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_log_ring_start(void);
+
+/**
+ * Stop the logger process, the remaining lines are written before it exits
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_log_ring_stop(void);
+
 /**
  * Log a line
  * @param level The level
@@ -57,6 +57,29 @@ pgagroal_lz4c_string(char* s, unsigned char** buffer, size_t* buffer_size);
 int
 pgagroal_lz4d_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string);
 
+/**
+ * LZ4 compress a buffer into a buffer of the caller
+ * @param source The data
+ * @param source_size The size of the data
+ * @param destination The compressed data buffer
+ * @param capacity The capacity of the compressed data buffer
+ * @param size The size of the compressed data
+ * @return 0 upon success, otherwise 1 when the data doesn't compress into the capacity
+ */
+int
+pgagroal_lz4c_buffer(void* source, size_t source_size, void* destination, size_t capacity, size_t* size);
+
+/**
+ * LZ4 decompress a buffer of a known original size into a buffer of the caller
+ * @param source The compressed data
+ * @param source_size The size of the compressed data
+ * @param destination The data buffer, at least the original size
+ * @param size The original size
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_lz4d_buffer(void* source, size_t source_size, void* destination, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
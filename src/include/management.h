@@ -92,13 +92,22 @@ extern "C" {
 #define MANAGEMENT_UPDATE_USER     21
 #define MANAGEMENT_REMOVE_USER     22
 #define MANAGEMENT_LIST_USERS      23
+
+#define MANAGEMENT_TRACKER         24
+#define MANAGEMENT_CLEAR_AUTH_QUERY 25
+#define MANAGEMENT_SLOWLOG         26
+#define MANAGEMENT_ACTIVITY        27
+#define MANAGEMENT_CLUSTER         28
 /**
  * Management arguments
  */
 #define MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS  "ActiveConnections"
+#define MANAGEMENT_ARGUMENT_ADDRESS             "Address"
 #define MANAGEMENT_ARGUMENT_APPNAME             "AppName"
+#define MANAGEMENT_ARGUMENT_BACKENDS            "Backends"
 #define MANAGEMENT_ARGUMENT_BEHIND              "Behind"
 #define MANAGEMENT_ARGUMENT_CLIENT_VERSION      "ClientVersion"
+#define MANAGEMENT_ARGUMENT_CLIENTS             "Clients"
 #define MANAGEMENT_ARGUMENT_COMMAND             "Command"
 #define MANAGEMENT_ARGUMENT_COMPRESSION         "Compression"
 #define MANAGEMENT_ARGUMENT_CONFIG_KEY          "ConfigKey"
@@ -106,30 +115,47 @@ extern "C" {
 #define MANAGEMENT_ARGUMENT_CONNECTIONS         "Connections"
 #define MANAGEMENT_ARGUMENT_DATABASE            "Database"
 #define MANAGEMENT_ARGUMENT_DATABASES           "Databases"
+#define MANAGEMENT_ARGUMENT_DEMAND              "Demand"
+#define MANAGEMENT_ARGUMENT_DURATION            "Duration"
 #define MANAGEMENT_ARGUMENT_ENABLED             "Enabled"
 #define MANAGEMENT_ARGUMENT_ENCRYPTION          "Encryption"
+#define MANAGEMENT_ARGUMENT_ENTRIES             "Entries"
 #define MANAGEMENT_ARGUMENT_ERROR               "Error"
+#define MANAGEMENT_ARGUMENT_EVENT               "Event"
+#define MANAGEMENT_ARGUMENT_EVENTS              "Events"
 #define MANAGEMENT_ARGUMENT_FD                  "FD"
+#define MANAGEMENT_ARGUMENT_FLUSHED             "Flushed"
+#define MANAGEMENT_ARGUMENT_FORCED              "Forced"
 #define MANAGEMENT_ARGUMENT_HOST                "Host"
 #define MANAGEMENT_ARGUMENT_INITIAL_CONNECTIONS "InitialConnections"
+#define MANAGEMENT_ARGUMENT_KIND                "Kind"
+#define MANAGEMENT_ARGUMENT_LIMIT_RULE          "LimitRule"
 #define MANAGEMENT_ARGUMENT_LIMITS              "Limits"
 #define MANAGEMENT_ARGUMENT_MAJOR_VERSION       "MajorVersion"
 #define MANAGEMENT_ARGUMENT_MAX_CONNECTIONS     "MaxConnections"
 #define MANAGEMENT_ARGUMENT_MIN_CONNECTIONS     "MinConnections"
 #define MANAGEMENT_ARGUMENT_MODE                "Mode"
 #define MANAGEMENT_ARGUMENT_TIMEOUT             "Timeout"
+#define MANAGEMENT_ARGUMENT_NUMBER_OF_CLIENTS   "NumberOfClients"
 #define MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS   "NumberOfServers"
+#define MANAGEMENT_ARGUMENT_OUTCOME             "Outcome"
 #define MANAGEMENT_ARGUMENT_OUTPUT              "Output"
 #define MANAGEMENT_ARGUMENT_PASSWORD            "Password"
 #define MANAGEMENT_ARGUMENT_PID                 "PID"
 #define MANAGEMENT_ARGUMENT_PORT                "Port"
 #define MANAGEMENT_ARGUMENT_PRIMARY             "Primary"
+#define MANAGEMENT_ARGUMENT_QUOTA               "Quota"
+#define MANAGEMENT_ARGUMENT_RECYCLED            "Recycled"
 #define MANAGEMENT_ARGUMENT_RESTART             "Restart"
 #define MANAGEMENT_ARGUMENT_SERVER              "Server"
 #define MANAGEMENT_ARGUMENT_SERVERS             "Servers"
+#define MANAGEMENT_ARGUMENT_SERVER_DURATION     "ServerDuration"
 #define MANAGEMENT_ARGUMENT_SERVER_VERSION      "ServerVersion"
+#define MANAGEMENT_ARGUMENT_SEQUENCE            "Sequence"
+#define MANAGEMENT_ARGUMENT_SLOT                "Slot"
 #define MANAGEMENT_ARGUMENT_START_TIME          "StartTime"
 #define MANAGEMENT_ARGUMENT_STATE               "State"
+#define MANAGEMENT_ARGUMENT_STATE_CHANGE        "StateChange"
 #define MANAGEMENT_ARGUMENT_SYSTEM_IDENTIFIER   "SystemIdentifier"
 #define MANAGEMENT_ARGUMENT_HEALTH              "Health"
 #define MANAGEMENT_ARGUMENT_STATUS              "Status"
@@ -137,6 +163,7 @@ extern "C" {
 #define MANAGEMENT_ARGUMENT_TIMESTAMP           "Timestamp"
 #define MANAGEMENT_ARGUMENT_TOTAL_CONNECTIONS   "TotalConnections"
 #define MANAGEMENT_ARGUMENT_USERNAME            "Username"
+#define MANAGEMENT_ARGUMENT_WAIT                "Wait"
 
 /**
  * Management error
@@ -175,6 +202,14 @@ extern "C" {
 
 #define MANAGEMENT_ERROR_SWITCH_TO_FAILED                   1300
 
+#define MANAGEMENT_ERROR_TRACKER_ERROR                      1400
+
+#define MANAGEMENT_ERROR_SLOWLOG_ERROR                      1500
+
+#define MANAGEMENT_ERROR_ACTIVITY_ERROR                     1600
+
+#define MANAGEMENT_ERROR_CLUSTER_ERROR                      1700
+
 /**
  * Output formats
  */
@@ -182,6 +217,21 @@ extern "C" {
 #define MANAGEMENT_OUTPUT_FORMAT_JSON 1
 #define MANAGEMENT_OUTPUT_FORMAT_RAW  2
 
+/** @struct management_stream
+ * A management response that is written in pieces, the pieces are
+ * compressed as they arrive and encrypted and encoded on the way to the socket
+ */
+struct management_stream
+{
+   uint8_t compression;  /**< The compress method for wire protocol */
+   uint8_t encryption;   /**< The encrypt method for wire protocol */
+   int mode;             /**< The aes mode */
+   void* compressor;     /**< The compression stream */
+   unsigned char* data;  /**< The compressed, or raw, data */
+   size_t size;          /**< The size of the data buffer */
+   size_t length;        /**< The length of the data */
+};
+
 /**
  * Create header for management command
  * @param command The command
@@ -368,6 +418,19 @@ pgagroal_management_request_clear(SSL* ssl, int socket, uint8_t compression, uin
 int
 pgagroal_management_request_clear_server(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, int32_t output_format);
 
+/**
+ * Management operation: Clear the authentication query cache
+ * @param ssl The SSL connection
+ * @param socket The socket
+ * @param username The user name, or "all" for all users
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_request_clear_auth_query(SSL* ssl, int socket, char* username, uint8_t compression, uint8_t encryption, int32_t output_format);
+
 /**
  * Management operation: Switch to
  * @param ssl The SSL connection
@@ -491,6 +554,56 @@ pgagroal_management_request_get_password(SSL* ssl, int socket, char* username, u
 int
 pgagroal_management_request_conf_alias(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 
+/**
+ * Management operation: Tracker
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param sequence The last sequence number already seen
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_request_tracker(SSL* ssl, int socket, int64_t sequence, uint8_t compression, uint8_t encryption, int32_t output_format);
+
+/**
+ * Management operation: Slow log
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param sequence The last sequence number already seen
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_request_slowlog(SSL* ssl, int socket, int64_t sequence, uint8_t compression, uint8_t encryption, int32_t output_format);
+
+/**
+ * Management operation: Activity
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_request_activity(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
+
+/**
+ * Management operation: Cluster
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_request_cluster(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
+
 /**
  * Create an ok response
  * @param ssl The SSL connection
@@ -552,6 +665,55 @@ pgagroal_management_read_json(SSL* ssl, int socket, uint8_t* compression, uint8_
 int
 pgagroal_management_write_json(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json);
 
+/**
+ * Write management JSON text that is already serialized
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param text The JSON text
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_write_text(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, char* text);
+
+/**
+ * Create a management stream
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol (None or *_GCM)
+ * @param stream The resulting stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_stream_create(uint8_t compression, uint8_t encryption, struct management_stream** stream);
+
+/**
+ * Write the next piece of JSON text to a management stream
+ * @param stream The stream
+ * @param data The piece
+ * @param length The length of the piece
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_stream_write(struct management_stream* stream, char* data, size_t length);
+
+/**
+ * Send a management stream
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param stream The stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_management_stream_send(SSL* ssl, int socket, struct management_stream* stream);
+
+/**
+ * Destroy a management stream
+ * @param stream The stream
+ */
+void
+pgagroal_management_stream_destroy(struct management_stream* stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,8 +36,15 @@ extern "C" {
 #include <pgagroal.h>
 #include <message.h>
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#define MEMORY_SMALL_SIZE    1024
+#define MEMORY_MEDIUM_SIZE   16384
+#define MEMORY_LARGE_SIZE    DEFAULT_BUFFER_SIZE
+#define MEMORY_CACHED_BLOCKS 32
+
 /**
  * Initialize a memory segment for the process local message structure
  */
@@ -58,11 +65,37 @@ void
 pgagroal_memory_free(void);
 
 /**
- * Destroy the memory segment
+ * Destroy the memory segment, and release the cached message blocks
  */
 void
 pgagroal_memory_destroy(void);
 
+/**
+ * Get a message with room for size bytes of data from the size-classed pool.
+ * The message and its data are a single block, which must be released
+ * with pgagroal_memory_message_release() or pgagroal_free_message()
+ * @param size The size of the data
+ * @param zero Zero the data
+ * @return The message, or NULL
+ */
+struct message*
+pgagroal_memory_message_alloc(size_t size, bool zero);
+
+/**
+ * Return a message to the size-classed pool
+ * @param msg The message
+ */
+void
+pgagroal_memory_message_release(struct message* msg);
+
+/**
+ * Get the pool statistics of this process
+ * @param hits The number of allocations served from the pool
+ * @param misses The number of allocations that needed malloc
+ */
+void
+pgagroal_memory_stats(uint64_t* hits, uint64_t* misses);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,6 +55,64 @@ struct message
    void* data;       /**< The message data */
 } __attribute__((aligned(64)));
 
+#define MESSAGE_HEADER_SIZE 5
+
+/** @struct message_stream
+ * Tracks the protocol message boundaries of a byte stream that is
+ * forwarded in chunks, so a message never needs to be assembled
+ */
+struct message_stream
+{
+   int header_length;                /**< The number of header bytes seen */
+   char header[MESSAGE_HEADER_SIZE]; /**< The header of the current message */
+   int32_t remaining;                /**< The remaining body bytes of the current message */
+   signed char kind;                 /**< The kind of the last message started */
+};
+
+/** @struct message_frame
+ * Defines a protocol message found in a chunk
+ */
+struct message_frame
+{
+   signed char kind; /**< The kind of the message */
+   int32_t length;   /**< The length of the message, including the length field */
+   char* body;       /**< The start of the body in the chunk */
+   int available;    /**< The number of body bytes in the chunk */
+};
+
+/**
+ * Find the next protocol message in a forwarded chunk. Only the 5 byte header
+ * is parsed, and a header split across chunks is carried in the stream. A
+ * message is reported once its header and, for a non-empty body, the first
+ * body byte is in the chunk; the rest of the body is skipped as it arrives.
+ * Messages of other kinds than the requested ones are stepped over without
+ * being reported
+ * @param stream The stream
+ * @param msg The chunk
+ * @param offset The offset in the chunk, updated past the reported body bytes
+ * @param kinds The kinds to report, or NULL for all
+ * @param frame The resulting frame
+ * @return true if a message was found, otherwise false when the chunk is consumed
+ */
+bool
+pgagroal_message_stream_next(struct message_stream* stream, struct message* msg, int* offset, char* kinds, struct message_frame* frame);
+
+/**
+ * Did the data seen so far end with a complete ReadyForQuery message
+ * @param stream The stream
+ * @return true if the stream is at a message boundary after a ReadyForQuery, otherwise false
+ */
+bool
+pgagroal_message_stream_ready(struct message_stream* stream);
+
+/**
+ * Did the data seen so far end inside a message
+ * @param stream The stream
+ * @return true if the next chunk continues a message, otherwise false
+ */
+bool
+pgagroal_message_stream_partial(struct message_stream* stream);
+
 /**
  * Read a message in blocking mode
  * @param ssl The SSL struct
@@ -160,6 +218,55 @@ pgagroal_write_notice(SSL* ssl, int socket);
 int
 pgagroal_write_pool_full(SSL* ssl, int socket);
 
+/**
+ * Write a transaction blocks are not allowed message
+ * @param ssl The SSL struct
+ * @param socket The socket descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_write_no_transaction_blocks(SSL* ssl, int socket);
+
+/**
+ * Write the FATAL message of a client that was idle in a transaction for too long
+ * @param ssl The SSL struct
+ * @param socket The socket descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_write_idle_transaction_timeout(SSL* ssl, int socket);
+
+/**
+ * Write the ERROR and the ReadyForQuery message for a request of a client
+ * whose idle transaction was rolled back
+ * @param ssl The SSL struct
+ * @param socket The socket descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_write_idle_transaction_rollback(SSL* ssl, int socket);
+
+/**
+ * Write the ERROR and the ReadyForQuery message for a LISTEN or UNLISTEN
+ * that the notification relay couldn't serve
+ * @param ssl The SSL struct
+ * @param socket The socket descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_write_notify_unavailable(SSL* ssl, int socket);
+
+/**
+ * Write the CommandComplete and the ReadyForQuery message for a LISTEN or
+ * UNLISTEN served by the notification relay
+ * @param ssl The SSL struct
+ * @param socket The socket descriptor
+ * @param listen Is it a LISTEN, otherwise an UNLISTEN
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_write_listen_complete(SSL* ssl, int socket, bool listen);
+
 /**
  * Write a connection refused message
  * @param ssl The SSL struct
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_MULTIPLEX_H
+#define PGAGROAL_MULTIPLEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+
+#include <stdlib.h>
+
+/**
+ * Run a transaction multiplexer process. The process serves the clients
+ * handed over by the workers from one event loop, and borrows a server
+ * connection for each transaction
+ * @param index The multiplexer index
+ * @param argv The argv
+ */
+void
+pgagroal_multiplex(int index, char** argv) __attribute__((noreturn));
+
+/**
+ * Hand an authenticated client over to a multiplexer
+ * @param client_fd The client descriptor
+ * @param slot The slot used for the authentication
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_multiplex_hand_off(int client_fd, int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
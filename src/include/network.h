@@ -45,10 +45,11 @@ extern "C" {
  * @param length The resulting length of descriptors
  * @param no_delay Use NODELAY
  * @param backlog the number of backlogs
+ * @param reuse_port Use SO_REUSEPORT so several processes can share the address
  * @return 0 upon success, otherwise 1
  */
 int
-pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_delay, int backlog);
+pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_delay, int backlog, bool reuse_port);
 
 /**
  * Bind a Unix Domain Socket
@@ -81,6 +82,17 @@ pgagroal_remove_unix_socket(const char* directory, const char* file);
 int
 pgagroal_connect(const char* hostname, int port, int* fd, bool keep_alive, bool no_delay);
 
+/**
+ * Connect to a server using the cached addresses of its host when dns_cache_ttl is set
+ * @param server The server
+ * @param fd The resulting descriptor
+ * @param keep_alive Use keep alive
+ * @param no_delay Use NODELAY
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_connect_server(int server, int* fd, bool keep_alive, bool no_delay);
+
 /**
  * Connect to a Unix Domain Socket
  * @param directory The directory
@@ -132,6 +144,24 @@ pgagroal_get_address(struct sockaddr* sa, char* address, size_t length);
 int
 pgagroal_tcp_nodelay(int fd);
 
+/**
+ * Apply the tcp_user_timeout and keep alive settings to a descriptor,
+ * so a peer that is gone is detected in seconds. Accepted sockets
+ * inherit the settings of their listening socket
+ * @param fd The descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tcp_keepalive(int fd);
+
+/**
+ * Apply the busy_poll setting to a descriptor
+ * @param fd The descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_socket_busy_poll(int fd);
+
 /**
  * Does the socket have an error associated
  * @param fd The descriptor
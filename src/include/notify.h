@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_NOTIFY_H
+#define PGAGROAL_NOTIFY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+
+#include <stdlib.h>
+
+#define NOTIFY_CHANNEL_LENGTH  64
+#define NOTIFY_CLIENT_CHANNELS 64
+#define NOTIFY_CLIENT_BUFFER   65536
+
+/**
+ * Run the notification relay process. The relay listens on a dedicated
+ * server connection per database on behalf of the transaction clients,
+ * and fans the notifications out to the subscribed clients
+ * @param argv The argv
+ */
+void
+pgagroal_notify_relay(char** argv) __attribute__((noreturn));
+
+/**
+ * Subscribe the client of this process to a channel. The function returns
+ * once the relay listens on the channel
+ * @param username The user name
+ * @param database The database
+ * @param channel The channel
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_notify_listen(char* username, char* database, char* channel);
+
+/**
+ * Unsubscribe the client of this process from a channel
+ * @param channel The channel, or NULL for all channels
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_notify_unlisten(char* channel);
+
+/**
+ * Read a notification sent by the relay
+ * @param client_fd The descriptor
+ * @param data The resulting NotificationResponse message
+ * @param length The length of the message
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_notify_read(int client_fd, char** data, int* length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
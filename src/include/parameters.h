@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PGAGROAL_PARAMETERS_H
+#define PGAGROAL_PARAMETERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <message.h>
+
+#include <stdbool.h>
+
+#include <openssl/ssl.h>
+
+#define PARAMETER_APPLICATION_NAME 0
+#define PARAMETER_CLIENT_ENCODING  1
+#define PARAMETER_SEARCH_PATH      2
+#define PARAMETER_TIMEZONE         3
+
+#define MAX_PARAMETER_VALUE_LENGTH 1024
+
+/**
+ * Record the session parameters of the client from its startup message.
+ * A parameter that isn't given is wanted at the startup value of the backend
+ * @param msg The startup message
+ */
+void
+pgagroal_parameters_startup(struct message* msg);
+
+/**
+ * The backend was started with the startup message of the client, so it
+ * has the parameters of the client
+ * @param slot The slot
+ */
+void
+pgagroal_parameters_created(int slot);
+
+/**
+ * Handle a ParameterStatus frame from the backend, which is the value both the
+ * client and the backend now have
+ * @param slot The slot of the backend
+ * @param frame The frame
+ */
+void
+pgagroal_parameters_server(int slot, struct message_frame* frame);
+
+/**
+ * Send the SET and RESET commands that give the backend the session parameters
+ * of the client. The reply isn't read, so the caller removes it from the stream
+ * @param ssl The SSL struct of the backend
+ * @param socket The descriptor of the backend
+ * @param slot The slot of the backend
+ * @param sent Was a query sent
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_parameters_synchronize(SSL* ssl, int socket, int slot, bool* sent);
+
+/**
+ * The last synchronization failed, which rolled it back on the backend.
+ * The parameters of it are no longer synchronized for the client
+ * @param slot The slot of the backend
+ */
+void
+pgagroal_parameters_failed(int slot);
+
+/**
+ * Forget the session parameters of a backend, which are at the startup value
+ * @param slot The slot
+ */
+void
+pgagroal_parameters_reset(int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,6 +40,7 @@ extern "C" {
 #if HAVE_OPENBSD
 #include <sys/limits.h>
 #endif
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <openssl/ssl.h>
 
@@ -75,17 +76,32 @@ extern "C" {
 #define HTTP_BUFFER_SIZE                         1024
 
 #define DEFAULT_BLOCKING_TIMEOUT                 30
+#define DEFAULT_MANAGEMENT_TIMEOUT               60
+#define DEFAULT_AUTH_QUERY_CACHE_TIMEOUT         0
 #define DEFAULT_CONNECTION_RETRY_DELAY           250 /* milliseconds: back-off cap on the blocking acquisition path */
 #define MIN_CONNECTION_RETRY_DELAY               1   /* milliseconds */
 #define MAX_CONNECTION_RETRY_DELAY               999 /* milliseconds: SLEEP() is sub-second only (nanosleep tv_nsec < 1e9) */
+#define DEFAULT_PREFILL_CONCURRENCY              4
+#define MAX_PREFILL_CONCURRENCY                  64
+#define MAX_TRANSACTION_STICKINESS               1000 /* milliseconds */
+#define MAX_BUSY_POLL                            1000 /* microseconds */
 #define DEFAULT_IDLE_TIMEOUT                     0
+#define DEFAULT_ADAPTIVE_POOL_INTERVAL           0
 #define DEFAULT_ROTATE_FRONTEND_PASSWORD_TIMEOUT 0
 #define DEFAULT_MAX_CONNECTION_AGE               0
 #define DEFAULT_FLUSH_TIMEOUT                    60
+#define DEFAULT_FLUSH_RATE                       10
 #define DEFAULT_BACKGROUND_INTERVAL              300
 #define DEFAULT_HEALTH_CHECK_PERIOD              30
 #define DEFAULT_HEALTH_CHECK_TIMEOUT             5
+#define DEFAULT_REPLICA_MAX_LAG                  (16 * 1024 * 1024)
+#define DEFAULT_QUERY_CACHE_MAX_AGE              5
+#define DEFAULT_QUERY_STATISTICS_SAMPLE          10
+#define DEFAULT_QUERY_STATISTICS_TOP             20
 #define DEFAULT_AUTHENTICATION_TIMEOUT           5
+#define DEFAULT_CLUSTER_LEASE                    10
+#define DEFAULT_CONSOLE_REFRESH                  5
+#define DEFAULT_TUNNEL_LINKS                     2
 
 #define MAX_USERNAME_LENGTH                      128
 #define MAX_DATABASE_LENGTH                      256
@@ -95,13 +111,21 @@ extern "C" {
 #define MIN_PASSWORD_LENGTH                      8
 #define MAX_PASSWORD_LENGTH                      1024
 #define MAX_PASSWORD_CHARS                       256
+#define SCRAM_SALT_LENGTH                        16
+#define SCRAM_KEY_LENGTH                         32
+#define SCRAM_MAX_SALT_LENGTH                    64
 #define MAX_APPLICATION_NAME                     64
 #define MAX_ALIASES                              8
 #define MAX_CERTIFICATES                         70
 
 #define MAX_PATH                                 1024
+#define FILE_HASH_LENGTH                         32
 #define MISC_LENGTH                              128
+#define MAX_STARTUP_PACKET_LENGTH                10000
 #define NUMBER_OF_SERVERS                        64
+#define NUMBER_OF_SERVER_ADDRESSES               8
+#define CONNECT_ATTEMPT_DELAY                    250
+#define RESOLVE_CLAIM_TIMEOUT                    5
 #ifdef DEBUG
 #define MAX_NUMBER_OF_CONNECTIONS 8
 #else
@@ -112,8 +136,43 @@ extern "C" {
 #define NUMBER_OF_USERS                64
 #define NUMBER_OF_ADMINS               8
 #define NUMBER_OF_DISABLED             64
+#define NUMBER_OF_FREE_SLOT_WORDS      ((MAX_NUMBER_OF_CONNECTIONS + 63) / 64)
+#define NUMBER_OF_POOL_KEYS            MAX_NUMBER_OF_CONNECTIONS
+#define NUMBER_OF_WAITERS              1024
+#define NUMBER_OF_SCRAM_KEYS           256
+#define NUMBER_OF_TLS_TICKET_KEYS      2
+#define NUMBER_OF_AUTH_QUERY_ENTRIES   256
+#define NUMBER_OF_CLIENT_RATES         1024
+#define CLIENT_RATE_PROBES             8
+#define NUMBER_OF_CANCEL_KEYS          (2 * MAX_NUMBER_OF_CONNECTIONS)
+#define NUMBER_OF_CLUSTER_PEERS        16
+#define ADAPTIVE_POOL_SAMPLES          12
+#define NUMBER_OF_HBA_WORDS            ((NUMBER_OF_HBAS + 63) / 64)
+#define NUMBER_OF_HBA_NODES            (2 + NUMBER_OF_HBAS * (32 + 128))
+#define NUMBER_OF_HBA_DATABASES        1024
+#define NUMBER_OF_HBA_USERNAMES        128
+#define AUTH_QUERY_SHADOW_LENGTH       256
+#define TLS_TICKET_KEY_ROTATION        3600
+#define TIMER_WHEEL_SIZE               64
+#define MAX_CONNECTION_AGE_JITTER      4
+#define VALIDATION_BATCH               64
+#define NUMBER_OF_MULTIPLEX_WORKERS    64
+#define NUMBER_OF_ACCEPTORS            64
+#define NUMBER_OF_TUNNEL_LINKS         16
+#define NUMBER_OF_CLIENTS              (4 * MAX_NUMBER_OF_CONNECTIONS)
 
 #define NUMBER_OF_SECURITY_MESSAGES    5
+#define SECURITY_MESSAGES_PER_SLOT     4
+#define NUMBER_OF_PREPARED_STATEMENTS  32
+#define NUMBER_OF_SESSION_PARAMETERS   4
+#define PROMETHEUS_COUNTER_SHARDS      16
+
+#define SECURITY_ENTRY_EMPTY           0
+#define SECURITY_ENTRY_USED            1
+#define SECURITY_ENTRY_DELETED         2
+
+#define CLIENT_ENTRY_FREE              0
+#define CLIENT_ENTRY_DELETED           -1
 
 #define STATE_NOTINIT                  -2
 #define STATE_INIT                     -1
@@ -126,6 +185,10 @@ extern "C" {
 #define STATE_VALIDATION               6
 #define STATE_REMOVE                   7
 
+#define RESET_NONE                     0
+#define RESET_DEALLOCATE               1
+#define RESET_DISCARD                  2
+
 #define SECURITY_INVALID               -2
 #define SECURITY_REJECT                -1
 #define SECURITY_TRUST                 0
@@ -138,6 +201,12 @@ extern "C" {
 #define AUTH_ERROR                     2
 #define AUTH_TIMEOUT                   3
 
+#define WAITER_FREE                    0
+#define WAITER_INIT                    1
+#define WAITER_WAITING                 2
+#define WAITER_HANDING                 3
+#define WAITER_HANDED                  4
+
 #define SERVER_NOTINIT                 -2
 #define SERVER_NOTINIT_PRIMARY         -1
 #define SERVER_PRIMARY                 0
@@ -160,12 +229,30 @@ extern "C" {
 #define FLUSH_IDLE                     0
 #define FLUSH_GRACEFULLY               1
 #define FLUSH_ALL                      2
+#define FLUSH_PROGRESSIVE              3
 
 #define VALIDATION_OFF                 0
 #define VALIDATION_FOREGROUND          1
 #define VALIDATION_BACKGROUND          2
 
+#define IDLE_TRANSACTION_WARN          0
+#define IDLE_TRANSACTION_CANCEL        1
+#define IDLE_TRANSACTION_ROLLBACK      2
+#define NUMBER_OF_IDLE_TRANSACTION     3
+
+#define TUNNEL_COMPRESSION_NONE        0
+#define TUNNEL_COMPRESSION_LZ4         1
+#define TUNNEL_COMPRESSION_ZSTD        2
+
 #define HISTOGRAM_BUCKETS              18
+#define LATENCY_HISTOGRAM_BUCKETS      20
+#define COUNT_HISTOGRAM_BUCKETS        12
+#define NUMBER_OF_DATABASE_METRICS     64
+#define NUMBER_OF_PIPELINES            4
+#define NUMBER_OF_BACKEND_PHASES       4
+#define NUMBER_OF_CREATE_REASONS       3
+#define NUMBER_OF_QUERY_FINGERPRINTS   256
+#define QUERY_FINGERPRINT_LENGTH       128
 
 #define HUGEPAGE_OFF                   0
 #define HUGEPAGE_TRY                   1
@@ -214,6 +301,8 @@ extern "C" {
 #define PGAGROAL_LIMIT_ENTRY_MAX_SIZE          "max_size"
 #define PGAGROAL_LIMIT_ENTRY_MIN_SIZE          "min_size"
 #define PGAGROAL_LIMIT_ENTRY_INITIAL_SIZE      "initial_size"
+#define PGAGROAL_LIMIT_ENTRY_GUARANTEED_SIZE   "guaranteed_size"
+#define PGAGROAL_LIMIT_ENTRY_PRIORITY          "priority"
 #define PGAGROAL_LIMIT_ENTRY_ALIASES           "aliases"
 #define PGAGROAL_LIMIT_ENTRY_NUMBER_OF_ALIASES "number_of_aliases"
 #define PGAGROAL_LIMIT_ENTRY_LINENO            "line_number"
@@ -378,6 +467,31 @@ extern void* prometheus_shmem;
  */
 extern void* prometheus_cache_shmem;
 
+/**
+ * Shared memory used to contain the query cache
+ */
+extern void* query_cache_shmem;
+
+/**
+ * Shared memory used to contain the tracker events
+ */
+extern void* tracker_shmem;
+
+/**
+ * Shared memory used to contain the slow acquires and transactions
+ */
+extern void* slowlog_shmem;
+
+/**
+ * Shared memory used to contain the client activity table
+ */
+extern void* activity_shmem;
+
+/**
+ * Shared memory used to contain the asynchronous log ring
+ */
+extern void* log_shmem;
+
 /** @struct server
  * Defines a server
  */
@@ -390,6 +504,7 @@ struct server
    int minor_version;            /**< The minor version of the server */
    char system_identifier[64];   /**< The system identifier of the server */
    bool tls;                     /**< Use TLS if possible */
+   bool tls_direct;              /**< Start TLS without the SSLRequest */
    bool valid;                   /**< Is the server valid */
    char tls_cert_file[MAX_PATH]; /**< TLS certificate path */
    char tls_key_file[MAX_PATH];  /**< TLS key path */
@@ -397,8 +512,20 @@ struct server
    atomic_schar state;           /**< The state of the server */
    atomic_schar health_state;    /**< The health state of the server */
    unsigned int failures;        /**< The number of failures */
+   atomic_llong lag;             /**< The replication lag in bytes from the health check, -1 if not a replica */
+   atomic_int rtt;               /**< The round trip time in microseconds from the health check, -1 if unknown */
+   atomic_int backends;          /**< The number of backend connections */
+   int max_connections;          /**< The maximum number of backend connections of a replica, 0 for no limit */
+   atomic_llong connect_tat;     /**< The monotonic time (us) the connection_rate bucket is drained until */
    atomic_schar auth_type;       /**< The authentication type used for health check */
    int lineno;                   /**< The line number within the configuration file */
+   atomic_uint address_sequence; /**< The sequence of the cached addresses, odd while they are written */
+   atomic_ullong resolver;       /**< The time (s) << 32 | the pid of the process resolving the host name, 0 if none */
+   atomic_llong resolve_failed;  /**< The time (s) the host name last failed to resolve */
+   int number_of_addresses;      /**< The number of cached addresses */
+   time_t address_time;          /**< The time the addresses were resolved */
+   socklen_t address_lengths[NUMBER_OF_SERVER_ADDRESSES];         /**< The lengths of the cached addresses */
+   struct sockaddr_storage addresses[NUMBER_OF_SERVER_ADDRESSES]; /**< The cached addresses of the host name */
 } __attribute__((aligned(64)));
 
 #define FOREACH_SERVER for (int i = 0; i < config->number_of_servers; i++)
@@ -410,30 +537,137 @@ struct server
       if (!config->servers[i].valid)
 
 /** @struct connection
- * Defines a connection
+ * Defines the hot part of a connection, which is what the pool touches
  */
 struct connection
+{
+   bool new;                 /**< Is the connection new */
+   signed char server;       /**< The server identifier */
+   bool replica;             /**< Is the connection routed to a replica */
+   bool tx_mode;             /**< Connection in transaction mode */
+   signed char reset;        /**< The reset needed when the connection is returned */
+   signed char has_security; /**< The security identifier */
+   signed char limit_rule;   /**< The limit rule used */
+   int key;                  /**< The interned pool key, 0 if none */
+   int backend_pid;          /**< The backend process id */
+   int backend_secret;       /**< The backend secret */
+   pid_t pid;                /**< The associated process id */
+   int fd;                   /**< The descriptor */
+   time_t start_time;        /**< The start timestamp */
+   time_t timestamp;         /**< The last used timestamp */
+} __attribute__((aligned(64)));
+
+/** @struct connection_info
+ * Defines the cold part of a connection, which is the names and the authentication replay
+ */
+struct connection_info
 {
    char username[MAX_USERNAME_LENGTH]; /**< The user name */
    char database[MAX_DATABASE_LENGTH]; /**< The database */
    char appname[MAX_APPLICATION_NAME]; /**< The application_name */
 
-   bool new;           /**< Is the connection new */
-   signed char server; /**< The server identifier */
-   bool tx_mode;       /**< Connection in transaction mode */
+   ssize_t security_lengths[NUMBER_OF_SECURITY_MESSAGES];       /**< The lengths of the security messages */
+   int security_index[NUMBER_OF_SECURITY_MESSAGES];             /**< The security message store entries, 0 if none */
+   uint64_t prepared_statements[NUMBER_OF_PREPARED_STATEMENTS]; /**< The statements prepared on the backend, 0 if none */
+   uint64_t session_parameters[NUMBER_OF_SESSION_PARAMETERS];   /**< The session parameters set on the backend, 0 if at the startup value */
+} __attribute__((aligned(64)));
 
-   signed char has_security;                                                  /**< The security identifier */
-   ssize_t security_lengths[NUMBER_OF_SECURITY_MESSAGES];                     /**< The lengths of the security messages */
-   char security_messages[NUMBER_OF_SECURITY_MESSAGES][SECURITY_BUFFER_SIZE]; /**< The security messages */
+/** @struct security_message
+ * Defines a reference counted entry in the shared security message store
+ */
+struct security_message
+{
+   signed char state;               /**< The state of the entry */
+   signed char server;              /**< The server */
+   int key;                         /**< The pool key */
+   int references;                  /**< The number of slots using the entry */
+   unsigned int hash;               /**< The hash of the message */
+   ssize_t length;                  /**< The length of the message */
+   char data[SECURITY_BUFFER_SIZE]; /**< The message */
+} __attribute__((aligned(64)));
 
-   int backend_pid;    /**< The backend process id */
-   int backend_secret; /**< The backend secret */
+/** @struct pool_key
+ * Defines an interned (limit rule, user name, real database) pool key
+ */
+struct pool_key
+{
+   atomic_schar state;                 /**< The state */
+   signed char limit_rule;             /**< The limit rule */
+   char username[MAX_USERNAME_LENGTH]; /**< The user name */
+   char database[MAX_DATABASE_LENGTH]; /**< The real database */
+};
+
+/** @struct scram_key
+ * Defines the SCRAM-SHA-256 ClientKey and ServerKey of a user derived
+ * for a backend salt and iteration count
+ */
+struct scram_key
+{
+   atomic_schar state;                 /**< The state */
+   char username[MAX_USERNAME_LENGTH]; /**< The user name */
+   char password[SCRAM_KEY_LENGTH];    /**< The digest of the salt and the password */
+   char salt[SCRAM_MAX_SALT_LENGTH];   /**< The salt */
+   int salt_length;                    /**< The length of the salt */
+   int iterations;                     /**< The iteration count */
+   char client_key[SCRAM_KEY_LENGTH];  /**< The ClientKey */
+   char server_key[SCRAM_KEY_LENGTH];  /**< The ServerKey */
+} __attribute__((aligned(64)));
+
+/** @struct tls_ticket_key
+ * Defines a key for the TLS session tickets, shared by all processes
+ * serving clients
+ */
+struct tls_ticket_key
+{
+   atomic_bool valid;          /**< Is the key valid */
+   unsigned char name[16];     /**< The key name */
+   unsigned char aes_key[32];  /**< The AES-256 key */
+   unsigned char hmac_key[32]; /**< The HMAC-SHA256 key */
+};
+
+/** @struct auth_query_entry
+ * Defines a cached authentication query result for a user and database
+ */
+struct auth_query_entry
+{
+   atomic_schar state;                    /**< The state */
+   char username[MAX_USERNAME_LENGTH];    /**< The user name */
+   char database[MAX_DATABASE_LENGTH];    /**< The database */
+   time_t expires;                        /**< The time the entry expires */
+   bool found;                            /**< Is the user known */
+   char shadow[AUTH_QUERY_SHADOW_LENGTH]; /**< The SCRAM-SHA-256 verifier of the user */
+} __attribute__((aligned(64)));
 
-   signed char limit_rule; /**< The limit rule used */
-   time_t start_time;      /**< The start timestamp */
-   time_t timestamp;       /**< The last used timestamp */
-   pid_t pid;              /**< The associated process id */
-   int fd;                 /**< The descriptor */
+/** @struct client_rate
+ * Defines the client_connection_rate bucket of a client address
+ */
+struct client_rate
+{
+   atomic_ullong key; /**< The hash of the client address, 0 if free */
+   atomic_llong tat;  /**< The monotonic time (us) the bucket is drained until */
+} __attribute__((aligned(16)));
+
+/** @struct pool_waiter
+ * Defines a process waiting for a connection to be handed to it
+ */
+struct pool_waiter
+{
+   atomic_int state;       /**< The state, also the futex word */
+   signed char limit_rule; /**< The limit rule */
+   int key;                /**< The pool key */
+   unsigned int ticket;    /**< The FIFO ticket */
+   signed char route;      /**< The replica server asked for, -1 for the primary */
+   pid_t pid;              /**< The waiting process */
+   int slot;               /**< The slot handed to the waiter */
+} __attribute__((aligned(64)));
+
+/** @struct timer_wheel
+ * Defines a timer wheel of slots, where each bucket covers a number of seconds
+ */
+struct timer_wheel
+{
+   atomic_llong tick;                                                  /**< The last processed tick */
+   atomic_ullong buckets[TIMER_WHEEL_SIZE][NUMBER_OF_FREE_SLOT_WORDS]; /**< The slots per bucket */
 } __attribute__((aligned(64)));
 
 /** @struct hba
@@ -449,6 +683,74 @@ struct hba
    int lineno;                         /**< The line number within the configuration file */
 } __attribute__((aligned(64)));
 
+/** @struct hba_node
+ * Defines a node of the HBA address prefix trie
+ */
+struct hba_node
+{
+   int16_t child[2];                      /**< The nodes for the next bit, or -1 */
+   uint64_t entries[NUMBER_OF_HBA_WORDS]; /**< The HBA entries whose prefix ends here */
+};
+
+/** @struct hba_name
+ * Defines a database or user name of the HBA matcher. The name itself is
+ * not copied, it is referenced in the HBA or limit entries
+ */
+struct hba_name
+{
+   bool used;                             /**< Is the slot used */
+   int16_t hba;                           /**< The HBA entry naming it, or -1 */
+   int16_t limit;                         /**< The limit entry having it as an alias */
+   int16_t alias;                         /**< The alias within the limit entry */
+   uint64_t entries[NUMBER_OF_HBA_WORDS]; /**< The HBA entries matching the name */
+};
+
+/** @struct hba_matcher
+ * Defines the HBA entries compiled for lookup. An entry matches when its
+ * bit is set for the address, the database and the user name, and the
+ * lowest such bit is the first matching line
+ */
+struct hba_matcher
+{
+   int number_of_nodes;                                /**< The number of trie nodes */
+   int methods[NUMBER_OF_HBAS];                        /**< The access method of each entry */
+   uint64_t all_addresses[NUMBER_OF_HBA_WORDS];        /**< The entries matching all addresses */
+   uint64_t all_databases[NUMBER_OF_HBA_WORDS];        /**< The entries matching all databases */
+   uint64_t all_usernames[NUMBER_OF_HBA_WORDS];        /**< The entries matching all user names */
+   struct hba_name databases[NUMBER_OF_HBA_DATABASES]; /**< The database names */
+   struct hba_name usernames[NUMBER_OF_HBA_USERNAMES]; /**< The user names */
+   struct hba_node nodes[NUMBER_OF_HBA_NODES];         /**< The trie nodes, IPv4 rooted at 0 and IPv6 at 1 */
+};
+
+/** @struct limit_demand
+ * Defines the observed demand of a limit entry, sampled every
+ * adaptive_pool_interval into a window of ADAPTIVE_POOL_SAMPLES
+ */
+struct limit_demand
+{
+   atomic_uint acquires;                          /**< The connections obtained in the current sample */
+   atomic_ushort peak;                            /**< The highest number of active connections in the current sample */
+   atomic_int target;                             /**< The adaptive minimum pool size, 0 if none */
+   int position;                                  /**< The next sample */
+   unsigned int rates[ADAPTIVE_POOL_SAMPLES];     /**< The connections obtained per sample */
+   unsigned short peaks[ADAPTIVE_POOL_SAMPLES];   /**< The highest number of active connections per sample */
+   unsigned short waiters[ADAPTIVE_POOL_SAMPLES]; /**< The number of waiters at the end of each sample */
+   atomic_int quota;                              /**< The backend connections of the instance in a cluster */
+} __attribute__((aligned(64)));
+
+/** @struct cluster_peer
+ * Defines another pgagroal instance sharing the limit entries, as last
+ * reported on its management port
+ */
+struct cluster_peer
+{
+   char host[MISC_LENGTH];                   /**< The host of the management port */
+   int port;                                 /**< The management port */
+   atomic_llong expires;                     /**< The end of the lease of the last report, 0 if none */
+   atomic_ushort demands[NUMBER_OF_LIMITS];  /**< The connections wanted per limit entry */
+   atomic_ushort backends[NUMBER_OF_LIMITS]; /**< The backend connections per limit entry */
+} __attribute__((aligned(64)));
+
 /** @struct limit
  * Defines a limit entry
  */
@@ -463,16 +765,23 @@ struct limit
    int max_size;                                   /**< The maximum pool size */
    int initial_size;                               /**< The initial pool size */
    int min_size;                                   /**< The minimum pool size */
+   int guaranteed_size;                            /**< The connections kept for the entry while it is busy */
+   int priority;                                   /**< The priority when connections are taken back, higher is kept */
    int lineno;                                     /**< The line number within the configuration file */
 } __attribute__((aligned(64)));
 
 /** @struct user
- * Defines a user
+ * Defines a user, the SCRAM-SHA-256 verifier is derived from the password
+ * when the user is loaded
  */
 struct user
 {
    char username[MAX_USERNAME_LENGTH]; /**< The user name */
    char password[MAX_PASSWORD_LENGTH]; /**< The password */
+   bool verifier;                      /**< Is the verifier available */
+   char salt[SCRAM_SALT_LENGTH];       /**< The salt of the verifier */
+   char stored_key[SCRAM_KEY_LENGTH];  /**< The StoredKey of the verifier */
+   char server_key[SCRAM_KEY_LENGTH];  /**< The ServerKey of the verifier */
 } __attribute__((aligned(64)));
 
 /** @struct vault_server
@@ -537,6 +846,112 @@ struct prometheus_connection
    atomic_ullong query_count; /**< The number of queries per connection */
 } __attribute__((aligned(64)));
 
+/** @struct prometheus_shard
+ * Defines a shard of a Prometheus counter, on its own cache line
+ */
+struct prometheus_shard
+{
+   atomic_ullong value; /**< The value of the shard */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_counter
+ * Defines a Prometheus counter that is updated in the shard of the current CPU,
+ * and summed when it is read
+ */
+struct prometheus_counter
+{
+   struct prometheus_shard shards[PROMETHEUS_COUNTER_SHARDS]; /**< The shards */
+};
+
+/** @struct prometheus_latency
+ * Defines a latency histogram, where the upper bound of the first
+ * bucket is 100 microseconds and doubles in each of the next
+ */
+struct prometheus_latency
+{
+   atomic_ulong buckets[LATENCY_HISTOGRAM_BUCKETS]; /**< The histogram buckets, the last is +Inf */
+   atomic_ullong sum;                               /**< The sum in microseconds */
+};
+
+/** @struct prometheus_count
+ * Defines a histogram of a number of events, where the upper bound of the
+ * first bucket is 1 and doubles in each of the next
+ */
+struct prometheus_count
+{
+   atomic_ulong buckets[COUNT_HISTOGRAM_BUCKETS]; /**< The histogram buckets, the last is +Inf */
+   atomic_ullong sum;                             /**< The sum of the events */
+};
+
+/** @struct prometheus_pipeline
+ * Defines the cost accounting of a pipeline, see metrics_accounting
+ */
+struct prometheus_pipeline
+{
+   struct prometheus_latency user_cpu;   /**< The user CPU time per session */
+   struct prometheus_latency system_cpu; /**< The system CPU time per session */
+   struct prometheus_count reads;        /**< The reads per transaction */
+   struct prometheus_count writes;       /**< The writes per transaction */
+   struct prometheus_count wakeups;      /**< The event loop wakeups per transaction */
+   atomic_ullong server_blocked;         /**< The microseconds waited for the server to reply */
+   atomic_ullong client_blocked;         /**< The microseconds waited for the client to send */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_backend
+ * Defines the creation of the backends of a server
+ */
+struct prometheus_backend
+{
+   struct prometheus_latency phases[NUMBER_OF_BACKEND_PHASES]; /**< The time of each phase */
+   atomic_ulong created[NUMBER_OF_CREATE_REASONS];             /**< The backends created per reason */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_query
+ * Defines the statistics of a query fingerprint, estimated from the samples
+ */
+struct prometheus_query
+{
+   uint64_t fingerprint;                 /**< The fingerprint, 0 if the entry is empty */
+   unsigned long long calls;             /**< The number of calls */
+   unsigned long long error;             /**< The calls counted for the evicted fingerprint */
+   unsigned long long usec;              /**< The backend time in microseconds */
+   unsigned long long rows;              /**< The number of rows */
+   char query[QUERY_FINGERPRINT_LENGTH]; /**< The start of the normalized query */
+};
+
+/** @struct prometheus_queries
+ * Defines the query fingerprints. The least called entry is replaced by a new
+ * fingerprint, which takes over its calls (space-saving)
+ */
+struct prometheus_queries
+{
+   atomic_schar lock;                                             /**< The lock of the table */
+   uint64_t fingerprints[NUMBER_OF_QUERY_FINGERPRINTS];           /**< The fingerprints of the entries */
+   struct prometheus_query entries[NUMBER_OF_QUERY_FINGERPRINTS]; /**< The entries */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_wait
+ * Defines the waits for a connection of a limit rule
+ */
+struct prometheus_wait
+{
+   struct prometheus_latency time; /**< The wait time */
+   atomic_ulong reuse;             /**< The number of waits served by a pooled connection */
+   atomic_ulong created;           /**< The number of waits served by a new connection */
+   atomic_ulong timeout;           /**< The number of waits that timed out */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_database
+ * Defines the transaction latencies of a database
+ */
+struct prometheus_database
+{
+   atomic_schar state;                     /**< The state of the entry */
+   char database[MAX_DATABASE_LENGTH];     /**< The database */
+   struct prometheus_latency transaction;  /**< The transaction time */
+   struct prometheus_latency service;      /**< The time the server spent on the transaction */
+} __attribute__((aligned(64)));
+
 /** @struct prometheus_cache
  * A structure to handle the Prometheus response
  * so that it is possible to serve the very same
@@ -565,10 +980,11 @@ struct prometheus_cache
 struct prometheus
 {
    // logging
-   atomic_ulong logging_info;  /**< Logging: INFO */
-   atomic_ulong logging_warn;  /**< Logging: WARN */
-   atomic_ulong logging_error; /**< Logging: ERROR */
-   atomic_ulong logging_fatal; /**< Logging: FATAL */
+   atomic_ulong logging_info;    /**< Logging: INFO */
+   atomic_ulong logging_warn;    /**< Logging: WARN */
+   atomic_ulong logging_error;   /**< Logging: ERROR */
+   atomic_ulong logging_fatal;   /**< Logging: FATAL */
+   atomic_ulong logging_dropped; /**< Logging: Dropped by the asynchronous ring */
 
    // internal connections
    atomic_int client_sockets; /**< The number of sockets the client used */
@@ -589,13 +1005,10 @@ struct main_prometheus
    atomic_ulong connection_kill;               /**< The number of kill calls */
    atomic_ulong connection_remove;             /**< The number of remove calls */
    atomic_ulong connection_timeout;            /**< The number of timeout calls */
-   atomic_ulong connection_return;             /**< The number of return calls */
    atomic_ulong connection_invalid;            /**< The number of invalid calls */
-   atomic_ulong connection_get;                /**< The number of get calls */
    atomic_ulong connection_idletimeout;        /**< The number of idle timeout calls */
    atomic_ulong connection_max_connection_age; /**< The number of max connection age calls */
    atomic_ulong connection_flush;              /**< The number of flush calls */
-   atomic_ulong connection_success;            /**< The number of success calls */
 
    /**< The number of connection awaiting due to `blocking_timeout` */
    atomic_ulong connections_awaiting[NUMBER_OF_LIMITS]; /**< The number of connection waiting per limit */
@@ -604,18 +1017,41 @@ struct main_prometheus
    atomic_ulong auth_user_success;      /**< The number of AUTH_SUCCESS calls */
    atomic_ulong auth_user_bad_password; /**< The number of AUTH_BAD_PASSWORD calls */
    atomic_ulong auth_user_error;        /**< The number of AUTH_ERROR calls */
+   atomic_ulong client_rate_limited;    /**< The number of clients rejected by client_connection_rate */
 
    atomic_ulong client_wait;      /**< The number of waiting clients */
-   atomic_ulong client_active;    /**< The number of active clients */
    atomic_ulong client_wait_time; /**< The time the client waits */
 
-   atomic_ullong query_count; /**< The number of queries */
-   atomic_ullong tx_count;    /**< The number of transactions */
+   atomic_ullong memory_pool_hits;   /**< The number of messages served from the pool */
+   atomic_ullong memory_pool_misses; /**< The number of messages that needed malloc */
 
-   atomic_ullong network_sent;     /**< The bytes sent by clients */
-   atomic_ullong network_received; /**< The bytes received from servers */
+   /* The counters updated by every client */
+   struct prometheus_counter connection_get;     /**< The number of get calls */
+   struct prometheus_counter connection_return;  /**< The number of return calls */
+   struct prometheus_counter connection_success; /**< The number of success calls */
+   struct prometheus_counter client_active;      /**< The number of active clients */
+   struct prometheus_counter query_count;        /**< The number of queries */
+   struct prometheus_counter tx_count;           /**< The number of transactions */
+   struct prometheus_counter network_sent;       /**< The bytes sent by clients */
+   struct prometheus_counter network_received;   /**< The bytes received from servers */
+   struct prometheus_counter client_write_blocked; /**< The microseconds writes waited for clients to read */
+   struct prometheus_counter server_write_blocked; /**< The microseconds writes waited for servers to read */
+
+   struct prometheus_wait connection_wait[NUMBER_OF_LIMITS + 1]; /**< The connection waits per limit rule (0 is no rule) */
+   struct prometheus_database databases[NUMBER_OF_DATABASE_METRICS]; /**< The transaction latencies per database */
+   struct prometheus_pipeline pipelines[NUMBER_OF_PIPELINES];        /**< The cost accounting per pipeline */
+   struct prometheus_queries queries;                                /**< The query fingerprints */
+
+   atomic_ulong idle_transaction_timeout[NUMBER_OF_IDLE_TRANSACTION]; /**< The idle transaction timeouts per action */
 
    atomic_ulong server_error[NUMBER_OF_SERVERS];          /**< The number of errors for a server */
+   struct prometheus_backend backends[NUMBER_OF_SERVERS]; /**< The creation of the backends per server */
+
+   atomic_int prefill_active;    /**< The number of prefill rounds running */
+   atomic_int prefill_pending;   /**< The connections the running prefill rounds still create */
+   atomic_ulong prefill_created; /**< The connections created by prefill */
+   atomic_ulong prefill_failed;  /**< The connections prefill failed to create */
+
    atomic_ulong failed_servers;                           /**< The number of failed servers */
    struct certificate_metrics cert_metrics;               /**< TLS certificate metrics */
    struct prometheus_connection prometheus_connections[]; /**< The number of prometheus connections (FMA) */
@@ -658,6 +1094,7 @@ struct configuration
    char tls_cert_file[MAX_PATH]; /**< TLS certificate path */
    char tls_key_file[MAX_PATH];  /**< TLS key path */
    char tls_ca_file[MAX_PATH];   /**< TLS CA certificate path */
+   bool tls_ktls;                /**< Offload TLS records to the kernel */
    // Prometheus
    unsigned char hugepage;                /**< Huge page support */
    int metrics;                           /**< The metrics port */
@@ -673,12 +1110,13 @@ struct configuration
  */
 struct vault_configuration
 {
-   struct configuration common;      /**< Common base class */
-   char users_path[MAX_PATH];        /**< The configuration path */
-   int number_of_users;              /**< The number of users */
-   int ev_backend;                   /**< Selected ev backend */
-   int tls_cert_auth_mode;           /**< TLS certificate authentication mode: verify-ca (0) or verify-full (1) */
-   struct vault_server vault_server; /**< The vault servers */
+   struct configuration common;            /**< Common base class */
+   char users_path[MAX_PATH];              /**< The configuration path */
+   int number_of_users;                    /**< The number of users */
+   int ev_backend;                         /**< Selected ev backend */
+   int tls_cert_auth_mode;                 /**< TLS certificate authentication mode: verify-ca (0) or verify-full (1) */
+   pgagroal_time_t password_cache_timeout; /**< The time a password is served from the cache, 0 if disabled */
+   struct vault_server vault_server;       /**< The vault servers */
 } __attribute__((aligned(64)));
 
 /** @struct main_configuration
@@ -694,10 +1132,18 @@ struct main_configuration
    char admins_path[MAX_PATH];         /**< The admins path */
    char superuser_path[MAX_PATH];      /**< The superuser path */
 
-   int management;    /**< The management port */
-   int console;       /**< The console port */
-   bool gracefully;   /**< Is pgagroal in gracefully mode */
-   bool keep_running; /**< Is pgagroal still running */
+   unsigned char users_hash[FILE_HASH_LENGTH];          /**< The SHA-256 of the users file */
+   unsigned char frontend_users_hash[FILE_HASH_LENGTH]; /**< The SHA-256 of the frontend users file */
+   unsigned char admins_hash[FILE_HASH_LENGTH];         /**< The SHA-256 of the admins file */
+   unsigned char superuser_hash[FILE_HASH_LENGTH];      /**< The SHA-256 of the superuser file */
+
+   int management;                     /**< The management port */
+   pgagroal_time_t management_timeout; /**< The idle time of a remote management session */
+   int console;                        /**< The console port */
+   pgagroal_time_t console_refresh;    /**< The age of the cached console page (Default seconds) */
+   bool gracefully;                    /**< Is pgagroal in gracefully mode */
+   bool keep_running;                  /**< Is pgagroal still running */
+   pid_t handed_over;                  /**< The main process id once its ports are handed over, otherwise 0 */
 
    bool all_disabled;                                      /**< Are all databases disabled */
    char disabled[NUMBER_OF_DISABLED][MAX_DATABASE_LENGTH]; /**< Which databases are disabled */
@@ -710,15 +1156,24 @@ struct main_configuration
 
    unsigned int update_process_title; /**< Behaviour for updating the process title */
 
-   bool authquery; /**< Is authentication query enabled */
+   bool authquery;                           /**< Is authentication query enabled */
+   pgagroal_time_t auth_query_cache_timeout; /**< The time the authentication query results are cached */
 
    atomic_ushort active_connections; /**< The active number of connections */
    int max_connections;              /**< The maximum number of connections */
+   int max_connections_reserve;      /**< The number of connection slots reserved for a reload raising max_connections */
+   int connection_slots;             /**< The number of connection slots in the shared memory */
+   int prefill_concurrency;          /**< The number of backends created at the same time by prefill */
+   int connection_rate;              /**< The number of backends created per second for a server, 0 for no limit */
+   int max_queue_length;             /**< The number of clients that may wait for a limit entry, 0 for no limit */
+   int client_connection_rate;       /**< The number of connections accepted per second from a client address, 0 for no limit */
+   int flush_rate;                   /**< The number of backends retired per second by a progressive flush, 0 for no limit */
    bool allow_unknown_users;         /**< Allow unknown users */
 
    pgagroal_time_t blocking_timeout;                 /**< The duration of blocking timeout (Default seconds) */
    unsigned int connection_retry_delay;              /**< Back-off cap (milliseconds) on the blocking acquisition retry path */
    pgagroal_time_t idle_timeout;                     /**< The duration of idle timeout (Default seconds) */
+   pgagroal_time_t adaptive_pool_interval;           /**< The sampling interval of the adaptive pool size (Default seconds) */
    pgagroal_time_t rotate_frontend_password_timeout; /**< The duration of rotate frontend password timeout (Default seconds) */
    int rotate_frontend_password_length;              /**< Length of randomised passwords */
    pgagroal_time_t max_connection_age;               /**< The duration of max connection age (Default seconds) */
@@ -730,22 +1185,77 @@ struct main_configuration
    pgagroal_time_t health_check_period;              /**< The duration of health check period (Default seconds) */
    pgagroal_time_t health_check_timeout;             /**< The duration of health check timeout (Default seconds) */
    char health_check_user[MAX_USERNAME_LENGTH];      /**< The health check user */
+   char replica_application_name[MAX_APPLICATION_NAME]; /**< The application_name routed to a replica */
+   unsigned int replica_max_lag;                     /**< The replication lag (bytes) allowed for routing */
+   bool replica_balance;                             /**< Balance the replica clients by round trip time and backends */
    pid_t health_check_pid;                           /**< The health check PID */
+   pid_t multiplex_pid[NUMBER_OF_MULTIPLEX_WORKERS]; /**< The transaction multiplexer PIDs */
+   pid_t notify_pid;                                 /**< The notification relay PID */
+   pid_t console_pid;                                /**< The console PID */
+   pid_t tunnel_pid[NUMBER_OF_TUNNEL_LINKS];         /**< The tunnel link PIDs */
    int startup_validation;                           /**< Startup server identifier validation mode */
    int disconnect_client;                            /**< Disconnect client if idle for more than the specified seconds */
    bool disconnect_client_force;                     /**< Force a disconnect client if active for more than the specified seconds */
    char pidfile[MAX_PATH];                           /**< File containing the PID */
 
    int ev_backend;                 /**< Selected ev backend */
+   bool io_uring_batch;            /**< Batch io_uring sends */
+   bool io_uring_sqpoll;           /**< Use an io_uring submission queue polling thread */
+   int io_uring_sqpoll_cpu;        /**< The CPU for the submission queue polling thread */
+   int io_uring_zero_copy;         /**< The message size from which io_uring sends are zero-copy */
+   bool ev_edge_triggered;         /**< Edge-triggered epoll watchers */
+   bool coalesce_writes;           /**< Coalesce forwarded writes with MSG_MORE */
+   bool metrics_accounting;        /**< Account CPU and syscalls per pipeline */
    bool keep_alive;                /**< Use keep alive */
    bool nodelay;                   /**< Use NODELAY */
+   pgagroal_time_t tcp_user_timeout;       /**< The time unacknowledged data may stay on a socket, 0 for the kernel default */
+   pgagroal_time_t tcp_keepalive_idle;     /**< The idle time before the first keep alive probe, 0 for the kernel default */
+   pgagroal_time_t tcp_keepalive_interval; /**< The time between keep alive probes, 0 for the kernel default */
+   int tcp_keepalive_count;                /**< The unanswered keep alive probes before a socket is dead, 0 for the kernel default */
+   pgagroal_time_t write_timeout;          /**< The time a write may wait for the peer to read, 0 for no limit */
+   pgagroal_time_t dns_cache_ttl;          /**< The time the addresses of a server host are cached, 0 for no cache */
+   pgagroal_time_t connect_timeout;        /**< The time a backend connect may take over all addresses, 0 for no limit */
    int backlog;                    /**< The backlog for listen */
+   int prefork_workers;            /**< The number of pre-forked client workers */
+   bool startup_gate;              /**< Wait for the startup packet in the main process before a worker */
+   int multiplex_workers;          /**< The number of transaction multiplexer processes */
+   bool lazy_reset;                /**< Only reset a session connection when its state changed */
+   bool log_async;                 /**< Log through the logger process */
+   int transaction_stickiness;     /**< Milliseconds a transaction client keeps its connection */
+   int busy_poll;                  /**< Microseconds a worker spins for events before blocking */
+   pgagroal_time_t idle_transaction_timeout; /**< The time a transaction may wait for the client, 0 if disabled */
+   int idle_transaction_action;              /**< The action on an idle transaction */
+   bool notify_relay;                        /**< Relay LISTEN and NOTIFY for the transaction clients */
+   unsigned int query_cache_max_size;   /**< The size of the query cache, 0 if disabled */
+   pgagroal_time_t query_cache_max_age; /**< The duration a cached query reply is served */
+   bool query_statistics;               /**< Collect the query fingerprint statistics */
+   int query_statistics_sample;         /**< One in this many queries is fingerprinted */
+   int query_statistics_top;            /**< The number of fingerprints in the metrics */
+   int acceptors;                  /**< The number of processes accepting on the main port */
+   int numa_node;                  /**< The NUMA node of the processes and the shared memory, -1 if none */
+   bool performance_splice;        /**< Relay server data with splice() in the performance pipeline */
    bool tracker;                   /**< Tracker support */
+   int slow_acquire_threshold;     /**< Milliseconds a connection wait is recorded from, 0 if disabled */
+   int slow_transaction_threshold; /**< Milliseconds a transaction is recorded from, 0 if disabled */
    bool track_prepared_statements; /**< Track prepared statements (transaction pooling) */
+   bool track_session_parameters;  /**< Synchronize the session parameters of a backend (transaction pooling) */
+
+   char cluster_peers[MAX_PATH];           /**< The management ports of the instances sharing the limit entries */
+   char cluster_user[MAX_USERNAME_LENGTH]; /**< The admin to authenticate to the peers with */
+   pgagroal_time_t cluster_lease;          /**< The time a report of a peer is valid (Default seconds) */
+
+   char tunnel[MISC_LENGTH];        /**< The host:port of the central pgagroal the clients are tunneled to */
+   char tunnel_host[MISC_LENGTH];   /**< The host of the central pgagroal */
+   int tunnel_host_port;            /**< The tunnel port of the central pgagroal */
+   int tunnel_links;                /**< The number of links to the central pgagroal */
+   int tunnel_compression;          /**< The compression of the tunnel frames */
+   bool tunnel_tls;                 /**< Are the links protected by TLS */
+   int tunnel_port;                 /**< The port the links of the edges are accepted on */
 
    char unix_socket_dir[MISC_LENGTH]; /**< The directory for the Unix Domain Socket */
 
    atomic_schar su_connection; /**< The superuser connection */
+   atomic_schar security_lock; /**< The security message store lock */
 
    int number_of_servers;        /**< The number of servers */
    int number_of_hbas;           /**< The number of HBA entries */
@@ -753,10 +1263,31 @@ struct main_configuration
    int number_of_users;          /**< The number of users */
    int number_of_frontend_users; /**< The number of users */
    int number_of_admins;         /**< The number of admins */
+   int number_of_cluster_peers;  /**< The number of cluster peers */
+
+   atomic_ullong free_slots[NUMBER_OF_LIMITS + 1][NUMBER_OF_FREE_SLOT_WORDS]; /**< The free slot index per limit rule (0 is no rule) */
+   atomic_int clients[NUMBER_OF_CLIENTS];                                     /**< The client worker PIDs hashed on the PID (0 is free, -1 is deleted) */
+   struct pool_key pool_keys[NUMBER_OF_POOL_KEYS];                            /**< The interned pool keys */
+   atomic_uint waiter_ticket;                                                 /**< The next waiter ticket */
+   atomic_int waiters[NUMBER_OF_LIMITS + 1];                                  /**< The number of waiters per limit rule (0 is no rule) */
+   struct limit_demand limit_demands[NUMBER_OF_LIMITS];                       /**< The demand per limit rule */
+   struct cluster_peer cluster[NUMBER_OF_CLUSTER_PEERS];                      /**< The cluster peers */
+   struct pool_waiter pool_waiters[NUMBER_OF_WAITERS];                        /**< The waiters */
+   struct scram_key scram_keys[NUMBER_OF_SCRAM_KEYS];                         /**< The backend SCRAM-SHA-256 keys */
+   atomic_int tls_ticket_key;                                                 /**< The current TLS session ticket key */
+   atomic_uint tls_generation;                                                /**< The generation of the shared TLS contexts */
+   atomic_uint limits_generation;                                             /**< The generation of the limit entries */
+   struct tls_ticket_key tls_ticket_keys[NUMBER_OF_TLS_TICKET_KEYS];          /**< The TLS session ticket keys */
+   struct auth_query_entry auth_query_entries[NUMBER_OF_AUTH_QUERY_ENTRIES];  /**< The authentication query cache */
+   struct client_rate client_rates[NUMBER_OF_CLIENT_RATES];                   /**< The client_connection_rate buckets */
+   atomic_int cancel_keys[NUMBER_OF_CANCEL_KEYS];                             /**< The slots hashed on the backend PID (-1 is none) */
+   struct timer_wheel idle_wheel;                                             /**< The idle_timeout timer wheel */
+   struct timer_wheel age_wheel;                                              /**< The max_connection_age timer wheel */
 
    atomic_schar states[MAX_NUMBER_OF_CONNECTIONS]; /**< The states */
    struct server servers[NUMBER_OF_SERVERS];       /**< The servers */
    struct hba hbas[NUMBER_OF_HBAS];                /**< The HBA entries */
+   struct hba_matcher hba_matcher;                 /**< The compiled HBA entries */
    struct limit limits[NUMBER_OF_LIMITS];          /**< The limit entries */
    struct user users[NUMBER_OF_USERS];             /**< The users */
    struct user frontend_users[NUMBER_OF_USERS];    /**< The frontend users */
@@ -42,6 +42,7 @@ extern "C" {
 #define PIPELINE_PERFORMANCE 0
 #define PIPELINE_SESSION     1
 #define PIPELINE_TRANSACTION 2
+#define PIPELINE_STATEMENT   3
 
 typedef int (*initialize)(void *, void **, size_t *);
 typedef void (*start)(struct event_loop *, struct worker_io *);
@@ -82,6 +83,12 @@ struct pipeline session_pipeline(void);
  */
 struct pipeline transaction_pipeline(void);
 
+/**
+ * Get the statement pipeline
+ * @return The structure
+ */
+struct pipeline statement_pipeline(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -53,6 +53,30 @@ extern "C" {
 int
 pgagroal_get_connection(char* username, char* database, bool reuse, bool transaction_mode, int* slot, SSL** ssl);
 
+/**
+ * Get a connection to the replica with the least replication lag, or to the
+ * primary when no replica qualifies
+ * @param username The user name
+ * @param database The database
+ * @param slot The resulting slot
+ * @param ssl The resulting SSL (can be NULL)
+ * @return 0 upon success, 1 if pool is full, otherwise 2
+ */
+int
+pgagroal_get_replica_connection(char* username, char* database, int* slot, SSL** ssl);
+
+/**
+ * Get a connection without waiting for one to be returned
+ * @param username The user name
+ * @param database The database
+ * @param transaction_mode Obtain a connection in transaction mode
+ * @param slot The resulting slot
+ * @param ssl The resulting SSL (can be NULL)
+ * @return 0 upon success, 1 if pool is full, otherwise 2
+ */
+int
+pgagroal_try_connection(char* username, char* database, bool transaction_mode, int* slot, SSL** ssl);
+
 /**
  * Compute the next back-off delay for the blocking acquisition retry path.
  *
@@ -77,6 +101,31 @@ pgagroal_pool_next_retry_delay(long current_ns, int cap_ms);
 int
 pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode);
 
+/**
+ * Are there clients waiting for a connection with the limit rule of a slot
+ * @param slot The slot
+ * @return True if there are waiting clients, otherwise false
+ */
+bool
+pgagroal_pool_waiting(int slot);
+
+/**
+ * Get the number of backend connections a limit rule may have, which is the
+ * share of the instance when the limit entries are shared with cluster_peers
+ * @param rule The limit rule
+ * @return The number of backend connections
+ */
+int
+pgagroal_pool_limit_size(int rule);
+
+/**
+ * Close the free connections of a limit rule until it is within a size
+ * @param rule The limit rule
+ * @param size The number of backend connections
+ */
+void
+pgagroal_pool_trim(int rule, int size);
+
 /**
  * Kill a connection
  * @param slot The slot
@@ -86,6 +135,13 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode);
 int
 pgagroal_kill_connection(int slot, SSL* ssl);
 
+/**
+ * Sample the demand of the limit entries, and grow or shrink their pools
+ * within min_size and max_size accordingly
+ */
+void
+pgagroal_adaptive_pool(void);
+
 /**
  * Perform idle timeout
  */
@@ -119,6 +175,19 @@ pgagroal_flush(int mode, char* database);
 void
 pgagroal_flush_server(signed char server);
 
+/**
+ * Flush the pool progressively. At most flush_rate backends are retired per second,
+ * the idle ones are terminated and the ones in use are recycled when returned,
+ * while the replacements are prefilled
+ * @param database The database
+ * @param timeout The seconds after which the backends still in use are terminated, 0 for none
+ * @param flushed The number of idle backends terminated
+ * @param recycled The number of backends recycled when returned
+ * @param forced The number of backends in use terminated at the timeout
+ */
+void
+pgagroal_flush_progressive(char* database, int64_t timeout, int* flushed, int* recycled, int* forced);
+
 /**
  * Flush the pool (JSON)
  * @param ssl The SSL connection
@@ -144,6 +213,14 @@ pgagroal_prefill(bool initial);
 int
 pgagroal_pool_init(void);
 
+/**
+ * Change max_connections within the connection slots. The free connections
+ * above a lower limit are closed, and the ones in use when they are returned
+ * @param max_connections The new maximum number of connections
+ */
+void
+pgagroal_pool_resize(int max_connections);
+
 /**
  * Shutdown the pool
  * @return 0 upon success, otherwise 1
@@ -158,6 +235,52 @@ pgagroal_pool_shutdown(void);
 int
 pgagroal_pool_status(void);
 
+/**
+ * Account for a new client connection against the client_connection_rate
+ * of its address
+ * @param address The client address
+ * @return True if the client is over its rate and should be rejected, otherwise false
+ */
+bool
+pgagroal_client_throttled(char* address);
+
+/**
+ * Index the backend key of a slot for the cancel requests
+ * @param slot The slot
+ */
+void
+pgagroal_cancel_key_register(int slot);
+
+/**
+ * Hand an idle connection over to a pgagroal process taking over, and
+ * detach it from the pool without terminating it
+ * @param client_fd The descriptor of the process taking over
+ * @param slot The slot
+ * @param handed_over Set to true if the connection was handed over
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_pool_hand_over(int client_fd, int slot, bool* handed_over);
+
+/**
+ * Take over an idle connection from the pgagroal process handing over
+ * @param client_fd The descriptor of the process handing over
+ * @param done Set to true when there are no more connections
+ * @param slot The slot the connection is pooled in, or -1 if it was rejected
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_pool_take_over(int client_fd, bool* done, int* slot);
+
+/**
+ * Forward a cancel request to the server of the backend it is for
+ * @param pid The backend process id
+ * @param secret The backend secret
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_cancel_request(int pid, int secret);
+
 /**
  * This function wraps around the logic to call `pgagroal_prefill()`.
  * In order to avoid code repetition, this function can be used safely
@@ -177,6 +300,48 @@ pgagroal_pool_status(void);
 void
 pgagroal_prefill_if_can(bool do_fork, bool initial);
 
+/**
+ * Get the interned key of a limit rule, user name and real database. Slots
+ * with the same key can be reused for each other
+ * @param best_rule The limit rule, or -1
+ * @param username The user name
+ * @param real_database The real database, aliases resolved
+ * @return The key, or 0 if the key can't be interned
+ */
+int
+pgagroal_pool_key(int best_rule, char* username, char* real_database);
+
+/**
+ * Place a slot in the bucket of its due time. A slot that is already due
+ * goes into the next bucket to be processed
+ * @param wheel The timer wheel
+ * @param timeout The timeout in seconds, which sets the span of a bucket
+ * @param due The due time
+ * @param slot The slot
+ */
+void
+pgagroal_timer_wheel_add(struct timer_wheel* wheel, int timeout, time_t due, int slot);
+
+/**
+ * Take a slot out of the bucket of its due time
+ * @param wheel The timer wheel
+ * @param timeout The timeout in seconds
+ * @param due The due time the slot was added with
+ * @param slot The slot
+ */
+void
+pgagroal_timer_wheel_remove(struct timer_wheel* wheel, int timeout, time_t due, int slot);
+
+/**
+ * Claim the slots of the buckets that have fully elapsed since the previous call
+ * @param wheel The timer wheel
+ * @param timeout The timeout in seconds
+ * @param now The current time
+ * @param due The resulting slots, NUMBER_OF_FREE_SLOT_WORDS words
+ */
+void
+pgagroal_timer_wheel_advance(struct timer_wheel* wheel, int timeout, time_t now, unsigned long long* due);
+
 #ifdef __cplusplus
 }
 #endif
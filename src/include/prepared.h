@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_PREPARED_H
+#define PGAGROAL_PREPARED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <message.h>
+
+#include <stdbool.h>
+
+/**
+ * Handle a frame from the client. Named Parse messages are recorded in the
+ * registry of the client, and a Bind or Describe of a statement that the
+ * backend lacks is preceded by a Close and Parse of it. A Parse of a name
+ * the backend already has is preceded by a Close of it. The Parse and Sync
+ * messages are kept until the backend answers them
+ * @param slot The slot of the backend
+ * @param socket The descriptor of the backend
+ * @param idle Has the backend answered everything sent to it
+ * @param frame The frame
+ * @param deallocate Set when the backend may get a statement that isn't tracked
+ * @return 0 upon success, otherwise 1 when the backend can't be used anymore
+ */
+int
+pgagroal_prepared_client(int slot, int socket, bool idle, struct message_frame* frame, bool* deallocate);
+
+/**
+ * Handle a frame from the backend. A statement is recorded for the backend
+ * when its ParseComplete arrives. An error saying that a statement is
+ * missing or already exists means the cache of the backend is stale
+ * @param slot The slot of the backend
+ * @param frame The frame
+ * @param deallocate Set when the backend may hold a statement that isn't tracked
+ */
+void
+pgagroal_prepared_server(int slot, struct message_frame* frame, bool* deallocate);
+
+/**
+ * Forget the statements prepared on a backend
+ * @param slot The slot
+ */
+void
+pgagroal_prepared_reset(int slot);
+
+/**
+ * Destroy the registry of the client
+ */
+void
+pgagroal_prepared_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
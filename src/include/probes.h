@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_PROBES_H
+#define PGAGROAL_PROBES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <utils.h>
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#endif
+
+/*
+ * USDT probes under the pgagroal provider, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/pgagroal:pgagroal:get_connection_done { @[arg1] = hist(arg3); }'
+ *
+ * Without HAVE_USDT every probe is an empty inline function
+ */
+
+/**
+ * Are the probes compiled in
+ * @return True if they are, otherwise false
+ */
+static inline bool
+pgagroal_probe_enabled(void)
+{
+#ifdef HAVE_USDT
+   return true;
+#else
+   return false;
+#endif
+}
+
+/**
+ * Start the clock for a probe that reports a duration
+ * @param start The start
+ */
+static inline void
+pgagroal_probe_clock(struct timespec* start)
+{
+#ifdef HAVE_USDT
+   clock_gettime(CLOCK_MONOTONIC, start);
+#else
+   (void)start;
+#endif
+}
+
+/**
+ * Probe: get_connection_start(username, database, limit_rule)
+ * @param username The user name
+ * @param database The database
+ * @param rule The limit rule
+ */
+static inline void
+pgagroal_probe_get_connection_start(char* username, char* database, int rule)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE3(pgagroal, get_connection_start, username, database, rule);
+#else
+   (void)username;
+   (void)database;
+   (void)rule;
+#endif
+}
+
+/**
+ * Probe: get_connection_done(slot, limit_rule, result, usec)
+ * @param slot The slot, or -1
+ * @param rule The limit rule
+ * @param result The result of pgagroal_get_connection()
+ * @param start The start of the call
+ */
+static inline void
+pgagroal_probe_get_connection_done(int slot, int rule, int result, struct timespec* start)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE4(pgagroal, get_connection_done, slot, rule, result, pgagroal_time_elapsed_usec(start));
+#else
+   (void)slot;
+   (void)rule;
+   (void)result;
+   (void)start;
+#endif
+}
+
+/**
+ * Probe: return_connection(slot, limit_rule, transaction_mode)
+ * @param slot The slot
+ * @param rule The limit rule
+ * @param transaction_mode Is the connection returned by the transaction pipeline
+ */
+static inline void
+pgagroal_probe_return_connection(int slot, int rule, bool transaction_mode)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE3(pgagroal, return_connection, slot, rule, transaction_mode ? 1 : 0);
+#else
+   (void)slot;
+   (void)rule;
+   (void)transaction_mode;
+#endif
+}
+
+/**
+ * Probe: kill_connection(slot, limit_rule, server)
+ * @param slot The slot
+ * @param rule The limit rule
+ * @param server The server
+ */
+static inline void
+pgagroal_probe_kill_connection(int slot, int rule, int server)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE3(pgagroal, kill_connection, slot, rule, server);
+#else
+   (void)slot;
+   (void)rule;
+   (void)server;
+#endif
+}
+
+/**
+ * Probe: authenticate_start(client_fd, address)
+ * @param client_fd The client descriptor
+ * @param address The client address
+ */
+static inline void
+pgagroal_probe_authenticate_start(int client_fd, char* address)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE2(pgagroal, authenticate_start, client_fd, address);
+#else
+   (void)client_fd;
+   (void)address;
+#endif
+}
+
+/**
+ * Probe: authenticate_done(client_fd, slot, result, usec)
+ * @param client_fd The client descriptor
+ * @param slot The slot, or -1
+ * @param result The AUTH_* result
+ * @param start The start of the authentication
+ */
+static inline void
+pgagroal_probe_authenticate_done(int client_fd, int slot, int result, struct timespec* start)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE4(pgagroal, authenticate_done, client_fd, slot, result, pgagroal_time_elapsed_usec(start));
+#else
+   (void)client_fd;
+   (void)slot;
+   (void)result;
+   (void)start;
+#endif
+}
+
+/**
+ * Probe: transaction_begin(client_fd, database)
+ * @param client_fd The client descriptor
+ * @param database The database
+ */
+static inline void
+pgagroal_probe_transaction_begin(int client_fd, char* database)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE2(pgagroal, transaction_begin, client_fd, database);
+#else
+   (void)client_fd;
+   (void)database;
+#endif
+}
+
+/**
+ * Probe: transaction_end(slot, limit_rule, usec, server_usec)
+ * @param slot The slot
+ * @param rule The limit rule
+ * @param usec The transaction time, including the wait for a connection
+ * @param server_usec The time spent waiting on the server
+ */
+static inline void
+pgagroal_probe_transaction_end(int slot, int rule, long long usec, long long server_usec)
+{
+#ifdef HAVE_USDT
+   DTRACE_PROBE4(pgagroal, transaction_end, slot, rule, usec, server_usec);
+#else
+   (void)slot;
+   (void)rule;
+   (void)usec;
+   (void)server_usec;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -35,6 +35,7 @@ extern "C" {
 #endif
 
 #include <ev.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // Certificate type constants
@@ -67,6 +68,34 @@ extern "C" {
  */
 #define PROMETHEUS_DEFAULT_CACHE_SIZE (256 * 1024)
 
+/**
+ * The longest time the counters of a worker process
+ * are kept locally before they are published (in milliseconds).
+ */
+#define PROMETHEUS_PUBLISH_INTERVAL 1000
+
+/**
+ * The outcomes of a wait for a connection
+ */
+#define PROMETHEUS_WAIT_REUSE   0
+#define PROMETHEUS_WAIT_CREATED 1
+#define PROMETHEUS_WAIT_TIMEOUT 2
+
+/**
+ * The phases of the creation of a backend
+ */
+#define PROMETHEUS_PHASE_CONNECT        0
+#define PROMETHEUS_PHASE_TLS            1
+#define PROMETHEUS_PHASE_AUTHENTICATION 2
+#define PROMETHEUS_PHASE_PARAMETERS     3
+
+/**
+ * The reasons a backend is created
+ */
+#define PROMETHEUS_CREATED_DEMAND  0
+#define PROMETHEUS_CREATED_PREFILL 1
+#define PROMETHEUS_CREATED_RECYCLE 2
+
 /**
  * Create a prometheus instance
  * @param client_ssl The client SSL structure
@@ -83,6 +112,16 @@ pgagroal_prometheus(SSL* client_ssl, int fd);
 void
 pgagroal_vault_prometheus(SSL* client_ssl, int fd);
 
+/**
+ * Render the metrics of the pool straight from shared memory, in the
+ * same text format as the /metrics page
+ * @param text The resulting text, must be freed by the caller
+ * @param length The length of the text
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_prometheus_exposition(char** text, size_t* length);
+
 /**
  * Initialize prometheus shmem
  */
@@ -120,6 +159,44 @@ pgagroal_prometheus_connection_kill(void);
 void
 pgagroal_prometheus_connection_remove(void);
 
+/**
+ * Add the time a client waited for a connection
+ * @param limit_index The limit rule, or -1
+ * @param usec The wait time in microseconds
+ * @param outcome The outcome of the wait
+ */
+void
+pgagroal_prometheus_connection_wait(int limit_index, long long usec, int outcome);
+
+/**
+ * Find or add the transaction latencies of a database
+ * @param database The database
+ * @return The index, or -1 if all entries are used
+ */
+int
+pgagroal_prometheus_database_index(char* database);
+
+/**
+ * Add the time of a transaction
+ * @param index The database index
+ * @param usec The transaction time in microseconds
+ * @param service_usec The time the server spent on the transaction in microseconds
+ */
+void
+pgagroal_prometheus_transaction_time(int index, long long usec, long long service_usec);
+
+/**
+ * Add a sampled query to its fingerprint. The sample is dropped when
+ * another process is updating the fingerprints
+ * @param fingerprint The fingerprint
+ * @param query The normalized query
+ * @param usec The backend time in microseconds
+ * @param rows The number of rows
+ * @param weight The number of queries the sample stands for
+ */
+void
+pgagroal_prometheus_query_statistics(uint64_t fingerprint, char* query, long long usec, long long rows, int weight);
+
 /**
  * Connection timeout
  */
@@ -224,6 +301,12 @@ pgagroal_prometheus_auth_user_bad_password(void);
 void
 pgagroal_prometheus_auth_user_error(void);
 
+/**
+ * Increase the number of clients rejected by client_connection_rate
+ */
+void
+pgagroal_prometheus_client_rate_limited(void);
+
 /**
  * Increase client_wait by 1
  */
@@ -274,6 +357,19 @@ pgagroal_prometheus_query_count_specified_reset(int slot);
 void
 pgagroal_prometheus_tx_count_add(void);
 
+/**
+ * Count a transaction that waited for its client longer than idle_transaction_timeout
+ * @param action The idle_transaction_action that was taken
+ */
+void
+pgagroal_prometheus_idle_transaction_timeout(int action);
+
+/**
+ * Add the message pool statistics of this process
+ */
+void
+pgagroal_prometheus_memory_pool_add(void);
+
 /**
  * Increase network_sent
  * @param s The size
@@ -288,6 +384,84 @@ pgagroal_prometheus_network_sent_add(ssize_t s);
 void
 pgagroal_prometheus_network_received_add(ssize_t s);
 
+/**
+ * Increase query_count and query_count for the specified connection by 1
+ * in the counters of this process
+ * @param slot The connection slot
+ */
+void
+pgagroal_prometheus_local_query_count_add(int slot);
+
+/**
+ * Increase network_sent in the counters of this process
+ * @param s The size
+ */
+void
+pgagroal_prometheus_local_network_sent_add(ssize_t s);
+
+/**
+ * Increase network_received in the counters of this process
+ * @param s The size
+ */
+void
+pgagroal_prometheus_local_network_received_add(ssize_t s);
+
+/**
+ * Increase the time writes waited for a peer to read in the counters of this process
+ * @param client Was the peer the client
+ * @param usec The microseconds
+ */
+void
+pgagroal_prometheus_local_write_blocked_add(bool client, long long usec);
+
+/**
+ * Start the cost accounting of a pipeline in this process, when
+ * metrics_accounting is on
+ * @param pipeline The pipeline
+ */
+void
+pgagroal_prometheus_local_accounting_start(int pipeline);
+
+/**
+ * Stop the cost accounting of this process, and add the CPU time
+ * since the start to the session histograms
+ */
+void
+pgagroal_prometheus_local_accounting_stop(void);
+
+/**
+ * Account a read in this process
+ * @param client Was the read from the client
+ */
+void
+pgagroal_prometheus_local_read_add(bool client);
+
+/**
+ * Account a write in this process
+ * @param client Was the write to the client
+ */
+void
+pgagroal_prometheus_local_write_add(bool client);
+
+/**
+ * Account an event loop wakeup in this process
+ */
+void
+pgagroal_prometheus_local_wakeup_add(void);
+
+/**
+ * Account the end of a transaction in this process, the reads, writes
+ * and wakeups since the previous end belong to it
+ */
+void
+pgagroal_prometheus_local_transaction_end(void);
+
+/**
+ * Publish the counters of this process
+ */
+void
+pgagroal_prometheus_local_publish(void);
+
 /**
  * Increase client_sockets by 1
  */
@@ -331,6 +505,44 @@ pgagroal_prometheus_server_error(int server);
 void
 pgagroal_prometheus_failed_servers(void);
 
+/**
+ * Add the time of a phase of the creation of a backend
+ * @param server The server
+ * @param phase The phase
+ * @param usec The time in microseconds
+ */
+void
+pgagroal_prometheus_backend_phase(int server, int phase, long long usec);
+
+/**
+ * Count a backend created for a server
+ * @param server The server
+ * @param reason The reason
+ */
+void
+pgagroal_prometheus_backend_created(int server, int reason);
+
+/**
+ * A prefill round starts
+ * @param missing The connections the round creates
+ */
+void
+pgagroal_prometheus_prefill_start(int missing);
+
+/**
+ * A connection of a prefill round is done
+ * @param created Was the connection created
+ */
+void
+pgagroal_prometheus_prefill_connection(bool created);
+
+/**
+ * A prefill round ends
+ * @param unstarted The connections the round didn't start
+ */
+void
+pgagroal_prometheus_prefill_end(int unstarted);
+
 /**
  * Add a logging count
  * @param logging The logging type
@@ -338,6 +550,12 @@ pgagroal_prometheus_failed_servers(void);
 void
 pgagroal_prometheus_logging(int logging);
 
+/**
+ * Count a logging statement dropped by the asynchronous ring
+ */
+void
+pgagroal_prometheus_logging_dropped(void);
+
 /**
  * Allocates, for the first time, the Prometheus cache.
  *
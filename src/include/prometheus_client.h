@@ -38,13 +38,21 @@ extern "C" {
 
 #include <time.h>
 
+struct prometheus_arena;
+
 /**
  * @struct prometheus_bridge
  * Parsed representation of a Prometheus scrape result.
+ *
+ * Metric names, label keys and label values are interned in an arena that
+ * is owned by the bridge, so they are shared between the samples and stay
+ * valid until the bridge is destroyed.
  */
 struct prometheus_bridge
 {
-   struct art* metrics; /**< ART keyed by metric name, values are @ref prometheus_metric */
+   struct art* metrics;            /**< ART keyed by metric name, values are @ref prometheus_metric */
+   struct art* names;              /**< ART of the interned strings */
+   struct prometheus_arena* arena; /**< The arena holding the interned strings and label sets */
 };
 
 /**
@@ -57,6 +65,7 @@ struct prometheus_metric
    char* help;                /**< HELP text */
    char* type;                /**< TYPE value (counter, gauge, histogram, summary, ...) */
    struct deque* definitions; /**< Deque of @ref prometheus_attributes entries */
+   struct art* index;         /**< ART keyed by the label text, values are @ref prometheus_attributes */
 };
 
 /**
@@ -65,8 +74,9 @@ struct prometheus_metric
  */
 struct prometheus_attributes
 {
-   struct deque* attributes; /**< Deque of @ref prometheus_attribute */
-   struct deque* values;     /**< Deque of @ref prometheus_value */
+   struct prometheus_attribute* attributes; /**< Array of @ref prometheus_attribute */
+   int number_of_attributes;                /**< The number of attributes */
+   struct deque* values;                    /**< Deque of @ref prometheus_value */
 };
 
 /**
@@ -76,7 +86,7 @@ struct prometheus_attributes
 struct prometheus_value
 {
    time_t timestamp; /**< Timestamp when the sample was observed */
-   char* value;      /**< Sample value as text */
+   double value;     /**< Sample value */
 };
 
 /**
@@ -85,8 +95,8 @@ struct prometheus_value
  */
 struct prometheus_attribute
 {
-   char* key;   /**< Label key */
-   char* value; /**< Label value */
+   char* key;   /**< Label key, interned */
+   char* value; /**< Label value, interned */
 };
 
 /**
@@ -109,6 +119,8 @@ pgagroal_prometheus_client_destroy_bridge(struct prometheus_bridge* bridge);
 
 /**
  * Scrape the local metrics endpoint and populate the provided bridge.
+ * Inside the pool the metrics are rendered straight from shared memory
+ * instead.
  *
  * @param endpoint Reserved endpoint selector. Current implementation uses the configured metrics endpoint.
  * @param bridge Destination bridge to populate.
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_QUERY_CACHE_H
+#define PGAGROAL_QUERY_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <message.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define QUERY_CACHE_ENTRY_SIZE 8192
+#define QUERY_CACHE_PROBES     8
+
+#define QUERY_CACHE_REPLY_DESCRIPTION 0
+#define QUERY_CACHE_REPLY_ROWS        1
+#define QUERY_CACHE_REPLY_READY       2
+#define QUERY_CACHE_REPLY_DONE        3
+
+/** @struct query_cache_entry
+ * Defines an entry of the query cache. The key and the reply follow the
+ * entry within QUERY_CACHE_ENTRY_SIZE
+ */
+struct query_cache_entry
+{
+   atomic_int lock;     /**< The number of readers, -1 while written */
+   atomic_ullong hash;  /**< The hash of the key, 0 if empty */
+   atomic_ullong used;  /**< The last use, for the eviction */
+   time_t valid_until;  /**< The expiry timestamp */
+   int key_length;      /**< The length of the key */
+   int data_length;     /**< The length of the reply */
+} __attribute__((aligned(64)));
+
+/** @struct query_cache
+ * Defines the query cache
+ */
+struct query_cache
+{
+   atomic_ullong clock;   /**< The use counter */
+   int number_of_entries; /**< The number of entries */
+   char entries[];        /**< The entries */
+};
+
+/**
+ * Create the query cache shared memory segment
+ * @param p_size The resulting size of the segment
+ * @param p_shmem The resulting segment
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_query_cache_init(size_t* p_size, void** p_shmem);
+
+/**
+ * Can the reply of a simple query be cached. The query is a single SELECT
+ * without INTO and row locks, and only calls the functions known to have no
+ * side effects
+ * @param query The query text
+ * @param length The length of the query text
+ * @return true if the query can be cached, otherwise false
+ */
+bool
+pgagroal_query_cache_cacheable(char* query, int length);
+
+/**
+ * Follow a reply to be cached, which is a RowDescription, the DataRow messages,
+ * a CommandComplete of a SELECT and an idle ReadyForQuery
+ * @param state The state of the reply, starting at QUERY_CACHE_REPLY_DESCRIPTION
+ * @param frame The next message of the reply
+ * @return true if the reply can still be cached, otherwise false
+ */
+bool
+pgagroal_query_cache_reply(int* state, struct message_frame* frame);
+
+/**
+ * Record the startup parameters of the client, which are part of the key
+ * @param msg The startup message
+ */
+void
+pgagroal_query_cache_startup(struct message* msg);
+
+/**
+ * Can a query change the session state that the replies depend on
+ * @param query The query text
+ * @param length The length of the query text
+ * @return true if the cache must not be used any more by the client, otherwise false
+ */
+bool
+pgagroal_query_cache_session(char* query, int length);
+
+/**
+ * Look up the reply of a simple query
+ * @param database The database
+ * @param username The user name
+ * @param query The query text
+ * @param length The length of the query text
+ * @param data The buffer for the reply, of QUERY_CACHE_ENTRY_SIZE bytes
+ * @param data_length The resulting length of the reply
+ * @return 0 upon a hit, otherwise 1
+ */
+int
+pgagroal_query_cache_get(char* database, char* username, char* query, int length, char* data, int* data_length);
+
+/**
+ * Store the reply of a simple query. The reply is dropped when it doesn't
+ * fit an entry, or when the entries it could go into are in use
+ * @param database The database
+ * @param username The user name
+ * @param query The query text
+ * @param length The length of the query text
+ * @param data The reply
+ * @param data_length The length of the reply
+ */
+void
+pgagroal_query_cache_put(char* database, char* username, char* query, int length, char* data, int data_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
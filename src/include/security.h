@@ -107,6 +107,58 @@ pgagroal_get_master_key(char** masterkey);
 char*
 pgagroal_get_user_password(char* username);
 
+/**
+ * Derive the SCRAM-SHA-256 verifier of a user from its password
+ * @param user The user
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_scram_verifier(struct user* user);
+
+/**
+ * Derive the SCRAM-SHA-256 verifiers of all users, frontend users, admins and the superuser,
+ * a user that already carries a verifier keeps it
+ * @param config The configuration
+ */
+void
+pgagroal_scram_verifiers(struct main_configuration* config);
+
+/**
+ * Find the first HBA entry allowing a user to a database from an address
+ * @param username The user name
+ * @param database The database
+ * @param address The client address
+ * @return The index of the entry, or -1 if none
+ */
+int
+pgagroal_hba_entry(char* username, char* database, char* address);
+
+/**
+ * Compile the HBA entries into the lookup structure used for authentication
+ * @param config The configuration
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_hba_compile(struct main_configuration* config);
+
+/**
+ * Remove cached authentication query results
+ * @param username The user name, or NULL for all users
+ * @return The number of removed entries
+ */
+int
+pgagroal_auth_query_cache_clear(char* username);
+
+/**
+ * Is a tunnel link allowed by the HBA entries of the tunnel database, which
+ * an entry for all databases doesn't cover
+ * @param identity The certificate identity of the edge
+ * @param address The address of the edge
+ * @return True if allowed, otherwise false
+ */
+bool
+pgagroal_tunnel_allowed(char* identity, char* address);
+
 /**
  * Is the user known to the system
  * @param user The user name
@@ -200,6 +252,42 @@ pgagroal_is_cert_authorized(const char* cert_identity, const char* requested_use
 int
 pgagroal_scram_client_auth(char* username, char* password, int socket, SSL* server_ssl, struct message** response_msg);
 
+/**
+ * Store a security message for a slot in the shared security message store.
+ * Identical messages for the same server and pool key share one entry
+ * @param slot The slot
+ * @param index The security message index
+ * @param data The message
+ * @param length The length of the message
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_security_store_message(int slot, int index, void* data, ssize_t length);
+
+/**
+ * Get a security message for a slot
+ * @param slot The slot
+ * @param index The security message index
+ * @return The message
+ */
+char*
+pgagroal_security_get_message(int slot, int index);
+
+/**
+ * Release the security messages of a slot
+ * @param slot The slot
+ */
+void
+pgagroal_security_release_messages(int slot);
+
+/**
+ * Are all the security messages of a slot in the shared store
+ * @param slot The slot
+ * @return True if the authentication of the slot can be replayed, otherwise false
+ */
+bool
+pgagroal_security_messages_cached(int slot);
+
 #ifdef __cplusplus
 }
 #endif
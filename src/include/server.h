@@ -46,6 +46,24 @@ extern "C" {
 int
 pgagroal_get_primary(int* server);
 
+/**
+ * Get a replica server within replica_max_lag. The replica with the least
+ * replication lag is used, or with replica_balance the one with the lowest
+ * round trip time weighted by its backend connections
+ * @param server The resulting server identifier
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_get_replica(int* server);
+
+/**
+ * Is the server a replica that clients can be routed to
+ * @param server The server
+ * @return True if eligible, otherwise false
+ */
+bool
+pgagroal_server_replica_eligible(int server);
+
 /**
  * Update the server state
  * @param slot The slot
@@ -33,10 +33,13 @@
 extern "C" {
 #endif
 
+#include <pgagroal.h>
+
 #include <stdlib.h>
 
 /**
- * Create a shared memory segment
+ * Create a shared memory segment. The segment is an anonymous mapping, so it
+ * is zero filled, and its pages are only touched on first use
  * @param size The size of the segment
  * @param hp Huge page value
  * @param shmem The shared memory segment
@@ -56,6 +59,24 @@ pgagroal_create_shared_memory(size_t size, unsigned char hp, void** shmem);
 int
 pgagroal_resize_shared_memory(size_t size, void* shmem, size_t* new_size, void** new_shmem);
 
+/**
+ * Get the connection information for a slot. The information array
+ * follows the connections in the main shared memory segment
+ * @param slot The slot
+ * @return The connection information
+ */
+struct connection_info*
+pgagroal_connection_info(int slot);
+
+/**
+ * Get the security message store. The store follows the connection
+ * information in the main shared memory segment and has
+ * SECURITY_MESSAGES_PER_SLOT entries per connection
+ * @return The security message store
+ */
+struct security_message*
+pgagroal_security_messages(void);
+
 /**
  * Destroy a shared memory segment
  * @param shmem The shared memory segment
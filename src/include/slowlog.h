@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGAGROAL_SLOWLOG_H
+#define PGAGROAL_SLOWLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgagroal.h>
+#include <json.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SLOWLOG_ACQUIRE     0
+#define SLOWLOG_TRANSACTION 1
+
+#define SLOWLOG_REUSE       0
+#define SLOWLOG_CREATED     1
+#define SLOWLOG_BUSY        2
+#define SLOWLOG_TIMEOUT     3
+#define SLOWLOG_ERROR       4
+#define SLOWLOG_DONE        5
+
+#define SLOWLOG_ENTRIES     1024
+#define SLOWLOG_NAME_LENGTH 64
+
+/** @struct slowlog_entry
+ * Defines a slow connection acquire or transaction in the ring
+ */
+struct slowlog_entry
+{
+   atomic_ullong sequence;             /**< The sequence number, 0 while the entry is written */
+   long long timestamp;                /**< The time of the entry (milliseconds) */
+   long long duration;                 /**< The wait, or the transaction time (microseconds) */
+   long long server_duration;          /**< The time the server was serving (microseconds), 0 for a wait */
+   int kind;                           /**< The kind of entry */
+   int outcome;                        /**< The outcome */
+   int pid;                            /**< The process */
+   int slot;                           /**< The slot, or -1 */
+   int limit_rule;                     /**< The limit rule, or -1 */
+   int server;                         /**< The server, or -1 */
+   char username[SLOWLOG_NAME_LENGTH]; /**< The user name */
+   char database[SLOWLOG_NAME_LENGTH]; /**< The database */
+   char appname[SLOWLOG_NAME_LENGTH];  /**< The application name */
+} __attribute__((aligned(64)));
+
+/** @struct slowlog_ring
+ * Defines the ring of slow entries, written and read like the tracker ring
+ */
+struct slowlog_ring
+{
+   atomic_ullong head;                            /**< The number of entries claimed */
+   struct slowlog_entry entries[SLOWLOG_ENTRIES]; /**< The entries */
+};
+
+/**
+ * Initialize the slow log ring
+ * @param p_size The size of the shared memory
+ * @param p_shmem The shared memory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_slowlog_init(size_t* p_size, void** p_shmem);
+
+/**
+ * Read the slow log entries newer than a sequence number
+ * @param since The last sequence number already seen
+ * @param response The response to add the entries to
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_slowlog_read(uint64_t since, struct json* response);
+
+/**
+ * Set the application name of the client of the process, an acquire is
+ * recorded before the name is on the slot
+ * @param appname The application name, or NULL
+ */
+void
+pgagroal_slowlog_application_name(char* appname);
+
+/**
+ * Record a connection acquire when the wait is over slow_acquire_threshold
+ * @param slot The slot, or -1
+ * @param limit_rule The limit rule, or -1
+ * @param outcome The outcome
+ * @param username The user name
+ * @param database The database
+ * @param start The start of the wait
+ */
+void
+pgagroal_slowlog_acquire(int slot, int limit_rule, int outcome, char* username, char* database, struct timespec* start);
+
+/**
+ * Record a transaction when it is over slow_transaction_threshold
+ * @param slot The slot
+ * @param transaction_time The transaction time, including the wait (microseconds)
+ * @param service_time The time the server was serving (microseconds)
+ */
+void
+pgagroal_slowlog_transaction(int slot, long long transaction_time, long long service_time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,26 +38,30 @@ extern "C" {
 #include <stdlib.h>
 
 /**
- * Create an status
+ * Send the status, serialized from shared memory without forking
  * @param ssl The SSL connection
  * @param client_fd The client
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @param writer The writer, its buffer is reused between requests
+ * @return 0 upon success, otherwise 1
  */
-void
-pgagroal_status(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
+int
+pgagroal_status(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload, struct json_writer* writer);
 
 /**
- * Create an status details
+ * Send the status details, serialized from shared memory without forking
  * @param ssl The SSL connection
  * @param client_fd The client
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @param writer The writer, its buffer is reused between requests
+ * @return 0 upon success, otherwise 1
  */
-void
-pgagroal_status_details(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
+int
+pgagroal_status_details(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload, struct json_writer* writer);
 
 #ifdef __cplusplus
 }
@@ -156,6 +156,14 @@ pgagroal_tls_set_fd(struct tls* tls, int fd);
 struct tls*
 pgagroal_tls_from_ssl(SSL* ssl);
 
+/**
+ * Is sending on an SSL connection offloaded to the kernel (kTLS)
+ * @param ssl The OpenSSL connection
+ * @return True if plain writes to the socket are encrypted by the kernel
+ */
+bool
+pgagroal_tls_ktls_send(SSL* ssl);
+
 /**
  * Drive a handshake to completion over a blocking socket, pumping ciphertext
  * between the engine and the descriptor
@@ -205,7 +213,7 @@ pgagroal_tls_configure_server_ctx(SSL_CTX* ctx, char* key_file, char* cert_file,
  * Create a socket-decoupled server-role context from configuration files
  * @param ctx The OpenSSL context
  * @param key_file The private key file
- * @param cert_file The certificate file
+ * @param cert_file The certificate file, or NULL if the context is configured already
  * @param ca_file The CA file, or an empty string for none
  * @param tls The resulting context
  * @return 0 upon success, otherwise 1
@@ -217,8 +225,8 @@ pgagroal_tls_create_server(SSL_CTX* ctx, char* key_file, char* cert_file, char*
  * Create a socket-decoupled client-role context from configuration files
  * @param ctx The OpenSSL context
  * @param key The private key file
- * @param cert The certificate file
- * @param root The root certificate file, or an empty string for none
+ * @param cert The certificate file, or NULL if the context is configured already
+ * @param root The root certificate file, or NULL / an empty string for none
  * @param tls The resulting context
  * @return 0 upon success, otherwise 1
  */
@@ -234,11 +242,63 @@ pgagroal_tls_create_client(SSL_CTX* ctx, char* key, char* cert, char* root, stru
 int
 pgagroal_create_ssl_ctx(bool client, SSL_CTX** ctx);
 
+/**
+ * Enable stateless session tickets on a server SSL context for the clients,
+ * the tickets are protected by the keys in the main configuration, so not
+ * for the vault
+ * @param ctx The SSL context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tls_session_tickets(SSL_CTX* ctx);
+
+/**
+ * Did the handshake agree on the postgresql ALPN protocol
+ * @param ssl The SSL connection
+ * @return true if postgresql was selected, otherwise false
+ */
+bool
+pgagroal_tls_alpn_postgresql(SSL* ssl);
+
+/**
+ * Build the shared frontend and backend SSL contexts, the contexts are
+ * inherited by the forked processes and replace the previous ones
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tls_contexts_create(void);
+
+/**
+ * Get a reference to the shared frontend SSL context, a process forked before
+ * the last pgagroal_tls_contexts_create() builds its own contexts first.
+ * Only for the processes of the main configuration
+ * @param ctx The SSL context, released with SSL_CTX_free()
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tls_server_context(SSL_CTX** ctx);
+
+/**
+ * Get a reference to the shared SSL context for a backend server
+ * @param server The server
+ * @param ctx The SSL context, released with SSL_CTX_free()
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tls_client_context(int server, SSL_CTX** ctx);
+
+/**
+ * Rotate the TLS session ticket keys, tickets of the previous key are still accepted
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tls_rotate_ticket_keys(void);
+
 /**
  * Create a SSL server
  * @param ctx The SSL context
  * @param key_file The key file path
- * @param cert_file The certificate file path
+ * @param cert_file The certificate file path, or NULL if the context is configured already
  * @param ca_file The ca file path
  * @param socket The socket
  * @param ssl The SSL structure
@@ -34,7 +34,10 @@ extern "C" {
 #endif
 
 #include <pgagroal.h>
+#include <json.h>
 
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #define TRACKER_CLIENT_START               0
@@ -74,6 +77,58 @@ extern "C" {
 #define TRACKER_SOCKET_DISASSOCIATE_CLIENT 102
 #define TRACKER_SOCKET_DISASSOCIATE_SERVER 103
 
+#define TRACKER_EVENTS      2048
+#define TRACKER_NAME_LENGTH 64
+
+/** @struct tracker_event
+ * Defines a tracker event in the ring
+ */
+struct tracker_event
+{
+   atomic_ullong sequence;                 /**< The sequence number, 0 while the event is written */
+   long long timestamp;                    /**< The time of the event (milliseconds) */
+   int id;                                 /**< The event identifier */
+   int slot;                               /**< The slot, or -1 */
+   int state;                              /**< The state of the slot */
+   int pid;                                /**< The process */
+   int server;                             /**< The server */
+   int limit_rule;                         /**< The limit rule */
+   int fd;                                 /**< The descriptor */
+   int active_connections;                 /**< The number of active connections */
+   char username[TRACKER_NAME_LENGTH];     /**< The user name */
+   char database[TRACKER_NAME_LENGTH];     /**< The database */
+   char appname[TRACKER_NAME_LENGTH];      /**< The application name */
+} __attribute__((aligned(64)));
+
+/** @struct tracker_ring
+ * Defines the ring of tracker events. Every process claims the next
+ * sequence number and writes its event without taking a lock, a reader
+ * only returns the events whose sequence is stable across the copy
+ */
+struct tracker_ring
+{
+   atomic_ullong head;                          /**< The number of events claimed */
+   struct tracker_event events[TRACKER_EVENTS]; /**< The events */
+};
+
+/**
+ * Initialize the tracker ring
+ * @param p_size The size of the shared memory
+ * @param p_shmem The shared memory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tracker_init(size_t* p_size, void** p_shmem);
+
+/**
+ * Read the tracker events newer than a sequence number
+ * @param since The last sequence number already seen
+ * @param response The response to add the events to
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_tracker_read(uint64_t since, struct json* response);
+
 /**
  * Tracking event: Basic
  * @param id The event identifier
@@ -56,13 +56,25 @@ struct accept_io
    char** argv;               /**< The argv */
 };
 
-/** @struct client
- * Defines the client structure
+/** @struct prefork
+ * Defines a pre-forked client worker
  */
-struct client
+struct prefork
 {
-   pid_t pid;           /**< The process id */
-   struct client* next; /**< The next client */
+   pid_t pid;           /**< The process id, 0 if the entry is empty */
+   int fd;              /**< The main side of the hand-off socket */
+   uint64_t generation; /**< The generation of the server descriptors it inherited */
+};
+
+/** @struct startup_client
+ * Defines an accepted client that hasn't sent its first packet yet
+ */
+struct startup_client
+{
+   struct io_watcher watcher; /**< The I/O (always first) */
+   int fd;                    /**< The client socket, -1 if the entry is empty */
+   time_t accepted;           /**< The time the client was accepted */
+   char address[MISC_LENGTH]; /**< The address of the client */
 };
 
 /** @struct pgagroal_command
@@ -381,10 +393,10 @@ pgagroal_set_proc_title(int argc, char** argv, char* s1, char* s2);
  *
  * @param argc the number of arguments
  * @param argv command line arguments
- * @param connection the struct connection pointer for the established connection.
+ * @param connection the struct connection_info pointer for the established connection.
  */
 void
-pgagroal_set_connection_proc_title(int argc, char** argv, struct connection* connection);
+pgagroal_set_connection_proc_title(int argc, char** argv, struct connection_info* connection);
 
 /**
  * Get the timestramp difference as a string
@@ -530,6 +542,16 @@ pgagroal_append_ullong(char* orig, unsigned long long l);
 char*
 pgagroal_append_char(char* orig, char c);
 
+/**
+ * Make room in a growable buffer
+ * @param buffer The buffer, reallocated as needed
+ * @param size The size of the buffer
+ * @param needed The size needed
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_buffer_reserve(unsigned char** buffer, size_t* size, size_t needed);
+
 /**
  * Indent a string
  * @param str The string
@@ -649,6 +671,16 @@ pgagroal_connection_state_as_string(signed char state);
 int
 pgagroal_os_kernel_version(char** os, int* kernel_major, int* kernel_minor, int* kernel_patch);
 
+/**
+ * Bind the process to a NUMA node. The process runs on the CPUs of the node,
+ * and its memory, and the shared memory it touches first, is preferably
+ * allocated on the node. The binding is inherited by the forked processes
+ * @param node The NUMA node
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_numa_bind(int node);
+
 /**
  * Remove all whitespace from a string
  * @param orig The original string
@@ -706,6 +738,14 @@ pgagroal_time_is_valid(pgagroal_time_t t);
 int
 pgagroal_time_format(pgagroal_time_t t, enum pgagroal_time_format_t fmt, char** output);
 
+/**
+ * Get the microseconds elapsed on the monotonic clock
+ * @param start The start, from clock_gettime(CLOCK_MONOTONIC)
+ * @return The elapsed microseconds
+ */
+long long
+pgagroal_time_elapsed_usec(struct timespec* start);
+
 /**
  * Parse a duration string into a non-negative number of seconds.
  * @param str the duration string
@@ -69,7 +69,8 @@ enum value_type {
 
 /**
  * @struct value
- * Defines a universal value
+ * Defines a universal value, scalars are kept in data and owned strings
+ * are stored right after the value in the same allocation
  */
 struct value
 {
@@ -77,6 +78,7 @@ struct value
    uintptr_t data;               /**< The data, could be passed by value or by reference */
    data_destroy_cb destroy_data; /**< The callback to destroy data */
    data_to_string_cb to_string;  /**< The callback to convert data to string */
+   char inline_data[];           /**< The storage of an owned string */
 };
 
 /**
@@ -120,6 +122,15 @@ pgagroal_value_create_with_config(uintptr_t data, struct value_config* config, s
 int
 pgagroal_value_destroy(struct value* value);
 
+/**
+ * Release a value but hand the data within over to the caller,
+ * an owned string is copied out of the value
+ * @param value The value
+ * @return The value data within
+ */
+uintptr_t
+pgagroal_value_release(struct value* value);
+
 /**
  * Get the raw data from the value, which can be casted back to its original type
  * @param value The value
@@ -33,6 +33,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 /**
@@ -55,6 +56,58 @@ pgagroal_zstdc_string(char* s, unsigned char** buffer, size_t* buffer_size);
 int
 pgagroal_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string);
 
+/**
+ * ZSTD compress a buffer into a buffer of the caller
+ * @param source The data
+ * @param source_size The size of the data
+ * @param destination The compressed data buffer
+ * @param capacity The capacity of the compressed data buffer
+ * @param size The size of the compressed data
+ * @return 0 upon success, otherwise 1 when the data doesn't compress into the capacity
+ */
+int
+pgagroal_zstdc_buffer(void* source, size_t source_size, void* destination, size_t capacity, size_t* size);
+
+/**
+ * ZSTD decompress a buffer of a known original size into a buffer of the caller
+ * @param source The compressed data
+ * @param source_size The size of the compressed data
+ * @param destination The data buffer, at least the original size
+ * @param size The original size
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_zstdd_buffer(void* source, size_t source_size, void* destination, size_t size);
+
+/**
+ * Create a ZSTD stream, the output is the same as for the string based function
+ * @param stream The resulting stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_zstd_stream_create(void** stream);
+
+/**
+ * Compress the next piece of a string
+ * @param stream The stream
+ * @param data The piece
+ * @param length The length of the piece
+ * @param last Is this the last piece
+ * @param buffer The compressed data buffer, grown as needed
+ * @param buffer_size The size of the compressed data buffer
+ * @param buffer_length The length of the compressed data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_zstd_stream_compress(void* stream, char* data, size_t length, bool last, unsigned char** buffer, size_t* buffer_size, size_t* buffer_length);
+
+/**
+ * Destroy a ZSTD stream
+ * @param stream The stream
+ */
+void
+pgagroal_zstd_stream_destroy(void* stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <activity.h>
+#include <json.h>
+#include <logging.h>
+#include <management.h>
+#include <shmem.h>
+
+/* system */
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static struct client_activity* current = NULL;
+
+static bool alive(int pid);
+static long long now(void);
+static void copy_name(char* dst, char* src, size_t size);
+static char* wait_name(int wait);
+
+int
+pgagroal_activity_init(size_t* p_size, void** p_shmem)
+{
+   size_t size;
+   struct client_activity* table = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   size = ACTIVITY_ENTRIES * sizeof(struct client_activity);
+
+   /* The mapping is zero filled, so every entry starts out free */
+   if (pgagroal_create_shared_memory(size, config->common.hugepage, (void**)&table))
+   {
+      goto error;
+   }
+
+   *p_shmem = table;
+   *p_size = size;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+void
+pgagroal_activity_start(char* address)
+{
+   int pid;
+   int expected;
+   long long t;
+   struct client_activity* table = NULL;
+   struct client_activity* e = NULL;
+
+   table = (struct client_activity*)activity_shmem;
+
+   if (table == NULL)
+   {
+      return;
+   }
+
+   pid = (int)getpid();
+   current = NULL;
+
+   /* The probe starts at the process, so concurrent clients rarely meet */
+   for (int i = 0; current == NULL && i < ACTIVITY_ENTRIES; i++)
+   {
+      e = &table[(pid + i) % ACTIVITY_ENTRIES];
+      expected = atomic_load_explicit(&e->pid, memory_order_relaxed);
+
+      /* The entry of an earlier process with the same pid is stale */
+      if (expected != 0 && expected != pid && alive(expected))
+      {
+         continue;
+      }
+
+      /* A process that was killed leaves its entry behind */
+      if (atomic_compare_exchange_strong(&e->pid, &expected, pid))
+      {
+         current = e;
+      }
+   }
+
+   if (current == NULL)
+   {
+      pgagroal_log_debug("pgagroal_activity_start: No entry for %d", pid);
+      return;
+   }
+
+   t = now();
+
+   atomic_store_explicit(&current->state, ACTIVITY_STARTING, memory_order_relaxed);
+   atomic_store_explicit(&current->wait, ACTIVITY_WAIT_CLIENT, memory_order_relaxed);
+   atomic_store_explicit(&current->slot, -1, memory_order_relaxed);
+   atomic_store_explicit(&current->state_change, t, memory_order_relaxed);
+   current->start = t;
+   current->username[0] = '\0';
+   current->database[0] = '\0';
+   current->appname[0] = '\0';
+   copy_name(&current->address[0], address, sizeof(current->address));
+}
+
+void
+pgagroal_activity_client(char* username, char* database, char* appname)
+{
+   if (current == NULL)
+   {
+      return;
+   }
+
+   copy_name(&current->username[0], username, ACTIVITY_NAME_LENGTH);
+   copy_name(&current->database[0], database, ACTIVITY_NAME_LENGTH);
+   copy_name(&current->appname[0], appname, ACTIVITY_NAME_LENGTH);
+}
+
+void
+pgagroal_activity_state(int state, int wait)
+{
+   if (current == NULL)
+   {
+      return;
+   }
+
+   /* Only the process writes its entry, so the old values are its own */
+   if (atomic_load_explicit(&current->state, memory_order_relaxed) != state)
+   {
+      atomic_store_explicit(&current->state_change, now(), memory_order_relaxed);
+      atomic_store_explicit(&current->state, state, memory_order_relaxed);
+   }
+
+   if (atomic_load_explicit(&current->wait, memory_order_relaxed) != wait)
+   {
+      atomic_store_explicit(&current->wait, wait, memory_order_relaxed);
+   }
+}
+
+void
+pgagroal_activity_slot(int slot)
+{
+   if (current == NULL)
+   {
+      return;
+   }
+
+   atomic_store_explicit(&current->slot, slot, memory_order_relaxed);
+}
+
+void
+pgagroal_activity_stop(void)
+{
+   if (current == NULL)
+   {
+      return;
+   }
+
+   atomic_store_explicit(&current->pid, 0, memory_order_release);
+   current = NULL;
+}
+
+int
+pgagroal_activity_read(struct json* response)
+{
+   int pid;
+   int number_of_clients = 0;
+   struct client_activity copy;
+   struct client_activity* table = NULL;
+   struct client_activity* e = NULL;
+   struct json* clients = NULL;
+   struct json* client = NULL;
+
+   table = (struct client_activity*)activity_shmem;
+
+   if (table == NULL || pgagroal_json_create(&clients))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < ACTIVITY_ENTRIES; i++)
+   {
+      e = &table[i];
+      pid = atomic_load_explicit(&e->pid, memory_order_acquire);
+
+      if (pid == 0)
+      {
+         continue;
+      }
+
+      if (!alive(pid))
+      {
+         atomic_compare_exchange_strong(&e->pid, &pid, 0);
+         continue;
+      }
+
+      /* The entry is read without a lock, so a name can be seen half written at the start of a client */
+      copy.start = e->start;
+      memcpy(&copy.username[0], &e->username[0], ACTIVITY_NAME_LENGTH);
+      memcpy(&copy.database[0], &e->database[0], ACTIVITY_NAME_LENGTH);
+      memcpy(&copy.appname[0], &e->appname[0], ACTIVITY_NAME_LENGTH);
+      memcpy(&copy.address[0], &e->address[0], sizeof(copy.address));
+
+      copy.username[ACTIVITY_NAME_LENGTH - 1] = '\0';
+      copy.database[ACTIVITY_NAME_LENGTH - 1] = '\0';
+      copy.appname[ACTIVITY_NAME_LENGTH - 1] = '\0';
+      copy.address[sizeof(copy.address) - 1] = '\0';
+
+      if (pgagroal_json_create(&client))
+      {
+         goto error;
+      }
+
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_PID, (uintptr_t)pid, ValueInt32);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_STATE, (uintptr_t)pgagroal_activity_state_name(atomic_load_explicit(&e->state, memory_order_relaxed)), ValueString);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_WAIT, (uintptr_t)wait_name(atomic_load_explicit(&e->wait, memory_order_relaxed)), ValueString);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_STATE_CHANGE, (uintptr_t)atomic_load_explicit(&e->state_change, memory_order_relaxed), ValueInt64);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_START_TIME, (uintptr_t)copy.start, ValueInt64);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_SLOT, (uintptr_t)atomic_load_explicit(&e->slot, memory_order_relaxed), ValueInt32);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)copy.username, ValueString);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)copy.database, ValueString);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_APPNAME, (uintptr_t)copy.appname, ValueString);
+      pgagroal_json_put(client, MANAGEMENT_ARGUMENT_ADDRESS, (uintptr_t)copy.address, ValueString);
+
+      pgagroal_json_append(clients, (uintptr_t)client, ValueJSON);
+      client = NULL;
+      number_of_clients++;
+   }
+
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_NUMBER_OF_CLIENTS, (uintptr_t)number_of_clients, ValueInt32);
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_CLIENTS, (uintptr_t)clients, ValueJSON);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(client);
+   pgagroal_json_destroy(clients);
+
+   return 1;
+}
+
+void
+pgagroal_activity_count(int* counts)
+{
+   int state;
+   struct client_activity* table = NULL;
+
+   table = (struct client_activity*)activity_shmem;
+
+   for (int i = 0; i < ACTIVITY_STATES; i++)
+   {
+      counts[i] = 0;
+   }
+
+   if (table == NULL)
+   {
+      return;
+   }
+
+   /* The entries of killed processes are counted until the next read of the table */
+   for (int i = 0; i < ACTIVITY_ENTRIES; i++)
+   {
+      if (atomic_load_explicit(&table[i].pid, memory_order_relaxed) == 0)
+      {
+         continue;
+      }
+
+      state = atomic_load_explicit(&table[i].state, memory_order_relaxed);
+
+      if (state >= 0 && state < ACTIVITY_STATES)
+      {
+         counts[state]++;
+      }
+   }
+}
+
+char*
+pgagroal_activity_state_name(int state)
+{
+   switch (state)
+   {
+      case ACTIVITY_STARTING:
+         return "starting";
+      case ACTIVITY_IDLE:
+         return "idle";
+      case ACTIVITY_ACTIVE:
+         return "active";
+      case ACTIVITY_IDLE_IN_TRANSACTION:
+         return "idle_in_transaction";
+      default:
+         break;
+   }
+
+   return "unknown";
+}
+
+static bool
+alive(int pid)
+{
+   return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static long long
+now(void)
+{
+   struct timeval t;
+
+   gettimeofday(&t, NULL);
+
+   return (long long)t.tv_sec * 1000 + t.tv_usec / 1000;
+}
+
+static void
+copy_name(char* dst, char* src, size_t size)
+{
+   size_t length = 0;
+
+   if (src != NULL)
+   {
+      length = strnlen(src, size - 1);
+      memcpy(dst, src, length);
+   }
+
+   dst[length] = '\0';
+}
+
+static char*
+wait_name(int wait)
+{
+   switch (wait)
+   {
+      case ACTIVITY_WAIT_NONE:
+         return "";
+      case ACTIVITY_WAIT_CONNECTION:
+         return "connection";
+      case ACTIVITY_WAIT_SERVER:
+         return "server";
+      case ACTIVITY_WAIT_CLIENT:
+         return "client";
+      default:
+         break;
+   }
+
+   return "unknown";
+}
@@ -36,9 +36,31 @@
 #include <pthread.h>
 #include <string.h>
 
+/* The number of messages encrypted with one session key before a new salt is drawn */
+#define AES_KEY_MAX_USES 65536
+
+/**
+ * @struct aes_key
+ * A session key derived from the master key and a salt
+ */
+struct aes_key
+{
+   bool valid;                             /**< Is the key set */
+   int mode;                               /**< The aes mode */
+   uint64_t generation;                    /**< The master key generation the key belongs to */
+   uint32_t uses;                          /**< The number of encryptions with the key */
+   unsigned char salt[PBKDF2_SALT_LENGTH]; /**< The salt */
+   unsigned char key[EVP_MAX_KEY_LENGTH];  /**< The key */
+};
+
 static int is_gcm(int mode);
 static int get_tag_length(int mode);
+static int derive_master_key(char* password);
 static int derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned char* iv, int mode);
+static int encryption_key(char* password, unsigned char* salt, unsigned char* key, unsigned char* iv, int mode);
+static int decryption_key(char* password, unsigned char* salt, unsigned char* key, int mode);
+static EVP_CIPHER_CTX* cipher_context(void);
+static void release_cipher_context(EVP_CIPHER_CTX* ctx);
 static int aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode);
 static int aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode);
 static const EVP_CIPHER* (*get_cipher(int mode))(void);
@@ -49,6 +71,10 @@ static _Thread_local unsigned char master_key_cache[EVP_MAX_KEY_LENGTH];
 static _Thread_local unsigned char cached_password_hash[EVP_MAX_MD_SIZE];
 static _Thread_local unsigned int cached_password_hash_len = 0;
 static _Thread_local bool master_key_cached = false;
+static _Thread_local uint64_t master_key_generation = 0;
+static _Thread_local struct aes_key encryption_key_cache;
+static _Thread_local struct aes_key decryption_key_cache;
+static _Thread_local EVP_CIPHER_CTX* cipher_ctx = NULL;
 
 static unsigned char master_salt_cache[PBKDF2_SALT_LENGTH];
 static bool master_salt_set = false;
@@ -173,7 +199,7 @@ pgagroal_decrypt(char* ciphertext, int ciphertext_length, char* password, char**
 
    int ret = 1;
 
-   if (derive_key_iv(password, salt, key, NULL, mode) != 0)
+   if (decryption_key(password, salt, key, mode) != 0)
    {
       goto cleanup;
    }
@@ -192,11 +218,8 @@ cleanup:
 
 // [private]
 static int
-derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned char* iv, int mode)
+derive_master_key(char* password)
 {
-   int key_length;
-   int iv_length;
-   unsigned char derived[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
    size_t password_length = strlen(password);
    unsigned char ms[PBKDF2_SALT_LENGTH];
 
@@ -217,16 +240,7 @@ derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned
       return 1;
    }
 
-   key_length = get_key_length(mode);
-   const EVP_CIPHER* (*cipher_fp)(void) = get_cipher(mode);
-   if (cipher_fp == NULL)
-   {
-      pgagroal_cleanse(ms, sizeof(ms));
-      return 1;
-   }
-   iv_length = EVP_CIPHER_iv_length(cipher_fp());
-
-   /* Step 1: Derive Master Key (Heavily cached) */
+   /* Derive Master Key (Heavily cached) */
    unsigned char current_hash[EVP_MAX_MD_SIZE];
    unsigned int current_hash_len = 0;
    if (!EVP_Digest(password, password_length, current_hash, &current_hash_len, EVP_sha256(), NULL))
@@ -251,8 +265,37 @@ derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned
       memcpy(cached_password_hash, current_hash, current_hash_len);
       cached_password_hash_len = current_hash_len;
       master_key_cached = true;
+      /* The session keys of another master key are stale */
+      master_key_generation++;
    }
    pgagroal_cleanse(current_hash, sizeof(current_hash));
+   /* Wipe stack copy of salt */
+   pgagroal_cleanse(ms, sizeof(ms));
+
+   return 0;
+}
+
+// [private]
+static int
+derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned char* iv, int mode)
+{
+   int key_length;
+   int iv_length;
+   unsigned char derived[EVP_MAX_KEY_LENGTH + EVP_MAX_IV_LENGTH];
+
+   key_length = get_key_length(mode);
+   const EVP_CIPHER* (*cipher_fp)(void) = get_cipher(mode);
+   if (cipher_fp == NULL)
+   {
+      return 1;
+   }
+   iv_length = EVP_CIPHER_iv_length(cipher_fp());
+
+   /* Step 1: Derive Master Key */
+   if (derive_master_key(password))
+   {
+      return 1;
+   }
 
    /* Step 2: Derive File/Session Key (Fast) */
    if (!PKCS5_PBKDF2_HMAC((char*)master_key_cache, EVP_MAX_KEY_LENGTH,
@@ -262,7 +305,6 @@ derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned
                           key_length + iv_length,
                           derived))
    {
-      pgagroal_cleanse(ms, sizeof(ms));
       return 1;
    }
 
@@ -274,12 +316,114 @@ derive_key_iv(char* password, unsigned char* salt, unsigned char* key, unsigned
 
    /* Wipe sensitive derived material */
    pgagroal_cleanse(derived, sizeof(derived));
-   /* Wipe stack copy of salt */
-   pgagroal_cleanse(ms, sizeof(ms));
 
    return 0;
 }
 
+// [private]
+static int
+encryption_key(char* password, unsigned char* salt, unsigned char* key, unsigned char* iv, int mode)
+{
+   struct aes_key* k = &encryption_key_cache;
+   unsigned char derived_iv[EVP_MAX_IV_LENGTH];
+
+   if (derive_master_key(password))
+   {
+      return 1;
+   }
+
+   /* The session key is kept for a while, every message gets a random IV */
+   if (!k->valid || k->mode != mode || k->generation != master_key_generation || k->uses >= AES_KEY_MAX_USES)
+   {
+      k->valid = false;
+
+      if (RAND_bytes(k->salt, PBKDF2_SALT_LENGTH) != 1)
+      {
+         return 1;
+      }
+
+      if (derive_key_iv(password, k->salt, k->key, derived_iv, mode) != 0)
+      {
+         pgagroal_cleanse(derived_iv, sizeof(derived_iv));
+         return 1;
+      }
+      pgagroal_cleanse(derived_iv, sizeof(derived_iv));
+
+      k->mode = mode;
+      k->generation = master_key_generation;
+      k->uses = 0;
+      k->valid = true;
+   }
+
+   if (RAND_bytes(iv, PBKDF2_IV_LENGTH) != 1)
+   {
+      return 1;
+   }
+
+   k->uses++;
+
+   memcpy(salt, k->salt, PBKDF2_SALT_LENGTH);
+   memcpy(key, k->key, EVP_MAX_KEY_LENGTH);
+
+   return 0;
+}
+
+// [private]
+static int
+decryption_key(char* password, unsigned char* salt, unsigned char* key, int mode)
+{
+   struct aes_key* k = &decryption_key_cache;
+
+   if (derive_master_key(password))
+   {
+      return 1;
+   }
+
+   /* A peer reuses its session key, so consecutive messages share the salt */
+   if (!k->valid || k->mode != mode || k->generation != master_key_generation ||
+       memcmp(k->salt, salt, PBKDF2_SALT_LENGTH) != 0)
+   {
+      k->valid = false;
+
+      if (derive_key_iv(password, salt, k->key, NULL, mode) != 0)
+      {
+         return 1;
+      }
+
+      memcpy(k->salt, salt, PBKDF2_SALT_LENGTH);
+      k->mode = mode;
+      k->generation = master_key_generation;
+      k->valid = true;
+   }
+
+   memcpy(key, k->key, EVP_MAX_KEY_LENGTH);
+
+   return 0;
+}
+
+// [private]
+static EVP_CIPHER_CTX*
+cipher_context(void)
+{
+   if (cipher_ctx == NULL)
+   {
+      cipher_ctx = EVP_CIPHER_CTX_new();
+   }
+
+   return cipher_ctx;
+}
+
+// [private]
+static void
+release_cipher_context(EVP_CIPHER_CTX* ctx)
+{
+   /* Wipe the key schedule but keep the context for the next message */
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_reset(ctx);
+   }
+}
+
 void
 pgagroal_clear_aes_cache(void)
 {
@@ -287,6 +431,8 @@ pgagroal_clear_aes_cache(void)
    pgagroal_cleanse(cached_password_hash, sizeof(cached_password_hash));
    cached_password_hash_len = 0;
    master_key_cached = false;
+   pgagroal_cleanse(&encryption_key_cache, sizeof(encryption_key_cache));
+   pgagroal_cleanse(&decryption_key_cache, sizeof(decryption_key_cache));
 }
 
 /**
@@ -324,7 +470,7 @@ aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphe
       goto error;
    }
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   if (!(ctx = cipher_context()))
    {
       goto error;
    }
@@ -369,7 +515,7 @@ aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphe
       ct_length += tag_len;
    }
 
-   EVP_CIPHER_CTX_free(ctx);
+   release_cipher_context(ctx);
 
    *ciphertext = (char*)ct;
    *ciphertext_length = ct_length;
@@ -377,10 +523,7 @@ aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphe
    return 0;
 
 error:
-   if (ctx)
-   {
-      EVP_CIPHER_CTX_free(ctx);
-   }
+   release_cipher_context(ctx);
 
    free(ct);
 
@@ -417,7 +560,7 @@ aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigne
       return 1;
    }
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   if (!(ctx = cipher_context()))
    {
       goto error;
    }
@@ -461,7 +604,7 @@ aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigne
 
    plaintext_length += length;
 
-   EVP_CIPHER_CTX_free(ctx);
+   release_cipher_context(ctx);
 
    pt[plaintext_length] = 0;
    *plaintext = pt;
@@ -469,10 +612,7 @@ aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigne
    return 0;
 
 error:
-   if (ctx)
-   {
-      EVP_CIPHER_CTX_free(ctx);
-   }
+   release_cipher_context(ctx);
 
    free(pt);
 
@@ -598,16 +738,10 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
 
    if (enc == 1)
    {
-      /* Encryption: generate a random salt */
-      if (RAND_bytes(salt, PBKDF2_SALT_LENGTH) != 1)
-      {
-         pgagroal_log_error("RAND_bytes: Failed to generate salt");
-         goto error;
-      }
-
-      if (derive_key_iv(master_key, salt, key, iv, mode) != 0)
+      /* Encryption: the session key with a random IV */
+      if (encryption_key(master_key, salt, key, iv, mode) != 0)
       {
-         pgagroal_log_error("derive_key_iv: Failed to derive key and iv");
+         pgagroal_log_error("encryption_key: Failed to derive key and iv");
          goto error;
       }
 
@@ -624,7 +758,7 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
       memcpy(out_buf, salt, PBKDF2_SALT_LENGTH);
       memcpy(out_buf + PBKDF2_SALT_LENGTH, iv, PBKDF2_IV_LENGTH);
 
-      if (!(ctx = EVP_CIPHER_CTX_new()))
+      if (!(ctx = cipher_context()))
       {
          pgagroal_log_error("EVP_CIPHER_CTX_new: Failed to create context");
          goto error;
@@ -686,9 +820,9 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
       actual_input = origin_buffer + PBKDF2_SALT_LENGTH + PBKDF2_IV_LENGTH;
       actual_input_size = origin_size - PBKDF2_SALT_LENGTH - PBKDF2_IV_LENGTH - tag_len;
 
-      if (derive_key_iv(master_key, salt, key, NULL, mode) != 0)
+      if (decryption_key(master_key, salt, key, mode) != 0)
       {
-         pgagroal_log_error("derive_key_iv: Failed to derive key and iv");
+         pgagroal_log_error("decryption_key: Failed to derive key");
          goto error;
       }
 
@@ -700,7 +834,7 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
          goto error;
       }
 
-      if (!(ctx = EVP_CIPHER_CTX_new()))
+      if (!(ctx = cipher_context()))
       {
          pgagroal_log_error("EVP_CIPHER_CTX_new: Failed to create context");
          goto error;
@@ -753,7 +887,7 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
    pgagroal_cleanse(key, sizeof(key));
    pgagroal_cleanse(iv, sizeof(iv));
 
-   EVP_CIPHER_CTX_free(ctx);
+   release_cipher_context(ctx);
 
    if (master_key != NULL)
    {
@@ -766,10 +900,7 @@ encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigne
    return 0;
 
 error:
-   if (ctx)
-   {
-      EVP_CIPHER_CTX_free(ctx);
-   }
+   release_cipher_context(ctx);
 
    /* Wipe key material from stack */
    pgagroal_cleanse(key, sizeof(key));
@@ -785,3 +916,131 @@ error:
 
    return 1;
 }
+
+int
+pgagroal_encrypt_stream_create(int mode, unsigned char* prefix, EVP_CIPHER_CTX** ctx)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   unsigned char salt[PBKDF2_SALT_LENGTH];
+   char* master_key = NULL;
+   EVP_CIPHER_CTX* c = NULL;
+   const EVP_CIPHER* (*cipher_fp)(void) = NULL;
+
+   *ctx = NULL;
+
+   memset(&key, 0, sizeof(key));
+   memset(&iv, 0, sizeof(iv));
+
+   /* The encrypted size must be known up front, which holds for GCM */
+   cipher_fp = get_cipher(mode);
+   if (cipher_fp == NULL || !is_gcm(mode))
+   {
+      pgagroal_log_error("Invalid encryption method specified");
+      goto error;
+   }
+
+   if (pgagroal_get_master_key(&master_key))
+   {
+      pgagroal_log_error("pgagroal_get_master_key: Invalid master key");
+      goto error;
+   }
+
+   if (encryption_key(master_key, salt, key, iv, mode) != 0)
+   {
+      pgagroal_log_error("encryption_key: Failed to derive key and iv");
+      goto error;
+   }
+
+   if (!(c = EVP_CIPHER_CTX_new()))
+   {
+      pgagroal_log_error("EVP_CIPHER_CTX_new: Failed to create context");
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(c, cipher_fp(), NULL, key, iv, 1) == 0)
+   {
+      pgagroal_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
+      goto error;
+   }
+
+   memcpy(prefix, salt, PBKDF2_SALT_LENGTH);
+   memcpy(prefix + PBKDF2_SALT_LENGTH, iv, PBKDF2_IV_LENGTH);
+
+   pgagroal_cleanse(key, sizeof(key));
+   pgagroal_cleanse(iv, sizeof(iv));
+   pgagroal_cleanse(master_key, strlen(master_key));
+   free(master_key);
+
+   *ctx = c;
+
+   return 0;
+
+error:
+
+   if (c != NULL)
+   {
+      EVP_CIPHER_CTX_free(c);
+   }
+
+   pgagroal_cleanse(key, sizeof(key));
+   pgagroal_cleanse(iv, sizeof(iv));
+
+   if (master_key != NULL)
+   {
+      pgagroal_cleanse(master_key, strlen(master_key));
+      free(master_key);
+   }
+
+   return 1;
+}
+
+int
+pgagroal_encrypt_stream_update(EVP_CIPHER_CTX* ctx, unsigned char* in, size_t length, unsigned char* out)
+{
+   int outl = 0;
+
+   if (length > INT_MAX)
+   {
+      pgagroal_log_error("pgagroal_encrypt_stream_update: Input size exceeds INT_MAX");
+      return 1;
+   }
+
+   if (EVP_CipherUpdate(ctx, out, &outl, in, (int)length) == 0 || (size_t)outl != length)
+   {
+      pgagroal_log_error("EVP_CipherUpdate: Failed to process data");
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgagroal_encrypt_stream_finish(EVP_CIPHER_CTX* ctx, unsigned char* tag)
+{
+   unsigned char last[EVP_MAX_BLOCK_LENGTH];
+   int f_len = 0;
+
+   if (EVP_CipherFinal_ex(ctx, last, &f_len) == 0 || f_len != 0)
+   {
+      pgagroal_log_error("EVP_CipherFinal_ex: Failed to finalize operation");
+      return 1;
+   }
+
+   if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag) != 1)
+   {
+      pgagroal_log_error("EVP_CIPHER_CTX_ctrl: Failed to get GCM tag");
+      return 1;
+   }
+
+   return 0;
+}
+
+void
+pgagroal_encrypt_stream_destroy(EVP_CIPHER_CTX* ctx)
+{
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+}
@@ -33,11 +33,21 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #define IS_LEAF(x)  (((uintptr_t)(x) & 1))
 #define SET_LEAF(x) ((void*)((uintptr_t)(x) | 1))
 #define GET_LEAF(x) ((struct art_leaf*)((void*)((uintptr_t)(x) & ~1)))
 
+#define ART_ARENA_CLASS_SIZE 64
+#define ART_ARENA_CLASSES    40
+#define ART_ARENA_BLOCK_MIN  4096
+#define ART_ARENA_BLOCK_MAX  65536
+
 enum art_node_type {
    Node4,
    Node16,
@@ -117,6 +127,28 @@ struct art_node256
    struct art_node* children[256];
 } __attribute__((aligned(64)));
 
+/**
+ * A block of the arena, the blocks are chained and released together
+ */
+struct art_block
+{
+   struct art_block* next; /**< The previous block */
+   size_t size;            /**< The size of the block */
+   size_t used;            /**< The used part of the block */
+} __attribute__((aligned(64)));
+
+/**
+ * The arena of a tree. The nodes and leaves are carved from the blocks in
+ * multiples of ART_ARENA_CLASS_SIZE, and a released one is kept on the free
+ * list of its size for the next allocation of that size. Larger leaves are
+ * allocated on their own
+ */
+struct art_arena
+{
+   struct art_block* blocks;        /**< The blocks */
+   void* free[ART_ARENA_CLASSES]; /**< The free lists by size */
+};
+
 struct to_string_param
 {
    char* str;
@@ -134,26 +166,46 @@ static struct art_leaf*
 node_get_minimum(struct art_node* node);
 
 static void
-create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config);
+create_art_leaf(struct art* t, struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config);
 
 static void
-create_art_node(struct art_node** node, enum art_node_type type);
+create_art_node(struct art* t, struct art_node** node, enum art_node_type type);
 
 static void
-create_art_node4(struct art_node4** node);
+create_art_node4(struct art* t, struct art_node4** node);
 
 static void
-create_art_node16(struct art_node16** node);
+create_art_node16(struct art* t, struct art_node16** node);
 
 static void
-create_art_node48(struct art_node48** node);
+create_art_node48(struct art* t, struct art_node48** node);
 
 static void
-create_art_node256(struct art_node256** node);
+create_art_node256(struct art* t, struct art_node256** node);
 
 // Destroy ART nodes/leaves recursively
 static void
-destroy_art_node(struct art_node* node);
+destroy_art_node(struct art* t, struct art_node* node);
+
+static void*
+arena_allocate(struct art* t, size_t size);
+
+static void
+arena_free(struct art* t, void* ptr, size_t size);
+
+// Release all the blocks at once
+static void
+arena_destroy(struct art* t);
+
+static void
+free_art_node(struct art* t, struct art_node* node);
+
+static void
+free_art_leaf(struct art* t, struct art_leaf* leaf);
+
+// Find the exact key in a node16
+static int
+find_child16(unsigned char ch, const unsigned char* keys, int length);
 
 static int
 art_iterate(struct art* t, art_callback cb, void* data);
@@ -219,7 +271,7 @@ find_index(unsigned char ch, const unsigned char* keys, int length);
  * @return Old value if the key exists, otherwise NULL
  */
 static struct value*
-art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new);
+art_node_insert(struct art* t, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new);
 
 /**
  * Delete a value from a node recursively.
@@ -231,13 +283,13 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
  * @return Deleted value if the key exists, otherwise NULL
  */
 static struct art_leaf*
-art_node_delete(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len);
+art_node_delete(struct art* t, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len);
 
 static int
 art_node_iterate(struct art_node* node, art_callback cb, void* data);
 
 static void
-node_add_child(struct art_node* node, struct art_node** node_ref, unsigned char ch, void* child);
+node_add_child(struct art* t, struct art_node* node, struct art_node** node_ref, unsigned char ch, void* child);
 
 /**
  * Add a child to the node. The function assumes node is not NULL,
@@ -250,13 +302,13 @@ node_add_child(struct art_node* node, struct art_node** node_ref, unsigned char
  * @param child The child
  */
 static void
-node4_add_child(struct art_node4* node, struct art_node** node_ref, unsigned char ch, void* child);
+node4_add_child(struct art* t, struct art_node4* node, struct art_node** node_ref, unsigned char ch, void* child);
 
 static void
-node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned char ch, void* child);
+node16_add_child(struct art* t, struct art_node16* node, struct art_node** node_ref, unsigned char ch, void* child);
 
 static void
-node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned char ch, void* child);
+node48_add_child(struct art* t, struct art_node48* node, struct art_node** node_ref, unsigned char ch, void* child);
 
 static void
 node256_add_child(struct art_node256* node, unsigned char ch, void* child);
@@ -265,19 +317,19 @@ node256_add_child(struct art_node256* node, unsigned char ch, void* child);
 // They also do not free the leaf node for bookkeeping purpose. The key insight is that due to path compression,
 // no node will have only one child, if node has only one child after deletion, it merges with this child
 static void
-node_remove_child(struct art_node* node, struct art_node** node_ref, unsigned char ch);
+node_remove_child(struct art* t, struct art_node* node, struct art_node** node_ref, unsigned char ch);
 
 static void
-node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned char ch);
+node4_remove_child(struct art* t, struct art_node4* node, struct art_node** node_ref, unsigned char ch);
 
 static void
-node16_remove_child(struct art_node16* node, struct art_node** node_ref, unsigned char ch);
+node16_remove_child(struct art* t, struct art_node16* node, struct art_node** node_ref, unsigned char ch);
 
 static void
-node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigned char ch);
+node48_remove_child(struct art* t, struct art_node48* node, struct art_node** node_ref, unsigned char ch);
 
 static void
-node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsigned char ch);
+node256_remove_child(struct art* t, struct art_node256* node, struct art_node** node_ref, unsigned char ch);
 
 static void
 copy_header(struct art_node* dest, struct art_node* src);
@@ -313,19 +365,21 @@ pgagroal_art_create(struct art** tree)
    t = malloc(sizeof(struct art));
    t->size = 0;
    t->root = NULL;
+   t->arena = NULL;
    *tree = t;
    return 0;
 }
 
 int
-pgagroal_art_destroy(struct art* tree)
+pgagroal_art_destroy(struct art* t)
 {
-   if (tree == NULL)
+   if (t == NULL)
    {
       return 0;
    }
-   destroy_art_node(tree->root);
-   free(tree);
+   destroy_art_node(t, t->root);
+   arena_destroy(t);
+   free(t);
    return 0;
 }
 
@@ -479,7 +533,7 @@ pgagroal_art_insert(struct art* t, char* key, uintptr_t value, enum value_type t
       // c'mon, at least create a tree first...
       goto error;
    }
-   old_val = art_node_insert(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, type, NULL, &new);
+   old_val = art_node_insert(t, t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, type, NULL, &new);
    pgagroal_value_destroy(old_val);
    if (new)
    {
@@ -499,7 +553,7 @@ pgagroal_art_insert_with_config(struct art* t, char* key, uintptr_t value, struc
    {
       goto error;
    }
-   old_val = art_node_insert(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, ValueRef, config, &new);
+   old_val = art_node_insert(t, t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, ValueRef, config, &new);
    pgagroal_value_destroy(old_val);
    if (new)
    {
@@ -518,14 +572,14 @@ pgagroal_art_delete(struct art* t, char* key)
    {
       return 1;
    }
-   l = art_node_delete(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1);
+   l = art_node_delete(t, t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1);
    if (l != NULL)
    {
       t->size--;
       pgagroal_value_destroy(l->value);
+      free_art_leaf(t, l);
    }
 
-   free(l);
    return 0;
 }
 
@@ -536,7 +590,8 @@ pgagroal_art_clear(struct art* t)
    {
       return 0;
    }
-   destroy_art_node(t->root);
+   destroy_art_node(t, t->root);
+   arena_destroy(t);
    t->root = NULL;
    t->size = 0;
    return 0;
@@ -571,10 +626,10 @@ min(uint32_t a, uint32_t b)
 }
 
 static void
-create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config)
+create_art_leaf(struct art* t, struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config)
 {
    struct art_leaf* l = NULL;
-   l = malloc(sizeof(struct art_leaf) + key_len);
+   l = arena_allocate(t, sizeof(struct art_leaf) + key_len);
    memset(l, 0, sizeof(struct art_leaf) + key_len);
    if (config != NULL)
    {
@@ -591,14 +646,14 @@ create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, ui
 }
 
 static void
-create_art_node(struct art_node** node, enum art_node_type type)
+create_art_node(struct art* t, struct art_node** node, enum art_node_type type)
 {
    struct art_node* n = NULL;
    switch (type)
    {
       case Node4:
       {
-         struct art_node4* n4 = malloc(sizeof(struct art_node4));
+         struct art_node4* n4 = arena_allocate(t, sizeof(struct art_node4));
          memset(n4, 0, sizeof(struct art_node4));
          n4->node.type = Node4;
          n = (struct art_node*)n4;
@@ -606,7 +661,7 @@ create_art_node(struct art_node** node, enum art_node_type type)
       }
       case Node16:
       {
-         struct art_node16* n16 = malloc(sizeof(struct art_node16));
+         struct art_node16* n16 = arena_allocate(t, sizeof(struct art_node16));
          memset(n16, 0, sizeof(struct art_node16));
          n16->node.type = Node16;
          n = (struct art_node*)n16;
@@ -614,7 +669,7 @@ create_art_node(struct art_node** node, enum art_node_type type)
       }
       case Node48:
       {
-         struct art_node48* n48 = malloc(sizeof(struct art_node48));
+         struct art_node48* n48 = arena_allocate(t, sizeof(struct art_node48));
          memset(n48, 0, sizeof(struct art_node48));
          n48->node.type = Node48;
          n = (struct art_node*)n48;
@@ -622,7 +677,7 @@ create_art_node(struct art_node** node, enum art_node_type type)
       }
       case Node256:
       {
-         struct art_node256* n256 = malloc(sizeof(struct art_node256));
+         struct art_node256* n256 = arena_allocate(t, sizeof(struct art_node256));
          memset(n256, 0, sizeof(struct art_node256));
          n256->node.type = Node256;
          n = (struct art_node*)n256;
@@ -633,39 +688,39 @@ create_art_node(struct art_node** node, enum art_node_type type)
 }
 
 static void
-create_art_node4(struct art_node4** node)
+create_art_node4(struct art* t, struct art_node4** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node4);
+   create_art_node(t, &n, Node4);
    *node = (struct art_node4*)n;
 }
 
 static void
-create_art_node16(struct art_node16** node)
+create_art_node16(struct art* t, struct art_node16** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node16);
+   create_art_node(t, &n, Node16);
    *node = (struct art_node16*)n;
 }
 
 static void
-create_art_node48(struct art_node48** node)
+create_art_node48(struct art* t, struct art_node48** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node48);
+   create_art_node(t, &n, Node48);
    *node = (struct art_node48*)n;
 }
 
 static void
-create_art_node256(struct art_node256** node)
+create_art_node256(struct art* t, struct art_node256** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node256);
+   create_art_node(t, &n, Node256);
    *node = (struct art_node256*)n;
 }
 
 static void
-destroy_art_node(struct art_node* node)
+destroy_art_node(struct art* t, struct art_node* node)
 {
    if (node == NULL)
    {
@@ -674,7 +729,7 @@ destroy_art_node(struct art_node* node)
    if (IS_LEAF(node))
    {
       pgagroal_value_destroy(GET_LEAF(node)->value);
-      free(GET_LEAF(node));
+      free_art_leaf(t, GET_LEAF(node));
       return;
    }
    switch (node->type)
@@ -684,7 +739,7 @@ destroy_art_node(struct art_node* node)
          struct art_node4* n = (struct art_node4*)node;
          for (int i = 0; i < node->num_children; i++)
          {
-            destroy_art_node(n->children[i]);
+            destroy_art_node(t, n->children[i]);
          }
          break;
       }
@@ -693,7 +748,7 @@ destroy_art_node(struct art_node* node)
          struct art_node16* n = (struct art_node16*)node;
          for (int i = 0; i < node->num_children; i++)
          {
-            destroy_art_node(n->children[i]);
+            destroy_art_node(t, n->children[i]);
          }
          break;
       }
@@ -707,7 +762,7 @@ destroy_art_node(struct art_node* node)
             {
                continue;
             }
-            destroy_art_node(n->children[idx - 1]);
+            destroy_art_node(t, n->children[idx - 1]);
          }
          break;
       }
@@ -721,12 +776,12 @@ destroy_art_node(struct art_node* node)
             {
                continue;
             }
-            destroy_art_node(n->children[i]);
+            destroy_art_node(t, n->children[i]);
          }
          break;
       }
    }
-   free(node);
+   free_art_node(t, node);
 }
 
 static struct art_node**
@@ -747,8 +802,8 @@ node_get_child(struct art_node* node, unsigned char ch)
       case Node16:
       {
          struct art_node16* n = (struct art_node16*)node;
-         int idx = find_index(ch, n->keys, n->node.num_children);
-         if (idx == -1 || n->keys[idx] != ch)
+         int idx = find_child16(ch, n->keys, n->node.num_children);
+         if (idx == -1)
          {
             goto error;
          }
@@ -774,7 +829,7 @@ error:
 }
 
 static struct value*
-art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new)
+art_node_insert(struct art* t, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new)
 {
    struct art_leaf* leaf = NULL;
    struct art_leaf* min_leaf = NULL;
@@ -788,7 +843,7 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
    {
       // Lazy expansion, skip creating an inner node since it currently will have only this one leaf.
       // We will compare keys when reach leaf anyway, the path doesn't need to 100% match the key along the way
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_leaf(t, &leaf, key, key_len, value, type, config);
       *node_ref = SET_LEAF(leaf);
       *new = true;
       return NULL;
@@ -817,8 +872,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
       // we compare with the existing key in the left most leaf and find an exact diverging point to split the node (see details below).
       // This way we inductively guarantee that all children to a parent share the same prefix even if it's only partially stored
       leaf_key = GET_LEAF(node)->key;
-      create_art_node(&new_node, Node4);
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_node(t, &new_node, Node4);
+      create_art_leaf(t, &leaf, key, key_len, value, type, config);
       // Get the diverging index after point of depth
       for (idx = depth; idx < min(key_len, GET_LEAF(node)->key_len); idx++)
       {
@@ -833,8 +888,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
       }
       new_node->prefix_len = idx - depth;
       depth += new_node->prefix_len;
-      node_add_child(new_node, &new_node, key[depth], SET_LEAF(leaf));
-      node_add_child(new_node, &new_node, leaf_key[depth], (void*)node);
+      node_add_child(t, new_node, &new_node, key[depth], SET_LEAF(leaf));
+      node_add_child(t, new_node, &new_node, leaf_key[depth], (void*)node);
       // replace with new node
       *node_ref = new_node;
       *new = true;
@@ -859,8 +914,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
    if (diff_len < node->prefix_len)
    {
       // case 2, split the node
-      create_art_node(&new_node, Node4);
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_node(t, &new_node, Node4);
+      create_art_leaf(t, &leaf, key, key_len, value, type, config);
       new_node->prefix_len = diff_len;
       memcpy(new_node->prefix, node->prefix, min(MAX_PREFIX_LEN, diff_len));
       // We need to know if new bytes that were once outside the partial prefix range will now come into the range
@@ -869,8 +924,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
       if (node->prefix_len <= MAX_PREFIX_LEN)
       {
          node->prefix_len = node->prefix_len - (diff_len + 1);
-         node_add_child(new_node, &new_node, key[depth + diff_len], SET_LEAF(leaf));
-         node_add_child(new_node, &new_node, node->prefix[diff_len], node);
+         node_add_child(t, new_node, &new_node, key[depth + diff_len], SET_LEAF(leaf));
+         node_add_child(t, new_node, &new_node, node->prefix[diff_len], node);
          // Update node's prefix info since we move it downwards
          // The first diverging character serves as the key byte in keys array,
          // so we don't duplicate store it in the prefix.
@@ -884,8 +939,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
       {
          node->prefix_len = node->prefix_len - (diff_len + 1);
          min_leaf = node_get_minimum(node);
-         node_add_child(new_node, &new_node, key[depth + diff_len], SET_LEAF(leaf));
-         node_add_child(new_node, &new_node, min_leaf->key[depth + diff_len], node);
+         node_add_child(t, new_node, &new_node, key[depth + diff_len], SET_LEAF(leaf));
+         node_add_child(t, new_node, &new_node, min_leaf->key[depth + diff_len], node);
          // node is moved downwards
          memmove(node->prefix, min_leaf->key + depth + diff_len + 1, min(MAX_PREFIX_LEN, node->prefix_len));
       }
@@ -906,13 +961,13 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
          {
             node->num_children++;
          }
-         return art_node_insert(*next, next, depth + 1, key, key_len, value, type, config, new);
+         return art_node_insert(t, *next, next, depth + 1, key, key_len, value, type, config, new);
       }
       else
       {
          // add a child to current node since the spot is available
-         create_art_leaf(&leaf, key, key_len, value, type, config);
-         node_add_child(node, node_ref, key[depth], SET_LEAF(leaf));
+         create_art_leaf(t, &leaf, key, key_len, value, type, config);
+         node_add_child(t, node, node_ref, key[depth], SET_LEAF(leaf));
          *new = true;
          return NULL;
       }
@@ -920,7 +975,7 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
 }
 
 static struct art_leaf*
-art_node_delete(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len)
+art_node_delete(struct art* t, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len)
 {
    struct art_leaf* l = NULL;
    struct art_node** child = NULL;
@@ -963,7 +1018,7 @@ art_node_delete(struct art_node* node, struct art_node** node_ref, uint32_t dept
          if (leaf_match(GET_LEAF(*child), key, key_len))
          {
             l = GET_LEAF(*child);
-            node_remove_child(node, node_ref, key[depth]);
+            node_remove_child(t, node, node_ref, key[depth]);
             return l;
          }
          else
@@ -973,7 +1028,7 @@ art_node_delete(struct art_node* node, struct art_node** node_ref, uint32_t dept
       }
       else
       {
-         return art_node_delete(*child, child, depth + 1, key, key_len);
+         return art_node_delete(t, *child, child, depth + 1, key, key_len);
       }
    }
 }
@@ -1066,18 +1121,18 @@ art_node_iterate(struct art_node* node, art_callback cb, void* data)
 }
 
 static void
-node_add_child(struct art_node* node, struct art_node** node_ref, unsigned char ch, void* child)
+node_add_child(struct art* t, struct art_node* node, struct art_node** node_ref, unsigned char ch, void* child)
 {
    switch (node->type)
    {
       case Node4:
-         node4_add_child((struct art_node4*)node, node_ref, ch, child);
+         node4_add_child(t, (struct art_node4*)node, node_ref, ch, child);
          break;
       case Node16:
-         node16_add_child((struct art_node16*)node, node_ref, ch, child);
+         node16_add_child(t, (struct art_node16*)node, node_ref, ch, child);
          break;
       case Node48:
-         node48_add_child((struct art_node48*)node, node_ref, ch, child);
+         node48_add_child(t, (struct art_node48*)node, node_ref, ch, child);
          break;
       case Node256:
          node256_add_child((struct art_node256*)node, ch, child);
@@ -1086,7 +1141,7 @@ node_add_child(struct art_node* node, struct art_node** node_ref, unsigned char
 }
 
 static void
-node4_add_child(struct art_node4* node, struct art_node** node_ref, unsigned char ch, void* child)
+node4_add_child(struct art* t, struct art_node4* node, struct art_node** node_ref, unsigned char ch, void* child)
 {
    if (node->node.num_children < 4)
    {
@@ -1103,20 +1158,20 @@ node4_add_child(struct art_node4* node, struct art_node** node_ref, unsigned cha
    {
       // expand
       struct art_node16* new_node = NULL;
-      create_art_node16(&new_node);
+      create_art_node16(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
       memcpy(new_node->keys, node->keys, node->node.num_children);
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
+      free_art_node(t, (struct art_node*)node);
 
-      node16_add_child(new_node, node_ref, ch, child);
+      node16_add_child(t, new_node, node_ref, ch, child);
    }
 }
 
 static void
-node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned char ch, void* child)
+node16_add_child(struct art* t, struct art_node16* node, struct art_node** node_ref, unsigned char ch, void* child)
 {
    if (node->node.num_children < 16)
    {
@@ -1133,7 +1188,7 @@ node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned c
    {
       // expand
       struct art_node48* new_node = NULL;
-      create_art_node48(&new_node);
+      create_art_node48(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
       for (int i = 0; i < node->node.num_children; i++)
@@ -1142,13 +1197,13 @@ node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned c
       }
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
-      node48_add_child(new_node, node_ref, ch, child);
+      free_art_node(t, (struct art_node*)node);
+      node48_add_child(t, new_node, node_ref, ch, child);
    }
 }
 
 static void
-node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned char ch, void* child)
+node48_add_child(struct art* t, struct art_node48* node, struct art_node** node_ref, unsigned char ch, void* child)
 {
    if (node->node.num_children < 48)
    {
@@ -1166,7 +1221,7 @@ node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned c
    {
       // expand
       struct art_node256* new_node = NULL;
-      create_art_node256(&new_node);
+      create_art_node256(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1178,7 +1233,7 @@ node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned c
       }
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
+      free_art_node(t, (struct art_node*)node);
       node256_add_child(new_node, ch, child);
    }
 }
@@ -1227,6 +1282,172 @@ find_index(unsigned char ch, const unsigned char* keys, int length)
    return -1;
 }
 
+static int
+find_child16(unsigned char ch, const unsigned char* keys, int length)
+{
+#if defined(__SSE2__)
+   __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)ch), _mm_loadu_si128((const __m128i*)keys));
+   int mask = _mm_movemask_epi8(cmp) & ((1 << length) - 1);
+
+   return mask != 0 ? __builtin_ctz(mask) : -1;
+#elif defined(__ARM_NEON)
+   uint8x16_t cmp = vceqq_u8(vdupq_n_u8(ch), vld1q_u8(keys));
+   // 4 bits per key, as NEON has no movemask
+   uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+
+   if (length < 16)
+   {
+      mask &= (1ULL << (length * 4)) - 1;
+   }
+
+   return mask != 0 ? __builtin_ctzll(mask) / 4 : -1;
+#else
+   for (int i = 0; i < length; i++)
+   {
+      if (keys[i] == ch)
+      {
+         return i;
+      }
+   }
+
+   return -1;
+#endif
+}
+
+static void*
+arena_allocate(struct art* t, size_t size)
+{
+   size_t c = (size + ART_ARENA_CLASS_SIZE - 1) / ART_ARENA_CLASS_SIZE;
+   size_t chunk = c * ART_ARENA_CLASS_SIZE;
+   void* p = NULL;
+   struct art_block* b = NULL;
+   struct art_arena* a = NULL;
+
+   if (c > ART_ARENA_CLASSES)
+   {
+      return malloc(size);
+   }
+
+   if (t->arena == NULL)
+   {
+      t->arena = calloc(1, sizeof(struct art_arena));
+      if (t->arena == NULL)
+      {
+         return NULL;
+      }
+   }
+
+   a = t->arena;
+
+   if (a->free[c - 1] != NULL)
+   {
+      p = a->free[c - 1];
+      a->free[c - 1] = *(void**)p;
+      return p;
+   }
+
+   b = a->blocks;
+   if (b == NULL || b->used + chunk > b->size)
+   {
+      // Small trees get small blocks, and the blocks double up to the maximum
+      size_t s = b == NULL ? ART_ARENA_BLOCK_MIN : MIN(b->size * 2, ART_ARENA_BLOCK_MAX);
+
+      b = aligned_alloc(ART_ARENA_CLASS_SIZE, s);
+      if (b == NULL)
+      {
+         return NULL;
+      }
+
+      b->next = a->blocks;
+      b->size = s;
+      b->used = sizeof(struct art_block);
+      a->blocks = b;
+   }
+
+   p = (char*)b + b->used;
+   b->used += chunk;
+
+   return p;
+}
+
+static void
+arena_free(struct art* t, void* ptr, size_t size)
+{
+   size_t c = (size + ART_ARENA_CLASS_SIZE - 1) / ART_ARENA_CLASS_SIZE;
+
+   if (ptr == NULL)
+   {
+      return;
+   }
+
+   if (c > ART_ARENA_CLASSES)
+   {
+      free(ptr);
+      return;
+   }
+
+   *(void**)ptr = t->arena->free[c - 1];
+   t->arena->free[c - 1] = ptr;
+}
+
+static void
+arena_destroy(struct art* t)
+{
+   struct art_block* b = NULL;
+   struct art_block* n = NULL;
+
+   if (t->arena == NULL)
+   {
+      return;
+   }
+
+   b = t->arena->blocks;
+   while (b != NULL)
+   {
+      n = b->next;
+      free(b);
+      b = n;
+   }
+
+   free(t->arena);
+   t->arena = NULL;
+}
+
+static void
+free_art_node(struct art* t, struct art_node* node)
+{
+   size_t size = 0;
+
+   switch (node->type)
+   {
+      case Node4:
+         size = sizeof(struct art_node4);
+         break;
+      case Node16:
+         size = sizeof(struct art_node16);
+         break;
+      case Node48:
+         size = sizeof(struct art_node48);
+         break;
+      case Node256:
+         size = sizeof(struct art_node256);
+         break;
+   }
+
+   arena_free(t, node, size);
+}
+
+static void
+free_art_leaf(struct art* t, struct art_leaf* leaf)
+{
+   if (leaf == NULL)
+   {
+      return;
+   }
+
+   arena_free(t, leaf, sizeof(struct art_leaf) + leaf->key_len);
+}
+
 static void
 copy_header(struct art_node* dest, struct art_node* src)
 {
@@ -1338,27 +1559,27 @@ node_get_minimum(struct art_node* node)
 }
 
 static void
-node_remove_child(struct art_node* node, struct art_node** node_ref, unsigned char ch)
+node_remove_child(struct art* t, struct art_node* node, struct art_node** node_ref, unsigned char ch)
 {
    switch (node->type)
    {
       case Node4:
-         node4_remove_child((struct art_node4*)node, node_ref, ch);
+         node4_remove_child(t, (struct art_node4*)node, node_ref, ch);
          break;
       case Node16:
-         node16_remove_child((struct art_node16*)node, node_ref, ch);
+         node16_remove_child(t, (struct art_node16*)node, node_ref, ch);
          break;
       case Node48:
-         node48_remove_child((struct art_node48*)node, node_ref, ch);
+         node48_remove_child(t, (struct art_node48*)node, node_ref, ch);
          break;
       case Node256:
-         node256_remove_child((struct art_node256*)node, node_ref, ch);
+         node256_remove_child(t, (struct art_node256*)node, node_ref, ch);
          break;
    }
 }
 
 static void
-node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned char ch)
+node4_remove_child(struct art* t, struct art_node4* node, struct art_node** node_ref, unsigned char ch)
 {
    int idx = 0;
    uint32_t len = 0;
@@ -1374,7 +1595,7 @@ node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned
       if (IS_LEAF(child))
       {
          // replace directly
-         free(node);
+         free_art_node(t, (struct art_node*)node);
          *node_ref = child;
          return;
       }
@@ -1392,14 +1613,14 @@ node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned
       }
       child->prefix_len = node->node.prefix_len + 1 + child->prefix_len;
       memcpy(child->prefix, node->node.prefix, min(child->prefix_len, MAX_PREFIX_LEN));
-      free(node);
+      free_art_node(t, (struct art_node*)node);
       // replace
       *node_ref = child;
    }
 }
 
 static void
-node16_remove_child(struct art_node16* node, struct art_node** node_ref, unsigned char ch)
+node16_remove_child(struct art* t, struct art_node16* node, struct art_node** node_ref, unsigned char ch)
 {
    int idx = 0;
    struct art_node4* new_node = NULL;
@@ -1411,17 +1632,17 @@ node16_remove_child(struct art_node16* node, struct art_node** node_ref, unsigne
    // Trick from libart, do not downgrade immediately to avoid jumping on 4/5 boundary
    if (node->node.num_children <= 3)
    {
-      create_art_node4(&new_node);
+      create_art_node4(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->keys, node->keys, node->node.num_children);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
-      free(node);
+      free_art_node(t, (struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
 
 static void
-node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigned char ch)
+node48_remove_child(struct art* t, struct art_node48* node, struct art_node** node_ref, unsigned char ch)
 {
    int idx = node->keys[ch];
    int cnt = 0;
@@ -1432,7 +1653,7 @@ node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigne
 
    if (node->node.num_children <= 12)
    {
-      create_art_node16(&new_node);
+      create_art_node16(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1443,13 +1664,13 @@ node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigne
             cnt++;
          }
       }
-      free(node);
+      free_art_node(t, (struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
 
 static void
-node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsigned char ch)
+node256_remove_child(struct art* t, struct art_node256* node, struct art_node** node_ref, unsigned char ch)
 {
    int num = 0;
    for (int i = 0; i < 48; i++)
@@ -1470,7 +1691,7 @@ node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsig
 
    if (node->node.num_children <= 37)
    {
-      create_art_node48(&new_node);
+      create_art_node48(t, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1481,7 +1702,7 @@ node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsig
             cnt++;
          }
       }
-      free(node);
+      free_art_node(t, (struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
@@ -1656,6 +1877,12 @@ art_search(struct art* t, unsigned char* key, uint32_t key_len)
          }
          return GET_LEAF(node)->value;
       }
+      // look up the child before the prefix is checked, so the child is fetched meanwhile
+      child = depth + node->prefix_len < key_len ? node_get_child(node, key[depth + node->prefix_len]) : NULL;
+      if (child != NULL && *child != NULL)
+      {
+         __builtin_prefetch(GET_LEAF(*child));
+      }
       // optimistically check the prefix,
       // we move forward as long as up to MAX_PREFIX_LEN characters match
       if (check_prefix_partial(node, key, depth, key_len) != min(node->prefix_len, MAX_PREFIX_LEN))
@@ -1668,7 +1895,6 @@ art_search(struct art* t, unsigned char* key, uint32_t key_len)
          return NULL;
       }
       // you can't dereference what the function returns directly since it could be null
-      child = node_get_child(node, key[depth]);
       node = child != NULL ? *child : NULL;
       // child is indexed by key[depth], so the next round we should skip this byte and start checking at the next
       depth++;
@@ -35,6 +35,7 @@
 /* system */
 #include <bzlib.h>
 #include <dirent.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -77,48 +78,121 @@ pgagroal_bzip2_string(char* s, unsigned char** buffer, size_t* buffer_size)
 int
 pgagroal_bunzip2_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
 {
-   int bzip2_err;
-   unsigned int estimated_size = compressed_size * 10;
-   unsigned int new_size;
+   int bzip2_err = BZ_OUTBUFF_FULL;
+   size_t estimated_size = compressed_size * 10;
+   unsigned int decompressed_size = 0;
+   char* temp = NULL;
+
+   *output_string = NULL;
 
-   *output_string = (char*)malloc(estimated_size);
-   if (!*output_string)
+   /* Highly repetitive text compresses well beyond any fixed ratio, so grow until it fits */
+   while (bzip2_err == BZ_OUTBUFF_FULL)
    {
-      pgagroal_log_error("Bzip2: Allocation failed");
-      return 1;
+      if (estimated_size >= UINT_MAX)
+      {
+         pgagroal_log_error("Bzip2: Decompressed size too large");
+         goto error;
+      }
+
+      temp = realloc(*output_string, estimated_size + 1);
+      if (!temp)
+      {
+         pgagroal_log_error("Bzip2: Allocation failed");
+         goto error;
+      }
+
+      *output_string = temp;
+
+      decompressed_size = (unsigned int)estimated_size;
+      bzip2_err = BZ2_bzBuffToBuffDecompress(*output_string, &decompressed_size, (char*)compressed_buffer, compressed_size, 0, 0);
+
+      estimated_size *= 2;
    }
 
-   bzip2_err = BZ2_bzBuffToBuffDecompress(*output_string, &estimated_size, (char*)compressed_buffer, compressed_size, 0, 0);
+   if (bzip2_err != BZ_OK)
+   {
+      pgagroal_log_error("Bzip2: Decompress failed");
+      goto error;
+   }
+
+   (*output_string)[decompressed_size] = '\0';
+
+   return 0;
+
+error:
+
+   free(*output_string);
+   *output_string = NULL;
+
+   return 1;
+}
+
+int
+pgagroal_bzip2_stream_create(void** stream)
+{
+   bz_stream* s = NULL;
+
+   *stream = NULL;
 
-   if (bzip2_err == BZ_OUTBUFF_FULL)
+   s = (bz_stream*)calloc(1, sizeof(bz_stream));
+   if (s == NULL)
    {
-      new_size = estimated_size * 2;
-      char* temp = realloc(*output_string, new_size);
+      pgagroal_log_error("BZip2: Allocation error");
+      return 1;
+   }
 
-      if (!temp)
+   if (BZ2_bzCompressInit(s, 9, 0, 0) != BZ_OK)
+   {
+      free(s);
+      pgagroal_log_error("BZip2: Initialization failed");
+      return 1;
+   }
+
+   *stream = s;
+
+   return 0;
+}
+
+int
+pgagroal_bzip2_stream_compress(void* stream, char* data, size_t length, bool last, unsigned char** buffer, size_t* buffer_size, size_t* buffer_length)
+{
+   int ret;
+   bz_stream* s = (bz_stream*)stream;
+
+   s->next_in = data;
+   s->avail_in = length;
+
+   do
+   {
+      if (pgagroal_buffer_reserve(buffer, buffer_size, *buffer_length + BUFFER_LENGTH))
       {
-         pgagroal_log_error("Bzip2: Reallocation failed");
-         free(*output_string);
+         pgagroal_log_error("BZip2: Allocation error");
          return 1;
       }
 
-      *output_string = temp;
+      s->next_out = (char*)*buffer + *buffer_length;
+      s->avail_out = *buffer_size - *buffer_length;
 
-      bzip2_err = BZ2_bzBuffToBuffDecompress(*output_string, &new_size, (char*)compressed_buffer, compressed_size, 0, 0);
-      if (bzip2_err != BZ_OK)
+      ret = BZ2_bzCompress(s, last ? BZ_FINISH : BZ_RUN);
+      if (ret < 0)
       {
-         pgagroal_log_error("Bzip2: Decompress failed");
-         free(*output_string);
+         pgagroal_log_error("BZip2: Compression failed");
          return 1;
       }
-      estimated_size = new_size;
-   }
-   else if (bzip2_err != BZ_OK)
-   {
-      pgagroal_log_error("Bzip2: Decompress failed");
-      free(*output_string);
-      return 1;
+
+      *buffer_length = *buffer_size - s->avail_out;
    }
+   while (s->avail_in > 0 || (last && ret != BZ_STREAM_END));
 
    return 0;
 }
+
+void
+pgagroal_bzip2_stream_destroy(void* stream)
+{
+   if (stream != NULL)
+   {
+      BZ2_bzCompressEnd((bz_stream*)stream);
+      free(stream);
+   }
+}
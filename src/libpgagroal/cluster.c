@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <cluster.h>
+#include <json.h>
+#include <logging.h>
+#include <management.h>
+#include <memory.h>
+#include <network.h>
+#include <pool.h>
+#include <security.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <openssl/ssl.h>
+
+static int exchange_peer(int peer);
+static void update_quota(int rule, time_t now);
+static int fair_share(int* demands, int n, int size);
+static int demand(int rule);
+static int find_rule(char* database, char* username);
+static char* admin_password(char* username);
+
+void
+pgagroal_cluster_reset(void)
+{
+   int equal;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < config->number_of_cluster_peers; i++)
+   {
+      atomic_store(&config->cluster[i].expires, 0);
+   }
+
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      equal = config->limits[i].max_size / (config->number_of_cluster_peers + 1);
+      atomic_store(&config->limit_demands[i].quota, equal);
+   }
+}
+
+void
+pgagroal_cluster_exchange(void)
+{
+   int running = 0;
+   int status;
+   unsigned int timeout;
+   pid_t pid;
+   time_t now;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   timeout = (unsigned int)MAX(pgagroal_time_convert(config->cluster_lease, FORMAT_TIME_S) / CLUSTER_EXCHANGES, 1);
+
+   /* Every peer is asked by its own process, so a peer that doesn't answer
+    * only holds up itself, and is given up on at the next exchange */
+   for (int i = 0; i < config->number_of_cluster_peers; i++)
+   {
+      pid = fork();
+      if (pid == -1)
+      {
+         pgagroal_log_error("Cluster: Unable to fork for %s:%d", config->cluster[i].host, config->cluster[i].port);
+      }
+      else if (pid == 0)
+      {
+         signal(SIGALRM, SIG_DFL);
+         alarm(timeout);
+
+         status = exchange_peer(i);
+
+         pgagroal_memory_destroy();
+         pgagroal_stop_logging();
+
+         exit(status);
+      }
+      else
+      {
+         running++;
+      }
+   }
+
+   while (running > 0)
+   {
+      pid = waitpid(-1, &status, 0);
+      if (pid == -1)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         break;
+      }
+
+      running--;
+   }
+
+   now = time(NULL);
+
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      update_quota(i, now);
+   }
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+}
+
+int
+pgagroal_cluster_report(struct json* response)
+{
+   struct json* limits = NULL;
+   struct json* limit = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgagroal_json_create(&limits))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      if (pgagroal_json_create(&limit))
+      {
+         goto error;
+      }
+
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)config->limits[i].database, ValueString);
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)config->limits[i].username, ValueString);
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_DEMAND, (uintptr_t)demand(i), ValueInt32);
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_BACKENDS, (uintptr_t)atomic_load(&config->limits[i].backend_connections), ValueInt32);
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_QUOTA, (uintptr_t)pgagroal_pool_limit_size(i), ValueInt32);
+      pgagroal_json_put(limit, MANAGEMENT_ARGUMENT_MAX_CONNECTIONS, (uintptr_t)config->limits[i].max_size, ValueInt32);
+
+      pgagroal_json_append(limits, (uintptr_t)limit, ValueJSON);
+      limit = NULL;
+   }
+
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_LIMITS, (uintptr_t)limits, ValueJSON);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(limit);
+   pgagroal_json_destroy(limits);
+
+   return 1;
+}
+
+static int
+exchange_peer(int peer)
+{
+   int fd = -1;
+   int rule;
+   uint8_t compression = MANAGEMENT_COMPRESSION_NONE;
+   uint8_t encryption = MANAGEMENT_ENCRYPTION_NONE;
+   char* password = NULL;
+   char* database = NULL;
+   char* username = NULL;
+   unsigned short demands[NUMBER_OF_LIMITS];
+   unsigned short backends[NUMBER_OF_LIMITS];
+   SSL* ssl = NULL;
+   struct json* read = NULL;
+   struct json* response = NULL;
+   struct json* limits = NULL;
+   struct json* limit = NULL;
+   struct json_iterator* iter = NULL;
+   struct cluster_peer* p = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   p = &config->cluster[peer];
+
+   password = admin_password(config->cluster_user);
+   if (password == NULL)
+   {
+      goto error;
+   }
+
+   if (pgagroal_connect(p->host, p->port, &fd, config->keep_alive, config->nodelay))
+   {
+      pgagroal_log_debug("Cluster: No connection to %s:%d", p->host, p->port);
+      goto error;
+   }
+
+   if (pgagroal_remote_management_scram_sha256(config->cluster_user, password, fd, &ssl) != AUTH_SUCCESS)
+   {
+      pgagroal_log_warn("Cluster: Bad credentials for %s at %s:%d", config->cluster_user, p->host, p->port);
+      goto error;
+   }
+
+   if (pgagroal_management_request_cluster(ssl, fd, compression, encryption, MANAGEMENT_OUTPUT_FORMAT_JSON))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_read_json(ssl, fd, &compression, &encryption, &read))
+   {
+      goto error;
+   }
+
+   response = (struct json*)pgagroal_json_get(read, MANAGEMENT_CATEGORY_RESPONSE);
+   limits = response != NULL ? (struct json*)pgagroal_json_get(response, MANAGEMENT_ARGUMENT_LIMITS) : NULL;
+
+   if (limits == NULL || limits->type != JSONArray)
+   {
+      pgagroal_log_warn("Cluster: No limit entries from %s:%d", p->host, p->port);
+      goto error;
+   }
+
+   /* A limit entry that the peer doesn't have is neither wanted nor held by it */
+   memset(&demands[0], 0, sizeof(demands));
+   memset(&backends[0], 0, sizeof(backends));
+
+   if (pgagroal_json_iterator_create(limits, &iter))
+   {
+      goto error;
+   }
+
+   while (pgagroal_json_iterator_next(iter))
+   {
+      limit = (struct json*)(iter->value->data);
+      database = (char*)pgagroal_json_get(limit, MANAGEMENT_ARGUMENT_DATABASE);
+      username = (char*)pgagroal_json_get(limit, MANAGEMENT_ARGUMENT_USERNAME);
+
+      rule = find_rule(database, username);
+      if (rule != -1)
+      {
+         demands[rule] = (unsigned short)MAX((int64_t)pgagroal_json_get(limit, MANAGEMENT_ARGUMENT_DEMAND), 0);
+         backends[rule] = (unsigned short)MAX((int64_t)pgagroal_json_get(limit, MANAGEMENT_ARGUMENT_BACKENDS), 0);
+      }
+   }
+
+   pgagroal_json_iterator_destroy(iter);
+   iter = NULL;
+
+   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
+   {
+      atomic_store(&p->demands[i], demands[i]);
+      atomic_store(&p->backends[i], backends[i]);
+   }
+
+   atomic_store(&p->expires, (long long)time(NULL) + pgagroal_time_convert(config->cluster_lease, FORMAT_TIME_S));
+
+   pgagroal_log_debug("Cluster: Report from %s:%d", p->host, p->port);
+
+   pgagroal_json_destroy(read);
+
+   if (ssl != NULL)
+   {
+      SSL_CTX* ctx = SSL_get_SSL_CTX(ssl);
+      if (SSL_shutdown(ssl) == 0)
+      {
+         SSL_shutdown(ssl);
+      }
+      SSL_free(ssl);
+      SSL_CTX_free(ctx);
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   pgagroal_json_iterator_destroy(iter);
+   pgagroal_json_destroy(read);
+
+   if (ssl != NULL)
+   {
+      SSL_CTX* ctx = SSL_get_SSL_CTX(ssl);
+      SSL_free(ssl);
+      SSL_CTX_free(ctx);
+   }
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+static void
+update_quota(int rule, time_t now)
+{
+   int n = 1;
+   int size;
+   int equal;
+   int others = 0;
+   int quota;
+   int backends;
+   bool stale = false;
+   int demands[NUMBER_OF_CLUSTER_PEERS + 1];
+   struct cluster_peer* p = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   size = config->limits[rule].max_size;
+   equal = size / (config->number_of_cluster_peers + 1);
+
+   demands[0] = demand(rule);
+
+   for (int i = 0; i < config->number_of_cluster_peers; i++)
+   {
+      p = &config->cluster[i];
+
+      if (atomic_load(&p->expires) > (long long)now)
+      {
+         demands[n] = atomic_load(&p->demands[rule]);
+         others += atomic_load(&p->backends[rule]);
+      }
+      else
+      {
+         /* Without a lease the peer may still be running, on its equal share,
+          * which is what it falls back to without a lease from us */
+         demands[n] = equal;
+         others += equal;
+         stale = true;
+      }
+
+      n++;
+   }
+
+   /* The rest of the division only goes out when every peer is known, so
+    * the instances on each side of a partition stay within max_size together */
+   if (stale)
+   {
+      size = equal * n;
+   }
+
+   quota = fair_share(&demands[0], n, size);
+
+   /* The connections that the peers still hold aren't given out until they are closed */
+   quota = MAX(MIN(quota, size - others), 0);
+
+   atomic_store(&config->limit_demands[rule].quota, quota);
+
+   backends = atomic_load(&config->limits[rule].backend_connections);
+
+   pgagroal_log_debug("Cluster: Limit entry (%d) demand=%d others=%d quota=%d backends=%d",
+                      rule + 1, demands[0], others, quota, backends);
+
+   if (backends > quota)
+   {
+      pgagroal_pool_trim(rule, quota);
+   }
+}
+
+static int
+fair_share(int* demands, int n, int size)
+{
+   int total = 0;
+   int remaining;
+   int left;
+   int d;
+   int j;
+   int sorted[NUMBER_OF_CLUSTER_PEERS + 1];
+
+   for (int i = 0; i < n; i++)
+   {
+      total += demands[i];
+   }
+
+   /* The spare connections are spread over the instances, so a burst can start at once */
+   if (total <= size)
+   {
+      return demands[0] + (size - total) / n;
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      d = demands[i];
+      for (j = i; j > 0 && sorted[j - 1] > d; j--)
+      {
+         sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = d;
+   }
+
+   /* The demands under the level are met, and the others share what is left */
+   remaining = size;
+   left = n;
+   for (int i = 0; i < n && sorted[i] * left <= remaining; i++)
+   {
+      remaining -= sorted[i];
+      left--;
+   }
+
+   return left > 0 ? MIN(demands[0], remaining / left) : demands[0];
+}
+
+static int
+demand(int rule)
+{
+   int wanted;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   wanted = atomic_load(&config->limits[rule].active_connections) + atomic_load(&config->waiters[rule + 1]);
+   wanted = MAX(wanted, config->limits[rule].min_size);
+
+   return MIN(wanted, config->limits[rule].max_size);
+}
+
+static int
+find_rule(char* database, char* username)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (database == NULL || username == NULL)
+   {
+      return -1;
+   }
+
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      if (!strcmp(config->limits[i].database, database) && !strcmp(config->limits[i].username, username))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static char*
+admin_password(char* username)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < config->number_of_admins; i++)
+   {
+      if (!strcmp(&config->admins[i].username[0], username))
+      {
+         return &config->admins[i].password[0];
+      }
+   }
+
+   return NULL;
+}
@@ -29,12 +29,15 @@
 /* pgagroal */
 #include <pgagroal.h>
 #include <aes.h>
+#include <art.h>
+#include <cluster.h>
 #include <configuration.h>
 #include <logging.h>
 #include <management.h>
 #include <memory.h>
 #include <network.h>
 #include <pipeline.h>
+#include <pool.h>
 #include <security.h>
 #include <server.h>
 #include <shmem.h>
@@ -53,6 +56,7 @@
 #include <strings.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <openssl/evp.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -74,22 +78,30 @@ static int as_logging_mode(char* str, int* mode);
 
 static int as_logging_rotation_size(char* str, unsigned int* size);
 static int as_validation(char* str, int* val);
+static int as_idle_transaction_action(char* str, int* action);
 static int as_pipeline(char* str, int* pipeline);
+static int as_tunnel_compression(char* str, int* compression);
 static int as_hugepage(char* str, unsigned char* hp);
 static int as_startup_validation(char* str, int* sv);
 static unsigned int as_update_process_title(char* str, unsigned int* policy, unsigned int default_policy);
 static int extract_value(char* str, int offset, char** value);
 static void extract_hba(char* str, char** type, char** database, char** user, char** address, char** method);
-static void extract_limit(char* str, int server_max, char** database, char** user, int* max_size, int* initial_size, int* min_size, char aliases[MAX_ALIASES][MAX_DATABASE_LENGTH], int* aliases_count);
+static void extract_limit(char* str, int server_max, char** database, char** user, int* max_size, int* initial_size, int* min_size, int* guaranteed_size, int* priority, char aliases[MAX_ALIASES][MAX_DATABASE_LENGTH], int* aliases_count);
 static void copy_limit(struct limit* dst, struct limit* src);
 static int as_seconds(char* str, pgagroal_time_t* result, pgagroal_time_t default_val);
 static unsigned int as_bytes(char* str, unsigned int* bytes, unsigned int default_bytes);
 static int extract_alias_with_space(char* str, int offset, char** db_part);
+static int extract_cluster_peers(struct main_configuration* config);
+static int extract_host_port(char* entry, char* host, int* port);
 
 static bool transfer_configuration(struct main_configuration* config, struct main_configuration* reload, bool* health_check_changed);
 static void copy_server(struct server* dst, struct server* src);
 static void copy_hba(struct hba* dst, struct hba* src);
 static void copy_user(struct user* dst, struct user* src);
+static bool is_same_limits(struct main_configuration* config, struct main_configuration* reload);
+static void reuse_verifiers(struct user* users, int number_of_users, struct user* existing, int number_of_existing);
+static void file_hash(char* path, unsigned char* hash);
+static bool is_same_file(char* path, unsigned char* hash);
 static int restart_int(char* name, int e, int n);
 static int __attribute__((unused)) restart_bool(char* name, bool e, bool n);
 static int restart_string(char* name, char* e, char* n, bool skip_non_existing);
@@ -120,9 +132,11 @@ static int to_bool(char* where, bool value);
 static int to_int(char* where, int value);
 static int to_update_process_title(char* where, int value);
 static int to_validation(char* where, int value);
+static int to_idle_transaction_action(char* where, int value);
 static int to_startup_validation(char* where, int value);
 static int to_hugepage(char* where, int value);
 static int to_pipeline(char* where, int value);
+static int to_tunnel_compression(char* where, int value);
 static int to_log_mode(char* where, int value);
 static int to_log_level(char* where, int value);
 static int to_log_type(char* where, int value);
@@ -153,19 +167,29 @@ pgagroal_init_configuration(void* shm)
       atomic_init(&config->servers[i].state, SERVER_NOTINIT);
       atomic_init(&config->servers[i].health_state, SERVER_HEALTH_UNKNOWN);
       config->servers[i].failures = 0;
+      atomic_init(&config->servers[i].lag, -1);
+      atomic_init(&config->servers[i].rtt, -1);
+      atomic_init(&config->servers[i].backends, 0);
+      atomic_init(&config->servers[i].connect_tat, 0);
    }
 
    config->failover = false;
    memset(config->failover_notify_script, 0, MISC_LENGTH);
    config->common.tls = false;
+   config->common.tls_ktls = false;
    config->gracefully = false;
    config->keep_running = true;
+   config->handed_over = 0;
    config->console = 0;
+   config->console_refresh = PGAGROAL_TIME_SEC(DEFAULT_CONSOLE_REFRESH);
    config->pipeline = PIPELINE_AUTO;
    config->authquery = false;
+   config->auth_query_cache_timeout = PGAGROAL_TIME_SEC(DEFAULT_AUTH_QUERY_CACHE_TIMEOUT);
    config->blocking_timeout = PGAGROAL_TIME_SEC(DEFAULT_BLOCKING_TIMEOUT);
+   config->management_timeout = PGAGROAL_TIME_SEC(DEFAULT_MANAGEMENT_TIMEOUT);
    config->connection_retry_delay = DEFAULT_CONNECTION_RETRY_DELAY;
    config->idle_timeout = PGAGROAL_TIME_SEC(DEFAULT_IDLE_TIMEOUT);
+   config->adaptive_pool_interval = PGAGROAL_TIME_SEC(DEFAULT_ADAPTIVE_POOL_INTERVAL);
    config->rotate_frontend_password_timeout = PGAGROAL_TIME_SEC(DEFAULT_ROTATE_FRONTEND_PASSWORD_TIMEOUT);
    config->rotate_frontend_password_length = MIN_PASSWORD_LENGTH;
    config->max_connection_age = PGAGROAL_TIME_SEC(DEFAULT_MAX_CONNECTION_AGE);
@@ -177,6 +201,9 @@ pgagroal_init_configuration(void* shm)
    config->health_check_period = PGAGROAL_TIME_SEC(DEFAULT_HEALTH_CHECK_PERIOD);
    config->health_check_timeout = PGAGROAL_TIME_SEC(DEFAULT_HEALTH_CHECK_TIMEOUT);
    pgagroal_snprintf(config->health_check_user, MAX_USERNAME_LENGTH, "");
+   memset(config->replica_application_name, 0, MAX_APPLICATION_NAME);
+   config->replica_max_lag = DEFAULT_REPLICA_MAX_LAG;
+   config->replica_balance = false;
    config->health_check_pid = 0;
    config->startup_validation = STARTUP_VALIDATION_TRY;
    config->common.authentication_timeout = PGAGROAL_TIME_SEC(DEFAULT_AUTHENTICATION_TIMEOUT);
@@ -187,12 +214,52 @@ pgagroal_init_configuration(void* shm)
 
    config->keep_alive = true;
    config->nodelay = true;
+   config->tcp_user_timeout = PGAGROAL_TIME_DISABLED;
+   config->tcp_keepalive_idle = PGAGROAL_TIME_DISABLED;
+   config->tcp_keepalive_interval = PGAGROAL_TIME_DISABLED;
+   config->tcp_keepalive_count = 0;
+   config->write_timeout = PGAGROAL_TIME_DISABLED;
+   config->dns_cache_ttl = PGAGROAL_TIME_DISABLED;
+   config->connect_timeout = PGAGROAL_TIME_DISABLED;
    config->backlog = -1;
+   config->prefork_workers = 0;
+   config->multiplex_workers = 0;
+   config->startup_gate = false;
+   config->log_async = false;
+   config->lazy_reset = false;
+   config->transaction_stickiness = 0;
+   config->busy_poll = 0;
+   config->idle_transaction_timeout = PGAGROAL_TIME_DISABLED;
+   config->idle_transaction_action = IDLE_TRANSACTION_CANCEL;
+   config->notify_relay = false;
+   config->query_cache_max_size = 0;
+   config->query_cache_max_age = PGAGROAL_TIME_SEC(DEFAULT_QUERY_CACHE_MAX_AGE);
+   config->query_statistics = false;
+   config->query_statistics_sample = DEFAULT_QUERY_STATISTICS_SAMPLE;
+   config->query_statistics_top = DEFAULT_QUERY_STATISTICS_TOP;
+   config->acceptors = 1;
    config->common.hugepage = HUGEPAGE_TRY;
+   config->numa_node = -1;
    config->tracker = false;
+   config->slow_acquire_threshold = 0;
+   config->slow_transaction_threshold = 0;
    config->track_prepared_statements = false;
+   config->track_session_parameters = false;
+   config->cluster_lease = PGAGROAL_TIME_SEC(DEFAULT_CLUSTER_LEASE);
+   config->tunnel_links = DEFAULT_TUNNEL_LINKS;
+   config->tunnel_compression = TUNNEL_COMPRESSION_NONE;
+   config->tunnel_tls = false;
+   config->tunnel_port = 0;
 
    config->ev_backend = PGAGROAL_EVENT_BACKEND_AUTO;
+   config->io_uring_batch = false;
+   config->io_uring_sqpoll = false;
+   config->io_uring_sqpoll_cpu = -1;
+   config->io_uring_zero_copy = 0;
+   config->ev_edge_triggered = false;
+   config->coalesce_writes = false;
+   config->metrics_accounting = false;
+   config->performance_splice = false;
 
    config->common.log_type = PGAGROAL_LOGGING_TYPE_CONSOLE;
    config->common.log_level = PGAGROAL_LOGGING_LEVEL_INFO;
@@ -204,9 +271,16 @@ pgagroal_init_configuration(void* shm)
    memcpy(config->common.default_log_path, "pgagroal.log", strlen("pgagroal.log"));
 
    config->max_connections = 100;
+   config->max_connections_reserve = 0;
+   config->prefill_concurrency = DEFAULT_PREFILL_CONCURRENCY;
+   config->connection_rate = 0;
+   config->max_queue_length = 0;
+   config->client_connection_rate = 0;
+   config->flush_rate = DEFAULT_FLUSH_RATE;
    config->allow_unknown_users = true;
 
    atomic_init(&config->su_connection, STATE_FREE);
+   atomic_init(&config->security_lock, STATE_FREE);
 
    config->update_process_title = UPDATE_PROCESS_TITLE_VERBOSE;
 
@@ -478,6 +552,161 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
       config->backlog = MAX(config->max_connections / 4, 16);
    }
 
+   if (config->prefork_workers < 0)
+   {
+      config->prefork_workers = 0;
+   }
+
+   if (config->multiplex_workers < 0)
+   {
+      config->multiplex_workers = 0;
+   }
+
+   if (config->multiplex_workers > NUMBER_OF_MULTIPLEX_WORKERS)
+   {
+      pgagroal_log_warn("pgagroal: multiplex_workers (%d) is greater than allowed (%d)", config->multiplex_workers, NUMBER_OF_MULTIPLEX_WORKERS);
+      config->multiplex_workers = NUMBER_OF_MULTIPLEX_WORKERS;
+   }
+
+   if (config->transaction_stickiness < 0)
+   {
+      config->transaction_stickiness = 0;
+   }
+
+   if (config->slow_acquire_threshold < 0)
+   {
+      config->slow_acquire_threshold = 0;
+   }
+
+   if (config->slow_transaction_threshold < 0)
+   {
+      config->slow_transaction_threshold = 0;
+   }
+
+   if (config->transaction_stickiness > MAX_TRANSACTION_STICKINESS)
+   {
+      pgagroal_log_warn("pgagroal: transaction_stickiness (%d) is greater than allowed (%d)", config->transaction_stickiness, MAX_TRANSACTION_STICKINESS);
+      config->transaction_stickiness = MAX_TRANSACTION_STICKINESS;
+   }
+
+   if (config->busy_poll < 0)
+   {
+      config->busy_poll = 0;
+   }
+
+   if (config->busy_poll > MAX_BUSY_POLL)
+   {
+      pgagroal_log_warn("pgagroal: busy_poll (%d) is greater than allowed (%d)", config->busy_poll, MAX_BUSY_POLL);
+      config->busy_poll = MAX_BUSY_POLL;
+   }
+
+   if (config->busy_poll > 0 && config->pipeline != PIPELINE_PERFORMANCE && config->pipeline != PIPELINE_TRANSACTION)
+   {
+      pgagroal_log_warn("pgagroal: busy_poll requires the performance or transaction pipeline");
+      config->busy_poll = 0;
+   }
+
+   if (pgagroal_time_is_valid(config->idle_transaction_timeout) && config->pipeline != PIPELINE_TRANSACTION)
+   {
+      pgagroal_log_warn("pgagroal: idle_transaction_timeout requires the transaction pipeline");
+      config->idle_transaction_timeout = PGAGROAL_TIME_DISABLED;
+   }
+
+   if (config->notify_relay && config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+   {
+      pgagroal_log_warn("pgagroal: notify_relay requires the transaction or statement pipeline");
+      config->notify_relay = false;
+   }
+
+   if (config->notify_relay && config->ev_backend == PGAGROAL_EVENT_BACKEND_IO_URING)
+   {
+      pgagroal_log_warn("pgagroal: notify_relay is not supported by the io_uring event backend");
+      config->notify_relay = false;
+   }
+
+   if (config->track_session_parameters && config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+   {
+      pgagroal_log_warn("pgagroal: track_session_parameters requires the transaction or statement pipeline");
+      config->track_session_parameters = false;
+   }
+
+   if (config->query_cache_max_size > 0 && config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+   {
+      pgagroal_log_warn("pgagroal: query_cache_max_size requires the transaction or statement pipeline");
+      config->query_cache_max_size = 0;
+   }
+
+   if (config->query_statistics && config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+   {
+      pgagroal_log_warn("pgagroal: query_statistics requires the transaction or statement pipeline");
+      config->query_statistics = false;
+   }
+
+   if (config->query_statistics && config->common.metrics == 0)
+   {
+      pgagroal_log_warn("pgagroal: query_statistics requires metrics");
+      config->query_statistics = false;
+   }
+
+   if (config->query_statistics_sample < 1)
+   {
+      config->query_statistics_sample = 1;
+   }
+
+   if (config->query_statistics_top < 1)
+   {
+      config->query_statistics_top = 1;
+   }
+
+   if (config->query_statistics_top > NUMBER_OF_QUERY_FINGERPRINTS)
+   {
+      pgagroal_log_warn("pgagroal: query_statistics_top (%d) is greater than allowed (%d)", config->query_statistics_top, NUMBER_OF_QUERY_FINGERPRINTS);
+      config->query_statistics_top = NUMBER_OF_QUERY_FINGERPRINTS;
+   }
+
+   if (config->query_cache_max_size > 0 && config->ev_backend == PGAGROAL_EVENT_BACKEND_IO_URING)
+   {
+      pgagroal_log_warn("pgagroal: query_cache_max_size is not supported by the io_uring event backend");
+      config->query_cache_max_size = 0;
+   }
+
+   if (config->multiplex_workers > 0 && config->pipeline != PIPELINE_TRANSACTION)
+   {
+      pgagroal_log_warn("pgagroal: multiplex_workers requires the transaction pipeline");
+      config->multiplex_workers = 0;
+   }
+
+   if (config->track_session_parameters && config->multiplex_workers > 0)
+   {
+      pgagroal_log_warn("pgagroal: track_session_parameters is not supported by the multiplexer");
+      config->track_session_parameters = false;
+   }
+
+   if (config->acceptors < 1)
+   {
+      config->acceptors = 1;
+   }
+
+   if (config->acceptors > NUMBER_OF_ACCEPTORS)
+   {
+      pgagroal_log_warn("pgagroal: acceptors (%d) is greater than allowed (%d)", config->acceptors, NUMBER_OF_ACCEPTORS);
+      config->acceptors = NUMBER_OF_ACCEPTORS;
+   }
+
+   if (config->numa_node < -1)
+   {
+      pgagroal_log_warn("pgagroal: numa_node (%d) must be -1 or a NUMA node", config->numa_node);
+      config->numa_node = -1;
+   }
+
+#ifndef SO_REUSEPORT
+   if (config->acceptors > 1)
+   {
+      pgagroal_log_warn("pgagroal: acceptors requires SO_REUSEPORT");
+      config->acceptors = 1;
+   }
+#endif
+
    if (!pgagroal_time_is_valid(config->common.authentication_timeout))
    {
       config->common.authentication_timeout = PGAGROAL_TIME_SEC(DEFAULT_AUTHENTICATION_TIMEOUT);
@@ -537,6 +766,28 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
       config->max_connections = MAX_NUMBER_OF_CONNECTIONS;
    }
 
+   if (config->max_connections_reserve < 0)
+   {
+      pgagroal_log_warn("pgagroal: max_connections_reserve (%d) must be 0 or greater", config->max_connections_reserve);
+      config->max_connections_reserve = 0;
+   }
+
+   if (config->max_connections_reserve > MAX_NUMBER_OF_CONNECTIONS)
+   {
+      pgagroal_log_warn("pgagroal: max_connections_reserve (%d) is greater than allowed (%d)", config->max_connections_reserve, MAX_NUMBER_OF_CONNECTIONS);
+      config->max_connections_reserve = MAX_NUMBER_OF_CONNECTIONS;
+   }
+
+   /* The shared memory is laid out for the slots, so a reload can change
+    * max_connections within them */
+   config->connection_slots = MAX(config->max_connections, config->max_connections_reserve);
+
+   if (config->prefork_workers > config->max_connections)
+   {
+      pgagroal_log_warn("pgagroal: prefork_workers (%d) is greater than max_connections (%d)", config->prefork_workers, config->max_connections);
+      config->prefork_workers = config->max_connections;
+   }
+
    if (config->health_check && pgagroal_time_convert(config->health_check_period, FORMAT_TIME_S) < HEALTH_CHECK_MIN_INTERVAL)
    {
       pgagroal_log_warn("pgagroal: health_check_period is invalid (< %d), disabling health check", HEALTH_CHECK_MIN_INTERVAL);
@@ -549,12 +800,64 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
       config->health_check = false;
    }
 
+   if (!config->keep_alive && (pgagroal_time_convert(config->tcp_keepalive_idle, FORMAT_TIME_S) > 0 ||
+                               pgagroal_time_convert(config->tcp_keepalive_interval, FORMAT_TIME_S) > 0 ||
+                               config->tcp_keepalive_count > 0))
+   {
+      pgagroal_log_warn("pgagroal: tcp_keepalive_idle, tcp_keepalive_interval and tcp_keepalive_count require keep_alive");
+   }
+
+   if (config->max_queue_length < 0)
+   {
+      pgagroal_log_warn("pgagroal: max_queue_length (%d) is invalid, disabling it", config->max_queue_length);
+      config->max_queue_length = 0;
+   }
+
+   if (config->connection_rate < 0)
+   {
+      pgagroal_log_warn("pgagroal: connection_rate (%d) is invalid, disabling it", config->connection_rate);
+      config->connection_rate = 0;
+   }
+
+   if (config->client_connection_rate < 0)
+   {
+      pgagroal_log_warn("pgagroal: client_connection_rate (%d) is invalid, disabling it", config->client_connection_rate);
+      config->client_connection_rate = 0;
+   }
+
+   if (config->flush_rate < 0)
+   {
+      pgagroal_log_warn("pgagroal: flush_rate (%d) is invalid, using %d", config->flush_rate, DEFAULT_FLUSH_RATE);
+      config->flush_rate = DEFAULT_FLUSH_RATE;
+   }
+
+   if (config->tcp_keepalive_count < 0)
+   {
+      pgagroal_log_warn("pgagroal: tcp_keepalive_count (%d) is invalid, using the kernel default", config->tcp_keepalive_count);
+      config->tcp_keepalive_count = 0;
+   }
+
    if (config->health_check && strlen(config->health_check_user) == 0)
    {
       pgagroal_log_fatal("pgagroal: health_check_user is required when health_check is enabled");
       return 1;
    }
 
+   if (strlen(config->replica_application_name) > 0)
+   {
+      if (!config->health_check)
+      {
+         pgagroal_log_warn("pgagroal: replica_application_name requires health_check");
+         memset(config->replica_application_name, 0, MAX_APPLICATION_NAME);
+      }
+      else if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
+      {
+         pgagroal_log_warn("pgagroal: replica_application_name is not supported by the %s pipeline",
+                           config->pipeline == PIPELINE_TRANSACTION ? "transaction" : "statement");
+         memset(config->replica_application_name, 0, MAX_APPLICATION_NAME);
+      }
+   }
+
    if (config->number_of_frontend_users > 0 && config->allow_unknown_users)
    {
       pgagroal_log_warn("pgagroal: Frontend users should not be used with allow_unknown_users");
@@ -648,7 +951,51 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
       }
    }
 
-   if (config->number_of_servers <= 0)
+   if (strlen(config->tunnel) > 0)
+   {
+      if (extract_host_port(config->tunnel, config->tunnel_host, &config->tunnel_host_port))
+      {
+         pgagroal_log_fatal("pgagroal: tunnel '%s' must be host:port", config->tunnel);
+         return 1;
+      }
+
+      if (config->tunnel_links < 1 || config->tunnel_links > NUMBER_OF_TUNNEL_LINKS)
+      {
+         pgagroal_log_warn("pgagroal: tunnel_links must be between 1 and %d. Default to %d", NUMBER_OF_TUNNEL_LINKS, DEFAULT_TUNNEL_LINKS);
+         config->tunnel_links = DEFAULT_TUNNEL_LINKS;
+      }
+   }
+
+   /* The central trusts the client addresses of an edge, so the edges present a certificate */
+   if (strlen(config->tunnel) > 0 &&
+       (!config->tunnel_tls || strlen(config->common.tls_cert_file) == 0 || strlen(config->common.tls_key_file) == 0))
+   {
+      pgagroal_log_fatal("pgagroal: tunnel requires tunnel_tls, tls_cert_file and tls_key_file");
+      return 1;
+   }
+
+   if (config->tunnel_port > 0 &&
+       (!config->tunnel_tls || strlen(config->common.tls_cert_file) == 0 || strlen(config->common.tls_key_file) == 0 ||
+        strlen(config->common.tls_ca_file) == 0))
+   {
+      pgagroal_log_fatal("pgagroal: tunnel_port requires tunnel_tls, tls_cert_file, tls_key_file and tls_ca_file");
+      return 1;
+   }
+
+   if (pgagroal_time_convert(config->console_refresh, FORMAT_TIME_S) < 1)
+   {
+      pgagroal_log_warn("pgagroal: console_refresh must be at least 1 second. Default to %d", DEFAULT_CONSOLE_REFRESH);
+      config->console_refresh = PGAGROAL_TIME_SEC(DEFAULT_CONSOLE_REFRESH);
+   }
+
+   if (strlen(config->tunnel) > 0 && config->tunnel_port > 0)
+   {
+      pgagroal_log_fatal("pgagroal: tunnel and tunnel_port can't be used together");
+      return 1;
+   }
+
+   /* An edge passes its clients on to the central pgagroal, which owns the servers */
+   if (config->number_of_servers <= 0 && strlen(config->tunnel) == 0)
    {
       pgagroal_log_fatal("pgagroal: No servers defined");
       return 1;
@@ -673,6 +1020,15 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
                             config->servers[i].lineno);
          return 1;
       }
+
+      if (config->servers[i].tls_direct && !config->servers[i].tls)
+      {
+         pgagroal_log_warn("pgagroal: tls_direct requires tls for server [%s] (%s:%d)",
+                           config->servers[i].name,
+                           config->common.configuration_path,
+                           config->servers[i].lineno);
+         config->servers[i].tls_direct = false;
+      }
    }
 
    // check for duplicated servers
@@ -736,7 +1092,7 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
    {
       /* Checks */
    }
-   else if (config->pipeline == PIPELINE_TRANSACTION)
+   else if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
    {
       if (config->disconnect_client > 0)
       {
@@ -886,12 +1242,16 @@ pgagroal_validate_configuration(void* shm, bool has_unix_socket, bool has_main_s
       }
 
       /* see doc: https://docs.kernel.org/admin-guide/sysctl/kernel.html#io-uring-disabled */
-      if (config->common.tls || (rval == '1') || (rval == '2'))
+      if (config->common.tls || strlen(config->tunnel) > 0 || config->tunnel_port > 0 || (rval == '1') || (rval == '2'))
       {
          if (config->common.tls)
          {
             pgagroal_log_warn("io_uring not supported with tls on");
          }
+         else if (strlen(config->tunnel) > 0 || config->tunnel_port > 0)
+         {
+            pgagroal_log_warn("io_uring not supported with tunnel");
+         }
          else
          {
             pgagroal_log_warn("io_uring supported but not enabled. Enable io_uring by setting /proc/sys/kernel/io_uring_disabled to '0'");
@@ -903,6 +1263,50 @@ fallback:
 #endif /* HAVE_LINUX && HAVE_IO_URING */
    pgagroal_log_debug("Selected backend '%s'", to_backend_str(config->ev_backend));
 
+   if (config->startup_gate && config->ev_backend == PGAGROAL_EVENT_BACKEND_IO_URING)
+   {
+      pgagroal_log_warn("pgagroal: startup_gate is not supported by the io_uring event backend");
+      config->startup_gate = false;
+   }
+
+   if (config->io_uring_sqpoll_cpu < -1)
+   {
+      pgagroal_log_warn("io_uring_sqpoll_cpu must be -1 or a CPU number. Default to -1");
+      config->io_uring_sqpoll_cpu = -1;
+   }
+
+   if (config->io_uring_zero_copy < 0)
+   {
+      pgagroal_log_warn("io_uring_zero_copy must be 0 or a size in bytes. Default to 0");
+      config->io_uring_zero_copy = 0;
+   }
+
+   if (extract_cluster_peers(config))
+   {
+      return 1;
+   }
+
+   if (config->number_of_cluster_peers > 0)
+   {
+      if (config->management <= 0)
+      {
+         pgagroal_log_fatal("pgagroal: cluster_peers requires management");
+         return 1;
+      }
+
+      if (strlen(config->cluster_user) == 0)
+      {
+         pgagroal_log_fatal("pgagroal: cluster_peers requires cluster_user");
+         return 1;
+      }
+
+      if (pgagroal_time_convert(config->cluster_lease, FORMAT_TIME_S) < 1)
+      {
+         pgagroal_log_warn("pgagroal: cluster_lease must be at least 1 second. Default to %d", DEFAULT_CLUSTER_LEASE);
+         config->cluster_lease = PGAGROAL_TIME_SEC(DEFAULT_CLUSTER_LEASE);
+      }
+   }
+
    // do some last initialization here, since the configuration
    // looks good so far
    pgagroal_init_pidfile_if_needed();
@@ -923,6 +1327,7 @@ pgagroal_vault_init_configuration(void* shm)
    config->common.port = 0;
    config->common.tls = false;
    config->tls_cert_auth_mode = TLS_CERT_AUTH_MODE_VERIFY_CA;
+   config->password_cache_timeout = PGAGROAL_TIME_SEC(0);
 
    config->vault_server.server.port = 0;
    config->vault_server.server.tls = false;
@@ -1391,6 +1796,8 @@ pgagroal_read_limit_configuration(void* shm, char* filename)
    int max_size;
    int initial_size;
    int min_size;
+   int guaranteed_size;
+   int priority;
    int server_max;
    int lineno;
    struct main_configuration* config;
@@ -1421,13 +1828,14 @@ pgagroal_read_limit_configuration(void* shm, char* filename)
          // Clear aliases array for each line
          memset(aliases, 0, sizeof(aliases));
 
-         extract_limit(line, server_max, &database, &username, &max_size, &initial_size, &min_size, aliases, &aliases_count);
+         extract_limit(line, server_max, &database, &username, &max_size, &initial_size, &min_size, &guaranteed_size, &priority, aliases, &aliases_count);
 
          if (database && username)
          {
             // normalize the sizes
             initial_size = initial_size > max_size ? max_size : initial_size;
             min_size = min_size > max_size ? max_size : min_size;
+            guaranteed_size = guaranteed_size > max_size ? max_size : guaranteed_size;
 
             if (pgagroal_apply_limit_configuration_string(&config->limits[index], PGAGROAL_LIMIT_ENTRY_DATABASE, database) == 0 && pgagroal_apply_limit_configuration_string(&config->limits[index], PGAGROAL_LIMIT_ENTRY_USERNAME, username) == 0 && pgagroal_apply_limit_configuration_int(&config->limits[index], PGAGROAL_LIMIT_ENTRY_MAX_SIZE, max_size) == 0 && pgagroal_apply_limit_configuration_int(&config->limits[index], PGAGROAL_LIMIT_ENTRY_MIN_SIZE, min_size) == 0 && pgagroal_apply_limit_configuration_int(&config->limits[index], PGAGROAL_LIMIT_ENTRY_LINENO, lineno) == 0 && pgagroal_apply_limit_configuration_int(&config->limits[index], PGAGROAL_LIMIT_ENTRY_INITIAL_SIZE, initial_size) == 0)
             {
@@ -1439,6 +1847,8 @@ pgagroal_read_limit_configuration(void* shm, char* filename)
                config->limits[index].max_size = max_size;
                config->limits[index].initial_size = initial_size;
                config->limits[index].min_size = min_size;
+               config->limits[index].guaranteed_size = guaranteed_size;
+               config->limits[index].priority = priority;
                config->limits[index].lineno = lineno;
 
                config->limits[index].aliases_count = aliases_count;
@@ -1499,11 +1909,37 @@ int
 pgagroal_validate_limit_configuration(void* shm)
 {
    int total_connections;
+   struct art* databases = NULL;
+   struct art* aliases = NULL;
+   struct art* users = NULL;
    struct main_configuration* config;
 
    total_connections = 0;
    config = (struct main_configuration*)shm;
 
+   /* The names are indexed once instead of scanning every entry for every alias */
+   if (pgagroal_art_create(&databases) || pgagroal_art_create(&aliases) || pgagroal_art_create(&users))
+   {
+      pgagroal_log_fatal("pgagroal: LIMIT: Out of memory");
+      goto error;
+   }
+
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      if (strlen(config->limits[i].database) > 0 && !pgagroal_art_contains_key(databases, config->limits[i].database))
+      {
+         pgagroal_art_insert(databases, config->limits[i].database, (uintptr_t)(i + 1), ValueInt32);
+      }
+   }
+
+   for (int i = 0; i < config->number_of_users; i++)
+   {
+      if (strlen(config->users[i].username) > 0)
+      {
+         pgagroal_art_insert(users, config->users[i].username, (uintptr_t)true, ValueBool);
+      }
+   }
+
    for (int i = 0; i < config->number_of_limits; i++)
    {
       total_connections += config->limits[i].max_size;
@@ -1511,111 +1947,80 @@ pgagroal_validate_limit_configuration(void* shm)
       if (config->limits[i].max_size <= 0)
       {
          pgagroal_log_fatal("max_size must be greater than 0 for limit entry %d (%s:%d)", i + 1, config->limit_path, config->limits[i].lineno);
-         return 1;
+         goto error;
       }
 
       if (config->limits[i].initial_size < 0)
       {
          pgagroal_log_fatal("initial_size must be greater or equal to 0 for limit entry %d (%s:%d)", i + 1, config->limit_path, config->limits[i].lineno);
-         return 1;
+         goto error;
       }
 
       if (config->limits[i].min_size < 0)
       {
          pgagroal_log_fatal("min_size must be greater or equal to 0 for limit entry %d (%s:%d)", i + 1, config->limit_path, config->limits[i].lineno);
-         return 1;
+         goto error;
+      }
+
+      if (config->limits[i].guaranteed_size < 0)
+      {
+         pgagroal_log_fatal("guaranteed_size must be greater or equal to 0 for limit entry %d (%s:%d)", i + 1, config->limit_path, config->limits[i].lineno);
+         goto error;
       }
 
       // Validate aliases within the current limit entry
       for (int j = 0; j < config->limits[i].aliases_count; j++)
       {
-         if (strlen(config->limits[i].aliases[j]) == 0)
+         char* alias = config->limits[i].aliases[j];
+         int k;
+
+         if (strlen(alias) == 0)
          {
             pgagroal_log_fatal("Empty alias found for limit entry %d (%s:%d)", i + 1, config->limit_path, config->limits[i].lineno);
-            return 1;
+            goto error;
          }
 
          // Check for duplicate aliases within the same limit entry
-         for (int k = j + 1; k < config->limits[i].aliases_count; k++)
+         k = (int)pgagroal_art_search(aliases, alias);
+         if (k == i + 1)
          {
-            if (!strcmp(config->limits[i].aliases[j], config->limits[i].aliases[k]))
-            {
-               pgagroal_log_fatal("Duplicate alias '%s' found within limit entry %d (%s:%d)",
-                                  config->limits[i].aliases[j], i + 1, config->limit_path, config->limits[i].lineno);
-               return 1;
-            }
+            pgagroal_log_fatal("Duplicate alias '%s' found within limit entry %d (%s:%d)",
+                               alias, i + 1, config->limit_path, config->limits[i].lineno);
+            goto error;
          }
 
-         // Check if alias conflicts with any main database name
-         for (int k = 0; k < config->number_of_limits; k++)
+         // Check if alias conflicts with any main database name, this covers
+         // a database name that matches the alias of another entry as well
+         k = (int)pgagroal_art_search(databases, alias);
+         if (k != 0)
          {
-            if (!strcmp(config->limits[i].aliases[j], config->limits[k].database))
-            {
-               pgagroal_log_fatal("Alias '%s' in entry %d conflicts with database name in entry %d (%s:%d vs %s:%d)",
-                                  config->limits[i].aliases[j], i + 1, k + 1,
-                                  config->limit_path, config->limits[i].lineno,
-                                  config->limit_path, config->limits[k].lineno);
-               return 1;
-            }
+            pgagroal_log_fatal("Alias '%s' in entry %d conflicts with database name in entry %d (%s:%d vs %s:%d)",
+                               alias, i + 1, k,
+                               config->limit_path, config->limits[i].lineno,
+                               config->limit_path, config->limits[k - 1].lineno);
+            goto error;
          }
 
          // Check for alias uniqueness across all other limit entries
-         for (int k = 0; k < config->number_of_limits; k++)
+         k = (int)pgagroal_art_search(aliases, alias);
+         if (k != 0)
          {
-            if (k == i)
-            {
-               continue; // Skip current entry
-            }
-            for (int l = 0; l < config->limits[k].aliases_count; l++)
-            {
-               if (!strcmp(config->limits[i].aliases[j], config->limits[k].aliases[l]))
-               {
-                  pgagroal_log_fatal("Duplicate alias '%s' found in entries %d and %d (%s:%d vs %s:%d)",
-                                     config->limits[i].aliases[j], i + 1, k + 1,
-                                     config->limit_path, config->limits[i].lineno,
-                                     config->limit_path, config->limits[k].lineno);
-                  return 1;
-               }
-            }
+            pgagroal_log_fatal("Duplicate alias '%s' found in entries %d and %d (%s:%d vs %s:%d)",
+                               alias, i + 1, k,
+                               config->limit_path, config->limits[i].lineno,
+                               config->limit_path, config->limits[k - 1].lineno);
+            goto error;
          }
-      }
 
-      // Check if main database name conflicts with any alias
-      for (int j = 0; j < config->number_of_limits; j++)
-      {
-         if (j == i)
-         {
-            continue; // Skip current entry
-         }
-         for (int k = 0; k < config->limits[j].aliases_count; k++)
-         {
-            if (!strcmp(config->limits[i].database, config->limits[j].aliases[k]))
-            {
-               pgagroal_log_fatal("Database name '%s' in entry %d conflicts with alias in entry %d (%s:%d vs %s:%d)",
-                                  config->limits[i].database, i + 1, j + 1,
-                                  config->limit_path, config->limits[i].lineno,
-                                  config->limit_path, config->limits[j].lineno);
-               return 1;
-            }
-         }
+         pgagroal_art_insert(aliases, alias, (uintptr_t)(i + 1), ValueInt32);
       }
 
       if (config->limits[i].initial_size > 0 || config->limits[i].min_size > 0)
       {
-         bool user_found = false;
-
-         for (int j = 0; j < config->number_of_users; j++)
-         {
-            if (!strcmp(config->limits[i].username, config->users[j].username))
-            {
-               user_found = true;
-            }
-         }
-
-         if (!user_found)
+         if (strlen(config->limits[i].username) == 0 || !pgagroal_art_contains_key(users, config->limits[i].username))
          {
             pgagroal_log_fatal("Unknown user '%s' for limit entry %d (%s:%d)", config->limits[i].username, i + 1, config->limit_path, config->limits[i].lineno);
-            return 1;
+            goto error;
          }
 
          if (config->limits[i].initial_size != 0 && config->limits[i].initial_size < config->limits[i].min_size)
@@ -1648,10 +2053,22 @@ pgagroal_validate_limit_configuration(void* shm)
    if (total_connections > config->max_connections)
    {
       pgagroal_log_fatal("pgagroal: LIMIT: Too many connections defined %d (max_connections = %d)", total_connections, config->max_connections);
-      return 1;
+      goto error;
    }
 
+   pgagroal_art_destroy(databases);
+   pgagroal_art_destroy(aliases);
+   pgagroal_art_destroy(users);
+
    return 0;
+
+error:
+
+   pgagroal_art_destroy(databases);
+   pgagroal_art_destroy(aliases);
+   pgagroal_art_destroy(users);
+
+   return 1;
 }
 
 /**
@@ -1688,6 +2105,7 @@ pgagroal_read_users_configuration(void* shm, char* filename)
 
    index = 0;
    config = (struct main_configuration*)shm;
+   file_hash(filename, &config->users_hash[0]);
 
    while (fgets(line, sizeof(line), file))
    {
@@ -1827,6 +2245,7 @@ pgagroal_read_frontend_users_configuration(void* shm, char* filename)
 
    index = 0;
    config = (struct main_configuration*)shm;
+   file_hash(filename, &config->frontend_users_hash[0]);
 
    while (fgets(line, sizeof(line), file))
    {
@@ -1991,6 +2410,7 @@ pgagroal_read_admins_configuration(void* shm, char* filename)
 
    index = 0;
    config = (struct main_configuration*)shm;
+   file_hash(filename, &config->admins_hash[0]);
 
    while (fgets(line, sizeof(line), file))
    {
@@ -2240,6 +2660,22 @@ pgagroal_validate_admins_configuration(void* shm)
       pgagroal_log_warn("pgagroal: Remote management enabled, but no admins are defined");
    }
 
+   if (config->number_of_cluster_peers > 0)
+   {
+      bool found = false;
+
+      for (int i = 0; !found && i < config->number_of_admins; i++)
+      {
+         found = !strcmp(config->admins[i].username, config->cluster_user);
+      }
+
+      if (!found)
+      {
+         pgagroal_log_fatal("pgagroal: cluster_user '%s' is not an admin", config->cluster_user);
+         return 1;
+      }
+   }
+
    return 0;
 }
 
@@ -2274,6 +2710,7 @@ pgagroal_read_superuser_configuration(void* shm, char* filename)
 
    index = 0;
    config = (struct main_configuration*)shm;
+   file_hash(filename, &config->superuser_hash[0]);
 
    while (fgets(line, sizeof(line), file))
    {
@@ -2429,9 +2866,19 @@ pgagroal_reload_configuration(bool* r, bool* health_check_changed)
       }
    }
 
+   /* An unchanged users file keeps the decrypted users and their verifiers */
    if (strcmp("", config->users_path))
    {
-      if (pgagroal_read_users_configuration((void*)reload, config->users_path))
+      if (is_same_file(config->users_path, &config->users_hash[0]))
+      {
+         for (int i = 0; i < config->number_of_users; i++)
+         {
+            copy_user(&reload->users[i], &config->users[i]);
+         }
+         reload->number_of_users = config->number_of_users;
+         memcpy(&reload->users_hash[0], &config->users_hash[0], FILE_HASH_LENGTH);
+      }
+      else if (pgagroal_read_users_configuration((void*)reload, config->users_path))
       {
          goto error;
       }
@@ -2439,15 +2886,33 @@ pgagroal_reload_configuration(bool* r, bool* health_check_changed)
 
    if (strcmp("", config->frontend_users_path))
    {
-      if (pgagroal_read_frontend_users_configuration((void*)reload, config->frontend_users_path))
+      if (is_same_file(config->frontend_users_path, &config->frontend_users_hash[0]))
       {
-         goto error;
-      }
+         for (int i = 0; i < config->number_of_frontend_users; i++)
+         {
+            copy_user(&reload->frontend_users[i], &config->frontend_users[i]);
+         }
+         reload->number_of_frontend_users = config->number_of_frontend_users;
+         memcpy(&reload->frontend_users_hash[0], &config->frontend_users_hash[0], FILE_HASH_LENGTH);
+      }
+      else if (pgagroal_read_frontend_users_configuration((void*)reload, config->frontend_users_path))
+      {
+         goto error;
+      }
    }
 
    if (strcmp("", config->admins_path))
    {
-      if (pgagroal_read_admins_configuration((void*)reload, config->admins_path))
+      if (is_same_file(config->admins_path, &config->admins_hash[0]))
+      {
+         for (int i = 0; i < config->number_of_admins; i++)
+         {
+            copy_user(&reload->admins[i], &config->admins[i]);
+         }
+         reload->number_of_admins = config->number_of_admins;
+         memcpy(&reload->admins_hash[0], &config->admins_hash[0], FILE_HASH_LENGTH);
+      }
+      else if (pgagroal_read_admins_configuration((void*)reload, config->admins_path))
       {
          goto error;
       }
@@ -2455,7 +2920,12 @@ pgagroal_reload_configuration(bool* r, bool* health_check_changed)
 
    if (strcmp("", config->superuser_path))
    {
-      if (pgagroal_read_superuser_configuration((void*)reload, config->superuser_path))
+      if (is_same_file(config->superuser_path, &config->superuser_hash[0]))
+      {
+         copy_user(&reload->superuser, &config->superuser);
+         memcpy(&reload->superuser_hash[0], &config->superuser_hash[0], FILE_HASH_LENGTH);
+      }
+      else if (pgagroal_read_superuser_configuration((void*)reload, config->superuser_path))
       {
          goto error;
       }
@@ -2496,6 +2966,19 @@ pgagroal_reload_configuration(bool* r, bool* health_check_changed)
       goto error;
    }
 
+   if (pgagroal_hba_compile(reload))
+   {
+      goto error;
+   }
+
+   /* Only the users whose password changed need a new verifier */
+   reuse_verifiers(&reload->users[0], reload->number_of_users, &config->users[0], config->number_of_users);
+   reuse_verifiers(&reload->frontend_users[0], reload->number_of_frontend_users, &config->frontend_users[0], config->number_of_frontend_users);
+   reuse_verifiers(&reload->admins[0], reload->number_of_admins, &config->admins[0], config->number_of_admins);
+   reuse_verifiers(&reload->superuser, strlen(reload->superuser.username) > 0 ? 1 : 0, &config->superuser, strlen(config->superuser.username) > 0 ? 1 : 0);
+
+   pgagroal_scram_verifiers(reload);
+
    *r = transfer_configuration(config, reload, health_check_changed);
    // Update certificate metrics after successful reload
    if (config->common.metrics > 0)
@@ -2968,6 +3451,30 @@ as_validation(char* str, int* val)
    return 1;
 }
 
+static int
+as_idle_transaction_action(char* str, int* action)
+{
+   if (!strcasecmp(str, "warn"))
+   {
+      *action = IDLE_TRANSACTION_WARN;
+      return 0;
+   }
+
+   if (!strcasecmp(str, "cancel"))
+   {
+      *action = IDLE_TRANSACTION_CANCEL;
+      return 0;
+   }
+
+   if (!strcasecmp(str, "rollback"))
+   {
+      *action = IDLE_TRANSACTION_ROLLBACK;
+      return 0;
+   }
+
+   return 1;
+}
+
 static int
 as_pipeline(char* str, int* pipeline)
 {
@@ -2995,6 +3502,36 @@ as_pipeline(char* str, int* pipeline)
       return 0;
    }
 
+   if (!strcasecmp(str, "statement"))
+   {
+      *pipeline = PIPELINE_STATEMENT;
+      return 0;
+   }
+
+   return 1;
+}
+
+static int
+as_tunnel_compression(char* str, int* compression)
+{
+   if (!strcasecmp(str, "off") || !strcasecmp(str, "none"))
+   {
+      *compression = TUNNEL_COMPRESSION_NONE;
+      return 0;
+   }
+
+   if (!strcasecmp(str, "lz4"))
+   {
+      *compression = TUNNEL_COMPRESSION_LZ4;
+      return 0;
+   }
+
+   if (!strcasecmp(str, "zstd"))
+   {
+      *compression = TUNNEL_COMPRESSION_ZSTD;
+      return 0;
+   }
+
    return 1;
 }
 
@@ -3085,10 +3622,11 @@ extract_hba(char* str, char** type, char** database, char** user, char** address
 
 static void
 extract_limit(char* str, int server_max, char** database, char** user, int* max_size, int* initial_size, int* min_size,
-              char aliases[MAX_ALIASES][MAX_DATABASE_LENGTH], int* aliases_count)
+              int* guaranteed_size, int* priority, char aliases[MAX_ALIASES][MAX_DATABASE_LENGTH], int* aliases_count)
 {
    int offset = 0;
    int length;
+   bool complete = false;
    char* value = NULL;
    char* db_part = NULL;
 
@@ -3096,6 +3634,8 @@ extract_limit(char* str, int server_max, char** database, char** user, int* max_
    *max_size = 0;
    *initial_size = 0;
    *min_size = 0;
+   *guaranteed_size = 0;
+   *priority = 0;
    *aliases_count = 0;
    *database = NULL;
    *user = NULL;
@@ -3272,6 +3812,9 @@ extract_limit(char* str, int server_max, char** database, char** user, int* max_
    free(value);
    value = NULL;
 
+   // The remaining columns are optional
+   complete = true;
+
    // Extract initial_size (optional)
    offset = extract_value(str, offset, &value);
    if (offset != -1 && value && strcmp("", value) != 0)
@@ -3310,6 +3853,37 @@ extract_limit(char* str, int server_max, char** database, char** user, int* max_
       value = NULL;
    }
 
+   // Extract guaranteed_size (optional)
+   offset = extract_value(str, offset, &value);
+   if (offset != -1 && value && strcmp("", value) != 0)
+   {
+      if (!strcasecmp("all", value))
+      {
+         *guaranteed_size = server_max;
+      }
+      else
+      {
+         if (as_int(value, guaranteed_size))
+         {
+            *guaranteed_size = 0;
+         }
+      }
+      free(value);
+      value = NULL;
+   }
+
+   // Extract priority (optional)
+   offset = extract_value(str, offset, &value);
+   if (offset != -1 && value && strcmp("", value) != 0)
+   {
+      if (as_int(value, priority))
+      {
+         *priority = 0;
+      }
+      free(value);
+      value = NULL;
+   }
+
 cleanup:
    if (value)
    {
@@ -3322,7 +3896,7 @@ cleanup:
       db_part = NULL;
    }
 
-   if (offset == -1)
+   if (!complete)
    {
       if (*database)
       {
@@ -3554,6 +4128,105 @@ extract_alias_with_space(char* str, int offset, char** db_part)
    return end;
 }
 
+static int
+extract_cluster_peers(struct main_configuration* config)
+{
+   int n = 0;
+   size_t length;
+   char* p = NULL;
+   char peer[MISC_LENGTH];
+
+   config->number_of_cluster_peers = 0;
+
+   /* The peers are host:port, separated by commas or spaces, an IPv6 host is in brackets */
+   p = &config->cluster_peers[0];
+   while (*p != '\0')
+   {
+      while (*p == ',' || *p == ' ' || *p == '\t')
+      {
+         p++;
+      }
+
+      length = strcspn(p, ", \t");
+      if (length == 0)
+      {
+         break;
+      }
+
+      if (length >= sizeof(peer))
+      {
+         pgagroal_log_fatal("pgagroal: cluster_peers entry is too long");
+         return 1;
+      }
+
+      memset(&peer[0], 0, sizeof(peer));
+      memcpy(&peer[0], p, length);
+      p += length;
+
+      if (n >= NUMBER_OF_CLUSTER_PEERS)
+      {
+         pgagroal_log_fatal("pgagroal: Too many cluster_peers (max %d)", NUMBER_OF_CLUSTER_PEERS);
+         return 1;
+      }
+
+      if (extract_host_port(&peer[0], &config->cluster[n].host[0], &config->cluster[n].port))
+      {
+         pgagroal_log_fatal("pgagroal: cluster_peers entry '%s' must be host:port", &peer[0]);
+         return 1;
+      }
+
+      n++;
+   }
+
+   config->number_of_cluster_peers = n;
+
+   return 0;
+}
+
+static int
+extract_host_port(char* entry, char* host, int* port)
+{
+   int p;
+   size_t length;
+   char* colon = NULL;
+   char* end = NULL;
+   char* start = NULL;
+
+   /* An IPv6 host is in brackets, the port is after the last colon */
+   colon = strrchr(entry, ':');
+   if (colon == NULL)
+   {
+      return 1;
+   }
+
+   errno = 0;
+   p = (int)strtol(colon + 1, &end, 10);
+   if (errno != 0 || end == colon + 1 || *end != '\0' || p <= 0 || p > 65535)
+   {
+      errno = 0;
+      return 1;
+   }
+
+   start = entry;
+   length = colon - entry;
+   if (start[0] == '[' && length > 1 && *(colon - 1) == ']')
+   {
+      start++;
+      length -= 2;
+   }
+
+   if (length == 0 || length >= MISC_LENGTH)
+   {
+      return 1;
+   }
+
+   memset(host, 0, MISC_LENGTH);
+   memcpy(host, start, length);
+   *port = p;
+
+   return 0;
+}
+
 /**
  * Utility function to copy all the settings from the source configuration
  * to the destination one. This is useful for example when a reload
@@ -3600,7 +4273,45 @@ check_restart_required(struct main_configuration* config, struct main_configurat
    {
       restart = true;
    }
-   if (restart_int("max_connections", config->max_connections, reload->max_connections))
+   if (restart_int("max_connections_reserve", config->max_connections_reserve, reload->max_connections_reserve))
+   {
+      restart = true;
+   }
+   if (reload->max_connections > config->connection_slots)
+   {
+      pgagroal_log_warn("Restart required for max_connections - Existing %d New %d (max_connections_reserve %d)",
+                        config->max_connections, reload->max_connections, config->connection_slots);
+      restart = true;
+   }
+   if (restart_int("prefork_workers", config->prefork_workers, reload->prefork_workers))
+   {
+      restart = true;
+   }
+   if (restart_int("multiplex_workers", config->multiplex_workers, reload->multiplex_workers))
+   {
+      restart = true;
+   }
+   if (restart_bool("startup_gate", config->startup_gate, reload->startup_gate))
+   {
+      restart = true;
+   }
+   if (restart_bool("notify_relay", config->notify_relay, reload->notify_relay))
+   {
+      restart = true;
+   }
+   if (restart_bool("track_session_parameters", config->track_session_parameters, reload->track_session_parameters))
+   {
+      restart = true;
+   }
+   if (restart_bool("log_async", config->log_async, reload->log_async))
+   {
+      restart = true;
+   }
+   if (restart_int("query_cache_max_size", config->query_cache_max_size, reload->query_cache_max_size))
+   {
+      restart = true;
+   }
+   if (restart_int("acceptors", config->acceptors, reload->acceptors))
    {
       restart = true;
    }
@@ -3612,18 +4323,78 @@ check_restart_required(struct main_configuration* config, struct main_configurat
    {
       restart = true;
    }
+   if (restart_bool("io_uring_batch", config->io_uring_batch, reload->io_uring_batch))
+   {
+      restart = true;
+   }
+   if (restart_bool("io_uring_sqpoll", config->io_uring_sqpoll, reload->io_uring_sqpoll))
+   {
+      restart = true;
+   }
+   if (restart_int("io_uring_sqpoll_cpu", config->io_uring_sqpoll_cpu, reload->io_uring_sqpoll_cpu))
+   {
+      restart = true;
+   }
+   if (restart_int("io_uring_zero_copy", config->io_uring_zero_copy, reload->io_uring_zero_copy))
+   {
+      restart = true;
+   }
+   if (restart_bool("ev_edge_triggered", config->ev_edge_triggered, reload->ev_edge_triggered))
+   {
+      restart = true;
+   }
+   if (restart_bool("coalesce_writes", config->coalesce_writes, reload->coalesce_writes))
+   {
+      restart = true;
+   }
    if (restart_int("hugepage", config->common.hugepage, reload->common.hugepage))
    {
       restart = true;
    }
+   if (restart_int("numa_node", config->numa_node, reload->numa_node))
+   {
+      restart = true;
+   }
    if (restart_string("unix_socket_dir", config->unix_socket_dir, reload->unix_socket_dir, false))
    {
       restart = true;
    }
+   if (restart_string("cluster_peers", config->cluster_peers, reload->cluster_peers, false))
+   {
+      restart = true;
+   }
+   if (restart_string("cluster_user", config->cluster_user, reload->cluster_user, false))
+   {
+      restart = true;
+   }
+   if (restart_string("tunnel", config->tunnel, reload->tunnel, false))
+   {
+      restart = true;
+   }
+   if (restart_int("tunnel_links", config->tunnel_links, reload->tunnel_links))
+   {
+      restart = true;
+   }
+   if (restart_int("tunnel_compression", config->tunnel_compression, reload->tunnel_compression))
+   {
+      restart = true;
+   }
+   if (restart_bool("tunnel_tls", config->tunnel_tls, reload->tunnel_tls))
+   {
+      restart = true;
+   }
+   if (restart_int("tunnel_port", config->tunnel_port, reload->tunnel_port))
+   {
+      restart = true;
+   }
    if (restart_bool("tls", config->common.tls, reload->common.tls))
    {
       restart = true;
    }
+   if (restart_bool("tls_ktls", config->common.tls_ktls, reload->common.tls_ktls))
+   {
+      restart = true;
+   }
 
    if (config->number_of_servers > reload->number_of_servers)
    {
@@ -3692,7 +4463,9 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    config->common.metrics_cache_max_age = reload->common.metrics_cache_max_age;
    config->common.metrics_cache_max_size = reload->common.metrics_cache_max_size;
    config->management = reload->management;
+   memcpy(&config->management_timeout, &reload->management_timeout, sizeof(config->management_timeout));
    config->console = reload->console;
+   memcpy(&config->console_refresh, &reload->console_refresh, sizeof(config->console_refresh));
    config->update_process_title = reload->update_process_title;
 
    /* pipeline */
@@ -3724,13 +4497,16 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    config->common.log_connections = reload->common.log_connections;
    config->common.log_disconnections = reload->common.log_disconnections;
    config->authquery = reload->authquery;
+   memcpy(&config->auth_query_cache_timeout, &reload->auth_query_cache_timeout, sizeof(config->auth_query_cache_timeout));
 
    config->common.tls = reload->common.tls;
    memcpy(config->common.tls_cert_file, reload->common.tls_cert_file, MAX_PATH);
    memcpy(config->common.tls_key_file, reload->common.tls_key_file, MAX_PATH);
    memcpy(config->common.tls_ca_file, reload->common.tls_ca_file, MAX_PATH);
+   config->common.tls_ktls = reload->common.tls_ktls;
 
-   if (config->common.tls && (config->pipeline == PIPELINE_SESSION || config->pipeline == PIPELINE_TRANSACTION))
+   if (config->common.tls && (config->pipeline == PIPELINE_SESSION || config->pipeline == PIPELINE_TRANSACTION ||
+                              config->pipeline == PIPELINE_STATEMENT))
    {
       if (pgagroal_tls_valid())
       {
@@ -3739,11 +4515,21 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
       }
    }
 
-   config->max_connections = reload->max_connections;
+   if (config->max_connections != reload->max_connections)
+   {
+      pgagroal_pool_resize(reload->max_connections);
+   }
+   config->max_connections_reserve = reload->max_connections_reserve;
+   config->prefill_concurrency = reload->prefill_concurrency;
+   config->connection_rate = reload->connection_rate;
+   config->max_queue_length = reload->max_queue_length;
+   config->client_connection_rate = reload->client_connection_rate;
+   config->flush_rate = reload->flush_rate;
    config->allow_unknown_users = reload->allow_unknown_users;
    memcpy(&config->blocking_timeout, &reload->blocking_timeout, sizeof(config->blocking_timeout));
    config->connection_retry_delay = reload->connection_retry_delay;
    memcpy(&config->idle_timeout, &reload->idle_timeout, sizeof(config->idle_timeout));
+   memcpy(&config->adaptive_pool_interval, &reload->adaptive_pool_interval, sizeof(config->adaptive_pool_interval));
    memcpy(&config->rotate_frontend_password_timeout, &reload->rotate_frontend_password_timeout, sizeof(config->rotate_frontend_password_timeout));
    config->rotate_frontend_password_length = reload->rotate_frontend_password_length;
    memcpy(&config->max_connection_age, &reload->max_connection_age, sizeof(config->max_connection_age));
@@ -3760,16 +4546,54 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    memcpy(&config->health_check_period, &reload->health_check_period, sizeof(config->health_check_period));
    memcpy(&config->health_check_timeout, &reload->health_check_timeout, sizeof(config->health_check_timeout));
    memcpy(config->health_check_user, reload->health_check_user, MAX_USERNAME_LENGTH);
+   memcpy(config->replica_application_name, reload->replica_application_name, MAX_APPLICATION_NAME);
+   config->replica_max_lag = reload->replica_max_lag;
+   config->replica_balance = reload->replica_balance;
 
    config->startup_validation = reload->startup_validation;
    memcpy(config->pidfile, reload->pidfile, MAX_PATH);
    config->ev_backend = reload->ev_backend;
+   config->io_uring_batch = reload->io_uring_batch;
+   config->io_uring_sqpoll = reload->io_uring_sqpoll;
+   config->io_uring_sqpoll_cpu = reload->io_uring_sqpoll_cpu;
+   config->io_uring_zero_copy = reload->io_uring_zero_copy;
+   config->ev_edge_triggered = reload->ev_edge_triggered;
+   config->coalesce_writes = reload->coalesce_writes;
+   config->metrics_accounting = reload->metrics_accounting;
+   config->performance_splice = reload->performance_splice;
    config->keep_alive = reload->keep_alive;
    config->nodelay = reload->nodelay;
+   memcpy(&config->tcp_user_timeout, &reload->tcp_user_timeout, sizeof(config->tcp_user_timeout));
+   memcpy(&config->tcp_keepalive_idle, &reload->tcp_keepalive_idle, sizeof(config->tcp_keepalive_idle));
+   memcpy(&config->tcp_keepalive_interval, &reload->tcp_keepalive_interval, sizeof(config->tcp_keepalive_interval));
+   config->tcp_keepalive_count = reload->tcp_keepalive_count;
+   memcpy(&config->write_timeout, &reload->write_timeout, sizeof(config->write_timeout));
+   memcpy(&config->dns_cache_ttl, &reload->dns_cache_ttl, sizeof(config->dns_cache_ttl));
+   memcpy(&config->connect_timeout, &reload->connect_timeout, sizeof(config->connect_timeout));
    config->backlog = reload->backlog;
+   config->prefork_workers = reload->prefork_workers;
+   config->multiplex_workers = reload->multiplex_workers;
+   config->startup_gate = reload->startup_gate;
+   config->log_async = reload->log_async;
+   config->lazy_reset = reload->lazy_reset;
+   config->transaction_stickiness = reload->transaction_stickiness;
+   config->busy_poll = reload->busy_poll;
+   memcpy(&config->idle_transaction_timeout, &reload->idle_transaction_timeout, sizeof(config->idle_transaction_timeout));
+   config->idle_transaction_action = reload->idle_transaction_action;
+   config->notify_relay = reload->notify_relay;
+   config->query_cache_max_age = reload->query_cache_max_age;
+   config->query_statistics = reload->query_statistics;
+   config->query_statistics_sample = reload->query_statistics_sample;
+   config->query_statistics_top = reload->query_statistics_top;
+   config->acceptors = reload->acceptors;
    config->common.hugepage = reload->common.hugepage;
+   config->numa_node = reload->numa_node;
    config->tracker = reload->tracker;
+   config->slow_acquire_threshold = reload->slow_acquire_threshold;
+   config->slow_transaction_threshold = reload->slow_transaction_threshold;
    config->track_prepared_statements = reload->track_prepared_statements;
+   config->track_session_parameters = reload->track_session_parameters;
+   memcpy(&config->cluster_lease, &reload->cluster_lease, sizeof(config->cluster_lease));
    memcpy(config->unix_socket_dir, reload->unix_socket_dir, MISC_LENGTH);
 
    /* Servers */
@@ -3793,13 +4617,28 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    }
    config->number_of_hbas = reload->number_of_hbas;
 
-   /* Limits */
-   memset(&config->limits[0], 0, sizeof(struct limit) * NUMBER_OF_LIMITS);
-   for (int i = 0; i < reload->number_of_limits; i++)
+   /* Limits, the entries and their counters are kept when nothing changed */
+   if (is_same_limits(config, reload))
    {
-      copy_limit(&config->limits[i], &reload->limits[i]);
+      pgagroal_log_debug("Limits unchanged (%d entries)", config->number_of_limits);
+   }
+   else
+   {
+      memset(&config->limits[0], 0, sizeof(struct limit) * NUMBER_OF_LIMITS);
+      for (int i = 0; i < reload->number_of_limits; i++)
+      {
+         copy_limit(&config->limits[i], &reload->limits[i]);
+      }
+      config->number_of_limits = reload->number_of_limits;
+      atomic_fetch_add(&config->limits_generation, 1);
+
+      /* The demand belongs to the previous limit entries */
+      memset(&config->limit_demands[0], 0, sizeof(config->limit_demands));
+      pgagroal_cluster_reset();
    }
-   config->number_of_limits = reload->number_of_limits;
+
+   /* The compiled HBA entries reference the HBA and limit entries above */
+   memcpy(&config->hba_matcher, &reload->hba_matcher, sizeof(struct hba_matcher));
 
    /* Users */
    memset(&config->users[0], 0, sizeof(struct user) * NUMBER_OF_USERS);
@@ -3829,6 +4668,11 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    memset(&config->superuser, 0, sizeof(struct user));
    copy_user(&config->superuser, &reload->superuser);
 
+   memcpy(&config->users_hash[0], &reload->users_hash[0], FILE_HASH_LENGTH);
+   memcpy(&config->frontend_users_hash[0], &reload->frontend_users_hash[0], FILE_HASH_LENGTH);
+   memcpy(&config->admins_hash[0], &reload->admins_hash[0], FILE_HASH_LENGTH);
+   memcpy(&config->superuser_hash[0], &reload->superuser_hash[0], FILE_HASH_LENGTH);
+
 #ifdef HAVE_SYSTEMD
    sd_notify(0, "READY=1");
 #endif
@@ -3981,6 +4825,8 @@ copy_limit(struct limit* dst, struct limit* src)
    dst->max_size = src->max_size;
    dst->initial_size = src->initial_size;
    dst->min_size = src->min_size;
+   dst->guaranteed_size = src->guaranteed_size;
+   dst->priority = src->priority;
    dst->lineno = src->lineno;
 }
 
@@ -3990,6 +4836,10 @@ copy_server(struct server* dst, struct server* src)
    atomic_schar state;
    atomic_schar health_state;
    atomic_schar auth_type;
+   long long lag;
+   int rtt;
+   int backends;
+   long long connect_tat;
    unsigned int failures;
    int version;
    int minor_version;
@@ -4001,6 +4851,8 @@ copy_server(struct server* dst, struct server* src)
       state = atomic_load(&dst->state);
       health_state = atomic_load(&dst->health_state);
       auth_type = atomic_load(&dst->auth_type);
+      lag = atomic_load(&dst->lag);
+      rtt = atomic_load(&dst->rtt);
       failures = dst->failures;
       version = dst->version;
       minor_version = dst->minor_version;
@@ -4011,20 +4863,29 @@ copy_server(struct server* dst, struct server* src)
       state = SERVER_NOTINIT;
       health_state = SERVER_HEALTH_UNKNOWN;
       auth_type = HEALTH_CHECK_AUTH_UNKNOWN;
+      lag = -1;
+      rtt = -1;
       failures = 0;
       version = 0;
       minor_version = 0;
       memset(system_identifier, 0, sizeof(system_identifier));
    }
 
+   /* The backends of the slot stay connected whatever the server is now,
+    * and so does the pace they were created at */
+   backends = atomic_load(&dst->backends);
+   connect_tat = atomic_load(&dst->connect_tat);
+
    memset(dst, 0, sizeof(struct server));
    memcpy(&dst->name[0], &src->name[0], MISC_LENGTH);
    memcpy(&dst->host[0], &src->host[0], MISC_LENGTH);
    dst->port = src->port;
+   dst->max_connections = src->max_connections;
    dst->version = version;
    dst->minor_version = minor_version;
    memcpy(&dst->system_identifier[0], system_identifier, sizeof(dst->system_identifier));
    dst->tls = src->tls;
+   dst->tls_direct = src->tls_direct;
    memcpy(&dst->tls_cert_file[0], &src->tls_cert_file[0], MAX_PATH);
    memcpy(&dst->tls_key_file[0], &src->tls_key_file[0], MAX_PATH);
    memcpy(&dst->tls_ca_file[0], &src->tls_ca_file[0], MAX_PATH);
@@ -4035,6 +4896,10 @@ copy_server(struct server* dst, struct server* src)
    atomic_init(&dst->health_state, health_state);
    dst->failures = failures;
    atomic_init(&dst->auth_type, auth_type);
+   atomic_init(&dst->lag, lag);
+   atomic_init(&dst->rtt, rtt);
+   atomic_init(&dst->backends, backends);
+   atomic_init(&dst->connect_tat, connect_tat);
    dst->lineno = src->lineno;
 }
 
@@ -4048,31 +4913,198 @@ copy_hba(struct hba* dst, struct hba* src)
    memcpy(&dst->method[0], &src->method[0], MAX_ADDRESS_LENGTH);
 }
 
-static void
-copy_user(struct user* dst, struct user* src)
+static bool
+is_same_limits(struct main_configuration* config, struct main_configuration* reload)
 {
-   memcpy(&dst->username[0], &src->username[0], MAX_USERNAME_LENGTH);
-   memcpy(&dst->password[0], &src->password[0], MAX_PASSWORD_LENGTH);
-}
+   if (config->number_of_limits != reload->number_of_limits)
+   {
+      return false;
+   }
 
-static int
-restart_int(char* name, int e, int n)
-{
-   if (e != n)
+   for (int i = 0; i < reload->number_of_limits; i++)
    {
-      pgagroal_log_warn("Restart required for %s - Existing %d New %d", name, e, n);
-      return 1;
+      struct limit* e = &config->limits[i];
+      struct limit* n = &reload->limits[i];
+
+      if (strncmp(e->database, n->database, MAX_DATABASE_LENGTH) ||
+          strncmp(e->username, n->username, MAX_USERNAME_LENGTH) ||
+          e->aliases_count != n->aliases_count ||
+          e->max_size != n->max_size ||
+          e->initial_size != n->initial_size ||
+          e->min_size != n->min_size ||
+          e->guaranteed_size != n->guaranteed_size ||
+          e->priority != n->priority ||
+          e->lineno != n->lineno)
+      {
+         return false;
+      }
+
+      for (int j = 0; j < n->aliases_count && j < MAX_ALIASES; j++)
+      {
+         if (strncmp(e->aliases[j], n->aliases[j], MAX_DATABASE_LENGTH))
+         {
+            return false;
+         }
+      }
    }
 
-   return 0;
+   return true;
 }
 
 /**
- * Utility function prints a line in the log when a restart is required.
- * @return 0 when parameter values are same, 1 when a restart required.
+ * Carry the SCRAM-SHA-256 verifier over to the reloaded users whose
+ * password is the same, so only new and changed users are derived again
  */
-static int __attribute__((unused))
-restart_bool(char* name, bool e, bool n)
+static void
+reuse_verifiers(struct user* users, int number_of_users, struct user* existing, int number_of_existing)
+{
+   struct art* index = NULL;
+
+   if (number_of_users == 0 || number_of_existing == 0 || pgagroal_art_create(&index))
+   {
+      return;
+   }
+
+   for (int i = 0; i < number_of_existing; i++)
+   {
+      if (existing[i].verifier && strlen(existing[i].username) > 0)
+      {
+         pgagroal_art_insert(index, existing[i].username, (uintptr_t)(i + 1), ValueInt32);
+      }
+   }
+
+   for (int i = 0; i < number_of_users; i++)
+   {
+      int e;
+
+      if (strlen(users[i].username) == 0)
+      {
+         continue;
+      }
+
+      e = (int)pgagroal_art_search(index, users[i].username);
+      if (e != 0 && !strncmp(existing[e - 1].password, users[i].password, MAX_PASSWORD_LENGTH))
+      {
+         users[i].verifier = true;
+         memcpy(&users[i].salt[0], &existing[e - 1].salt[0], SCRAM_SALT_LENGTH);
+         memcpy(&users[i].stored_key[0], &existing[e - 1].stored_key[0], SCRAM_KEY_LENGTH);
+         memcpy(&users[i].server_key[0], &existing[e - 1].server_key[0], SCRAM_KEY_LENGTH);
+      }
+   }
+
+   pgagroal_art_destroy(index);
+}
+
+/**
+ * Hash a users file, the hash is all zero when the file can't be read
+ */
+static void
+file_hash(char* path, unsigned char* hash)
+{
+   FILE* file = NULL;
+   EVP_MD_CTX* ctx = NULL;
+   unsigned char buffer[8192];
+   unsigned int length = 0;
+   size_t n;
+
+   memset(hash, 0, FILE_HASH_LENGTH);
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   ctx = EVP_MD_CTX_new();
+   if (ctx == NULL || !EVP_DigestInit_ex(ctx, EVP_sha256(), NULL))
+   {
+      goto error;
+   }
+
+   while ((n = fread(&buffer[0], 1, sizeof(buffer), file)) > 0)
+   {
+      if (!EVP_DigestUpdate(ctx, &buffer[0], n))
+      {
+         goto error;
+      }
+   }
+
+   if (ferror(file) || !EVP_DigestFinal_ex(ctx, hash, &length))
+   {
+      memset(hash, 0, FILE_HASH_LENGTH);
+      goto error;
+   }
+
+   EVP_MD_CTX_free(ctx);
+   fclose(file);
+
+   return;
+
+error:
+
+   EVP_MD_CTX_free(ctx);
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+}
+
+/**
+ * Is the content of a users file the one that was read
+ */
+static bool
+is_same_file(char* path, unsigned char* hash)
+{
+   unsigned char current[FILE_HASH_LENGTH];
+   unsigned char none[FILE_HASH_LENGTH];
+
+   memset(&none[0], 0, FILE_HASH_LENGTH);
+   if (!memcmp(hash, &none[0], FILE_HASH_LENGTH))
+   {
+      return false;
+   }
+
+   file_hash(path, &current[0]);
+
+   if (memcmp(hash, &current[0], FILE_HASH_LENGTH))
+   {
+      return false;
+   }
+
+   pgagroal_log_debug("Unchanged: %s", path);
+
+   return true;
+}
+
+static void
+copy_user(struct user* dst, struct user* src)
+{
+   memcpy(&dst->username[0], &src->username[0], MAX_USERNAME_LENGTH);
+   memcpy(&dst->password[0], &src->password[0], MAX_PASSWORD_LENGTH);
+   dst->verifier = src->verifier;
+   memcpy(&dst->salt[0], &src->salt[0], SCRAM_SALT_LENGTH);
+   memcpy(&dst->stored_key[0], &src->stored_key[0], SCRAM_KEY_LENGTH);
+   memcpy(&dst->server_key[0], &src->server_key[0], SCRAM_KEY_LENGTH);
+}
+
+static int
+restart_int(char* name, int e, int n)
+{
+   if (e != n)
+   {
+      pgagroal_log_warn("Restart required for %s - Existing %d New %d", name, e, n);
+      return 1;
+   }
+
+   return 0;
+}
+
+/**
+ * Utility function prints a line in the log when a restart is required.
+ * @return 0 when parameter values are same, 1 when a restart required.
+ */
+static int __attribute__((unused))
+restart_bool(char* name, bool e, bool n)
 {
    if (e != n)
    {
@@ -4238,6 +5270,8 @@ reset_health_check_state(struct main_configuration* config)
       config->servers[i].failures = 0;
       atomic_store(&config->servers[i].health_state, SERVER_HEALTH_UNKNOWN);
       atomic_store(&config->servers[i].auth_type, HEALTH_CHECK_AUTH_UNKNOWN);
+      atomic_store(&config->servers[i].lag, -1);
+      atomic_store(&config->servers[i].rtt, -1);
    }
 }
 
@@ -4780,10 +5814,18 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_int(buffer, config->management);
       }
+      else if (!strncmp(key, "management_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->management_timeout, FORMAT_TIME_S));
+      }
       else if (!strncmp(key, "console", MISC_LENGTH))
       {
          return to_int(buffer, config->console);
       }
+      else if (!strncmp(key, "console_refresh", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->console_refresh, FORMAT_TIME_S));
+      }
       else if (!strncmp(key, "pipeline", MISC_LENGTH))
       {
          return to_pipeline(buffer, config->pipeline);
@@ -4808,6 +5850,18 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_string(buffer, config->health_check_user, buffer_size);
       }
+      else if (!strncmp(key, "replica_application_name", MISC_LENGTH))
+      {
+         return to_string(buffer, config->replica_application_name, buffer_size);
+      }
+      else if (!strncmp(key, "replica_max_lag", MISC_LENGTH))
+      {
+         return to_int(buffer, config->replica_max_lag);
+      }
+      else if (!strncmp(key, "replica_balance", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->replica_balance);
+      }
       else if (!strncmp(key, "failover_notify_script", MISC_LENGTH))
       {
          return to_string(buffer, config->failover_notify_script, buffer_size);
@@ -4816,10 +5870,18 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_bool(buffer, config->common.tls);
       }
+      else if (!strncmp(key, "tls_ktls", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->common.tls_ktls);
+      }
       else if (!strncmp(key, "auth_query", MISC_LENGTH))
       {
          return to_bool(buffer, config->authquery);
       }
+      else if (!strncmp(key, "auth_query_cache_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->auth_query_cache_timeout, FORMAT_TIME_S));
+      }
       else if (!strncmp(key, "tls_ca_file", MAX_PATH))
       {
          return to_string(buffer, config->common.tls_ca_file, buffer_size);
@@ -4856,6 +5918,10 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_int(buffer, (int)pgagroal_time_convert(config->idle_timeout, FORMAT_TIME_S));
       }
+      else if (!strncmp(key, "adaptive_pool_interval", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->adaptive_pool_interval, FORMAT_TIME_S));
+      }
       else if (!strncmp(key, "rotate_frontend_password_timeout", MISC_LENGTH))
       {
          return to_int(buffer, (int)pgagroal_time_convert(config->rotate_frontend_password_timeout, FORMAT_TIME_S));
@@ -4904,6 +5970,38 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_string(buffer, config->pidfile, buffer_size);
       }
+      else if (!strncmp(key, "cluster_peers", MISC_LENGTH))
+      {
+         return to_string(buffer, config->cluster_peers, buffer_size);
+      }
+      else if (!strncmp(key, "cluster_user", MISC_LENGTH))
+      {
+         return to_string(buffer, config->cluster_user, buffer_size);
+      }
+      else if (!strncmp(key, "cluster_lease", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->cluster_lease, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "tunnel", MISC_LENGTH))
+      {
+         return to_string(buffer, config->tunnel, buffer_size);
+      }
+      else if (!strncmp(key, "tunnel_links", MISC_LENGTH))
+      {
+         return to_int(buffer, config->tunnel_links);
+      }
+      else if (!strncmp(key, "tunnel_compression", MISC_LENGTH))
+      {
+         return to_tunnel_compression(buffer, config->tunnel_compression);
+      }
+      else if (!strncmp(key, "tunnel_tls", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->tunnel_tls);
+      }
+      else if (!strncmp(key, "tunnel_port", MISC_LENGTH))
+      {
+         return to_int(buffer, config->tunnel_port);
+      }
       else if (!strncmp(key, "allow_unknown_users", MISC_LENGTH))
       {
          return to_bool(buffer, config->allow_unknown_users);
@@ -4912,6 +6010,30 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_int(buffer, config->max_connections);
       }
+      else if (!strncmp(key, "max_connections_reserve", MISC_LENGTH))
+      {
+         return to_int(buffer, config->max_connections_reserve);
+      }
+      else if (!strncmp(key, "prefill_concurrency", MISC_LENGTH))
+      {
+         return to_int(buffer, config->prefill_concurrency);
+      }
+      else if (!strncmp(key, "connection_rate", MISC_LENGTH))
+      {
+         return to_int(buffer, config->connection_rate);
+      }
+      else if (!strncmp(key, "max_queue_length", MISC_LENGTH))
+      {
+         return to_int(buffer, config->max_queue_length);
+      }
+      else if (!strncmp(key, "client_connection_rate", MISC_LENGTH))
+      {
+         return to_int(buffer, config->client_connection_rate);
+      }
+      else if (!strncmp(key, "flush_rate", MISC_LENGTH))
+      {
+         return to_int(buffer, config->flush_rate);
+      }
       else if (!strncmp(key, "unix_socket_dir", MISC_LENGTH))
       {
          return to_string(buffer, config->unix_socket_dir, buffer_size);
@@ -4920,22 +6042,162 @@ pgagroal_write_config_value(char* buffer, char* config_key, size_t buffer_size)
       {
          return to_bool(buffer, config->keep_alive);
       }
+      else if (!strncmp(key, "coalesce_writes", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->coalesce_writes);
+      }
+      else if (!strncmp(key, "metrics_accounting", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->metrics_accounting);
+      }
+      else if (!strncmp(key, "ev_edge_triggered", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->ev_edge_triggered);
+      }
+      else if (!strncmp(key, "performance_splice", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->performance_splice);
+      }
+      else if (!strncmp(key, "io_uring_zero_copy", MISC_LENGTH))
+      {
+         return to_int(buffer, config->io_uring_zero_copy);
+      }
+      else if (!strncmp(key, "io_uring_batch", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->io_uring_batch);
+      }
+      else if (!strncmp(key, "io_uring_sqpoll", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->io_uring_sqpoll);
+      }
+      else if (!strncmp(key, "io_uring_sqpoll_cpu", MISC_LENGTH))
+      {
+         return to_int(buffer, config->io_uring_sqpoll_cpu);
+      }
       else if (!strncmp(key, "nodelay", MISC_LENGTH))
       {
          return to_int(buffer, config->nodelay);
       }
+      else if (!strncmp(key, "tcp_user_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->tcp_user_timeout, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "write_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->write_timeout, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "dns_cache_ttl", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->dns_cache_ttl, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "connect_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->connect_timeout, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "tcp_keepalive_idle", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->tcp_keepalive_idle, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "tcp_keepalive_interval", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->tcp_keepalive_interval, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "tcp_keepalive_count", MISC_LENGTH))
+      {
+         return to_int(buffer, config->tcp_keepalive_count);
+      }
       else if (!strncmp(key, "backlog", MISC_LENGTH))
       {
          return to_int(buffer, config->backlog);
       }
+      else if (!strncmp(key, "prefork_workers", MISC_LENGTH))
+      {
+         return to_int(buffer, config->prefork_workers);
+      }
+      else if (!strncmp(key, "multiplex_workers", MISC_LENGTH))
+      {
+         return to_int(buffer, config->multiplex_workers);
+      }
+      else if (!strncmp(key, "startup_gate", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->startup_gate);
+      }
+      else if (!strncmp(key, "log_async", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->log_async);
+      }
+      else if (!strncmp(key, "lazy_reset", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->lazy_reset);
+      }
+      else if (!strncmp(key, "transaction_stickiness", MISC_LENGTH))
+      {
+         return to_int(buffer, config->transaction_stickiness);
+      }
+      else if (!strncmp(key, "busy_poll", MISC_LENGTH))
+      {
+         return to_int(buffer, config->busy_poll);
+      }
+      else if (!strncmp(key, "idle_transaction_timeout", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->idle_transaction_timeout, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "idle_transaction_action", MISC_LENGTH))
+      {
+         return to_idle_transaction_action(buffer, config->idle_transaction_action);
+      }
+      else if (!strncmp(key, "notify_relay", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->notify_relay);
+      }
+      else if (!strncmp(key, "query_cache_max_size", MISC_LENGTH))
+      {
+         return to_int(buffer, config->query_cache_max_size);
+      }
+      else if (!strncmp(key, "query_cache_max_age", MISC_LENGTH))
+      {
+         return to_int(buffer, (int)pgagroal_time_convert(config->query_cache_max_age, FORMAT_TIME_S));
+      }
+      else if (!strncmp(key, "query_statistics", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->query_statistics);
+      }
+      else if (!strncmp(key, "query_statistics_sample", MISC_LENGTH))
+      {
+         return to_int(buffer, config->query_statistics_sample);
+      }
+      else if (!strncmp(key, "query_statistics_top", MISC_LENGTH))
+      {
+         return to_int(buffer, config->query_statistics_top);
+      }
+      else if (!strncmp(key, "acceptors", MISC_LENGTH))
+      {
+         return to_int(buffer, config->acceptors);
+      }
       else if (!strncmp(key, "hugepage", MISC_LENGTH))
       {
          return to_hugepage(buffer, config->common.hugepage);
       }
+      else if (!strncmp(key, "numa_node", MISC_LENGTH))
+      {
+         return to_int(buffer, config->numa_node);
+      }
       else if (!strncmp(key, "track_prepared_statements", MISC_LENGTH))
       {
          return to_bool(buffer, config->track_prepared_statements);
       }
+      else if (!strncmp(key, "track_session_parameters", MISC_LENGTH))
+      {
+         return to_bool(buffer, config->track_session_parameters);
+      }
+      else if (!strncmp(key, "slow_acquire_threshold", MISC_LENGTH))
+      {
+         return to_int(buffer, config->slow_acquire_threshold);
+      }
+      else if (!strncmp(key, "slow_transaction_threshold", MISC_LENGTH))
+      {
+         return to_int(buffer, config->slow_transaction_threshold);
+      }
       else
       {
          goto error;
@@ -4994,6 +6256,10 @@ pgagroal_write_server_config_value(char* buffer, char* server_name, char* config
    {
       return to_int(buffer, config->servers[server_index].port);
    }
+   else if (!strncmp(config_key, "max_connections", MISC_LENGTH))
+   {
+      return to_int(buffer, config->servers[server_index].max_connections);
+   }
    else if (!strncmp(config_key, "primary", MISC_LENGTH))
    {
       state = atomic_load(&config->servers[server_index].state);
@@ -5014,6 +6280,10 @@ pgagroal_write_server_config_value(char* buffer, char* server_name, char* config
    {
       return to_bool(buffer, config->servers[server_index].tls);
    }
+   else if (!strncmp(config_key, "tls_direct", MISC_LENGTH))
+   {
+      return to_bool(buffer, config->servers[server_index].tls_direct);
+   }
    else if (!strncmp(config_key, "tls_cert_file", MAX_PATH))
    {
       return to_string(buffer, config->servers[server_index].tls_cert_file, buffer_size);
@@ -5156,6 +6426,14 @@ pgagroal_write_limit_config_value(char* buffer, char* database, char* config_key
    {
       return to_int(buffer, config->limits[limit_index].initial_size);
    }
+   else if (!strncmp(config_key, "guaranteed_size", MISC_LENGTH))
+   {
+      return to_int(buffer, config->limits[limit_index].guaranteed_size);
+   }
+   else if (!strncmp(config_key, "priority", MISC_LENGTH))
+   {
+      return to_int(buffer, config->limits[limit_index].priority);
+   }
    else
    {
       goto error;
@@ -5364,6 +6642,38 @@ to_validation(char* where, int value)
    return 0;
 }
 
+/**
+ * An utility function to convert the enumeration of values for the idle_transaction_action setting
+ * into one of its possible string descriptions.
+ *
+ * @param where the buffer used to store the stringy thing
+ * @param value the config->idle_transaction_action setting
+ * @return 0 on success, 1 otherwise
+ */
+static int
+to_idle_transaction_action(char* where, int value)
+{
+   if (!where || value < 0)
+   {
+      return 1;
+   }
+
+   switch (value)
+   {
+      case IDLE_TRANSACTION_WARN:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "warn");
+         break;
+      case IDLE_TRANSACTION_CANCEL:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "cancel");
+         break;
+      case IDLE_TRANSACTION_ROLLBACK:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "rollback");
+         break;
+   }
+
+   return 0;
+}
+
 /**
  * An utility function to convert the enumeration of values for the startup_validation setting
  * into one of its possible string descriptions.
@@ -5455,6 +6765,9 @@ to_pipeline(char* where, int value)
       case PIPELINE_TRANSACTION:
          pgagroal_snprintf(where, MISC_LENGTH, "%s", "transaction");
          break;
+      case PIPELINE_STATEMENT:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "statement");
+         break;
       case PIPELINE_PERFORMANCE:
          pgagroal_snprintf(where, MISC_LENGTH, "%s", "performance");
          break;
@@ -5464,15 +6777,15 @@ to_pipeline(char* where, int value)
 }
 
 /**
- * An utility function to convert the enumeration of values for the log_level setting
+ * An utility function to convert the enumeration of values for the tunnel_compression setting
  * into one of its possible string descriptions.
  *
  * @param where the buffer used to store the stringy thing
- * @param value the config->common.log_level setting
+ * @param value the config->tunnel_compression setting
  * @return 0 on success, 1 otherwise
  */
 static int
-to_log_level(char* where, int value)
+to_tunnel_compression(char* where, int value)
 {
    if (!where || value < 0)
    {
@@ -5481,11 +6794,43 @@ to_log_level(char* where, int value)
 
    switch (value)
    {
-      case PGAGROAL_LOGGING_LEVEL_DEBUG2:
-         pgagroal_snprintf(where, MISC_LENGTH, "%s", "debug2");
+      case TUNNEL_COMPRESSION_NONE:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "off");
          break;
-      case PGAGROAL_LOGGING_LEVEL_DEBUG1:
-         pgagroal_snprintf(where, MISC_LENGTH, "%s", "debug");
+      case TUNNEL_COMPRESSION_LZ4:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "lz4");
+         break;
+      case TUNNEL_COMPRESSION_ZSTD:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "zstd");
+         break;
+   }
+
+   return 0;
+}
+
+/**
+ * An utility function to convert the enumeration of values for the log_level setting
+ * into one of its possible string descriptions.
+ *
+ * @param where the buffer used to store the stringy thing
+ * @param value the config->common.log_level setting
+ * @return 0 on success, 1 otherwise
+ */
+static int
+to_log_level(char* where, int value)
+{
+   if (!where || value < 0)
+   {
+      return 1;
+   }
+
+   switch (value)
+   {
+      case PGAGROAL_LOGGING_LEVEL_DEBUG2:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "debug2");
+         break;
+      case PGAGROAL_LOGGING_LEVEL_DEBUG1:
+         pgagroal_snprintf(where, MISC_LENGTH, "%s", "debug");
          break;
       case PGAGROAL_LOGGING_LEVEL_INFO:
          pgagroal_snprintf(where, MISC_LENGTH, "%s", "info");
@@ -5763,6 +7108,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("management_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->management_timeout, PGAGROAL_TIME_SEC(DEFAULT_MANAGEMENT_TIMEOUT)))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("console", section, key, true, &unknown))
    {
       if (as_int(value, &config->console))
@@ -5770,6 +7122,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("console_refresh", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->console_refresh, PGAGROAL_TIME_SEC(DEFAULT_CONSOLE_REFRESH)))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("pipeline", section, key, true, &unknown))
    {
       if (as_pipeline(value, &config->pipeline))
@@ -5814,6 +7173,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("auth_query_cache_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->auth_query_cache_timeout, PGAGROAL_TIME_SEC(DEFAULT_AUTH_QUERY_CACHE_TIMEOUT)))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("tls", section, key, true, NULL))
    {
       if (as_bool(value, &config->common.tls))
@@ -5828,6 +7194,20 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("tls_direct", section, key, false, &unknown))
+   {
+      if (as_bool(value, &srv->tls_direct))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tls_ktls", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->common.tls_ktls))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("tls_ca_file", section, key, true, NULL))
    {
       memset(config->common.tls_ca_file, 0, MAX_PATH);
@@ -5925,6 +7305,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("adaptive_pool_interval", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->adaptive_pool_interval, PGAGROAL_TIME_SEC(DEFAULT_ADAPTIVE_POOL_INTERVAL)))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("rotate_frontend_password_timeout", section, key, true, &unknown))
    {
       if (as_seconds(value, &config->rotate_frontend_password_timeout, PGAGROAL_TIME_SEC(DEFAULT_ROTATE_FRONTEND_PASSWORD_TIMEOUT)))
@@ -6005,6 +7392,30 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
       memset(config->health_check_user, 0, MAX_USERNAME_LENGTH);
       memcpy(config->health_check_user, value, max);
    }
+   else if (key_in_section("replica_application_name", section, key, true, &unknown))
+   {
+      max = strlen(value);
+      if (max > MAX_APPLICATION_NAME - 1)
+      {
+         max = MAX_APPLICATION_NAME - 1;
+      }
+      memset(config->replica_application_name, 0, MAX_APPLICATION_NAME);
+      memcpy(config->replica_application_name, value, max);
+   }
+   else if (key_in_section("replica_max_lag", section, key, true, &unknown))
+   {
+      if (as_bytes(value, &config->replica_max_lag, DEFAULT_REPLICA_MAX_LAG))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("replica_balance", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->replica_balance))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("startup_validation", section, key, true, &unknown))
    {
       if (as_startup_validation(value, &config->startup_validation))
@@ -6043,6 +7454,71 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
       }
       memcpy(config->pidfile, value, max);
    }
+   else if (key_in_section("cluster_peers", section, key, true, &unknown))
+   {
+      memset(config->cluster_peers, 0, MAX_PATH);
+      max = strlen(value);
+      if (max > MAX_PATH - 1)
+      {
+         max = MAX_PATH - 1;
+      }
+      memcpy(config->cluster_peers, value, max);
+   }
+   else if (key_in_section("cluster_user", section, key, true, &unknown))
+   {
+      memset(config->cluster_user, 0, MAX_USERNAME_LENGTH);
+      max = strlen(value);
+      if (max > MAX_USERNAME_LENGTH - 1)
+      {
+         max = MAX_USERNAME_LENGTH - 1;
+      }
+      memcpy(config->cluster_user, value, max);
+   }
+   else if (key_in_section("cluster_lease", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->cluster_lease, PGAGROAL_TIME_SEC(DEFAULT_CLUSTER_LEASE)))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tunnel", section, key, true, &unknown))
+   {
+      memset(config->tunnel, 0, MISC_LENGTH);
+      max = strlen(value);
+      if (max > MISC_LENGTH - 1)
+      {
+         max = MISC_LENGTH - 1;
+      }
+      memcpy(config->tunnel, value, max);
+   }
+   else if (key_in_section("tunnel_links", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->tunnel_links))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tunnel_compression", section, key, true, &unknown))
+   {
+      if (as_tunnel_compression(value, &config->tunnel_compression))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tunnel_tls", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->tunnel_tls))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tunnel_port", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->tunnel_port))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("allow_unknown_users", section, key, true, &unknown))
    {
       if (as_bool(value, &config->allow_unknown_users))
@@ -6117,13 +7593,78 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
-   else if (key_in_section("max_connections", section, key, true, &unknown))
+   else if (key_in_section("max_connections", section, key, true, NULL))
    {
       if (as_int(value, &config->max_connections))
       {
          unknown = true;
       }
    }
+   else if (key_in_section("max_connections_reserve", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->max_connections_reserve))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("max_connections", section, key, false, &unknown))
+   {
+      if (as_int(value, &srv->max_connections))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("prefill_concurrency", section, key, true, &unknown))
+   {
+      int concurrency = DEFAULT_PREFILL_CONCURRENCY;
+
+      if (as_int(value, &concurrency))
+      {
+         unknown = true;
+      }
+      else
+      {
+         if (concurrency < 1)
+         {
+            pgagroal_log_warn("pgagroal: prefill_concurrency %d below minimum 1; clamping", concurrency);
+            concurrency = 1;
+         }
+         else if (concurrency > MAX_PREFILL_CONCURRENCY)
+         {
+            pgagroal_log_warn("pgagroal: prefill_concurrency %d above maximum %d; clamping", concurrency, MAX_PREFILL_CONCURRENCY);
+            concurrency = MAX_PREFILL_CONCURRENCY;
+         }
+         config->prefill_concurrency = concurrency;
+      }
+   }
+   else if (key_in_section("connection_rate", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->connection_rate))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("max_queue_length", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->max_queue_length))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("client_connection_rate", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->client_connection_rate))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("flush_rate", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->flush_rate))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("unix_socket_dir", section, key, true, &unknown))
    {
       memset(config->unix_socket_dir, 0, MISC_LENGTH);
@@ -6138,6 +7679,62 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
    {
       config->ev_backend = to_backend_type(value);
    }
+   else if (key_in_section("io_uring_batch", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->io_uring_batch))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("io_uring_sqpoll", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->io_uring_sqpoll))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("io_uring_sqpoll_cpu", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->io_uring_sqpoll_cpu))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("io_uring_zero_copy", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->io_uring_zero_copy))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("ev_edge_triggered", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->ev_edge_triggered))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("coalesce_writes", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->coalesce_writes))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("metrics_accounting", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->metrics_accounting))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("performance_splice", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->performance_splice))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("keep_alive", section, key, true, &unknown))
    {
       if (as_bool(value, &config->keep_alive))
@@ -6152,6 +7749,55 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("tcp_user_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->tcp_user_timeout, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("write_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->write_timeout, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("dns_cache_ttl", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->dns_cache_ttl, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("connect_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->connect_timeout, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tcp_keepalive_idle", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->tcp_keepalive_idle, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tcp_keepalive_interval", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->tcp_keepalive_interval, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("tcp_keepalive_count", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->tcp_keepalive_count))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("backlog", section, key, true, &unknown))
    {
       if (as_int(value, &config->backlog))
@@ -6159,6 +7805,118 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("prefork_workers", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->prefork_workers))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("multiplex_workers", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->multiplex_workers))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("startup_gate", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->startup_gate))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("log_async", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->log_async))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("lazy_reset", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->lazy_reset))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("transaction_stickiness", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->transaction_stickiness))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("busy_poll", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->busy_poll))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("idle_transaction_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->idle_transaction_timeout, PGAGROAL_TIME_DISABLED))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("idle_transaction_action", section, key, true, &unknown))
+   {
+      if (as_idle_transaction_action(value, &config->idle_transaction_action))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("notify_relay", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->notify_relay))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("query_cache_max_size", section, key, true, &unknown))
+   {
+      if (as_bytes(value, &config->query_cache_max_size, 0))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("query_cache_max_age", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->query_cache_max_age, PGAGROAL_TIME_SEC(DEFAULT_QUERY_CACHE_MAX_AGE)))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("query_statistics", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->query_statistics))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("query_statistics_sample", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->query_statistics_sample))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("query_statistics_top", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->query_statistics_top))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("acceptors", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->acceptors))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("hugepage", section, key, true, &unknown))
    {
       if (as_hugepage(value, &config->common.hugepage))
@@ -6166,6 +7924,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("numa_node", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->numa_node))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("tracker", section, key, true, &unknown))
    {
       if (as_bool(value, &config->tracker))
@@ -6173,6 +7938,20 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("slow_acquire_threshold", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->slow_acquire_threshold))
+      {
+         unknown = true;
+      }
+   }
+   else if (key_in_section("slow_transaction_threshold", section, key, true, &unknown))
+   {
+      if (as_int(value, &config->slow_transaction_threshold))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("track_prepared_statements", section, key, true, &unknown))
    {
       if (as_bool(value, &config->track_prepared_statements))
@@ -6180,6 +7959,13 @@ pgagroal_apply_main_configuration(struct main_configuration* config,
          unknown = true;
       }
    }
+   else if (key_in_section("track_session_parameters", section, key, true, &unknown))
+   {
+      if (as_bool(value, &config->track_session_parameters))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("update_process_title", section, key, true, &unknown))
    {
       if (as_update_process_title(value, &config->update_process_title, UPDATE_PROCESS_TITLE_VERBOSE))
@@ -6262,6 +8048,13 @@ pgagroal_apply_vault_configuration(struct vault_configuration* config,
    {
       config->ev_backend = to_backend_type(value);
    }
+   else if (key_in_section("password_cache_timeout", section, key, true, &unknown))
+   {
+      if (as_seconds(value, &config->password_cache_timeout, PGAGROAL_TIME_SEC(0)))
+      {
+         unknown = true;
+      }
+   }
    else if (key_in_section("user", section, key, false, &unknown))
    {
       memset(&srv->user.username, 0, MISC_LENGTH);
@@ -6567,6 +8360,12 @@ pgagroal_apply_configuration(char* config_key, char* config_value,
       goto error;
    }
 
+   if (pgagroal_hba_compile(temp_config))
+   {
+      pgagroal_log_error("HBA compilation failed for %s = %s", config_key, config_value);
+      goto error;
+   }
+
    /* transfer_configuration internally calls check_restart_required and
     * returns true if a restart is needed (no changes applied in that case).
     * When restart is not required, it applies all changes to the running config.
@@ -6701,6 +8500,14 @@ pgagroal_apply_limit_configuration_string(struct limit* limit,
    {
       return as_int(value, &limit->initial_size);
    }
+   else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_GUARANTEED_SIZE, MISC_LENGTH))
+   {
+      return as_int(value, &limit->guaranteed_size);
+   }
+   else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_PRIORITY, MISC_LENGTH))
+   {
+      return as_int(value, &limit->priority);
+   }
    else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_LINENO, MISC_LENGTH))
    {
       return as_int(value, &limit->lineno);
@@ -6733,6 +8540,14 @@ pgagroal_apply_limit_configuration_int(struct limit* limit,
    {
       limit->initial_size = value;
    }
+   else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_GUARANTEED_SIZE, MISC_LENGTH))
+   {
+      limit->guaranteed_size = value;
+   }
+   else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_PRIORITY, MISC_LENGTH))
+   {
+      limit->priority = value;
+   }
    else if (!strncmp(context, PGAGROAL_LIMIT_ENTRY_LINENO, MISC_LENGTH))
    {
       limit->lineno = value;
@@ -6763,7 +8578,9 @@ add_configuration_response(struct json* res)
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE, config->common.metrics_cache_max_age, FORMAT_TIME_S);
    pgagroal_json_put_size_value(res, CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_SIZE, config->common.metrics_cache_max_size);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MANAGEMENT, (uintptr_t)config->management, ValueInt64);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_MANAGEMENT_TIMEOUT, config->management_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CONSOLE, (uintptr_t)config->console, ValueInt64);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_CONSOLE_REFRESH, config->console_refresh, FORMAT_TIME_S);
    pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_LOG_TYPE, config->common.log_type, to_log_type);
    pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_LOG_LEVEL, config->common.log_level, to_log_level);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_LOG_PATH, (uintptr_t)config->common.log_path, ValueString);
@@ -6776,6 +8593,7 @@ add_configuration_response(struct json* res)
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT, config->blocking_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CONNECTION_RETRY_DELAY, (uintptr_t)config->connection_retry_delay, ValueInt64);
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_IDLE_TIMEOUT, config->idle_timeout, FORMAT_TIME_S);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_ADAPTIVE_POOL_INTERVAL, config->adaptive_pool_interval, FORMAT_TIME_S);
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_ROTATE_FRONTEND_PASSWORD_TIMEOUT, config->rotate_frontend_password_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_ROTATE_FRONTEND_PASSWORD_LENGTH, (uintptr_t)config->rotate_frontend_password_length, ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MAX_CONNECTION_AGE, (uintptr_t)pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S), ValueInt64);
@@ -6785,14 +8603,24 @@ add_configuration_response(struct json* res)
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_BACKGROUND_INTERVAL, (uintptr_t)pgagroal_time_convert(config->background_interval, FORMAT_TIME_S), ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MAX_RETRIES, (uintptr_t)config->max_retries, ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MAX_CONNECTIONS, (uintptr_t)config->max_connections, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MAX_CONNECTIONS_RESERVE, (uintptr_t)config->max_connections_reserve, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_PREFILL_CONCURRENCY, (uintptr_t)config->prefill_concurrency, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CONNECTION_RATE, (uintptr_t)config->connection_rate, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MAX_QUEUE_LENGTH, (uintptr_t)config->max_queue_length, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CLIENT_CONNECTION_RATE, (uintptr_t)config->client_connection_rate, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_FLUSH_RATE, (uintptr_t)config->flush_rate, ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_ALLOW_UNKNOWN_USERS, (uintptr_t)config->allow_unknown_users, ValueBool);
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_HEALTH_CHECK_PERIOD, config->health_check_period, FORMAT_TIME_S);
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_HEALTH_CHECK_TIMEOUT, config->health_check_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_HEALTH_CHECK_USER, (uintptr_t)config->health_check_user, ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_REPLICA_APPLICATION_NAME, (uintptr_t)config->replica_application_name, ValueString);
+   pgagroal_json_put_size_value(res, CONFIGURATION_ARGUMENT_REPLICA_MAX_LAG, config->replica_max_lag);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_REPLICA_BALANCE, (uintptr_t)config->replica_balance, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_HEALTH_CHECK, (uintptr_t)config->health_check, ValueBool);
    pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_AUTHENTICATION_TIMEOUT, config->common.authentication_timeout, FORMAT_TIME_S);
    pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_PIPELINE, config->pipeline, to_pipeline);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_AUTH_QUERY, (uintptr_t)config->authquery, ValueBool);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_AUTH_QUERY_CACHE_TIMEOUT, config->auth_query_cache_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_FAILOVER, (uintptr_t)config->failover, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_FAILOVER_SCRIPT, (uintptr_t)config->failover_script, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_FAILOVER_NOTIFY_SCRIPT, (uintptr_t)config->failover_notify_script, ValueString);
@@ -6800,17 +8628,61 @@ add_configuration_response(struct json* res)
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TLS_CERT_FILE, (uintptr_t)config->common.tls_cert_file, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TLS_KEY_FILE, (uintptr_t)config->common.tls_key_file, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TLS_CA_FILE, (uintptr_t)config->common.tls_ca_file, ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TLS_KTLS, (uintptr_t)config->common.tls_ktls, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_METRICS_CERT_FILE, (uintptr_t)config->common.metrics_cert_file, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_METRICS_KEY_FILE, (uintptr_t)config->common.metrics_key_file, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_METRICS_CA_FILE, (uintptr_t)config->common.metrics_ca_file, ValueString);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_EV_BACKEND, (uintptr_t)to_backend_str(config->ev_backend), ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_IO_URING_BATCH, (uintptr_t)config->io_uring_batch, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_IO_URING_SQPOLL, (uintptr_t)config->io_uring_sqpoll, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_IO_URING_SQPOLL_CPU, (uintptr_t)config->io_uring_sqpoll_cpu, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_IO_URING_ZERO_COPY, (uintptr_t)config->io_uring_zero_copy, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_EV_EDGE_TRIGGERED, (uintptr_t)config->ev_edge_triggered, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_COALESCE_WRITES, (uintptr_t)config->coalesce_writes, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_METRICS_ACCOUNTING, (uintptr_t)config->metrics_accounting, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_PERFORMANCE_SPLICE, (uintptr_t)config->performance_splice, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_KEEP_ALIVE, (uintptr_t)config->keep_alive, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_NODELAY, (uintptr_t)config->nodelay, ValueBool);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_TCP_USER_TIMEOUT, config->tcp_user_timeout, FORMAT_TIME_S);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_IDLE, config->tcp_keepalive_idle, FORMAT_TIME_S);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_INTERVAL, config->tcp_keepalive_interval, FORMAT_TIME_S);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TCP_KEEPALIVE_COUNT, (uintptr_t)config->tcp_keepalive_count, ValueInt32);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_WRITE_TIMEOUT, config->write_timeout, FORMAT_TIME_S);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_DNS_CACHE_TTL, config->dns_cache_ttl, FORMAT_TIME_S);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_CONNECT_TIMEOUT, config->connect_timeout, FORMAT_TIME_S);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_BACKLOG, (uintptr_t)config->backlog, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_PREFORK_WORKERS, (uintptr_t)config->prefork_workers, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_MULTIPLEX_WORKERS, (uintptr_t)config->multiplex_workers, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_STARTUP_GATE, (uintptr_t)config->startup_gate, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_LOG_ASYNC, (uintptr_t)config->log_async, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_LAZY_RESET, (uintptr_t)config->lazy_reset, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TRANSACTION_STICKINESS, (uintptr_t)config->transaction_stickiness, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_BUSY_POLL, (uintptr_t)config->busy_poll, ValueInt64);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_IDLE_TRANSACTION_TIMEOUT, config->idle_transaction_timeout, FORMAT_TIME_S);
+   pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_IDLE_TRANSACTION_ACTION, config->idle_transaction_action, to_idle_transaction_action);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_NOTIFY_RELAY, (uintptr_t)config->notify_relay, ValueBool);
+   pgagroal_json_put_size_value(res, CONFIGURATION_ARGUMENT_QUERY_CACHE_MAX_SIZE, config->query_cache_max_size);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_QUERY_CACHE_MAX_AGE, config->query_cache_max_age, FORMAT_TIME_S);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_QUERY_STATISTICS, (uintptr_t)config->query_statistics, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_QUERY_STATISTICS_SAMPLE, (uintptr_t)config->query_statistics_sample, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_QUERY_STATISTICS_TOP, (uintptr_t)config->query_statistics_top, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_ACCEPTORS, (uintptr_t)config->acceptors, ValueInt64);
    pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_HUGEPAGE, config->common.hugepage, to_hugepage);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_NUMA_NODE, (uintptr_t)config->numa_node, ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TRACKER, (uintptr_t)config->tracker, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_SLOW_ACQUIRE_THRESHOLD, (uintptr_t)config->slow_acquire_threshold, ValueInt64);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_SLOW_TRANSACTION_THRESHOLD, (uintptr_t)config->slow_transaction_threshold, ValueInt64);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TRACK_PREPARED_STATEMENTS, (uintptr_t)config->track_prepared_statements, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TRACK_SESSION_PARAMETERS, (uintptr_t)config->track_session_parameters, ValueBool);
    pgagroal_json_put(res, CONFIGURATION_ARGUMENT_PIDFILE, (uintptr_t)config->pidfile, ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CLUSTER_PEERS, (uintptr_t)config->cluster_peers, ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_CLUSTER_USER, (uintptr_t)config->cluster_user, ValueString);
+   pgagroal_json_put_time_value(res, CONFIGURATION_ARGUMENT_CLUSTER_LEASE, config->cluster_lease, FORMAT_TIME_S);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TUNNEL, (uintptr_t)config->tunnel, ValueString);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TUNNEL_LINKS, (uintptr_t)config->tunnel_links, ValueInt64);
+   pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_TUNNEL_COMPRESSION, config->tunnel_compression, to_tunnel_compression);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TUNNEL_TLS, (uintptr_t)config->tunnel_tls, ValueBool);
+   pgagroal_json_put(res, CONFIGURATION_ARGUMENT_TUNNEL_PORT, (uintptr_t)config->tunnel_port, ValueInt64);
    pgagroal_json_put_enum_value(res, CONFIGURATION_ARGUMENT_UPDATE_PROCESS_TITLE, config->update_process_title, to_update_process_title);
 }
 
@@ -6838,7 +8710,9 @@ add_servers_configuration_response(struct json* res)
 
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt64);
+      pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_MAX_CONNECTIONS, (uintptr_t)config->servers[i].max_connections, ValueInt64);
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS, (uintptr_t)config->servers[i].tls, ValueBool);
+      pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_DIRECT, (uintptr_t)config->servers[i].tls_direct, ValueBool);
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_CERT_FILE, (uintptr_t)config->servers[i].tls_cert_file, ValueString);
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_KEY_FILE, (uintptr_t)config->servers[i].tls_key_file, ValueString);
       pgagroal_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_CA_FILE, (uintptr_t)config->servers[i].tls_ca_file, ValueString);
@@ -6887,6 +8761,8 @@ add_limits_configuration_response(struct json* res)
       pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_MAX_SIZE, (uintptr_t)config->limits[i].max_size, ValueInt64);
       pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_INITIAL_SIZE, (uintptr_t)config->limits[i].initial_size, ValueInt64);
       pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_MIN_SIZE, (uintptr_t)config->limits[i].min_size, ValueInt64);
+      pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_GUARANTEED_SIZE, (uintptr_t)config->limits[i].guaranteed_size, ValueInt64);
+      pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_PRIORITY, (uintptr_t)config->limits[i].priority, ValueInt64);
 
       // Add aliases count
       pgagroal_json_put(limit_conf, CONFIGURATION_ARGUMENT_LIMIT_NUMBER_OF_ALIASES, (uintptr_t)config->limits[i].aliases_count, ValueInt64);
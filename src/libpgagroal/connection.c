@@ -32,6 +32,7 @@
 #include <logging.h>
 #include <memory.h>
 #include <network.h>
+#include <shmem.h>
 #include <utils.h>
 
 /* system */
@@ -53,17 +54,38 @@ static int write_complete(SSL* ssl, int socket, void* buf, size_t size);
 static int write_socket(int socket, void* buf, size_t size);
 static int write_ssl(SSL* ssl, void* buf, size_t size);
 
+static int batch_depth = 0;
+static int batch_fd = -1;
+
 int
 pgagroal_connection_get(int* client_fd)
 {
    int fd;
+   char name[MISC_LENGTH];
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
    *client_fd = -1;
 
-   if (pgagroal_connect_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &fd))
+   if (batch_depth > 0 && batch_fd != -1)
+   {
+      *client_fd = batch_fd;
+      return 0;
+   }
+
+   /* The ports were handed over, so the shared name belongs to the new main process */
+   memset(&name, 0, sizeof(name));
+   if (config->handed_over > 0)
+   {
+      pgagroal_snprintf(&name[0], sizeof(name), "%s.%d", TRANSFER_UDS, (int)config->handed_over);
+   }
+   else
+   {
+      pgagroal_snprintf(&name[0], sizeof(name), "%s", TRANSFER_UDS);
+   }
+
+   if (pgagroal_connect_unix_socket(config->unix_socket_dir, &name[0], &fd))
    {
       pgagroal_log_warn("pgagroal_management_transfer_connection: get connect: %d", fd);
       errno = 0;
@@ -72,6 +94,11 @@ pgagroal_connection_get(int* client_fd)
 
    *client_fd = fd;
 
+   if (batch_depth > 0)
+   {
+      batch_fd = fd;
+   }
+
    return 0;
 
 error:
@@ -79,6 +106,38 @@ error:
    return 1;
 }
 
+void
+pgagroal_connection_put(int client_fd)
+{
+   if (client_fd == -1 || client_fd == batch_fd)
+   {
+      return;
+   }
+
+   pgagroal_disconnect(client_fd);
+}
+
+void
+pgagroal_connection_batch_begin(void)
+{
+   batch_depth++;
+}
+
+void
+pgagroal_connection_batch_end(void)
+{
+   if (batch_depth > 0)
+   {
+      batch_depth--;
+   }
+
+   if (batch_depth == 0 && batch_fd != -1)
+   {
+      pgagroal_disconnect(batch_fd);
+      batch_fd = -1;
+   }
+}
+
 int
 pgagroal_connection_get_pid(pid_t pid, int* client_fd)
 {
@@ -161,15 +220,22 @@ error:
 
 int
 pgagroal_connection_transfer_write(int client_fd, int32_t slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   return pgagroal_connection_fd_write(client_fd, slot, config->connections[slot].fd);
+}
+
+int
+pgagroal_connection_fd_write(int client_fd, int32_t slot, int fd)
 {
    struct cmsghdr* cmptr = NULL;
    struct iovec iov[1];
    struct msghdr msg;
    char buf2[2];
    char buf4[4];
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
 
    memset(&buf4[0], 0, sizeof(buf4));
    pgagroal_write_int32(&buf4, slot);
@@ -200,7 +266,7 @@ pgagroal_connection_transfer_write(int client_fd, int32_t slot)
    msg.msg_control = cmptr;
    msg.msg_controllen = CMSG_SPACE(sizeof(int));
    msg.msg_flags = 0;
-   *(int*)CMSG_DATA(cmptr) = config->connections[slot].fd;
+   *(int*)CMSG_DATA(cmptr) = fd;
 
    if (sendmsg(client_fd, &msg, 0) != 2)
    {
@@ -428,6 +494,40 @@ error:
    return 1;
 }
 
+int
+pgagroal_connection_buffer_write(int client_fd, void* buf, size_t size)
+{
+   if (write_complete(NULL, client_fd, buf, size))
+   {
+      pgagroal_log_warn("pgagroal_connection_buffer_write: %d %s", client_fd, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgagroal_connection_buffer_read(int client_fd, void* buf, size_t size)
+{
+   if (read_complete(NULL, client_fd, buf, size))
+   {
+      pgagroal_log_warn("pgagroal_connection_buffer_read: %d %s", client_fd, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
 read_complete(SSL* ssl, int socket, void* buf, size_t size)
 {
@@ -772,7 +872,7 @@ write_ssl(SSL* ssl, void* buf, size_t size)
 /*    { */
 /*       pgagroal_log_debug("pgagroal_management_remove_fd: slot %d state %d database %s user %s socket %d pid %d connect: %d", */
 /*                          slot, atomic_load(&config->states[slot]), */
-/*                          config->connections[slot].database, config->connections[slot].username, socket, pid, fd); */
+/*                          pgagroal_connection_info(slot)->database, pgagroal_connection_info(slot)->username, socket, pid, fd); */
 /*       errno = 0; */
 /*       goto error; */
 /*    } */
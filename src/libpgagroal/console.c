@@ -28,7 +28,9 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <connection.h>
 #include <console.h>
+#include <ev.h>
 #include <logging.h>
 #include <memory.h>
 #include <network.h>
@@ -44,7 +46,11 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 /**
  * @struct console_metric
@@ -59,6 +65,7 @@ struct console_metric
    char* server;                 /**< Server name associated with this metric */
    struct console_label* labels; /**< Array of key/value labels */
    int label_count;              /**< Number of labels */
+   uint64_t version;             /**< The cache version the value last changed in */
 };
 
 struct console_label
@@ -115,6 +122,17 @@ struct console_page
    char* metric_prefix;                 /**< Metric prefix to strip */
 };
 
+/**
+ * @struct console_key
+ * A metric of the cached page, found by its name and labels
+ */
+struct console_key
+{
+   char* key;                     /**< The name and labels */
+   char* category;                /**< The category name */
+   struct console_metric* metric; /**< The metric */
+};
+
 struct prefix_count
 {
    char* prefix;
@@ -146,6 +164,10 @@ struct category_candidate
 #define PAGE_HOME    1
 #define PAGE_API     2
 #define BAD_REQUEST  3
+#define PAGE_DELTA   4
+
+#define CONSOLE_CHECK_INTERVAL 1000 /* milliseconds */
+#define CONSOLE_IDLE           60   /* seconds */
 
 static int build_categories_from_bridge(struct prometheus_bridge* bridge, struct console_page* console);
 static int record_prefix_counts(const char* metric_name, struct prefix_count** counts, int* size, int* capacity);
@@ -166,21 +188,49 @@ static int collect_simple_label_columns(struct console_category* category, char*
 static const char* find_metric_label_value(struct console_metric* metric, const char* key);
 static char* generate_metrics_table(struct console_category* category);
 static char* generate_category_tabs(struct console_page* console);
-static int resolve_page(struct message* msg);
+static int resolve_page(struct message* msg, uint64_t* version);
 static int badrequest_page(SSL* client_ssl, int client_fd);
 static int home_page(SSL* client_ssl, int client_fd);
 static int api_page(SSL* client_ssl, int client_fd);
+static int delta_page(SSL* client_ssl, int client_fd, uint64_t since);
+static int console_serve(SSL* client_ssl, int client_fd);
 static int console_init(int endpoint, const char* brand_name, const char* metric_prefix, struct console_page** result);
 static int console_refresh_metrics(int endpoint, struct console_page* console);
 static int console_refresh_status(struct console_page* console);
 static int console_generate_html(struct console_page* console, char** html, size_t* html_size);
 static int console_generate_json(struct console_page* console, char** json, size_t* json_size);
 static int console_destroy(struct console_page* console);
+static int console_generate_delta(struct console_page* console, uint64_t version, uint64_t since, bool full, char** json, size_t* json_size);
+static char* append_json_string(char* buffer, char* str);
+static int cache_refresh(void);
+static void cache_free(void);
+static int build_keys(struct console_page* console, struct console_key** keys, int* key_count);
+static void free_keys(struct console_key* keys, int key_count);
+static int compare_keys(const void* a, const void* b);
+static void accept_cb(struct io_watcher* watcher);
+static void shutdown_cb(void);
+static void refresh_cb(void);
+
+static int unix_socket = -1;
+static char socket_name[MISC_LENGTH];
+static struct console_page* cache_page = NULL;
+static char* cache_html = NULL;
+static size_t cache_html_size = 0;
+static char* cache_json = NULL;
+static size_t cache_json_size = 0;
+static struct console_key* cache_keys = NULL;
+static int cache_key_count = 0;
+static uint64_t cache_version = 0;
+static uint64_t layout_version = 0;
+static time_t request_time = 0;
 
 static int
-resolve_page(struct message* msg)
+resolve_page(struct message* msg, uint64_t* version)
 {
    char* from = NULL;
+   char* query = NULL;
+   char* param = NULL;
+   char* saveptr = NULL;
    int index;
 
    if (msg->length < 3 || strncmp((char*)msg->data, "GET", 3) != 0)
@@ -198,6 +248,13 @@ resolve_page(struct message* msg)
 
    pgagroal_write_byte(msg->data + index, '\0');
 
+   query = strchr(from, '?');
+   if (query != NULL)
+   {
+      *query = '\0';
+      query++;
+   }
+
    if (strcmp(from, "/") == 0 || strcmp(from, "/index.html") == 0)
    {
       return PAGE_HOME;
@@ -206,6 +263,22 @@ resolve_page(struct message* msg)
    {
       return PAGE_API;
    }
+   else if (strcmp(from, "/api/delta") == 0)
+   {
+      *version = 0;
+
+      param = query != NULL ? strtok_r(query, "&", &saveptr) : NULL;
+      while (param != NULL)
+      {
+         if (strncmp(param, "version=", strlen("version=")) == 0)
+         {
+            *version = strtoull(param + strlen("version="), NULL, 10);
+         }
+         param = strtok_r(NULL, "&", &saveptr);
+      }
+
+      return PAGE_DELTA;
+   }
    return PAGE_UNKNOWN;
 }
 
@@ -340,6 +413,11 @@ home_page(SSL* client_ssl, int client_fd)
    size_t html_size = 0;
    int status = 0;
 
+   if (cache_html != NULL)
+   {
+      return send_http_response(client_ssl, client_fd, "text/html; charset=utf-8", cache_html, cache_html_size, "home_page");
+   }
+
    if (console_init(0, "pgagroal", "pgagroal_", &console))
    {
       pgagroal_log_error("Failed to initialize console");
@@ -378,6 +456,11 @@ api_page(SSL* client_ssl, int client_fd)
    size_t json_size = 0;
    int status = 0;
 
+   if (cache_json != NULL)
+   {
+      return send_http_response(client_ssl, client_fd, "application/json; charset=utf-8", cache_json, cache_json_size, "api_page");
+   }
+
    if (console_init(0, "pgagroal", "pgagroal_", &console))
    {
       pgagroal_log_error("Failed to initialize console for API");
@@ -408,6 +491,60 @@ error:
    return status;
 }
 
+static int
+delta_page(SSL* client_ssl, int client_fd, uint64_t since)
+{
+   struct console_page* console = NULL;
+   char* json = NULL;
+   size_t json_size = 0;
+   bool full = true;
+   int status = 0;
+
+   if (cache_page != NULL)
+   {
+      /* A version from before the last layout change, or from an earlier console process */
+      full = since == 0 || since < layout_version || since > cache_version;
+
+      if (console_generate_delta(cache_page, cache_version, since, full, &json, &json_size))
+      {
+         pgagroal_log_error("Failed to generate delta");
+         status = 1;
+         goto error;
+      }
+   }
+   else
+   {
+      if (console_init(0, "pgagroal", "pgagroal_", &console))
+      {
+         pgagroal_log_error("Failed to initialize console for delta");
+         status = 1;
+         goto error;
+      }
+
+      if (console_generate_delta(console, 0, since, true, &json, &json_size))
+      {
+         pgagroal_log_error("Failed to generate delta");
+         status = 1;
+         goto error;
+      }
+   }
+
+   status = send_http_response(client_ssl, client_fd, "application/json; charset=utf-8", json, json_size, "delta_page");
+
+error:
+   if (status != 0)
+   {
+      badrequest_page(client_ssl, client_fd);
+   }
+   free(json);
+   if (console != NULL)
+   {
+      console_destroy(console);
+   }
+
+   return status;
+}
+
 static int
 console_refresh_metrics(int endpoint, struct console_page* console)
 {
@@ -848,6 +985,89 @@ error:
    return status;
 }
 
+static int
+console_generate_delta(struct console_page* console, uint64_t version, uint64_t since, bool full, char** json, size_t* json_size)
+{
+   char* json_buffer = NULL;
+   bool first = true;
+
+   if (console == NULL || json == NULL || json_size == NULL)
+   {
+      pgagroal_log_error("Invalid parameters for delta generation");
+      goto error;
+   }
+
+   json_buffer = pgagroal_format_and_append(json_buffer, "{\"version\":%" PRIu64 ",\"full\":%s,\"metrics\":[",
+                                            version, full ? "true" : "false");
+
+   for (int i = 0; i < console->category_count; i++)
+   {
+      struct console_category* cat = &console->categories[i];
+
+      for (int j = 0; j < cat->metric_count; j++)
+      {
+         struct console_metric* metric = &cat->metrics[j];
+
+         if (!full && metric->version <= since)
+         {
+            continue;
+         }
+
+         if (!first)
+         {
+            json_buffer = pgagroal_append(json_buffer, ",");
+         }
+         first = false;
+
+         json_buffer = pgagroal_append(json_buffer, "{\"category\":");
+         json_buffer = append_json_string(json_buffer, cat->name);
+         json_buffer = pgagroal_append(json_buffer, ",\"name\":");
+         json_buffer = append_json_string(json_buffer, metric->name);
+         json_buffer = pgagroal_append(json_buffer, ",\"labels\":{");
+
+         for (int k = 0; k < metric->label_count; k++)
+         {
+            if (k > 0)
+            {
+               json_buffer = pgagroal_append(json_buffer, ",");
+            }
+            json_buffer = append_json_string(json_buffer, metric->labels[k].key);
+            json_buffer = pgagroal_append(json_buffer, ":");
+            json_buffer = append_json_string(json_buffer, metric->labels[k].value);
+         }
+
+         json_buffer = pgagroal_format_and_append(json_buffer, "},\"value\":%.2f}", metric->value);
+      }
+   }
+
+   json_buffer = pgagroal_append(json_buffer, "]}");
+
+   *json = json_buffer;
+   *json_size = strlen(json_buffer);
+
+   return 0;
+
+error:
+   free(json_buffer);
+   return 1;
+}
+
+static char*
+append_json_string(char* buffer, char* str)
+{
+   char* escaped = NULL;
+
+   escaped = pgagroal_escape_string(str != NULL ? str : "");
+
+   buffer = pgagroal_append_char(buffer, '"');
+   buffer = pgagroal_append(buffer, escaped);
+   buffer = pgagroal_append_char(buffer, '"');
+
+   free(escaped);
+
+   return buffer;
+}
+
 static int
 console_destroy(struct console_page* console)
 {
@@ -1302,9 +1522,9 @@ create_metric_from_prometheus_attrs(struct prometheus_metric* prom_metric, const
    if (attrs->values != NULL && pgagroal_deque_size(attrs->values) > 0)
    {
       value_data = (struct prometheus_value*)pgagroal_deque_peek_last(attrs->values, NULL);
-      if (value_data != NULL && value_data->value != NULL)
+      if (value_data != NULL)
       {
-         metric->value = atof(value_data->value);
+         metric->value = value_data->value;
       }
    }
 
@@ -1319,7 +1539,6 @@ create_metric_from_prometheus_attrs(struct prometheus_metric* prom_metric, const
 static int
 extract_labels_from_prometheus_attrs(struct prometheus_attributes* attrs, struct console_metric* metric)
 {
-   struct deque_iterator* attr_iter = NULL;
    int label_idx = 0;
 
    if (attrs == NULL || metric == NULL)
@@ -1327,12 +1546,12 @@ extract_labels_from_prometheus_attrs(struct prometheus_attributes* attrs, struct
       goto error;
    }
 
-   if (attrs->attributes == NULL || pgagroal_deque_size(attrs->attributes) == 0)
+   if (attrs->attributes == NULL || attrs->number_of_attributes == 0)
    {
       return 0;
    }
 
-   metric->label_count = pgagroal_deque_size(attrs->attributes);
+   metric->label_count = attrs->number_of_attributes;
    metric->labels = (struct console_label*)malloc(metric->label_count * sizeof(struct console_label));
    if (metric->labels == NULL)
    {
@@ -1342,19 +1561,11 @@ extract_labels_from_prometheus_attrs(struct prometheus_attributes* attrs, struct
 
    memset(metric->labels, 0, metric->label_count * sizeof(struct console_label));
 
-   if (pgagroal_deque_iterator_create(attrs->attributes, &attr_iter))
+   for (int i = 0; i < attrs->number_of_attributes; i++)
    {
-      free(metric->labels);
-      metric->labels = NULL;
-      metric->label_count = 0;
-      goto error;
-   }
+      struct prometheus_attribute* attr = &attrs->attributes[i];
 
-   while (pgagroal_deque_iterator_next(attr_iter) && label_idx < metric->label_count)
-   {
-      struct prometheus_attribute* attr = (struct prometheus_attribute*)attr_iter->value->data;
-
-      if (attr == NULL || attr->key == NULL || attr->value == NULL)
+      if (attr->key == NULL || attr->value == NULL)
       {
          continue;
       }
@@ -1381,15 +1592,10 @@ extract_labels_from_prometheus_attrs(struct prometheus_attributes* attrs, struct
       }
    }
 
-   pgagroal_deque_iterator_destroy(attr_iter);
    metric->label_count = label_idx;
 
    return 0;
 error:
-   if (attr_iter != NULL)
-   {
-      pgagroal_deque_iterator_destroy(attr_iter);
-   }
    return 1;
 }
 
@@ -2084,14 +2290,138 @@ generate_category_tabs(struct console_page* console)
 void
 pgagroal_console(SSL* client_ssl, int client_fd)
 {
-   struct main_configuration* config = (struct main_configuration*)shmem;
-   struct message* msg = NULL;
-   int page;
    int status = MESSAGE_STATUS_OK;
 
    pgagroal_start_logging();
    pgagroal_memory_init();
 
+   status = console_serve(client_ssl, client_fd);
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   if (status == MESSAGE_STATUS_OK)
+   {
+      exit(0);
+   }
+
+   exit(1);
+}
+
+void
+pgagroal_console_cache(char** argv)
+{
+   struct event_loop* loop = NULL;
+   struct io_watcher io_mgt;
+   struct signal_info signal_watcher;
+   struct periodic_watcher refresh_watcher;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_set_proc_title(1, argv, "console", NULL);
+
+   memset(&socket_name, 0, sizeof(socket_name));
+   pgagroal_snprintf(&socket_name[0], sizeof(socket_name), "%s.%d", MAIN_UDS, (int)getpid());
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &socket_name[0], &unix_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s", config->unix_socket_dir, &socket_name[0]);
+      exit(1);
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal_console: Failed to create loop");
+      exit(1);
+   }
+
+   memset(&io_mgt, 0, sizeof(struct io_watcher));
+   pgagroal_event_accept_init(&io_mgt, unix_socket, accept_cb);
+   pgagroal_io_start(&io_mgt);
+
+   pgagroal_signal_init(&signal_watcher.sig_w, shutdown_cb, SIGQUIT);
+   signal_watcher.slot = -1;
+   pgagroal_signal_start(&signal_watcher.sig_w);
+
+   pgagroal_periodic_init(&refresh_watcher, refresh_cb, CONSOLE_CHECK_INTERVAL, CONSOLE_CHECK_INTERVAL);
+   pgagroal_periodic_start(&refresh_watcher);
+
+   /* The versions of a restarted process are above the ones handed out before */
+   cache_version = (uint64_t)time(NULL);
+   layout_version = cache_version;
+
+   pgagroal_log_debug("pgagroal_console: Started (PID %d)", (int)getpid());
+
+   pgagroal_event_loop_run();
+
+   cache_free();
+
+   pgagroal_periodic_stop(&refresh_watcher);
+   pgagroal_io_stop(&io_mgt);
+   pgagroal_disconnect(unix_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &socket_name[0]);
+   errno = 0;
+
+   pgagroal_event_loop_destroy();
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+}
+
+int
+pgagroal_console_hand_off(int client_fd)
+{
+   int fd = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->console_pid <= 0)
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_get_pid(config->console_pid, &fd))
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_CONSOLE) ||
+       pgagroal_connection_fd_write(fd, -1, client_fd))
+   {
+      goto error;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+static int
+console_serve(SSL* client_ssl, int client_fd)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+   struct message* msg = NULL;
+   uint64_t since = 0;
+   int page;
+   int status = MESSAGE_STATUS_OK;
+
    if (client_ssl)
    {
       char buffer[TLS_PROBE_SIZE] = {0};
@@ -2116,7 +2446,7 @@ pgagroal_console(SSL* client_ssl, int client_fd)
       goto error;
    }
 
-   page = resolve_page(msg);
+   page = resolve_page(msg, &since);
 
    if (page == PAGE_HOME)
    {
@@ -2126,6 +2456,10 @@ pgagroal_console(SSL* client_ssl, int client_fd)
    {
       status = api_page(client_ssl, client_fd);
    }
+   else if (page == PAGE_DELTA)
+   {
+      status = delta_page(client_ssl, client_fd, since);
+   }
    else
    {
       status = badrequest_page(client_ssl, client_fd);
@@ -2135,13 +2469,331 @@ error:
    pgagroal_close_ssl(client_ssl);
    pgagroal_disconnect(client_fd);
 
-   pgagroal_memory_destroy();
-   pgagroal_stop_logging();
+   return status;
+}
 
-   if (status == MESSAGE_STATUS_OK)
+static int
+cache_refresh(void)
+{
+   struct console_page* console = NULL;
+   struct console_key* keys = NULL;
+   struct console_key* old = NULL;
+   int key_count = 0;
+   char* html = NULL;
+   size_t html_size = 0;
+   char* json = NULL;
+   size_t json_size = 0;
+   uint64_t next;
+   bool changed = false;
+   bool layout = false;
+
+   if (console_init(0, "pgagroal", "pgagroal_", &console))
    {
-      exit(0);
+      goto error;
    }
 
-   exit(1);
+   if (build_keys(console, &keys, &key_count))
+   {
+      goto error;
+   }
+
+   next = cache_version + 1;
+   layout = cache_page == NULL || key_count != cache_key_count;
+
+   /* A metric keeps its version until its value changes */
+   for (int i = 0; i < key_count; i++)
+   {
+      old = NULL;
+      if (cache_keys != NULL)
+      {
+         old = (struct console_key*)bsearch(&keys[i], cache_keys, cache_key_count, sizeof(struct console_key), compare_keys);
+      }
+
+      if (old == NULL)
+      {
+         layout = true;
+         changed = true;
+         keys[i].metric->version = next;
+      }
+      else if (old->metric->value < keys[i].metric->value || old->metric->value > keys[i].metric->value)
+      {
+         changed = true;
+         keys[i].metric->version = next;
+      }
+      else
+      {
+         keys[i].metric->version = old->metric->version;
+      }
+   }
+
+   if (console_generate_html(console, &html, &html_size))
+   {
+      goto error;
+   }
+
+   if (console_generate_json(console, &json, &json_size))
+   {
+      goto error;
+   }
+
+   cache_free();
+
+   if (changed || layout)
+   {
+      cache_version = next;
+   }
+
+   if (layout)
+   {
+      layout_version = next;
+   }
+
+   cache_page = console;
+   cache_keys = keys;
+   cache_key_count = key_count;
+   cache_html = html;
+   cache_html_size = html_size;
+   cache_json = json;
+   cache_json_size = json_size;
+
+   pgagroal_log_debug("pgagroal_console: Version %" PRIu64 " (%d metrics)", cache_version, key_count);
+
+   return 0;
+
+error:
+
+   free(html);
+   free(json);
+   free_keys(keys, key_count);
+   if (console != NULL)
+   {
+      console_destroy(console);
+   }
+
+   return 1;
+}
+
+static void
+cache_free(void)
+{
+   free(cache_html);
+   cache_html = NULL;
+   cache_html_size = 0;
+
+   free(cache_json);
+   cache_json = NULL;
+   cache_json_size = 0;
+
+   free_keys(cache_keys, cache_key_count);
+   cache_keys = NULL;
+   cache_key_count = 0;
+
+   if (cache_page != NULL)
+   {
+      console_destroy(cache_page);
+      cache_page = NULL;
+   }
+}
+
+static int
+build_keys(struct console_page* console, struct console_key** keys, int* key_count)
+{
+   struct console_key* k = NULL;
+   int count = 0;
+   int index = 0;
+
+   *keys = NULL;
+   *key_count = 0;
+
+   for (int i = 0; i < console->category_count; i++)
+   {
+      count += console->categories[i].metric_count;
+   }
+
+   if (count == 0)
+   {
+      return 0;
+   }
+
+   k = (struct console_key*)calloc(count, sizeof(struct console_key));
+   if (k == NULL)
+   {
+      pgagroal_log_error("Failed to allocate console keys");
+      goto error;
+   }
+
+   for (int i = 0; i < console->category_count; i++)
+   {
+      struct console_category* cat = &console->categories[i];
+
+      for (int j = 0; j < cat->metric_count; j++)
+      {
+         struct console_metric* metric = &cat->metrics[j];
+         char* key = NULL;
+
+         key = pgagroal_append(key, metric->name);
+         key = pgagroal_append_char(key, '{');
+         for (int l = 0; l < metric->label_count; l++)
+         {
+            key = pgagroal_format_and_append(key, "%s%s=%s", l > 0 ? "," : "",
+                                             metric->labels[l].key, metric->labels[l].value);
+         }
+         key = pgagroal_append_char(key, '}');
+
+         if (key == NULL)
+         {
+            goto error;
+         }
+
+         k[index].key = key;
+         k[index].category = cat->name;
+         k[index].metric = metric;
+         index++;
+      }
+   }
+
+   qsort(k, count, sizeof(struct console_key), compare_keys);
+
+   *keys = k;
+   *key_count = count;
+
+   return 0;
+
+error:
+
+   free_keys(k, index);
+
+   return 1;
+}
+
+static void
+free_keys(struct console_key* keys, int key_count)
+{
+   if (keys != NULL)
+   {
+      for (int i = 0; i < key_count; i++)
+      {
+         free(keys[i].key);
+      }
+      free(keys);
+   }
+}
+
+static int
+compare_keys(const void* a, const void* b)
+{
+   return strcmp(((struct console_key*)a)->key, ((struct console_key*)b)->key);
+}
+
+static void
+accept_cb(struct io_watcher* watcher)
+{
+   int client_fd = -1;
+   int id = -1;
+   int32_t slot = -1;
+   int fd = -1;
+   pid_t pid;
+   time_t now;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      errno = 0;
+      return;
+   }
+
+   if (pgagroal_connection_id_read(client_fd, &id))
+   {
+      pgagroal_log_error("pgagroal_console: Management client: ID: %d", id);
+      goto done;
+   }
+
+   if (id == CONNECTION_CONSOLE)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal_console: Hand-off: FD %d", fd);
+         goto done;
+      }
+
+      now = time(NULL);
+      request_time = now;
+
+      if (cache_page == NULL ||
+          difftime(now, cache_page->refresh_time) >= pgagroal_time_convert(config->console_refresh, FORMAT_TIME_S))
+      {
+         if (cache_refresh())
+         {
+            pgagroal_log_warn("pgagroal_console: Could not refresh the page");
+         }
+      }
+
+      /* The request is read and written by a child, so a slow client doesn't hold up the others */
+      pid = fork();
+      if (pid == -1)
+      {
+         pgagroal_log_error("pgagroal_console: Cannot create process");
+      }
+      else if (pid == 0)
+      {
+         int status;
+
+         pgagroal_event_loop_fork();
+         pgagroal_disconnect(client_fd);
+         pgagroal_disconnect(unix_socket);
+
+         status = console_serve(NULL, fd);
+
+         pgagroal_memory_destroy();
+         pgagroal_stop_logging();
+
+         exit(status == MESSAGE_STATUS_OK ? 0 : 1);
+      }
+
+      pgagroal_disconnect(fd);
+   }
+   else
+   {
+      pgagroal_log_debug("pgagroal_console: Unsupported management id: %d", id);
+   }
+
+done:
+
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+shutdown_cb(void)
+{
+   pgagroal_event_loop_break();
+}
+
+static void
+refresh_cb(void)
+{
+   time_t now;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   while (waitpid(-1, NULL, WNOHANG) > 0)
+   {
+      /* Reap the request processes */
+   }
+
+   now = time(NULL);
+
+   /* Keep the page current while it is watched */
+   if (cache_page != NULL && request_time > 0 && difftime(now, request_time) < CONSOLE_IDLE &&
+       difftime(now, cache_page->refresh_time) >= pgagroal_time_convert(config->console_refresh, FORMAT_TIME_S))
+   {
+      if (cache_refresh())
+      {
+         pgagroal_log_warn("pgagroal_console: Could not refresh the page");
+      }
+   }
 }
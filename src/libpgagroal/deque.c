@@ -35,17 +35,40 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define DEQUE_BLOCK_MIN 8
+#define DEQUE_BLOCK_MAX 256
+
+/**
+ * A block of nodes. The nodes of a deque are carved from its blocks in
+ * order, so a deque that is appended to and iterated walks adjacent memory
+ */
+struct deque_block
+{
+   struct deque_block* next;  /**< The previous block */
+   uint32_t capacity;         /**< The number of nodes */
+   uint32_t used;             /**< The number of nodes handed out */
+   struct deque_node nodes[]; /**< The nodes */
+};
+
 // tag is copied if not NULL
 static void
 deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type, struct value_config* config);
 
 // tag is copied if not NULL
 static void
-deque_node_create(uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node);
+deque_node_create(struct deque* deque, uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node);
 
 // tag will always be freed
 static void
-deque_node_destroy(struct deque_node* node);
+deque_node_destroy(struct deque* deque, struct deque_node* node);
+
+// take a node from the released ones or the blocks
+static struct deque_node*
+deque_node_allocate(struct deque* deque);
+
+// the node is kept for the next allocation
+static void
+deque_node_release(struct deque* deque, struct deque_node* node);
 
 static void
 deque_read_lock(struct deque* deque);
@@ -93,12 +116,14 @@ pgagroal_deque_create(bool thread_safe, struct deque** deque)
    q = malloc(sizeof(struct deque));
    q->size = 0;
    q->thread_safe = thread_safe;
+   q->blocks = NULL;
+   q->free = NULL;
    if (thread_safe)
    {
       pthread_rwlock_init(&q->mutex, NULL);
    }
-   deque_node_create(0, ValueInt32, NULL, NULL, &q->start);
-   deque_node_create(0, ValueInt32, NULL, NULL, &q->end);
+   deque_node_create(q, 0, ValueInt32, NULL, NULL, &q->start);
+   deque_node_create(q, 0, ValueInt32, NULL, NULL, &q->end);
    q->start->next = q->end;
    q->end->prev = q->start;
    *deque = q;
@@ -185,10 +210,9 @@ pgagroal_deque_poll(struct deque* deque, char** tag)
    {
       *tag = head->tag;
    }
-   free(head);
+   deque_node_release(deque, head);
 
-   data = pgagroal_value_data(val);
-   free(val);
+   data = pgagroal_value_release(val);
 
    deque_unlock(deque);
    return data;
@@ -221,10 +245,9 @@ pgagroal_deque_poll_last(struct deque* deque, char** tag)
    {
       *tag = tail->tag;
    }
-   free(tail);
+   deque_node_release(deque, tail);
 
-   data = pgagroal_value_data(val);
-   free(val);
+   data = pgagroal_value_release(val);
 
    deque_unlock(deque);
    return data;
@@ -377,6 +400,8 @@ pgagroal_deque_destroy(struct deque* deque)
 {
    struct deque_node* n = NULL;
    struct deque_node* next = NULL;
+   struct deque_block* b = NULL;
+   struct deque_block* nb = NULL;
    if (deque == NULL)
    {
       return;
@@ -385,9 +410,16 @@ pgagroal_deque_destroy(struct deque* deque)
    while (n != NULL)
    {
       next = n->next;
-      deque_node_destroy(n);
+      deque_node_destroy(deque, n);
       n = next;
    }
+   b = deque->blocks;
+   while (b != NULL)
+   {
+      nb = b->next;
+      free(b);
+      b = nb;
+   }
    if (deque->thread_safe)
    {
       pthread_rwlock_destroy(&deque->mutex);
@@ -512,8 +544,8 @@ deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type
       return;
    }
 
-   deque_node_create(data, type, tag, config, &n);
    deque_write_lock(deque);
+   deque_node_create(deque, data, type, tag, config, &n);
    deque->size++;
    last = deque->end->prev;
    last->next = n;
@@ -524,10 +556,10 @@ deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type
 }
 
 static void
-deque_node_create(uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node)
+deque_node_create(struct deque* deque, uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node)
 {
    struct deque_node* n = NULL;
-   n = malloc(sizeof(struct deque_node));
+   n = deque_node_allocate(deque);
    memset(n, 0, sizeof(struct deque_node));
    if (config != NULL)
    {
@@ -549,7 +581,7 @@ deque_node_create(uintptr_t data, enum value_type type, char* tag, struct value_
 }
 
 static void
-deque_node_destroy(struct deque_node* node)
+deque_node_destroy(struct deque* deque, struct deque_node* node)
 {
    if (node == NULL)
    {
@@ -557,7 +589,51 @@ deque_node_destroy(struct deque_node* node)
    }
    pgagroal_value_destroy(node->data);
    free(node->tag);
-   free(node);
+   deque_node_release(deque, node);
+}
+
+static struct deque_node*
+deque_node_allocate(struct deque* deque)
+{
+   struct deque_node* n = NULL;
+   struct deque_block* b = NULL;
+   uint32_t capacity = DEQUE_BLOCK_MIN;
+
+   if (deque->free != NULL)
+   {
+      n = deque->free;
+      deque->free = n->next;
+      return n;
+   }
+
+   b = deque->blocks;
+   if (b == NULL || b->used == b->capacity)
+   {
+      // the blocks double, so a small deque stays small
+      if (b != NULL)
+      {
+         capacity = MIN(b->capacity * 2, DEQUE_BLOCK_MAX);
+      }
+
+      b = malloc(sizeof(struct deque_block) + capacity * sizeof(struct deque_node));
+      if (b == NULL)
+      {
+         return NULL;
+      }
+      b->next = deque->blocks;
+      b->capacity = capacity;
+      b->used = 0;
+      deque->blocks = b;
+   }
+
+   return &b->nodes[b->used++];
+}
+
+static void
+deque_node_release(struct deque* deque, struct deque_node* node)
+{
+   node->next = deque->free;
+   deque->free = node;
 }
 
 static void
@@ -758,7 +834,7 @@ deque_remove(struct deque* deque, struct deque_node* node)
    struct deque_node* next = node->next;
    prev->next = next;
    next->prev = prev;
-   deque_node_destroy(node);
+   deque_node_destroy(deque, node);
    deque->size--;
    return prev;
 }
@@ -33,7 +33,9 @@
 #include <memory.h>
 #include <network.h>
 #include <pgagroal.h>
+#include <prometheus.h>
 #include <shmem.h>
+#include <utils.h>
 
 /* system */
 #include <assert.h>
@@ -86,9 +88,14 @@ static int ev_io_uring_destroy(void);
 static int ev_io_uring_loop(void);
 static int ev_io_uring_fork(void);
 static int ev_io_uring_handler(struct io_uring_cqe*);
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
 static int ev_io_uring_setup_buffers(void);
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
+static void ev_io_uring_recycle_buffer(int bid);
+static void ev_io_uring_flush_sends(void);
+static int ev_io_uring_lent_buffer(void* data, ssize_t length);
+static inline uint64_t ev_io_uring_send_data(int bid, int index);
+static void ev_io_uring_release_buffer(int bid);
+static int ev_io_uring_send_cqe(struct io_uring_cqe** cqe, bool wait);
+static void ev_io_uring_reap_notifications(void);
 
 static int ev_io_uring_io_start(struct io_watcher*);
 static int ev_io_uring_io_stop(struct io_watcher*);
@@ -111,7 +118,9 @@ static int ev_epoll_io_handler(struct io_watcher*);
 static int ev_epoll_periodic_init(struct periodic_watcher*, int64_t, int64_t);
 static int ev_epoll_periodic_start(struct periodic_watcher*);
 static int ev_epoll_periodic_stop(struct periodic_watcher*);
-static int ev_epoll_periodic_handler(struct periodic_watcher*);
+static int ev_epoll_timer_handler(void);
+static int ev_epoll_timer_rearm(void);
+static int64_t ev_epoll_now(void);
 
 #else
 
@@ -137,6 +146,8 @@ static int ev_kqueue_signal_handler(struct kevent*);
 #endif /* HAVE_LINUX */
 
 static void init_watcher_message(struct io_watcher* watcher);
+static int events_add(event_watcher_t* watcher);
+static int events_remove(event_watcher_t* watcher);
 
 /* context globals */
 
@@ -149,9 +160,13 @@ static _Atomic(signal_cb) signal_callbacks[PGAGROAL_NSIG] = {0};
 #if HAVE_IO_URING
 static struct io_uring_params params; /* io_uring argument params */
 static int ring_size;                 /* io_uring sqe ring_size */
+static bool batch_sends;              /* Defer sends to the end of the loop pass */
+static bool sqpoll;                   /* Use a kernel submission queue polling thread */
+static int zero_copy;                 /* Message size from which sends are zero-copy, 0 disables */
 #endif
 
-static int epoll_flags; /* Flags for epoll instance creation */
+static int epoll_flags;     /* Flags for epoll instance creation */
+static bool edge_triggered; /* Watch worker sockets with EPOLLET */
 
 #else
 
@@ -278,6 +293,16 @@ pgagroal_event_loop_init(void)
       return NULL;
    }
 
+   loop->events = calloc(MAX_EVENTS, sizeof(event_watcher_t*));
+   if (loop->events == NULL)
+   {
+      pgagroal_log_fatal("calloc error: %s", strerror(errno));
+      free(loop);
+      loop = NULL;
+      return NULL;
+   }
+   loop->events_size = MAX_EVENTS;
+
    loop->owner_pid = getpid();
    atomic_init(&loop->running, false);
    atomic_init(&loop->forked, false);
@@ -290,19 +315,43 @@ pgagroal_event_loop_init(void)
 #if HAVE_IO_URING
       /* io_uring context */
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
+      /* Multishot receives post many completions per submission */
       ring_size = 128;
       params.cq_entries = 1024;
-#else
-      ring_size = 64;
-      params.cq_entries = 128;
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
 
       params.flags = 0;
       params.flags |= IORING_SETUP_CQSIZE; /* needed if I'm using cq_entries above */
-      params.flags |= IORING_SETUP_DEFER_TASKRUN;
       params.flags |= IORING_SETUP_SINGLE_ISSUER;
 
+      batch_sends = false;
+      sqpoll = false;
+      zero_copy = 0;
+      if (execution_context == PGAGROAL_CONTEXT_MAIN && shmem != NULL)
+      {
+         struct main_configuration* main_config = (struct main_configuration*)shmem;
+
+         batch_sends = main_config->io_uring_batch;
+         sqpoll = main_config->io_uring_sqpoll;
+         zero_copy = main_config->io_uring_zero_copy;
+
+         if (sqpoll)
+         {
+            /* The kernel thread picks up submissions, so task work can not be deferred to us */
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = IO_URING_SQPOLL_IDLE;
+            if (main_config->io_uring_sqpoll_cpu >= 0)
+            {
+               params.flags |= IORING_SETUP_SQ_AFF;
+               params.sq_thread_cpu = main_config->io_uring_sqpoll_cpu;
+            }
+         }
+      }
+
+      if (!sqpoll)
+      {
+         params.flags |= IORING_SETUP_DEFER_TASKRUN;
+      }
+
 #if EXPERIMENTAL_FEATURE_FAST_POLL_ENABLED
       params.flags |= IORING_FEAT_FAST_POLL;
 #endif /* EXPERIMENTAL_FEATURE_FAST_POLL_ENABLED */
@@ -314,6 +363,11 @@ pgagroal_event_loop_init(void)
 
       /* epoll context */
       epoll_flags = 0;
+      edge_triggered = false;
+      if (execution_context == PGAGROAL_CONTEXT_MAIN && shmem != NULL)
+      {
+         edge_triggered = ((struct main_configuration*)shmem)->ev_edge_triggered;
+      }
 #else
       /* kqueue context */
       kqueue_flags = 0;
@@ -342,6 +396,7 @@ pgagroal_event_loop_init(void)
    return loop;
 
 error:
+   free(loop->events);
    free(loop);
    loop = NULL;
 
@@ -388,23 +443,7 @@ pgagroal_event_loop_destroy(void)
 
    rc = loop_destroy();
 
-#if HAVE_LINUX
-   for (int i = 0; i < loop->events_nr; i++)
-   {
-      event_watcher_t* w = loop->events[i];
-
-      if (w && w->type == PGAGROAL_EVENT_TYPE_PERIODIC)
-      {
-         struct periodic_watcher* p = (struct periodic_watcher*)w;
-         if (p->fd != -1)
-         {
-            pgagroal_disconnect(p->fd);
-            p->fd = -1;
-         }
-      }
-   }
-#endif
-
+   free(loop->events);
    free(loop);
    loop = NULL;
 
@@ -430,6 +469,15 @@ pgagroal_event_loop_break(void)
    atomic_store(&loop->running, false);
 }
 
+void
+pgagroal_event_loop_busy_poll(int usec)
+{
+   if (loop != NULL)
+   {
+      loop->busy_poll = usec > 0 ? usec : 0;
+   }
+}
+
 bool
 pgagroal_event_loop_is_running(void)
 {
@@ -482,16 +530,13 @@ pgagroal_io_start(struct io_watcher* watcher)
       return PGAGROAL_EVENT_RC_ERROR;
    }
 
-   if (loop->events_nr >= MAX_EVENTS)
+   if (events_add((event_watcher_t*)watcher))
    {
-      pgagroal_log_warn("pgagroal_io_start: MAX_EVENTS (%d) reached - cannot register new watcher (fd rcv=%d, snd=%d)",
-                        MAX_EVENTS, watcher->fds.worker.rcv_fd, watcher->fds.worker.snd_fd);
+      pgagroal_log_warn("pgagroal_io_start: cannot register new watcher (fd rcv=%d, snd=%d, events_nr=%d)",
+                        watcher->fds.worker.rcv_fd, watcher->fds.worker.snd_fd, loop->events_nr);
       return PGAGROAL_EVENT_RC_FATAL;
    }
 
-   loop->events[loop->events_nr] = (event_watcher_t*)watcher;
-   loop->events_nr++;
-
    return io_start(watcher);
 }
 
@@ -507,15 +552,9 @@ pgagroal_io_stop(struct io_watcher* watcher)
 
    assert(loop != NULL && watcher != NULL);
 
-   for (i = 0; i < loop->events_nr; i++)
-   {
-      if (watcher == (struct io_watcher*)loop->events[i])
-      {
-         break;
-      }
-   }
+   i = watcher->event_watcher.index;
 
-   if (i >= loop->events_nr)
+   if (i < 0 || i >= loop->events_nr || loop->events[i] != (event_watcher_t*)watcher)
    {
       pgagroal_log_warn("pgagroal_io_stop: watcher not found in events list (fd rcv=%d, snd=%d, events_nr=%d) - possible double-stop",
                         watcher->fds.worker.rcv_fd, watcher->fds.worker.snd_fd, loop->events_nr);
@@ -529,12 +568,7 @@ pgagroal_io_stop(struct io_watcher* watcher)
       return rc;
    }
 
-   for (int j = i; j < loop->events_nr - 1; j++)
-   {
-      loop->events[j] = loop->events[j + 1];
-   }
-   loop->events_nr--;
-   loop->events[loop->events_nr] = NULL;
+   events_remove((event_watcher_t*)watcher);
 
    return PGAGROAL_EVENT_RC_OK;
 }
@@ -567,16 +601,13 @@ pgagroal_periodic_start(struct periodic_watcher* watcher)
       return PGAGROAL_EVENT_RC_ERROR;
    }
 
-   if (loop->events_nr >= MAX_EVENTS)
+   if (events_add((event_watcher_t*)watcher))
    {
-      pgagroal_log_warn("pgagroal_periodic_start: MAX_EVENTS (%d) reached - cannot register periodic watcher",
-                        MAX_EVENTS);
+      pgagroal_log_warn("pgagroal_periodic_start: cannot register periodic watcher (events_nr=%d)",
+                        loop->events_nr);
       return PGAGROAL_EVENT_RC_FATAL;
    }
 
-   loop->events[loop->events_nr] = (event_watcher_t*)watcher;
-   loop->events_nr++;
-
    return periodic_start(watcher);
 }
 
@@ -592,15 +623,9 @@ pgagroal_periodic_stop(struct periodic_watcher* watcher)
 
    assert(loop != NULL && watcher != NULL);
 
-   for (i = 0; i < loop->events_nr; i++)
-   {
-      if (watcher == (struct periodic_watcher*)loop->events[i])
-      {
-         break;
-      }
-   }
+   i = watcher->event_watcher.index;
 
-   if (i >= loop->events_nr)
+   if (i < 0 || i >= loop->events_nr || loop->events[i] != (event_watcher_t*)watcher)
    {
       return PGAGROAL_EVENT_RC_ERROR;
    }
@@ -612,12 +637,7 @@ pgagroal_periodic_stop(struct periodic_watcher* watcher)
       return rc;
    }
 
-   for (int j = i; j < loop->events_nr - 1; j++)
-   {
-      loop->events[j] = loop->events[j + 1];
-   }
-   loop->events_nr--;
-   loop->events[loop->events_nr] = NULL;
+   events_remove((event_watcher_t*)watcher);
 
    return PGAGROAL_EVENT_RC_OK;
 }
@@ -633,19 +653,35 @@ pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg)
    int ret;
    int cqe_res;
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
-   int bid = loop->bid;
-   if (loop->br.cnt <= 0 || loop->br.buf == NULL || bid < 0 || bid >= loop->br.cnt)
+   ssize_t total_sent = 0;
+   ssize_t to_send = msg->length;
+   int bid = ev_io_uring_lent_buffer(msg->data, to_send);
+   bool zc = false;
+   bool more;
+
+   if (batch_sends && bid >= 0)
    {
-      pgagroal_log_fatal("invalid buffer id: %d (count=%d)", bid, loop->br.cnt);
-      return -1;
+      if (loop->sends_nr == IO_URING_BATCH_SIZE)
+      {
+         ev_io_uring_flush_sends();
+      }
+
+      loop->sends[loop->sends_nr].fd = watcher->fds.worker.snd_fd;
+      loop->sends[loop->sends_nr].bid = bid;
+      loop->sends[loop->sends_nr].data = msg->data;
+      loop->sends[loop->sends_nr].length = to_send;
+      loop->sends_nr++;
+      loop->held[bid]++;
+
+      return (int)to_send;
    }
-   void* data = loop->br.buf + bid * DEFAULT_BUFFER_SIZE;
-   msg->data = data;
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
 
-   ssize_t total_sent = 0;
-   ssize_t to_send = msg->length;
+   /* Anything queued before this send has to reach the wire first */
+   ev_io_uring_flush_sends();
+
+   /* The kernel reads a zero-copy send from our memory until the notification,
+    * which only a provided buffer can wait for without stalling the callback */
+   zc = zero_copy > 0 && to_send >= zero_copy && bid >= 0;
 
    /*
     * Use the dedicated send_ring for sends.
@@ -662,31 +698,33 @@ pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg)
          return -1;
       }
 
-#if EXPERIMENTAL_FEATURE_ZERO_COPY_ENABLED
-      /* XXX: Implement zero copy send (this has been shown to speed up a little some
-       * workloads, but the implementation is still problematic). */
-      io_uring_prep_send_zc(sqe, watcher->fds.worker.snd_fd,
+      send_flags = MSG_NOSIGNAL;
+      if (zc)
+      {
+         io_uring_prep_send_zc(sqe, watcher->fds.worker.snd_fd,
+                               (char*)msg->data + total_sent,
+                               to_send - total_sent,
+                               send_flags, 0);
+         io_uring_sqe_set_data64(sqe, ev_io_uring_send_data(bid, 0));
+         loop->held[bid]++;
+      }
+      else
+      {
+         io_uring_prep_send(sqe, watcher->fds.worker.snd_fd,
                             (char*)msg->data + total_sent,
                             to_send - total_sent,
-                            send_flags, 0);
-#else
-      send_flags |= MSG_NOSIGNAL;
-      io_uring_prep_send(sqe, watcher->fds.worker.snd_fd,
-                         (char*)msg->data + total_sent,
-                         to_send - total_sent,
-                         send_flags);
-#endif /* EXPERIMENTAL_FEATURE_ZERO_COPY_ENABLED */
-
-      io_uring_sqe_set_data(sqe, NULL);
+                            send_flags);
+         io_uring_sqe_set_data64(sqe, ev_io_uring_send_data(-1, 0));
+      }
 
-      ret = io_uring_submit(&loop->ring_snd);
+      ret = io_uring_submit_and_wait(&loop->ring_snd, 1);
       if (ret < 0)
       {
          pgagroal_log_error("io_uring send submit error: %s", strerror(-ret));
          return -1;
       }
 
-      ret = io_uring_wait_cqe(&loop->ring_snd, &cqe);
+      ret = ev_io_uring_send_cqe(&cqe, true);
       if (ret < 0)
       {
          pgagroal_log_error("io_uring send wait error: %s", strerror(-ret));
@@ -696,8 +734,15 @@ pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg)
       /* Read cqe->res before calling io_uring_cqe_seen() to prevent the
        * completion from being reused before we read the result. */
       cqe_res = cqe->res;
+      more = cqe->flags & IORING_CQE_F_MORE;
       io_uring_cqe_seen(&loop->ring_snd, cqe);
 
+      if (zc && !more)
+      {
+         /* No notification follows, the kernel is done with the buffer */
+         ev_io_uring_release_buffer(bid);
+      }
+
       if (cqe_res < 0)
       {
          pgagroal_log_debug("io_uring send error fd=%d: %s",
@@ -731,15 +776,6 @@ pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg)
       sent_bytes = (int)total_sent;
    }
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
-   io_uring_buf_ring_add(loop->br.br,
-                         data,
-                         DEFAULT_BUFFER_SIZE,
-                         bid,
-                         DEFAULT_BUFFER_SIZE,
-                         1);
-   io_uring_buf_ring_advance(loop->br.br, 1);
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
 #else
    (void)watcher;
    (void)msg;
@@ -749,6 +785,17 @@ pgagroal_event_prep_submit_send(struct io_watcher* watcher, struct message* msg)
    return sent_bytes;
 }
 
+void
+pgagroal_event_flush_sends(void)
+{
+#if HAVE_LINUX && HAVE_IO_URING
+   if (loop != NULL && batch_sends)
+   {
+      ev_io_uring_flush_sends();
+   }
+#endif /* HAVE_LINUX && HAVE_IO_URING */
+}
+
 int
 pgagroal_wait_recv(void)
 {
@@ -778,6 +825,13 @@ pgagroal_wait_recv(void)
 #if HAVE_LINUX
 #if HAVE_IO_URING
 
+/* The user data of a send: the provided buffer it holds, plus one, above its batch index */
+static inline uint64_t
+ev_io_uring_send_data(int bid, int index)
+{
+   return ((uint64_t)(bid + 1) << 32) | (uint32_t)index;
+}
+
 static inline void __attribute__((unused))
 ev_io_uring_rearm_receive(struct event_loop* loop, struct io_watcher* watcher)
 {
@@ -799,6 +853,16 @@ ev_io_uring_init(void)
 
    /* Initialize the main ring for receives */
    rc = io_uring_queue_init_params(ring_size, &loop->ring_rcv, &params);
+   if (rc && sqpoll && (rc == -EPERM || rc == -EINVAL))
+   {
+      pgagroal_log_warn("io_uring: SQPOLL not available (%s), using regular submission", strerror(-rc));
+      sqpoll = false;
+      params.flags &= ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF);
+      params.flags |= IORING_SETUP_DEFER_TASKRUN;
+      params.sq_thread_idle = 0;
+      params.sq_thread_cpu = 0;
+      rc = io_uring_queue_init_params(ring_size, &loop->ring_rcv, &params);
+   }
    if (rc)
    {
       pgagroal_log_fatal("io_uring_queue_init_params (recv ring) error: %s", strerror(-rc));
@@ -817,6 +881,13 @@ ev_io_uring_init(void)
     * When waiting for a send CQE on a shared ring, recv CQEs may arrive first,
     * causing either lost data, stack overflow (if processed), or state corruption.
     * Using a separate ring guarantees we only get send CQEs when waiting for sends. */
+   if (sqpoll)
+   {
+      /* Share the polling thread of the receive ring */
+      send_params.flags = IORING_SETUP_SQPOLL | IORING_SETUP_ATTACH_WQ;
+      send_params.sq_thread_idle = IO_URING_SQPOLL_IDLE;
+      send_params.wq_fd = loop->ring_rcv.ring_fd;
+   }
    rc = io_uring_queue_init_params(64, &loop->ring_snd, &send_params);
    if (rc)
    {
@@ -834,14 +905,18 @@ ev_io_uring_init(void)
       return rc;
    }
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
    rc = ev_io_uring_setup_buffers();
    if (rc)
    {
       pgagroal_log_fatal("ev_io_uring_setup_buffers error");
+      io_uring_queue_exit(&loop->ring_rcv);
+      io_uring_queue_exit(&loop->ring_snd);
       return rc;
    }
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
+
+   loop->sends_nr = 0;
+   loop->lent = -1;
+   memset(loop->held, 0, sizeof(loop->held));
 
    return PGAGROAL_EVENT_RC_OK;
 }
@@ -849,15 +924,18 @@ ev_io_uring_init(void)
 static int
 ev_io_uring_destroy(void)
 {
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
-   if (loop->br.buf != NULL)
+   ev_io_uring_flush_sends();
+
+   if (loop->br.br != NULL)
    {
-      free(loop->br.buf);
-      loop->br.buf = NULL;
+      io_uring_free_buf_ring(&loop->ring_rcv, loop->br.br, loop->br.cnt, IO_URING_BUFFER_GROUP);
+      loop->br.br = NULL;
    }
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
    io_uring_queue_exit(&loop->ring_rcv);
    io_uring_queue_exit(&loop->ring_snd);
+   free(loop->br.buf);
+   loop->br.buf = NULL;
+   loop->br.cnt = 0;
    return PGAGROAL_EVENT_RC_OK;
 }
 
@@ -865,7 +943,6 @@ static int
 ev_io_uring_io_start(struct io_watcher* watcher)
 {
    struct io_uring_sqe* sqe = io_uring_get_sqe(&loop->ring_rcv);
-   struct message* msg = NULL;
 
    if (unlikely(!sqe))
    {
@@ -880,16 +957,11 @@ ev_io_uring_io_start(struct io_watcher* watcher)
          io_uring_prep_multishot_accept(sqe, watcher->fds.main.listen_fd, NULL, NULL, 0);
          break;
       case PGAGROAL_EVENT_TYPE_WORKER:
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
-         io_uring_prep_recv_multishot(sqe, watcher->fds.worker.rcv_fd, NULL, 0, 0); /* msg must be NULL */
-         sqe->buf_group = 0;
+         /* The kernel picks a buffer from the loop's pool for every receive,
+          * so one submission keeps delivering until the socket closes */
+         io_uring_prep_recv_multishot(sqe, watcher->fds.worker.rcv_fd, NULL, 0, 0);
+         sqe->buf_group = IO_URING_BUFFER_GROUP;
          sqe->flags |= IOSQE_BUFFER_SELECT;
-#else
-         msg = pgagroal_get_watcher_message(watcher);
-         /* Use MESSAGE_PARSE_BUFFER_SIZE to leave headroom and prevent buffer
-          * overflow when parsing message headers near the end of received data */
-         io_uring_prep_recv(sqe, watcher->fds.worker.rcv_fd, msg->data, MESSAGE_PARSE_BUFFER_SIZE, 0);
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
          break;
       default:
          pgagroal_log_fatal("unknown event type: %d", watcher->event_watcher.type);
@@ -1056,6 +1128,18 @@ ev_io_uring_loop(void)
    {
       ts = &idle_ts;
 
+      if (loop->busy_poll > 0)
+      {
+         struct timespec spin_start;
+
+         /* A completion that comes within the spin is taken without a wakeup */
+         io_uring_submit(&loop->ring_rcv);
+         clock_gettime(CLOCK_MONOTONIC, &spin_start);
+         while (io_uring_peek_cqe(&loop->ring_rcv, &cqe) != 0 && pgagroal_time_elapsed_usec(&spin_start) < loop->busy_poll)
+         {
+         }
+      }
+
       io_uring_submit_and_wait_timeout(&loop->ring_rcv, &cqe, to_wait, ts, NULL);
 
       if (*loop->ring_rcv.cq.koverflow)
@@ -1086,6 +1170,13 @@ ev_io_uring_loop(void)
       if (events)
       {
          io_uring_cq_advance(&loop->ring_rcv, events);
+         pgagroal_prometheus_local_wakeup_add();
+      }
+
+      ev_io_uring_flush_sends();
+      if (zero_copy > 0)
+      {
+         ev_io_uring_reap_notifications();
       }
    }
 
@@ -1106,10 +1197,14 @@ ev_io_uring_handler(struct io_uring_cqe* cqe)
    struct io_watcher* io;
    struct periodic_watcher* per;
    struct message* msg = NULL;
+   void* data = NULL;
+   int bid;
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
-   loop->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
+   /* A completion that never reaches a worker callback still hands back its buffer */
+   if ((cqe->flags & IORING_CQE_F_BUFFER) && (watcher == NULL || watcher->type != PGAGROAL_EVENT_TYPE_WORKER))
+   {
+      ev_io_uring_recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+   }
 
    /* Cancelled requests will trigger the handler, but have NULL data. */
    if (!watcher)
@@ -1188,7 +1283,25 @@ ev_io_uring_handler(struct io_uring_cqe* cqe)
       case PGAGROAL_EVENT_TYPE_WORKER:
          io = (struct io_watcher*)watcher;
          msg = pgagroal_get_watcher_message(io);
-         if (cqe->res <= 0)
+         if (io->event_watcher.index < 0)
+         {
+            /* Data that raced with pgagroal_io_stop() */
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+               ev_io_uring_recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+         }
+         else if (cqe->res == -ENOBUFS)
+         {
+            /* The pool ran dry and the kernel ended the multishot receive.
+             * The data is still queued on the socket, so just rearm */
+            pgagroal_log_trace("io_uring: no provided buffer for fd=%d", io->fds.worker.rcv_fd);
+            if (pgagroal_event_loop_is_running())
+            {
+               ev_io_uring_io_start(io);
+            }
+         }
+         else if (cqe->res <= 0)
          {
             if (cqe->res == 0)
             {
@@ -1206,12 +1319,26 @@ ev_io_uring_handler(struct io_uring_cqe* cqe)
          }
          else
          {
+            /* Lend the provided buffer to the callback. Sends either complete before
+             * pgagroal_send_message() returns or hold the buffer until they are
+             * flushed, so it is only recycled once nothing refers to it */
+            bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            data = msg->data;
+            msg->data = (char*)loop->br.buf + (size_t)bid * DEFAULT_BUFFER_SIZE;
             msg->length = cqe->res;
             rc = PGAGROAL_EVENT_RC_OK;
+            loop->lent = bid;
             io->cb(io);
+            loop->lent = -1;
+            msg->data = data;
+            if (loop->held[bid] == 0)
+            {
+               ev_io_uring_recycle_buffer(bid);
+            }
 
-            /* Only rearm if loop is still running and connection is good */
-            if (pgagroal_event_loop_is_running())
+            /* Only rearm if the kernel ended the receive and the watcher is still active */
+            if (!(cqe->flags & IORING_CQE_F_MORE) && pgagroal_event_loop_is_running() &&
+                io->event_watcher.index >= 0)
             {
                ev_io_uring_io_start(io);
             }
@@ -1226,16 +1353,194 @@ ev_io_uring_handler(struct io_uring_cqe* cqe)
    return rc;
 }
 
-#if EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED
+static void
+ev_io_uring_flush_sends(void)
+{
+   struct io_uring_sqe* sqe = NULL;
+   struct io_uring_sqe* prev = NULL;
+   struct io_uring_cqe* cqe = NULL;
+   bool queued[IO_URING_BATCH_SIZE] = {0};
+   bool failed[IO_URING_BATCH_SIZE] = {0};
+   int n = 0;
+   int ret;
+
+   if (loop->sends_nr == 0)
+   {
+      return;
+   }
+
+   /* Group the sends per socket, keeping their order, and link each group
+    * so the kernel writes them one after the other */
+   for (int i = 0; i < loop->sends_nr; i++)
+   {
+      if (queued[i])
+      {
+         continue;
+      }
+
+      prev = NULL;
+      for (int j = i; j < loop->sends_nr; j++)
+      {
+         if (queued[j] || loop->sends[j].fd != loop->sends[i].fd)
+         {
+            continue;
+         }
+
+         queued[j] = true;
+
+         /* The send ring is larger than the batch and empty between flushes */
+         sqe = io_uring_get_sqe(&loop->ring_snd);
+         if (sqe == NULL)
+         {
+            pgagroal_log_error("io_uring: no SQE available for batched send");
+            failed[j] = true;
+            continue;
+         }
+
+         if (zero_copy > 0 && loop->sends[j].length >= zero_copy)
+         {
+            io_uring_prep_send_zc(sqe, loop->sends[j].fd, loop->sends[j].data,
+                                  loop->sends[j].length, MSG_NOSIGNAL | MSG_WAITALL, 0);
+            io_uring_sqe_set_data64(sqe, ev_io_uring_send_data(loop->sends[j].bid, j));
+            loop->held[loop->sends[j].bid]++;
+         }
+         else
+         {
+            io_uring_prep_send(sqe, loop->sends[j].fd, loop->sends[j].data,
+                               loop->sends[j].length, MSG_NOSIGNAL | MSG_WAITALL);
+            io_uring_sqe_set_data64(sqe, ev_io_uring_send_data(-1, j));
+         }
+         if (prev != NULL)
+         {
+            io_uring_sqe_set_flags(prev, prev->flags | IOSQE_IO_LINK);
+         }
+         prev = sqe;
+         n++;
+      }
+   }
+
+   ret = io_uring_submit_and_wait(&loop->ring_snd, n);
+   if (ret < 0)
+   {
+      pgagroal_log_error("io_uring batched send submit error: %s", strerror(-ret));
+      memset(failed, true, sizeof(failed));
+   }
+
+   for (int i = 0; i < ret; i++)
+   {
+      uint64_t data;
+      int idx;
+
+      if (ev_io_uring_send_cqe(&cqe, true))
+      {
+         break;
+      }
+      data = io_uring_cqe_get_data64(cqe);
+      idx = (int)(uint32_t)data;
+      if (idx >= 0 && idx < loop->sends_nr && cqe->res != loop->sends[idx].length)
+      {
+         failed[idx] = true;
+      }
+      if ((data >> 32) != 0 && !(cqe->flags & IORING_CQE_F_MORE))
+      {
+         ev_io_uring_release_buffer((int)(data >> 32) - 1);
+      }
+      io_uring_cqe_seen(&loop->ring_snd, cqe);
+   }
+
+   for (int i = 0; i < loop->sends_nr; i++)
+   {
+      if (failed[i])
+      {
+         /* A partial or failed write leaves the stream unusable */
+         pgagroal_log_debug("io_uring batched send failed fd=%d", loop->sends[i].fd);
+         shutdown(loop->sends[i].fd, SHUT_RDWR);
+      }
+
+      ev_io_uring_release_buffer(loop->sends[i].bid);
+   }
+
+   loop->sends_nr = 0;
+}
+
+static int
+ev_io_uring_lent_buffer(void* data, ssize_t length)
+{
+   char* lent = NULL;
+
+   if (loop->lent < 0 || length <= 0)
+   {
+      return -1;
+   }
+
+   lent = (char*)loop->br.buf + (size_t)loop->lent * DEFAULT_BUFFER_SIZE;
+   if ((char*)data >= lent && (char*)data + length <= lent + DEFAULT_BUFFER_SIZE)
+   {
+      return loop->lent;
+   }
+
+   return -1;
+}
+
+static void
+ev_io_uring_release_buffer(int bid)
+{
+   loop->held[bid]--;
+   if (loop->held[bid] == 0 && bid != loop->lent)
+   {
+      ev_io_uring_recycle_buffer(bid);
+   }
+}
+
+static int
+ev_io_uring_send_cqe(struct io_uring_cqe** cqe, bool wait)
+{
+   uint64_t data;
+   int ret;
+
+   /* Zero-copy notifications may arrive at any time, they only hand back the buffer */
+   for (;;)
+   {
+      ret = wait ? io_uring_wait_cqe(&loop->ring_snd, cqe) : io_uring_peek_cqe(&loop->ring_snd, cqe);
+      if (ret < 0)
+      {
+         return ret;
+      }
+      if (*cqe == NULL)
+      {
+         return -EAGAIN;
+      }
+
+      if (!((*cqe)->flags & IORING_CQE_F_NOTIF))
+      {
+         return 0;
+      }
+
+      data = io_uring_cqe_get_data64(*cqe);
+      io_uring_cqe_seen(&loop->ring_snd, *cqe);
+      if ((data >> 32) != 0)
+      {
+         ev_io_uring_release_buffer((int)(data >> 32) - 1);
+      }
+   }
+}
+
+static void
+ev_io_uring_reap_notifications(void)
+{
+   struct io_uring_cqe* cqe = NULL;
+
+   /* Every send result has been consumed, so only notifications are left */
+   while (ev_io_uring_send_cqe(&cqe, false) == 0)
+   {
+      io_uring_cqe_seen(&loop->ring_snd, cqe);
+   }
+}
+
 static int
 ev_io_uring_setup_buffers(void)
 {
-   int rc;
-   int br_cnt = 1;
-   int br_bgid = 0;
-   int br_mask = DEFAULT_BUFFER_SIZE;
-   int br_flags = 0;
-   int bid = 0;
+   int rc = 0;
 
 #if EXPERIMENTAL_FEATURE_USE_HUGE_ENABLED
    pgagroal_log_fatal("io_uring use_huge not implemented");
@@ -1244,39 +1549,60 @@ ev_io_uring_setup_buffers(void)
 
    loop->br.br = NULL;
    loop->br.buf = NULL;
-   loop->br.pending_send = false;
    loop->br.cnt = 0;
 
-   loop->br.br = io_uring_setup_buf_ring(&loop->ring_rcv, br_cnt, br_bgid, br_flags, &rc);
-   if (!loop->br.br)
+   if (posix_memalign(&loop->br.buf, sysconf(_SC_PAGESIZE), (size_t)IO_URING_BUFFERS * DEFAULT_BUFFER_SIZE))
    {
-      pgagroal_log_fatal("buffer ring register error %s", strerror(-rc));
+      pgagroal_log_fatal("posix_memalign error: %s", strerror(errno));
+      loop->br.buf = NULL;
       return PGAGROAL_EVENT_RC_FATAL;
    }
-   if (posix_memalign(&loop->br.buf, sysconf(_SC_PAGESIZE), 2 * DEFAULT_BUFFER_SIZE))
+
+   loop->br.br = io_uring_setup_buf_ring(&loop->ring_rcv, IO_URING_BUFFERS, IO_URING_BUFFER_GROUP, 0, &rc);
+   if (!loop->br.br)
    {
-      pgagroal_log_fatal("posix_memalign error: %s", strerror(errno));
+      pgagroal_log_fatal("buffer ring register error %s", strerror(-rc));
+      free(loop->br.buf);
+      loop->br.buf = NULL;
       return PGAGROAL_EVENT_RC_FATAL;
    }
-   io_uring_buf_ring_add(loop->br.br,
-                         loop->br.buf,
-                         DEFAULT_BUFFER_SIZE,
-                         bid++,
-                         br_mask,
-                         loop->br.cnt++);
 
-   io_uring_buf_ring_add(loop->br.br,
-                         loop->br.buf + DEFAULT_BUFFER_SIZE,
-                         DEFAULT_BUFFER_SIZE,
-                         bid,
-                         br_mask,
-                         loop->br.cnt++);
+   loop->br.cnt = IO_URING_BUFFERS;
+
+   /* Each buffer is registered with MESSAGE_PARSE_BUFFER_SIZE to leave headroom
+    * for parsing message headers near the end of the received data */
+   for (int i = 0; i < loop->br.cnt; i++)
+   {
+      io_uring_buf_ring_add(loop->br.br,
+                            (char*)loop->br.buf + (size_t)i * DEFAULT_BUFFER_SIZE,
+                            MESSAGE_PARSE_BUFFER_SIZE,
+                            i,
+                            io_uring_buf_ring_mask(loop->br.cnt),
+                            i);
+   }
 
    io_uring_buf_ring_advance(loop->br.br, loop->br.cnt);
 
    return PGAGROAL_EVENT_RC_OK;
 }
-#endif /* EXPERIMENTAL_FEATURE_RECV_MULTISHOT_ENABLED */
+
+static void
+ev_io_uring_recycle_buffer(int bid)
+{
+   if (loop->br.br == NULL || bid < 0 || bid >= loop->br.cnt)
+   {
+      pgagroal_log_error("io_uring: invalid buffer id: %d (count=%d)", bid, loop->br.cnt);
+      return;
+   }
+
+   io_uring_buf_ring_add(loop->br.br,
+                         (char*)loop->br.buf + (size_t)bid * DEFAULT_BUFFER_SIZE,
+                         MESSAGE_PARSE_BUFFER_SIZE,
+                         bid,
+                         io_uring_buf_ring_mask(loop->br.cnt),
+                         0);
+   io_uring_buf_ring_advance(loop->br.br, 1);
+}
 
 #endif /* HAVE_IO_URING */
 
@@ -1298,12 +1624,30 @@ ev_epoll_loop(void)
    pgagroal_event_loop_start();
    while (pgagroal_event_loop_is_running())
    {
+      nfds = 0;
+
+      if (loop->busy_poll > 0)
+      {
+         struct timespec spin_start;
+
+         /* An event that comes within the spin is taken without a wakeup */
+         clock_gettime(CLOCK_MONOTONIC, &spin_start);
+         do
+         {
+            nfds = epoll_pwait(loop->epollfd, events, MAX_EVENTS, 0, &loop->sigset);
+         }
+         while (nfds == 0 && pgagroal_time_elapsed_usec(&spin_start) < loop->busy_poll);
+      }
+
+      if (nfds == 0)
+      {
 #if HAVE_EPOLL_PWAIT2
-      nfds = epoll_pwait2(loop->epollfd, events, MAX_EVENTS, &timeout_ts,
-                          &loop->sigset);
+         nfds = epoll_pwait2(loop->epollfd, events, MAX_EVENTS, &timeout_ts,
+                             &loop->sigset);
 #else
-      nfds = epoll_pwait(loop->epollfd, events, MAX_EVENTS, timeout, &loop->sigset);
+         nfds = epoll_pwait(loop->epollfd, events, MAX_EVENTS, timeout, &loop->sigset);
 #endif
+      }
 
       if (nfds == -1)
       {
@@ -1317,6 +1661,11 @@ ev_epoll_loop(void)
          break;
       }
 
+      if (nfds > 0)
+      {
+         pgagroal_prometheus_local_wakeup_add();
+      }
+
       for (int i = 0; i < nfds; i++)
       {
          rc = ev_epoll_handler((void*)events[i].data.u64);
@@ -1333,19 +1682,55 @@ ev_epoll_loop(void)
 static int
 ev_epoll_init(void)
 {
+   struct epoll_event event;
+
    loop->epollfd = -1;
+   loop->timerfd = -1;
    loop->epollfd = epoll_create1(epoll_flags);
    if (loop->epollfd == -1)
    {
       pgagroal_log_fatal("epoll_init error: %s", strerror(errno));
       return PGAGROAL_EVENT_RC_FATAL;
    }
+
+   /* One timer serves every periodic watcher, armed for the earliest deadline */
+   loop->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (loop->timerfd == -1)
+   {
+      pgagroal_log_fatal("timerfd_create: %s", strerror(errno));
+      goto error;
+   }
+
+   event.events = EPOLLIN;
+   event.data.u64 = 0;
+   if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, loop->timerfd, &event) == -1)
+   {
+      pgagroal_log_fatal("epoll_ctl error: %s", strerror(errno));
+      goto error;
+   }
+
    return PGAGROAL_EVENT_RC_OK;
+
+error:
+   if (loop->timerfd != -1)
+   {
+      close(loop->timerfd);
+      loop->timerfd = -1;
+   }
+   close(loop->epollfd);
+   loop->epollfd = -1;
+   return PGAGROAL_EVENT_RC_FATAL;
 }
 
 static int
 ev_epoll_fork(void)
 {
+   if (loop->timerfd >= 0)
+   {
+      close(loop->timerfd);
+      loop->timerfd = -1;
+   }
+
    if (loop->epollfd < 0)
    {
       return PGAGROAL_EVENT_RC_OK;
@@ -1363,6 +1748,12 @@ ev_epoll_fork(void)
 static int
 ev_epoll_destroy(void)
 {
+   if (loop->timerfd >= 0)
+   {
+      close(loop->timerfd);
+      loop->timerfd = -1;
+   }
+
    if (loop->epollfd < 0)
    {
       return PGAGROAL_EVENT_RC_OK;
@@ -1380,10 +1771,9 @@ ev_epoll_destroy(void)
 static int
 ev_epoll_handler(void* watcher)
 {
-   enum event_type type = ((event_watcher_t*)watcher)->type;
-   if (type == PGAGROAL_EVENT_TYPE_PERIODIC)
+   if (watcher == NULL)
    {
-      return ev_epoll_periodic_handler((struct periodic_watcher*)watcher);
+      return ev_epoll_timer_handler();
    }
    return ev_epoll_io_handler((struct io_watcher*)watcher);
 }
@@ -1391,82 +1781,151 @@ ev_epoll_handler(void* watcher)
 static int
 ev_epoll_periodic_init(struct periodic_watcher* watcher, int64_t msec, int64_t repeat_ms)
 {
-   struct timespec now;
-   struct itimerspec new_value;
+   int64_t now = ev_epoll_now();
 
-   if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+   if (now < 0)
    {
-      pgagroal_log_error("clock_gettime: %s", strerror(errno));
       return PGAGROAL_EVENT_RC_ERROR;
    }
 
    watcher->repeat_ms = repeat_ms;
+   /* The first fire is counted from init, like an armed timer would be */
+   watcher->deadline = now + (msec > 0 ? msec : 1) * 1000000LL;
+
+   return PGAGROAL_EVENT_RC_OK;
+}
+
+static int
+ev_epoll_periodic_start(struct periodic_watcher* watcher __attribute__((unused)))
+{
+   return ev_epoll_timer_rearm();
+}
 
-   new_value.it_value.tv_sec = msec / 1000;
-   new_value.it_value.tv_nsec = (msec % 1000) * 1000000;
+static int
+ev_epoll_periodic_stop(struct periodic_watcher* watcher)
+{
+   watcher->deadline = 0;
 
-   new_value.it_interval.tv_sec = repeat_ms / 1000;
-   new_value.it_interval.tv_nsec = (repeat_ms % 1000) * 1000000;
+   return ev_epoll_timer_rearm();
+}
 
-   /* no need to set it to non-blocking due to TFD_NONBLOCK */
-   watcher->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
-   if (watcher->fd == -1)
+static int
+ev_epoll_timer_handler(void)
+{
+   uint64_t exp;
+   int64_t now;
+   struct periodic_watcher* due = NULL;
+   struct periodic_watcher* p = NULL;
+
+   if (read(loop->timerfd, &exp, sizeof(uint64_t)) == -1 && errno != EAGAIN)
    {
-      pgagroal_log_error("timerfd_create: %s", strerror(errno));
+      pgagroal_log_error("timer_handler read: %s", strerror(errno));
       return PGAGROAL_EVENT_RC_ERROR;
    }
+   errno = 0;
 
-   if (timerfd_settime(watcher->fd, 0, &new_value, NULL) == -1)
+   now = ev_epoll_now();
+
+   /* Fire the earliest due watcher one at a time, since a callback may
+    * start or stop watchers and so reorder the list of events */
+   for (;;)
    {
-      pgagroal_log_error("timerfd_settime");
-      close(watcher->fd);
-      watcher->fd = -1;
-      return PGAGROAL_EVENT_RC_ERROR;
+      due = NULL;
+      for (int i = 0; i < loop->events_nr; i++)
+      {
+         if (loop->events[i]->type != PGAGROAL_EVENT_TYPE_PERIODIC)
+         {
+            continue;
+         }
+
+         p = (struct periodic_watcher*)loop->events[i];
+         if (p->deadline > 0 && p->deadline <= now && (due == NULL || p->deadline < due->deadline))
+         {
+            due = p;
+         }
+      }
+
+      if (due == NULL)
+      {
+         break;
+      }
+
+      if (due->repeat_ms > 0)
+      {
+         due->deadline += due->repeat_ms * 1000000LL;
+         if (due->deadline <= now)
+         {
+            /* Missed intervals are merged into this fire */
+            due->deadline = now + due->repeat_ms * 1000000LL;
+         }
+      }
+      else
+      {
+         due->deadline = 0;
+      }
+
+      due->cb();
+
+      if (atomic_load(&loop->forked) || !pgagroal_event_loop_is_running())
+      {
+         return PGAGROAL_EVENT_RC_OK;
+      }
    }
-   return PGAGROAL_EVENT_RC_OK;
+
+   return ev_epoll_timer_rearm();
 }
 
 static int
-ev_epoll_periodic_start(struct periodic_watcher* watcher)
+ev_epoll_timer_rearm(void)
 {
-   struct epoll_event event;
-   event.events = EPOLLIN;
-   event.data.u64 = (uint64_t)watcher;
-   if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, watcher->fd, &event) == -1)
+   int64_t earliest = 0;
+   struct periodic_watcher* p = NULL;
+   struct itimerspec value = {0};
+
+   if (loop->timerfd < 0)
    {
-      pgagroal_log_fatal("epoll_ctl error: %s", strerror(errno));
-      return PGAGROAL_EVENT_RC_FATAL;
+      return PGAGROAL_EVENT_RC_OK;
    }
-   return PGAGROAL_EVENT_RC_OK;
-}
 
-static int
-ev_epoll_periodic_stop(struct periodic_watcher* watcher)
-{
-   if (epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, watcher->fd, NULL) == -1)
+   for (int i = 0; i < loop->events_nr; i++)
    {
-      pgagroal_log_error("epoll_ctl error: %s", strerror(errno));
-      return PGAGROAL_EVENT_RC_ERROR;
+      if (loop->events[i]->type != PGAGROAL_EVENT_TYPE_PERIODIC)
+      {
+         continue;
+      }
+
+      p = (struct periodic_watcher*)loop->events[i];
+      if (p->deadline > 0 && (earliest == 0 || p->deadline < earliest))
+      {
+         earliest = p->deadline;
+      }
    }
 
-   pgagroal_disconnect(watcher->fd);
-   watcher->fd = -1;
+   /* A zero value disarms the timer when no watcher is waiting */
+   value.it_value.tv_sec = earliest / 1000000000LL;
+   value.it_value.tv_nsec = earliest % 1000000000LL;
+
+   if (timerfd_settime(loop->timerfd, TFD_TIMER_ABSTIME, &value, NULL) == -1)
+   {
+      pgagroal_log_error("timerfd_settime: %s", strerror(errno));
+      return PGAGROAL_EVENT_RC_ERROR;
+   }
 
    return PGAGROAL_EVENT_RC_OK;
 }
 
-static int
-ev_epoll_periodic_handler(struct periodic_watcher* watcher)
+static int64_t
+ev_epoll_now(void)
 {
-   uint64_t exp;
-   int nread = read(watcher->fd, &exp, sizeof(uint64_t));
-   if (nread != sizeof(uint64_t))
+   struct timespec now;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
    {
-      pgagroal_log_error("periodic_handler read: %s", strerror(errno));
-      return PGAGROAL_EVENT_RC_ERROR;
+      pgagroal_log_error("clock_gettime: %s", strerror(errno));
+      return -1;
    }
-   watcher->cb();
-   return PGAGROAL_EVENT_RC_OK;
+
+   return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
 static int
@@ -1483,11 +1942,16 @@ ev_epoll_io_start(struct io_watcher* watcher)
       case PGAGROAL_EVENT_TYPE_MAIN:
          fd = watcher->fds.main.listen_fd;
          event.events = EPOLLIN;
+         /* The accept queue is drained until EAGAIN. Accepted sockets
+          * don't inherit O_NONBLOCK on Linux */
+         if (pgagroal_socket_nonblocking(fd))
+         {
+            return PGAGROAL_EVENT_RC_FATAL;
+         }
          break;
       case PGAGROAL_EVENT_TYPE_WORKER:
          fd = watcher->fds.worker.rcv_fd;
-         /* XXX: lookup the possibility to add EPOLLET here */
-         event.events = EPOLLIN;
+         event.events = edge_triggered ? EPOLLIN | EPOLLET : EPOLLIN;
          break;
       default:
          /* reaching here is a bug, do not recover */
@@ -1555,27 +2019,73 @@ static int
 ev_epoll_io_handler(struct io_watcher* watcher)
 {
    int client_fd = -1;
+   int listen_fd = -1;
+   int rcv_fd = -1;
+   char peek;
+   struct epoll_event event;
    enum event_type type = watcher->event_watcher.type;
    switch (type)
    {
       case PGAGROAL_EVENT_TYPE_MAIN:
-         client_fd = accept(watcher->fds.main.listen_fd, NULL, NULL);
-         if (client_fd == -1)
+         listen_fd = watcher->fds.main.listen_fd;
+         for (int i = 0; i < MAX_ACCEPTS; i++)
          {
-            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            client_fd = accept(listen_fd, NULL, NULL);
+            if (client_fd == -1)
             {
-               pgagroal_log_error("accept error: %s", strerror(errno));
-               return PGAGROAL_EVENT_RC_ERROR;
+               if (errno != EAGAIN && errno != EWOULDBLOCK && i == 0)
+               {
+                  pgagroal_log_error("accept error: %s", strerror(errno));
+                  return PGAGROAL_EVENT_RC_ERROR;
+               }
+               errno = 0;
+               break;
             }
-         }
-         else
-         {
+
             watcher->fds.main.client_fd = client_fd;
             watcher->cb(watcher);
+
+            /* The callback may have forked, stopped or replaced the watcher */
+            if (atomic_load(&loop->forked) || !pgagroal_event_loop_is_running() ||
+                watcher->fds.main.listen_fd != listen_fd)
+            {
+               break;
+            }
          }
          break;
       case PGAGROAL_EVENT_TYPE_WORKER:
-         watcher->cb(watcher);
+         rcv_fd = watcher->fds.worker.rcv_fd;
+         for (int i = 0; i < MAX_READS; i++)
+         {
+            watcher->cb(watcher);
+
+            if (!edge_triggered)
+            {
+               break;
+            }
+
+            /* The callback may have forked, stopped or moved the watcher */
+            if (atomic_load(&loop->forked) || !pgagroal_event_loop_is_running() ||
+                watcher->event_watcher.index < 0 || watcher->fds.worker.rcv_fd != rcv_fd)
+            {
+               break;
+            }
+
+            /* No new edge comes for data or a close that is already queued */
+            if (recv(rcv_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) < 0)
+            {
+               errno = 0;
+               break;
+            }
+
+            if (i == MAX_READS - 1)
+            {
+               /* Give the other watchers a turn, and have the rest reported again */
+               event.events = EPOLLIN | EPOLLET;
+               event.data.u64 = (uintptr_t)watcher;
+               epoll_ctl(loop->epollfd, EPOLL_CTL_MOD, rcv_fd, &event);
+            }
+         }
          break;
       default:
          /* shouldn't happen, do not recover */
@@ -1613,6 +2123,11 @@ ev_kqueue_loop(void)
          pgagroal_event_loop_break();
          break;
       }
+
+      if (nfds > 0)
+      {
+         pgagroal_prometheus_local_wakeup_add();
+      }
       for (int i = 0; i < nfds; i++)
       {
          rc = ev_kqueue_handler(&events[i]);
@@ -1854,22 +2369,37 @@ ev_kqueue_io_handler(struct kevent* kev)
    struct io_watcher* watcher = (struct io_watcher*)kev->udata;
    enum event_type type = watcher->event_watcher.type;
    int rc = PGAGROAL_EVENT_RC_OK;
+   int listen_fd = -1;
+   int pending = 1;
 
    switch (type)
    {
       case PGAGROAL_EVENT_TYPE_MAIN:
-         watcher->fds.main.client_fd = accept(watcher->fds.main.listen_fd, NULL, NULL);
-         if (watcher->fds.main.client_fd == -1)
+         /* kevent reports the accept queue length in data, so take that many
+          * connections without blocking and without another wakeup */
+         listen_fd = watcher->fds.main.listen_fd;
+         pending = kev->data > 0 ? MIN((int)kev->data, MAX_ACCEPTS) : 1;
+         for (int i = 0; i < pending; i++)
          {
-            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            watcher->fds.main.client_fd = accept(listen_fd, NULL, NULL);
+            if (watcher->fds.main.client_fd == -1)
             {
-               pgagroal_log_error("accept error: %s", strerror(errno));
-               rc = PGAGROAL_EVENT_RC_ERROR;
+               if (errno != EAGAIN && errno != EWOULDBLOCK && i == 0)
+               {
+                  pgagroal_log_error("accept error: %s", strerror(errno));
+                  rc = PGAGROAL_EVENT_RC_ERROR;
+               }
+               errno = 0;
+               break;
             }
-         }
-         else
-         {
+
             watcher->cb(watcher);
+
+            if (atomic_load(&loop->forked) || !pgagroal_event_loop_is_running() ||
+                watcher->fds.main.listen_fd != listen_fd)
+            {
+               break;
+            }
          }
          break;
       case PGAGROAL_EVENT_TYPE_WORKER:
@@ -2016,21 +2546,53 @@ init_watcher_message(struct io_watcher* watcher)
 {
    if (watcher->msg == NULL)
    {
-      watcher->msg = calloc(1, sizeof(struct message));
+      watcher->msg = pgagroal_memory_message_alloc(DEFAULT_BUFFER_SIZE, false);
       if (watcher->msg == NULL)
       {
          pgagroal_log_fatal("failed to allocate message");
          exit(1);
       }
-      watcher->msg->data = calloc(1, DEFAULT_BUFFER_SIZE);
-      if (watcher->msg->data == NULL)
+   }
+}
+
+static int
+events_add(event_watcher_t* watcher)
+{
+   if (loop->events_nr >= loop->events_size)
+   {
+      int size = loop->events_size * 2;
+      event_watcher_t** events = NULL;
+
+      events = realloc(loop->events, size * sizeof(event_watcher_t*));
+      if (events == NULL)
       {
-         pgagroal_log_fatal("failed to allocate message buffer");
-         free(watcher->msg);
-         watcher->msg = NULL;
-         exit(1);
+         return 1;
       }
-      watcher->msg->length = 0;
-      watcher->msg->kind = 0;
+
+      loop->events = events;
+      loop->events_size = size;
    }
+
+   watcher->index = loop->events_nr;
+   loop->events[loop->events_nr] = watcher;
+   loop->events_nr++;
+
+   return 0;
+}
+
+static int
+events_remove(event_watcher_t* watcher)
+{
+   int i = watcher->index;
+   event_watcher_t* last = NULL;
+
+   /* Swap with the last entry such that removal doesn't depend on the number of watchers */
+   loop->events_nr--;
+   last = loop->events[loop->events_nr];
+   loop->events[i] = last;
+   last->index = i;
+   loop->events[loop->events_nr] = NULL;
+   watcher->index = -1;
+
+   return 0;
 }
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <fingerprint.h>
+
+/* system */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+/** @struct normalizer
+ * Defines the normalized query as it is written
+ */
+struct normalizer
+{
+   uint64_t hash; /**< The hash of the characters so far */
+   char* text;    /**< The text */
+   size_t size;   /**< The size of the text */
+   size_t length; /**< The length of the text */
+   char last;     /**< The last character, or '\0' */
+};
+
+static void emit(struct normalizer* n, char c);
+static bool is_identifier(char c);
+static bool is_word(char c);
+static int skip_string(char* query, int length, int i, bool backslash);
+static int skip_dollar_string(char* query, int length, int i);
+
+uint64_t
+pgagroal_fingerprint(char* query, int length, char* text, size_t size)
+{
+   int i = 0;
+   bool space = false;
+   char c;
+   struct normalizer n;
+
+   n.hash = FNV_OFFSET;
+   n.text = text;
+   n.size = size;
+   n.length = 0;
+   n.last = '\0';
+
+   length = (int)strnlen(query, length);
+
+   /* Trailing white space and semicolons don't change the statement */
+   while (length > 0 && (isspace((unsigned char)query[length - 1]) || query[length - 1] == ';'))
+   {
+      length--;
+   }
+
+   while (i < length)
+   {
+      c = query[i];
+
+      if (isspace((unsigned char)c))
+      {
+         space = true;
+         i++;
+         continue;
+      }
+
+      if (c == '-' && i + 1 < length && query[i + 1] == '-')
+      {
+         while (i < length && query[i] != '\n')
+         {
+            i++;
+         }
+         space = true;
+         continue;
+      }
+
+      if (c == '/' && i + 1 < length && query[i + 1] == '*')
+      {
+         i += 2;
+         while (i + 1 < length && !(query[i] == '*' && query[i + 1] == '/'))
+         {
+            i++;
+         }
+         i += 2;
+         space = true;
+         continue;
+      }
+
+      /* A space is only kept between two words, so the spacing around operators doesn't matter */
+      if (space && is_word(n.last) && is_word(c))
+      {
+         emit(&n, ' ');
+      }
+      space = false;
+
+      if (c == '\'')
+      {
+         i = skip_string(query, length, i, false);
+         emit(&n, '?');
+      }
+      else if ((c == 'e' || c == 'E') && i + 1 < length && query[i + 1] == '\'' && !is_identifier(n.last))
+      {
+         i = skip_string(query, length, i + 1, true);
+         emit(&n, '?');
+      }
+      else if (c == '"')
+      {
+         /* A quoted identifier is kept as it is */
+         emit(&n, c);
+         i++;
+         while (i < length)
+         {
+            emit(&n, query[i]);
+            if (query[i] == '"')
+            {
+               if (i + 1 < length && query[i + 1] == '"')
+               {
+                  emit(&n, '"');
+                  i += 2;
+                  continue;
+               }
+               i++;
+               break;
+            }
+            i++;
+         }
+      }
+      else if (c == '$' && !is_identifier(n.last) && i + 1 < length &&
+               (query[i + 1] == '$' || isalpha((unsigned char)query[i + 1]) || query[i + 1] == '_'))
+      {
+         int end = skip_dollar_string(query, length, i);
+
+         if (end > i)
+         {
+            i = end;
+            emit(&n, '?');
+         }
+         else
+         {
+            emit(&n, c);
+            i++;
+         }
+      }
+      else if ((isdigit((unsigned char)c) || (c == '.' && i + 1 < length && isdigit((unsigned char)query[i + 1]))) &&
+               !is_identifier(n.last))
+      {
+         while (i < length && (isdigit((unsigned char)query[i]) || query[i] == '.'))
+         {
+            i++;
+         }
+         if (i < length && (query[i] == 'e' || query[i] == 'E'))
+         {
+            int j = i + 1;
+
+            if (j < length && (query[j] == '+' || query[j] == '-'))
+            {
+               j++;
+            }
+            if (j < length && isdigit((unsigned char)query[j]))
+            {
+               i = j;
+               while (i < length && isdigit((unsigned char)query[i]))
+               {
+                  i++;
+               }
+            }
+         }
+         emit(&n, '?');
+      }
+      else
+      {
+         emit(&n, (char)tolower((unsigned char)c));
+         i++;
+      }
+   }
+
+   if (n.size > 0)
+   {
+      n.text[n.length] = '\0';
+   }
+
+   return n.hash != 0 ? n.hash : 1;
+}
+
+static void
+emit(struct normalizer* n, char c)
+{
+   n->hash = (n->hash ^ (unsigned char)c) * FNV_PRIME;
+
+   if (n->length + 1 < n->size)
+   {
+      n->text[n->length++] = c;
+   }
+
+   n->last = c;
+}
+
+static bool
+is_identifier(char c)
+{
+   return isalnum((unsigned char)c) || c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+static bool
+is_word(char c)
+{
+   return is_identifier(c) || c == '?' || c == '\'' || c == '"' || c == '.';
+}
+
+static int
+skip_string(char* query, int length, int i, bool backslash)
+{
+   /* i is at the opening quote */
+   i++;
+
+   while (i < length)
+   {
+      if (backslash && query[i] == '\\')
+      {
+         i += 2;
+         continue;
+      }
+
+      if (query[i] == '\'')
+      {
+         if (i + 1 < length && query[i + 1] == '\'')
+         {
+            i += 2;
+            continue;
+         }
+
+         return i + 1;
+      }
+
+      i++;
+   }
+
+   return length;
+}
+
+static int
+skip_dollar_string(char* query, int length, int i)
+{
+   int tag_length;
+   int j = i + 1;
+
+   while (j < length && query[j] != '$')
+   {
+      if (!isalnum((unsigned char)query[j]) && query[j] != '_')
+      {
+         return i;
+      }
+      j++;
+   }
+
+   if (j >= length)
+   {
+      return i;
+   }
+
+   /* The tag includes both dollar signs */
+   tag_length = j - i + 1;
+
+   for (int k = j + 1; k + tag_length <= length; k++)
+   {
+      if (query[k] == '$' && !memcmp(&query[k], &query[i], tag_length))
+      {
+         return k + tag_length;
+      }
+   }
+
+   return length;
+}
@@ -44,6 +44,9 @@
 
 #define BUFFER_LENGTH 8192
 
+/* One deflate state is kept between messages, as it is costly to set up */
+static _Thread_local z_stream* stream_cache = NULL;
+
 int
 pgagroal_gzip_string(char* s, unsigned char** buffer, size_t* buffer_size)
 {
@@ -206,3 +209,86 @@ pgagroal_gunzip_string(unsigned char* compressed_buffer, size_t compressed_size,
 
    return 0;
 }
+
+int
+pgagroal_gzip_stream_create(void** stream)
+{
+   z_stream* s = NULL;
+
+   *stream = NULL;
+
+   if (stream_cache != NULL)
+   {
+      *stream = stream_cache;
+      stream_cache = NULL;
+      return 0;
+   }
+
+   s = (z_stream*)calloc(1, sizeof(z_stream));
+   if (s == NULL)
+   {
+      pgagroal_log_error("Gzip: Allocation error");
+      return 1;
+   }
+
+   if (deflateInit2(s, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      free(s);
+      pgagroal_log_error("Gzip: Initialization failed");
+      return 1;
+   }
+
+   *stream = s;
+
+   return 0;
+}
+
+int
+pgagroal_gzip_stream_compress(void* stream, char* data, size_t length, bool last, unsigned char** buffer, size_t* buffer_size, size_t* buffer_length)
+{
+   int ret;
+   z_stream* s = (z_stream*)stream;
+
+   s->next_in = (unsigned char*)data;
+   s->avail_in = length;
+
+   do
+   {
+      if (pgagroal_buffer_reserve(buffer, buffer_size, *buffer_length + BUFFER_LENGTH))
+      {
+         pgagroal_log_error("Gzip: Allocation error");
+         return 1;
+      }
+
+      s->next_out = *buffer + *buffer_length;
+      s->avail_out = *buffer_size - *buffer_length;
+
+      ret = deflate(s, last ? Z_FINISH : Z_NO_FLUSH);
+      if (ret == Z_STREAM_ERROR)
+      {
+         pgagroal_log_error("Gzip: Compression failed");
+         return 1;
+      }
+
+      *buffer_length = *buffer_size - s->avail_out;
+   }
+   while (s->avail_in > 0 || s->avail_out == 0 || (last && ret != Z_STREAM_END));
+
+   return 0;
+}
+
+void
+pgagroal_gzip_stream_destroy(void* stream)
+{
+   if (stream != NULL)
+   {
+      if (stream_cache == NULL && deflateReset((z_stream*)stream) == Z_OK)
+      {
+         stream_cache = (z_stream*)stream;
+         return;
+      }
+
+      deflateEnd((z_stream*)stream);
+      free(stream);
+   }
+}
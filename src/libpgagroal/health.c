@@ -37,14 +37,25 @@
 #include <message.h>
 
 /* system */
+#include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <time.h>
 #include <sys/wait.h>
 
 static void health_check_loop(void);
-static int server_probe(int server_idx, bool* up, int* auth_type);
+static void health_check_stop_cb(int signum);
+static void server_prober(int server_idx);
+static int server_probe(int server_idx, int* fd, bool* up, int* auth_type, int* rtt);
+static int probe_query(int fd);
+static int probe_response(int fd, int timeout, bool* up);
+static void server_lag(int server_idx, bool up);
+
+static volatile sig_atomic_t health_check_stopping = 0;
 
 /**
  * Entry point for the health check worker
@@ -121,108 +132,244 @@ pgagroal_health_check_stop(void)
 }
 
 /**
- * Main loop for the health check worker
+ * Main loop for the health check worker. Every server is probed by its own
+ * process, so a server that hangs does not delay the detection of the others
  */
 static void
 health_check_loop(void)
 {
    struct main_configuration* config;
-   pgagroal_time_t period;
-   bool up;
-   int status;
-   int previous_state[NUMBER_OF_SERVERS];
-   int32_t t;
+   pid_t probers[NUMBER_OF_SERVERS];
+   pid_t pid;
 
    config = (struct main_configuration*)shmem;
 
-   period = config->health_check_period;
-
    pgagroal_log_info("Health check started");
 
+   signal(SIGTERM, health_check_stop_cb);
+
    for (int i = 0; i < NUMBER_OF_SERVERS; i++)
    {
-      previous_state[i] = -2; /* Initial value representing 'never checked' */
+      probers[i] = 0;
+      atomic_store(&config->servers[i].lag, -1);
+      atomic_store(&config->servers[i].rtt, -1);
+   }
+
+   while (!health_check_stopping && config->keep_running && config->health_check)
+   {
+      FOREACH_VALID_SERVER
+      {
+         if (probers[i] == 0)
+         {
+            pid = fork();
+            if (pid == -1)
+            {
+               pgagroal_log_error("Health: Unable to fork prober for server %d", i);
+            }
+            else if (pid == 0)
+            {
+               signal(SIGTERM, SIG_DFL);
+               server_prober(i);
+               pgagroal_stop_logging();
+               exit(0);
+            }
+            else
+            {
+               probers[i] = pid;
+            }
+         }
+      }
+
+      sleep(1);
+
+      while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+      {
+         for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+         {
+            if (probers[i] == pid)
+            {
+               probers[i] = 0;
+            }
+         }
+      }
    }
 
-   while (config->keep_running && config->health_check)
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      if (probers[i] != 0)
+      {
+         kill(probers[i], SIGTERM);
+         waitpid(probers[i], NULL, 0);
+      }
+   }
+
+   pgagroal_log_info("Health check stopped");
+}
+
+static void
+health_check_stop_cb(int signum __attribute__((unused)))
+{
+   health_check_stopping = 1;
+}
+
+/**
+ * Probe a server every health_check_period
+ * @param server_idx The server index
+ */
+static void
+server_prober(int server_idx)
+{
+   struct main_configuration* config;
+   pid_t parent;
+   bool up;
+   int status;
+   int fd = -1;
+   int auth = HEALTH_CHECK_AUTH_UNKNOWN;
+   int rtt = -1;
+   int previous_state = -2; /* 'never checked' */
+   int32_t t;
+
+   config = (struct main_configuration*)shmem;
+   parent = getppid();
+
+   while (config->keep_running && config->health_check && getppid() == parent)
    {
       /* Sleep for the configured period, but check flags every second */
-      period = config->health_check_period;
-      t = pgagroal_time_convert(period, FORMAT_TIME_S);
-      for (int32_t i = 0; i < t && config->keep_running && config->health_check; i++)
+      t = pgagroal_time_convert(config->health_check_period, FORMAT_TIME_S);
+      for (int32_t i = 0; i < t && config->keep_running && config->health_check && getppid() == parent; i++)
       {
          sleep(1);
       }
 
-      if (!config->keep_running || !config->health_check)
+      if (!config->keep_running || !config->health_check || getppid() != parent)
       {
          break;
       }
 
-      pgagroal_log_debug("Health check run");
+      pgagroal_log_debug("Health check run for server %d", server_idx);
 
-      FOREACH_VALID_SERVER
+      up = false;
+      status = server_probe(server_idx, &fd, &up, &auth, &rtt);
+
+      /* status != 0 means connection or protocol error, but we treat it as 'not up' for retries */
+      if (status != 0)
       {
-         int auth = HEALTH_CHECK_AUTH_UNKNOWN;
          up = false;
-         status = server_probe(i, &up, &auth);
-
-         /* status != 0 means connection or protocol error, but we treat it as 'not up' for retries */
-         if (status != 0)
-         {
-            up = false;
-            atomic_store(&config->servers[i].auth_type, HEALTH_CHECK_AUTH_ERROR);
-         }
-         else
-         {
-            atomic_store(&config->servers[i].auth_type, auth);
-         }
+         atomic_store(&config->servers[server_idx].auth_type, HEALTH_CHECK_AUTH_ERROR);
+      }
+      else
+      {
+         atomic_store(&config->servers[server_idx].auth_type, auth);
+      }
 
-         if (up)
+      if (up)
+      {
+         config->servers[server_idx].failures = 0;
+         if (previous_state != SERVER_HEALTH_UP)
          {
-            config->servers[i].failures = 0;
-            if (previous_state[i] != SERVER_HEALTH_UP)
-            {
-               pgagroal_log_info("Health: Server %d is UP", i);
-               previous_state[i] = SERVER_HEALTH_UP;
-            }
-            atomic_store(&config->servers[i].health_state, SERVER_HEALTH_UP);
+            pgagroal_log_info("Health: Server %d is UP", server_idx);
+            previous_state = SERVER_HEALTH_UP;
          }
-         else
+         atomic_store(&config->servers[server_idx].health_state, SERVER_HEALTH_UP);
+         atomic_store(&config->servers[server_idx].rtt, rtt);
+      }
+      else
+      {
+         atomic_store(&config->servers[server_idx].rtt, -1);
+         config->servers[server_idx].failures++;
+         if (config->servers[server_idx].failures >= HEALTH_CHECK_MAX_RETRIES)
          {
-            config->servers[i].failures++;
-            if (config->servers[i].failures >= HEALTH_CHECK_MAX_RETRIES)
+            if (previous_state != SERVER_HEALTH_DOWN)
             {
-               if (previous_state[i] != SERVER_HEALTH_DOWN)
-               {
-                  pgagroal_log_warn("Health: Server %d is DOWN", i);
-                  previous_state[i] = SERVER_HEALTH_DOWN;
-               }
-               atomic_store(&config->servers[i].health_state, SERVER_HEALTH_DOWN);
+               pgagroal_log_warn("Health: Server %d is DOWN", server_idx);
+               previous_state = SERVER_HEALTH_DOWN;
             }
+            atomic_store(&config->servers[server_idx].health_state, SERVER_HEALTH_DOWN);
          }
       }
+
+      server_lag(server_idx, up);
    }
 
-   pgagroal_log_info("Health check stopped");
+   if (fd != -1)
+   {
+      (void)pgagroal_write_terminate(NULL, fd);
+      pgagroal_disconnect(fd);
+   }
 }
 
+/**
+ * Record the replication lag of a server for the replica routing
+ * @param server_idx The server index
+ * @param up Did the probe succeed
+ */
+static void
+server_lag(int server_idx, bool up)
+{
+   char* status = NULL;
+   char* primary = NULL;
+   int64_t behind = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (up && strlen(config->replica_application_name) > 0)
+   {
+      pgagroal_server_get_connectivity_info(server_idx, &status, &primary, &behind);
+
+      if (strcmp(primary, "No"))
+      {
+         behind = -1;
+      }
+   }
+
+   if (behind >= 0)
+   {
+      pgagroal_log_trace("Health: Server %d is a replica %" PRId64 " bytes behind", server_idx, behind);
+   }
+
+   atomic_store(&config->servers[server_idx].lag, behind);
+}
+
+/**
+ * Probe a server. The probe connection is kept open for the next probe,
+ * and a fresh one is made when it is gone or fails
+ * @param server_idx The server index
+ * @param fd The probe connection, or -1
+ * @param up Did the query succeed
+ * @param auth_type The authentication type, updated on a fresh connection
+ * @param rtt The round trip time of the query in microseconds
+ * @return 0 upon success, otherwise 1
+ */
 static int
-server_probe(int server_idx, bool* up, int* auth_type)
+server_probe(int server_idx, int* fd, bool* up, int* auth_type, int* rtt)
 {
    struct main_configuration* config;
-   int fd = -1;
-   struct message* msg = NULL;
-   int status;
-   bool query_success = false;
-   bool query_ready = false;
-   int offset_q;
-   char type_q;
-   int len_q;
+   struct timespec start;
+   int timeout;
 
    config = (struct main_configuration*)shmem;
 
    *up = false;
+   *rtt = -1;
+   timeout = MAX(1, (int)pgagroal_time_convert(config->health_check_timeout, FORMAT_TIME_S));
+
+   if (*fd != -1)
+   {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      if (probe_query(*fd) == 0 && probe_response(*fd, timeout, up) == 0)
+      {
+         *rtt = (int)MIN(pgagroal_time_elapsed_usec(&start), INT_MAX);
+         return 0;
+      }
+
+      /* The server may have closed an idle connection, so retry on a new one */
+      pgagroal_log_debug("Health: Probe connection to server %d lost", server_idx);
+      pgagroal_disconnect(*fd);
+      *fd = -1;
+   }
+
    *auth_type = HEALTH_CHECK_AUTH_UNKNOWN;
 
    pgagroal_log_debug("Health: Probing server %d (%s:%d) as user %s",
@@ -233,19 +380,69 @@ server_probe(int server_idx, bool* up, int* auth_type)
                                      config->health_check_user,
                                      config->health_check_user,
                                      "SELECT 1",
-                                     MAX(1, (int)pgagroal_time_convert(config->health_check_timeout, FORMAT_TIME_S)),
-                                     auth_type, &fd) != 0)
+                                     timeout,
+                                     auth_type, fd) != 0)
    {
       pgagroal_log_debug("Health: Failed to connect to server %d", server_idx);
+      *fd = -1;
       return 1;
    }
 
+   /* The query is already sent, so only the wait for the response is timed */
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   if (probe_response(*fd, timeout, up))
+   {
+      pgagroal_disconnect(*fd);
+      *fd = -1;
+      return 1;
+   }
+
+   *rtt = (int)MIN(pgagroal_time_elapsed_usec(&start), INT_MAX);
+
+   return 0;
+}
+
+static int
+probe_query(int fd)
+{
+   char query[15];
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&query, 0, sizeof(query));
+
+   pgagroal_write_byte(&query, 'Q');
+   pgagroal_write_int32(&(query[1]), sizeof(query) - 1);
+   pgagroal_write_string(&(query[5]), "SELECT 1;");
+
+   msg.kind = 'Q';
+   msg.length = sizeof(query);
+   msg.data = &query;
+
+   if (pgagroal_write_message(NULL, fd, &msg) != MESSAGE_STATUS_OK)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+probe_response(int fd, int timeout, bool* up)
+{
+   struct message* msg = NULL;
+   int status;
+   bool query_success = false;
+   bool query_ready = false;
+   int offset_q;
+   char type_q;
+   int len_q;
+
    /* Wait for query response */
    while (true)
    {
-      status = pgagroal_read_timeout_message(NULL, fd,
-                                             MAX(1, (int)pgagroal_time_convert(config->health_check_timeout, FORMAT_TIME_S)),
-                                             &msg);
+      status = pgagroal_read_timeout_message(NULL, fd, timeout, &msg);
       if (status != MESSAGE_STATUS_OK || msg == NULL)
       {
          pgagroal_log_debug("Health: Failed to read query response (status %d)", status);
@@ -288,10 +485,6 @@ server_probe(int server_idx, bool* up, int* auth_type)
       }
    }
 
-   (void)pgagroal_write_terminate(NULL, fd);
-
-   pgagroal_disconnect(fd);
-
    *up = query_success;
    return 0;
 
@@ -300,9 +493,5 @@ error:
    {
       pgagroal_clear_message(msg);
    }
-   if (fd != -1)
-   {
-      pgagroal_disconnect(fd);
-   }
    return 1;
 }
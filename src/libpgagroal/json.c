@@ -38,6 +38,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -45,11 +46,18 @@
 static bool type_allowed(enum value_type type);
 static char* item_to_string(struct json* item, int32_t format, char* tag, int indent);
 static char* array_to_string(struct json* array, int32_t format, char* tag, int indent);
-static int parse_string(char* str, uint64_t* index, struct json** obj);
+static int parse_string(char* str, uint64_t len, uint64_t* index, struct json** obj);
 static int json_add(struct json* obj, char* key, uintptr_t val, enum value_type type);
-static int fill_value(char* str, char* key, uint64_t* index, struct json* o);
+static int fill_value(char* str, uint64_t len, char* key, uint64_t* index, struct json* o);
+static int decode_string(char* str, uint64_t len, uint64_t* index, char** value);
 static bool value_start(char ch);
 static int handle_escape_char(char* str, uint64_t* index, uint64_t len, char* ch);
+static int writer_append(struct json_writer* writer, char* s, size_t length);
+static int writer_flush(struct json_writer* writer);
+static int writer_escaped(struct json_writer* writer, char* s);
+static int writer_member(struct json_writer* writer, char* key);
+static int writer_open(struct json_writer* writer, char* key, char c);
+static int writer_close(struct json_writer* writer, char c);
 
 int
 pgagroal_json_append(struct json* array, uintptr_t entry, enum value_type type)
@@ -335,13 +343,45 @@ pgagroal_json_iterator_has_next(struct json_iterator* iter)
 int
 pgagroal_json_parse_string(char* str, struct json** obj)
 {
-   uint64_t idx = 0;
+   char* copy = NULL;
+   int ret;
+
    if (str == NULL || strlen(str) < 2)
    {
       return 1;
    }
 
-   return parse_string(str, &idx, obj);
+   copy = strdup(str);
+   if (copy == NULL)
+   {
+      return 1;
+   }
+
+   ret = pgagroal_json_parse_buffer(copy, obj);
+
+   free(copy);
+
+   return ret;
+}
+
+int
+pgagroal_json_parse_buffer(char* str, struct json** obj)
+{
+   uint64_t idx = 0;
+   uint64_t len = 0;
+
+   if (str == NULL)
+   {
+      return 1;
+   }
+
+   len = strlen(str);
+   if (len < 2)
+   {
+      return 1;
+   }
+
+   return parse_string(str, len, &idx, obj);
 }
 
 int
@@ -350,7 +390,7 @@ pgagroal_json_clone(struct json* from, struct json** to)
    struct json* o = NULL;
    char* str = NULL;
    str = pgagroal_json_to_string(from, FORMAT_JSON, NULL, 0);
-   if (pgagroal_json_parse_string(str, &o))
+   if (pgagroal_json_parse_buffer(str, &o))
    {
       goto error;
    }
@@ -363,14 +403,13 @@ error:
 }
 
 static int
-parse_string(char* str, uint64_t* index, struct json** obj)
+parse_string(char* str, uint64_t len, uint64_t* index, struct json** obj)
 {
    enum json_type type;
    struct json* o = NULL;
    uint64_t idx = *index;
    char ch = str[idx];
    char* key = NULL;
-   uint64_t len = strlen(str);
 
    if (ch == '{')
    {
@@ -421,25 +460,8 @@ parse_string(char* str, uint64_t* index, struct json** obj)
          {
             goto error;
          }
-         idx++;
          // The key
-         while (idx < len && str[idx] != '"')
-         {
-            char ec_ch;
-            // handle escape character
-            if (str[idx] == '\\')
-            {
-               if (handle_escape_char(str, &idx, len, &ec_ch))
-               {
-                  goto error;
-               }
-               key = pgagroal_append_char(key, ec_ch);
-               continue;
-            }
-
-            key = pgagroal_append_char(key, str[idx++]);
-         }
-         if (idx == len || key == NULL)
+         if (decode_string(str, len, &idx, &key) || *key == '\0')
          {
             goto error;
          }
@@ -461,11 +483,10 @@ parse_string(char* str, uint64_t* index, struct json** obj)
             goto error;
          }
          // The value
-         if (fill_value(str, key, &idx, o))
+         if (fill_value(str, len, key, &idx, o))
          {
             goto error;
          }
-         free(key);
          key = NULL;
       }
    }
@@ -504,7 +525,7 @@ parse_string(char* str, uint64_t* index, struct json** obj)
             goto error;
          }
 
-         if (fill_value(str, key, &idx, o))
+         if (fill_value(str, len, key, &idx, o))
          {
             goto error;
          }
@@ -516,7 +537,6 @@ parse_string(char* str, uint64_t* index, struct json** obj)
    return 0;
 error:
    pgagroal_json_destroy(o);
-   free(key);
    return 1;
 }
 
@@ -545,83 +565,60 @@ value_start(char ch)
 }
 
 static int
-fill_value(char* str, char* key, uint64_t* index, struct json* o)
+fill_value(char* str, uint64_t len, char* key, uint64_t* index, struct json* o)
 {
    uint64_t idx = *index;
-   uint64_t len = strlen(str);
    if (str[idx] == '"')
    {
       char* val = NULL;
-      idx++;
-      while (idx < len && str[idx] != '"')
-      {
-         char ec_ch;
-         if (str[idx] == '\\')
-         {
-            if (handle_escape_char(str, &idx, len, &ec_ch))
-            {
-               goto error;
-            }
-            val = pgagroal_append_char(val, ec_ch);
-            continue;
-         }
-
-         val = pgagroal_append_char(val, str[idx++]);
-      }
-      if (idx == len)
+      if (decode_string(str, len, &idx, &val))
       {
          goto error;
       }
-      if (val == NULL)
-      {
-         json_add(o, key, (uintptr_t)"", ValueString);
-      }
-      else
-      {
-         json_add(o, key, (uintptr_t)val, ValueString);
-      }
-      idx++;
-      free(val);
+      json_add(o, key, (uintptr_t)val, ValueString);
    }
    else if (str[idx] == '-' || str[idx] == '+' || isdigit(str[idx]))
    {
       bool has_digit = false;
-      char* val_str = NULL;
+      uint64_t start = idx;
+      char* end = NULL;
+      char saved;
       while (idx < len && (isdigit(str[idx]) || str[idx] == '.' || str[idx] == '-' || str[idx] == '+'))
       {
          if (str[idx] == '.')
          {
             has_digit = true;
          }
-         val_str = pgagroal_append_char(val_str, str[idx++]);
+         idx++;
       }
+      // terminate the number in place so the conversion can't read past it
+      saved = str[idx];
+      str[idx] = '\0';
       if (has_digit)
       {
-         double val = 0.;
-         if (sscanf(val_str, "%lf", &val) != 1)
+         double val = strtod(str + start, &end);
+         str[idx] = saved;
+         if (end == str + start)
          {
-            free(val_str);
             goto error;
          }
          json_add(o, key, pgagroal_value_from_double(val), ValueDouble);
-         free(val_str);
       }
       else
       {
-         int64_t val = 0;
-         if (sscanf(val_str, "%" PRId64, &val) != 1)
+         int64_t val = strtoll(str + start, &end, 10);
+         str[idx] = saved;
+         if (end == str + start)
          {
-            free(val_str);
             goto error;
          }
          json_add(o, key, (uintptr_t)val, ValueInt64);
-         free(val_str);
       }
    }
    else if (str[idx] == '{')
    {
       struct json* val = NULL;
-      if (parse_string(str, &idx, &val))
+      if (parse_string(str, len, &idx, &val))
       {
          goto error;
       }
@@ -630,7 +627,7 @@ fill_value(char* str, char* key, uint64_t* index, struct json* o)
    else if (str[idx] == '[')
    {
       struct json* val = NULL;
-      if (parse_string(str, &idx, &val))
+      if (parse_string(str, len, &idx, &val))
       {
          goto error;
       }
@@ -638,29 +635,27 @@ fill_value(char* str, char* key, uint64_t* index, struct json* o)
    }
    else if (str[idx] == 'n' || str[idx] == 't' || str[idx] == 'f')
    {
-      char* val = NULL;
+      uint64_t start = idx;
       while (idx < len && str[idx] >= 'a' && str[idx] <= 'z')
       {
-         val = pgagroal_append_char(val, str[idx++]);
+         idx++;
       }
-      if (pgagroal_compare_string(val, "null"))
+      if (idx - start == 4 && !strncmp(str + start, "null", 4))
       {
          json_add(o, key, 0, ValueString);
       }
-      else if (pgagroal_compare_string(val, "true"))
+      else if (idx - start == 4 && !strncmp(str + start, "true", 4))
       {
          json_add(o, key, true, ValueBool);
       }
-      else if (pgagroal_compare_string(val, "false"))
+      else if (idx - start == 5 && !strncmp(str + start, "false", 5))
       {
          json_add(o, key, false, ValueBool);
       }
       else
       {
-         free(val);
          goto error;
       }
-      free(val);
    }
    else
    {
@@ -672,6 +667,46 @@ error:
    return 1;
 }
 
+/**
+ * Decode the string starting at the quote at index into the buffer itself,
+ * unescaping only ever shrinks it so the result is terminated where the
+ * closing quote was
+ */
+static int
+decode_string(char* str, uint64_t len, uint64_t* index, char** value)
+{
+   uint64_t idx = *index + 1;
+   uint64_t w = idx;
+   char* start = str + idx;
+
+   while (idx < len && str[idx] != '"')
+   {
+      char ec_ch;
+      if (str[idx] == '\\')
+      {
+         if (handle_escape_char(str, &idx, len, &ec_ch))
+         {
+            return 1;
+         }
+         str[w++] = ec_ch;
+         continue;
+      }
+
+      str[w++] = str[idx++];
+   }
+   if (idx == len)
+   {
+      return 1;
+   }
+
+   str[w] = '\0';
+
+   *value = start;
+   *index = idx + 1;
+
+   return 0;
+}
+
 static int
 handle_escape_char(char* str, uint64_t* index, uint64_t len, char* ch)
 {
@@ -736,7 +771,7 @@ pgagroal_json_read_file(char* path, struct json** obj)
       memset(buf, 0, sizeof(buf));
    }
 
-   if (pgagroal_json_parse_string(str, &j))
+   if (pgagroal_json_parse_buffer(str, &j))
    {
       pgagroal_log_error("Failed to parse json file %s", path);
       goto error;
@@ -913,3 +948,325 @@ array_to_string(struct json* array, int32_t format, char* tag, int indent)
 {
    return pgagroal_deque_to_string(array->elements, format, tag, indent);
 }
+
+void
+pgagroal_json_writer_reset(struct json_writer* writer)
+{
+   writer->length = 0;
+   writer->flushed = 0;
+   writer->depth = 0;
+   writer->first[0] = true;
+   writer->error = false;
+   writer->flush = NULL;
+   writer->sink = NULL;
+
+   if (writer->data != NULL)
+   {
+      writer->data[0] = '\0';
+   }
+}
+
+void
+pgagroal_json_writer_sink(struct json_writer* writer, int (*flush)(void* sink, char* data, size_t length), void* sink)
+{
+   writer->flush = flush;
+   writer->sink = sink;
+}
+
+int
+pgagroal_json_writer_begin_object(struct json_writer* writer, char* key)
+{
+   return writer_open(writer, key, '{');
+}
+
+int
+pgagroal_json_writer_end_object(struct json_writer* writer)
+{
+   return writer_close(writer, '}');
+}
+
+int
+pgagroal_json_writer_begin_array(struct json_writer* writer, char* key)
+{
+   return writer_open(writer, key, '[');
+}
+
+int
+pgagroal_json_writer_end_array(struct json_writer* writer)
+{
+   return writer_close(writer, ']');
+}
+
+int
+pgagroal_json_writer_string(struct json_writer* writer, char* key, char* value)
+{
+   if (writer_member(writer, key))
+   {
+      return 1;
+   }
+
+   if (value == NULL)
+   {
+      return writer_append(writer, "null", 4);
+   }
+
+   return writer_escaped(writer, value);
+}
+
+int
+pgagroal_json_writer_int(struct json_writer* writer, char* key, int64_t value)
+{
+   char buf[32];
+   int n;
+
+   if (writer_member(writer, key))
+   {
+      return 1;
+   }
+
+   n = snprintf(buf, sizeof(buf), "%" PRId64, value);
+
+   return writer_append(writer, buf, n);
+}
+
+int
+pgagroal_json_writer_bool(struct json_writer* writer, char* key, bool value)
+{
+   if (writer_member(writer, key))
+   {
+      return 1;
+   }
+
+   return value ? writer_append(writer, "true", 4) : writer_append(writer, "false", 5);
+}
+
+int
+pgagroal_json_writer_json(struct json_writer* writer, char* key, struct json* value)
+{
+   int ret;
+   char* s = NULL;
+
+   if (writer_member(writer, key))
+   {
+      return 1;
+   }
+
+   if (value == NULL)
+   {
+      return writer_append(writer, "null", 4);
+   }
+
+   s = pgagroal_json_to_string(value, FORMAT_JSON_COMPACT, NULL, 0);
+   if (s == NULL)
+   {
+      writer->error = true;
+      return 1;
+   }
+
+   ret = writer_append(writer, s, strlen(s));
+
+   free(s);
+
+   return ret;
+}
+
+int
+pgagroal_json_writer_finish(struct json_writer* writer)
+{
+   if (writer->error || writer->depth != 0 || writer->length + writer->flushed == 0)
+   {
+      return 1;
+   }
+
+   if (writer->flush != NULL && writer->length > 0)
+   {
+      return writer_flush(writer);
+   }
+
+   return 0;
+}
+
+void
+pgagroal_json_writer_destroy(struct json_writer* writer)
+{
+   if (writer != NULL)
+   {
+      free(writer->data);
+      writer->data = NULL;
+      writer->size = 0;
+      writer->length = 0;
+   }
+}
+
+static int
+writer_append(struct json_writer* writer, char* s, size_t length)
+{
+   if (writer->error)
+   {
+      return 1;
+   }
+
+   if (writer->length + length + 1 > writer->size)
+   {
+      size_t size = writer->size > 0 ? writer->size : 8192;
+      char* data = NULL;
+
+      while (writer->length + length + 1 > size)
+      {
+         size *= 2;
+      }
+
+      data = realloc(writer->data, size);
+      if (data == NULL)
+      {
+         writer->error = true;
+         return 1;
+      }
+
+      writer->data = data;
+      writer->size = size;
+   }
+
+   memcpy(writer->data + writer->length, s, length);
+   writer->length += length;
+   writer->data[writer->length] = '\0';
+
+   if (writer->flush != NULL && writer->length >= JSON_WRITER_CHUNK_SIZE)
+   {
+      return writer_flush(writer);
+   }
+
+   return 0;
+}
+
+static int
+writer_flush(struct json_writer* writer)
+{
+   if (writer->flush(writer->sink, writer->data, writer->length))
+   {
+      writer->error = true;
+      return 1;
+   }
+
+   writer->flushed += writer->length;
+   writer->length = 0;
+   writer->data[0] = '\0';
+
+   return 0;
+}
+
+static int
+writer_escaped(struct json_writer* writer, char* s)
+{
+   char* start = s;
+
+   if (writer_append(writer, "\"", 1))
+   {
+      return 1;
+   }
+
+   /* Runs without a character to escape are copied in one go */
+   for (char* p = s; *p != '\0'; p++)
+   {
+      char* escaped = NULL;
+
+      switch (*p)
+      {
+         case '\"':
+            escaped = "\\\"";
+            break;
+         case '\\':
+            escaped = "\\\\";
+            break;
+         case '\n':
+            escaped = "\\n";
+            break;
+         case '\t':
+            escaped = "\\t";
+            break;
+         case '\r':
+            escaped = "\\r";
+            break;
+         default:
+            break;
+      }
+
+      if (escaped != NULL)
+      {
+         if (writer_append(writer, start, p - start) || writer_append(writer, escaped, 2))
+         {
+            return 1;
+         }
+         start = p + 1;
+      }
+   }
+
+   if (writer_append(writer, start, strlen(start)))
+   {
+      return 1;
+   }
+
+   return writer_append(writer, "\"", 1);
+}
+
+static int
+writer_member(struct json_writer* writer, char* key)
+{
+   if (writer->error)
+   {
+      return 1;
+   }
+
+   if (!writer->first[writer->depth])
+   {
+      if (writer_append(writer, ",", 1))
+      {
+         return 1;
+      }
+   }
+   writer->first[writer->depth] = false;
+
+   if (key != NULL)
+   {
+      if (writer_escaped(writer, key) || writer_append(writer, ":", 1))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static int
+writer_open(struct json_writer* writer, char* key, char c)
+{
+   if (writer->depth + 1 >= JSON_WRITER_MAX_DEPTH)
+   {
+      writer->error = true;
+      return 1;
+   }
+
+   if (writer_member(writer, key) || writer_append(writer, &c, 1))
+   {
+      return 1;
+   }
+
+   writer->depth++;
+   writer->first[writer->depth] = true;
+
+   return 0;
+}
+
+static int
+writer_close(struct json_writer* writer, char c)
+{
+   if (writer->depth == 0)
+   {
+      writer->error = true;
+      return 1;
+   }
+
+   writer->depth--;
+
+   return writer_append(writer, &c, 1);
+}
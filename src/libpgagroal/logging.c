@@ -30,15 +30,19 @@
 #include <pgagroal.h>
 #include <logging.h>
 #include <prometheus.h>
+#include <shmem.h>
 #include <utils.h>
 
 /* system */
 #include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
@@ -47,6 +51,12 @@
 #define MAX_LENGTH  4096
 
 static void output_log_line(char* l);
+static char* log_filename(char* file);
+static bool log_ring_active(void);
+static void log_ring_push(int level, char* file, int line, char* fmt, va_list vl);
+static int log_ring_drain(struct log_ring* ring);
+static void log_ring_write(struct log_ring_line* l);
+static void log_ring_run(struct log_ring* ring);
 
 FILE* log_file;
 
@@ -54,6 +64,8 @@ time_t next_log_rotation_age; /* number of seconds at which the next location wi
 
 char current_log_path[MAX_PATH]; /* the current log file */
 
+static bool log_writer = false; /* is this the logger process */
+
 static const char* levels[] =
    {
       "TRACE",
@@ -333,6 +345,17 @@ pgagroal_log_line(int level, char* file, int line, char* fmt, ...)
             break;
       }
 
+      if (log_ring_active())
+      {
+         va_list vl;
+
+         va_start(vl, fmt);
+         log_ring_push(level, file, line, fmt, vl);
+         va_end(vl);
+
+         return;
+      }
+
 retry:
       isfree = STATE_FREE;
 
@@ -347,15 +370,7 @@ retry:
          t = time(NULL);
          tm = localtime(&t);
 
-         filename = strrchr(file, '/');
-         if (filename != NULL)
-         {
-            filename = filename + 1;
-         }
-         else
-         {
-            filename = file;
-         }
+         filename = log_filename(file);
 
          if (strlen(config->log_line_prefix) == 0)
          {
@@ -778,3 +793,388 @@ pgagroal_log_is_enabled(int level)
 
    return false;
 }
+
+int
+pgagroal_log_ring_init(size_t* p_size, void** p_shmem)
+{
+   size_t size;
+   struct log_ring* ring = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   size = sizeof(struct log_ring);
+
+   if (pgagroal_create_shared_memory(size, config->hugepage, (void**)&ring))
+   {
+      goto error;
+   }
+
+   atomic_init(&ring->running, false);
+   atomic_init(&ring->pid, 0);
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+
+   for (int i = 0; i < PGAGROAL_LOGGING_RING_LINES; i++)
+   {
+      atomic_init(&ring->lines[i].sequence, i);
+   }
+
+   *p_shmem = ring;
+   *p_size = size;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgagroal_log_ring_start(void)
+{
+   pid_t pid;
+   struct log_ring* ring;
+
+   ring = (struct log_ring*)log_shmem;
+
+   if (ring == NULL)
+   {
+      return 0;
+   }
+
+   /* Set before the fork such that the logger process doesn't see a stopped ring */
+   atomic_store(&ring->running, true);
+
+   pid = fork();
+
+   if (pid == -1)
+   {
+      atomic_store(&ring->running, false);
+      log_ring_drain(ring);
+      pgagroal_log_error("Cannot create the logger process: %s", strerror(errno));
+      errno = 0;
+      return 1;
+   }
+   else if (pid == 0)
+   {
+      log_writer = true;
+      log_ring_run(ring);
+      exit(0);
+   }
+
+   atomic_store(&ring->pid, pid);
+
+   return 0;
+}
+
+int
+pgagroal_log_ring_stop(void)
+{
+   pid_t pid;
+   struct log_ring* ring;
+
+   ring = (struct log_ring*)log_shmem;
+
+   if (ring == NULL || !atomic_load(&ring->running))
+   {
+      return 0;
+   }
+
+   atomic_store(&ring->running, false);
+
+   pid = atomic_load(&ring->pid);
+   if (pid > 0)
+   {
+      waitpid(pid, NULL, 0);
+      atomic_store(&ring->pid, 0);
+   }
+
+   /* Lines claimed while the logger process was exiting */
+   log_ring_drain(ring);
+
+   return 0;
+}
+
+static char*
+log_filename(char* file)
+{
+   char* filename = NULL;
+
+   filename = strrchr(file, '/');
+   if (filename != NULL)
+   {
+      return filename + 1;
+   }
+
+   return file;
+}
+
+static bool
+log_ring_active(void)
+{
+   struct log_ring* ring;
+
+   ring = (struct log_ring*)log_shmem;
+
+   return ring != NULL && !log_writer && atomic_load_explicit(&ring->running, memory_order_relaxed);
+}
+
+static void
+log_ring_push(int level, char* file, int line, char* fmt, va_list vl)
+{
+   char buf[256];
+   char text[PGAGROAL_LOGGING_RING_LINE_LENGTH];
+   int length = 0;
+   int n;
+   int64_t diff;
+   uint64_t position;
+   uint64_t sequence;
+   struct tm* tm;
+   time_t t;
+   char* prefix = NULL;
+   struct log_ring* ring;
+   struct log_ring_line* l = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+   ring = (struct log_ring*)log_shmem;
+
+   /* The line is formatted by the caller, the logger process only writes it */
+   if (config->log_type != PGAGROAL_LOGGING_TYPE_SYSLOG)
+   {
+      t = time(NULL);
+      tm = localtime(&t);
+
+      prefix = strlen(config->log_line_prefix) > 0 ? config->log_line_prefix : PGAGROAL_LOGGING_DEFAULT_LOG_LINE_PREFIX;
+      buf[strftime(buf, sizeof(buf), prefix, tm)] = '\0';
+
+      if (config->log_type == PGAGROAL_LOGGING_TYPE_CONSOLE)
+      {
+         length = snprintf(text, sizeof(text), "%s %s%-5s\x1b[0m \x1b[90m%s:%d\x1b[0m ",
+                           buf, colors[level - 1], levels[level - 1],
+                           log_filename(file), line);
+      }
+      else
+      {
+         length = snprintf(text, sizeof(text), "%s %-5s %s:%d ",
+                           buf, levels[level - 1], log_filename(file), line);
+      }
+
+      if (length < 0)
+      {
+         length = 0;
+      }
+      else if (length >= (int)sizeof(text))
+      {
+         length = sizeof(text) - 1;
+      }
+   }
+
+   n = vsnprintf(text + length, sizeof(text) - length, fmt, vl);
+   if (n > 0)
+   {
+      length += n;
+   }
+
+   if (length >= (int)sizeof(text))
+   {
+      length = sizeof(text) - 1;
+   }
+
+   position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+   for (;;)
+   {
+      l = &ring->lines[position % PGAGROAL_LOGGING_RING_LINES];
+      sequence = atomic_load_explicit(&l->sequence, memory_order_acquire);
+      diff = (int64_t)(sequence - position);
+
+      if (diff == 0)
+      {
+         if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1,
+                                                   memory_order_relaxed, memory_order_relaxed))
+         {
+            break;
+         }
+      }
+      else if (diff < 0)
+      {
+         /* The logger process is behind, never block the caller */
+         pgagroal_prometheus_logging_dropped();
+         return;
+      }
+      else
+      {
+         position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+      }
+   }
+
+   memcpy(l->text, text, length);
+   l->text[length] = '\0';
+   l->length = length;
+   l->level = level;
+
+   atomic_store_explicit(&l->sequence, position + 1, memory_order_release);
+}
+
+static int
+log_ring_drain(struct log_ring* ring)
+{
+   int count = 0;
+   signed char isfree;
+   uint64_t position;
+   struct log_ring_line* l = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   l = &ring->lines[position % PGAGROAL_LOGGING_RING_LINES];
+
+   if (atomic_load_explicit(&l->sequence, memory_order_acquire) != position + 1)
+   {
+      return 0;
+   }
+
+   /* pgagroal_log_mem() still writes directly */
+retry:
+   isfree = STATE_FREE;
+
+   if (!atomic_compare_exchange_strong(&config->log_lock, &isfree, STATE_IN_USE))
+   {
+      SLEEP_AND_GOTO(1000000L, retry)
+   }
+
+   while (count < PGAGROAL_LOGGING_RING_LINES &&
+          atomic_load_explicit(&l->sequence, memory_order_acquire) == position + 1)
+   {
+      log_ring_write(l);
+
+      atomic_store_explicit(&l->sequence, position + PGAGROAL_LOGGING_RING_LINES, memory_order_release);
+
+      position++;
+      count++;
+      l = &ring->lines[position % PGAGROAL_LOGGING_RING_LINES];
+   }
+
+   atomic_store_explicit(&ring->tail, position, memory_order_relaxed);
+
+   if (config->log_type == PGAGROAL_LOGGING_TYPE_CONSOLE)
+   {
+      fflush(stdout);
+   }
+   else if (config->log_type == PGAGROAL_LOGGING_TYPE_FILE)
+   {
+      if (log_file != NULL)
+      {
+         fflush(log_file);
+
+         if (log_rotation_required())
+         {
+            log_file_rotate();
+         }
+      }
+      else
+      {
+         fflush(stderr);
+      }
+   }
+
+   atomic_store(&config->log_lock, STATE_FREE);
+
+   return count;
+}
+
+static void
+log_ring_write(struct log_ring_line* l)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->log_type == PGAGROAL_LOGGING_TYPE_CONSOLE)
+   {
+      fwrite(l->text, 1, l->length, stdout);
+      fputc('\n', stdout);
+   }
+   else if (config->log_type == PGAGROAL_LOGGING_TYPE_FILE)
+   {
+      FILE* f = log_file != NULL ? log_file : stderr;
+
+      fwrite(l->text, 1, l->length, f);
+      fputc('\n', f);
+   }
+   else if (config->log_type == PGAGROAL_LOGGING_TYPE_SYSLOG)
+   {
+      switch (l->level)
+      {
+         case PGAGROAL_LOGGING_LEVEL_DEBUG5:
+         case PGAGROAL_LOGGING_LEVEL_DEBUG1:
+            syslog(LOG_DEBUG, "%s", l->text);
+            break;
+         case PGAGROAL_LOGGING_LEVEL_WARN:
+            syslog(LOG_WARNING, "%s", l->text);
+            break;
+         case PGAGROAL_LOGGING_LEVEL_ERROR:
+            syslog(LOG_ERR, "%s", l->text);
+            break;
+         case PGAGROAL_LOGGING_LEVEL_FATAL:
+            syslog(LOG_CRIT, "%s", l->text);
+            break;
+         default:
+            syslog(LOG_INFO, "%s", l->text);
+            break;
+      }
+   }
+}
+
+static void
+log_ring_run(struct log_ring* ring)
+{
+   int type;
+   pid_t parent;
+   char path[MISC_LENGTH];
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* The pool stops the logger process once everything else is down */
+   signal(SIGINT, SIG_IGN);
+   signal(SIGTERM, SIG_IGN);
+
+   parent = getppid();
+   type = config->log_type;
+   memcpy(path, config->log_path, MISC_LENGTH);
+
+   while (atomic_load(&ring->running) && getppid() == parent)
+   {
+      if (type != config->log_type || strncmp(path, config->log_path, MISC_LENGTH))
+      {
+         /* A reload changed the destination */
+         if (log_file != NULL)
+         {
+            fclose(log_file);
+            log_file = NULL;
+         }
+
+         type = config->log_type;
+         memcpy(path, config->log_path, MISC_LENGTH);
+
+         pgagroal_start_logging();
+      }
+
+      if (log_ring_drain(ring) == 0)
+      {
+         SLEEP(1000000L)
+      }
+   }
+
+   /* Write what is left */
+   while (log_ring_drain(ring) > 0)
+   {
+      ;
+   }
+
+   pgagroal_stop_logging();
+}
@@ -37,6 +37,7 @@
 /* system */
 #include <dirent.h>
 #include "lz4.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -78,22 +79,34 @@ int
 pgagroal_lz4d_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
 {
    size_t max_decompressed_size;
-   int decompressed_size;
+   int decompressed_size = -1;
+   char* s = NULL;
 
-   max_decompressed_size = compressed_size * 4;
+   *output_string = NULL;
 
-   *output_string = (char*)malloc(max_decompressed_size);
-   if (*output_string == NULL)
+   /* The block format doesn't carry the size, so grow until it fits, LZ4 compresses at most 255:1 */
+   for (max_decompressed_size = compressed_size * 4 + 1;
+        decompressed_size < 0 && max_decompressed_size <= compressed_size * 255 * 2 + 1 && max_decompressed_size <= INT_MAX;
+        max_decompressed_size *= 2)
    {
-      pgagroal_log_error("LZ4: Allocation failed");
-      return 1;
+      s = (char*)realloc(*output_string, max_decompressed_size);
+      if (s == NULL)
+      {
+         pgagroal_log_error("LZ4: Allocation failed");
+         free(*output_string);
+         *output_string = NULL;
+         return 1;
+      }
+      *output_string = s;
+
+      decompressed_size = LZ4_decompress_safe((const char*)compressed_buffer, *output_string, compressed_size, max_decompressed_size - 1);
    }
 
-   decompressed_size = LZ4_decompress_safe((const char*)compressed_buffer, *output_string, compressed_size, max_decompressed_size);
    if (decompressed_size < 0)
    {
       pgagroal_log_error("LZ4: Decompress failed");
       free(*output_string);
+      *output_string = NULL;
       return 1;
    }
 
@@ -101,3 +114,47 @@ pgagroal_lz4d_string(unsigned char* compressed_buffer, size_t compressed_size, c
 
    return 0;
 }
+
+int
+pgagroal_lz4c_buffer(void* source, size_t source_size, void* destination, size_t capacity, size_t* size)
+{
+   int compressed_size;
+
+   *size = 0;
+
+   if (source_size > INT_MAX || capacity > INT_MAX)
+   {
+      return 1;
+   }
+
+   /* Data that doesn't fit is sent as it is, so that isn't an error to log */
+   compressed_size = LZ4_compress_default((const char*)source, (char*)destination, (int)source_size, (int)capacity);
+   if (compressed_size <= 0)
+   {
+      return 1;
+   }
+
+   *size = (size_t)compressed_size;
+
+   return 0;
+}
+
+int
+pgagroal_lz4d_buffer(void* source, size_t source_size, void* destination, size_t size)
+{
+   int decompressed_size;
+
+   if (source_size > INT_MAX || size > INT_MAX)
+   {
+      return 1;
+   }
+
+   decompressed_size = LZ4_decompress_safe((const char*)source, (char*)destination, (int)source_size, (int)size);
+   if (decompressed_size < 0 || (size_t)decompressed_size != size)
+   {
+      pgagroal_log_error("LZ4: Decompress failed");
+      return 1;
+   }
+
+   return 0;
+}
@@ -46,6 +46,7 @@
 
 /* system */
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdatomic.h>
 #include <stdbool.h>
@@ -57,8 +58,11 @@
 #include <sys/un.h>
 
 #include <openssl/err.h>
+#include <openssl/evp.h>
 #include <openssl/ssl.h>
 
+#define MANAGEMENT_STREAM_CHUNK 12288
+
 static int read_uint8(char* prefix, SSL* ssl, int socket, uint8_t* i);
 static int read_string(char* prefix, SSL* ssl, int socket, char** str);
 static int read_complete(SSL* ssl, int socket, void* buf, size_t size);
@@ -67,6 +71,7 @@ static int write_string(char* prefix, SSL* ssl, int socket, char* str);
 static int write_complete(SSL* ssl, int socket, void* buf, size_t size);
 static int write_socket(int socket, void* buf, size_t size);
 static int write_ssl(SSL* ssl, void* buf, size_t size);
+static int stream_encode(SSL* ssl, int socket, unsigned char* carry, size_t* carry_length, unsigned char* data, size_t length);
 
 int
 pgagroal_management_request_flush(SSL* ssl, int socket, int32_t mode, char* database, int64_t timeout, uint8_t compression, uint8_t encryption, int32_t output_format)
@@ -253,6 +258,138 @@ error:
    return 1;
 }
 
+int
+pgagroal_management_request_tracker(SSL* ssl, int socket, int64_t sequence, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgagroal_management_create_header(MANAGEMENT_TRACKER, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgagroal_json_put(request, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)sequence, ValueInt64);
+
+   if (pgagroal_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgagroal_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(j);
+
+   return 1;
+}
+
+int
+pgagroal_management_request_slowlog(SSL* ssl, int socket, int64_t sequence, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgagroal_management_create_header(MANAGEMENT_SLOWLOG, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgagroal_json_put(request, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)sequence, ValueInt64);
+
+   if (pgagroal_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgagroal_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(j);
+
+   return 1;
+}
+
+int
+pgagroal_management_request_activity(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgagroal_management_create_header(MANAGEMENT_ACTIVITY, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgagroal_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(j);
+
+   return 1;
+}
+
+int
+pgagroal_management_request_cluster(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgagroal_management_create_header(MANAGEMENT_CLUSTER, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgagroal_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(j);
+
+   return 1;
+}
+
 int
 pgagroal_management_request_get_password(SSL* ssl, int socket, char* username, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -581,6 +718,40 @@ error:
    return 1;
 }
 
+int
+pgagroal_management_request_clear_auth_query(SSL* ssl, int socket, char* username, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgagroal_management_create_header(MANAGEMENT_CLEAR_AUTH_QUERY, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgagroal_json_put(request, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)username, ValueString);
+
+   if (pgagroal_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgagroal_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(j);
+
+   return 1;
+}
+
 int
 pgagroal_management_request_switch_to(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -1136,7 +1307,7 @@ pgagroal_management_read_json(SSL* ssl, int socket, uint8_t* compression, uint8_
       }
    }
 
-   if (pgagroal_json_parse_string(s, &r))
+   if (pgagroal_json_parse_buffer(s, &r))
    {
       goto error;
    }
@@ -1178,172 +1349,372 @@ error:
 int
 pgagroal_management_write_json(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json)
 {
+   int ret;
    char* s = NULL;
 
-   unsigned char* transfer_buffer = NULL;
+   s = pgagroal_json_to_string(json, FORMAT_JSON_COMPACT, NULL, 0);
+   if (s == NULL)
+   {
+      return 1;
+   }
+
+   ret = pgagroal_management_write_text(ssl, socket, compression, encryption, s);
+
+   free(s);
+
+   return ret;
+}
+
+int
+pgagroal_management_write_text(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, char* text)
+{
+   struct management_stream* stream = NULL;
+
+   if (pgagroal_management_stream_create(compression, encryption, &stream))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_stream_write(stream, text, strlen(text)))
+   {
+      goto error;
+   }
+
+   if (pgagroal_management_stream_send(ssl, socket, stream))
+   {
+      goto error;
+   }
+
+   pgagroal_management_stream_destroy(stream);
+
+   return 0;
+
+error:
+
+   pgagroal_management_stream_destroy(stream);
+
+   return 1;
+}
+
+int
+pgagroal_management_stream_create(uint8_t compression, uint8_t encryption, struct management_stream** stream)
+{
+   struct management_stream* s = NULL;
+
+   *stream = NULL;
+
+   s = (struct management_stream*)calloc(1, sizeof(struct management_stream));
+   if (s == NULL)
+   {
+      pgagroal_log_error("pgagroal_management_stream_create: Allocation failed");
+      goto error;
+   }
+
+   s->compression = compression;
+   s->encryption = encryption;
+
+   switch (encryption)
+   {
+      case MANAGEMENT_ENCRYPTION_AES256_GCM:
+         s->mode = ENCRYPTION_AES_256_GCM;
+         break;
+      case MANAGEMENT_ENCRYPTION_AES192_GCM:
+         s->mode = ENCRYPTION_AES_192_GCM;
+         break;
+      case MANAGEMENT_ENCRYPTION_AES128_GCM:
+         s->mode = ENCRYPTION_AES_128_GCM;
+         break;
+      default:
+         if (encryption != MANAGEMENT_ENCRYPTION_NONE)
+         {
+            pgagroal_log_error("pgagroal_management_stream_create: Unsupported management encryption code %d", encryption);
+            goto error;
+         }
+         break;
+   }
+
+   switch (compression)
+   {
+      case MANAGEMENT_COMPRESSION_GZIP:
+         if (pgagroal_gzip_stream_create(&s->compressor))
+         {
+            goto error;
+         }
+         break;
+      case MANAGEMENT_COMPRESSION_ZSTD:
+         if (pgagroal_zstd_stream_create(&s->compressor))
+         {
+            goto error;
+         }
+         break;
+      case MANAGEMENT_COMPRESSION_BZIP2:
+         if (pgagroal_bzip2_stream_create(&s->compressor))
+         {
+            goto error;
+         }
+         break;
+      default:
+         /* LZ4 uses the block format, so the text is kept until the stream is sent */
+         break;
+   }
+
+   *stream = s;
+
+   return 0;
+
+error:
+
+   pgagroal_management_stream_destroy(s);
+
+   return 1;
+}
+
+int
+pgagroal_management_stream_write(struct management_stream* stream, char* data, size_t length)
+{
+   switch (stream->compression)
+   {
+      case MANAGEMENT_COMPRESSION_GZIP:
+         return pgagroal_gzip_stream_compress(stream->compressor, data, length, false, &stream->data, &stream->size, &stream->length);
+      case MANAGEMENT_COMPRESSION_ZSTD:
+         return pgagroal_zstd_stream_compress(stream->compressor, data, length, false, &stream->data, &stream->size, &stream->length);
+      case MANAGEMENT_COMPRESSION_BZIP2:
+         return pgagroal_bzip2_stream_compress(stream->compressor, data, length, false, &stream->data, &stream->size, &stream->length);
+      default:
+         break;
+   }
+
+   if (pgagroal_buffer_reserve(&stream->data, &stream->size, stream->length + length + 1))
+   {
+      pgagroal_log_error("pgagroal_management_stream_write: Allocation failed");
+      return 1;
+   }
+
+   memcpy(stream->data + stream->length, data, length);
+   stream->length += length;
+   stream->data[stream->length] = '\0';
+
+   return 0;
+}
+
+int
+pgagroal_management_stream_send(SSL* ssl, int socket, struct management_stream* stream)
+{
+   int ret = 0;
    unsigned char* compressed_buffer = NULL;
-   unsigned char* encrypted_buffer = NULL;
-   char* encoded = NULL;
-   size_t transfer_size = 0;
    size_t compressed_size = 0;
-   size_t encrypted_size = 0;
+   unsigned char prefix[PBKDF2_SALT_LENGTH + PBKDF2_IV_LENGTH];
+   unsigned char tag[GCM_TAG_LENGTH];
+   unsigned char chunk[MANAGEMENT_STREAM_CHUNK];
+   unsigned char carry[3];
+   size_t carry_length = 0;
+   size_t raw_size = 0;
    size_t encoded_size = 0;
+   char buf4[4] = {0};
+   EVP_CIPHER_CTX* ctx = NULL;
+
+   switch (stream->compression)
+   {
+      case MANAGEMENT_COMPRESSION_GZIP:
+         ret = pgagroal_gzip_stream_compress(stream->compressor, NULL, 0, true, &stream->data, &stream->size, &stream->length);
+         break;
+      case MANAGEMENT_COMPRESSION_ZSTD:
+         ret = pgagroal_zstd_stream_compress(stream->compressor, NULL, 0, true, &stream->data, &stream->size, &stream->length);
+         break;
+      case MANAGEMENT_COMPRESSION_BZIP2:
+         ret = pgagroal_bzip2_stream_compress(stream->compressor, NULL, 0, true, &stream->data, &stream->size, &stream->length);
+         break;
+      case MANAGEMENT_COMPRESSION_LZ4:
+         ret = pgagroal_lz4c_string(stream->data != NULL ? (char*)stream->data : "", &compressed_buffer, &compressed_size);
+         if (ret == 0)
+         {
+            free(stream->data);
+            stream->data = compressed_buffer;
+            stream->size = compressed_size;
+            stream->length = compressed_size;
+         }
+         break;
+      default:
+         break;
+   }
 
-   s = pgagroal_json_to_string(json, FORMAT_JSON_COMPACT, NULL, 0);
+   if (ret)
+   {
+      pgagroal_log_error("pgagroal_management_stream_send: Failed to compress (compression=%d)", stream->compression);
+      goto error;
+   }
 
-   if (write_uint8("pgagroal-cli", ssl, socket, compression))
+   if (write_uint8("pgagroal-cli", ssl, socket, stream->compression))
    {
       goto error;
    }
 
-   if (write_uint8("pgagroal-cli", ssl, socket, encryption))
+   if (write_uint8("pgagroal-cli", ssl, socket, stream->encryption))
    {
       goto error;
    }
 
-   if (compression || encryption)
+   if (!stream->compression && !stream->encryption)
    {
-      // First, perform compress
-      switch (compression)
-      {
-         case MANAGEMENT_COMPRESSION_GZIP:
-            if (pgagroal_gzip_string(s, &compressed_buffer, &compressed_size))
-            {
-               pgagroal_log_error("pgagroal_management_write_json: Failed to gzip the string");
-               goto error;
-            }
-            transfer_buffer = compressed_buffer;
-            transfer_size = compressed_size;
+      /* The raw text is kept terminated */
+      return write_string("pgagroal-cli", ssl, socket, (char*)stream->data);
+   }
 
-            free(s);
-            compressed_buffer = NULL;
-            s = NULL;
-            break;
-         case MANAGEMENT_COMPRESSION_ZSTD:
-            if (pgagroal_zstdc_string(s, &compressed_buffer, &compressed_size))
-            {
-               pgagroal_log_error("pgagroal_management_write_json: Failed to zstd the string");
-               goto error;
-            }
-            transfer_buffer = compressed_buffer;
-            transfer_size = compressed_size;
+   /* GCM keeps the size, so the length of the encoding is known before anything is encrypted */
+   raw_size = stream->length;
+   if (stream->mode != 0)
+   {
+      raw_size += sizeof(prefix) + sizeof(tag);
+   }
+   encoded_size = 4 * ((raw_size + 2) / 3);
 
-            free(s);
-            compressed_buffer = NULL;
-            s = NULL;
-            break;
-         case MANAGEMENT_COMPRESSION_LZ4:
-            if (pgagroal_lz4c_string(s, &compressed_buffer, &compressed_size))
-            {
-               pgagroal_log_error("pgagroal_management_write_json: Failed to lz4 the string");
-               goto error;
-            }
-            transfer_buffer = compressed_buffer;
-            transfer_size = compressed_size;
+   if (encoded_size > UINT32_MAX)
+   {
+      pgagroal_log_error("pgagroal_management_stream_send: Response too large (%zu)", encoded_size);
+      goto error;
+   }
 
-            free(s);
-            compressed_buffer = NULL;
-            s = NULL;
-            break;
-         case MANAGEMENT_COMPRESSION_BZIP2:
-            if (pgagroal_bzip2_string(s, &compressed_buffer, &compressed_size))
-            {
-               pgagroal_log_error("pgagroal_management_write_json: Failed to bzip2 the string");
-               goto error;
-            }
-            transfer_buffer = compressed_buffer;
-            transfer_size = compressed_size;
+   pgagroal_write_uint32(&buf4, (uint32_t)encoded_size);
+   if (write_complete(ssl, socket, &buf4, sizeof(buf4)))
+   {
+      goto socket_error;
+   }
 
-            free(s);
-            compressed_buffer = NULL;
-            s = NULL;
-            break;
-         default:
-            transfer_buffer = (unsigned char*)s;
-            transfer_size = strlen(s);
-            s = NULL;
-            break;
+   if (stream->mode != 0)
+   {
+      if (pgagroal_encrypt_stream_create(stream->mode, prefix, &ctx))
+      {
+         pgagroal_log_error("pgagroal_management_stream_send: Encryption failed (encryption=%d, mode=%d)", stream->encryption, stream->mode);
+         goto error;
       }
 
-      // Second, perform encrypt
-      int mode = 0;
-      switch (encryption)
+      if (stream_encode(ssl, socket, carry, &carry_length, prefix, sizeof(prefix)))
       {
-         case MANAGEMENT_ENCRYPTION_AES256_GCM:
-            mode = ENCRYPTION_AES_256_GCM;
-            break;
-         case MANAGEMENT_ENCRYPTION_AES192_GCM:
-            mode = ENCRYPTION_AES_192_GCM;
-            break;
-         case MANAGEMENT_ENCRYPTION_AES128_GCM:
-            mode = ENCRYPTION_AES_128_GCM;
-            break;
-         default:
-            if (encryption != MANAGEMENT_ENCRYPTION_NONE)
-            {
-               pgagroal_log_error("pgagroal_management_write_json: Unsupported management encryption code %d", encryption);
-               goto error;
-            }
-            break;
+         goto socket_error;
       }
+   }
 
-      if (mode != 0)
+   for (size_t offset = 0; offset < stream->length; offset += MANAGEMENT_STREAM_CHUNK)
+   {
+      size_t n = MIN(stream->length - offset, (size_t)MANAGEMENT_STREAM_CHUNK);
+      unsigned char* piece = stream->data + offset;
+
+      if (ctx != NULL)
       {
-         if (pgagroal_encrypt_buffer(transfer_buffer, transfer_size, &encrypted_buffer, &encrypted_size, mode))
+         if (pgagroal_encrypt_stream_update(ctx, piece, n, chunk))
          {
-            pgagroal_log_error("pgagroal_management_write_json: Encryption failed (encryption=%d, mode=%d)", encryption, mode);
             goto error;
          }
-         free(transfer_buffer);
-         transfer_buffer = encrypted_buffer;
-         transfer_size = encrypted_size;
-         encrypted_buffer = NULL;
+         piece = chunk;
       }
 
-      // Third, perform base64 encode
-      if (pgagroal_base64_encode(transfer_buffer, transfer_size, &encoded, &encoded_size) != 0)
+      if (stream_encode(ssl, socket, carry, &carry_length, piece, n))
+      {
+         goto socket_error;
+      }
+   }
+
+   if (ctx != NULL)
+   {
+      if (pgagroal_encrypt_stream_finish(ctx, tag))
       {
-         pgagroal_log_error("pgagroal_management_write_json: Encoding failed");
          goto error;
       }
 
-      free(transfer_buffer);
-      s = encoded;
-      encoded = NULL;
+      if (stream_encode(ssl, socket, carry, &carry_length, tag, sizeof(tag)))
+      {
+         goto socket_error;
+      }
    }
 
-   if (write_string("pgagroal-cli", ssl, socket, s))
+   if (carry_length > 0)
    {
-      goto error;
+      int n = EVP_EncodeBlock(chunk, carry, carry_length);
+
+      if (write_complete(ssl, socket, chunk, n))
+      {
+         goto socket_error;
+      }
    }
 
-   free(s);
+   pgagroal_encrypt_stream_destroy(ctx);
 
    return 0;
 
+socket_error:
+
+   pgagroal_log_warn("pgagroal_management_stream_send: %p %d %s", ssl, socket, strerror(errno));
+   errno = 0;
+
 error:
-   if (s != NULL)
-   {
-      free(s);
-   }
-   if (transfer_buffer != NULL)
-   {
-      free(transfer_buffer);
-   }
-   if (compressed_buffer != NULL)
+
+   pgagroal_encrypt_stream_destroy(ctx);
+
+   return 1;
+}
+
+void
+pgagroal_management_stream_destroy(struct management_stream* stream)
+{
+   if (stream == NULL)
    {
-      free(compressed_buffer);
+      return;
    }
-   if (encrypted_buffer != NULL)
+
+   switch (stream->compression)
    {
-      free(encrypted_buffer);
+      case MANAGEMENT_COMPRESSION_GZIP:
+         pgagroal_gzip_stream_destroy(stream->compressor);
+         break;
+      case MANAGEMENT_COMPRESSION_ZSTD:
+         pgagroal_zstd_stream_destroy(stream->compressor);
+         break;
+      case MANAGEMENT_COMPRESSION_BZIP2:
+         pgagroal_bzip2_stream_destroy(stream->compressor);
+         break;
+      default:
+         break;
    }
-   if (encoded != NULL)
+
+   free(stream->data);
+   free(stream);
+}
+
+static int
+stream_encode(SSL* ssl, int socket, unsigned char* carry, size_t* carry_length, unsigned char* data, size_t length)
+{
+   unsigned char in[MANAGEMENT_STREAM_CHUNK];
+   unsigned char out[MANAGEMENT_STREAM_CHUNK / 3 * 4 + 1];
+
+   /* Only whole groups of three bytes are encoded, the rest waits for the next piece */
+   while (length > 0)
    {
-      free(encoded);
+      size_t n = *carry_length;
+      size_t take = MIN(length, sizeof(in) - n);
+      size_t whole;
+      int encoded;
+
+      memcpy(in, carry, n);
+      memcpy(in + n, data, take);
+      data += take;
+      length -= take;
+      n += take;
+
+      whole = n - n % 3;
+      if (whole > 0)
+      {
+         encoded = EVP_EncodeBlock(out, in, whole);
+         if (write_complete(ssl, socket, out, encoded))
+         {
+            return 1;
+         }
+      }
+
+      *carry_length = n - whole;
+      memcpy(carry, in + whole, *carry_length);
    }
 
-   return 1;
+   return 0;
 }
 
 static int
@@ -1578,8 +1949,12 @@ write_socket(int socket, void* buf, size_t size)
          switch (errno)
          {
             case EAGAIN:
-               keep_write = true;
-               errno = 0;
+               /* A blocking socket only fails that way when its send timeout expired */
+               keep_write = (fcntl(socket, F_GETFL) & O_NONBLOCK) != 0;
+               if (keep_write)
+               {
+                  errno = 0;
+               }
                break;
             default:
                keep_write = false;
@@ -40,12 +40,39 @@
 #include <assert.h>
 #endif
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define MEMORY_CLASSES 3
+
+struct memory_block
+{
+   struct memory_block* next; /**< The next cached block */
+   int size_class;            /**< The size class, or -1 when not pooled */
+   struct message message;    /**< The message, followed by its data */
+};
+
+struct memory_class
+{
+   size_t size;               /**< The data size of the blocks */
+   int cached;                /**< The number of cached blocks */
+   struct memory_block* free; /**< The cached blocks */
+};
+
 static struct message* message = NULL;
 static void* data = NULL;
 
+static struct memory_class classes[MEMORY_CLASSES] = {
+   {MEMORY_SMALL_SIZE, 0, NULL},
+   {MEMORY_MEDIUM_SIZE, 0, NULL},
+   {MEMORY_LARGE_SIZE, 0, NULL}
+};
+static uint64_t pool_hits = 0;
+static uint64_t pool_misses = 0;
+
+static int memory_size_class(size_t size);
+
 /**
  *
  */
@@ -116,8 +143,17 @@ pgagroal_memory_free(void)
    assert(data != NULL);
 #endif
 
+   /* Only clear what the last message used, so an idle process doesn't touch
+    * the whole buffer on every message */
+   if (message->length > 0 && message->length <= DEFAULT_BUFFER_SIZE && message->data == data)
+   {
+      memset(data, 0, message->length);
+   }
+   else
+   {
+      memset(data, 0, DEFAULT_BUFFER_SIZE);
+   }
    memset(message, 0, sizeof(struct message));
-   memset(data, 0, DEFAULT_BUFFER_SIZE);
 
    message->kind = 0;
    message->length = 0;
@@ -130,9 +166,119 @@ pgagroal_memory_free(void)
 void
 pgagroal_memory_destroy(void)
 {
+   struct memory_block* block = NULL;
+
    free(data);
    free(message);
 
    data = NULL;
    message = NULL;
+
+   for (int i = 0; i < MEMORY_CLASSES; i++)
+   {
+      while (classes[i].free != NULL)
+      {
+         block = classes[i].free;
+         classes[i].free = block->next;
+         free(block);
+      }
+      classes[i].cached = 0;
+   }
+}
+
+/**
+ *
+ */
+struct message*
+pgagroal_memory_message_alloc(size_t size, bool zero)
+{
+   int sc;
+   struct memory_block* block = NULL;
+
+   sc = memory_size_class(size);
+
+   if (sc != -1 && classes[sc].free != NULL)
+   {
+      block = classes[sc].free;
+      classes[sc].free = block->next;
+      classes[sc].cached--;
+      pool_hits++;
+   }
+   else
+   {
+      block = (struct memory_block*)malloc(sizeof(struct memory_block) + (sc != -1 ? classes[sc].size : size));
+      if (block == NULL)
+      {
+         pgagroal_log_fatal("Unable to allocate memory");
+         return NULL;
+      }
+      pool_misses++;
+   }
+
+   block->next = NULL;
+   block->size_class = sc;
+
+   memset(&block->message, 0, sizeof(struct message));
+   block->message.data = (void*)(block + 1);
+
+   if (zero)
+   {
+      memset(block->message.data, 0, size);
+   }
+
+   return &block->message;
+}
+
+/**
+ *
+ */
+void
+pgagroal_memory_message_release(struct message* msg)
+{
+   struct memory_block* block = NULL;
+
+   if (msg == NULL)
+   {
+      return;
+   }
+
+   block = (struct memory_block*)((char*)msg - offsetof(struct memory_block, message));
+
+#ifdef DEBUG
+   assert(msg->data == (void*)(block + 1));
+#endif
+
+   if (block->size_class == -1 || classes[block->size_class].cached >= MEMORY_CACHED_BLOCKS)
+   {
+      free(block);
+      return;
+   }
+
+   block->next = classes[block->size_class].free;
+   classes[block->size_class].free = block;
+   classes[block->size_class].cached++;
+}
+
+/**
+ *
+ */
+void
+pgagroal_memory_stats(uint64_t* hits, uint64_t* misses)
+{
+   *hits = pool_hits;
+   *misses = pool_misses;
+}
+
+static int
+memory_size_class(size_t size)
+{
+   for (int i = 0; i < MEMORY_CLASSES; i++)
+   {
+      if (size <= classes[i].size)
+      {
+         return i;
+      }
+   }
+
+   return -1;
 }
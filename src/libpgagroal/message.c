@@ -33,6 +33,7 @@
 #include <memory.h>
 #include <message.h>
 #include <network.h>
+#include <prometheus.h>
 #include <shmem.h>
 #include <tls.h>
 #include <utils.h>
@@ -40,14 +41,64 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 
 static int read_message(int socket, bool block, int timeout, struct message** msg);
 static int write_message(int socket, struct message* msg);
+static int write_message_flags(int socket, struct message* msg, int flags, int timeout);
+static bool wait_writable(int socket, int timeout, struct timespec* start, bool* blocked);
+static bool more_to_forward(struct io_watcher* watcher, struct message* msg);
+static bool stream_wants(char* kinds, signed char kind);
+static int write_constant(SSL* ssl, int socket, const char* data, size_t size);
+
+/* The microseconds this process waited for a peer to read what it was sent */
+static long long write_blocked = 0;
+
+/* Protocol messages that never change are built at compile time. A string
+ * literal's own terminator is the last byte of the message */
+static const char pool_full_message[] = "E\0\0\0\x32"
+                                        "SFATAL\0VFATAL\0C53300\0Mconnection pool is full";
+static const char no_transaction_blocks_message[] = "E\0\0\0\x58"
+                                                    "SFATAL\0VFATAL\0C0A000\0Mtransaction blocks are not allowed in the statement pipeline\0";
+static const char idle_transaction_timeout_message[] = "E\0\0\0\x55"
+                                                       "SFATAL\0VFATAL\0C25P03\0Mterminating connection due to idle-in-transaction timeout\0";
+static const char idle_transaction_rollback_message[] = "E\0\0\0\x5e"
+                                                        "SERROR\0VERROR\0C25P03\0Mthe transaction was rolled back due to idle-in-transaction timeout\0\0"
+                                                        "Z\0\0\0\x05"
+                                                        "E";
+static const char notify_unavailable_message[] = "E\0\0\0\x43"
+                                                 "SERROR\0VERROR\0C55000\0Mthe notification relay is not available\0\0"
+                                                 "Z\0\0\0\x05"
+                                                 "I";
+static const char listen_complete_message[] = "C\0\0\0\x0b"
+                                              "LISTEN\0"
+                                              "Z\0\0\0\x05"
+                                              "I";
+static const char unlisten_complete_message[] = "C\0\0\0\x0d"
+                                                "UNLISTEN\0"
+                                                "Z\0\0\0\x05"
+                                                "I";
+static const char connection_refused_message[] = "E\0\0\0\x2d"
+                                                 "SFATAL\0VFATAL\0C53300\0Mconnection refused";
+static const char connection_refused_old_message[] = "Econnection refused";
+static const char deallocate_all_message[] = "Q\0\0\0\x14"
+                                             "DEALLOCATE ALL;";
+static const char discard_all_message[] = "Q\0\0\0\x11"
+                                          "DISCARD ALL;";
+static const char rollback_message[] = "Q\0\0\0\x0e"
+                                       "ROLLBACK;";
+static const char client_failover_message[] = "E\0\0\0\x38"
+                                              "SFATAL\0VFATAL\0C53300\0Mserver failover\0Rauth_failed\0";
+static const char terminate_message[] = {'X', 0, 0, 0, 4};
+static const char auth_password_message[] = {'R', 0, 0, 0, 8, 0, 0, 0, 3};
+static const char auth_success_message[] = {'R', 0, 0, 0, 8, 0, 0, 0, 0};
 
 static int ssl_read_message(SSL* ssl, int timeout, struct message** msg);
 static int ssl_write_message(SSL* ssl, struct message* msg);
@@ -255,6 +306,8 @@ pgagroal_recv_message(struct io_watcher* watcher, struct message** msg)
 
    int rfd = watcher->fds.worker.rcv_fd;
 
+   pgagroal_prometheus_local_read_add(rfd == wi->client_fd);
+
    /* Use the correct TLS context for the receiving endpoint */
    if (rfd == wi->client_fd && wi->client_ssl != NULL)
    {
@@ -277,9 +330,14 @@ pgagroal_send_message(struct io_watcher* watcher, struct message* msg)
 {
    struct main_configuration* config = (struct main_configuration*)shmem;
    struct worker_io* wi = (struct worker_io*)watcher;
+   long long blocked = write_blocked;
+   int timeout = -1;
+   int status;
 
    int sfd = watcher->fds.worker.snd_fd;
 
+   pgagroal_prometheus_local_write_add(sfd == wi->client_fd);
+
    /* Use the correct TLS context for the sending endpoint */
    if (sfd == wi->client_fd && wi->client_ssl != NULL)
    {
@@ -292,7 +350,28 @@ pgagroal_send_message(struct io_watcher* watcher, struct message* msg)
 
    if (config->ev_backend != PGAGROAL_EVENT_BACKEND_IO_URING)
    {
-      return write_message(sfd, msg);
+      if (pgagroal_time_is_valid(config->write_timeout))
+      {
+         timeout = (int)pgagroal_time_convert(config->write_timeout, FORMAT_TIME_S) * 1000;
+      }
+
+#ifdef MSG_MORE
+      if (config->coalesce_writes && more_to_forward(watcher, msg))
+      {
+         status = write_message_flags(sfd, msg, MSG_MORE, timeout);
+      }
+      else
+#endif
+      {
+         status = write_message_flags(sfd, msg, 0, timeout);
+      }
+
+      if (unlikely(write_blocked != blocked))
+      {
+         pgagroal_prometheus_local_write_blocked_add(sfd == wi->client_fd, write_blocked - blocked);
+      }
+
+      return status;
    }
    return write_message_from_buffer(watcher, msg);
 }
@@ -314,19 +393,12 @@ pgagroal_create_message(void* data, ssize_t length, struct message** msg)
 {
    struct message* copy = NULL;
 
-   copy = (struct message*)malloc(sizeof(struct message));
+   copy = pgagroal_memory_message_alloc(length, false);
    if (copy == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating message");
       return MESSAGE_STATUS_ERROR;
    }
-   copy->data = malloc(length);
-   if (copy->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating message");
-      free(copy);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    copy->kind = pgagroal_read_byte(data);
    copy->length = length;
@@ -354,21 +426,13 @@ pgagroal_copy_message(struct message* msg)
    assert(msg->length > 0);
 #endif
 
-   copy = (struct message*)malloc(sizeof(struct message));
+   copy = pgagroal_memory_message_alloc(msg->length, false);
    if (copy == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while copying message");
       return NULL;
    }
 
-   copy->data = malloc(msg->length);
-   if (copy->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while copying message");
-      free(copy);
-      return NULL;
-   }
-
    copy->kind = msg->kind;
    copy->length = msg->length;
    memcpy(copy->data, msg->data, msg->length);
@@ -379,19 +443,96 @@ pgagroal_copy_message(struct message* msg)
 void
 pgagroal_free_message(struct message* msg)
 {
-   if (msg)
+   pgagroal_memory_message_release(msg);
+}
+
+bool
+pgagroal_message_stream_next(struct message_stream* stream, struct message* msg, int* offset, char* kinds, struct message_frame* frame)
+{
+   int n;
+   int32_t length;
+   char* data = (char*)msg->data;
+   int end = (int)msg->length;
+
+   while (true)
    {
-      if (msg->data)
+      if (stream->header_length == MESSAGE_HEADER_SIZE)
       {
-         free(msg->data);
-         msg->data = NULL;
+         /* Wait for the first body byte, so the body always starts in the chunk */
+         if (stream->remaining > 0 && *offset >= end)
+         {
+            return false;
+         }
+
+         stream->header_length = 0;
+
+         if (stream_wants(kinds, stream->kind))
+         {
+            frame->kind = stream->kind;
+            frame->length = stream->remaining + 4;
+            frame->body = data + *offset;
+            frame->available = MIN(stream->remaining, end - *offset);
+
+            stream->remaining -= frame->available;
+            *offset += frame->available;
+
+            return true;
+         }
       }
 
-      free(msg);
-      msg = NULL;
+      if (stream->remaining > 0)
+      {
+         n = MIN(stream->remaining, end - *offset);
+         stream->remaining -= n;
+         *offset += n;
+      }
+
+      /* Step over whole messages in the chunk that aren't requested */
+      while (stream->header_length == 0 && stream->remaining == 0 && *offset + MESSAGE_HEADER_SIZE <= end)
+      {
+         stream->kind = (signed char)data[*offset];
+         length = pgagroal_read_int32(data + *offset + 1);
+         length = length > 4 ? length : 4;
+
+         if (stream_wants(kinds, stream->kind) || *offset + 1 + length > end)
+         {
+            break;
+         }
+
+         *offset += 1 + length;
+      }
+
+      if (*offset >= end)
+      {
+         return false;
+      }
+
+      n = MIN(MESSAGE_HEADER_SIZE - stream->header_length, end - *offset);
+      memcpy(&stream->header[stream->header_length], data + *offset, n);
+      stream->header_length += n;
+      *offset += n;
+
+      if (stream->header_length == MESSAGE_HEADER_SIZE)
+      {
+         stream->kind = (signed char)stream->header[0];
+         length = pgagroal_read_int32(&stream->header[1]);
+         stream->remaining = length > 4 ? length - 4 : 0;
+      }
    }
 }
 
+bool
+pgagroal_message_stream_ready(struct message_stream* stream)
+{
+   return stream->header_length == 0 && stream->remaining == 0 && stream->kind == 'Z';
+}
+
+bool
+pgagroal_message_stream_partial(struct message_stream* stream)
+{
+   return stream->header_length != 0 || stream->remaining != 0;
+}
+
 int
 pgagroal_write_empty(SSL* ssl, int socket)
 {
@@ -462,84 +603,55 @@ pgagroal_write_tls(SSL* ssl, int socket)
 int
 pgagroal_write_pool_full(SSL* ssl, int socket)
 {
-   int size = 51;
-   char pool_full[size];
-   struct message msg;
+   return write_constant(ssl, socket, pool_full_message, sizeof(pool_full_message));
+}
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&pool_full, 0, sizeof(pool_full));
+int
+pgagroal_write_no_transaction_blocks(SSL* ssl, int socket)
+{
+   return write_constant(ssl, socket, no_transaction_blocks_message, sizeof(no_transaction_blocks_message));
+}
 
-   pgagroal_write_byte(&pool_full, 'E');
-   pgagroal_write_int32(&(pool_full[1]), size - 1);
-   pgagroal_write_string(&(pool_full[5]), "SFATAL");
-   pgagroal_write_string(&(pool_full[12]), "VFATAL");
-   pgagroal_write_string(&(pool_full[19]), "C53300");
-   pgagroal_write_string(&(pool_full[26]), "Mconnection pool is full");
+int
+pgagroal_write_idle_transaction_timeout(SSL* ssl, int socket)
+{
+   return write_constant(ssl, socket, idle_transaction_timeout_message, sizeof(idle_transaction_timeout_message));
+}
 
-   msg.kind = 'E';
-   msg.length = size;
-   msg.data = &pool_full;
+int
+pgagroal_write_idle_transaction_rollback(SSL* ssl, int socket)
+{
+   /* The ReadyForQuery message ends the constant, so its terminator isn't sent */
+   return write_constant(ssl, socket, idle_transaction_rollback_message, sizeof(idle_transaction_rollback_message) - 1);
+}
 
-   if (ssl == NULL)
+int
+pgagroal_write_notify_unavailable(SSL* ssl, int socket)
+{
+   return write_constant(ssl, socket, notify_unavailable_message, sizeof(notify_unavailable_message) - 1);
+}
+
+int
+pgagroal_write_listen_complete(SSL* ssl, int socket, bool listen)
+{
+   if (listen)
    {
-      return write_message(socket, &msg);
+      return write_constant(ssl, socket, listen_complete_message, sizeof(listen_complete_message) - 1);
    }
 
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, unlisten_complete_message, sizeof(unlisten_complete_message) - 1);
 }
 
 int
 pgagroal_write_connection_refused(SSL* ssl, int socket)
 {
-   int size = 46;
-   char connection_refused[size];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&connection_refused, 0, sizeof(connection_refused));
-
-   pgagroal_write_byte(&connection_refused, 'E');
-   pgagroal_write_int32(&(connection_refused[1]), size - 1);
-   pgagroal_write_string(&(connection_refused[5]), "SFATAL");
-   pgagroal_write_string(&(connection_refused[12]), "VFATAL");
-   pgagroal_write_string(&(connection_refused[19]), "C53300");
-   pgagroal_write_string(&(connection_refused[26]), "Mconnection refused");
-
-   msg.kind = 'E';
-   msg.length = size;
-   msg.data = &connection_refused;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, connection_refused_message, sizeof(connection_refused_message));
 }
 
 int
 pgagroal_write_connection_refused_old(SSL* ssl, int socket)
 {
-   int size = 20;
-   char connection_refused[size];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&connection_refused, 0, sizeof(connection_refused));
-
-   pgagroal_write_byte(&connection_refused, 'E');
-   pgagroal_write_string(&(connection_refused[1]), "connection refused");
-
-   msg.kind = 'E';
-   msg.length = size;
-   msg.data = &connection_refused;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, connection_refused_old_message, sizeof(connection_refused_old_message));
 }
 
 int
@@ -668,31 +780,9 @@ int
 pgagroal_write_deallocate_all(SSL* ssl, int socket)
 {
    int status;
-   int size = 21;
-
-   char deallocate[size];
-   struct message msg;
    struct message* reply = NULL;
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&deallocate, 0, sizeof(deallocate));
-
-   pgagroal_write_byte(&deallocate, 'Q');
-   pgagroal_write_int32(&(deallocate[1]), size - 1);
-   pgagroal_write_string(&(deallocate[5]), "DEALLOCATE ALL;");
-
-   msg.kind = 'Q';
-   msg.length = size;
-   msg.data = &deallocate;
-
-   if (ssl == NULL)
-   {
-      status = write_message(socket, &msg);
-   }
-   else
-   {
-      status = ssl_write_message(ssl, &msg);
-   }
+   status = write_constant(ssl, socket, deallocate_all_message, sizeof(deallocate_all_message));
    if (status != MESSAGE_STATUS_OK)
    {
       goto error;
@@ -733,31 +823,9 @@ int
 pgagroal_write_discard_all(SSL* ssl, int socket)
 {
    int status;
-   int size = 18;
-
-   char discard[size];
-   struct message msg;
    struct message* reply = NULL;
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&discard, 0, sizeof(discard));
-
-   pgagroal_write_byte(&discard, 'Q');
-   pgagroal_write_int32(&(discard[1]), size - 1);
-   pgagroal_write_string(&(discard[5]), "DISCARD ALL;");
-
-   msg.kind = 'Q';
-   msg.length = size;
-   msg.data = &discard;
-
-   if (ssl == NULL)
-   {
-      status = write_message(socket, &msg);
-   }
-   else
-   {
-      status = ssl_write_message(ssl, &msg);
-   }
+   status = write_constant(ssl, socket, discard_all_message, sizeof(discard_all_message));
    if (status != MESSAGE_STATUS_OK)
    {
       goto error;
@@ -801,111 +869,28 @@ error:
 int
 pgagroal_write_terminate(SSL* ssl, int socket)
 {
-   char terminate[5];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&terminate, 0, sizeof(terminate));
-
-   terminate[0] = 'X';
-   terminate[4] = 4;
-
-   msg.kind = 'X';
-   msg.length = 5;
-   msg.data = &terminate;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, terminate_message, sizeof(terminate_message));
 }
 
 int
 pgagroal_write_client_failover(SSL* ssl, int socket)
 {
-   int size = 57;
-   char failover[size];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&failover, 0, sizeof(failover));
-
-   pgagroal_write_byte(&failover, 'E');
-   pgagroal_write_int32(&(failover[1]), size - 1);
-   pgagroal_write_string(&(failover[5]), "SFATAL");
-   pgagroal_write_string(&(failover[12]), "VFATAL");
-   pgagroal_write_string(&(failover[19]), "C53300");
-   pgagroal_write_string(&(failover[26]), "Mserver failover");
-   pgagroal_write_string(&(failover[43]), "Rauth_failed");
-
-   msg.kind = 'E';
-   msg.length = size;
-   msg.data = &failover;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, client_failover_message, sizeof(client_failover_message));
 }
 
 int
 pgagroal_write_auth_password(SSL* ssl, int socket)
 {
-   char password[9];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&password, 0, sizeof(password));
-
-   password[0] = 'R';
-   pgagroal_write_int32(&(password[1]), 8);
-   pgagroal_write_int32(&(password[5]), 3);
-
-   msg.kind = 'R';
-   msg.length = 9;
-   msg.data = &password;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, auth_password_message, sizeof(auth_password_message));
 }
 
 int
 pgagroal_write_rollback(SSL* ssl, int socket)
 {
    int status;
-   int size = 15;
-
-   char rollback[size];
-   struct message msg;
    struct message* reply = NULL;
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&rollback, 0, sizeof(rollback));
-
-   pgagroal_write_byte(&rollback, 'Q');
-   pgagroal_write_int32(&(rollback[1]), size - 1);
-   pgagroal_write_string(&(rollback[5]), "ROLLBACK;");
-
-   msg.kind = 'Q';
-   msg.length = size;
-   msg.data = &rollback;
-
-   if (ssl == NULL)
-   {
-      status = write_message(socket, &msg);
-   }
-   else
-   {
-      status = ssl_write_message(ssl, &msg);
-   }
+   status = write_constant(ssl, socket, rollback_message, sizeof(rollback_message));
    if (status != MESSAGE_STATUS_OK)
    {
       goto error;
@@ -944,19 +929,12 @@ pgagroal_create_auth_password_response(char* password, struct message** msg)
 
    size = 6 + strlen(password);
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating auth_password_response");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating auth_password_response");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 'p';
    m->length = size;
@@ -1004,19 +982,12 @@ pgagroal_create_auth_scram256_response(char* nounce, struct message** msg)
 
    size = 1 + 4 + 13 + 4 + 9 + strlen(nounce);
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_response");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_response");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 'p';
    m->length = size;
@@ -1040,20 +1011,12 @@ pgagroal_create_auth_scram256_continue(char* cn, char* sn, char* salt, struct me
 
    size = 1 + 4 + 4 + 2 + strlen(cn) + strlen(sn) + 3 + strlen(salt) + 7;
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_continue");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_continue");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 'R';
    m->length = size;
@@ -1081,21 +1044,13 @@ pgagroal_create_auth_scram256_continue_response(char* wp, char* p, struct messag
 
    size = 1 + 4 + strlen(wp) + 3 + strlen(p);
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_continue_response");
       return MESSAGE_STATUS_ERROR;
    }
 
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_continue_response");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
-
    m->kind = 'p';
    m->length = size;
 
@@ -1118,19 +1073,12 @@ pgagroal_create_auth_scram256_final(char* ss, struct message** msg)
 
    size = 1 + 4 + 4 + 2 + strlen(ss);
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_final");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating auth_scram256_final");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 'R';
    m->length = size;
@@ -1149,26 +1097,7 @@ pgagroal_create_auth_scram256_final(char* ss, struct message** msg)
 int
 pgagroal_write_auth_success(SSL* ssl, int socket)
 {
-   char success[9];
-   struct message msg;
-
-   memset(&msg, 0, sizeof(struct message));
-   memset(&success, 0, sizeof(success));
-
-   success[0] = 'R';
-   pgagroal_write_int32(&(success[1]), 8);
-   pgagroal_write_int32(&(success[5]), 0);
-
-   msg.kind = 'R';
-   msg.length = 9;
-   msg.data = &success;
-
-   if (ssl == NULL)
-   {
-      return write_message(socket, &msg);
-   }
-
-   return ssl_write_message(ssl, &msg);
+   return write_constant(ssl, socket, auth_success_message, sizeof(auth_success_message));
 }
 
 int
@@ -1179,19 +1108,12 @@ pgagroal_create_ssl_message(struct message** msg)
 
    size = 8;
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating ssl_message");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating ssl_message");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 0;
    m->length = size;
@@ -1216,19 +1138,12 @@ pgagroal_create_startup_message(char* username, char* database, struct message**
    ds = strlen(database);
    size = 4 + 4 + 4 + 1 + us + 1 + 8 + 1 + ds + 1 + 17 + 9 + 1;
 
-   m = (struct message*)malloc(sizeof(struct message));
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating startup_message");
       return MESSAGE_STATUS_ERROR;
    }
-   m->data = calloc(1, size);
-   if (m->data == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating startup_message");
-      free(m);
-      return MESSAGE_STATUS_ERROR;
-   }
 
    m->kind = 0;
    m->length = size;
@@ -1255,17 +1170,10 @@ pgagroal_create_cancel_request_message(int pid, int secret, struct message** msg
 
    size = 16;
 
-   m = (struct message*)malloc(sizeof(struct message));
-   if (m == NULL)
-   {
-      pgagroal_log_fatal("Couldn't allocate memory while creating cancel_request_message");
-      return MESSAGE_STATUS_ERROR;
-   }
-   m->data = calloc(1, size);
+   m = pgagroal_memory_message_alloc(size, true);
    if (m == NULL)
    {
       pgagroal_log_fatal("Couldn't allocate memory while creating cancel_request_message");
-      free(m);
       return MESSAGE_STATUS_ERROR;
    }
 
@@ -1437,17 +1345,28 @@ read_message(int socket, bool block, int timeout, struct message** msg)
 
 static int
 write_message(int socket, struct message* msg)
+{
+   return write_message_flags(socket, msg, 0, -1);
+}
+
+static int
+write_message_flags(int socket, struct message* msg, int flags, int timeout)
 {
    bool keep_write;
    ssize_t numbytes;
    int offset;
    ssize_t totalbytes;
    ssize_t remaining;
+   bool blocked = false;
+   struct timespec start;
 
 #ifdef DEBUG
    assert(msg != NULL);
 #endif
 
+   /* Sends deferred by the io_uring loop go out before this one */
+   pgagroal_event_flush_sends();
+
    numbytes = 0;
    offset = 0;
    totalbytes = 0;
@@ -1457,11 +1376,17 @@ write_message(int socket, struct message* msg)
    {
       keep_write = false;
 
-      numbytes = write(socket, msg->data + offset, remaining);
+      /* The write never blocks in the kernel, so the time a peer doesn't read is seen here */
+      numbytes = send(socket, msg->data + offset, remaining, flags | MSG_DONTWAIT);
+      if (unlikely(numbytes == -1 && errno == ENOTSOCK))
+      {
+         errno = 0;
+         numbytes = write(socket, msg->data + offset, remaining);
+      }
 
-      if (likely(numbytes == msg->length))
+      if (likely(numbytes == remaining))
       {
-         return MESSAGE_STATUS_OK;
+         goto done;
       }
       else if (numbytes != -1)
       {
@@ -1469,11 +1394,6 @@ write_message(int socket, struct message* msg)
          totalbytes += numbytes;
          remaining -= numbytes;
 
-         if (totalbytes == msg->length)
-         {
-            return MESSAGE_STATUS_OK;
-         }
-
          pgagroal_log_debug("Write %d - %zd/%zd vs %zd", socket, numbytes, totalbytes, msg->length);
          keep_write = true;
          errno = 0;
@@ -1483,8 +1403,11 @@ write_message(int socket, struct message* msg)
          switch (errno)
          {
             case EAGAIN:
-               keep_write = true;
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
                errno = 0;
+               keep_write = wait_writable(socket, timeout, &start, &blocked);
                break;
             default:
                keep_write = false;
@@ -1494,7 +1417,117 @@ write_message(int socket, struct message* msg)
    }
    while (keep_write);
 
+   if (blocked)
+   {
+      write_blocked += pgagroal_time_elapsed_usec(&start);
+   }
+
    return MESSAGE_STATUS_ERROR;
+
+done:
+
+   if (blocked)
+   {
+      write_blocked += pgagroal_time_elapsed_usec(&start);
+   }
+
+   return MESSAGE_STATUS_OK;
+}
+
+/**
+ * Wait for a socket that is full to be writable again
+ * @param socket The socket
+ * @param timeout The maximum milliseconds to wait since the first wait, or -1 to wait forever
+ * @param start The time of the first wait
+ * @param blocked Has the write waited before
+ * @return True if the write can be retried, otherwise false with errno set to ETIMEDOUT
+ */
+static bool
+wait_writable(int socket, int timeout, struct timespec* start, bool* blocked)
+{
+   int left = -1;
+   struct pollfd pfd;
+
+   if (!*blocked)
+   {
+      clock_gettime(CLOCK_MONOTONIC, start);
+      *blocked = true;
+   }
+
+   if (timeout >= 0)
+   {
+      left = timeout - (int)(pgagroal_time_elapsed_usec(start) / 1000);
+      if (left <= 0)
+      {
+         errno = ETIMEDOUT;
+         return false;
+      }
+   }
+
+   pfd.fd = socket;
+   pfd.events = POLLOUT;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, left) == 0)
+   {
+      errno = ETIMEDOUT;
+      return false;
+   }
+
+   /* An error or a hang up is reported by the next write */
+   errno = 0;
+
+   return true;
+}
+
+static int
+write_constant(SSL* ssl, int socket, const char* data, size_t size)
+{
+   struct message msg;
+
+   msg.kind = (signed char)data[0];
+   msg.length = size;
+   msg.data = (void*)data;
+
+   if (ssl == NULL)
+   {
+      return write_message(socket, &msg);
+   }
+
+   return ssl_write_message(ssl, &msg);
+}
+
+static bool
+stream_wants(char* kinds, signed char kind)
+{
+   if (kinds == NULL)
+   {
+      return true;
+   }
+
+   return kind != 0 && strchr(kinds, kind) != NULL;
+}
+
+static bool
+more_to_forward(struct io_watcher* watcher, struct message* msg)
+{
+   char peek;
+   char* data = (char*)msg->data;
+
+   /* ReadyForQuery ends the response, so it goes out right away */
+   if (msg->length >= 6 && data[msg->length - 6] == 'Z' && pgagroal_read_int32(data + msg->length - 5) == 5)
+   {
+      return false;
+   }
+
+   /* Only hold the segment back when the next read is already queued */
+   if (recv(watcher->fds.worker.rcv_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) > 0)
+   {
+      return true;
+   }
+
+   errno = 0;
+   return false;
 }
 
 static int
@@ -1640,6 +1673,12 @@ ssl_write_message(SSL* ssl, struct message* msg)
       return MESSAGE_STATUS_ERROR;
    }
 
+   /* The kernel encrypts what is written to the socket, so skip the copy into OpenSSL */
+   if (pgagroal_tls_ktls_send(ssl))
+   {
+      return write_message(SSL_get_fd(ssl), msg);
+   }
+
    numbytes = 0;
    offset = 0;
    totalbytes = 0;
@@ -0,0 +1,935 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <connection.h>
+#include <ev.h>
+#include <logging.h>
+#include <memory.h>
+#include <message.h>
+#include <multiplex.h>
+#include <network.h>
+#include <pool.h>
+#include <prepared.h>
+#include <prometheus.h>
+#include <server.h>
+#include <shmem.h>
+#include <tracker.h>
+#include <utils.h>
+#include <worker.h>
+
+/* system */
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MULTIPLEX_RETRY_INTERVAL 10 /* milliseconds */
+
+/** @struct multiplex_client
+ * Defines a client served by a multiplexer
+ */
+struct multiplex_client
+{
+   struct worker_io client;              /**< Receives from the client, sends to the server (always first) */
+   struct worker_io server;              /**< Receives from the server, sends to the client */
+   bool client_active;                   /**< Is the client watcher started */
+   bool server_active;                   /**< Is the server watcher started */
+   bool closed;                          /**< Is the client closed */
+   bool in_tx;                           /**< Is a transaction in progress */
+   bool deallocate;                      /**< Deallocate the prepared statements on return */
+   bool fatal;                           /**< Has the server reported FATAL or PANIC */
+   bool saw_x;                           /**< Has the client sent Terminate */
+   struct message_stream client_stream;  /**< The message boundaries of the client stream */
+   struct message_stream server_stream;  /**< The message boundaries of the server stream */
+   time_t wait_start;                    /**< When the client started to wait for a connection */
+   char username[MAX_USERNAME_LENGTH];   /**< The user name */
+   char database[MAX_DATABASE_LENGTH];   /**< The database */
+   char appname[MAX_APPLICATION_NAME];   /**< The application name */
+   struct multiplex_client* prev;        /**< The previous client */
+   struct multiplex_client* next;        /**< The next client */
+   struct multiplex_client* wait_next;   /**< The next client waiting for a connection */
+};
+
+static void multiplex_client(struct io_watcher* watcher);
+static void multiplex_server(struct io_watcher* watcher);
+static void accept_cb(struct io_watcher* watcher);
+static void shutdown_cb(void);
+static void retry_cb(void);
+static void client_adopt(int client_fd, char* username, char* database, char* appname);
+static bool client_borrow(struct multiplex_client* c);
+static bool client_attach(struct multiplex_client* c, int slot, SSL* ssl);
+static void client_release(struct multiplex_client* c);
+static void client_close(struct multiplex_client* c, int status);
+static void client_wait(struct multiplex_client* c);
+static void client_free(struct multiplex_client* c);
+
+static int unix_socket = -1;
+static char socket_name[MISC_LENGTH];
+static int fds[MAX_NUMBER_OF_CONNECTIONS];
+static struct multiplex_client* owners[MAX_NUMBER_OF_CONNECTIONS];
+static struct multiplex_client* clients = NULL;
+static struct multiplex_client* waiting = NULL;
+static struct multiplex_client* waiting_tail = NULL;
+static struct multiplex_client* closing = NULL;
+static struct multiplex_client* reclaim = NULL;
+static int number_of_clients = 0;
+
+void
+pgagroal_multiplex(int index, char** argv)
+{
+   struct event_loop* loop = NULL;
+   struct io_watcher io_mgt;
+   struct signal_info signal_watcher;
+   struct periodic_watcher retry_watcher;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_set_proc_title(1, argv, "multiplexer", NULL);
+
+   /* The server descriptors inherited from the main process */
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      fds[i] = config->connections[i].fd;
+      owners[i] = NULL;
+   }
+
+   memset(&socket_name, 0, sizeof(socket_name));
+   pgagroal_snprintf(&socket_name[0], sizeof(socket_name), "%s.%d", MAIN_UDS, (int)getpid());
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &socket_name[0], &unix_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &socket_name[0], config->common.port);
+      exit(1);
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal_multiplex: Failed to create loop");
+      exit(1);
+   }
+
+   memset(&io_mgt, 0, sizeof(struct io_watcher));
+   pgagroal_event_accept_init(&io_mgt, unix_socket, accept_cb);
+   pgagroal_io_start(&io_mgt);
+
+   pgagroal_signal_init(&signal_watcher.sig_w, shutdown_cb, SIGQUIT);
+   signal_watcher.slot = -1;
+   pgagroal_signal_start(&signal_watcher.sig_w);
+
+   pgagroal_periodic_init(&retry_watcher, retry_cb, MULTIPLEX_RETRY_INTERVAL, MULTIPLEX_RETRY_INTERVAL);
+   pgagroal_periodic_start(&retry_watcher);
+
+   pgagroal_log_debug("pgagroal_multiplex: Multiplexer %d (PID %d)", index, (int)getpid());
+
+   pgagroal_event_loop_run();
+
+   while (clients != NULL)
+   {
+      client_close(clients, WORKER_SHUTDOWN);
+   }
+
+   while (closing != NULL)
+   {
+      struct multiplex_client* c = closing;
+      closing = c->next;
+      client_free(c);
+   }
+
+   while (reclaim != NULL)
+   {
+      struct multiplex_client* c = reclaim;
+      reclaim = c->next;
+      client_free(c);
+   }
+
+   pgagroal_periodic_stop(&retry_watcher);
+   pgagroal_prometheus_local_publish();
+   pgagroal_io_stop(&io_mgt);
+   pgagroal_disconnect(unix_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &socket_name[0]);
+   errno = 0;
+
+   pgagroal_event_loop_destroy();
+
+   pgagroal_prometheus_memory_pool_add();
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+}
+
+int
+pgagroal_multiplex_hand_off(int client_fd, int slot)
+{
+   int fd = -1;
+   pid_t pid;
+   struct connection_info* info = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->multiplex_workers <= 0)
+   {
+      goto error;
+   }
+
+   pid = config->multiplex_pid[getpid() % config->multiplex_workers];
+   if (pid <= 0)
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_get_pid(pid, &fd))
+   {
+      goto error;
+   }
+
+   info = pgagroal_connection_info(slot);
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_MULTIPLEX))
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_buffer_write(fd, info->username, MAX_USERNAME_LENGTH) ||
+       pgagroal_connection_buffer_write(fd, info->database, MAX_DATABASE_LENGTH) ||
+       pgagroal_connection_buffer_write(fd, info->appname, MAX_APPLICATION_NAME))
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_fd_write(fd, -1, client_fd))
+   {
+      goto error;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+static void
+multiplex_client(struct io_watcher* watcher)
+{
+   int status = MESSAGE_STATUS_ERROR;
+   struct multiplex_client* c = NULL;
+   struct message* msg = NULL;
+   struct main_configuration* config = NULL;
+
+   c = (struct multiplex_client*)watcher;
+   config = (struct main_configuration*)shmem;
+
+   /* An event may still be queued for a client closed or parked in the same round */
+   if (c->closed || !c->client_active)
+   {
+      return;
+   }
+
+   if (c->client.slot == -1 && !client_borrow(c))
+   {
+      return;
+   }
+
+   status = pgagroal_recv_message(watcher, &msg);
+
+   if (likely(status == MESSAGE_STATUS_OK))
+   {
+      pgagroal_prometheus_local_network_sent_add(msg->length);
+
+      if (likely(msg->kind != 'X'))
+      {
+         int offset = 0;
+         struct message_frame frame;
+
+         while (pgagroal_message_stream_next(&c->client_stream, msg, &offset, "PQE", &frame))
+         {
+            if (config->track_prepared_statements)
+            {
+               /* The P message tell us the prepared statement */
+               if (frame.kind == 'P' && frame.available > 0 && frame.body[0] != '\0')
+               {
+                  c->deallocate = true;
+               }
+            }
+
+            /* The Q and E message tell us the execute of the simple query and the prepared statement */
+            if (frame.kind == 'Q' || frame.kind == 'E')
+            {
+               pgagroal_prometheus_local_query_count_add(c->client.slot);
+            }
+         }
+
+         status = pgagroal_send_message(watcher, msg);
+
+         if (unlikely(status == MESSAGE_STATUS_ERROR))
+         {
+            if (config->failover)
+            {
+               pgagroal_server_failover(c->client.slot);
+               pgagroal_write_client_failover(NULL, c->client.client_fd);
+               pgagroal_prometheus_failed_servers();
+
+               client_close(c, WORKER_FAILOVER);
+            }
+            else
+            {
+               pgagroal_log_warn("[C] Server error (slot %d database %s user %s): %s (socket %d status %d)",
+                                 c->client.slot, c->database, c->username, strerror(errno), c->client.server_fd, status);
+               errno = 0;
+
+               client_close(c, WORKER_SERVER_FAILURE);
+            }
+         }
+      }
+      else
+      {
+         c->saw_x = true;
+         client_close(c, WORKER_SUCCESS);
+      }
+   }
+   else if (status == MESSAGE_STATUS_ZERO)
+   {
+      pgagroal_log_debug("[C] Client done (slot %d database %s user %s): %s (socket %d status %d)",
+                         c->client.slot, c->database, c->username, strerror(errno), c->client.client_fd, status);
+      errno = 0;
+
+      client_close(c, c->saw_x ? WORKER_SUCCESS : WORKER_CLIENT_FAILURE);
+   }
+   else
+   {
+      pgagroal_log_warn("[C] Client error (slot %d database %s user %s): %s (socket %d status %d)",
+                        c->client.slot, c->database, c->username, strerror(errno), c->client.client_fd, status);
+      pgagroal_log_message(msg);
+      errno = 0;
+
+      client_close(c, WORKER_CLIENT_FAILURE);
+   }
+}
+
+static void
+multiplex_server(struct io_watcher* watcher)
+{
+   int status = MESSAGE_STATUS_ERROR;
+   struct multiplex_client* c = NULL;
+   struct message* msg = NULL;
+   struct main_configuration* config = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   c = (struct multiplex_client*)((char*)watcher - offsetof(struct multiplex_client, server));
+
+   if (c->closed || !c->server_active)
+   {
+      return;
+   }
+
+   status = pgagroal_recv_message(watcher, &msg);
+
+   if (likely(status == MESSAGE_STATUS_OK))
+   {
+      pgagroal_prometheus_local_network_received_add(msg->length);
+
+      int offset = 0;
+      struct message_frame frame;
+
+      while (pgagroal_message_stream_next(&c->server_stream, msg, &offset, "Z", &frame))
+      {
+         /* The Z message tell us the transaction state */
+         if (frame.kind == 'Z' && frame.available > 0)
+         {
+            char tx_state = frame.body[0];
+
+            if (tx_state != 'I' && !c->in_tx)
+            {
+               pgagroal_prometheus_tx_count_add();
+            }
+
+            c->in_tx = tx_state != 'I';
+         }
+      }
+
+      status = pgagroal_send_message(watcher, msg);
+
+      if (unlikely(status != MESSAGE_STATUS_OK))
+      {
+         pgagroal_log_warn("[S] Client error (slot %d database %s user %s): %s (socket %d status %d)",
+                           c->client.slot, c->database, c->username, strerror(errno), c->client.client_fd, status);
+         errno = 0;
+
+         client_close(c, WORKER_CLIENT_FAILURE);
+         return;
+      }
+
+      if (unlikely(msg->kind == 'E'))
+      {
+         if (!strncmp(msg->data + 6, "FATAL", 5) || !strncmp(msg->data + 6, "PANIC", 5))
+         {
+            c->fatal = true;
+         }
+      }
+
+      /* The transaction is complete, so the connection goes back to the pool */
+      if (pgagroal_message_stream_ready(&c->server_stream) && !c->in_tx && c->client.slot != -1)
+      {
+         client_release(c);
+      }
+   }
+   else if (status == MESSAGE_STATUS_ERROR && errno == ETIMEDOUT && config->failover)
+   {
+      /* The server stopped answering within tcp_user_timeout or the keep alive probes */
+      pgagroal_log_warn("[S] Server timed out (slot %d database %s user %s): %s (socket %d status %d)",
+                        c->client.slot, c->database, c->username, strerror(errno), c->client.server_fd, status);
+      errno = 0;
+
+      pgagroal_server_failover(c->client.slot);
+      pgagroal_write_client_failover(NULL, c->client.client_fd);
+      pgagroal_prometheus_failed_servers();
+
+      client_close(c, WORKER_FAILOVER);
+   }
+   else
+   {
+      pgagroal_log_debug("[S] Server done (slot %d database %s user %s): %s (socket %d status %d)",
+                         c->client.slot, c->database, c->username, strerror(errno), c->client.server_fd, status);
+      errno = 0;
+
+      client_close(c, WORKER_SERVER_FAILURE);
+   }
+}
+
+static void
+accept_cb(struct io_watcher* watcher)
+{
+   int client_fd = -1;
+   int id = -1;
+   int32_t slot = -1;
+   int fd = -1;
+   char username[MAX_USERNAME_LENGTH];
+   char database[MAX_DATABASE_LENGTH];
+   char appname[MAX_APPLICATION_NAME];
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      errno = 0;
+      return;
+   }
+
+   if (pgagroal_connection_id_read(client_fd, &id))
+   {
+      pgagroal_log_error("pgagroal_multiplex: Management client: ID: %d", id);
+      goto done;
+   }
+
+   if (id == CONNECTION_MULTIPLEX)
+   {
+      memset(&username, 0, sizeof(username));
+      memset(&database, 0, sizeof(database));
+      memset(&appname, 0, sizeof(appname));
+
+      if (pgagroal_connection_buffer_read(client_fd, &username[0], sizeof(username)) ||
+          pgagroal_connection_buffer_read(client_fd, &database[0], sizeof(database)) ||
+          pgagroal_connection_buffer_read(client_fd, &appname[0], sizeof(appname)) ||
+          pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal_multiplex: Hand-off: FD %d", fd);
+         goto done;
+      }
+
+      username[sizeof(username) - 1] = '\0';
+      database[sizeof(database) - 1] = '\0';
+      appname[sizeof(appname) - 1] = '\0';
+
+      client_adopt(fd, &username[0], &database[0], &appname[0]);
+   }
+   else if (id == CONNECTION_CLIENT_FD)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal_multiplex: Management client_fd: Slot %d FD %d", slot, fd);
+         goto done;
+      }
+
+      if (owners[slot] != NULL)
+      {
+         /* A client is using our own descriptor for this connection */
+         pgagroal_disconnect(fd);
+      }
+      else
+      {
+         if (fds[slot] > 0 && fds[slot] != fd)
+         {
+            pgagroal_disconnect(fds[slot]);
+         }
+         fds[slot] = fd;
+      }
+   }
+   else if (id == CONNECTION_REMOVE_FD)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal_multiplex: Management remove_fd: Slot %d FD %d", slot, fd);
+         goto done;
+      }
+
+      pgagroal_disconnect(fd);
+
+      if (owners[slot] == NULL && fds[slot] > 0)
+      {
+         pgagroal_disconnect(fds[slot]);
+         fds[slot] = 0;
+      }
+   }
+   else
+   {
+      pgagroal_log_debug("pgagroal_multiplex: Unsupported management id: %d", id);
+   }
+
+done:
+
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+shutdown_cb(void)
+{
+   pgagroal_event_loop_break();
+}
+
+static void
+retry_cb(void)
+{
+   struct multiplex_client* c = NULL;
+   struct multiplex_client* p = NULL;
+   struct multiplex_client* n = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_prometheus_local_publish();
+
+   /* Clients closed before the previous tick can't have queued events anymore */
+   while (reclaim != NULL)
+   {
+      c = reclaim;
+      reclaim = c->next;
+      client_free(c);
+   }
+   reclaim = closing;
+   closing = NULL;
+
+   c = waiting;
+   p = NULL;
+
+   while (c != NULL)
+   {
+      int slot = -1;
+      int ret = 1;
+      SSL* ssl = NULL;
+      bool done = true;
+
+      n = c->wait_next;
+
+      if (!c->closed)
+      {
+         ret = pgagroal_try_connection(c->username, c->database, true, &slot, &ssl);
+
+         if (ret == 0)
+         {
+            if (client_attach(c, slot, ssl))
+            {
+               c->wait_start = 0;
+               c->client_active = true;
+               pgagroal_io_start(&c->client.io);
+            }
+            else
+            {
+               done = false;
+            }
+         }
+         else if (ret == 1)
+         {
+            if (pgagroal_time_is_valid(config->blocking_timeout) &&
+                difftime(time(NULL), c->wait_start) >= (double)pgagroal_time_convert(config->blocking_timeout, FORMAT_TIME_S))
+            {
+               pgagroal_write_pool_full(NULL, c->client.client_fd);
+               client_close(c, WORKER_SERVER_FAILURE);
+            }
+            else
+            {
+               done = false;
+            }
+         }
+         else
+         {
+            pgagroal_log_warn("Failure during obtaining connection");
+            pgagroal_write_pool_full(NULL, c->client.client_fd);
+            client_close(c, WORKER_SERVER_FAILURE);
+         }
+      }
+
+      if (done)
+      {
+         if (p == NULL)
+         {
+            waiting = n;
+         }
+         else
+         {
+            p->wait_next = n;
+         }
+
+         if (waiting_tail == c)
+         {
+            waiting_tail = p;
+         }
+
+         c->wait_next = NULL;
+      }
+      else
+      {
+         p = c;
+      }
+
+      c = n;
+   }
+}
+
+static void
+client_adopt(int client_fd, char* username, char* database, char* appname)
+{
+   struct multiplex_client* c = NULL;
+
+   c = (struct multiplex_client*)calloc(1, sizeof(struct multiplex_client));
+   if (c == NULL)
+   {
+      pgagroal_log_error("pgagroal_multiplex: Unable to allocate client");
+      pgagroal_disconnect(client_fd);
+      return;
+   }
+
+   memcpy(&c->username[0], username, MAX_USERNAME_LENGTH);
+   memcpy(&c->database[0], database, MAX_DATABASE_LENGTH);
+   memcpy(&c->appname[0], appname, MAX_APPLICATION_NAME);
+
+   pgagroal_event_worker_init(&c->client.io, client_fd, -1, multiplex_client);
+   c->client.client_fd = client_fd;
+   c->client.server_fd = -1;
+   c->client.slot = -1;
+   c->server.slot = -1;
+
+   c->next = clients;
+   if (clients != NULL)
+   {
+      clients->prev = c;
+   }
+   clients = c;
+   number_of_clients++;
+
+   pgagroal_prometheus_client_sockets_add();
+   pgagroal_prometheus_client_active_add();
+
+   c->client_active = true;
+   if (pgagroal_io_start(&c->client.io))
+   {
+      c->client_active = false;
+      client_close(c, WORKER_FAILURE);
+      return;
+   }
+
+   pgagroal_log_debug("pgagroal_multiplex: Client %d (user %s database %s), %d clients",
+                      client_fd, c->username, c->database, number_of_clients);
+}
+
+static bool
+client_borrow(struct multiplex_client* c)
+{
+   int slot = -1;
+   int ret;
+   SSL* ssl = NULL;
+
+   pgagroal_tracking_event_basic(TRACKER_TX_GET_CONNECTION, &c->username[0], &c->database[0]);
+
+   ret = pgagroal_try_connection(&c->username[0], &c->database[0], true, &slot, &ssl);
+   if (ret == 0)
+   {
+      if (client_attach(c, slot, ssl))
+      {
+         return true;
+      }
+
+      client_wait(c);
+   }
+   else if (ret == 1)
+   {
+      /* Keep the request in the client socket until a connection is available */
+      client_wait(c);
+   }
+   else
+   {
+      pgagroal_log_warn("Failure during obtaining connection");
+      pgagroal_write_pool_full(NULL, c->client.client_fd);
+      client_close(c, WORKER_SERVER_FAILURE);
+   }
+
+   return false;
+}
+
+static bool
+client_attach(struct multiplex_client* c, int slot, SSL* ssl)
+{
+   int server_fd;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* A new connection was created by this process, otherwise use our copy of it */
+   if (config->connections[slot].new)
+   {
+      server_fd = config->connections[slot].fd;
+   }
+   else
+   {
+      server_fd = fds[slot];
+   }
+
+   if (server_fd <= 0)
+   {
+      /* The descriptor hasn't reached this process yet */
+      pgagroal_return_connection(slot, ssl, true);
+      return false;
+   }
+
+   owners[slot] = c;
+   fds[slot] = server_fd;
+
+   c->client.server_fd = server_fd;
+   c->client.server_ssl = ssl;
+   c->client.slot = slot;
+
+   pgagroal_event_worker_init(&c->client.io, c->client.client_fd, server_fd, multiplex_client);
+
+   memcpy(&pgagroal_connection_info(slot)->appname[0], &c->appname[0], MAX_APPLICATION_NAME);
+
+   pgagroal_event_worker_init(&c->server.io, server_fd, c->client.client_fd, multiplex_server);
+   c->server.client_fd = c->client.client_fd;
+   c->server.server_fd = server_fd;
+   c->server.slot = slot;
+   c->server.client_ssl = NULL;
+   c->server.server_ssl = ssl;
+
+   c->fatal = false;
+
+   c->server_active = true;
+   pgagroal_io_start(&c->server.io);
+
+   return true;
+}
+
+static void
+client_release(struct multiplex_client* c)
+{
+   int slot = c->client.slot;
+
+   if (c->server_active)
+   {
+      pgagroal_io_stop(&c->server.io);
+      c->server_active = false;
+   }
+
+   if (c->fatal)
+   {
+      client_close(c, WORKER_SERVER_FATAL);
+      return;
+   }
+
+   if (c->deallocate)
+   {
+      pgagroal_write_deallocate_all(c->client.server_ssl, c->client.server_fd);
+      pgagroal_prepared_reset(slot);
+      c->deallocate = false;
+   }
+
+   owners[slot] = NULL;
+   c->client.slot = -1;
+   c->server.slot = -1;
+
+   pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION, slot);
+   if (pgagroal_return_connection(slot, c->client.server_ssl, true))
+   {
+      pgagroal_log_warn("Failure during connection return");
+      client_close(c, WORKER_SERVER_FAILURE);
+   }
+}
+
+static void
+client_close(struct multiplex_client* c, int status)
+{
+   int slot = c->client.slot;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (c->closed)
+   {
+      return;
+   }
+
+   c->closed = true;
+
+   if (c->server_active)
+   {
+      pgagroal_io_stop(&c->server.io);
+      c->server_active = false;
+   }
+
+   if (slot != -1)
+   {
+      owners[slot] = NULL;
+
+      if (status == WORKER_SERVER_FAILURE || status == WORKER_SERVER_FATAL || status == WORKER_FAILOVER)
+      {
+         pgagroal_tracking_event_slot(TRACKER_WORKER_KILL1, slot);
+         pgagroal_kill_connection(slot, c->client.server_ssl);
+         fds[slot] = 0;
+      }
+      else
+      {
+         /* We are either in 'X' or the client terminated (consider cancel query) */
+         if (c->in_tx)
+         {
+            pgagroal_write_rollback(c->client.server_ssl, c->client.server_fd);
+         }
+
+         pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION_STOP, slot);
+         pgagroal_return_connection(slot, c->client.server_ssl, true);
+      }
+
+      pgagroal_prometheus_query_count_specified_reset(slot);
+
+      c->client.slot = -1;
+      c->server.slot = -1;
+   }
+
+   if (c->client_active)
+   {
+      pgagroal_io_stop(&c->client.io);
+      c->client_active = false;
+   }
+
+   if (config->common.log_disconnections)
+   {
+      pgagroal_log_info("disconnect: user=%s database=%s", c->username, c->database);
+   }
+
+   pgagroal_disconnect(c->client.client_fd);
+
+   pgagroal_prometheus_client_active_sub();
+   pgagroal_prometheus_client_sockets_sub();
+
+   if (c->prev != NULL)
+   {
+      c->prev->next = c->next;
+   }
+   else
+   {
+      clients = c->next;
+   }
+   if (c->next != NULL)
+   {
+      c->next->prev = c->prev;
+   }
+   number_of_clients--;
+
+   /* Freed two ticks later, an event may still be queued for it */
+   c->prev = NULL;
+   c->next = closing;
+   closing = c;
+}
+
+static void
+client_wait(struct multiplex_client* c)
+{
+   if (c->client_active)
+   {
+      pgagroal_io_stop(&c->client.io);
+      c->client_active = false;
+   }
+
+   if (c->wait_start == 0)
+   {
+      c->wait_start = time(NULL);
+   }
+
+   c->wait_next = NULL;
+   if (waiting_tail == NULL)
+   {
+      waiting = c;
+   }
+   else
+   {
+      waiting_tail->wait_next = c;
+   }
+   waiting_tail = c;
+}
+
+static void
+client_free(struct multiplex_client* c)
+{
+   if (c->client.io.msg)
+   {
+      pgagroal_free_message(c->client.io.msg);
+      c->client.io.msg = NULL;
+   }
+   if (c->server.io.msg)
+   {
+      pgagroal_free_message(c->server.io.msg);
+      c->server.io.msg = NULL;
+   }
+
+   free(c);
+}
@@ -30,6 +30,7 @@
 #include <pgagroal.h>
 #include <logging.h>
 #include <network.h>
+#include <shmem.h>
 #include <utils.h>
 
 /* system */
@@ -38,9 +39,11 @@
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -53,15 +56,22 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
-
-static int bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_size, bool no_delay, int backlog);
+#include <poll.h>
+
+static int bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_size, bool no_delay, int backlog, bool reuse_port);
+static int connect_address(struct sockaddr* address, socklen_t length, int protocol, int* fd, bool keep_alive, bool no_delay, bool nonblocking);
+static int connect_race(struct sockaddr_storage* addresses, socklen_t* lengths, int n, int* fd, bool keep_alive, bool no_delay);
+static int resolve_addresses(const char* hostname, int port, struct sockaddr_storage* addresses, socklen_t* lengths);
+static int server_addresses(struct server* srv, struct sockaddr_storage* addresses, socklen_t* lengths, bool* expired);
+static int resolve_server(struct server* srv, bool failed);
+static bool resolve_claim(struct server* srv, time_t now, unsigned long long* claim);
 static int socket_buffers(int fd);
 
 /**
  *
  */
 int
-pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_delay, int backlog)
+pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_delay, int backlog, bool reuse_port)
 {
    int default_buffer_size = DEFAULT_BUFFER_SIZE;
    struct ifaddrs *ifaddr, *ifa;
@@ -102,7 +112,7 @@ pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_de
                inet_ntop(AF_INET6, &sa6->sin6_addr, addr, sizeof(addr));
             }
 
-            if (bind_host(addr, port, &new_fds, &new_length, &default_buffer_size, no_delay, backlog))
+            if (bind_host(addr, port, &new_fds, &new_length, &default_buffer_size, no_delay, backlog, reuse_port))
             {
                free(new_fds);
                continue;
@@ -139,7 +149,7 @@ pgagroal_bind(const char* hostname, int port, int** fds, int* length, bool no_de
       return 0;
    }
 
-   return bind_host(hostname, port, fds, length, &default_buffer_size, no_delay, backlog);
+   return bind_host(hostname, port, fds, length, &default_buffer_size, no_delay, backlog, reuse_port);
 }
 
 /**
@@ -243,12 +253,9 @@ pgagroal_remove_unix_socket(const char* directory, const char* file)
 int
 pgagroal_connect(const char* hostname, int port, int* fd, bool keep_alive, bool no_delay)
 {
-   int default_buffer_size = DEFAULT_BUFFER_SIZE;
    struct addrinfo hints = {0};
    struct addrinfo* servinfo = NULL;
    struct addrinfo* p = NULL;
-   int yes = 1;
-   socklen_t optlen = sizeof(int);
    int rv;
    char sport[6];
    int error = 0;
@@ -276,65 +283,7 @@ pgagroal_connect(const char* hostname, int port, int* fd, bool keep_alive, bool
    /* Loop through all the results and connect to the first we can */
    for (p = servinfo; *fd == -1 && p != NULL; p = p->ai_next)
    {
-      if ((*fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-      {
-         error = errno;
-         errno = 0;
-      }
-
-      if (*fd != -1)
-      {
-         if (keep_alive)
-         {
-            if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
-            {
-               error = errno;
-               pgagroal_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-         }
-
-         if (no_delay)
-         {
-            if (setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &yes, optlen) == -1)
-            {
-               error = errno;
-               pgagroal_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-         }
-
-         if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &default_buffer_size, optlen) == -1)
-         {
-            error = errno;
-            pgagroal_disconnect(*fd);
-            errno = 0;
-            *fd = -1;
-            continue;
-         }
-
-         if (setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &default_buffer_size, optlen) == -1)
-         {
-            error = errno;
-            pgagroal_disconnect(*fd);
-            errno = 0;
-            *fd = -1;
-            continue;
-         }
-
-         if (connect(*fd, p->ai_addr, p->ai_addrlen) == -1)
-         {
-            error = errno;
-            pgagroal_disconnect(*fd);
-            errno = 0;
-            *fd = -1;
-            continue;
-         }
-      }
+      error = connect_address(p->ai_addr, p->ai_addrlen, p->ai_protocol, fd, keep_alive, no_delay, false);
    }
 
    if (*fd == -1)
@@ -358,6 +307,71 @@ error:
    return 1;
 }
 
+int
+pgagroal_connect_server(int server, int* fd, bool keep_alive, bool no_delay)
+{
+   int n;
+   int error = 0;
+   bool expired = false;
+   struct sockaddr_storage addresses[NUMBER_OF_SERVER_ADDRESSES];
+   socklen_t lengths[NUMBER_OF_SERVER_ADDRESSES];
+   struct server* srv = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   srv = &config->servers[server];
+
+   if (!pgagroal_time_is_valid(config->dns_cache_ttl))
+   {
+      n = resolve_addresses(srv->host, srv->port, &addresses[0], &lengths[0]);
+   }
+   else
+   {
+      n = server_addresses(srv, &addresses[0], &lengths[0], &expired);
+
+      /* A single process resolves the name again, the others use the addresses they have */
+      if ((n == 0 || expired) && !resolve_server(srv, false))
+      {
+         n = server_addresses(srv, &addresses[0], &lengths[0], &expired);
+      }
+
+      /* Unless the name failed to resolve in this second */
+      if (n == 0 && atomic_load(&srv->resolve_failed) != (long long)time(NULL))
+      {
+         n = resolve_addresses(srv->host, srv->port, &addresses[0], &lengths[0]);
+      }
+   }
+
+   if (n == 0)
+   {
+      return 1;
+   }
+
+   error = connect_race(&addresses[0], &lengths[0], n, fd, keep_alive, no_delay);
+
+   if (*fd != -1)
+   {
+      return 0;
+   }
+
+   /* The name may point elsewhere after a failover */
+   if (pgagroal_time_is_valid(config->dns_cache_ttl) && !resolve_server(srv, true))
+   {
+      n = server_addresses(srv, &addresses[0], &lengths[0], &expired);
+
+      error = connect_race(&addresses[0], &lengths[0], n, fd, keep_alive, no_delay);
+
+      if (*fd != -1)
+      {
+         return 0;
+      }
+   }
+
+   pgagroal_log_debug("pgagroal_connect_server: %s:%d %s", srv->host, srv->port, strerror(error));
+
+   return 1;
+}
+
 /**
  *
  */
@@ -506,6 +520,108 @@ pgagroal_tcp_nodelay(int fd)
    return 0;
 }
 
+int
+pgagroal_tcp_keepalive(int fd)
+{
+   int value;
+   socklen_t optlen = sizeof(int);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef TCP_USER_TIMEOUT
+   /* Unacknowledged writes fail with ETIMEDOUT instead of the minutes of retransmits */
+   value = (int)pgagroal_time_convert(config->tcp_user_timeout, FORMAT_TIME_S) * 1000;
+   if (value > 0 && setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+   if (!config->keep_alive)
+   {
+      return 0;
+   }
+
+   value = 1;
+   if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &value, optlen) == -1)
+   {
+      goto error;
+   }
+
+#ifdef TCP_KEEPIDLE
+   value = (int)pgagroal_time_convert(config->tcp_keepalive_idle, FORMAT_TIME_S);
+   if (value > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+#ifdef TCP_KEEPINTVL
+   value = (int)pgagroal_time_convert(config->tcp_keepalive_interval, FORMAT_TIME_S);
+   if (value > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+#ifdef TCP_KEEPCNT
+   value = config->tcp_keepalive_count;
+   if (value > 0 && setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+   return 0;
+
+error:
+   pgagroal_log_warn("tcp_keepalive: %d %s", fd, strerror(errno));
+   errno = 0;
+
+   return 1;
+}
+
+int
+pgagroal_socket_busy_poll(int fd)
+{
+   int value;
+   socklen_t optlen = sizeof(int);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->busy_poll <= 0)
+   {
+      return 0;
+   }
+
+#ifdef SO_BUSY_POLL
+   value = config->busy_poll;
+   if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+#ifdef SO_PREFER_BUSY_POLL
+   value = 1;
+   if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value, optlen) == -1)
+   {
+      goto error;
+   }
+#endif
+
+   return 0;
+
+error:
+   /* Without CAP_NET_ADMIN the spin of the event loop is all there is */
+   pgagroal_log_debug("socket_busy_poll: %d %s", fd, strerror(errno));
+   errno = 0;
+
+   return 1;
+}
+
 int
 pgagroal_socket_nonblocking(int fd)
 {
@@ -590,7 +706,7 @@ socket_buffers(int fd)
  *
  */
 static int
-bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_size __attribute__((unused)), bool no_delay, int backlog)
+bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_size __attribute__((unused)), bool no_delay, int backlog, bool reuse_port)
 {
    int* result = NULL;
    int index, size;
@@ -654,6 +770,27 @@ bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_si
          continue;
       }
 
+#ifdef SO_REUSEPORT
+      if (reuse_port)
+      {
+         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1)
+         {
+            pgagroal_log_debug("server: so_reuseport: %d %s", sockfd, strerror(errno));
+            pgagroal_disconnect(sockfd);
+            continue;
+         }
+      }
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+      /* The clients speak first, so a connection is only accepted once its first message is there */
+      if (setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &yes, sizeof(int)) == -1)
+      {
+         pgagroal_log_debug("server: tcp_defer_accept: %d %s", sockfd, strerror(errno));
+         errno = 0;
+      }
+#endif
+
       if (socket_buffers(sockfd))
       {
          pgagroal_disconnect(sockfd);
@@ -700,3 +837,440 @@ bind_host(const char* hostname, int port, int** fds, int* length, int* buffer_si
 
    return 0;
 }
+
+/**
+ * Connect to an address
+ * @param address The address
+ * @param length The length of the address
+ * @param protocol The protocol
+ * @param fd The resulting descriptor, -1 upon failure
+ * @param keep_alive Use keep alive
+ * @param no_delay Use NODELAY
+ * @param nonblocking Start the connect without waiting for it
+ * @return 0 upon success, EINPROGRESS for a started connect, otherwise the error
+ */
+static int
+connect_address(struct sockaddr* address, socklen_t length, int protocol, int* fd, bool keep_alive, bool no_delay, bool nonblocking)
+{
+   int default_buffer_size = DEFAULT_BUFFER_SIZE;
+   int yes = 1;
+   socklen_t optlen = sizeof(int);
+   int error = 0;
+
+   if ((*fd = socket(address->sa_family, SOCK_STREAM, protocol)) == -1)
+   {
+      error = errno;
+      errno = 0;
+      return error;
+   }
+
+   if (keep_alive)
+   {
+      if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
+      {
+         goto error;
+      }
+   }
+
+   if (no_delay)
+   {
+      if (setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &yes, optlen) == -1)
+      {
+         goto error;
+      }
+   }
+
+   if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &default_buffer_size, optlen) == -1)
+   {
+      goto error;
+   }
+
+   if (setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &default_buffer_size, optlen) == -1)
+   {
+      goto error;
+   }
+
+   if (nonblocking && fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK) == -1)
+   {
+      goto error;
+   }
+
+   if (connect(*fd, address, length) == -1)
+   {
+      if (nonblocking && errno == EINPROGRESS)
+      {
+         errno = 0;
+         return EINPROGRESS;
+      }
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   error = errno;
+   pgagroal_disconnect(*fd);
+   errno = 0;
+   *fd = -1;
+
+   return error;
+}
+
+/**
+ * Read the cached addresses of a server. The addresses are copied out between two
+ * reads of the sequence, which is odd while a process writes them
+ * @param srv The server
+ * @param addresses The addresses
+ * @param lengths The lengths of the addresses
+ * @param expired Is the time to live over
+ * @return The number of addresses, 0 if none
+ */
+static int
+server_addresses(struct server* srv, struct sockaddr_storage* addresses, socklen_t* lengths, bool* expired)
+{
+   int n = 0;
+   unsigned int sequence;
+   time_t resolved = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int retry = 0; retry < 16; retry++)
+   {
+      sequence = atomic_load(&srv->address_sequence);
+      if (sequence & 1)
+      {
+         continue;
+      }
+
+      n = srv->number_of_addresses;
+      resolved = srv->address_time;
+      memcpy(addresses, &srv->addresses[0], sizeof(struct sockaddr_storage) * n);
+      memcpy(lengths, &srv->address_lengths[0], sizeof(socklen_t) * n);
+
+      if (atomic_load(&srv->address_sequence) == sequence)
+      {
+         *expired = difftime(time(NULL), resolved) >= (double)pgagroal_time_convert(config->dns_cache_ttl, FORMAT_TIME_S);
+         return n;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * Resolve the host name of a server into the cache. A process that finds another
+ * one resolving leaves it to that process
+ * @param srv The server
+ * @param failed Was a connect to the cached addresses refused
+ * @return 0 upon success, otherwise 1
+ */
+static int
+resolve_server(struct server* srv, bool failed)
+{
+   int n;
+   time_t now;
+   unsigned long long claim;
+   struct sockaddr_storage addresses[NUMBER_OF_SERVER_ADDRESSES];
+   socklen_t lengths[NUMBER_OF_SERVER_ADDRESSES];
+
+   now = time(NULL);
+
+   /* A server that is down, or a name that does not resolve, is resolved once a second at most */
+   if ((failed && srv->address_time == now) || atomic_load(&srv->resolve_failed) == (long long)now)
+   {
+      return 1;
+   }
+
+   if (!resolve_claim(srv, now, &claim))
+   {
+      return 1;
+   }
+
+   n = resolve_addresses(srv->host, srv->port, &addresses[0], &lengths[0]);
+
+   if (n == 0)
+   {
+      atomic_store(&srv->resolve_failed, (long long)time(NULL));
+   }
+   /* A process that took the claim over writes the addresses instead */
+   else if (atomic_load(&srv->resolver) == claim)
+   {
+      atomic_fetch_add(&srv->address_sequence, 1);
+
+      memcpy(&srv->addresses[0], &addresses[0], sizeof(struct sockaddr_storage) * n);
+      memcpy(&srv->address_lengths[0], &lengths[0], sizeof(socklen_t) * n);
+      srv->number_of_addresses = n;
+      srv->address_time = time(NULL);
+
+      atomic_fetch_add(&srv->address_sequence, 1);
+
+      pgagroal_log_debug("resolve_server: %s has %d addresses", srv->host, n);
+   }
+
+   atomic_compare_exchange_strong(&srv->resolver, &claim, 0);
+
+   return n > 0 ? 0 : 1;
+}
+
+/**
+ * Claim the resolution of the host name of a server. The claim of a process
+ * that died, or that is older than RESOLVE_CLAIM_TIMEOUT, is taken over
+ * @param srv The server
+ * @param now The current time
+ * @param claim The claim
+ * @return true if the claim was made, otherwise false
+ */
+static bool
+resolve_claim(struct server* srv, time_t now, unsigned long long* claim)
+{
+   int pid;
+   time_t since;
+   unsigned long long owner;
+
+   owner = atomic_load(&srv->resolver);
+
+   if (owner != 0)
+   {
+      pid = (int)(owner & 0xFFFFFFFFULL);
+      since = (time_t)(owner >> 32);
+
+      if (difftime(now, since) < RESOLVE_CLAIM_TIMEOUT && (kill(pid, 0) == 0 || errno != ESRCH))
+      {
+         return false;
+      }
+
+      pgagroal_log_debug("resolve_claim: %s taken over from %d", srv->host, pid);
+   }
+
+   *claim = ((unsigned long long)now << 32) | (unsigned int)getpid();
+
+   return atomic_compare_exchange_strong(&srv->resolver, &owner, *claim);
+}
+
+/**
+ * Resolve a host name. The addresses alternate between the address families
+ * in the order of the resolver, so that a race starts with both families
+ * @param hostname The host name
+ * @param port The port
+ * @param addresses The addresses
+ * @param lengths The lengths of the addresses
+ * @return The number of addresses, 0 upon failure
+ */
+static int
+resolve_addresses(const char* hostname, int port, struct sockaddr_storage* addresses, socklen_t* lengths)
+{
+   int n = 0;
+   int rv;
+   int family = AF_UNSPEC;
+   char sport[6];
+   bool used[NUMBER_OF_SERVER_ADDRESSES * 2] = {0};
+   int number_of_results = 0;
+   struct addrinfo* results[NUMBER_OF_SERVER_ADDRESSES * 2];
+   struct addrinfo hints;
+   struct addrinfo* servinfo = NULL;
+
+   memset(&sport, 0, sizeof(sport));
+   pgagroal_snprintf(&sport[0], sizeof(sport), "%d", port);
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if ((rv = getaddrinfo(hostname, &sport[0], &hints, &servinfo)) != 0)
+   {
+      pgagroal_log_debug("getaddrinfo: %s (%s)", hostname, gai_strerror(rv));
+      goto error;
+   }
+
+   for (struct addrinfo* p = servinfo; p != NULL && number_of_results < NUMBER_OF_SERVER_ADDRESSES * 2; p = p->ai_next)
+   {
+      if (p->ai_addrlen <= sizeof(struct sockaddr_storage))
+      {
+         results[number_of_results++] = p;
+      }
+   }
+
+   while (n < NUMBER_OF_SERVER_ADDRESSES && n < number_of_results)
+   {
+      int next = -1;
+
+      /* The first unused address of the other family, or else the first unused one */
+      for (int i = 0; i < number_of_results; i++)
+      {
+         if (!used[i])
+         {
+            if (next == -1)
+            {
+               next = i;
+            }
+            if (results[i]->ai_family != family)
+            {
+               next = i;
+               break;
+            }
+         }
+      }
+
+      used[next] = true;
+      family = results[next]->ai_family;
+      memcpy(&addresses[n], results[next]->ai_addr, results[next]->ai_addrlen);
+      lengths[n] = results[next]->ai_addrlen;
+      n++;
+   }
+
+   freeaddrinfo(servinfo);
+
+   return n;
+
+error:
+
+   if (servinfo != NULL)
+   {
+      freeaddrinfo(servinfo);
+   }
+
+   return 0;
+}
+
+/**
+ * Connect to the first address that answers. A new attempt is started every
+ * CONNECT_ATTEMPT_DELAY milliseconds while the earlier ones are pending, the
+ * first connect to complete wins and the others are closed
+ * @param addresses The addresses
+ * @param lengths The lengths of the addresses
+ * @param n The number of addresses
+ * @param fd The resulting descriptor, -1 upon failure
+ * @param keep_alive Use keep alive
+ * @param no_delay Use NODELAY
+ * @return 0 upon success, otherwise the error
+ */
+static int
+connect_race(struct sockaddr_storage* addresses, socklen_t* lengths, int n, int* fd, bool keep_alive, bool no_delay)
+{
+   int next = 0;
+   int pending = 0;
+   int error = 0;
+   int timeout = -1;
+   int wait;
+   int64_t elapsed;
+   int64_t last_start = 0;
+   struct pollfd fds[NUMBER_OF_SERVER_ADDRESSES];
+   struct timespec start;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *fd = -1;
+
+   if (pgagroal_time_is_valid(config->connect_timeout))
+   {
+      timeout = (int)pgagroal_time_convert(config->connect_timeout, FORMAT_TIME_S) * 1000;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   while (*fd == -1)
+   {
+      elapsed = pgagroal_time_elapsed_usec(&start) / 1000;
+
+      if (next < n && (pending == 0 || elapsed - last_start >= CONNECT_ATTEMPT_DELAY))
+      {
+         int s = -1;
+
+         error = connect_address((struct sockaddr*)&addresses[next], lengths[next], IPPROTO_TCP, &s, keep_alive, no_delay, true);
+         next++;
+         last_start = elapsed;
+
+         if (error == 0)
+         {
+            *fd = s;
+            break;
+         }
+         else if (error == EINPROGRESS)
+         {
+            fds[pending].fd = s;
+            fds[pending].events = POLLOUT;
+            fds[pending].revents = 0;
+            pending++;
+         }
+
+         continue;
+      }
+
+      if (pending == 0)
+      {
+         break;
+      }
+
+      if (timeout != -1 && elapsed >= timeout)
+      {
+         error = ETIMEDOUT;
+         break;
+      }
+
+      wait = timeout != -1 ? (int)(timeout - elapsed) : -1;
+      if (next < n && (wait == -1 || wait > CONNECT_ATTEMPT_DELAY - (elapsed - last_start)))
+      {
+         wait = (int)(CONNECT_ATTEMPT_DELAY - (elapsed - last_start));
+      }
+
+      if (poll(&fds[0], pending, wait) == -1)
+      {
+         if (errno == EINTR)
+         {
+            errno = 0;
+            continue;
+         }
+         error = errno;
+         errno = 0;
+         break;
+      }
+
+      for (int i = 0; i < pending; i++)
+      {
+         if (fds[i].revents != 0)
+         {
+            int so_error = 0;
+            socklen_t optlen = sizeof(so_error);
+
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &optlen) == -1)
+            {
+               so_error = errno;
+               errno = 0;
+            }
+
+            if (so_error == 0 && *fd == -1)
+            {
+               *fd = fds[i].fd;
+            }
+            else
+            {
+               error = so_error != 0 ? so_error : error;
+               pgagroal_disconnect(fds[i].fd);
+
+               /* Start the next attempt at once */
+               last_start = -CONNECT_ATTEMPT_DELAY;
+            }
+
+            fds[i] = fds[pending - 1];
+            pending--;
+            i--;
+         }
+      }
+   }
+
+   for (int i = 0; i < pending; i++)
+   {
+      pgagroal_disconnect(fds[i].fd);
+   }
+
+   if (*fd != -1)
+   {
+      fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) & ~O_NONBLOCK);
+      return 0;
+   }
+
+   return error;
+}
@@ -0,0 +1,1007 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <connection.h>
+#include <ev.h>
+#include <logging.h>
+#include <memory.h>
+#include <message.h>
+#include <network.h>
+#include <notify.h>
+#include <pool.h>
+#include <prometheus.h>
+#include <security.h>
+#include <shmem.h>
+#include <utils.h>
+#include <worker.h>
+
+/* system */
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NOTIFY_DATABASES      16
+#define NOTIFY_SUBSCRIPTIONS  4096
+#define NOTIFY_PENDING        64
+#define NOTIFY_DEAD_CLIENTS   16
+#define NOTIFY_MESSAGE_SIZE   65536
+#define NOTIFY_RETRY_INTERVAL 1000 /* milliseconds */
+
+/** @struct notify_database
+ * Defines the server connection that listens for a database
+ */
+struct notify_database
+{
+   struct worker_io server;            /**< Receives from the server */
+   bool used;                          /**< Is the entry used */
+   bool active;                        /**< Is the server watcher started */
+   bool failed;                        /**< Has the current request failed */
+   int slot;                           /**< The slot, or -1 without a connection */
+   SSL* ssl;                           /**< The SSL connection */
+   char username[MAX_USERNAME_LENGTH]; /**< The user name of the connection */
+   char database[MAX_DATABASE_LENGTH]; /**< The database */
+   char* buffer;                       /**< The data received from the server */
+   size_t length;                      /**< The length of the data */
+   size_t capacity;                    /**< The capacity of the buffer */
+   int pending[NOTIFY_PENDING];        /**< The clients waiting for a reply in request order, -1 for none */
+   int pending_start;                  /**< The first pending request */
+   int pending_count;                  /**< The number of pending requests */
+};
+
+/** @struct notify_subscription
+ * Defines a channel a client listens on
+ */
+struct notify_subscription
+{
+   pid_t pid;                           /**< The process of the client */
+   int database;                        /**< The database index */
+   char channel[NOTIFY_CHANNEL_LENGTH]; /**< The channel */
+};
+
+static void notify_server(struct io_watcher* watcher);
+static void accept_cb(struct io_watcher* watcher);
+static void shutdown_cb(void);
+static void retry_cb(void);
+static int database_find(char* username, char* database);
+static int database_connect(struct notify_database* d);
+static void database_close(struct notify_database* d, bool kill);
+static int database_request(struct notify_database* d, char* query, int client_fd);
+static void database_reply(struct notify_database* d);
+static char* channel_command(char* query, char* command, char* channel);
+static void subscribe(int client_fd, pid_t pid, char* username, char* database, char* channel);
+static void unsubscribe(pid_t pid, char* channel);
+static void fan_out(int database, char* data, int length);
+static int subscribers(int database, char* channel);
+
+static int unix_socket = -1;
+static char socket_name[MISC_LENGTH];
+static struct notify_database databases[NOTIFY_DATABASES];
+static struct notify_subscription* subscriptions = NULL;
+static int number_of_subscriptions = 0;
+
+void
+pgagroal_notify_relay(char** argv)
+{
+   struct event_loop* loop = NULL;
+   struct io_watcher io_mgt;
+   struct signal_info signal_watcher;
+   struct periodic_watcher retry_watcher;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_set_proc_title(1, argv, "notify", NULL);
+
+   memset(&databases, 0, sizeof(databases));
+   for (int i = 0; i < NOTIFY_DATABASES; i++)
+   {
+      databases[i].slot = -1;
+   }
+
+   subscriptions = calloc(NOTIFY_SUBSCRIPTIONS, sizeof(struct notify_subscription));
+   if (subscriptions == NULL)
+   {
+      pgagroal_log_fatal("pgagroal_notify_relay: Out of memory");
+      exit(1);
+   }
+
+   memset(&socket_name, 0, sizeof(socket_name));
+   pgagroal_snprintf(&socket_name[0], sizeof(socket_name), "%s.%d", MAIN_UDS, (int)getpid());
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &socket_name[0], &unix_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s", config->unix_socket_dir, &socket_name[0]);
+      exit(1);
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal_notify_relay: Failed to create loop");
+      exit(1);
+   }
+
+   memset(&io_mgt, 0, sizeof(struct io_watcher));
+   pgagroal_event_accept_init(&io_mgt, unix_socket, accept_cb);
+   pgagroal_io_start(&io_mgt);
+
+   pgagroal_signal_init(&signal_watcher.sig_w, shutdown_cb, SIGQUIT);
+   signal_watcher.slot = -1;
+   pgagroal_signal_start(&signal_watcher.sig_w);
+
+   pgagroal_periodic_init(&retry_watcher, retry_cb, NOTIFY_RETRY_INTERVAL, NOTIFY_RETRY_INTERVAL);
+   pgagroal_periodic_start(&retry_watcher);
+
+   pgagroal_log_debug("pgagroal_notify_relay: Notification relay (PID %d)", (int)getpid());
+
+   pgagroal_event_loop_run();
+
+   for (int i = 0; i < NOTIFY_DATABASES; i++)
+   {
+      if (databases[i].used)
+      {
+         database_close(&databases[i], true);
+      }
+      free(databases[i].buffer);
+   }
+
+   free(subscriptions);
+
+   pgagroal_periodic_stop(&retry_watcher);
+   pgagroal_prometheus_local_publish();
+   pgagroal_io_stop(&io_mgt);
+   pgagroal_disconnect(unix_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &socket_name[0]);
+   errno = 0;
+
+   pgagroal_event_loop_destroy();
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+}
+
+int
+pgagroal_notify_listen(char* username, char* database, char* channel)
+{
+   int fd = -1;
+   int reply = -1;
+   char u[MAX_USERNAME_LENGTH];
+   char d[MAX_DATABASE_LENGTH];
+   char c[NOTIFY_CHANNEL_LENGTH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->notify_pid <= 0)
+   {
+      goto error;
+   }
+
+   memset(&u, 0, sizeof(u));
+   memset(&d, 0, sizeof(d));
+   memset(&c, 0, sizeof(c));
+   memcpy(&u[0], username, MIN(strlen(username), sizeof(u) - 1));
+   memcpy(&d[0], database, MIN(strlen(database), sizeof(d) - 1));
+   memcpy(&c[0], channel, MIN(strlen(channel), sizeof(c) - 1));
+
+   if (pgagroal_connection_get_pid(config->notify_pid, &fd))
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_NOTIFY_LISTEN) ||
+       pgagroal_connection_pid_write(fd, getpid()) ||
+       pgagroal_connection_buffer_write(fd, &u[0], sizeof(u)) ||
+       pgagroal_connection_buffer_write(fd, &d[0], sizeof(d)) ||
+       pgagroal_connection_buffer_write(fd, &c[0], sizeof(c)))
+   {
+      goto error;
+   }
+
+   /* The relay replies once the server listens on the channel */
+   if (pgagroal_connection_id_read(fd, &reply) || reply != 0)
+   {
+      goto error;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+int
+pgagroal_notify_unlisten(char* channel)
+{
+   int fd = -1;
+   char c[NOTIFY_CHANNEL_LENGTH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->notify_pid <= 0)
+   {
+      goto error;
+   }
+
+   memset(&c, 0, sizeof(c));
+   if (channel != NULL)
+   {
+      memcpy(&c[0], channel, MIN(strlen(channel), sizeof(c) - 1));
+   }
+
+   if (pgagroal_connection_get_pid(config->notify_pid, &fd))
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_NOTIFY_UNLISTEN) ||
+       pgagroal_connection_pid_write(fd, getpid()) ||
+       pgagroal_connection_buffer_write(fd, &c[0], sizeof(c)))
+   {
+      goto error;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+int
+pgagroal_notify_read(int client_fd, char** data, int* length)
+{
+   char buf4[4];
+   int32_t l;
+   char* d = NULL;
+
+   *data = NULL;
+   *length = 0;
+
+   if (pgagroal_connection_buffer_read(client_fd, &buf4[0], sizeof(buf4)))
+   {
+      goto error;
+   }
+
+   l = pgagroal_read_int32(&buf4[0]);
+   if (l <= MESSAGE_HEADER_SIZE || l > NOTIFY_MESSAGE_SIZE)
+   {
+      goto error;
+   }
+
+   d = malloc(l);
+   if (d == NULL)
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_buffer_read(client_fd, d, l))
+   {
+      goto error;
+   }
+
+   *data = d;
+   *length = l;
+
+   return 0;
+
+error:
+
+   free(d);
+
+   return 1;
+}
+
+static void
+notify_server(struct io_watcher* watcher)
+{
+   int status = MESSAGE_STATUS_ERROR;
+   int index;
+   size_t offset = 0;
+   int32_t length;
+   char* data = NULL;
+   struct message* msg = NULL;
+   struct notify_database* d = NULL;
+
+   d = (struct notify_database*)((char*)watcher - offsetof(struct notify_database, server));
+   index = (int)(d - &databases[0]);
+
+   if (!d->active)
+   {
+      return;
+   }
+
+   status = pgagroal_recv_message(watcher, &msg);
+
+   if (unlikely(status != MESSAGE_STATUS_OK))
+   {
+      pgagroal_log_warn("pgagroal_notify_relay: Lost the connection of database %s (slot %d), notifications may be missed",
+                        d->database, d->slot);
+      errno = 0;
+
+      database_close(d, true);
+      return;
+   }
+
+   if (d->length + msg->length > d->capacity)
+   {
+      size_t capacity = MAX(d->capacity * 2, d->length + msg->length);
+
+      data = realloc(d->buffer, capacity);
+      if (data == NULL)
+      {
+         pgagroal_log_error("pgagroal_notify_relay: Out of memory for database %s", d->database);
+         database_close(d, true);
+         return;
+      }
+
+      d->buffer = data;
+      d->capacity = capacity;
+   }
+
+   memcpy(d->buffer + d->length, msg->data, msg->length);
+   d->length += msg->length;
+
+   /* Only whole messages are looked at, the rest waits for the next read */
+   while (offset + MESSAGE_HEADER_SIZE <= d->length)
+   {
+      signed char kind = (signed char)d->buffer[offset];
+
+      length = pgagroal_read_int32(d->buffer + offset + 1);
+
+      if (length < 4)
+      {
+         pgagroal_log_error("pgagroal_notify_relay: Invalid message from database %s", d->database);
+         database_close(d, true);
+         return;
+      }
+
+      if (offset + 1 + length > d->length)
+      {
+         break;
+      }
+
+      if (kind == 'A')
+      {
+         fan_out(index, d->buffer + offset, 1 + length);
+      }
+      else if (kind == 'E')
+      {
+         d->failed = true;
+      }
+      else if (kind == 'Z')
+      {
+         database_reply(d);
+      }
+
+      offset += 1 + length;
+   }
+
+   memmove(d->buffer, d->buffer + offset, d->length - offset);
+   d->length -= offset;
+
+   /* The connection goes back to the pool once nobody listens anymore */
+   if (d->slot != -1 && d->pending_count == 0 && subscribers(index, NULL) == 0)
+   {
+      pgagroal_log_debug("pgagroal_notify_relay: Database %s has no listeners (slot %d)", d->database, d->slot);
+      database_close(d, false);
+      d->used = false;
+   }
+}
+
+static void
+accept_cb(struct io_watcher* watcher)
+{
+   int client_fd = -1;
+   int id = -1;
+   pid_t pid = -1;
+   char username[MAX_USERNAME_LENGTH];
+   char database[MAX_DATABASE_LENGTH];
+   char channel[NOTIFY_CHANNEL_LENGTH];
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      errno = 0;
+      return;
+   }
+
+   if (pgagroal_connection_id_read(client_fd, &id))
+   {
+      pgagroal_log_error("pgagroal_notify_relay: Management client: ID: %d", id);
+      goto done;
+   }
+
+   memset(&channel, 0, sizeof(channel));
+
+   if (id == CONNECTION_NOTIFY_LISTEN)
+   {
+      memset(&username, 0, sizeof(username));
+      memset(&database, 0, sizeof(database));
+
+      if (pgagroal_connection_pid_read(client_fd, &pid) ||
+          pgagroal_connection_buffer_read(client_fd, &username[0], sizeof(username)) ||
+          pgagroal_connection_buffer_read(client_fd, &database[0], sizeof(database)) ||
+          pgagroal_connection_buffer_read(client_fd, &channel[0], sizeof(channel)))
+      {
+         pgagroal_log_error("pgagroal_notify_relay: Listen: PID %d", (int)pid);
+         goto done;
+      }
+
+      username[sizeof(username) - 1] = '\0';
+      database[sizeof(database) - 1] = '\0';
+      channel[sizeof(channel) - 1] = '\0';
+
+      /* The client is answered once the server replied */
+      subscribe(client_fd, pid, &username[0], &database[0], &channel[0]);
+      return;
+   }
+   else if (id == CONNECTION_NOTIFY_UNLISTEN)
+   {
+      if (pgagroal_connection_pid_read(client_fd, &pid) ||
+          pgagroal_connection_buffer_read(client_fd, &channel[0], sizeof(channel)))
+      {
+         pgagroal_log_error("pgagroal_notify_relay: Unlisten: PID %d", (int)pid);
+         goto done;
+      }
+
+      channel[sizeof(channel) - 1] = '\0';
+
+      unsubscribe(pid, channel[0] != '\0' ? &channel[0] : NULL);
+   }
+   else
+   {
+      pgagroal_log_debug("pgagroal_notify_relay: Unsupported management id: %d", id);
+   }
+
+done:
+
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+shutdown_cb(void)
+{
+   pgagroal_event_loop_break();
+}
+
+static void
+retry_cb(void)
+{
+   char* query = NULL;
+   struct notify_database* d = NULL;
+
+   pgagroal_prometheus_local_publish();
+
+   for (int i = 0; i < NOTIFY_DATABASES; i++)
+   {
+      d = &databases[i];
+
+      if (!d->used)
+      {
+         continue;
+      }
+
+      if (subscribers(i, NULL) == 0)
+      {
+         if (d->pending_count == 0)
+         {
+            database_close(d, false);
+            d->used = false;
+         }
+         continue;
+      }
+
+      if (d->slot != -1 || database_connect(d))
+      {
+         continue;
+      }
+
+      /* Listen again on every channel of the database with a single request */
+      for (int j = 0; j < number_of_subscriptions; j++)
+      {
+         bool seen = false;
+
+         if (subscriptions[j].database != i)
+         {
+            continue;
+         }
+
+         for (int k = 0; !seen && k < j; k++)
+         {
+            seen = subscriptions[k].database == i && !strcmp(subscriptions[k].channel, subscriptions[j].channel);
+         }
+
+         if (!seen)
+         {
+            query = channel_command(query, "LISTEN", subscriptions[j].channel);
+         }
+      }
+
+      pgagroal_log_info("pgagroal_notify_relay: Database %s listens again (slot %d)", d->database, d->slot);
+
+      if (query == NULL || database_request(d, query, -1))
+      {
+         database_close(d, true);
+      }
+
+      free(query);
+      query = NULL;
+   }
+}
+
+static int
+database_find(char* username, char* database)
+{
+   int empty = -1;
+   struct notify_database* d = NULL;
+
+   /* A notification is sent to every session of the database, regardless of the user */
+   for (int i = 0; i < NOTIFY_DATABASES; i++)
+   {
+      if (databases[i].used && !strcmp(databases[i].database, database))
+      {
+         return i;
+      }
+
+      if (!databases[i].used && empty == -1)
+      {
+         empty = i;
+      }
+   }
+
+   if (empty == -1)
+   {
+      return -1;
+   }
+
+   d = &databases[empty];
+
+   d->used = true;
+   d->slot = -1;
+   d->ssl = NULL;
+   d->length = 0;
+   d->pending_start = 0;
+   d->pending_count = 0;
+   d->failed = false;
+
+   memset(&d->username, 0, sizeof(d->username));
+   memset(&d->database, 0, sizeof(d->database));
+   memcpy(&d->username[0], username, MIN(strlen(username), sizeof(d->username) - 1));
+   memcpy(&d->database[0], database, MIN(strlen(database), sizeof(d->database) - 1));
+
+   return empty;
+}
+
+static int
+database_connect(struct notify_database* d)
+{
+   int slot = -1;
+   int server_fd;
+   char* password = NULL;
+   SSL* ssl = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   password = pgagroal_get_user_password(d->username);
+   if (password == NULL)
+   {
+      pgagroal_log_warn("pgagroal_notify_relay: No password for user %s", d->username);
+      return 1;
+   }
+
+   if (pgagroal_prefill_auth(d->username, password, d->database, &slot, &ssl) != AUTH_SUCCESS)
+   {
+      pgagroal_log_warn("pgagroal_notify_relay: No connection for database %s user %s", d->database, d->username);
+
+      if (slot != -1)
+      {
+         if (config->connections[slot].fd != -1 && pgagroal_socket_isvalid(config->connections[slot].fd))
+         {
+            pgagroal_write_terminate(NULL, config->connections[slot].fd);
+         }
+         pgagroal_kill_connection(slot, ssl);
+      }
+
+      return 1;
+   }
+
+   server_fd = config->connections[slot].fd;
+
+   d->slot = slot;
+   d->ssl = ssl;
+   d->length = 0;
+   d->pending_start = 0;
+   d->pending_count = 0;
+   d->failed = false;
+
+   memset(&d->server, 0, sizeof(struct worker_io));
+   pgagroal_event_worker_init(&d->server.io, server_fd, server_fd, notify_server);
+   d->server.client_fd = -1;
+   d->server.server_fd = server_fd;
+   d->server.slot = slot;
+   d->server.client_ssl = NULL;
+   d->server.server_ssl = ssl;
+
+   pgagroal_io_start(&d->server.io);
+   d->active = true;
+
+   pgagroal_log_debug("pgagroal_notify_relay: Database %s user %s (slot %d)", d->database, d->username, slot);
+
+   return 0;
+}
+
+static void
+database_close(struct notify_database* d, bool kill)
+{
+   int fd;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (d->active)
+   {
+      pgagroal_io_stop(&d->server.io);
+      d->active = false;
+   }
+
+   /* The clients waiting for a reply are told about the failure */
+   while (d->pending_count > 0)
+   {
+      fd = d->pending[d->pending_start];
+      d->pending_start = (d->pending_start + 1) % NOTIFY_PENDING;
+      d->pending_count--;
+
+      if (fd != -1)
+      {
+         pgagroal_connection_id_write(fd, 1);
+         pgagroal_disconnect(fd);
+      }
+   }
+
+   if (d->slot != -1)
+   {
+      if (kill)
+      {
+         if (config->connections[d->slot].fd != -1 && pgagroal_socket_isvalid(config->connections[d->slot].fd))
+         {
+            pgagroal_write_terminate(d->ssl, config->connections[d->slot].fd);
+         }
+         pgagroal_kill_connection(d->slot, d->ssl);
+      }
+      else if (pgagroal_return_connection(d->slot, d->ssl, false))
+      {
+         pgagroal_log_warn("pgagroal_notify_relay: Failure during connection return (slot %d)", d->slot);
+      }
+
+      d->slot = -1;
+      d->ssl = NULL;
+   }
+
+   if (d->server.io.msg != NULL)
+   {
+      pgagroal_free_message(d->server.io.msg);
+      d->server.io.msg = NULL;
+   }
+
+   d->length = 0;
+}
+
+static int
+database_request(struct notify_database* d, char* query, int client_fd)
+{
+   size_t length;
+   char* data = NULL;
+   struct message msg;
+
+   if (d->slot == -1 || d->pending_count >= NOTIFY_PENDING)
+   {
+      return 1;
+   }
+
+   length = strlen(query);
+
+   data = malloc(MESSAGE_HEADER_SIZE + length + 1);
+   if (data == NULL)
+   {
+      return 1;
+   }
+
+   pgagroal_write_byte(data, 'Q');
+   pgagroal_write_int32(data + 1, (int32_t)(4 + length + 1));
+   memcpy(data + MESSAGE_HEADER_SIZE, query, length + 1);
+
+   memset(&msg, 0, sizeof(struct message));
+   msg.kind = 'Q';
+   msg.length = MESSAGE_HEADER_SIZE + length + 1;
+   msg.data = data;
+
+   if (pgagroal_write_message(d->ssl, d->server.server_fd, &msg) != MESSAGE_STATUS_OK)
+   {
+      free(data);
+      return 1;
+   }
+
+   free(data);
+
+   /* Every query is answered by one ReadyForQuery */
+   d->pending[(d->pending_start + d->pending_count) % NOTIFY_PENDING] = client_fd;
+   d->pending_count++;
+
+   return 0;
+}
+
+static void
+database_reply(struct notify_database* d)
+{
+   int fd;
+
+   if (d->pending_count == 0)
+   {
+      return;
+   }
+
+   fd = d->pending[d->pending_start];
+   d->pending_start = (d->pending_start + 1) % NOTIFY_PENDING;
+   d->pending_count--;
+
+   if (fd != -1)
+   {
+      pgagroal_connection_id_write(fd, d->failed ? 1 : 0);
+      pgagroal_disconnect(fd);
+   }
+
+   d->failed = false;
+}
+
+static char*
+channel_command(char* query, char* command, char* channel)
+{
+   if (query != NULL)
+   {
+      query = pgagroal_append(query, "; ");
+   }
+
+   query = pgagroal_append(query, command);
+
+   if (channel == NULL)
+   {
+      return pgagroal_append(query, " *");
+   }
+
+   /* The channel is quoted, as the client already normalized it */
+   query = pgagroal_append(query, " \"");
+   for (int i = 0; channel[i] != '\0'; i++)
+   {
+      if (channel[i] == '"')
+      {
+         query = pgagroal_append_char(query, '"');
+      }
+      query = pgagroal_append_char(query, channel[i]);
+   }
+
+   return pgagroal_append_char(query, '"');
+}
+
+static void
+subscribe(int client_fd, pid_t pid, char* username, char* database, char* channel)
+{
+   int index;
+   bool found = false;
+   char* query = NULL;
+   struct notify_database* d = NULL;
+   struct notify_subscription* s = NULL;
+
+   index = database_find(username, database);
+   if (index == -1)
+   {
+      pgagroal_log_warn("pgagroal_notify_relay: Too many databases (%d)", NOTIFY_DATABASES);
+      goto error;
+   }
+
+   d = &databases[index];
+
+   for (int i = 0; !found && i < number_of_subscriptions; i++)
+   {
+      s = &subscriptions[i];
+      found = s->pid == pid && s->database == index && !strcmp(s->channel, channel);
+   }
+
+   if (!found && number_of_subscriptions >= NOTIFY_SUBSCRIPTIONS)
+   {
+      pgagroal_log_warn("pgagroal_notify_relay: Too many subscriptions (%d)", NOTIFY_SUBSCRIPTIONS);
+      goto error;
+   }
+
+   if (d->slot == -1 && database_connect(d))
+   {
+      goto error;
+   }
+
+   /* Listening again is a no-op for the server, and its reply tells that the channel is listened on */
+   query = channel_command(NULL, "LISTEN", channel);
+   if (query == NULL || database_request(d, query, client_fd))
+   {
+      goto error;
+   }
+
+   free(query);
+
+   if (!found)
+   {
+      s = &subscriptions[number_of_subscriptions++];
+      s->pid = pid;
+      s->database = index;
+      memset(&s->channel, 0, sizeof(s->channel));
+      memcpy(&s->channel[0], channel, MIN(strlen(channel), sizeof(s->channel) - 1));
+   }
+
+   pgagroal_log_debug("pgagroal_notify_relay: PID %d listens on %s in database %s", (int)pid, channel, d->database);
+
+   return;
+
+error:
+
+   free(query);
+
+   pgagroal_connection_id_write(client_fd, 1);
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+unsubscribe(pid_t pid, char* channel)
+{
+   int i = 0;
+   char* query = NULL;
+   struct notify_subscription removed;
+
+   while (i < number_of_subscriptions)
+   {
+      if (subscriptions[i].pid != pid || (channel != NULL && strcmp(subscriptions[i].channel, channel)))
+      {
+         i++;
+         continue;
+      }
+
+      memcpy(&removed, &subscriptions[i], sizeof(struct notify_subscription));
+      subscriptions[i] = subscriptions[--number_of_subscriptions];
+
+      pgagroal_log_debug("pgagroal_notify_relay: PID %d stops listening on %s", (int)pid, removed.channel);
+
+      /* The server keeps listening while another client listens on the channel */
+      if (subscribers(removed.database, removed.channel) > 0)
+      {
+         continue;
+      }
+
+      query = channel_command(NULL, "UNLISTEN", subscribers(removed.database, NULL) > 0 ? removed.channel : NULL);
+      if (query != NULL)
+      {
+         database_request(&databases[removed.database], query, -1);
+      }
+
+      free(query);
+      query = NULL;
+   }
+}
+
+static void
+fan_out(int database, char* data, int length)
+{
+   int fd = -1;
+   int dead = 0;
+   char buf4[4];
+   char* channel = NULL;
+   pid_t gone[NOTIFY_DEAD_CLIENTS];
+
+   /* NotificationResponse: the process id of the server, the channel and the payload */
+   if (length <= 9 || strnlen(data + 9, length - 9) >= (size_t)(length - 9))
+   {
+      return;
+   }
+
+   channel = data + 9;
+
+   pgagroal_write_int32(&buf4[0], length);
+
+   for (int i = 0; i < number_of_subscriptions; i++)
+   {
+      struct notify_subscription* s = &subscriptions[i];
+
+      if (s->database != database || strcmp(s->channel, channel))
+      {
+         continue;
+      }
+
+      if (pgagroal_connection_get_pid(s->pid, &fd) ||
+          pgagroal_connection_id_write(fd, CONNECTION_NOTIFY) ||
+          pgagroal_connection_buffer_write(fd, &buf4[0], sizeof(buf4)) ||
+          pgagroal_connection_buffer_write(fd, data, length))
+      {
+         /* The client is gone without telling the relay */
+         if (dead < NOTIFY_DEAD_CLIENTS)
+         {
+            gone[dead++] = s->pid;
+         }
+      }
+
+      if (fd != -1)
+      {
+         pgagroal_disconnect(fd);
+         fd = -1;
+      }
+   }
+
+   for (int i = 0; i < dead; i++)
+   {
+      unsubscribe(gone[i], NULL);
+   }
+}
+
+static int
+subscribers(int database, char* channel)
+{
+   int count = 0;
+
+   for (int i = 0; i < number_of_subscriptions; i++)
+   {
+      if (subscriptions[i].database == database && (channel == NULL || !strcmp(subscriptions[i].channel, channel)))
+      {
+         count++;
+      }
+   }
+
+   return count;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <logging.h>
+#include <message.h>
+#include <parameters.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* The parameters as reported by ParameterStatus */
+static char* names[NUMBER_OF_SESSION_PARAMETERS] = {"application_name", "client_encoding", "search_path", "TimeZone"};
+
+static bool tracked[NUMBER_OF_SESSION_PARAMETERS];
+static uint64_t hashes[NUMBER_OF_SESSION_PARAMETERS];
+static char values[NUMBER_OF_SESSION_PARAMETERS][MAX_PARAMETER_VALUE_LENGTH];
+static bool changed[NUMBER_OF_SESSION_PARAMETERS];
+static uint64_t previous[NUMBER_OF_SESSION_PARAMETERS];
+
+static int parameter_index(char* name);
+static void set_value(int index, char* value);
+static uint64_t hash(char* value);
+static size_t append_literal(char* data, char* value);
+
+void
+pgagroal_parameters_startup(struct message* msg)
+{
+   int i;
+   int index;
+   char* data = (char*)msg->data;
+   char* name = NULL;
+   char* value = NULL;
+
+   for (int j = 0; j < NUMBER_OF_SESSION_PARAMETERS; j++)
+   {
+      tracked[j] = true;
+      hashes[j] = 0;
+      values[j][0] = '\0';
+   }
+
+   /* The parameters start after the protocol version, and the message is zero terminated */
+   i = 8;
+   while (i < msg->length - 1 && data[i] != '\0')
+   {
+      name = data + i;
+      i += strlen(name) + 1;
+
+      if (i >= msg->length)
+      {
+         break;
+      }
+
+      value = data + i;
+      i += strlen(value) + 1;
+
+      index = parameter_index(name);
+      if (index != -1)
+      {
+         set_value(index, value);
+      }
+   }
+}
+
+void
+pgagroal_parameters_created(int slot)
+{
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
+   {
+      pgagroal_connection_info(slot)->session_parameters[i] = hashes[i];
+   }
+}
+
+void
+pgagroal_parameters_server(int slot, struct message_frame* frame)
+{
+   int index;
+   char* name = NULL;
+   char* value = NULL;
+   char* end = NULL;
+
+   if (slot == -1 || frame->kind != 'S' || frame->available != frame->length - 4)
+   {
+      return;
+   }
+
+   name = frame->body;
+   end = memchr(name, '\0', frame->available);
+   if (end == NULL)
+   {
+      return;
+   }
+
+   value = end + 1;
+   if (memchr(value, '\0', frame->available - (value - frame->body)) == NULL)
+   {
+      return;
+   }
+
+   index = parameter_index(name);
+   if (index == -1)
+   {
+      return;
+   }
+
+   set_value(index, value);
+   pgagroal_connection_info(slot)->session_parameters[index] = hash(value);
+}
+
+int
+pgagroal_parameters_synchronize(SSL* ssl, int socket, int slot, bool* sent)
+{
+   size_t size = 5 + 1;
+   size_t offset = 5;
+   char* data = NULL;
+   uint64_t* backend = pgagroal_connection_info(slot)->session_parameters;
+   struct message msg;
+
+   *sent = false;
+
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
+   {
+      changed[i] = tracked[i] && hashes[i] != backend[i];
+
+      if (changed[i])
+      {
+         /* Every quote and backslash may be escaped */
+         size += 64 + 2 * strlen(names[i]) + 2 * strlen(values[i]);
+      }
+   }
+
+   if (size == 5 + 1)
+   {
+      return 0;
+   }
+
+   data = (char*)malloc(size);
+   if (data == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
+   {
+      if (!changed[i])
+      {
+         continue;
+      }
+
+      if (hashes[i] == 0)
+      {
+         offset += pgagroal_snprintf(data + offset, size - offset, "RESET %s;", names[i]);
+      }
+      else
+      {
+         /* set_config() takes the value as text, so a list like search_path keeps its form */
+         offset += pgagroal_snprintf(data + offset, size - offset, "SELECT pg_catalog.set_config('%s', ", names[i]);
+         offset += append_literal(data + offset, values[i]);
+         offset += pgagroal_snprintf(data + offset, size - offset, ", false);");
+      }
+
+      pgagroal_log_debug("parameters: %s on slot %d", names[i], slot);
+
+      previous[i] = backend[i];
+      backend[i] = hashes[i];
+   }
+
+   data[offset++] = '\0';
+   pgagroal_write_byte(data, 'Q');
+   pgagroal_write_int32(data + 1, offset - 1);
+
+   memset(&msg, 0, sizeof(struct message));
+   msg.kind = 'Q';
+   msg.length = offset;
+   msg.data = data;
+
+   if (pgagroal_write_message(ssl, socket, &msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   *sent = true;
+
+   free(data);
+
+   return 0;
+
+error:
+   pgagroal_log_debug("parameters: unable to synchronize slot %d", slot);
+
+   free(data);
+
+   return 1;
+}
+
+void
+pgagroal_parameters_failed(int slot)
+{
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
+   {
+      if (changed[i])
+      {
+         pgagroal_log_warn("parameters: %s could not be set on slot %d", names[i], slot);
+
+         pgagroal_connection_info(slot)->session_parameters[i] = previous[i];
+         tracked[i] = false;
+         changed[i] = false;
+      }
+   }
+}
+
+void
+pgagroal_parameters_reset(int slot)
+{
+   memset(&pgagroal_connection_info(slot)->session_parameters, 0,
+          sizeof(pgagroal_connection_info(slot)->session_parameters));
+}
+
+static int
+parameter_index(char* name)
+{
+   /* The names of the parameters are case insensitive */
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
+   {
+      if (!strcasecmp(name, names[i]))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static void
+set_value(int index, char* value)
+{
+   size_t length = strlen(value);
+
+   if (length >= MAX_PARAMETER_VALUE_LENGTH)
+   {
+      /* Too large to replay, so the parameter is left to the client */
+      tracked[index] = false;
+      return;
+   }
+
+   memcpy(&values[index][0], value, length + 1);
+   hashes[index] = hash(value);
+   tracked[index] = true;
+}
+
+static uint64_t
+hash(char* value)
+{
+   uint64_t h = 14695981039346656037ULL;
+
+   for (size_t i = 0; value[i] != '\0'; i++)
+   {
+      h = (h ^ (unsigned char)value[i]) * 1099511628211ULL;
+   }
+
+   /* 0 is the startup value */
+   return h | 1;
+}
+
+static size_t
+append_literal(char* data, char* value)
+{
+   size_t offset = 0;
+
+   /* An escape string literal doesn't depend on standard_conforming_strings */
+   data[offset++] = 'E';
+   data[offset++] = '\'';
+
+   for (size_t i = 0; value[i] != '\0'; i++)
+   {
+      if (value[i] == '\'' || value[i] == '\\')
+      {
+         data[offset++] = value[i];
+      }
+      data[offset++] = value[i];
+   }
+
+   data[offset++] = '\'';
+
+   return offset;
+}
@@ -28,16 +28,19 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <activity.h>
 #include <ev.h>
 #include <logging.h>
 #include <management.h>
 #include <message.h>
 #include <network.h>
 #include <pipeline.h>
+#include <shmem.h>
 #include <worker.h>
 
 /* system */
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -52,8 +55,10 @@ static void performance_server(struct io_watcher* watcher);
 static void performance_stop(struct event_loop* loop, struct worker_io*);
 static void performance_destroy(void*, size_t);
 static void performance_periodic(void);
+static int performance_relay(struct worker_io* wi, bool* client_failed);
 
 static bool saw_x = false;
+static int relay_pipe[2] = {-1, -1};
 
 struct pipeline
 performance_pipeline(void)
@@ -84,7 +89,7 @@ performance_start(struct event_loop* loop __attribute__((unused)), struct worker
 
    config = (struct main_configuration*)shmem;
 
-   for (int i = 0; i < config->max_connections; i++)
+   for (int i = 0; i < config->connection_slots; i++)
    {
       if (i != w->slot && !config->connections[i].new && config->connections[i].fd > 0)
       {
@@ -92,12 +97,40 @@ performance_start(struct event_loop* loop __attribute__((unused)), struct worker
       }
    }
 
+   /* The messages aren't looked at, so the client is active for its whole session */
+   pgagroal_activity_state(ACTIVITY_ACTIVE, ACTIVITY_WAIT_NONE);
+
+#if HAVE_LINUX
+   /* io_uring owns the receives of its watchers, so only epoll can relay */
+   if (config->performance_splice && config->ev_backend == PGAGROAL_EVENT_BACKEND_EPOLL)
+   {
+      if (pipe2(relay_pipe, O_CLOEXEC))
+      {
+         pgagroal_log_debug("performance_start: pipe2 error: %s", strerror(errno));
+         relay_pipe[0] = -1;
+         relay_pipe[1] = -1;
+         errno = 0;
+      }
+      else
+      {
+         fcntl(relay_pipe[1], F_SETPIPE_SZ, DEFAULT_BUFFER_SIZE);
+      }
+   }
+#endif
+
    return;
 }
 
 static void
 performance_stop(struct event_loop* loop __attribute__((unused)), struct worker_io* w __attribute__((unused)))
 {
+   if (relay_pipe[0] != -1)
+   {
+      close(relay_pipe[0]);
+      close(relay_pipe[1]);
+      relay_pipe[0] = -1;
+      relay_pipe[1] = -1;
+   }
 }
 
 static void
@@ -116,7 +149,6 @@ performance_client(struct io_watcher* watcher)
    int status = MESSAGE_STATUS_ERROR;
    struct worker_io* wi = NULL;
    struct message* msg = NULL;
-   struct main_configuration* config = (struct main_configuration*)shmem;
 
    wi = (struct worker_io*)watcher;
 
@@ -154,7 +186,7 @@ performance_client(struct io_watcher* watcher)
 
 client_done:
    pgagroal_log_debug("[C] Client done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->client_fd, status);
    errno = 0;
 
@@ -172,7 +204,7 @@ client_done:
 
 client_error:
    pgagroal_log_warn("[C] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -183,7 +215,7 @@ client_error:
 
 server_error:
    pgagroal_log_warn("[C] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -198,12 +230,33 @@ performance_server(struct io_watcher* watcher)
 {
    int status = MESSAGE_STATUS_ERROR;
    bool fatal = false;
+   bool client_failed = false;
    struct worker_io* wi = NULL;
    struct message* msg = NULL;
-   struct main_configuration* config = (struct main_configuration*)shmem;
 
    wi = (struct worker_io*)watcher;
 
+   if (relay_pipe[0] != -1)
+   {
+      status = performance_relay(wi, &client_failed);
+
+      if (likely(status == MESSAGE_STATUS_OK))
+      {
+         return;
+      }
+      else if (status == MESSAGE_STATUS_ZERO)
+      {
+         /* The server side isn't inspected, so a close is never taken as a clean end */
+         exit_code = WORKER_SERVER_FAILURE;
+         goto server_done;
+      }
+      else if (client_failed)
+      {
+         goto client_error;
+      }
+      goto server_error;
+   }
+
    status = pgagroal_recv_message(watcher, &msg);
 
    if (likely(status == MESSAGE_STATUS_OK))
@@ -229,7 +282,7 @@ performance_server(struct io_watcher* watcher)
             exit_code = WORKER_SERVER_FATAL;
             pgagroal_event_loop_break();
             pgagroal_log_warn("[C] Server Fatal (slot %d database %s user %s): %s (socket %d status %d)",
-                              wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                              wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                               strerror(errno), wi->client_fd, status);
          }
       }
@@ -247,7 +300,7 @@ performance_server(struct io_watcher* watcher)
 
 client_error:
    pgagroal_log_warn("[S] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -259,7 +312,7 @@ client_error:
 
 server_done:
    pgagroal_log_debug("[S] Server done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->server_fd, status);
    errno = 0;
 
@@ -268,7 +321,7 @@ server_done:
 
 server_error:
    pgagroal_log_warn("[S] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -278,3 +331,49 @@ server_error:
    pgagroal_event_loop_break();
    return;
 }
+
+static int
+performance_relay(struct worker_io* wi, bool* client_failed)
+{
+#if HAVE_LINUX
+   ssize_t in;
+   ssize_t out;
+
+   in = splice(wi->server_fd, NULL, relay_pipe[1], NULL, DEFAULT_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+   if (in == 0)
+   {
+      return MESSAGE_STATUS_ZERO;
+   }
+   else if (in < 0)
+   {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      {
+         errno = 0;
+         return MESSAGE_STATUS_OK;
+      }
+      return MESSAGE_STATUS_ERROR;
+   }
+
+   /* The pipe holds what was read, so drain it completely into the client */
+   while (in > 0)
+   {
+      out = splice(relay_pipe[0], NULL, wi->client_fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (out <= 0)
+      {
+         if (out < 0 && errno == EINTR)
+         {
+            continue;
+         }
+         *client_failed = true;
+         return MESSAGE_STATUS_ERROR;
+      }
+      in -= out;
+   }
+
+   return MESSAGE_STATUS_OK;
+#else
+   (void)wi;
+   (void)client_failed;
+   return MESSAGE_STATUS_ERROR;
+#endif
+}
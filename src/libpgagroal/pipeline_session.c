@@ -28,6 +28,7 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <activity.h>
 #include <ev.h>
 #include <logging.h>
 #include <management.h>
@@ -41,11 +42,13 @@
 #include <worker.h>
 
 /* system */
+#include <ctype.h>
 #include <errno.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/types.h>
@@ -58,11 +61,16 @@ static void session_server(struct io_watcher* watcher);
 static void session_stop(struct event_loop* loop, struct worker_io*);
 static void session_destroy(void*, size_t);
 static void session_periodic(void);
+static void session_state(int slot, struct message_frame* frame);
+static signed char query_reset(char* query, int length);
+static signed char word_reset(char* word, int length, bool start);
+static bool word_is(char* word, int length, char* keyword);
 
 static bool in_tx;
-static int next_client_message;
-static int next_server_message;
+static struct message_stream client_stream;
+static struct message_stream server_stream;
 static bool saw_x = false;
+static bool lazy_reset = false;
 
 #define CLIENT_INIT   0
 #define CLIENT_IDLE   1
@@ -109,14 +117,13 @@ session_initialize(void* shmem, void** pipeline_shmem, size_t* pipeline_shmem_si
 
    if (config->disconnect_client > 0)
    {
-      session_shmem_size = config->max_connections * sizeof(struct client_session);
+      session_shmem_size = config->connection_slots * sizeof(struct client_session);
       if (pgagroal_create_shared_memory(session_shmem_size, config->common.hugepage, &session_shmem))
       {
          return 1;
       }
-      memset(session_shmem, 0, session_shmem_size);
 
-      for (int i = 0; i < config->max_connections; i++)
+      for (int i = 0; i < config->connection_slots; i++)
       {
          client = session_shmem + (i * sizeof(struct client_session));
 
@@ -140,10 +147,14 @@ session_start(struct event_loop* loop __attribute__((unused)), struct worker_io*
    config = (struct main_configuration*)shmem;
 
    in_tx = false;
-   next_client_message = 0;
-   next_server_message = 0;
+   memset(&client_stream, 0, sizeof(struct message_stream));
+   memset(&server_stream, 0, sizeof(struct message_stream));
+
+   /* The connection is reset as the client changes the session state */
+   lazy_reset = config->lazy_reset;
+   config->connections[w->slot].reset = lazy_reset ? RESET_NONE : RESET_DISCARD;
 
-   for (int i = 0; i < config->max_connections; i++)
+   for (int i = 0; i < config->connection_slots; i++)
    {
       if (i != w->slot && !config->connections[i].new && config->connections[i].fd > 0)
       {
@@ -246,13 +257,13 @@ session_periodic(void)
                   }
                   else
                   {
-                     ret = pgagroal_connect(config->servers[server].host, config->servers[server].port, &socket, config->keep_alive, config->nodelay);
+                     ret = pgagroal_connect_server(server, &socket, config->keep_alive, config->nodelay);
                   }
 
                   if (ret == 0)
                   {
                      pgagroal_log_debug("Cancel request for %s/%s using slot %d (pid %d)",
-                                        config->connections[i].database, config->connections[i].username,
+                                        pgagroal_connection_info(i)->database, pgagroal_connection_info(i)->username,
                                         i, config->connections[i].backend_pid);
 
                      pgagroal_write_message(NULL, socket, cancel_msg);
@@ -263,7 +274,7 @@ session_periodic(void)
                   atomic_store(&config->states[i], STATE_GRACEFULLY);
 
                   pgagroal_log_info("Disconnect client %s/%s using slot %d (pid %d socket %d)",
-                                    config->connections[i].database, config->connections[i].username,
+                                    pgagroal_connection_info(i)->database, pgagroal_connection_info(i)->username,
                                     i, config->connections[i].pid, config->connections[i].fd);
                   kill(config->connections[i].pid, SIGQUIT);
 
@@ -299,47 +310,31 @@ session_client(struct io_watcher* watcher)
 
    if (likely(status == MESSAGE_STATUS_OK))
    {
-      pgagroal_prometheus_network_sent_add(msg->length);
+      pgagroal_prometheus_local_network_sent_add(msg->length);
 
       if (likely(msg->kind != 'X'))
       {
          int offset = 0;
+         struct message_frame frame;
 
-         while (offset < msg->length)
+         while (pgagroal_message_stream_next(&client_stream, msg, &offset, lazy_reset ? "QEPF" : "QE", &frame))
          {
-            if (next_client_message == 0)
+            /* The Q and E message tell us the execute of the simple query and the prepared statement */
+            if (frame.kind == 'Q' || frame.kind == 'E')
             {
-               char kind = pgagroal_read_byte(msg->data + offset);
-               int length = pgagroal_read_int32(msg->data + offset + 1);
-
-               /* The Q and E message tell us the execute of the simple query and the prepared statement */
-               if (kind == 'Q' || kind == 'E')
-               {
-                  pgagroal_prometheus_query_count_add();
-                  pgagroal_prometheus_query_count_specified_add(wi->slot);
-               }
-
-               /* Calculate the offset to the next message */
-               if (offset + length + 1 <= msg->length)
-               {
-                  next_client_message = 0;
-                  offset += length + 1;
-               }
-               else
-               {
-                  next_client_message = length + 1 - (msg->length - offset);
-                  offset = msg->length;
-               }
+               pgagroal_prometheus_local_query_count_add(wi->slot);
             }
-            else
+
+            if (lazy_reset && frame.kind != 'E')
             {
-               offset = MIN(next_client_message, msg->length);
-               next_client_message -= offset;
+               session_state(wi->slot, &frame);
             }
          }
 
          status = pgagroal_send_message(watcher, msg);
 
+         pgagroal_activity_state(ACTIVITY_ACTIVE, ACTIVITY_WAIT_SERVER);
+
          if (unlikely(status == MESSAGE_STATUS_ERROR))
          {
             if (config->failover)
@@ -377,7 +372,7 @@ session_client(struct io_watcher* watcher)
 
 client_done:
    pgagroal_log_debug("[C] Client done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->client_fd, status);
    errno = 0;
 
@@ -397,7 +392,7 @@ client_done:
 
 client_error:
    pgagroal_log_warn("[C] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -411,7 +406,7 @@ client_error:
 
 server_error:
    pgagroal_log_warn("[C] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -440,9 +435,10 @@ session_server(struct io_watcher* watcher)
    bool fatal = false;
    struct worker_io* wi = NULL;
    struct message* msg = NULL;
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   struct main_configuration* config = NULL;
 
    wi = (struct worker_io*)watcher;
+   config = (struct main_configuration*)shmem;
 
    client_active(wi->slot);
 
@@ -450,46 +446,36 @@ session_server(struct io_watcher* watcher)
 
    if (likely(status == MESSAGE_STATUS_OK))
    {
-      pgagroal_prometheus_network_received_add(msg->length);
+      pgagroal_prometheus_local_network_received_add(msg->length);
 
       int offset = 0;
+      struct message_frame frame;
 
-      while (offset < msg->length)
+      while (pgagroal_message_stream_next(&server_stream, msg, &offset, lazy_reset ? "ZS" : "Z", &frame))
       {
-         if (next_server_message == 0)
+         /* The S message tells us that a reported parameter changed */
+         if (frame.kind == 'S')
          {
-            char kind = pgagroal_read_byte(msg->data + offset);
-            int length = pgagroal_read_int32(msg->data + offset + 1);
-
-            /* The Z message tell us the transaction state */
-            if (kind == 'Z')
-            {
-               char tx_state = pgagroal_read_byte(msg->data + offset + 5);
-
-               if (tx_state != 'I' && !in_tx)
-               {
-                  pgagroal_prometheus_tx_count_add();
-               }
+            config->connections[wi->slot].reset = RESET_DISCARD;
+         }
 
-               in_tx = tx_state != 'I';
-            }
+         /* The Z message tell us the transaction state */
+         if (frame.kind == 'Z' && frame.available > 0)
+         {
+            char tx_state = frame.body[0];
 
-            /* Calculate the offset to the next message */
-            if (offset + length + 1 <= msg->length)
+            if (tx_state != 'I' && !in_tx)
             {
-               next_server_message = 0;
-               offset += length + 1;
+               pgagroal_prometheus_tx_count_add();
             }
-            else
+            else if (tx_state == 'I')
             {
-               next_server_message = length + 1 - (msg->length - offset);
-               offset = msg->length;
+               pgagroal_prometheus_local_transaction_end();
             }
-         }
-         else
-         {
-            offset = MIN(next_server_message, msg->length);
-            next_server_message -= offset;
+
+            in_tx = tx_state != 'I';
+
+            pgagroal_activity_state(in_tx ? ACTIVITY_IDLE_IN_TRANSACTION : ACTIVITY_IDLE, ACTIVITY_WAIT_CLIENT);
          }
       }
 
@@ -520,6 +506,15 @@ session_server(struct io_watcher* watcher)
    {
       goto server_done;
    }
+   else if (errno == ETIMEDOUT && config->failover)
+   {
+      /* The server stopped answering within tcp_user_timeout or the keep alive probes */
+      pgagroal_server_failover(wi->slot);
+      pgagroal_write_client_failover(wi->client_ssl, wi->client_fd);
+      pgagroal_prometheus_failed_servers();
+
+      goto failover;
+   }
    else
    {
       goto server_error;
@@ -531,7 +526,7 @@ session_server(struct io_watcher* watcher)
 
 client_error:
    pgagroal_log_warn("[S] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -545,7 +540,7 @@ client_error:
 
 server_done:
    pgagroal_log_debug("[S] Server done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->server_fd, status);
    errno = 0;
 
@@ -556,7 +551,7 @@ server_done:
 
 server_error:
    pgagroal_log_warn("[S] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -565,6 +560,19 @@ server_error:
 
    exit_code = WORKER_SERVER_FAILURE;
 
+   pgagroal_event_loop_break();
+   return;
+
+failover:
+   pgagroal_log_warn("[S] Server timed out (slot %d database %s user %s): %s (socket %d status %d)",
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
+                     strerror(ETIMEDOUT), wi->server_fd, status);
+   errno = 0;
+
+   client_inactive(wi->slot);
+
+   exit_code = WORKER_FAILOVER;
+
    pgagroal_event_loop_break();
    return;
 }
@@ -594,3 +602,155 @@ client_inactive(int slot)
       client->timestamp = time(NULL);
    }
 }
+
+static void
+session_state(int slot, struct message_frame* frame)
+{
+   signed char reset = RESET_NONE;
+   char* end = NULL;
+   struct main_configuration* config = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->connections[slot].reset == RESET_DISCARD)
+   {
+      return;
+   }
+
+   if (frame->kind == 'Q')
+   {
+      reset = query_reset(frame->body, frame->available);
+
+      /* The rest of a split query isn't seen */
+      if (frame->available < frame->length - 4)
+      {
+         reset = RESET_DISCARD;
+      }
+   }
+   else if (frame->kind == 'P')
+   {
+      end = memchr(frame->body, '\0', frame->available);
+
+      if (end == NULL || memchr(end + 1, '\0', frame->available - (end + 1 - frame->body)) == NULL)
+      {
+         reset = RESET_DISCARD;
+      }
+      else
+      {
+         reset = query_reset(end + 1, frame->available - (end + 1 - frame->body));
+
+         /* A named statement stays on the server */
+         if (frame->body[0] != '\0')
+         {
+            reset = MAX(reset, RESET_DEALLOCATE);
+         }
+      }
+   }
+   else
+   {
+      /* A function call can change anything */
+      reset = RESET_DISCARD;
+   }
+
+   if (reset > config->connections[slot].reset)
+   {
+      config->connections[slot].reset = reset;
+   }
+}
+
+static signed char
+query_reset(char* query, int length)
+{
+   bool start = true;
+   int i = 0;
+   int word = 0;
+   signed char reset = RESET_NONE;
+
+   while (i < length && query[i] != '\0' && reset != RESET_DISCARD)
+   {
+      if (query[i] == '-' && i + 1 < length && query[i + 1] == '-')
+      {
+         while (i < length && query[i] != '\n')
+         {
+            i++;
+         }
+      }
+      else if (query[i] == '/' && i + 1 < length && query[i + 1] == '*')
+      {
+         i += 2;
+         while (i + 1 < length && !(query[i] == '*' && query[i + 1] == '/'))
+         {
+            i++;
+         }
+         i += 2;
+      }
+      else if (isalpha((unsigned char)query[i]) || query[i] == '_')
+      {
+         word = i;
+         while (i < length && (isalnum((unsigned char)query[i]) || query[i] == '_' || query[i] == '$'))
+         {
+            i++;
+         }
+
+         reset = MAX(reset, word_reset(query + word, i - word, start));
+         start = false;
+      }
+      else
+      {
+         /* A semicolon inside a literal only makes the check stricter */
+         if (query[i] == ';')
+         {
+            start = true;
+         }
+         else if (!isspace((unsigned char)query[i]))
+         {
+            start = false;
+         }
+         i++;
+      }
+   }
+
+   return reset;
+}
+
+static signed char
+word_reset(char* word, int length, bool start)
+{
+   if (start)
+   {
+      if (word_is(word, length, "SET") || word_is(word, length, "RESET") ||
+          word_is(word, length, "LISTEN") || word_is(word, length, "DECLARE") ||
+          word_is(word, length, "LOAD") || word_is(word, length, "DO"))
+      {
+         return RESET_DISCARD;
+      }
+
+      if (word_is(word, length, "PREPARE"))
+      {
+         return RESET_DEALLOCATE;
+      }
+   }
+
+   if (word_is(word, length, "TEMP") || word_is(word, length, "TEMPORARY") ||
+       word_is(word, length, "PG_TEMP") || word_is(word, length, "SET_CONFIG"))
+   {
+      return RESET_DISCARD;
+   }
+
+   /* pg_advisory_lock, pg_try_advisory_lock and friends */
+   for (int i = 0; i + 8 <= length; i++)
+   {
+      if (!strncasecmp(word + i, "ADVISORY", 8))
+      {
+         return RESET_DISCARD;
+      }
+   }
+
+   return RESET_NONE;
+}
+
+static bool
+word_is(char* word, int length, char* keyword)
+{
+   return length == (int)strlen(keyword) && !strncasecmp(word, keyword, length);
+}
@@ -28,24 +28,34 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <activity.h>
 #include <connection.h>
 #include <ev.h>
+#include <fingerprint.h>
 #include <logging.h>
 #include <message.h>
 #include <network.h>
+#include <notify.h>
+#include <parameters.h>
 #include <pipeline.h>
 #include <pool.h>
+#include <prepared.h>
+#include <probes.h>
 #include <prometheus.h>
+#include <query_cache.h>
 #include <server.h>
 #include <shmem.h>
+#include <slowlog.h>
 #include <tracker.h>
 #include <worker.h>
 #include <utils.h>
 
 /* system */
+#include <ctype.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/types.h>
@@ -53,6 +63,7 @@
 
 static int transaction_initialize(void*, void**, size_t*);
 static void transaction_start(struct event_loop* loop, struct worker_io*);
+static void statement_start(struct event_loop* loop, struct worker_io*);
 static void transaction_client(struct io_watcher* watcher);
 static void transaction_server(struct io_watcher* watcher);
 static void transaction_stop(struct event_loop* loop, struct worker_io*);
@@ -62,22 +73,88 @@ static void transaction_periodic(void);
 static void start_mgt(struct event_loop* loop);
 static void shutdown_mgt(struct event_loop* loop);
 static void accept_cb(struct io_watcher* watcher);
+static int release_connection(void);
+static void sticky_cb(void);
+static void idle_cb(void);
+static bool rolled_back_request(struct worker_io* wi, struct message* msg);
+static bool ends_transaction(struct message_frame* frame);
+static bool listen_request(struct worker_io* wi, struct message* msg);
+static bool listen_command(char* query, int length, bool* listen, char* channel);
+static int channel_index(char* channel);
+static void notify_queue(char* data, int length);
+static void notify_flush(void);
+static bool single_query(struct message* msg);
+static bool cached_reply(struct worker_io* wi, struct message* msg);
+static bool session_query(struct message_frame* frame);
+static void sample_query(struct message_frame* frame);
+static long long command_rows(struct message_frame* frame);
+static int backend_fd(int slot);
 
 static int slot;
 static char username[MAX_USERNAME_LENGTH];
 static char database[MAX_DATABASE_LENGTH];
 static char appname[MAX_APPLICATION_NAME];
 static bool in_tx;
-static int next_client_message;
-static int next_server_message;
+static struct message_stream client_stream;
+static struct message_stream server_stream;
 static int unix_socket = -1;
-static int deallocate;
+static bool deallocate;
+static bool tracked;
+static bool prepared;
+static bool statement;
+static bool server_idle;
 static bool fatal;
 static int fds[MAX_NUMBER_OF_CONNECTIONS];
 static bool saw_x = false;
+static bool copy_in = false;
+static bool copy_out = false;
 static struct io_watcher io_mgt;
 static struct worker_io server_io;
 static bool io_watcher_active = false;
+static bool sticky = false;
+static struct periodic_watcher sticky_timer;
+static int64_t idle_timeout;
+static bool idle = false;
+static bool rolled_back = false;
+static int requests;
+static struct periodic_watcher idle_timer;
+static bool cache = false;
+static bool capturing = false;
+static char* capture = NULL;
+static int capture_length;
+static int capture_state;
+static char* capture_query = NULL;
+static int capture_query_length;
+static struct message held;
+static int database_index = -1;
+static bool timing = false;
+static bool timed = false;
+static bool serving = false;
+static struct timespec transaction_begin;
+static struct timespec service_begin;
+static long long service_time;
+static char* client_kinds = NULL;
+static char* server_kinds = NULL;
+static bool statistics = false;
+static bool sampled = false;
+static int sample_countdown;
+static int sample_weight;
+static uint64_t sample_fingerprint;
+static long long sample_rows;
+static struct timespec sample_begin;
+static char sample_text[QUERY_FINGERPRINT_LENGTH];
+static bool notify = false;
+static bool listened = false;
+static int number_of_channels;
+static char channels[NOTIFY_CLIENT_CHANNELS][NOTIFY_CHANNEL_LENGTH];
+static char* notifications = NULL;
+static int notifications_length;
+static struct worker_io* notify_client = NULL;
+static bool parameters = false;
+static bool synchronize = false;
+static bool synchronizing = false;
+static struct timespec synchronize_start;
+static char parameter_kinds[16];
 
 struct pipeline
 transaction_pipeline(void)
@@ -95,6 +172,16 @@ transaction_pipeline(void)
    return pipeline;
 }
 
+struct pipeline
+statement_pipeline(void)
+{
+   struct pipeline pipeline = transaction_pipeline();
+
+   pipeline.start = &statement_start;
+
+   return pipeline;
+}
+
 static int
 transaction_initialize(void* shmem __attribute__((unused)), void** pipeline_shmem __attribute__((unused)), size_t* pipeline_shmem_size __attribute__((unused)))
 {
@@ -111,16 +198,119 @@ transaction_start(struct event_loop* loop, struct worker_io* w)
    config = (struct main_configuration*)shmem;
 
    slot = -1;
-   memcpy(&username[0], config->connections[w->slot].username, MAX_USERNAME_LENGTH);
-   memcpy(&database[0], config->connections[w->slot].database, MAX_DATABASE_LENGTH);
-   memcpy(&appname[0], config->connections[w->slot].appname, MAX_APPLICATION_NAME);
+   memcpy(&username[0], pgagroal_connection_info(w->slot)->username, MAX_USERNAME_LENGTH);
+   memcpy(&database[0], pgagroal_connection_info(w->slot)->database, MAX_DATABASE_LENGTH);
+   memcpy(&appname[0], pgagroal_connection_info(w->slot)->appname, MAX_APPLICATION_NAME);
+   pgagroal_slowlog_application_name(&appname[0]);
    in_tx = false;
-   next_client_message = 0;
-   next_server_message = 0;
+   copy_in = false;
+   copy_out = false;
+   memset(&client_stream, 0, sizeof(struct message_stream));
+   memset(&server_stream, 0, sizeof(struct message_stream));
    deallocate = false;
 
+   /* The transaction and server times are recorded per database */
+   database_index = config->common.metrics > 0 ? pgagroal_prometheus_database_index(&database[0]) : -1;
+   timing = database_index != -1 || config->slow_transaction_threshold > 0 || pgagroal_probe_enabled();
+   timed = false;
+   serving = false;
+
+   /* The settings that the framing loop looks at are read once per client */
+   tracked = config->track_prepared_statements;
+
+   /* Statements are replayed with a blocking round trip on the backend socket,
+    * which io_uring owns through its pending receive */
+   prepared = tracked && config->ev_backend != PGAGROAL_EVENT_BACKEND_IO_URING;
+
+   /* The processes are per client, so the pid spreads the samples over the clients */
+   statistics = config->common.metrics > 0 && config->query_statistics;
+   sampled = false;
+   sample_countdown = (int)(getpid() % config->query_statistics_sample);
+
+   /* The Sync messages are counted against the ReadyForQuery messages, such that
+    * a transaction is only idle when no request of the client is outstanding */
+   idle_timeout = statement ? 0 : pgagroal_time_convert(config->idle_transaction_timeout, FORMAT_TIME_S) * 1000;
+   idle = false;
+   rolled_back = false;
+   requests = 0;
+
+   /* A client message is read before a connection is obtained when the
+    * query cache is used, which io_uring delivers through the watcher */
+   cache = query_cache_shmem != NULL && config->ev_backend != PGAGROAL_EVENT_BACKEND_IO_URING;
+
+   /* The Parse messages carry the query text, and the CommandComplete messages the rows */
+   if (tracked)
+   {
+      client_kinds = "PBDCQES";
+   }
+   else if (statistics || cache)
+   {
+      client_kinds = idle_timeout > 0 ? "PQES" : "PQE";
+   }
+   else
+   {
+      client_kinds = idle_timeout > 0 ? "QES" : "QE";
+   }
+
+   /* The ParseComplete messages tell us the statements that exist on the backend */
+   if (prepared)
+   {
+      server_kinds = statistics ? "1CEGHWZ" : "1EGHWZ";
+   }
+   else
+   {
+      server_kinds = statistics ? "CGHWZ" : "GHWZ";
+   }
+
+   /* The session parameters of the client are given to every backend it obtains,
+    * and the ParameterStatus messages tell us the values it changed */
+   parameters = config->track_session_parameters;
+   synchronize = false;
+   synchronizing = false;
+
+   if (parameters)
+   {
+      pgagroal_snprintf(&parameter_kinds[0], sizeof(parameter_kinds), "%sS", server_kinds);
+      server_kinds = &parameter_kinds[0];
+   }
+
+   capturing = false;
+
+   if (cache)
+   {
+      capture = malloc(QUERY_CACHE_ENTRY_SIZE);
+      capture_query = malloc(QUERY_CACHE_ENTRY_SIZE);
+      memset(&held, 0, sizeof(struct message));
+      held.data = malloc(DEFAULT_BUFFER_SIZE);
+
+      if (capture == NULL || capture_query == NULL || held.data == NULL)
+      {
+         pgagroal_log_warn("pgagroal: Query cache disabled for the client");
+         cache = false;
+      }
+   }
+
+   /* LISTEN and UNLISTEN are served by the relay, as the connection only lasts for a transaction */
+   notify = config->notify_relay && config->notify_pid > 0;
+   listened = false;
+   number_of_channels = 0;
+   notifications_length = 0;
+   notify_client = w;
+
+   if (notify && held.data == NULL)
+   {
+      memset(&held, 0, sizeof(struct message));
+      held.data = malloc(DEFAULT_BUFFER_SIZE);
+
+      if (held.data == NULL)
+      {
+         pgagroal_log_warn("pgagroal: Notification relay disabled for the client");
+         notify = false;
+      }
+   }
+
    memset(&p, 0, sizeof(p));
-   pgagroal_snprintf(&p[0], sizeof(p), MAIN_UDS);
+   pgagroal_snprintf(&p[0], sizeof(p), "%s.%d", MAIN_UDS, (int)getpid());
 
    if (pgagroal_bind_unix_socket(config->unix_socket_dir, &p[0], &unix_socket))
    {
@@ -128,11 +318,6 @@ transaction_start(struct event_loop* loop, struct worker_io* w)
       goto error;
    }
 
-   for (int i = 0; i < config->max_connections; i++)
-   {
-      fds[i] = config->connections[i].fd;
-   }
-
    start_mgt(loop);
 
    pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION_START, w->slot);
@@ -142,6 +327,7 @@ transaction_start(struct event_loop* loop, struct worker_io* w)
 
    w->server_fd = -1;
    w->slot = -1;
+   pgagroal_activity_slot(-1);
 
    if (is_new)
    {
@@ -158,9 +344,30 @@ error:
    return;
 }
 
+static void
+statement_start(struct event_loop* loop, struct worker_io* w)
+{
+   /* The transaction pipeline, except that a backend is never held across statements */
+   statement = true;
+
+   transaction_start(loop, w);
+}
+
 static void
 transaction_stop(struct event_loop* loop, struct worker_io* w)
 {
+   if (sticky)
+   {
+      pgagroal_periodic_stop(&sticky_timer);
+      sticky = false;
+   }
+
+   if (idle)
+   {
+      pgagroal_periodic_stop(&idle_timer);
+      idle = false;
+   }
+
    if (slot != -1)
    {
       struct main_configuration* config = NULL;
@@ -173,6 +380,12 @@ transaction_stop(struct event_loop* loop, struct worker_io* w)
          /* ROLLBACK */
          pgagroal_write_rollback(w->server_ssl, config->connections[slot].fd);
       }
+      else if (deallocate)
+      {
+         pgagroal_write_deallocate_all(w->server_ssl, config->connections[slot].fd);
+         pgagroal_prepared_reset(slot);
+         deallocate = false;
+      }
 
       if (io_watcher_active)
       {
@@ -184,6 +397,27 @@ transaction_stop(struct event_loop* loop, struct worker_io* w)
       slot = -1;
    }
 
+   if (listened)
+   {
+      /* The relay stops listening for the client */
+      pgagroal_notify_unlisten(NULL);
+      listened = false;
+   }
+
+   number_of_channels = 0;
+   free(notifications);
+   notifications = NULL;
+   notifications_length = 0;
+
+   pgagroal_prepared_destroy();
+
+   free(capture);
+   capture = NULL;
+   free(capture_query);
+   capture_query = NULL;
+   free(held.data);
+   held.data = NULL;
+
    shutdown_mgt(loop);
 }
 
@@ -201,6 +435,9 @@ static void
 transaction_client(struct io_watcher* watcher)
 {
    int status = MESSAGE_STATUS_ERROR;
+   bool received = false;
+   bool query = false;
+   bool boundary = false;
    SSL* s_ssl = NULL;
    struct worker_io* wi = NULL;
    struct message* msg = NULL;
@@ -209,23 +446,82 @@ transaction_client(struct io_watcher* watcher)
    wi = (struct worker_io*)watcher;
    config = (struct main_configuration*)shmem;
 
+   if (sticky)
+   {
+      /* The client is back within the stickiness window, so it keeps the connection */
+      pgagroal_periodic_stop(&sticky_timer);
+      sticky = false;
+   }
+
+   if (idle)
+   {
+      /* The client is back within idle_transaction_timeout */
+      pgagroal_periodic_stop(&idle_timer);
+      idle = false;
+   }
+
+   if (timing && !timed)
+   {
+      /* The transaction time includes the wait for a connection */
+      clock_gettime(CLOCK_MONOTONIC, &transaction_begin);
+      service_time = 0;
+      timed = true;
+      pgagroal_probe_transaction_begin(wi->client_fd, &database[0]);
+   }
+
+   if (slot == -1 && (cache || rolled_back || notify))
+   {
+      /* A cached reply is served without obtaining a connection */
+      status = pgagroal_recv_message(watcher, &msg);
+      received = true;
+
+      if (status == MESSAGE_STATUS_OK && rolled_back && rolled_back_request(wi, msg))
+      {
+         timed = false;
+         return;
+      }
+
+      if (status == MESSAGE_STATUS_OK && notify && listen_request(wi, msg))
+      {
+         timed = false;
+         return;
+      }
+
+      if (status == MESSAGE_STATUS_OK && cache && cached_reply(wi, msg))
+      {
+         timed = false;
+         return;
+      }
+
+      if (status == MESSAGE_STATUS_OK && msg->length <= DEFAULT_BUFFER_SIZE)
+      {
+         /* Obtaining the connection may read into the message buffer */
+         held.kind = msg->kind;
+         held.length = msg->length;
+         memcpy(held.data, msg->data, msg->length);
+         msg = &held;
+      }
+   }
+
    /* We can't use the information from wi except from client_fd/client_ssl */
    if (slot == -1)
    {
       pgagroal_tracking_event_basic(TRACKER_TX_GET_CONNECTION, &username[0], &database[0]);
+      pgagroal_activity_state(ACTIVITY_ACTIVE, ACTIVITY_WAIT_CONNECTION);
       if (pgagroal_get_connection(&username[0], &database[0], true, true, &slot, &s_ssl))
       {
          pgagroal_write_pool_full(wi->client_ssl, wi->client_fd);
          goto get_error;
       }
+      pgagroal_activity_slot(slot);
 
-      wi->server_fd = fds[slot];
+      wi->server_fd = backend_fd(slot);
       wi->server_ssl = s_ssl;
       wi->slot = slot;
 
       pgagroal_event_worker_init(&wi->io, wi->client_fd, wi->server_fd, transaction_client);
 
-      memcpy(&config->connections[slot].appname[0], &appname[0], MAX_APPLICATION_NAME);
+      memcpy(&pgagroal_connection_info(slot)->appname[0], &appname[0], MAX_APPLICATION_NAME);
 
       pgagroal_event_worker_init(&server_io.io, config->connections[slot].fd,
                                  wi->client_fd, transaction_server);
@@ -236,69 +532,134 @@ transaction_client(struct io_watcher* watcher)
       server_io.server_ssl = wi->server_ssl;
 
       fatal = false;
+      server_idle = true;
+      synchronize = parameters;
 
       pgagroal_io_start(&server_io.io);
       io_watcher_active = true;
    }
 
-   status = pgagroal_recv_message(watcher, &msg);
+   if (!received)
+   {
+      status = pgagroal_recv_message(watcher, &msg);
+   }
 
    if (likely(status == MESSAGE_STATUS_OK))
    {
-      pgagroal_prometheus_network_sent_add(msg->length);
+      pgagroal_prometheus_local_network_sent_add(msg->length);
+
+      /* The first byte is only a message kind when the previous read ended on a message */
+      boundary = !pgagroal_message_stream_partial(&client_stream);
+
+      /* A client within the stickiness window gives its connection back for a LISTEN */
+      if (notify && !received && !in_tx && server_idle && boundary && listen_request(wi, msg))
+      {
+         timed = false;
+
+         if (release_connection())
+         {
+            goto return_error;
+         }
+
+         return;
+      }
 
-      if (likely(msg->kind != 'X'))
+      if (likely(!boundary || msg->kind != 'X'))
       {
          int offset = 0;
+         struct message_frame frame;
 
-         while (offset < msg->length)
+         if (synchronize)
          {
-            if (next_client_message == 0)
+            synchronize = false;
+
+            /* The SET commands go ahead of the first message, which must start on a message */
+            if (boundary && pgagroal_parameters_synchronize(wi->server_ssl, wi->server_fd, slot, &synchronizing))
+            {
+               goto server_error;
+            }
+
+            if (synchronizing)
+            {
+               clock_gettime(CLOCK_MONOTONIC, &synchronize_start);
+            }
+         }
+
+         /* A reply is only captured for a query sent on its own */
+         query = cache && !in_tx && !copy_in && boundary && single_query(msg);
+         capturing = false;
+
+         /* The CopyData messages of a COPY are stepped over by their length,
+          * only the CopyDone or CopyFail that ends it is looked for */
+         while (pgagroal_message_stream_next(&client_stream, msg, &offset,
+                                             copy_in ? "cf" : client_kinds, &frame))
+         {
+            if (copy_in)
             {
-               char kind = pgagroal_read_byte(msg->data + offset);
-               int length = pgagroal_read_int32(msg->data + offset + 1);
+               copy_in = false;
+               continue;
+            }
 
-               if (config->track_prepared_statements)
+            if (tracked)
+            {
+               if (prepared && wi->server_ssl == NULL)
                {
-                  /* The P message tell us the prepared statement */
-                  if (kind == 'P')
+                  if (pgagroal_prepared_client(slot, wi->server_fd, server_idle, &frame, &deallocate))
                   {
-                     char* ps = pgagroal_read_string(msg->data + offset + 5);
-                     if (strcmp(ps, ""))
-                     {
-                        deallocate = true;
-                     }
+                     goto server_error;
                   }
                }
-
-               /* The Q and E message tell us the execute of the simple query and the prepared statement */
-               if (kind == 'Q' || kind == 'E')
+               else if (frame.kind == 'P' && frame.available > 0 && frame.body[0] != '\0')
                {
-                  pgagroal_prometheus_query_count_add();
-                  pgagroal_prometheus_query_count_specified_add(wi->slot);
+                  /* The P message tell us the prepared statement */
+                  deallocate = true;
                }
+            }
 
-               /* Calculate the offset to the next message */
-               if (offset + length + 1 <= msg->length)
-               {
-                  next_client_message = 0;
-                  offset += length + 1;
-               }
-               else
-               {
-                  next_client_message = length + 1 - (msg->length - offset);
-                  offset = msg->length;
-               }
+            /* The Q and E message tell us the execute of the simple query and the prepared statement */
+            if (frame.kind == 'Q' || frame.kind == 'E')
+            {
+               pgagroal_prometheus_local_query_count_add(wi->slot);
             }
-            else
+
+            if (idle_timeout > 0 && (frame.kind == 'Q' || frame.kind == 'S'))
             {
-               offset = MIN(next_client_message, msg->length);
-               next_client_message -= offset;
+               requests++;
+            }
+
+            if (statistics && !sampled && (frame.kind == 'Q' || frame.kind == 'P'))
+            {
+               sample_query(&frame);
+            }
+
+            /* The cached replies are for the session state at the startup */
+            if (cache && (frame.kind == 'Q' || frame.kind == 'P') && session_query(&frame))
+            {
+               cache = false;
+               query = false;
             }
          }
 
          status = pgagroal_send_message(watcher, msg);
 
+         pgagroal_activity_state(ACTIVITY_ACTIVE, ACTIVITY_WAIT_SERVER);
+
+         if (timing && server_idle && !serving)
+         {
+            clock_gettime(CLOCK_MONOTONIC, &service_begin);
+            serving = true;
+         }
+         server_idle = false;
+
+         if (query && status == MESSAGE_STATUS_OK)
+         {
+            memcpy(capture_query, msg->data + 5, msg->length - 5);
+            capture_query_length = msg->length - 5;
+            capture_length = 0;
+            capture_state = QUERY_CACHE_REPLY_DESCRIPTION;
+            capturing = true;
+         }
+
          if (unlikely(status == MESSAGE_STATUS_ERROR))
          {
             if (config->failover)
@@ -315,7 +676,7 @@ transaction_client(struct io_watcher* watcher)
             }
          }
       }
-      else if (msg->kind == 'X')
+      else
       {
          saw_x = true;
          pgagroal_event_loop_break();
@@ -334,7 +695,7 @@ transaction_client(struct io_watcher* watcher)
 
 client_done:
    pgagroal_log_debug("[C] Client done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->client_fd, status);
    errno = 0;
 
@@ -352,7 +713,7 @@ client_done:
 
 client_error:
    pgagroal_log_warn("[C] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -364,7 +725,7 @@ client_error:
 
 server_error:
    pgagroal_log_warn("[C] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -386,6 +747,14 @@ get_error:
 
    exit_code = WORKER_SERVER_FAILURE;
 
+   pgagroal_event_loop_break();
+   return;
+
+return_error:
+   pgagroal_log_warn("Failure during connection return");
+
+   exit_code = WORKER_SERVER_FAILURE;
+
    pgagroal_event_loop_break();
    return;
 }
@@ -394,13 +763,16 @@ static void
 transaction_server(struct io_watcher* watcher)
 {
    int status = MESSAGE_STATUS_ERROR;
+   bool boundary = false;
    struct worker_io* wi = NULL;
    struct message* msg = NULL;
+   struct message reply;
    struct main_configuration* config = NULL;
 
-   wi = (struct worker_io*)watcher;
    config = (struct main_configuration*)shmem;
 
+   wi = (struct worker_io*)watcher;
+
    if (!pgagroal_socket_isvalid(wi->client_fd))
    {
       goto client_error;
@@ -410,47 +782,160 @@ transaction_server(struct io_watcher* watcher)
 
    if (likely(status == MESSAGE_STATUS_OK))
    {
-      pgagroal_prometheus_network_received_add(msg->length);
+      pgagroal_prometheus_local_network_received_add(msg->length);
 
       int offset = 0;
+      struct message_frame frame;
 
-      while (offset < msg->length)
+      if (synchronizing)
       {
-         if (next_server_message == 0)
+         /* The reply to the SET commands isn't the client's, so it is left out up to its ReadyForQuery */
+         while (synchronizing && pgagroal_message_stream_next(&server_stream, msg, &offset, "EZ", &frame))
          {
-            char kind = pgagroal_read_byte(msg->data + offset);
-            int length = pgagroal_read_int32(msg->data + offset + 1);
-
-            /* The Z message tell us the transaction state */
-            if (kind == 'Z')
+            if (frame.kind == 'E')
+            {
+               pgagroal_parameters_failed(slot);
+            }
+            else if (frame.kind == 'Z')
             {
-               char tx_state = pgagroal_read_byte(msg->data + offset + 5);
+               synchronizing = false;
+               pgagroal_prometheus_backend_phase(config->connections[slot].server, PROMETHEUS_PHASE_PARAMETERS,
+                                                 pgagroal_time_elapsed_usec(&synchronize_start));
+            }
+         }
 
-               if (tx_state != 'I' && !in_tx)
-               {
-                  pgagroal_prometheus_tx_count_add();
-               }
+         if (offset >= msg->length)
+         {
+            return;
+         }
+
+         memset(&reply, 0, sizeof(struct message));
+         reply.kind = pgagroal_read_byte((char*)msg->data + offset);
+         reply.length = msg->length - offset;
+         reply.data = (char*)msg->data + offset;
+
+         msg = &reply;
+         offset = 0;
+      }
+
+      boundary = !pgagroal_message_stream_partial(&server_stream);
+
+      if (capturing)
+      {
+         if (capture_length + msg->length <= QUERY_CACHE_ENTRY_SIZE)
+         {
+            memcpy(capture + capture_length, msg->data, msg->length);
+            capture_length += msg->length;
+         }
+         else
+         {
+            capturing = false;
+         }
+      }
+
+      /* Like on the client side only the end of a COPY is looked for */
+      while (pgagroal_message_stream_next(&server_stream, msg, &offset,
+                                          copy_out ? "cEZ" : (capturing ? NULL : server_kinds), &frame))
+      {
+         if (copy_out)
+         {
+            copy_out = false;
+         }
+
+         if (capturing && !pgagroal_query_cache_reply(&capture_state, &frame))
+         {
+            capturing = false;
+         }
+
+         /* CopyInResponse, CopyOutResponse and CopyBothResponse start a COPY */
+         if (frame.kind == 'G' || frame.kind == 'W')
+         {
+            copy_in = true;
+         }
+
+         if (frame.kind == 'H' || frame.kind == 'W')
+         {
+            copy_out = true;
+         }
+
+         if (prepared && wi->server_ssl == NULL && (frame.kind == '1' || frame.kind == 'E' || frame.kind == 'Z'))
+         {
+            pgagroal_prepared_server(wi->slot, &frame, &deallocate);
+         }
+
+         if (frame.kind == 'S' && parameters)
+         {
+            pgagroal_parameters_server(wi->slot, &frame);
+         }
 
-               in_tx = tx_state != 'I';
+         if (frame.kind == 'C' && sampled)
+         {
+            sample_rows += command_rows(&frame);
+         }
+
+         /* The Z message tell us the transaction state */
+         if (frame.kind == 'Z' && frame.available > 0)
+         {
+            char tx_state = frame.body[0];
+
+            if (tx_state != 'I' && !in_tx)
+            {
+               pgagroal_prometheus_tx_count_add();
+            }
+            else if (tx_state == 'I')
+            {
+               pgagroal_prometheus_local_transaction_end();
             }
 
-            /* Calculate the offset to the next message */
-            if (offset + length + 1 <= msg->length)
+            in_tx = tx_state != 'I';
+            copy_in = false;
+
+            pgagroal_activity_state(in_tx ? ACTIVITY_IDLE_IN_TRANSACTION : ACTIVITY_IDLE, ACTIVITY_WAIT_CLIENT);
+
+            if (requests > 0)
             {
-               next_server_message = 0;
-               offset += length + 1;
+               requests--;
             }
-            else
+         }
+      }
+
+      server_idle = pgagroal_message_stream_ready(&server_stream);
+
+      if (serving && server_idle)
+      {
+         service_time += pgagroal_time_elapsed_usec(&service_begin);
+         serving = false;
+
+         /* The time between the replies within a transaction is the time of the client */
+         if (!in_tx && timed)
+         {
+            long long transaction_time = pgagroal_time_elapsed_usec(&transaction_begin);
+
+            if (database_index != -1)
             {
-               next_server_message = length + 1 - (msg->length - offset);
-               offset = msg->length;
+               pgagroal_prometheus_transaction_time(database_index, transaction_time, service_time);
             }
+            pgagroal_probe_transaction_end(slot, config->connections[slot].limit_rule, transaction_time, service_time);
+            pgagroal_slowlog_transaction(slot, transaction_time, service_time);
+            timed = false;
          }
-         else
+      }
+
+      if (sampled && server_idle)
+      {
+         pgagroal_prometheus_query_statistics(sample_fingerprint, &sample_text[0], pgagroal_time_elapsed_usec(&sample_begin),
+                                              sample_rows, sample_weight);
+         sampled = false;
+      }
+
+      if (capturing && server_idle)
+      {
+         if (!in_tx && capture_state == QUERY_CACHE_REPLY_DONE)
          {
-            offset = MIN(next_server_message, msg->length);
-            next_server_message -= offset;
+            pgagroal_query_cache_put(&database[0], &username[0], capture_query, capture_query_length, capture, capture_length);
          }
+
+         capturing = false;
       }
 
       status = pgagroal_send_message(watcher, msg);
@@ -460,7 +945,12 @@ transaction_server(struct io_watcher* watcher)
          goto client_error;
       }
 
-      if (unlikely(msg->kind == 'E'))
+      if (notifications_length > 0)
+      {
+         notify_flush();
+      }
+
+      if (unlikely(boundary && msg->kind == 'E'))
       {
          if (!strncmp(msg->data + 6, "FATAL", 5) || !strncmp(msg->data + 6, "PANIC", 5))
          {
@@ -468,43 +958,64 @@ transaction_server(struct io_watcher* watcher)
          }
       }
 
-      /* Check for ReadyForQuery message (Z) to detect transaction completion */
-      if (msg->kind == 'Z' && !in_tx && slot != -1)
+      if (statement && in_tx && slot != -1 && pgagroal_message_stream_ready(&server_stream))
+      {
+         goto transaction_block;
+      }
+
+      if (idle_timeout > 0 && in_tx && requests == 0 && slot != -1 && pgagroal_message_stream_ready(&server_stream))
       {
-         /* Transaction completed - stop I/O watcher immediately if still active */
-         if (io_watcher_active)
+         /* The connection is held for the transaction until the client is back */
+         if (idle)
          {
-            pgagroal_io_stop(&server_io.io);
-            io_watcher_active = false;
+            pgagroal_periodic_stop(&idle_timer);
          }
+         pgagroal_periodic_init(&idle_timer, idle_cb, idle_timeout, 0);
+         pgagroal_periodic_start(&idle_timer);
+         idle = true;
+      }
 
-         if (!fatal)
+      /* Check for ReadyForQuery message (Z) to detect transaction completion */
+      if (pgagroal_message_stream_ready(&server_stream) && !in_tx && slot != -1 && !sticky)
+      {
+         if (fatal)
          {
-            if (deallocate)
-            {
-               pgagroal_write_deallocate_all(wi->server_ssl, wi->server_fd);
-               deallocate = false;
-            }
-
-            pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION, slot);
-            if (pgagroal_return_connection(slot, wi->server_ssl, true))
+            if (io_watcher_active)
             {
-               goto return_error;
+               pgagroal_io_stop(&server_io.io);
+               io_watcher_active = false;
             }
 
-            slot = -1;
-         }
-         else
-         {
             exit_code = WORKER_SERVER_FATAL;
             pgagroal_event_loop_break();
          }
+         else if (config->transaction_stickiness > 0 && !pgagroal_pool_waiting(slot))
+         {
+            /* Keep the connection for the next transaction of the client, unless
+             * it isn't back within the window or other clients are waiting */
+            pgagroal_periodic_init(&sticky_timer, sticky_cb, config->transaction_stickiness, 0);
+            pgagroal_periodic_start(&sticky_timer);
+            sticky = true;
+         }
+         else if (release_connection())
+         {
+            goto return_error;
+         }
       }
    }
    else if (status == MESSAGE_STATUS_ZERO)
    {
       goto server_done;
    }
+   else if (errno == ETIMEDOUT && config->failover)
+   {
+      /* The server stopped answering within tcp_user_timeout or the keep alive probes */
+      pgagroal_server_failover(slot);
+      pgagroal_write_client_failover(wi->client_ssl, wi->client_fd);
+      pgagroal_prometheus_failed_servers();
+
+      goto failover;
+   }
    else
    {
       goto server_error;
@@ -512,9 +1023,27 @@ transaction_server(struct io_watcher* watcher)
 
    return;
 
+transaction_block:
+   pgagroal_log_debug("[S] Transaction block in the statement pipeline (slot %d database %s user %s)",
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username);
+
+   if (io_watcher_active)
+   {
+      pgagroal_io_stop(&server_io.io);
+      io_watcher_active = false;
+   }
+
+   /* The backend is rolled back and returned when the pipeline stops */
+   pgagroal_write_no_transaction_blocks(wi->client_ssl, wi->client_fd);
+
+   exit_code = WORKER_CLIENT_FAILURE;
+
+   pgagroal_event_loop_break();
+   return;
+
 client_error:
    pgagroal_log_warn("[S] Client error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->client_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -526,7 +1055,7 @@ client_error:
 
 server_done:
    pgagroal_log_debug("[S] Server done (slot %d database %s user %s): %s (socket %d status %d)",
-                      wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                      wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                       strerror(errno), wi->server_fd, status);
    errno = 0;
 
@@ -535,7 +1064,7 @@ server_done:
 
 server_error:
    pgagroal_log_warn("[S] Server error (slot %d database %s user %s): %s (socket %d status %d)",
-                     wi->slot, config->connections[wi->slot].database, config->connections[wi->slot].username,
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
                      strerror(errno), wi->server_fd, status);
    pgagroal_log_message(msg);
    errno = 0;
@@ -545,6 +1074,17 @@ server_error:
    pgagroal_event_loop_break();
    return;
 
+failover:
+   pgagroal_log_warn("[S] Server timed out (slot %d database %s user %s): %s (socket %d status %d)",
+                     wi->slot, pgagroal_connection_info(wi->slot)->database, pgagroal_connection_info(wi->slot)->username,
+                     strerror(ETIMEDOUT), wi->server_fd, status);
+   errno = 0;
+
+   exit_code = WORKER_FAILOVER;
+
+   pgagroal_event_loop_break();
+   return;
+
 return_error:
    pgagroal_log_warn("Failure during connection return");
 
@@ -554,10 +1094,623 @@ return_error:
    return;
 }
 
-static void
-start_mgt(struct event_loop* loop __attribute__((unused)))
+static int
+release_connection(void)
 {
-   memset(&io_mgt, 0, sizeof(struct io_watcher));
+   /* Transaction completed - stop I/O watcher immediately if still active */
+   if (io_watcher_active)
+   {
+      pgagroal_io_stop(&server_io.io);
+      io_watcher_active = false;
+   }
+
+   if (deallocate)
+   {
+      pgagroal_write_deallocate_all(server_io.server_ssl, server_io.server_fd);
+      pgagroal_prepared_reset(slot);
+      deallocate = false;
+   }
+
+   pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION, slot);
+   if (pgagroal_return_connection(slot, server_io.server_ssl, true))
+   {
+      return 1;
+   }
+
+   slot = -1;
+   pgagroal_activity_slot(-1);
+
+   return 0;
+}
+
+static void
+sticky_cb(void)
+{
+   pgagroal_periodic_stop(&sticky_timer);
+   sticky = false;
+
+   if (slot != -1 && !in_tx && release_connection())
+   {
+      pgagroal_log_warn("Failure during connection return");
+
+      exit_code = WORKER_SERVER_FAILURE;
+
+      pgagroal_event_loop_break();
+   }
+}
+
+static void
+idle_cb(void)
+{
+   int action;
+   struct main_configuration* config = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_periodic_stop(&idle_timer);
+   idle = false;
+
+   if (slot == -1 || !in_tx || requests > 0)
+   {
+      return;
+   }
+
+   action = config->idle_transaction_action;
+
+   if (action == IDLE_TRANSACTION_ROLLBACK && config->ev_backend == PGAGROAL_EVENT_BACKEND_IO_URING)
+   {
+      /* Like the query cache, the requests can't be read before a connection is obtained */
+      action = IDLE_TRANSACTION_CANCEL;
+   }
+
+   if (action == IDLE_TRANSACTION_ROLLBACK && held.data == NULL)
+   {
+      /* The request that ends the transaction is held while a connection is obtained */
+      held.data = malloc(DEFAULT_BUFFER_SIZE);
+      if (held.data == NULL)
+      {
+         action = IDLE_TRANSACTION_CANCEL;
+      }
+   }
+
+   pgagroal_log_warn("Idle transaction (slot %d database %s user %s application_name %s) for more than %lld ms",
+                     slot, &database[0], &username[0], &appname[0], (long long)idle_timeout);
+   pgagroal_prometheus_idle_transaction_timeout(action);
+
+   if (action == IDLE_TRANSACTION_WARN)
+   {
+      return;
+   }
+
+   if (action == IDLE_TRANSACTION_CANCEL)
+   {
+      /* The connection is rolled back and returned when the pipeline stops */
+      pgagroal_write_idle_transaction_timeout(server_io.client_ssl, server_io.client_fd);
+
+      exit_code = WORKER_CLIENT_FAILURE;
+
+      pgagroal_event_loop_break();
+      return;
+   }
+
+   if (io_watcher_active)
+   {
+      pgagroal_io_stop(&server_io.io);
+      io_watcher_active = false;
+   }
+
+   if (pgagroal_write_rollback(server_io.server_ssl, server_io.server_fd))
+   {
+      pgagroal_log_warn("Failure during rollback (slot %d)", slot);
+
+      exit_code = WORKER_SERVER_FAILURE;
+
+      pgagroal_event_loop_break();
+      return;
+   }
+
+   /* The client is told about the rollback on its next request */
+   in_tx = false;
+   timed = false;
+   rolled_back = true;
+   pgagroal_prometheus_local_transaction_end();
+
+   if (release_connection())
+   {
+      pgagroal_log_warn("Failure during connection return");
+
+      exit_code = WORKER_SERVER_FAILURE;
+
+      pgagroal_event_loop_break();
+   }
+}
+
+static bool
+rolled_back_request(struct worker_io* wi, struct message* msg)
+{
+   int offset = 0;
+   int replies = 0;
+   struct message_frame frame;
+   struct message_stream stream;
+
+   if (!pgagroal_message_stream_partial(&client_stream) && msg->kind == 'X')
+   {
+      saw_x = true;
+      pgagroal_event_loop_break();
+      return true;
+   }
+
+   /* The chunk is framed on a copy of the stream, as a forwarded chunk is framed again */
+   memcpy(&stream, &client_stream, sizeof(struct message_stream));
+
+   while (pgagroal_message_stream_next(&stream, msg, &offset, "PQS", &frame))
+   {
+      if ((frame.kind == 'Q' || frame.kind == 'P') && ends_transaction(&frame))
+      {
+         /* A ROLLBACK outside of a transaction is only a warning for the server */
+         rolled_back = false;
+         return false;
+      }
+
+      if (frame.kind == 'Q' || frame.kind == 'S')
+      {
+         replies++;
+      }
+   }
+
+   memcpy(&client_stream, &stream, sizeof(struct message_stream));
+
+   /* Like the server, every request fails until the transaction is ended.
+    * A failed write shows up as the client being gone on its next read */
+   for (int i = 0; i < replies; i++)
+   {
+      pgagroal_write_idle_transaction_rollback(wi->client_ssl, wi->client_fd);
+   }
+
+   return true;
+}
+
+static bool
+ends_transaction(struct message_frame* frame)
+{
+   int i = 0;
+   int length = frame->available;
+   char* query = frame->body;
+
+   if (frame->kind == 'P')
+   {
+      /* The query follows the name of the statement */
+      i = (int)strnlen(query, length) + 1;
+   }
+
+   while (i < length && (query[i] == ' ' || query[i] == '\t' || query[i] == '\r' || query[i] == '\n'))
+   {
+      i++;
+   }
+
+   if (i + 5 <= length && !strncasecmp(query + i, "abort", 5))
+   {
+      i += 5;
+   }
+   else if (i + 8 <= length && !strncasecmp(query + i, "rollback", 8))
+   {
+      i += 8;
+   }
+   else
+   {
+      return false;
+   }
+
+   if (i < length && (isalnum((unsigned char)query[i]) || query[i] == '_'))
+   {
+      return false;
+   }
+
+   /* A ROLLBACK TO SAVEPOINT needs the transaction */
+   while (i < length && (query[i] == ' ' || query[i] == '\t' || query[i] == '\r' || query[i] == '\n'))
+   {
+      i++;
+   }
+
+   if (i + 2 <= length && !strncasecmp(query + i, "to", 2) &&
+       (i + 2 == length || !isalnum((unsigned char)query[i + 2])))
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+listen_request(struct worker_io* wi, struct message* msg)
+{
+   int index;
+   bool listen = false;
+   char channel[NOTIFY_CHANNEL_LENGTH];
+
+   if (in_tx || msg->kind != 'Q' || msg->length < 6 || pgagroal_read_int32(msg->data + 1) + 1 != msg->length)
+   {
+      return false;
+   }
+
+   if (client_stream.header_length != 0 || client_stream.remaining != 0)
+   {
+      return false;
+   }
+
+   if (!listen_command(msg->data + 5, msg->length - 5, &listen, &channel[0]))
+   {
+      return false;
+   }
+
+   index = channel_index(&channel[0]);
+
+   if (listen && index == -1)
+   {
+      if (number_of_channels >= NOTIFY_CLIENT_CHANNELS ||
+          pgagroal_notify_listen(&username[0], &database[0], &channel[0]))
+      {
+         pgagroal_log_warn("Relay unavailable for LISTEN %s (database %s user %s)", &channel[0], &database[0], &username[0]);
+
+         /* A failed write shows up as the client being gone on its next read */
+         pgagroal_write_notify_unavailable(wi->client_ssl, wi->client_fd);
+         return true;
+      }
+
+      memcpy(&channels[number_of_channels][0], &channel[0], NOTIFY_CHANNEL_LENGTH);
+      number_of_channels++;
+      listened = true;
+   }
+   else if (!listen)
+   {
+      if (channel[0] == '\0')
+      {
+         number_of_channels = 0;
+      }
+      else if (index != -1)
+      {
+         number_of_channels--;
+         memcpy(&channels[index][0], &channels[number_of_channels][0], NOTIFY_CHANNEL_LENGTH);
+      }
+
+      if (listened && (channel[0] == '\0' || index != -1))
+      {
+         pgagroal_notify_unlisten(channel[0] != '\0' ? &channel[0] : NULL);
+      }
+   }
+
+   pgagroal_write_listen_complete(wi->client_ssl, wi->client_fd, listen);
+
+   return true;
+}
+
+static bool
+listen_command(char* query, int length, bool* listen, char* channel)
+{
+   int i = 0;
+   int n = 0;
+
+   memset(channel, 0, NOTIFY_CHANNEL_LENGTH);
+
+   while (i < length && isspace((unsigned char)query[i]))
+   {
+      i++;
+   }
+
+   if (i + 6 <= length && !strncasecmp(query + i, "listen", 6))
+   {
+      *listen = true;
+      i += 6;
+   }
+   else if (i + 8 <= length && !strncasecmp(query + i, "unlisten", 8))
+   {
+      *listen = false;
+      i += 8;
+   }
+   else
+   {
+      return false;
+   }
+
+   if (i >= length || !isspace((unsigned char)query[i]))
+   {
+      return false;
+   }
+
+   while (i < length && isspace((unsigned char)query[i]))
+   {
+      i++;
+   }
+
+   /* The channel is normalized like an identifier, so the relay can quote it */
+   if (i < length && query[i] == '"')
+   {
+      i++;
+
+      while (true)
+      {
+         if (i >= length || query[i] == '\0')
+         {
+            return false;
+         }
+
+         if (query[i] == '"')
+         {
+            if (i + 1 >= length || query[i + 1] != '"')
+            {
+               i++;
+               break;
+            }
+            i++;
+         }
+
+         if (n >= NOTIFY_CHANNEL_LENGTH - 1)
+         {
+            return false;
+         }
+
+         channel[n++] = query[i++];
+      }
+   }
+   else if (!*listen && i < length && query[i] == '*')
+   {
+      i++;
+   }
+   else
+   {
+      while (i < length && (isalnum((unsigned char)query[i]) || query[i] == '_' || query[i] == '$' ||
+                            (unsigned char)query[i] >= 0x80))
+      {
+         if (n >= NOTIFY_CHANNEL_LENGTH - 1)
+         {
+            return false;
+         }
+
+         channel[n++] = (char)tolower((unsigned char)query[i++]);
+      }
+
+      if (n == 0 || isdigit((unsigned char)channel[0]) || channel[0] == '$')
+      {
+         return false;
+      }
+   }
+
+   if (*listen && n == 0)
+   {
+      return false;
+   }
+
+   while (i < length && isspace((unsigned char)query[i]))
+   {
+      i++;
+   }
+
+   if (i < length && query[i] == ';')
+   {
+      i++;
+   }
+
+   while (i < length && isspace((unsigned char)query[i]))
+   {
+      i++;
+   }
+
+   /* Anything else, like a second statement, is sent to the server */
+   return i >= length || query[i] == '\0';
+}
+
+static int
+channel_index(char* channel)
+{
+   for (int i = 0; i < number_of_channels; i++)
+   {
+      if (!strcmp(&channels[i][0], channel))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static void
+notify_queue(char* data, int length)
+{
+   /* NotificationResponse: the process id of the server, the channel and the payload */
+   if (length <= 9 || strnlen(data + 9, length - 9) >= (size_t)(length - 9))
+   {
+      return;
+   }
+
+   /* The client may have stopped listening while the notification was on its way */
+   if (channel_index(data + 9) == -1)
+   {
+      return;
+   }
+
+   if (notifications == NULL)
+   {
+      notifications = malloc(NOTIFY_CLIENT_BUFFER);
+   }
+
+   if (notifications == NULL || notifications_length + length > NOTIFY_CLIENT_BUFFER)
+   {
+      pgagroal_log_warn("Notification on %s dropped (database %s user %s)", data + 9, &database[0], &username[0]);
+      return;
+   }
+
+   memcpy(notifications + notifications_length, data, length);
+   notifications_length += length;
+
+   notify_flush();
+}
+
+static void
+notify_flush(void)
+{
+   struct message msg;
+
+   /* Like the server, the notifications are delivered between transactions */
+   if (in_tx || copy_in || copy_out || (slot != -1 && !pgagroal_message_stream_ready(&server_stream)))
+   {
+      return;
+   }
+
+   memset(&msg, 0, sizeof(struct message));
+   msg.kind = 'A';
+   msg.length = notifications_length;
+   msg.data = notifications;
+
+   /* A failed write shows up as the client being gone on its next read */
+   pgagroal_write_message(notify_client->client_ssl, notify_client->client_fd, &msg);
+
+   notifications_length = 0;
+}
+
+static bool
+single_query(struct message* msg)
+{
+   if (msg->kind != 'Q' || msg->length < 6 || pgagroal_read_int32(msg->data + 1) + 1 != msg->length)
+   {
+      return false;
+   }
+
+   if (client_stream.header_length != 0 || client_stream.remaining != 0)
+   {
+      return false;
+   }
+
+   return pgagroal_query_cache_cacheable(msg->data + 5, msg->length - 5);
+}
+
+static bool
+cached_reply(struct worker_io* wi, struct message* msg)
+{
+   int length = 0;
+   struct message reply;
+
+   if (!single_query(msg))
+   {
+      return false;
+   }
+
+   if (pgagroal_query_cache_get(&database[0], &username[0], msg->data + 5, msg->length - 5, capture, &length))
+   {
+      return false;
+   }
+
+   memset(&reply, 0, sizeof(struct message));
+   reply.kind = pgagroal_read_byte(capture);
+   reply.length = length;
+   reply.data = capture;
+
+   pgagroal_prometheus_query_count_add();
+
+   /* A failed write shows up as the client being gone on its next read */
+   pgagroal_write_message(wi->client_ssl, wi->client_fd, &reply);
+
+   return true;
+}
+
+static bool
+session_query(struct message_frame* frame)
+{
+   size_t name_length;
+
+   if (frame->kind == 'P')
+   {
+      /* The query follows the name of the statement */
+      name_length = strnlen(frame->body, frame->available);
+      if ((int)name_length >= frame->available)
+      {
+         return false;
+      }
+
+      return pgagroal_query_cache_session(frame->body + name_length + 1, frame->available - name_length - 1);
+   }
+
+   return pgagroal_query_cache_session(frame->body, frame->available);
+}
+
+static void
+sample_query(struct message_frame* frame)
+{
+   int length;
+   char* query = NULL;
+   size_t name_length;
+   struct main_configuration* config = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Only a message that is whole in the chunk is fingerprinted */
+   if (frame->available < frame->length - 4)
+   {
+      return;
+   }
+
+   if (sample_countdown > 0)
+   {
+      sample_countdown--;
+      return;
+   }
+
+   sample_countdown = config->query_statistics_sample - 1;
+
+   query = frame->body;
+   length = frame->available;
+
+   if (frame->kind == 'P')
+   {
+      /* The query follows the name of the statement */
+      name_length = strnlen(query, length);
+      if ((int)name_length >= length)
+      {
+         return;
+      }
+
+      query += name_length + 1;
+      length -= name_length + 1;
+   }
+
+   sample_fingerprint = pgagroal_fingerprint(query, length, &sample_text[0], sizeof(sample_text));
+   sample_weight = config->query_statistics_sample;
+   sample_rows = 0;
+   clock_gettime(CLOCK_MONOTONIC, &sample_begin);
+   sampled = true;
+}
+
+static long long
+command_rows(struct message_frame* frame)
+{
+   int start = -1;
+   long long rows = 0;
+
+   /* The rows are the last word of the tag, like SELECT 5 or INSERT 0 5 */
+   for (int i = 0; i < frame->available && frame->body[i] != '\0'; i++)
+   {
+      if (frame->body[i] == ' ')
+      {
+         start = i + 1;
+      }
+   }
+
+   if (start == -1)
+   {
+      return 0;
+   }
+
+   for (int i = start; i < frame->available && frame->body[i] >= '0' && frame->body[i] <= '9'; i++)
+   {
+      rows = rows * 10 + (frame->body[i] - '0');
+   }
+
+   return rows;
+}
+
+static void
+start_mgt(struct event_loop* loop __attribute__((unused)))
+{
+   memset(&io_mgt, 0, sizeof(struct io_watcher));
    pgagroal_event_accept_init(&io_mgt, unix_socket, accept_cb);
    pgagroal_io_start(&io_mgt);
 }
@@ -571,7 +1724,7 @@ shutdown_mgt(struct event_loop* loop __attribute__((unused)))
    config = (struct main_configuration*)shmem;
 
    memset(&p, 0, sizeof(p));
-   pgagroal_snprintf(&p[0], sizeof(p), MAIN_UDS);
+   pgagroal_snprintf(&p[0], sizeof(p), "%s.%d", MAIN_UDS, (int)getpid());
 
    pgagroal_io_stop(&io_mgt);
    pgagroal_disconnect(unix_socket);
@@ -581,8 +1734,7 @@ shutdown_mgt(struct event_loop* loop __attribute__((unused)))
 
    if (server_io.io.msg)
    {
-      free(server_io.io.msg->data);
-      free(server_io.io.msg);
+      pgagroal_free_message(server_io.io.msg);
       server_io.io.msg = NULL;
    }
 }
@@ -594,6 +1746,8 @@ accept_cb(struct io_watcher* watcher)
    int id = -1;
    int32_t slot = -1;
    int fd = -1;
+   int length = 0;
+   char* data = NULL;
    struct main_configuration* config = NULL;
 
    config = (struct main_configuration*)shmem;
@@ -631,12 +1785,23 @@ accept_cb(struct io_watcher* watcher)
          goto done;
       }
 
-      if (fds[slot] == fd && !config->connections[slot].new && config->connections[slot].fd > 0)
+      if (backend_fd(slot) == fd && !config->connections[slot].new && config->connections[slot].fd > 0)
       {
          pgagroal_disconnect(fd);
-         fds[slot] = 0;
+         fds[slot] = -1;
       }
    }
+   else if (id == CONNECTION_NOTIFY)
+   {
+      if (pgagroal_notify_read(client_fd, &data, &length))
+      {
+         pgagroal_log_error("pgagroal: Management notify: ID: %d", id);
+         goto done;
+      }
+
+      notify_queue(data, length);
+      free(data);
+   }
    else
    {
       pgagroal_log_debug("pgagroal: Unsupported management id: %d", id);
@@ -646,3 +1811,25 @@ done:
 
    pgagroal_disconnect(client_fd);
 }
+
+/**
+ * The descriptor of a backend in this process. The descriptors of the main
+ * process are inherited at the fork, and the ones that change later are sent
+ * to us, so a slot is only looked up in the shared memory until then
+ * @param slot The slot
+ * @return The descriptor
+ */
+static int
+backend_fd(int slot)
+{
+   struct main_configuration* config = NULL;
+
+   if (fds[slot] != 0)
+   {
+      return fds[slot];
+   }
+
+   config = (struct main_configuration*)shmem;
+
+   return config->connections[slot].fd;
+}
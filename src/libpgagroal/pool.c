@@ -34,10 +34,15 @@
 #include <management.h>
 #include <memory.h>
 #include <message.h>
+#include <parameters.h>
 #include <pool.h>
+#include <prepared.h>
+#include <probes.h>
 #include <prometheus.h>
 #include <security.h>
 #include <server.h>
+#include <shmem.h>
+#include <slowlog.h>
 #include <tls.h>
 #include <tracker.h>
 #include <utils.h>
@@ -52,19 +57,80 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#if HAVE_LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* The idle connection a process hands over: the server, the flags, the backend
+ * key, the timestamps, the names, the security messages and the backend state */
+#define HAND_OVER_RECORD_SIZE (4 + 3 + 4 + 4 + 8 + 8 + MISC_LENGTH + MAX_USERNAME_LENGTH + MAX_DATABASE_LENGTH + \
+                               NUMBER_OF_SECURITY_MESSAGES * (4 + SECURITY_BUFFER_SIZE) +                   \
+                               (NUMBER_OF_PREPARED_STATEMENTS + NUMBER_OF_SESSION_PARAMETERS) * 8)
+
+/** @struct flush_target
+ * Defines a backend a progressive flush has to retire
+ */
+struct flush_target
+{
+   bool active;       /**< Is the backend still to be retired */
+   bool marked;       /**< Is the backend marked to be recycled when it is returned */
+   bool handed;       /**< Is the backend left to the maintenance task that holds it */
+   int backend_pid;   /**< The backend process id */
+   time_t start_time; /**< The start timestamp */
+};
 
 static int find_best_rule(char* username, char* database);
+static int session_rule(char* username, char* database, char** real_database);
 static bool remove_connection(char* username, char* database);
 static void connection_details(int slot);
-static bool do_prefill(char* username, char* database, int size);
+static int do_prefill(char* username, char* database, int size);
+static void prefill_limit(int limit, int user, int size);
+static int prefill_connection(int limit, int user);
 static bool is_alias_of_limit(char* database, int limit_index);
 static int get_connection_count_for_limit_rule(int rule_index, char* username);
 static char* resolve_database_name(char* database, int best_rule);
 static void check_graceful_shutdown_trigger(void);
 static bool increase_connections(int best_rule);
+static void free_slot_add(int slot);
+static bool free_slot_retire(int slot);
+static void free_slot_clear(int slot);
+static bool free_slot_take(int rule, int* cursor, int* slot);
+static bool wait_for_hand_off(int best_rule, int key, unsigned int* ticket, long timeout, int* slot);
+static void hand_off(int slot);
+static bool direct_hand_off(int slot);
+static struct pool_waiter* oldest_waiter(int key, int route);
+static int connection_route(int slot);
+static long connect_throttle(int server);
+static bool admit(int best_rule);
+static bool reclaim_connection(int best_rule);
+static void futex_wait(atomic_int* word, int value, long timeout);
+static void futex_wake(atomic_int* word);
+static void timer_wheels_insert(int slot);
+static void timer_wheels_remove(int slot);
+static time_t age_deadline(int slot, int timeout);
+static bool validate_batch(int* slots, int number_of_slots);
+static bool validation_done(int slot, bool valid);
+static void detach_connection(int slot);
+static bool flush_target_gone(int slot, struct flush_target* target);
+
+static int rule_value = -2;
+static bool rule_alias = false;
+static unsigned int rule_generation = 0;
+static char rule_username[MAX_USERNAME_LENGTH];
+static char rule_database[MAX_DATABASE_LENGTH];
+static int key_rule = -2;
+static int key_value = 0;
+static char key_username[MAX_USERNAME_LENGTH];
+static char key_database[MAX_DATABASE_LENGTH];
+static bool no_wait = false;
+static int replica_server = -1;
+static bool recycling = false;
 
 int
 pgagroal_get_connection(char* username, char* database, bool reuse, bool transaction_mode, int* slot, SSL** ssl)
@@ -77,10 +143,16 @@ pgagroal_get_connection(char* username, char* database, bool reuse, bool transac
    int server;
    int fd;
    time_t start_time;
+   struct timespec wait_start;
+   struct timespec connect_start;
    int best_rule;
+   int key;
+   int reason;
+   unsigned int ticket;
    int retries;
    long retry_delay;
    int ret;
+   long throttle;
    char* real_database;
 
    struct main_configuration* config;
@@ -91,11 +163,18 @@ pgagroal_get_connection(char* username, char* database, bool reuse, bool transac
 
    pgagroal_prometheus_connection_get();
 
-   best_rule = find_best_rule(username, database);
+   best_rule = session_rule(username, database, &real_database);
+   key = pgagroal_pool_key(best_rule, username, real_database);
+   ticket = 0;
    retries = 0;
    retry_delay = 0; /* seeds the back-off at 1ms on the first blocking retry; persists across goto start */
    start_time = time(NULL);
+   if (config->common.metrics > 0 || config->slow_acquire_threshold > 0 || pgagroal_probe_enabled())
+   {
+      clock_gettime(CLOCK_MONOTONIC, &wait_start);
+   }
    pgagroal_prometheus_connection_awaiting(best_rule);
+   pgagroal_probe_get_connection_start(username, database, best_rule);
 
 start:
 
@@ -103,6 +182,7 @@ start:
    *ssl = NULL;
    do_init = false;
    has_lock = false;
+   throttle = 0;
 
    /* Fast-path bail when the pool is likely saturated. The counter is
     * read non-mutating; the slot array (below) is the source of truth.
@@ -117,7 +197,13 @@ start:
 
    if (reuse)
    {
-      for (int i = 0; *slot == -1 && i < config->max_connections; i++)
+      int cursor = 0;
+      int i = -1;
+
+      /* Only visit the slots that the free slot index has for this rule
+       * instead of every state; each claimed index bit is still confirmed
+       * by the FREE -> IN_USE transition on the state itself */
+      while (*slot == -1 && free_slot_take(best_rule, &cursor, &i))
       {
          free = STATE_FREE;
 
@@ -125,17 +211,25 @@ start:
          {
             bool can_reuse = false;
 
-            // Check if same rule and username
-            if (best_rule == config->connections[i].limit_rule &&
-                !strcmp((const char*)(&config->connections[i].username), username))
+            if (key != 0 && config->connections[i].key != 0)
             {
-               real_database = resolve_database_name(database, best_rule);
-               // Check exact database match
-               if (!strcmp((const char*)(&config->connections[i].database), real_database))
-               {
-                  can_reuse = true;
-               }
-               // Check if both are aliases of the same real database
+               /* Aliases resolve into the same key */
+               can_reuse = key == config->connections[i].key;
+            }
+            else if (best_rule == config->connections[i].limit_rule &&
+                     !strcmp((const char*)(&pgagroal_connection_info(i)->username), username) &&
+                     !strcmp((const char*)(&pgagroal_connection_info(i)->database), real_database))
+            {
+               can_reuse = true;
+            }
+
+            /* Replica connections are pooled per server, unless balanced where
+             * any eligible replica serves the client */
+            if (can_reuse && connection_route(i) != replica_server &&
+                !(config->replica_balance && replica_server != -1 && connection_route(i) != -1 &&
+                  pgagroal_server_replica_eligible(connection_route(i))))
+            {
+               can_reuse = false;
             }
 
             if (can_reuse)
@@ -144,16 +238,19 @@ start:
                {
                   *slot = i;
                   has_lock = true;
+                  timer_wheels_remove(i);
                }
                else
                {
                   atomic_store(&config->states[i], STATE_FREE);
+                  free_slot_add(i);
                   goto retry;
                }
             }
             else
             {
                atomic_store(&config->states[i], STATE_FREE);
+               free_slot_add(i);
             }
          }
       }
@@ -161,6 +258,11 @@ start:
 
    if (*slot == -1 && !transaction_mode)
    {
+      if (!admit(best_rule))
+      {
+         goto retry;
+      }
+
       if (best_rule >= 0)
       {
          /* Atomically reserve a backend against the per-rule max_size cap
@@ -172,7 +274,7 @@ start:
           * (issue #848). The reservation is the serialization point, so live
           * backends for the rule never exceed max_size. */
          unsigned short reserved = atomic_fetch_add(&config->limits[best_rule].backend_connections, 1);
-         if (reserved >= config->limits[best_rule].max_size)
+         if (reserved >= pgagroal_pool_limit_size(best_rule))
          {
             atomic_fetch_sub(&config->limits[best_rule].backend_connections, 1);
             goto retry;
@@ -216,17 +318,27 @@ start:
           * leaked, then fall through to the blocking-timeout retry path. */
          atomic_fetch_sub(&config->limits[best_rule].backend_connections, 1);
       }
+
+      if (*slot == -1 && reclaim_connection(best_rule))
+      {
+         goto start;
+      }
    }
 
    if (*slot != -1)
    {
+handed_off:
       config->connections[*slot].limit_rule = best_rule;
       config->connections[*slot].pid = getpid();
 
       if (do_init)
       {
          /* We need to find the server for the connection */
-         if (pgagroal_get_primary(&server))
+         if (replica_server != -1)
+         {
+            server = replica_server;
+         }
+         else if (pgagroal_get_primary(&server))
          {
             if (best_rule >= 0)
             {
@@ -246,8 +358,26 @@ start:
             goto error;
          }
 
+         throttle = connect_throttle(server);
+         if (throttle > 0)
+         {
+            /* The server is re-warmed at connection_rate, so wait for a token or
+             * for a connection that is returned or prefilled in the meantime */
+            if (best_rule >= 0)
+            {
+               atomic_fetch_sub(&config->limits[best_rule].backend_connections, 1);
+            }
+            config->connections[*slot].limit_rule = -1;
+            config->connections[*slot].pid = -1;
+            atomic_store(&config->states[*slot], STATE_NOTINIT);
+
+            goto retry;
+         }
+
          pgagroal_log_debug("connect: server %d", server);
 
+         clock_gettime(CLOCK_MONOTONIC, &connect_start);
+
          if (config->servers[server].host[0] == '/')
          {
             char pgsql[MISC_LENGTH];
@@ -258,7 +388,13 @@ start:
          }
          else
          {
-            ret = pgagroal_connect(config->servers[server].host, config->servers[server].port, &fd, config->keep_alive, config->nodelay);
+            ret = pgagroal_connect_server(server, &fd, config->keep_alive, config->nodelay);
+
+            if (ret == 0)
+            {
+               pgagroal_tcp_keepalive(fd);
+               pgagroal_socket_busy_poll(fd);
+            }
          }
 
          if (ret)
@@ -280,7 +416,7 @@ start:
                pgagroal_flush_server(server);
             }
 
-            if (config->failover)
+            if (config->failover && replica_server == -1)
             {
                pgagroal_server_force_failover(server);
                pgagroal_prometheus_failed_servers();
@@ -292,16 +428,35 @@ start:
 
          pgagroal_log_debug("connect: %s:%d using slot %d fd %d", config->servers[server].host, config->servers[server].port, *slot, fd);
 
+         /* A client asks for a connection it can reuse, prefill asks for a new one */
+         if (reuse)
+         {
+            reason = PROMETHEUS_CREATED_DEMAND;
+         }
+         else if (recycling)
+         {
+            reason = PROMETHEUS_CREATED_RECYCLE;
+         }
+         else
+         {
+            reason = PROMETHEUS_CREATED_PREFILL;
+         }
+
+         pgagroal_prometheus_backend_phase(server, PROMETHEUS_PHASE_CONNECT, pgagroal_time_elapsed_usec(&connect_start));
+         pgagroal_prometheus_backend_created(server, reason);
+
          config->connections[*slot].server = server;
+         config->connections[*slot].replica = replica_server != -1;
+         atomic_fetch_add(&config->servers[server].backends, 1);
 
-         memset(&config->connections[*slot].username, 0, MAX_USERNAME_LENGTH);
-         memcpy(&config->connections[*slot].username, username, MIN(strlen(username), MAX_USERNAME_LENGTH - 1));
-         real_database = resolve_database_name(database, best_rule);
-         memset(&config->connections[*slot].database, 0, MAX_DATABASE_LENGTH);
-         memcpy(&config->connections[*slot].database, real_database, MIN(strlen(real_database), MAX_DATABASE_LENGTH - 1));
+         memset(&pgagroal_connection_info(*slot)->username, 0, MAX_USERNAME_LENGTH);
+         memcpy(&pgagroal_connection_info(*slot)->username, username, MIN(strlen(username), MAX_USERNAME_LENGTH - 1));
+         memset(&pgagroal_connection_info(*slot)->database, 0, MAX_DATABASE_LENGTH);
+         memcpy(&pgagroal_connection_info(*slot)->database, real_database, MIN(strlen(real_database), MAX_DATABASE_LENGTH - 1));
 
          pgagroal_log_debug("Connection setup: client_db='%s' -> postgres_db='%s'", database, real_database);
          config->connections[*slot].has_security = SECURITY_INVALID;
+         config->connections[*slot].key = key;
          config->connections[*slot].fd = fd;
 
          atomic_store(&config->states[*slot], STATE_IN_USE);
@@ -320,6 +475,7 @@ start:
             else
             {
                atomic_store(&config->states[*slot], STATE_FREE);
+               free_slot_add(*slot);
                goto retry;
             }
          }
@@ -360,10 +516,14 @@ start:
       if (config->common.metrics > 0)
       {
          atomic_store(&prometheus->client_wait_time, difftime(time(NULL), start_time));
+         pgagroal_prometheus_connection_wait(best_rule, pgagroal_time_elapsed_usec(&wait_start),
+                                             do_init ? PROMETHEUS_WAIT_CREATED : PROMETHEUS_WAIT_REUSE);
       }
       pgagroal_prometheus_connection_success();
       pgagroal_tracking_event_slot(TRACKER_GET_CONNECTION_SUCCESS, *slot);
       pgagroal_prometheus_connection_unawaiting(best_rule);
+      pgagroal_probe_get_connection_done(*slot, best_rule, 0, &wait_start);
+      pgagroal_slowlog_acquire(*slot, best_rule, do_init ? SLOWLOG_CREATED : SLOWLOG_REUSE, username, database, &wait_start);
       return 0;
    }
    else
@@ -378,6 +538,11 @@ retry:
          atomic_fetch_sub(&config->active_connections, 1);
       }
 retry2:
+      if (no_wait)
+      {
+         goto busy;
+      }
+
       if (pgagroal_time_is_valid(config->blocking_timeout))
       {
          /* Back-off that doubles each retry (1ms, 2ms, 4ms, ... up to the
@@ -385,7 +550,24 @@ retry2:
           * The total wait is still bounded by blocking_timeout, which is
           * re-checked below each retry (#813). */
          retry_delay = pgagroal_pool_next_retry_delay(retry_delay, config->connection_retry_delay);
-         SLEEP(retry_delay)
+
+         /* A full queue fails fast instead of piling up clients until blocking_timeout */
+         if (ticket == 0 && config->max_queue_length > 0 && best_rule >= -1 && best_rule < NUMBER_OF_LIMITS &&
+             atomic_load(&config->waiters[best_rule + 1]) >= config->max_queue_length)
+         {
+            pgagroal_log_debug("pgagroal_get_connection: Queue full for %s/%s", username, database);
+            goto busy;
+         }
+
+         /* Wait in FIFO order for a returned connection to be handed to us;
+          * the back-off delay bounds the wait, so newly created capacity is
+          * still picked up by the rescan */
+         if (wait_for_hand_off(best_rule, key, &ticket, retry_delay, slot))
+         {
+            do_init = false;
+            has_lock = true;
+            goto handed_off;
+         }
 
          double diff = difftime(time(NULL), start_time);
          if (diff >= (double)pgagroal_time_convert(config->blocking_timeout, FORMAT_TIME_S))
@@ -402,6 +584,12 @@ retry2:
       }
       else
       {
+         if (throttle > 0)
+         {
+            /* Waiting for the token doesn't use up the retries */
+            SLEEP_AND_GOTO(MIN(throttle, 999999L) * 1000L, start)
+         }
+
          if (!transaction_mode)
          {
             if (best_rule == -1)
@@ -432,14 +620,23 @@ retry2:
       }
    }
 
+busy:
+   pgagroal_prometheus_connection_unawaiting(best_rule);
+   pgagroal_probe_get_connection_done(-1, best_rule, 1, &wait_start);
+   pgagroal_slowlog_acquire(-1, best_rule, SLOWLOG_BUSY, username, database, &wait_start);
+   return 1;
+
 timeout:
    if (config->common.metrics > 0)
    {
       atomic_store(&prometheus->client_wait_time, difftime(time(NULL), start_time));
+      pgagroal_prometheus_connection_wait(best_rule, pgagroal_time_elapsed_usec(&wait_start), PROMETHEUS_WAIT_TIMEOUT);
    }
    pgagroal_prometheus_connection_timeout();
    pgagroal_tracking_event_basic(TRACKER_GET_CONNECTION_TIMEOUT, username, database);
    pgagroal_prometheus_connection_unawaiting(best_rule);
+   pgagroal_probe_get_connection_done(-1, best_rule, 1, &wait_start);
+   pgagroal_slowlog_acquire(-1, best_rule, SLOWLOG_TIMEOUT, username, database, &wait_start);
    return 1;
 
 error:
@@ -455,10 +652,41 @@ error:
    pgagroal_prometheus_connection_error();
    pgagroal_prometheus_connection_unawaiting(best_rule);
    pgagroal_tracking_event_basic(TRACKER_GET_CONNECTION_ERROR, username, database);
+   pgagroal_probe_get_connection_done(-1, best_rule, 2, &wait_start);
+   pgagroal_slowlog_acquire(-1, best_rule, SLOWLOG_ERROR, username, database, &wait_start);
 
    return 2;
 }
 
+int
+pgagroal_get_replica_connection(char* username, char* database, int* slot, SSL** ssl)
+{
+   int ret;
+
+   if (pgagroal_get_replica(&replica_server))
+   {
+      /* No replica qualifies, so the client is served by the primary */
+      replica_server = -1;
+   }
+
+   ret = pgagroal_get_connection(username, database, true, false, slot, ssl);
+   replica_server = -1;
+
+   return ret;
+}
+
+int
+pgagroal_try_connection(char* username, char* database, bool transaction_mode, int* slot, SSL** ssl)
+{
+   int ret;
+
+   no_wait = true;
+   ret = pgagroal_get_connection(username, database, true, transaction_mode, slot, ssl);
+   no_wait = false;
+
+   return ret;
+}
+
 long
 pgagroal_pool_next_retry_delay(long current_ns, int cap_ms)
 {
@@ -504,9 +732,18 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
    signed char in_use;
    signed char age_check;
    int transfer_fd = -1;
+   bool batched = false;
 
    config = (struct main_configuration*)shmem;
 
+   pgagroal_probe_return_connection(slot, config->connections[slot].limit_rule, transaction_mode);
+
+   /* The slot is above a max_connections lowered by a reload */
+   if (slot >= config->max_connections)
+   {
+      goto kill_connection;
+   }
+
    /* Kill the connection, if it lives longer than max_connection_age */
    if (pgagroal_time_is_valid(config->max_connection_age))
    {
@@ -535,9 +772,10 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
 
    /* Can we cache this connection ? */
    if (config->connections[slot].has_security != SECURITY_INVALID &&
+       pgagroal_security_messages_cached(slot) &&
        (config->connections[slot].has_security != SECURITY_SCRAM256 ||
         (config->connections[slot].has_security == SECURITY_SCRAM256 &&
-         (config->authquery || pgagroal_user_known(config->connections[slot].username)))) &&
+         (config->authquery || pgagroal_user_known(pgagroal_connection_info(slot)->username)))) &&
        ssl == NULL)
    {
       state = atomic_load(&config->states[slot]);
@@ -549,16 +787,43 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
 
          if (!transaction_mode)
          {
-            if (pgagroal_write_discard_all(ssl, config->connections[slot].fd))
+            /* The session pipeline lowers the reset when the client didn't change the session state */
+            if (config->connections[slot].reset == RESET_DISCARD)
             {
-               goto kill_connection;
+               if (pgagroal_write_discard_all(ssl, config->connections[slot].fd))
+               {
+                  goto kill_connection;
+               }
+               pgagroal_parameters_reset(slot);
+            }
+            else if (config->connections[slot].reset == RESET_DEALLOCATE)
+            {
+               if (pgagroal_write_deallocate_all(ssl, config->connections[slot].fd))
+               {
+                  goto kill_connection;
+               }
             }
+            config->connections[slot].reset = RESET_DISCARD;
+            pgagroal_prepared_reset(slot);
          }
 
          pgagroal_tracking_event_slot(TRACKER_RETURN_CONNECTION_SUCCESS, slot);
 
          config->connections[slot].timestamp = time(NULL);
 
+         /* A transaction client waiting for the same key gets the
+          * connection as is, without it passing through the free state */
+         if (transaction_mode && !config->connections[slot].new && direct_hand_off(slot))
+         {
+            pgagroal_prometheus_connection_return();
+
+            return 0;
+         }
+
+         /* A new connection is transferred and returned over one connection */
+         pgagroal_connection_batch_begin();
+         batched = true;
+
          if (config->connections[slot].new)
          {
             if (pgagroal_connection_get(&transfer_fd))
@@ -576,7 +841,7 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
                goto kill_connection;
             }
 
-            pgagroal_disconnect(transfer_fd);
+            pgagroal_connection_put(transfer_fd);
             transfer_fd = -1;
          }
 
@@ -595,9 +860,12 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
             goto kill_connection;
          }
 
-         pgagroal_disconnect(transfer_fd);
+         pgagroal_connection_put(transfer_fd);
          transfer_fd = -1;
 
+         pgagroal_connection_batch_end();
+         batched = false;
+
          if (config->connections[slot].limit_rule >= 0)
          {
             atomic_fetch_sub(&config->limits[config->connections[slot].limit_rule].active_connections, 1);
@@ -606,13 +874,16 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
          config->connections[slot].new = false;
          config->connections[slot].pid = -1;
          config->connections[slot].tx_mode = transaction_mode;
-         memset(&config->connections[slot].appname, 0, sizeof(config->connections[slot].appname));
+         memset(&pgagroal_connection_info(slot)->appname, 0, sizeof(pgagroal_connection_info(slot)->appname));
          atomic_store(&config->states[slot], STATE_FREE);
+         free_slot_add(slot);
          atomic_fetch_sub(&config->active_connections, 1);
 
          pgagroal_log_debug("Connection returned: slot=%d, active_connections=%d, gracefully=%s",
                             slot, atomic_load(&config->active_connections), config->gracefully ? "true" : "false");
 
+         hand_off(slot);
+
          // Check for graceful shutdown after successful connection return
          check_graceful_shutdown_trigger();
 
@@ -631,13 +902,85 @@ pgagroal_return_connection(int slot, SSL* ssl, bool transaction_mode)
 
 kill_connection:
 
-   pgagroal_disconnect(transfer_fd);
+   pgagroal_connection_put(transfer_fd);
+
+   if (batched)
+   {
+      pgagroal_connection_batch_end();
+   }
 
    pgagroal_tracking_event_slot(TRACKER_RETURN_CONNECTION_KILL, slot);
 
    return pgagroal_kill_connection(slot, ssl);
 }
 
+bool
+pgagroal_pool_waiting(int slot)
+{
+   int rule;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   rule = config->connections[slot].limit_rule;
+
+   if (rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      return false;
+   }
+
+   return atomic_load(&config->waiters[rule + 1]) > 0;
+}
+
+int
+pgagroal_pool_limit_size(int rule)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->number_of_cluster_peers > 0)
+   {
+      return MIN(atomic_load(&config->limit_demands[rule].quota), config->limits[rule].max_size);
+   }
+
+   return config->limits[rule].max_size;
+}
+
+void
+pgagroal_pool_trim(int rule, int size)
+{
+   int backends;
+   signed char free;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   backends = atomic_load(&config->limits[rule].backend_connections);
+
+   for (int i = config->max_connections - 1; backends > size && i >= 0; i--)
+   {
+      free = STATE_FREE;
+
+      if (config->connections[i].limit_rule == rule &&
+          atomic_compare_exchange_strong(&config->states[i], &free, STATE_IDLE_CHECK))
+      {
+         if (config->connections[i].limit_rule == rule && !config->connections[i].tx_mode)
+         {
+            timer_wheels_remove(i);
+            pgagroal_tracking_event_slot(TRACKER_KILL_CONNECTION, i);
+            pgagroal_kill_connection(i, NULL);
+            backends--;
+         }
+         else
+         {
+            atomic_store(&config->states[i], STATE_FREE);
+            free_slot_add(i);
+         }
+      }
+   }
+}
+
 int
 pgagroal_kill_connection(int slot, SSL* ssl)
 {
@@ -655,6 +998,7 @@ pgagroal_kill_connection(int slot, SSL* ssl)
                       config->connections[slot].pid);
 
    pgagroal_tracking_event_slot(TRACKER_KILL_CONNECTION, slot);
+   pgagroal_probe_kill_connection(slot, config->connections[slot].limit_rule, config->connections[slot].server);
 
    fd = config->connections[slot].fd;
    if (fd != -1)
@@ -679,7 +1023,7 @@ pgagroal_kill_connection(int slot, SSL* ssl)
          result = 1;
       }
 
-      pgagroal_disconnect(transfer_fd);
+      pgagroal_connection_put(transfer_fd);
 
       if (ssl != NULL)
       {
@@ -719,59 +1063,117 @@ pgagroal_kill_connection(int slot, SSL* ssl)
       result = 1;
    }
 
-   if (config->connections[slot].limit_rule >= 0)
-   {
-      /* Release the rule's hard-cap reservation (issue #848). Unlike the
-       * per-rule active_connections below, backend_connections tracks live
-       * backends rather than checkouts, so it must be released on every kill
-       * of a rule-bound backend -- including idle/flush kills of pooled
-       * connections, where pid == -1 and the checkout counter was already
-       * decremented on return. */
-      atomic_fetch_sub(&config->limits[config->connections[slot].limit_rule].backend_connections, 1);
-   }
+   detach_connection(slot);
 
-   if (config->connections[slot].pid != -1)
+   pgagroal_prometheus_connection_kill();
+
+   return result;
+}
+
+void
+pgagroal_adaptive_pool(void)
+{
+   bool prefill;
+   time_t now;
+   int position;
+   int previous;
+   int window;
+   int current;
+   int last;
+   int predicted;
+   int target;
+   int backends;
+   bool busy;
+   signed char free;
+   struct limit_demand* demand = NULL;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+   now = time(NULL);
+   prefill = false;
+
+   pgagroal_log_debug("pgagroal_adaptive_pool");
+
+   for (int i = 0; i < config->number_of_limits; i++)
    {
-      if (config->connections[slot].limit_rule >= 0)
+      demand = &config->limit_demands[i];
+
+      /* Close the current sample */
+      position = demand->position;
+      demand->rates[position] = atomic_exchange(&demand->acquires, 0);
+      demand->peaks[position] = atomic_exchange(&demand->peak, atomic_load(&config->limits[i].active_connections));
+      demand->waiters[position] = (unsigned short)atomic_load(&config->waiters[i + 1]);
+      demand->position = (position + 1) % ADAPTIVE_POOL_SAMPLES;
+
+      window = 0;
+      busy = false;
+      for (int j = 0; j < ADAPTIVE_POOL_SAMPLES; j++)
       {
-         atomic_fetch_sub(&config->limits[config->connections[slot].limit_rule].active_connections, 1);
+         window = MAX(window, demand->peaks[j] + demand->waiters[j]);
+         busy = busy || demand->rates[j] > 0;
       }
 
-      atomic_fetch_sub(&config->active_connections, 1);
+      /* A rising demand is extrapolated one sample ahead */
+      previous = (position + ADAPTIVE_POOL_SAMPLES - 1) % ADAPTIVE_POOL_SAMPLES;
+      current = demand->peaks[position] + demand->waiters[position];
+      last = demand->peaks[previous] + demand->waiters[previous];
+      predicted = current + MAX(current - last, 0);
 
-      // Check for graceful shutdown after killing connection
-      check_graceful_shutdown_trigger();
-   }
+      /* Without any use over the whole window the pool falls back to min_size */
+      target = busy ? MAX(window, predicted) : 0;
+      target = MIN(MAX(target, config->limits[i].min_size), pgagroal_pool_limit_size(i));
 
-   memset(&config->connections[slot].username, 0, sizeof(config->connections[slot].username));
-   memset(&config->connections[slot].database, 0, sizeof(config->connections[slot].database));
-   memset(&config->connections[slot].appname, 0, sizeof(config->connections[slot].appname));
+      atomic_store(&demand->target, target);
 
-   config->connections[slot].new = true;
-   config->connections[slot].server = -1;
-   config->connections[slot].tx_mode = false;
+      backends = atomic_load(&config->limits[i].backend_connections);
 
-   config->connections[slot].has_security = SECURITY_INVALID;
-   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-   {
-      config->connections[slot].security_lengths[i] = 0;
-      memset(&config->connections[slot].security_messages[i], 0, SECURITY_BUFFER_SIZE);
-   }
+      pgagroal_log_debug("Adaptive: Limit entry (%d) window=%d predicted=%d target=%d backends=%d",
+                         i + 1, window, predicted, target, backends);
 
-   config->connections[slot].backend_pid = 0;
-   config->connections[slot].backend_secret = 0;
+      if (backends < target)
+      {
+         prefill = true;
+      }
 
-   config->connections[slot].limit_rule = -1;
-   config->connections[slot].start_time = -1;
-   config->connections[slot].timestamp = -1;
-   config->connections[slot].fd = -1;
-   config->connections[slot].pid = -1;
+      /* Shrink by the connections that were not used during the last sample */
+      for (int j = config->max_connections - 1; backends > target && j >= 0; j--)
+      {
+         free = STATE_FREE;
 
-   atomic_store(&config->states[slot], STATE_NOTINIT);
+         if (config->connections[j].limit_rule == i &&
+             atomic_compare_exchange_strong(&config->states[j], &free, STATE_IDLE_CHECK))
+         {
+            if (config->connections[j].limit_rule == i && !config->connections[j].tx_mode &&
+                difftime(now, config->connections[j].timestamp) >= (double)pgagroal_time_convert(config->adaptive_pool_interval, FORMAT_TIME_S))
+            {
+               timer_wheels_remove(j);
+               pgagroal_prometheus_connection_idletimeout();
+               pgagroal_tracking_event_slot(TRACKER_IDLE_TIMEOUT, j);
+               pgagroal_kill_connection(j, NULL);
+               backends--;
+            }
+            else
+            {
+               atomic_store(&config->states[j], STATE_FREE);
+               free_slot_add(j);
+            }
+         }
+      }
+   }
 
-   pgagroal_prometheus_connection_kill();
+   if (prefill)
+   {
+      pgagroal_prefill_if_can(true, false);
+   }
 
-   return result;
+   pgagroal_pool_status();
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
 }
 
 void
@@ -781,6 +1183,8 @@ pgagroal_idle_timeout(void)
    time_t now;
    signed char free;
    signed char idle_check;
+   int timeout;
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
    struct main_configuration* config;
 
    pgagroal_start_logging();
@@ -789,12 +1193,21 @@ pgagroal_idle_timeout(void)
    config = (struct main_configuration*)shmem;
    now = time(NULL);
    prefill = false;
+   timeout = (int)pgagroal_time_convert(config->idle_timeout, FORMAT_TIME_S);
 
    pgagroal_log_debug("pgagroal_idle_timeout");
 
-   /* Here we run backwards in order to keep hot connections in the beginning */
+   /* Only visit the slots that are due according to the timer wheel, and
+    * run backwards in order to keep hot connections in the beginning */
+   pgagroal_timer_wheel_advance(&config->idle_wheel, timeout, now, &due[0]);
+
    for (int i = config->max_connections - 1; i >= 0; i--)
    {
+      if (!(due[i / 64] & (1ULL << (i % 64))))
+      {
+         continue;
+      }
+
       free = STATE_FREE;
       idle_check = STATE_IDLE_CHECK;
 
@@ -817,6 +1230,10 @@ pgagroal_idle_timeout(void)
                pgagroal_kill_connection(i, NULL);
                prefill = true;
             }
+            else
+            {
+               free_slot_add(i);
+            }
          }
       }
    }
@@ -840,6 +1257,9 @@ pgagroal_max_connection_age(void)
    time_t now;
    signed char free;
    signed char age_check;
+   int timeout;
+   int recycles[NUMBER_OF_SERVERS];
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
    struct main_configuration* config;
 
    pgagroal_start_logging();
@@ -848,20 +1268,50 @@ pgagroal_max_connection_age(void)
    config = (struct main_configuration*)shmem;
    now = time(NULL);
    prefill = false;
+   timeout = (int)pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S);
+
+   memset(&recycles, 0, sizeof(recycles));
 
    pgagroal_log_debug("pgagroal_max_connection_age");
 
-   /* Here we run backwards in order to keep hot connections in the beginning */
+   /* Only visit the slots that are due according to the timer wheel, and
+    * run backwards in order to keep hot connections in the beginning */
+   pgagroal_timer_wheel_advance(&config->age_wheel, timeout, now, &due[0]);
+
    for (int i = config->max_connections - 1; i >= 0; i--)
    {
+      if (!(due[i / 64] & (1ULL << (i % 64))))
+      {
+         continue;
+      }
+
       free = STATE_FREE;
       age_check = STATE_MAX_CONNECTION_AGE;
 
       if (atomic_compare_exchange_strong(&config->states[i], &free, age_check))
       {
-         double age = difftime(now, config->connections[i].start_time);
-         if (age >= (double)pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S) && !config->connections[i].tx_mode)
+         int server = config->connections[i].server;
+         bool recycle = now >= age_deadline(i, timeout) && !config->connections[i].tx_mode;
+
+         /* Ahead of max_connection_age the recycling waits while the rule has
+          * waiters, and is capped per server, such that backends created
+          * together don't reconnect together */
+         if (recycle && difftime(now, config->connections[i].start_time) < (double)timeout)
          {
+            if (pgagroal_pool_waiting(i) ||
+                (server >= 0 && server < NUMBER_OF_SERVERS && recycles[server] >= config->prefill_concurrency))
+            {
+               recycle = false;
+            }
+         }
+
+         if (recycle)
+         {
+            if (server >= 0 && server < NUMBER_OF_SERVERS)
+            {
+               recycles[server]++;
+            }
+
             pgagroal_prometheus_connection_max_connection_age();
             pgagroal_tracking_event_slot(TRACKER_MAX_CONNECTION_AGE, i);
             pgagroal_kill_connection(i, NULL);
@@ -876,12 +1326,18 @@ pgagroal_max_connection_age(void)
                pgagroal_kill_connection(i, NULL);
                prefill = true;
             }
+            else
+            {
+               free_slot_add(i);
+            }
          }
       }
    }
 
    if (prefill)
    {
+      /* The prefill replaces the recycled backends */
+      recycling = true;
       pgagroal_prefill_if_can(true, false);
    }
 
@@ -898,7 +1354,8 @@ pgagroal_validation(void)
    bool prefill = true;
    time_t now;
    signed char free;
-   signed char validation;
+   int slots[VALIDATION_BATCH];
+   int number_of_slots = 0;
    struct main_configuration* config;
 
    pgagroal_start_logging();
@@ -909,13 +1366,13 @@ pgagroal_validation(void)
 
    pgagroal_log_debug("pgagroal_validation");
 
-   /* We run backwards */
+   /* We run backwards, and the slots are validated a batch at a time, such that
+    * a slot is only unavailable for the time it takes to check its batch */
    for (int i = config->max_connections - 1; i >= 0; i--)
    {
       free = STATE_FREE;
-      validation = STATE_VALIDATION;
 
-      if (atomic_compare_exchange_strong(&config->states[i], &free, validation))
+      if (atomic_compare_exchange_strong(&config->states[i], &free, STATE_VALIDATION))
       {
          bool kill = false;
          double diff, age;
@@ -946,32 +1403,31 @@ pgagroal_validation(void)
             }
          }
 
-         /* Ok, send SELECT 1 */
-         if (!kill)
-         {
-            kill = !pgagroal_connection_isvalid(config->connections[i].fd);
-         }
-
          if (kill)
          {
-            pgagroal_prometheus_connection_invalid();
-            pgagroal_tracking_event_slot(TRACKER_INVALID_CONNECTION, i);
-            pgagroal_kill_connection(i, NULL);
+            validation_done(i, false);
             prefill = true;
+            continue;
          }
-         else
+
+         slots[number_of_slots++] = i;
+
+         if (number_of_slots == VALIDATION_BATCH)
          {
-            if (!atomic_compare_exchange_strong(&config->states[i], &validation, STATE_FREE))
+            if (validate_batch(&slots[0], number_of_slots))
             {
-               pgagroal_prometheus_connection_invalid();
-               pgagroal_tracking_event_slot(TRACKER_INVALID_CONNECTION, i);
-               pgagroal_kill_connection(i, NULL);
                prefill = true;
             }
+            number_of_slots = 0;
          }
       }
    }
 
+   if (number_of_slots > 0 && validate_batch(&slots[0], number_of_slots))
+   {
+      prefill = true;
+   }
+
    if (prefill)
    {
       pgagroal_prefill_if_can(true, false);
@@ -1002,7 +1458,7 @@ pgagroal_flush(int mode, char* database)
    prefill = false;
 
    pgagroal_log_debug("pgagroal_flush");
-   for (int i = config->max_connections - 1; i >= 0; i--)
+   for (int i = config->connection_slots - 1; i >= 0; i--)
    {
       free = STATE_FREE;
       in_use = STATE_IN_USE;
@@ -1021,7 +1477,7 @@ pgagroal_flush(int mode, char* database)
       {
          bool consider = false;
 
-         if (!strcmp(database, "all") || !strcmp(config->connections[i].database, database))
+         if (!strcmp(database, "all") || !strcmp(pgagroal_connection_info(i)->database, database))
          {
             consider = true;
          }
@@ -1125,7 +1581,7 @@ pgagroal_flush_server(signed char server)
    config = (struct main_configuration*)shmem;
 
    pgagroal_log_debug("pgagroal_flush_server %s", config->servers[server].name);
-   for (int i = 0; i < config->max_connections; i++)
+   for (int i = 0; i < config->connection_slots; i++)
    {
       if (config->connections[i].server == server)
       {
@@ -1170,7 +1626,9 @@ pgagroal_flush_server(signed char server)
    {
       if (server != (unsigned char)primary && primary != -1)
       {
-         pgagroal_prefill_if_can(true, true);
+         /* Re-warm the new primary to min_size right away, the clients
+          * create the rest at connection_rate */
+         pgagroal_prefill_if_can(true, false);
       }
    }
 
@@ -1181,6 +1639,221 @@ pgagroal_flush_server(signed char server)
    exit(0);
 }
 
+void
+pgagroal_flush_progressive(char* database, int64_t timeout, int* flushed, int* recycled, int* forced)
+{
+   bool all;
+   bool prefill;
+   int remaining;
+   int64_t budget;
+   int64_t used;
+   int64_t elapsed;
+   int64_t last_prefill;
+   struct timespec start;
+   struct timespec now;
+   struct flush_target* targets = NULL;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   *flushed = 0;
+   *recycled = 0;
+   *forced = 0;
+
+   targets = calloc(config->connection_slots, sizeof(struct flush_target));
+   if (targets == NULL)
+   {
+      pgagroal_log_error("pgagroal: progressive flush of '%s' out of memory", database);
+      goto done;
+   }
+
+   all = !strcmp(database, "all") || !strcmp(database, "*");
+   remaining = 0;
+
+   /* Only the backends that exist now are retired, the replacements are left alone */
+   for (int i = 0; i < config->connection_slots; i++)
+   {
+      signed char state = atomic_load(&config->states[i]);
+
+      if (state == STATE_NOTINIT || state == STATE_INIT)
+      {
+         continue;
+      }
+
+      if (!all && strcmp(pgagroal_connection_info(i)->database, database))
+      {
+         continue;
+      }
+
+      targets[i].active = true;
+      targets[i].backend_pid = config->connections[i].backend_pid;
+      targets[i].start_time = config->connections[i].start_time;
+      remaining++;
+   }
+
+   pgagroal_log_info("pgagroal: progressive flush of %d connections for '%s' (flush_rate %d)",
+                     remaining, database, config->flush_rate);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   used = 0;
+   last_prefill = -1000;
+   prefill = false;
+
+   while (remaining > 0)
+   {
+      bool force;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      elapsed = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000LL;
+
+      /* A second worth of backends at once, the rest spaced evenly like connection_rate */
+      if (config->flush_rate > 0)
+      {
+         budget = config->flush_rate + (config->flush_rate * elapsed) / 1000LL - used;
+      }
+      else
+      {
+         budget = config->connection_slots;
+      }
+
+      force = timeout > 0 && elapsed >= timeout * 1000LL;
+
+      for (int i = 0; i < config->connection_slots && remaining > 0; i++)
+      {
+         signed char free = STATE_FREE;
+         signed char in_use = STATE_IN_USE;
+
+         if (!targets[i].active)
+         {
+            continue;
+         }
+
+         if (flush_target_gone(i, &targets[i]))
+         {
+            if (targets[i].handed)
+            {
+               (*forced)++;
+            }
+            else if (targets[i].marked)
+            {
+               (*recycled)++;
+            }
+            targets[i].active = false;
+            remaining--;
+            prefill = true;
+            continue;
+         }
+
+         /* On expiry everything left goes at once */
+         if (budget <= 0 && !force)
+         {
+            continue;
+         }
+
+         if (atomic_compare_exchange_strong(&config->states[i], &free, STATE_FLUSH))
+         {
+            if (pgagroal_socket_isvalid(config->connections[i].fd))
+            {
+               pgagroal_write_terminate(NULL, config->connections[i].fd);
+            }
+            pgagroal_prometheus_connection_flush();
+            pgagroal_tracking_event_slot(TRACKER_FLUSH, i);
+            pgagroal_kill_connection(i, NULL);
+
+            (*flushed)++;
+            targets[i].active = false;
+            remaining--;
+            budget--;
+            used++;
+            prefill = true;
+         }
+         else if (force)
+         {
+            signed char state = atomic_load(&config->states[i]);
+
+            switch (state)
+            {
+               case STATE_IN_USE:
+               case STATE_GRACEFULLY:
+                  if (!targets[i].handed && atomic_compare_exchange_strong(&config->states[i], &state, STATE_FLUSH))
+                  {
+                     if (config->connections[i].pid > 0)
+                     {
+                        kill(config->connections[i].pid, SIGQUIT);
+                     }
+                     pgagroal_prometheus_connection_flush();
+                     pgagroal_tracking_event_slot(TRACKER_FLUSH, i);
+                     pgagroal_kill_connection(i, NULL);
+
+                     (*forced)++;
+                     targets[i].active = false;
+                     remaining--;
+                     prefill = true;
+                  }
+                  break;
+               case STATE_IDLE_CHECK:
+               case STATE_MAX_CONNECTION_AGE:
+               case STATE_VALIDATION:
+                  /* The task can't put the backend back as free, and kills it instead */
+                  if (atomic_compare_exchange_strong(&config->states[i], &state, STATE_GRACEFULLY))
+                  {
+                     targets[i].handed = true;
+                  }
+                  break;
+               default:
+                  /* Being removed already */
+                  break;
+            }
+         }
+         else if (!targets[i].marked)
+         {
+            if (atomic_compare_exchange_strong(&config->states[i], &in_use, STATE_GRACEFULLY))
+            {
+               targets[i].marked = true;
+               budget--;
+               used++;
+            }
+         }
+      }
+
+      /* The replacements are created next to the drain, at most once a second */
+      if (prefill && elapsed - last_prefill >= 1000)
+      {
+         pgagroal_prefill_if_can(true, false);
+         last_prefill = elapsed;
+         prefill = false;
+      }
+
+      while (waitpid(-1, NULL, WNOHANG) > 0)
+      {
+      }
+
+      if (remaining > 0)
+      {
+         SLEEP(100000000L)
+      }
+   }
+
+   if (prefill)
+   {
+      pgagroal_prefill_if_can(true, false);
+   }
+
+   pgagroal_log_info("pgagroal: progressive flush for '%s' done (flushed %d, recycled %d, forced %d)",
+                     database, *flushed, *recycled, *forced);
+
+done:
+
+   free(targets);
+
+   pgagroal_pool_status();
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+}
+
 void
 pgagroal_request_flush(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
 {
@@ -1189,6 +1862,9 @@ pgagroal_request_flush(SSL* ssl __attribute__((unused)), int client_fd, uint8_t
    struct json* req = NULL;
    int mode = 0;
    char* database = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
 
    start_time = time(NULL);
 
@@ -1196,13 +1872,37 @@ pgagroal_request_flush(SSL* ssl __attribute__((unused)), int client_fd, uint8_t
    mode = (int)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_MODE);
    database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
 
-   if (database != NULL)
+   if (database == NULL)
    {
-      pgagroal_flush(mode, database);
+      database = "*";
+   }
+
+   if (mode == FLUSH_PROGRESSIVE)
+   {
+      struct json* res = NULL;
+      int64_t timeout = -1;
+      int flushed = 0;
+      int recycled = 0;
+      int forced = 0;
+
+      timeout = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_TIMEOUT);
+      if (timeout < 0)
+      {
+         timeout = pgagroal_time_is_valid(config->flush_timeout) ? pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S) : 0;
+      }
+
+      pgagroal_flush_progressive(database, timeout, &flushed, &recycled, &forced);
+
+      if (!pgagroal_management_create_response(payload, -1, &res))
+      {
+         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_FLUSHED, (uintptr_t)flushed, ValueInt32);
+         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_RECYCLED, (uintptr_t)recycled, ValueInt32);
+         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_FORCED, (uintptr_t)forced, ValueInt32);
+      }
    }
    else
    {
-      pgagroal_flush(mode, "*");
+      pgagroal_flush(mode, database);
    }
 
    end_time = time(NULL);
@@ -1236,9 +1936,11 @@ pgagroal_prefill(bool initial)
       }
       else
       {
-         size = config->limits[i].min_size;
+         size = MAX(config->limits[i].min_size, atomic_load(&config->limit_demands[i].target));
       }
 
+      size = MIN(size, pgagroal_pool_limit_size(i));
+
       if (size > 0)
       {
          if (strcmp("all", config->limits[i].database) && strcmp("all", config->limits[i].username))
@@ -1255,55 +1957,7 @@ pgagroal_prefill(bool initial)
 
             if (user != -1)
             {
-               while (do_prefill(config->users[user].username, config->limits[i].database, size))
-               {
-                  int32_t slot = -1;
-                  SSL* ssl = NULL;
-
-                  if (pgagroal_prefill_auth(config->users[user].username, config->users[user].password,
-                                            config->limits[i].database, &slot, &ssl) != AUTH_SUCCESS)
-                  {
-                     pgagroal_log_warn("Invalid data for user '%s' using limit entry (%d)", config->limits[i].username, i + 1);
-
-                     if (slot != -1)
-                     {
-                        if (config->connections[slot].fd != -1)
-                        {
-                           if (pgagroal_socket_isvalid(config->connections[slot].fd))
-                           {
-                              pgagroal_write_terminate(NULL, config->connections[slot].fd);
-                           }
-                        }
-                        pgagroal_tracking_event_slot(TRACKER_PREFILL_KILL, slot);
-                        pgagroal_kill_connection(slot, ssl);
-                     }
-
-                     break;
-                  }
-
-                  if (slot != -1)
-                  {
-                     if (config->connections[slot].has_security != SECURITY_INVALID)
-                     {
-                        pgagroal_tracking_event_slot(TRACKER_PREFILL_RETURN, slot);
-                        pgagroal_return_connection(slot, ssl, false);
-                     }
-                     else
-                     {
-                        pgagroal_log_warn("Unsupported security model during prefill for user '%s' using limit entry (%d)", config->limits[i].username, i + 1);
-                        if (config->connections[slot].fd != -1)
-                        {
-                           if (pgagroal_socket_isvalid(config->connections[slot].fd))
-                           {
-                              pgagroal_write_terminate(NULL, config->connections[slot].fd);
-                           }
-                        }
-                        pgagroal_tracking_event_slot(TRACKER_PREFILL_KILL, slot);
-                        pgagroal_kill_connection(slot, ssl);
-                        break;
-                     }
-                  }
-               }
+               prefill_limit(i, user, size);
             }
             else
             {
@@ -1337,14 +1991,89 @@ pgagroal_pool_init(void)
       atomic_init(&config->states[i], STATE_NOTINIT);
    }
 
+   /* Pool keys */
+   for (int i = 0; i < NUMBER_OF_POOL_KEYS; i++)
+   {
+      atomic_init(&config->pool_keys[i].state, STATE_NOTINIT);
+   }
+
+   /* SCRAM-SHA-256 keys */
+   for (int i = 0; i < NUMBER_OF_SCRAM_KEYS; i++)
+   {
+      atomic_init(&config->scram_keys[i].state, STATE_NOTINIT);
+   }
+
+   /* Authentication query cache */
+   for (int i = 0; i < NUMBER_OF_AUTH_QUERY_ENTRIES; i++)
+   {
+      atomic_init(&config->auth_query_entries[i].state, STATE_NOTINIT);
+   }
+
+   /* Client connection rates */
+   for (int i = 0; i < NUMBER_OF_CLIENT_RATES; i++)
+   {
+      atomic_init(&config->client_rates[i].key, 0);
+      atomic_init(&config->client_rates[i].tat, 0);
+   }
+
+   /* Cancel keys */
+   for (int i = 0; i < NUMBER_OF_CANCEL_KEYS; i++)
+   {
+      atomic_init(&config->cancel_keys[i], -1);
+   }
+
+   /* Waiters */
+   atomic_init(&config->waiter_ticket, 0);
+   for (int i = 0; i < NUMBER_OF_LIMITS + 1; i++)
+   {
+      atomic_init(&config->waiters[i], 0);
+   }
+
+   for (int i = 0; i < NUMBER_OF_WAITERS; i++)
+   {
+      atomic_init(&config->pool_waiters[i].state, WAITER_FREE);
+   }
+
+   /* Demand */
+   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
+   {
+      atomic_init(&config->limit_demands[i].acquires, 0);
+      atomic_init(&config->limit_demands[i].peak, 0);
+      atomic_init(&config->limit_demands[i].target, 0);
+   }
+
+   /* Timer wheels */
+   atomic_init(&config->idle_wheel.tick, 0);
+   atomic_init(&config->age_wheel.tick, 0);
+   for (int i = 0; i < TIMER_WHEEL_SIZE; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_FREE_SLOT_WORDS; j++)
+      {
+         atomic_init(&config->idle_wheel.buckets[i][j], 0);
+         atomic_init(&config->age_wheel.buckets[i][j], 0);
+      }
+   }
+
+   /* Free slot index */
+   for (int i = 0; i < NUMBER_OF_LIMITS + 1; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_FREE_SLOT_WORDS; j++)
+      {
+         atomic_init(&config->free_slots[i][j], 0);
+      }
+   }
+
    /* Connections */
-   for (int i = 0; i < config->max_connections; i++)
+   for (int i = 0; i < config->connection_slots; i++)
    {
       config->connections[i].new = true;
       config->connections[i].tx_mode = false;
       config->connections[i].server = -1;
+      config->connections[i].replica = false;
+      config->connections[i].reset = RESET_DISCARD;
       config->connections[i].has_security = SECURITY_INVALID;
       config->connections[i].limit_rule = -1;
+      config->connections[i].key = 0;
       config->connections[i].start_time = -1;
       config->connections[i].timestamp = -1;
       config->connections[i].fd = -1;
@@ -1354,6 +2083,36 @@ pgagroal_pool_init(void)
    return 0;
 }
 
+void
+pgagroal_pool_resize(int max_connections)
+{
+   int old;
+   signed char free;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   old = config->max_connections;
+   config->max_connections = max_connections;
+
+   pgagroal_log_info("max_connections changed from %d to %d", old, max_connections);
+
+   /* The slots up to connection_slots are initialized, so nothing is needed
+    * to grow. The free connections above a lower limit are closed, the
+    * ones in use are closed by pgagroal_return_connection, and the ones held
+    * by a maintenance task are closed by free_slot_add */
+   for (int i = old - 1; i >= max_connections; i--)
+   {
+      free = STATE_FREE;
+      if (atomic_compare_exchange_strong(&config->states[i], &free, STATE_REMOVE))
+      {
+         pgagroal_prometheus_connection_remove();
+         pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, i);
+         pgagroal_kill_connection(i, NULL);
+      }
+   }
+}
+
 int
 pgagroal_pool_shutdown(void)
 {
@@ -1361,7 +2120,7 @@ pgagroal_pool_shutdown(void)
 
    config = (struct main_configuration*)shmem;
 
-   for (int i = 0; i < config->max_connections; i++)
+   for (int i = 0; i < config->connection_slots; i++)
    {
       int state = atomic_load(&config->states[i]);
 
@@ -1403,458 +2162,1040 @@ pgagroal_pool_status(void)
    }
 
 #ifdef DEBUG
-   assert(atomic_load(&config->active_connections) <= config->max_connections);
+   assert(atomic_load(&config->active_connections) <= config->connection_slots);
 #endif
 
    return 0;
 }
 
-static int
-find_best_rule(char* username, char* database)
+bool
+pgagroal_client_throttled(char* address)
 {
-   int best_rule;
+   unsigned long long hash;
+   unsigned long long key;
+   long long interval;
+   long long now;
+   long long tat;
+   long long next;
+   struct timespec ts;
+   struct client_rate* r = NULL;
    struct main_configuration* config;
 
-   best_rule = -1;
    config = (struct main_configuration*)shmem;
 
-   if (config->number_of_limits > 0)
+   if (config->client_connection_rate <= 0 || address == NULL)
    {
-      for (int i = 0; i < config->number_of_limits; i++)
+      return false;
+   }
+
+   interval = 1000000LL / config->client_connection_rate;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now = (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+   /* FNV-1a */
+   hash = 14695981039346656037ULL;
+   for (char* c = address; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+   }
+   hash = hash != 0 ? hash : 1;
+
+   /* A bucket that is drained belongs to nobody, so it can be taken over */
+   for (int i = 0; r == NULL && i < CLIENT_RATE_PROBES; i++)
+   {
+      struct client_rate* c = &config->client_rates[(hash + i) % NUMBER_OF_CLIENT_RATES];
+
+      key = atomic_load(&c->key);
+      if (key == hash)
       {
-         bool database_match = false;
+         r = c;
+      }
+      else if ((key == 0 || atomic_load(&c->tat) <= now) &&
+               atomic_compare_exchange_strong(&c->key, &key, hash))
+      {
+         atomic_store(&c->tat, now);
+         r = c;
+      }
+   }
 
-         // Check exact database name match or "all"
-         if (!strcmp("all", config->limits[i].database) || !strcmp(database, config->limits[i].database))
-         {
-            database_match = true;
-         }
-         else
-         {
-            // Check if database matches any alias for this limit entry
-            for (int j = 0; j < config->limits[i].aliases_count; j++)
-            {
-               if (!strcmp(database, config->limits[i].aliases[j]))
-               {
-                  database_match = true;
-                  pgagroal_log_debug("Database '%s' matched alias '%s' for rule %d",
-                                     database, config->limits[i].aliases[j], i);
-                  break;
-               }
-            }
-         }
+   if (r == NULL)
+   {
+      /* The table is full of busy addresses, don't punish the new one */
+      return false;
+   }
 
-         // Check username match
-         bool username_match = (!strcmp("all", config->limits[i].username) || !strcmp(username, config->limits[i].username));
+   tat = atomic_load(&r->tat);
+   do
+   {
+      next = MAX(tat, now) + interval;
 
-         /* There is a match */
-         if (username_match && database_match)
-         {
-            if (best_rule == -1)
-            {
-               best_rule = i;
-            }
-            else
-            {
-               if (!strcmp(username, config->limits[best_rule].username) &&
-                   (!strcmp(database, config->limits[best_rule].database) ||
-                    is_alias_of_limit(database, best_rule)))
-               {
-                  /* We have a precise rule already */
-               }
-               else if (!strcmp("all", config->limits[best_rule].username))
-               {
-                  /* User is better */
-                  if (strcmp("all", config->limits[i].username))
-                  {
-                     best_rule = i;
-                  }
-               }
-               else if (!strcmp("all", config->limits[best_rule].database))
-               {
-                  /* Database is better */
-                  if (strcmp("all", config->limits[i].database))
-                  {
-                     best_rule = i;
-                  }
-               }
-            }
-         }
+      if (next - now > 1000000LL)
+      {
+         return true;
       }
    }
+   while (!atomic_compare_exchange_weak(&r->tat, &tat, next));
 
-   if (best_rule != -1)
+   return false;
+}
+
+void
+pgagroal_cancel_key_register(int slot)
+{
+   unsigned int pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pid = (unsigned int)config->connections[slot].backend_pid;
+
+   if (pid != 0)
    {
-      pgagroal_log_debug("find_best_rule: user=%s, database=%s -> rule %d (real_database=%s)",
-                         username, database, best_rule, config->limits[best_rule].database);
+      atomic_store(&config->cancel_keys[pid % NUMBER_OF_CANCEL_KEYS], slot);
    }
-
-   return best_rule;
 }
 
-static bool
-is_alias_of_limit(char* database, int limit_index)
+int
+pgagroal_pool_hand_over(int client_fd, int slot, bool* handed_over)
 {
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   char* record = NULL;
+   char* p = NULL;
+   char size[4];
+   signed char free_state;
+   struct connection* connection;
+   struct connection_info* info;
+   struct main_configuration* config;
 
-   if (limit_index < 0 || limit_index >= config->number_of_limits)
+   config = (struct main_configuration*)shmem;
+   connection = &config->connections[slot];
+   info = pgagroal_connection_info(slot);
+
+   *handed_over = false;
+
+   free_state = STATE_FREE;
+   if (!atomic_compare_exchange_strong(&config->states[slot], &free_state, STATE_REMOVE))
    {
-      return false;
+      return 0;
    }
 
-   for (int i = 0; i < config->limits[limit_index].aliases_count; i++)
+   /* Only a connection that can be replayed to a client is worth taking over */
+   if (connection->fd == -1 || connection->server < 0 || connection->has_security == SECURITY_INVALID ||
+       !pgagroal_security_messages_cached(slot) || !pgagroal_socket_isvalid(connection->fd))
    {
-      if (!strcmp(database, config->limits[limit_index].aliases[i]))
-      {
-         return true;
-      }
+      atomic_store(&config->states[slot], STATE_FREE);
+      free_slot_retire(slot);
+      return 0;
    }
 
-   return false;
-}
+   record = calloc(1, HAND_OVER_RECORD_SIZE);
+   if (record == NULL)
+   {
+      atomic_store(&config->states[slot], STATE_FREE);
+      free_slot_retire(slot);
+      return 0;
+   }
 
-static bool
-increase_connections(int best_rule)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
-   int connections;
+   p = record;
+   pgagroal_write_int32(p, config->servers[connection->server].port);
+   p += 4;
+   pgagroal_write_byte(p, connection->replica);
+   p += 1;
+   pgagroal_write_byte(p, connection->tx_mode);
+   p += 1;
+   pgagroal_write_byte(p, connection->has_security);
+   p += 1;
+   pgagroal_write_int32(p, connection->backend_pid);
+   p += 4;
+   pgagroal_write_int32(p, connection->backend_secret);
+   p += 4;
+   pgagroal_write_long(p, (long)connection->start_time);
+   p += 8;
+   pgagroal_write_long(p, (long)connection->timestamp);
+   p += 8;
+   memcpy(p, config->servers[connection->server].host, MISC_LENGTH - 1);
+   p += MISC_LENGTH;
+   memcpy(p, info->username, MAX_USERNAME_LENGTH - 1);
+   p += MAX_USERNAME_LENGTH;
+   memcpy(p, info->database, MAX_DATABASE_LENGTH - 1);
+   p += MAX_DATABASE_LENGTH;
 
-   connections = atomic_fetch_add(&config->active_connections, 1);
-   if (connections >= config->max_connections)
+   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
    {
-      /* Cap race: another thread acquired between the atomic_load fast-path
-       * bail in pgagroal_get_connection() and this fetch_add. Roll the
-       * global counter back so it does not drift upward as a metric. The
-       * post-decrement value is not claimed to be below max_connections
-       * (another thread may increment in between); the actual cap is
-       * enforced by the slot array (config->states[] has exactly
-       * max_connections entries), so a missed rollback at worst leaves
-       * the metric off by N rather than producing more backends than the
-       * cap.
-       */
-      pgagroal_log_debug("increase_connections: cap race (active=%d, max=%d); rolling back counter",
-                         connections + 1, config->max_connections);
-      atomic_fetch_sub(&config->active_connections, 1);
-      return false;
+      ssize_t length = MIN(MAX(info->security_lengths[i], 0), SECURITY_BUFFER_SIZE);
+
+      pgagroal_write_int32(p, (int32_t)length);
+      p += 4;
+      memcpy(p, pgagroal_security_get_message(slot, i), length);
+      p += SECURITY_BUFFER_SIZE;
    }
 
-   if (best_rule >= 0)
+   for (int i = 0; i < NUMBER_OF_PREPARED_STATEMENTS; i++)
    {
-      atomic_fetch_add(&config->limits[best_rule].active_connections, 1);
+      pgagroal_write_long(p, (long)info->prepared_statements[i]);
+      p += 8;
    }
 
-   return true;
-}
-
-static int
-get_connection_count_for_limit_rule(int rule_index, char* username)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
-   int count = 0;
-
-   if (rule_index < 0 || rule_index >= config->number_of_limits)
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
    {
-      return 0;
+      pgagroal_write_long(p, (long)info->session_parameters[i]);
+      p += 8;
    }
 
-   for (int i = 0; i < config->max_connections; i++)
+   pgagroal_write_int32(&size, HAND_OVER_RECORD_SIZE);
+
+   if (pgagroal_connection_buffer_write(client_fd, &size, sizeof(size)) ||
+       pgagroal_connection_buffer_write(client_fd, record, HAND_OVER_RECORD_SIZE) ||
+       pgagroal_connection_fd_write(client_fd, slot, connection->fd))
    {
-      if (atomic_load(&config->states[i]) != STATE_NOTINIT &&
-          !strcmp((const char*)(&config->connections[i].username), username))
-      {
-         // Check if this connection is for the main database name
-         if (!strcmp((const char*)(&config->connections[i].database), config->limits[rule_index].database))
-         {
-            count++;
-         }
-         else
-         {
-            // Check if this connection is for any alias of this database
-            for (int j = 0; j < config->limits[rule_index].aliases_count; j++)
-            {
-               if (!strcmp((const char*)(&config->connections[i].database), config->limits[rule_index].aliases[j]))
-               {
-                  count++;
-                  break;
-               }
-            }
-         }
-      }
+      pgagroal_log_error("pgagroal_pool_hand_over: Slot %d FD %d", slot, connection->fd);
+      atomic_store(&config->states[slot], STATE_FREE);
+      free_slot_retire(slot);
+      goto error;
    }
 
-   pgagroal_log_debug("Connection count for rule %d (user=%s): %d connections",
-                      rule_index, username, count);
+   pgagroal_log_debug("pgagroal_pool_hand_over: Slot %d FD %d", slot, connection->fd);
 
-   return count;
+   /* The process taking over owns the backend now, so it isn't terminated */
+   detach_connection(slot);
+
+   *handed_over = true;
+
+   free(record);
+
+   return 0;
+
+error:
+
+   free(record);
+
+   return 1;
 }
 
-static bool
-remove_connection(char* username, char* database)
+int
+pgagroal_pool_take_over(int client_fd, bool* done, int* slot)
 {
-   signed char free;
-   signed char remove;
+   char* record = NULL;
+   char* p = NULL;
+   char size[4];
+   int32_t length;
+   int32_t old_slot = -1;
+   int fd = -1;
+   int port;
+   int server = -1;
+   int best_rule;
+   signed char not_init;
+   bool replica;
+   bool tx_mode;
+   signed char has_security;
+   char host[MISC_LENGTH];
+   char username[MAX_USERNAME_LENGTH];
+   char database[MAX_DATABASE_LENGTH];
+   struct connection* connection;
+   struct connection_info* info;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   pgagroal_log_trace("remove_connection");
-   for (int i = config->max_connections - 1; i >= 0; i--)
+   *done = false;
+   *slot = -1;
+
+   if (pgagroal_connection_buffer_read(client_fd, &size, sizeof(size)))
    {
-      free = STATE_FREE;
-      remove = STATE_REMOVE;
+      goto error;
+   }
 
-      if (atomic_compare_exchange_strong(&config->states[i], &free, remove))
-      {
-         if (!strcmp(username, config->connections[i].username) && !strcmp(database, config->connections[i].database))
-         {
-            if (!atomic_compare_exchange_strong(&config->states[i], &remove, STATE_FREE))
-            {
-               pgagroal_prometheus_connection_remove();
-               pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, i);
-               pgagroal_kill_connection(i, NULL);
-            }
-         }
-         else
-         {
-            pgagroal_prometheus_connection_remove();
-            pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, i);
-            pgagroal_kill_connection(i, NULL);
-         }
+   length = pgagroal_read_int32(&size);
+   if (length == 0)
+   {
+      *done = true;
+      return 0;
+   }
 
-         return true;
-      }
+   if (length < 0 || length > 4 * HAND_OVER_RECORD_SIZE)
+   {
+      goto error;
    }
 
-   return false;
-}
+   record = malloc(length);
+   if (record == NULL)
+   {
+      goto error;
+   }
 
-static void
-check_graceful_shutdown_trigger(void)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   if (pgagroal_connection_buffer_read(client_fd, record, length))
+   {
+      goto error;
+   }
 
-   int remaining_connections = atomic_load(&config->active_connections);
+   if (pgagroal_connection_transfer_read(client_fd, &old_slot, &fd))
+   {
+      goto error;
+   }
 
-   if (remaining_connections == 0 && config->gracefully)
+   /* A version with another layout of the slots can't be trusted with the backend state */
+   if (length != HAND_OVER_RECORD_SIZE)
    {
-      if (config->keep_running)
+      pgagroal_log_warn("pgagroal_pool_take_over: Slot %d has an unknown layout (%d)", old_slot, length);
+      goto reject;
+   }
+
+   p = record;
+   port = pgagroal_read_int32(p);
+   p += 4;
+   replica = pgagroal_read_byte(p);
+   p += 1;
+   tx_mode = pgagroal_read_byte(p);
+   p += 1;
+   has_security = pgagroal_read_byte(p);
+   p += 1;
+
+   memset(&host, 0, sizeof(host));
+   memcpy(&host, p + 4 + 4 + 8 + 8, MISC_LENGTH - 1);
+   memset(&username, 0, sizeof(username));
+   memcpy(&username, p + 4 + 4 + 8 + 8 + MISC_LENGTH, MAX_USERNAME_LENGTH - 1);
+   memset(&database, 0, sizeof(database));
+   memcpy(&database, p + 4 + 4 + 8 + 8 + MISC_LENGTH + MAX_USERNAME_LENGTH, MAX_DATABASE_LENGTH - 1);
+
+   for (int i = 0; server == -1 && i < config->number_of_servers; i++)
+   {
+      if (!strcmp(config->servers[i].host, host) && config->servers[i].port == port)
       {
-         pgagroal_log_debug("pgagroal: graceful shutdown conditions met - connections=0, gracefully=true, keep_running=true - proceeding with shutdown");
+         server = i;
       }
-      else
+   }
+
+   if (server == -1)
+   {
+      pgagroal_log_debug("pgagroal_pool_take_over: Slot %d has an unknown server %s:%d", old_slot, host, port);
+      goto reject;
+   }
+
+   best_rule = find_best_rule(username, database);
+
+   if (best_rule >= 0)
+   {
+      unsigned short reserved = atomic_fetch_add(&config->limits[best_rule].backend_connections, 1);
+      if (reserved >= pgagroal_pool_limit_size(best_rule))
       {
-         pgagroal_log_debug("pgagroal: graceful shutdown skipped - connections=0, gracefully=true, but keep_running=false (race condition prevented)");
-         return;
+         atomic_fetch_sub(&config->limits[best_rule].backend_connections, 1);
+         pgagroal_log_debug("pgagroal_pool_take_over: Slot %d is over the limit of %s", old_slot, database);
+         goto reject;
       }
    }
 
-   if (remaining_connections == 0 && config->gracefully && config->keep_running)
+   for (int i = 0; *slot == -1 && i < config->max_connections; i++)
    {
-      // Double-check to handle race conditions with new connections
-      usleep(1000); // 1ms delay to let any concurrent operations complete
+      not_init = STATE_NOTINIT;
 
-      // Verify all three conditions are still met after brief delay
-      int final_connections = atomic_load(&config->active_connections);
-      if (final_connections == 0 && config->gracefully && config->keep_running)
+      if (atomic_compare_exchange_strong(&config->states[i], &not_init, STATE_INIT))
       {
-         pgagroal_log_debug("pgagroal: graceful shutdown confirmed - triggering shutdown");
-
-         pid_t parent_pid = getppid();
-         if (kill(parent_pid, SIGTRAP) == -1)
-         {
-            if (errno == ESRCH)
-            {
-               pgagroal_log_debug("Parent process already exited, worker shutting down");
-            }
-            else
-            {
-               pgagroal_log_debug("Failed to signal parent process (PID: %d): %s", parent_pid, strerror(errno));
-            }
-         }
-         else
-         {
-            pgagroal_log_debug("Graceful shutdown signal sent to parent process (PID: %d)", parent_pid);
-         }
+         *slot = i;
       }
-      else
+   }
+
+   if (*slot == -1)
+   {
+      if (best_rule >= 0)
       {
-         int final_connections_check = atomic_load(&config->active_connections);
-         pgagroal_log_debug("Graceful shutdown conditions - connections=%d, gracefully=%s, keep_running=%s",
-                            final_connections_check,
-                            config->gracefully ? "true" : "false",
-                            config->keep_running ? "true" : "false");
+         atomic_fetch_sub(&config->limits[best_rule].backend_connections, 1);
       }
+      pgagroal_log_debug("pgagroal_pool_take_over: No slot for slot %d", old_slot);
+      goto reject;
    }
-}
 
-static void
-connection_details(int slot)
-{
-   int state;
-   char time_buf[32];
-   char start_buf[32];
-   struct main_configuration* config;
-   struct connection connection;
+   connection = &config->connections[*slot];
+   info = pgagroal_connection_info(*slot);
+
+   connection->new = false;
+   connection->server = server;
+   connection->replica = replica;
+   connection->tx_mode = tx_mode;
+   connection->reset = RESET_DISCARD;
+   connection->has_security = has_security;
+   connection->limit_rule = best_rule;
+   connection->key = pgagroal_pool_key(best_rule, username, database);
+   connection->backend_pid = pgagroal_read_int32(p);
+   p += 4;
+   connection->backend_secret = pgagroal_read_int32(p);
+   p += 4;
+   connection->start_time = (time_t)pgagroal_read_long(p);
+   p += 8;
+   connection->timestamp = (time_t)pgagroal_read_long(p);
+   p += 8 + MISC_LENGTH + MAX_USERNAME_LENGTH + MAX_DATABASE_LENGTH;
+   connection->pid = -1;
+   connection->fd = fd;
+
+   memcpy(&info->username, &username, sizeof(username));
+   memcpy(&info->database, &database, sizeof(database));
+   memset(&info->appname, 0, sizeof(info->appname));
+
+   atomic_fetch_add(&config->servers[server].backends, 1);
 
-   config = (struct main_configuration*)shmem;
+   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+   {
+      int32_t l = pgagroal_read_int32(p);
 
-   connection = config->connections[slot];
-   state = atomic_load(&config->states[slot]);
+      p += 4;
 
-   memset(&time_buf, 0, sizeof(time_buf));
-   ctime_r(&(connection.timestamp), &time_buf[0]);
-   time_buf[strlen(time_buf) - 1] = 0;
+      if (l > 0 && l <= SECURITY_BUFFER_SIZE)
+      {
+         pgagroal_security_store_message(*slot, i, p, l);
+      }
+      p += SECURITY_BUFFER_SIZE;
+   }
 
-   memset(&start_buf, 0, sizeof(start_buf));
-   ctime_r(&(connection.start_time), &start_buf[0]);
-   start_buf[strlen(start_buf) - 1] = 0;
+   for (int i = 0; i < NUMBER_OF_PREPARED_STATEMENTS; i++)
+   {
+      info->prepared_statements[i] = (uint64_t)pgagroal_read_long(p);
+      p += 8;
+   }
 
-   switch (state)
+   for (int i = 0; i < NUMBER_OF_SESSION_PARAMETERS; i++)
    {
-      case STATE_NOTINIT:
-         pgagroal_log_debug("pgagroal_pool_status: State: NOTINIT");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         break;
-      case STATE_INIT:
-         pgagroal_log_debug("pgagroal_pool_status: State: INIT");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         break;
-      case STATE_FREE:
-         pgagroal_log_debug("pgagroal_pool_status: State: FREE");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-         {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
-         }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
-#endif
-         break;
-      case STATE_IN_USE:
-         pgagroal_log_debug("pgagroal_pool_status: State: IN_USE");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-         {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
-         }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
-#endif
-         break;
-      case STATE_GRACEFULLY:
-         pgagroal_log_debug("pgagroal_pool_status: State: GRACEFULLY");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-         {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
-         }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
-#endif
-         break;
-      case STATE_FLUSH:
-         pgagroal_log_debug("pgagroal_pool_status: State: FLUSH");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+      info->session_parameters[i] = (uint64_t)pgagroal_read_long(p);
+      p += 8;
+   }
+
+   /* A replay that only lives in our own memory can't be used by the workers */
+   if (!pgagroal_security_messages_cached(*slot))
+   {
+      pgagroal_log_debug("pgagroal_pool_take_over: Security message store full (slot %d)", *slot);
+      detach_connection(*slot);
+      *slot = -1;
+      goto reject;
+   }
+
+   pgagroal_cancel_key_register(*slot);
+
+   atomic_store(&config->states[*slot], STATE_FREE);
+   free_slot_add(*slot);
+
+   pgagroal_log_debug("pgagroal_pool_take_over: Slot %d FD %d (was slot %d)", *slot, fd, old_slot);
+
+   free(record);
+
+   return 0;
+
+reject:
+
+   pgagroal_write_terminate(NULL, fd);
+   pgagroal_disconnect(fd);
+
+   free(record);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   free(record);
+
+   return 1;
+}
+
+int
+pgagroal_cancel_request(int pid, int secret)
+{
+   int ret;
+   int slot = -1;
+   int index;
+   int server = -1;
+   int fd = -1;
+   struct message* msg = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pid == 0)
+   {
+      goto error;
+   }
+
+   /* The index is only a hint, as a slot is reused without clearing its entry */
+   index = atomic_load(&config->cancel_keys[(unsigned int)pid % NUMBER_OF_CANCEL_KEYS]);
+   if (index >= 0 && index < config->max_connections &&
+       config->connections[index].backend_pid == pid && config->connections[index].backend_secret == secret)
+   {
+      slot = index;
+   }
+
+   for (int i = 0; slot == -1 && i < config->max_connections; i++)
+   {
+      if (config->connections[i].backend_pid == pid && config->connections[i].backend_secret == secret)
+      {
+         slot = i;
+      }
+   }
+
+   if (slot == -1)
+   {
+      pgagroal_log_debug("pgagroal_cancel_request: No backend with PID %d", pid);
+      goto error;
+   }
+
+   server = config->connections[slot].server;
+   if (server < 0 || server >= config->number_of_servers)
+   {
+      goto error;
+   }
+
+   if (config->servers[server].host[0] == '/')
+   {
+      char pgsql[MISC_LENGTH];
+
+      memset(&pgsql, 0, sizeof(pgsql));
+      pgagroal_snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->servers[server].port);
+      ret = pgagroal_connect_unix_socket(config->servers[server].host, &pgsql[0], &fd);
+   }
+   else
+   {
+      ret = pgagroal_connect_server(server, &fd, config->keep_alive, config->nodelay);
+   }
+
+   if (ret)
+   {
+      pgagroal_log_error("pgagroal: No connection to %s:%d", config->servers[server].host, config->servers[server].port);
+      goto error;
+   }
+
+   if (pgagroal_create_cancel_request_message(pid, secret, &msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   pgagroal_log_debug("Cancel request using slot %d (pid %d)", slot, pid);
+
+   if (pgagroal_write_message(NULL, fd, msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   pgagroal_free_message(msg);
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   pgagroal_free_message(msg);
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+static int
+find_best_rule(char* username, char* database)
+{
+   int best_rule;
+   struct main_configuration* config;
+
+   best_rule = -1;
+   config = (struct main_configuration*)shmem;
+
+   if (config->number_of_limits > 0)
+   {
+      for (int i = 0; i < config->number_of_limits; i++)
+      {
+         bool database_match = false;
+
+         // Check exact database name match or "all"
+         if (!strcmp("all", config->limits[i].database) || !strcmp(database, config->limits[i].database))
          {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
+            database_match = true;
          }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
-#endif
-         break;
-      case STATE_IDLE_CHECK:
-         pgagroal_log_debug("pgagroal_pool_status: State: IDLE CHECK");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         else
          {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
+            // Check if database matches any alias for this limit entry
+            for (int j = 0; j < config->limits[i].aliases_count; j++)
+            {
+               if (!strcmp(database, config->limits[i].aliases[j]))
+               {
+                  database_match = true;
+                  pgagroal_log_debug("Database '%s' matched alias '%s' for rule %d",
+                                     database, config->limits[i].aliases[j], i);
+                  break;
+               }
+            }
          }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
-#endif
-         break;
-      case STATE_MAX_CONNECTION_AGE:
-         pgagroal_log_debug("pgagroal_pool_status: State: MAX CONNECTION AGE");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+
+         // Check username match
+         bool username_match = (!strcmp("all", config->limits[i].username) || !strcmp(username, config->limits[i].username));
+
+         /* There is a match */
+         if (username_match && database_match)
          {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
+            if (best_rule == -1)
+            {
+               best_rule = i;
+            }
+            else
+            {
+               if (!strcmp(username, config->limits[best_rule].username) &&
+                   (!strcmp(database, config->limits[best_rule].database) ||
+                    is_alias_of_limit(database, best_rule)))
+               {
+                  /* We have a precise rule already */
+               }
+               else if (!strcmp("all", config->limits[best_rule].username))
+               {
+                  /* User is better */
+                  if (strcmp("all", config->limits[i].username))
+                  {
+                     best_rule = i;
+                  }
+               }
+               else if (!strcmp("all", config->limits[best_rule].database))
+               {
+                  /* Database is better */
+                  if (strcmp("all", config->limits[i].database))
+                  {
+                     best_rule = i;
+                  }
+               }
+            }
          }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+      }
+   }
+
+   if (best_rule != -1)
+   {
+      pgagroal_log_debug("find_best_rule: user=%s, database=%s -> rule %d (real_database=%s)",
+                         username, database, best_rule, config->limits[best_rule].database);
+   }
+
+   return best_rule;
+}
+
+static int
+session_rule(char* username, char* database, char** real_database)
+{
+   int best_rule;
+   unsigned int generation;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* A worker keeps asking for the same pair, so the rule is resolved
+    * once and again only when the limit entries have been reloaded */
+   generation = atomic_load(&config->limits_generation);
+
+   if (rule_value != -2 && rule_generation == generation &&
+       !strcmp(rule_username, username) && !strcmp(rule_database, database))
+   {
+      *real_database = rule_alias ? config->limits[rule_value].database : database;
+      return rule_value;
+   }
+
+   best_rule = find_best_rule(username, database);
+   *real_database = resolve_database_name(database, best_rule);
+
+   if (strlen(username) < MAX_USERNAME_LENGTH && strlen(database) < MAX_DATABASE_LENGTH)
+   {
+      rule_value = best_rule;
+      rule_alias = *real_database != database;
+      rule_generation = generation;
+      memset(&rule_username, 0, sizeof(rule_username));
+      memcpy(&rule_username, username, strlen(username));
+      memset(&rule_database, 0, sizeof(rule_database));
+      memcpy(&rule_database, database, strlen(database));
+   }
+   else
+   {
+      rule_value = -2;
+   }
+
+   return best_rule;
+}
+
+static bool
+is_alias_of_limit(char* database, int limit_index)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+
+   if (limit_index < 0 || limit_index >= config->number_of_limits)
+   {
+      return false;
+   }
+
+   for (int i = 0; i < config->limits[limit_index].aliases_count; i++)
+   {
+      if (!strcmp(database, config->limits[limit_index].aliases[i]))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static bool
+increase_connections(int best_rule)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+   int connections;
+
+   connections = atomic_fetch_add(&config->active_connections, 1);
+   if (connections >= config->max_connections)
+   {
+      /* Cap race: another thread acquired between the atomic_load fast-path
+       * bail in pgagroal_get_connection() and this fetch_add. Roll the
+       * global counter back so it does not drift upward as a metric. The
+       * post-decrement value is not claimed to be below max_connections
+       * (another thread may increment in between); the actual cap is
+       * enforced by the slot array (config->states[] has exactly
+       * max_connections entries), so a missed rollback at worst leaves
+       * the metric off by N rather than producing more backends than the
+       * cap.
+       */
+      pgagroal_log_debug("increase_connections: cap race (active=%d, max=%d); rolling back counter",
+                         connections + 1, config->max_connections);
+      atomic_fetch_sub(&config->active_connections, 1);
+      return false;
+   }
+
+   if (best_rule >= 0)
+   {
+      unsigned short active = atomic_fetch_add(&config->limits[best_rule].active_connections, 1) + 1;
+
+      if (pgagroal_time_is_valid(config->adaptive_pool_interval))
+      {
+         struct limit_demand* demand = &config->limit_demands[best_rule];
+         unsigned short peak = atomic_load(&demand->peak);
+
+         atomic_fetch_add(&demand->acquires, 1);
+         while (active > peak && !atomic_compare_exchange_weak(&demand->peak, &peak, active))
+         {
+            /* peak now holds the current value */
+         }
+      }
+   }
+
+   return true;
+}
+
+static int
+get_connection_count_for_limit_rule(int rule_index, char* username)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+   int count = 0;
+
+   if (rule_index < 0 || rule_index >= config->number_of_limits)
+   {
+      return 0;
+   }
+
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      if (atomic_load(&config->states[i]) != STATE_NOTINIT &&
+          !strcmp((const char*)(&pgagroal_connection_info(i)->username), username))
+      {
+         // Check if this connection is for the main database name
+         if (!strcmp((const char*)(&pgagroal_connection_info(i)->database), config->limits[rule_index].database))
+         {
+            count++;
+         }
+         else
+         {
+            // Check if this connection is for any alias of this database
+            for (int j = 0; j < config->limits[rule_index].aliases_count; j++)
+            {
+               if (!strcmp((const char*)(&pgagroal_connection_info(i)->database), config->limits[rule_index].aliases[j]))
+               {
+                  count++;
+                  break;
+               }
+            }
+         }
+      }
+   }
+
+   pgagroal_log_debug("Connection count for rule %d (user=%s): %d connections",
+                      rule_index, username, count);
+
+   return count;
+}
+
+static bool
+remove_connection(char* username, char* database)
+{
+   signed char free;
+   signed char remove;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_log_trace("remove_connection");
+   for (int i = config->max_connections - 1; i >= 0; i--)
+   {
+      free = STATE_FREE;
+      remove = STATE_REMOVE;
+
+      if (atomic_compare_exchange_strong(&config->states[i], &free, remove))
+      {
+         if (!strcmp(username, pgagroal_connection_info(i)->username) && !strcmp(database, pgagroal_connection_info(i)->database))
+         {
+            if (!atomic_compare_exchange_strong(&config->states[i], &remove, STATE_FREE))
+            {
+               pgagroal_prometheus_connection_remove();
+               pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, i);
+               pgagroal_kill_connection(i, NULL);
+            }
+            else
+            {
+               free_slot_add(i);
+            }
+         }
+         else
+         {
+            pgagroal_prometheus_connection_remove();
+            pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, i);
+            pgagroal_kill_connection(i, NULL);
+         }
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+check_graceful_shutdown_trigger(void)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+
+   int remaining_connections = atomic_load(&config->active_connections);
+
+   if (remaining_connections == 0 && config->gracefully)
+   {
+      if (config->keep_running)
+      {
+         pgagroal_log_debug("pgagroal: graceful shutdown conditions met - connections=0, gracefully=true, keep_running=true - proceeding with shutdown");
+      }
+      else
+      {
+         pgagroal_log_debug("pgagroal: graceful shutdown skipped - connections=0, gracefully=true, but keep_running=false (race condition prevented)");
+         return;
+      }
+   }
+
+   if (remaining_connections == 0 && config->gracefully && config->keep_running)
+   {
+      // Double-check to handle race conditions with new connections
+      usleep(1000); // 1ms delay to let any concurrent operations complete
+
+      // Verify all three conditions are still met after brief delay
+      int final_connections = atomic_load(&config->active_connections);
+      if (final_connections == 0 && config->gracefully && config->keep_running)
+      {
+         pgagroal_log_debug("pgagroal: graceful shutdown confirmed - triggering shutdown");
+
+         pid_t parent_pid = getppid();
+         if (kill(parent_pid, SIGTRAP) == -1)
+         {
+            if (errno == ESRCH)
+            {
+               pgagroal_log_debug("Parent process already exited, worker shutting down");
+            }
+            else
+            {
+               pgagroal_log_debug("Failed to signal parent process (PID: %d): %s", parent_pid, strerror(errno));
+            }
+         }
+         else
+         {
+            pgagroal_log_debug("Graceful shutdown signal sent to parent process (PID: %d)", parent_pid);
+         }
+      }
+      else
+      {
+         int final_connections_check = atomic_load(&config->active_connections);
+         pgagroal_log_debug("Graceful shutdown conditions - connections=%d, gracefully=%s, keep_running=%s",
+                            final_connections_check,
+                            config->gracefully ? "true" : "false",
+                            config->keep_running ? "true" : "false");
+      }
+   }
+}
+
+static void
+connection_details(int slot)
+{
+   int state;
+   char time_buf[32];
+   char start_buf[32];
+   struct main_configuration* config;
+   struct connection connection;
+   struct connection_info* info;
+
+   config = (struct main_configuration*)shmem;
+
+   connection = config->connections[slot];
+   info = pgagroal_connection_info(slot);
+   state = atomic_load(&config->states[slot]);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&(connection.timestamp), &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   memset(&start_buf, 0, sizeof(start_buf));
+   ctime_r(&(connection.start_time), &start_buf[0]);
+   start_buf[strlen(start_buf) - 1] = 0;
+
+   switch (state)
+   {
+      case STATE_NOTINIT:
+         pgagroal_log_debug("pgagroal_pool_status: State: NOTINIT");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         break;
+      case STATE_INIT:
+         pgagroal_log_debug("pgagroal_pool_status: State: INIT");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         break;
+      case STATE_FREE:
+         pgagroal_log_debug("pgagroal_pool_status: State: FREE");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_IN_USE:
+         pgagroal_log_debug("pgagroal_pool_status: State: IN_USE");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_GRACEFULLY:
+         pgagroal_log_debug("pgagroal_pool_status: State: GRACEFULLY");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_FLUSH:
+         pgagroal_log_debug("pgagroal_pool_status: State: FLUSH");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_IDLE_CHECK:
+         pgagroal_log_debug("pgagroal_pool_status: State: IDLE CHECK");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_MAX_CONNECTION_AGE:
+         pgagroal_log_debug("pgagroal_pool_status: State: MAX CONNECTION AGE");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
 #ifdef DEBUG
          pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
 #endif
@@ -1863,9 +3204,32 @@ connection_details(int slot)
          pgagroal_log_debug("pgagroal_pool_status: State: VALIDATION");
          pgagroal_log_debug("                      Slot: %d", slot);
          pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
+         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
+         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
+         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
+         pgagroal_log_debug("                      FD: %d", connection.fd);
+         pgagroal_log_trace("                      PID: %d", connection.pid);
+         pgagroal_log_trace("                      Auth: %d", connection.has_security);
+         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+         {
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      case STATE_REMOVE:
+         pgagroal_log_debug("pgagroal_pool_status: State: REMOVE");
+         pgagroal_log_debug("                      Slot: %d", slot);
+         pgagroal_log_debug("                      Server: %d", connection.server);
+         pgagroal_log_debug("                      User: %s", info->username);
+         pgagroal_log_debug("                      Database: %s", info->database);
+         pgagroal_log_debug("                      AppName: %s", info->appname);
          pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
          pgagroal_log_debug("                      Start: %s", &start_buf[0]);
          pgagroal_log_debug("                      Time: %s", &time_buf[0]);
@@ -1874,135 +3238,1364 @@ connection_details(int slot)
          pgagroal_log_trace("                      Auth: %d", connection.has_security);
          for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
          {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
+            pgagroal_log_trace("                      Size: %zd", info->security_lengths[i]);
+            pgagroal_log_mem(pgagroal_security_get_message(slot, i), info->security_lengths[i]);
+         }
+         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
+#ifdef DEBUG
+         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+#endif
+         break;
+      default:
+         pgagroal_log_debug("pgagroal_pool_status: State %d Slot %d FD %d", state, slot, connection.fd);
+         break;
+   }
+}
+
+static void
+prefill_limit(int limit, int user, int size)
+{
+   int missing;
+   int running;
+   int started;
+   int created;
+   bool failed;
+   pid_t pid;
+   int status;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   failed = false;
+
+   while (!failed && (missing = do_prefill(config->users[user].username, config->limits[limit].database, size)) > 0)
+   {
+      running = 0;
+      started = 0;
+      created = 0;
+
+      pgagroal_log_info("Prefill: Creating %d connections for limit entry (%d) with %d at a time",
+                        missing, limit + 1, config->prefill_concurrency);
+
+      pgagroal_prometheus_prefill_start(missing);
+
+      /* Each connection is created by its own process, and at most
+       * prefill_concurrency of them are connecting to the primary at once */
+      while ((!failed && started < missing) || running > 0)
+      {
+         if (!failed && started < missing && running < config->prefill_concurrency)
+         {
+            pid = fork();
+            if (pid == -1)
+            {
+               pgagroal_log_error("Prefill: Unable to fork for limit entry (%d)", limit + 1);
+               failed = true;
+            }
+            else if (pid == 0)
+            {
+               status = prefill_connection(limit, user);
+
+               pgagroal_memory_destroy();
+               pgagroal_stop_logging();
+
+               exit(status);
+            }
+            else
+            {
+               running++;
+               started++;
+            }
+         }
+         else
+         {
+            pid = waitpid(-1, &status, 0);
+            if (pid == -1)
+            {
+               if (errno == EINTR)
+               {
+                  continue;
+               }
+
+               failed = true;
+               break;
+            }
+
+            running--;
+
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            {
+               created++;
+               pgagroal_prometheus_prefill_connection(true);
+               pgagroal_log_debug("Prefill: Limit entry (%d) %d/%d", limit + 1, created, missing);
+            }
+            else
+            {
+               pgagroal_prometheus_prefill_connection(false);
+               failed = true;
+            }
+         }
+      }
+
+      pgagroal_prometheus_prefill_end(missing - started + running);
+
+      pgagroal_log_info("Prefill: Created %d of %d connections for limit entry (%d)", created, missing, limit + 1);
+   }
+}
+
+static int
+prefill_connection(int limit, int user)
+{
+   int32_t slot = -1;
+   SSL* ssl = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgagroal_prefill_auth(config->users[user].username, config->users[user].password,
+                             config->limits[limit].database, &slot, &ssl) != AUTH_SUCCESS)
+   {
+      pgagroal_log_warn("Invalid data for user '%s' using limit entry (%d)", config->limits[limit].username, limit + 1);
+
+      if (slot != -1)
+      {
+         if (config->connections[slot].fd != -1)
+         {
+            if (pgagroal_socket_isvalid(config->connections[slot].fd))
+            {
+               pgagroal_write_terminate(NULL, config->connections[slot].fd);
+            }
+         }
+         pgagroal_tracking_event_slot(TRACKER_PREFILL_KILL, slot);
+         pgagroal_kill_connection(slot, ssl);
+      }
+
+      return 1;
+   }
+
+   if (slot != -1)
+   {
+      if (config->connections[slot].has_security != SECURITY_INVALID)
+      {
+         pgagroal_tracking_event_slot(TRACKER_PREFILL_RETURN, slot);
+         pgagroal_return_connection(slot, ssl, false);
+      }
+      else
+      {
+         pgagroal_log_warn("Unsupported security model during prefill for user '%s' using limit entry (%d)", config->limits[limit].username, limit + 1);
+         if (config->connections[slot].fd != -1)
+         {
+            if (pgagroal_socket_isvalid(config->connections[slot].fd))
+            {
+               pgagroal_write_terminate(NULL, config->connections[slot].fd);
+            }
+         }
+         pgagroal_tracking_event_slot(TRACKER_PREFILL_KILL, slot);
+         pgagroal_kill_connection(slot, ssl);
+
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static int
+do_prefill(char* username, char* database, int size)
+{
+   signed char state;
+   int free = 0;
+   int connections = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   //Find the limit rule for this database/username combination
+   int rule_index = find_best_rule(username, database);
+   if (rule_index != -1)
+   {
+      // Count connections for this rule (including aliases)
+      connections = get_connection_count_for_limit_rule(rule_index, username);
+   }
+   else
+   {
+      // Fallback to old logic if no rule found
+      for (int i = 0; i < config->max_connections; i++)
+      {
+         if (!strcmp((const char*)(&pgagroal_connection_info(i)->username), username) &&
+             !strcmp((const char*)(&pgagroal_connection_info(i)->database), database))
+         {
+            connections++;
+         }
+      }
+   }
+
+   // Count free connections
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      state = atomic_load(&config->states[i]);
+      if (state == STATE_NOTINIT)
+      {
+         free++;
+      }
+   }
+
+   pgagroal_log_debug("do_prefill: user=%s, database=%s, current=%d, target=%d, free=%d",
+                      username, database, connections, size, free);
+
+   return MAX(MIN(size - connections, free), 0);
+}
+
+void
+pgagroal_prefill_if_can(bool do_fork, bool initial)
+{
+   int primary;
+
+   if (pgagroal_can_prefill())
+   {
+      if (pgagroal_get_primary(&primary))
+      {
+         pgagroal_log_warn("No primary detected, cannot try to prefill!");
+         return;
+      }
+
+      if (do_fork)
+      {
+         if (!fork())
+         {
+            pgagroal_prefill(initial);
+         }
+      }
+      else
+      {
+         pgagroal_prefill(initial);
+      }
+   }
+}
+
+void
+pgagroal_timer_wheel_add(struct timer_wheel* wheel, int timeout, time_t due, int slot)
+{
+   long long granularity;
+
+   /* The wheel spans at least twice the timeout */
+   granularity = MAX(1, (timeout + (TIMER_WHEEL_SIZE / 2) - 1) / (TIMER_WHEEL_SIZE / 2));
+
+   /* A slot that is already due goes into the next bucket to be processed */
+   due = MAX(due, (time_t)((atomic_load(&wheel->tick) + 1) * granularity));
+
+   atomic_fetch_or(&wheel->buckets[(due / granularity) % TIMER_WHEEL_SIZE][slot / 64], 1ULL << (slot % 64));
+}
+
+void
+pgagroal_timer_wheel_remove(struct timer_wheel* wheel, int timeout, time_t due, int slot)
+{
+   long long granularity;
+
+   granularity = MAX(1, (timeout + (TIMER_WHEEL_SIZE / 2) - 1) / (TIMER_WHEEL_SIZE / 2));
+
+   due = MAX(due, (time_t)((atomic_load(&wheel->tick) + 1) * granularity));
+
+   atomic_fetch_and(&wheel->buckets[(due / granularity) % TIMER_WHEEL_SIZE][slot / 64], ~(1ULL << (slot % 64)));
+}
+
+void
+pgagroal_timer_wheel_advance(struct timer_wheel* wheel, int timeout, time_t now, unsigned long long* due)
+{
+   long long granularity;
+   long long from;
+   long long to;
+
+   memset(due, 0, NUMBER_OF_FREE_SLOT_WORDS * sizeof(unsigned long long));
+
+   granularity = MAX(1, (timeout + (TIMER_WHEEL_SIZE / 2) - 1) / (TIMER_WHEEL_SIZE / 2));
+
+   /* Only buckets that have fully elapsed are due */
+   to = now / granularity - 1;
+   from = atomic_load(&wheel->tick) + 1;
+
+   if (from <= 1 || to - from + 1 >= TIMER_WHEEL_SIZE)
+   {
+      from = to - TIMER_WHEEL_SIZE + 1;
+   }
+
+   for (long long t = from; t <= to; t++)
+   {
+      for (int w = 0; w < NUMBER_OF_FREE_SLOT_WORDS; w++)
+      {
+         due[w] |= atomic_exchange(&wheel->buckets[t % TIMER_WHEEL_SIZE][w], 0);
+      }
+   }
+
+   if (to >= from)
+   {
+      atomic_store(&wheel->tick, to);
+   }
+}
+
+int
+pgagroal_pool_key(int best_rule, char* username, char* real_database)
+{
+   unsigned int hash;
+   int index;
+   signed char state;
+   struct pool_key* k;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* A worker keeps asking for the same pair, so remember the last key */
+   if (key_rule == best_rule && !strcmp(key_username, username) && !strcmp(key_database, real_database))
+   {
+      return key_value;
+   }
+
+   if (strlen(username) >= MAX_USERNAME_LENGTH || strlen(real_database) >= MAX_DATABASE_LENGTH)
+   {
+      return 0;
+   }
+
+   /* FNV-1a */
+   hash = 2166136261U;
+   hash = (hash ^ (unsigned char)best_rule) * 16777619U;
+   for (char* c = username; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+   hash = (hash ^ 0xFF) * 16777619U;
+   for (char* c = real_database; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+
+   /* Open addressing; keys are never removed, so a full table means
+    * no key and the caller falls back to comparing the names */
+   for (int i = 0; i < NUMBER_OF_POOL_KEYS; i++)
+   {
+      index = (hash + i) % NUMBER_OF_POOL_KEYS;
+      k = &config->pool_keys[index];
+
+      state = STATE_NOTINIT;
+      if (atomic_compare_exchange_strong(&k->state, &state, STATE_INIT))
+      {
+         k->limit_rule = best_rule;
+         memset(&k->username, 0, sizeof(k->username));
+         memcpy(&k->username, username, strlen(username));
+         memset(&k->database, 0, sizeof(k->database));
+         memcpy(&k->database, real_database, strlen(real_database));
+         atomic_store(&k->state, STATE_FREE);
+      }
+      else
+      {
+         while (state == STATE_INIT)
+         {
+            SLEEP(1000L)
+            state = atomic_load(&k->state);
+         }
+      }
+
+      if (k->limit_rule == best_rule && !strcmp(k->username, username) && !strcmp(k->database, real_database))
+      {
+         key_rule = best_rule;
+         key_value = index + 1;
+         memset(&key_username, 0, sizeof(key_username));
+         memcpy(&key_username, username, strlen(username));
+         memset(&key_database, 0, sizeof(key_database));
+         memcpy(&key_database, real_database, strlen(real_database));
+
+         return key_value;
+      }
+   }
+
+   return 0;
+}
+
+static char*
+resolve_database_name(char* database, int best_rule)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
+
+   if (best_rule < 0 || best_rule >= config->number_of_limits)
+   {
+      return database; // Return original if no rule found
+   }
+
+   // Check if this database name is an alias
+   for (int j = 0; j < config->limits[best_rule].aliases_count; j++)
+   {
+      if (!strcmp(database, config->limits[best_rule].aliases[j]))
+      {
+         return config->limits[best_rule].database; // Return real database name
+      }
+   }
+
+   // Not an alias, return original name
+   return database;
+}
+
+static void
+free_slot_add(int slot)
+{
+   int rule;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (free_slot_retire(slot))
+   {
+      return;
+   }
+
+   rule = config->connections[slot].limit_rule;
+   if (rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      rule = -1;
+   }
+
+   /* Published after the state is FREE, so an acquirer that claims the bit
+    * and loses the state CAS can rely on the next owner re-adding it */
+   atomic_fetch_or(&config->free_slots[rule + 1][slot / 64], 1ULL << (slot % 64));
+
+   /* Every free slot is also due in the timer wheels */
+   timer_wheels_insert(slot);
+}
+
+/**
+ * Close a free slot above a max_connections lowered by a reload. A slot held
+ * by a maintenance task during the reload is only returned afterwards, and
+ * no scan visits it any more
+ * @param slot The slot
+ * @return true if the slot is above the limit, otherwise false
+ */
+static bool
+free_slot_retire(int slot)
+{
+   signed char free;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (slot < config->max_connections)
+   {
+      return false;
+   }
+
+   free = STATE_FREE;
+   if (atomic_compare_exchange_strong(&config->states[slot], &free, STATE_REMOVE))
+   {
+      pgagroal_prometheus_connection_remove();
+      pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, slot);
+      pgagroal_kill_connection(slot, NULL);
+   }
+
+   return true;
+}
+
+static void
+free_slot_clear(int slot)
+{
+   int rule;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   rule = config->connections[slot].limit_rule;
+   if (rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      rule = -1;
+   }
+
+   atomic_fetch_and(&config->free_slots[rule + 1][slot / 64], ~(1ULL << (slot % 64)));
+}
+
+static bool
+free_slot_take(int rule, int* cursor, int* slot)
+{
+   int words;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      rule = -1;
+   }
+
+   words = (config->max_connections + 63) / 64;
+
+   for (int w = *cursor / 64; w < words; w++)
+   {
+      unsigned long long mask;
+
+      mask = atomic_load(&config->free_slots[rule + 1][w]);
+      if (w == *cursor / 64)
+      {
+         mask &= ~0ULL << (*cursor % 64);
+      }
+
+      /* The last word may hold slots above a max_connections lowered by a reload */
+      if (w == words - 1 && config->max_connections % 64 != 0)
+      {
+         mask &= (1ULL << (config->max_connections % 64)) - 1;
+      }
+
+      while (mask != 0)
+      {
+         int bit = __builtin_ctzll(mask);
+         unsigned long long b = 1ULL << bit;
+
+         /* Claim the bit; only one acquirer gets to try the slot */
+         if (atomic_fetch_and(&config->free_slots[rule + 1][w], ~b) & b)
+         {
+            *slot = w * 64 + bit;
+            *cursor = *slot + 1;
+            return true;
          }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+
+         mask &= ~b;
+      }
+   }
+
+   *cursor = words * 64;
+
+   return false;
+}
+
+static bool
+wait_for_hand_off(int best_rule, int key, unsigned int* ticket, long timeout, int* slot)
+{
+   int start;
+   int expected;
+   struct pool_waiter* w = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (key == 0 || best_rule < -1 || best_rule >= NUMBER_OF_LIMITS)
+   {
+      SLEEP(timeout)
+      return false;
+   }
+
+   start = getpid() % NUMBER_OF_WAITERS;
+   for (int i = 0; w == NULL && i < NUMBER_OF_WAITERS; i++)
+   {
+      struct pool_waiter* c = &config->pool_waiters[(start + i) % NUMBER_OF_WAITERS];
+
+      expected = WAITER_FREE;
+      if (atomic_compare_exchange_strong(&c->state, &expected, WAITER_INIT))
+      {
+         w = c;
+      }
+   }
+
+   if (w == NULL)
+   {
+      /* All waiter entries are taken, so just back off */
+      SLEEP(timeout)
+      return false;
+   }
+
+   /* The ticket is kept across retries, so the FIFO position is too */
+   if (*ticket == 0)
+   {
+      *ticket = atomic_fetch_add(&config->waiter_ticket, 1) + 1;
+   }
+
+   w->limit_rule = best_rule;
+   w->key = key;
+   w->ticket = *ticket;
+   w->pid = getpid();
+   w->route = replica_server;
+   w->slot = -1;
+
+   atomic_fetch_add(&config->waiters[best_rule + 1], 1);
+   atomic_store(&w->state, WAITER_WAITING);
+
+   futex_wait(&w->state, WAITER_WAITING, timeout);
+
+   expected = WAITER_WAITING;
+   if (!atomic_compare_exchange_strong(&w->state, &expected, WAITER_FREE))
+   {
+      /* A returning process won the race; wait for it to publish the slot */
+      while (atomic_load(&w->state) != WAITER_HANDED)
+      {
+         SLEEP(1000L)
+      }
+
+      *slot = w->slot;
+      atomic_store(&w->state, WAITER_FREE);
+   }
+
+   atomic_fetch_sub(&config->waiters[best_rule + 1], 1);
+
+   return *slot != -1;
+}
+
+static void
+hand_off(int slot)
+{
+   int rule;
+   int key;
+   int expected;
+   signed char free;
+   unsigned long long b;
+   struct pool_waiter* oldest = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   rule = config->connections[slot].limit_rule;
+   key = config->connections[slot].key;
+
+   if (key == 0 || rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      return;
+   }
+
+   /* The slot is published as FREE before the waiters are checked, and a
+    * waiter registers before it sleeps, so either the waiter sees the slot
+    * on its rescan or we see the waiter here */
+   if (atomic_load(&config->waiters[rule + 1]) == 0)
+   {
+      return;
+   }
+
+   oldest = oldest_waiter(key, connection_route(slot));
+
+   if (oldest == NULL)
+   {
+      return;
+   }
+
+   /* Take the slot back out of the free slot index */
+   b = 1ULL << (slot % 64);
+   if (!(atomic_fetch_and(&config->free_slots[rule + 1][slot / 64], ~b) & b))
+   {
+      return;
+   }
+
+   free = STATE_FREE;
+   if (!atomic_compare_exchange_strong(&config->states[slot], &free, STATE_IN_USE))
+   {
+      return;
+   }
+
+   if (!increase_connections(rule))
+   {
+      atomic_store(&config->states[slot], STATE_FREE);
+      free_slot_add(slot);
+      return;
+   }
+
+   expected = WAITER_WAITING;
+   if (!atomic_compare_exchange_strong(&oldest->state, &expected, WAITER_HANDING))
+   {
+      /* The waiter timed out in the meantime */
+      if (rule >= 0)
+      {
+         atomic_fetch_sub(&config->limits[rule].active_connections, 1);
+      }
+      atomic_fetch_sub(&config->active_connections, 1);
+      atomic_store(&config->states[slot], STATE_FREE);
+      free_slot_add(slot);
+      return;
+   }
+
+   timer_wheels_remove(slot);
+
+   config->connections[slot].pid = oldest->pid;
+   oldest->slot = slot;
+   atomic_store(&oldest->state, WAITER_HANDED);
+
+   futex_wake(&oldest->state);
+
+   pgagroal_log_debug("hand_off: Slot %d to PID %d", slot, oldest->pid);
+}
+
+static bool
+direct_hand_off(int slot)
+{
+   int rule;
+   int key;
+   int expected;
+   struct pool_waiter* oldest = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   rule = config->connections[slot].limit_rule;
+   key = config->connections[slot].key;
+
+   if (key == 0 || rule < -1 || rule >= NUMBER_OF_LIMITS)
+   {
+      return false;
+   }
+
+   /* A waiter that registers after this check finds the slot through
+    * hand_off() once it is published as FREE */
+   if (atomic_load(&config->waiters[rule + 1]) == 0)
+   {
+      return false;
+   }
+
+   oldest = oldest_waiter(key, connection_route(slot));
+
+   if (oldest == NULL)
+   {
+      return false;
+   }
+
+   expected = WAITER_WAITING;
+   if (!atomic_compare_exchange_strong(&oldest->state, &expected, WAITER_HANDING))
+   {
+      return false;
+   }
+
+   /* The slot stays IN_USE and the waiter takes over the active connection
+    * counts, which are the same since the key includes the limit rule */
+   config->connections[slot].pid = oldest->pid;
+   config->connections[slot].tx_mode = true;
+   memset(&pgagroal_connection_info(slot)->appname, 0, sizeof(pgagroal_connection_info(slot)->appname));
+   oldest->slot = slot;
+   atomic_store(&oldest->state, WAITER_HANDED);
+
+   futex_wake(&oldest->state);
+
+   pgagroal_log_debug("direct_hand_off: Slot %d to PID %d", slot, oldest->pid);
+
+   return true;
+}
+
+static struct pool_waiter*
+oldest_waiter(int key, int route)
+{
+   int expected;
+   struct pool_waiter* oldest = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < NUMBER_OF_WAITERS; i++)
+   {
+      struct pool_waiter* w = &config->pool_waiters[i];
+
+      if (atomic_load(&w->state) == WAITER_WAITING && w->key == key && w->route == route)
+      {
+         if (kill(w->pid, 0) == -1 && errno == ESRCH)
+         {
+            /* The waiter died; reclaim its entry */
+            expected = WAITER_WAITING;
+            if (atomic_compare_exchange_strong(&w->state, &expected, WAITER_FREE))
+            {
+               atomic_fetch_sub(&config->waiters[w->limit_rule + 1], 1);
+            }
+            errno = 0;
+            continue;
+         }
+
+         if (oldest == NULL || (int)(w->ticket - oldest->ticket) < 0)
+         {
+            oldest = w;
+         }
+      }
+   }
+
+   return oldest;
+}
+
+static int
+connection_route(int slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   return config->connections[slot].replica ? config->connections[slot].server : -1;
+}
+
+/**
+ * Take a token from the connection_rate bucket of a server. The bucket is kept
+ * as the time it is drained until, so a full bucket lets a second worth of
+ * backends through at once and the rest are spaced evenly
+ * @param server The server
+ * @return 0 if a backend can be created, otherwise the microseconds to wait
+ */
+static long
+connect_throttle(int server)
+{
+   long long interval;
+   long long now;
+   long long tat;
+   long long next;
+   struct timespec ts;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->connection_rate <= 0)
+   {
+      return 0;
+   }
+
+   interval = 1000000LL / config->connection_rate;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   now = (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+   tat = atomic_load(&config->servers[server].connect_tat);
+   do
+   {
+      next = MAX(tat, now) + interval;
+
+      if (next - now > 1000000LL)
+      {
+         return (long)(next - now - 1000000LL);
+      }
+   }
+   while (!atomic_compare_exchange_weak(&config->servers[server].connect_tat, &tat, next));
+
+   return 0;
+}
+
+/**
+ * Can a new backend be created for the rule. The busy entries that are below
+ * their guaranteed_size keep the connections they are missing free, and an
+ * idle entry doesn't hold any back, so the other entries can borrow them
+ * @param best_rule The limit rule
+ * @return True if admitted, otherwise false
+ */
+static bool
+admit(int best_rule)
+{
+   int used;
+   int held;
+   int missing;
+   struct limit* limit;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (best_rule >= 0 &&
+       atomic_load(&config->limits[best_rule].backend_connections) < config->limits[best_rule].guaranteed_size)
+   {
+      return true;
+   }
+
+   held = 0;
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      limit = &config->limits[i];
+
+      if (i == best_rule || limit->guaranteed_size == 0)
+      {
+         continue;
+      }
+
+      if (atomic_load(&limit->active_connections) == 0 && atomic_load(&config->waiters[i + 1]) == 0)
+      {
+         continue;
+      }
+
+      missing = limit->guaranteed_size - atomic_load(&limit->backend_connections);
+      if (missing > 0)
+      {
+         held += missing;
+      }
+   }
+
+   if (held == 0)
+   {
+      return true;
+   }
+
+   used = 0;
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      used += atomic_load(&config->servers[i].backends);
+   }
+
+   return config->max_connections - used > held;
+}
+
+/**
+ * Take a free connection back from another entry, so a rule below its
+ * guaranteed_size gets a slot when the pool is full. The connection comes from
+ * the lowest priority entry that is above its own guaranteed_size
+ * @param best_rule The limit rule
+ * @return True if a connection was removed, otherwise false
+ */
+static bool
+reclaim_connection(int best_rule)
+{
+   int rule;
+   int victim;
+   int priority;
+   int lowest;
+   signed char free;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (best_rule < 0 ||
+       atomic_load(&config->limits[best_rule].backend_connections) >= config->limits[best_rule].guaranteed_size)
+   {
+      return false;
+   }
+
+   victim = -1;
+   lowest = 0;
+   priority = config->limits[best_rule].priority;
+
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      if (atomic_load(&config->states[i]) != STATE_FREE)
+      {
+         continue;
+      }
+
+      rule = config->connections[i].limit_rule;
+
+      if (rule == best_rule)
+      {
+         continue;
+      }
+
+      /* A connection without a rule has no guarantee and priority 0 */
+      if (rule >= 0 &&
+          atomic_load(&config->limits[rule].backend_connections) <= config->limits[rule].guaranteed_size)
+      {
+         continue;
+      }
+
+      if (rule >= 0 ? config->limits[rule].priority > priority : priority < 0)
+      {
+         continue;
+      }
+
+      if (victim == -1 || (rule >= 0 ? config->limits[rule].priority : 0) < lowest)
+      {
+         victim = i;
+         lowest = rule >= 0 ? config->limits[rule].priority : 0;
+      }
+   }
+
+   if (victim == -1)
+   {
+      return false;
+   }
+
+   free = STATE_FREE;
+   if (!atomic_compare_exchange_strong(&config->states[victim], &free, STATE_REMOVE))
+   {
+      return false;
+   }
+
+   pgagroal_log_debug("reclaim_connection: Slot %d for limit entry %d", victim, best_rule + 1);
+
+   pgagroal_prometheus_connection_remove();
+   pgagroal_tracking_event_slot(TRACKER_REMOVE_CONNECTION, victim);
+   pgagroal_kill_connection(victim, NULL);
+
+   return true;
+}
+
+static void
+futex_wait(atomic_int* word, int value, long timeout)
+{
+#if HAVE_LINUX
+   struct timespec ts;
+
+   ts.tv_sec = timeout / 1000000000L;
+   ts.tv_nsec = timeout % 1000000000L;
+
+   syscall(SYS_futex, word, FUTEX_WAIT, value, &ts, NULL, 0);
+   errno = 0;
+#else
+   long waited = 0;
+
+   while (waited < timeout && atomic_load(word) == value)
+   {
+      SLEEP(1000000L)
+      waited += 1000000L;
+   }
 #endif
-         break;
-      case STATE_REMOVE:
-         pgagroal_log_debug("pgagroal_pool_status: State: REMOVE");
-         pgagroal_log_debug("                      Slot: %d", slot);
-         pgagroal_log_debug("                      Server: %d", connection.server);
-         pgagroal_log_debug("                      User: %s", connection.username);
-         pgagroal_log_debug("                      Database: %s", connection.database);
-         pgagroal_log_debug("                      AppName: %s", connection.appname);
-         pgagroal_log_debug("                      Rule: %d", connection.limit_rule);
-         pgagroal_log_debug("                      Start: %s", &start_buf[0]);
-         pgagroal_log_debug("                      Time: %s", &time_buf[0]);
-         pgagroal_log_debug("                      FD: %d", connection.fd);
-         pgagroal_log_trace("                      PID: %d", connection.pid);
-         pgagroal_log_trace("                      Auth: %d", connection.has_security);
-         for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-         {
-            pgagroal_log_trace("                      Size: %zd", connection.security_lengths[i]);
-            pgagroal_log_mem(&connection.security_messages[i], connection.security_lengths[i]);
-         }
-         pgagroal_log_trace("                      Backend PID: %d", connection.backend_pid);
-#ifdef DEBUG
-         pgagroal_log_trace("                      Backend Secret: %d", connection.backend_secret);
+}
+
+static void
+futex_wake(atomic_int* word)
+{
+#if HAVE_LINUX
+   syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+   errno = 0;
+#else
+   (void)word;
 #endif
-         break;
-      default:
-         pgagroal_log_debug("pgagroal_pool_status: State %d Slot %d FD %d", state, slot, connection.fd);
-         break;
+}
+
+static void
+timer_wheels_insert(int slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Transaction mode connections are not subject to the timeouts */
+   if (config->connections[slot].tx_mode)
+   {
+      return;
+   }
+
+   if (pgagroal_time_is_valid(config->idle_timeout))
+   {
+      int timeout = (int)pgagroal_time_convert(config->idle_timeout, FORMAT_TIME_S);
+      pgagroal_timer_wheel_add(&config->idle_wheel, timeout, config->connections[slot].timestamp + timeout, slot);
+   }
+
+   if (pgagroal_time_is_valid(config->max_connection_age))
+   {
+      int timeout = (int)pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S);
+      pgagroal_timer_wheel_add(&config->age_wheel, timeout, age_deadline(slot, timeout), slot);
    }
 }
 
+static void
+timer_wheels_remove(int slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgagroal_time_is_valid(config->idle_timeout))
+   {
+      int timeout = (int)pgagroal_time_convert(config->idle_timeout, FORMAT_TIME_S);
+      pgagroal_timer_wheel_remove(&config->idle_wheel, timeout, config->connections[slot].timestamp + timeout, slot);
+   }
+
+   if (pgagroal_time_is_valid(config->max_connection_age))
+   {
+      int timeout = (int)pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S);
+      pgagroal_timer_wheel_remove(&config->age_wheel, timeout, age_deadline(slot, timeout), slot);
+   }
+}
+
+/**
+ * The time a slot is due for recycling. The deadline is spread over the last
+ * part of max_connection_age by a hash of the slot and its start time, such
+ * that backends created together are recycled apart
+ * @param slot The slot
+ * @param timeout The max_connection_age in seconds
+ * @return The deadline
+ */
+static time_t
+age_deadline(int slot, int timeout)
+{
+   int window;
+   unsigned int h;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   window = timeout / MAX_CONNECTION_AGE_JITTER;
+   if (window <= 0)
+   {
+      return config->connections[slot].start_time + timeout;
+   }
+
+   h = (unsigned int)(slot + 1) * 2654435761U;
+   h ^= (unsigned int)config->connections[slot].start_time * 2246822519U;
+   h ^= h >> 15;
+
+   return config->connections[slot].start_time + timeout - (time_t)(h % (unsigned int)window);
+}
+
+/**
+ * Validate a batch of slots in validation. A backend that has something to read
+ * while idle was closed or sent an error, and the others are sent an empty query
+ * at once, so the replies are awaited in parallel. A slot is released as soon as
+ * its reply is complete
+ * @param slots The slots
+ * @param number_of_slots The number of slots
+ * @return true if a connection was killed, otherwise false
+ */
 static bool
-do_prefill(char* username, char* database, int size)
+validate_batch(int* slots, int number_of_slots)
 {
-   signed char state;
-   int free = 0;
-   int connections = 0;
+   bool killed = false;
+   int pending = 0;
+   int n;
+   int timeout;
+   ssize_t numbytes;
+   struct timespec start;
+   char buffer[256];
+   char probe[6];
+   bool active[VALIDATION_BATCH];
+   bool failed[VALIDATION_BATCH];
+   struct pollfd fds[VALIDATION_BATCH];
+   struct message_stream streams[VALIDATION_BATCH];
+   struct message msg;
+   struct message reply;
+   struct message_frame frame;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   //Find the limit rule for this database/username combination
-   int rule_index = find_best_rule(username, database);
-   if (rule_index != -1)
+   timeout = (int)pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S) * 1000;
+   if (timeout <= 0)
    {
-      // Count connections for this rule (including aliases)
-      connections = get_connection_count_for_limit_rule(rule_index, username);
+      timeout = 5000;
    }
-   else
+
+   memset(&probe, 0, sizeof(probe));
+   pgagroal_write_byte(&probe, 'Q');
+   pgagroal_write_int32(&probe[1], 5);
+
+   memset(&msg, 0, sizeof(struct message));
+   msg.kind = 'Q';
+   msg.length = sizeof(probe);
+   msg.data = &probe;
+
+   memset(&streams, 0, sizeof(streams));
+
+   for (int i = 0; i < number_of_slots; i++)
    {
-      // Fallback to old logic if no rule found
-      for (int i = 0; i < config->max_connections; i++)
+      fds[i].fd = config->connections[slots[i]].fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+      active[i] = true;
+      failed[i] = false;
+   }
+
+   /* An idle backend has nothing to say, one pass finds the ones that were closed */
+   if (poll(&fds[0], number_of_slots, 0) < 0)
+   {
+      errno = 0;
+   }
+
+   for (int i = 0; i < number_of_slots; i++)
+   {
+      if (fds[i].revents != 0 || pgagroal_write_socket_message(fds[i].fd, &msg) != MESSAGE_STATUS_OK)
       {
-         if (!strcmp((const char*)(&config->connections[i].username), username) &&
-             !strcmp((const char*)(&config->connections[i].database), database))
+         active[i] = false;
+         if (validation_done(slots[i], false))
          {
-            connections++;
+            killed = true;
          }
       }
-   }
-
-   // Count free connections
-   for (int i = 0; i < config->max_connections; i++)
-   {
-      state = atomic_load(&config->states[i]);
-      if (state == STATE_NOTINIT)
+      else
       {
-         free++;
+         pending++;
       }
    }
 
-   pgagroal_log_debug("do_prefill: user=%s, database=%s, current=%d, target=%d, free=%d",
-                      username, database, connections, size, free);
+   clock_gettime(CLOCK_MONOTONIC, &start);
 
-   return connections < size && free > 0;
-}
+   while (pending > 0)
+   {
+      int left = timeout - (int)(pgagroal_time_elapsed_usec(&start) / 1000);
 
-void
-pgagroal_prefill_if_can(bool do_fork, bool initial)
-{
-   int primary;
+      if (left <= 0)
+      {
+         break;
+      }
 
-   if (pgagroal_can_prefill())
-   {
-      if (pgagroal_get_primary(&primary))
+      for (int i = 0; i < number_of_slots; i++)
       {
-         pgagroal_log_warn("No primary detected, cannot try to prefill!");
-         return;
+         /* A negative descriptor is left out by poll() */
+         fds[i].fd = active[i] ? config->connections[slots[i]].fd : -1;
+         fds[i].revents = 0;
       }
 
-      if (do_fork)
+      n = poll(&fds[0], number_of_slots, left);
+      if (n < 0 && errno == EINTR)
       {
-         if (!fork())
+         errno = 0;
+         continue;
+      }
+      if (n <= 0)
+      {
+         break;
+      }
+
+      for (int i = 0; i < number_of_slots; i++)
+      {
+         bool done = false;
+         bool valid = false;
+         int offset = 0;
+
+         if (!active[i] || fds[i].revents == 0)
          {
-            pgagroal_prefill(initial);
+            continue;
+         }
+
+         numbytes = recv(fds[i].fd, &buffer[0], sizeof(buffer), MSG_DONTWAIT);
+
+         if (numbytes <= 0)
+         {
+            if (numbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            {
+               errno = 0;
+               continue;
+            }
+            errno = 0;
+            done = true;
+         }
+         else
+         {
+            memset(&reply, 0, sizeof(struct message));
+            reply.kind = buffer[0];
+            reply.length = numbytes;
+            reply.data = &buffer[0];
+
+            while (!done && pgagroal_message_stream_next(&streams[i], &reply, &offset, "EZ", &frame))
+            {
+               if (frame.kind == 'E')
+               {
+                  failed[i] = true;
+               }
+               else if (frame.kind == 'Z')
+               {
+                  done = true;
+                  valid = !failed[i] && offset == numbytes;
+               }
+            }
+         }
+
+         if (done)
+         {
+            active[i] = false;
+            pending--;
+
+            if (validation_done(slots[i], valid))
+            {
+               killed = true;
+            }
          }
       }
-      else
+   }
+
+   /* No reply within authentication_timeout */
+   for (int i = 0; i < number_of_slots; i++)
+   {
+      if (active[i] && validation_done(slots[i], false))
       {
-         pgagroal_prefill(initial);
+         killed = true;
       }
    }
+
+   return killed;
 }
 
-static char*
-resolve_database_name(char* database, int best_rule)
+/**
+ * End the validation of a slot, which is released or killed
+ * @param slot The slot
+ * @param valid Is the connection valid
+ * @return true if the connection was killed, otherwise false
+ */
+static bool
+validation_done(int slot, bool valid)
 {
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   signed char validation = STATE_VALIDATION;
+   struct main_configuration* config;
 
-   if (best_rule < 0 || best_rule >= config->number_of_limits)
+   config = (struct main_configuration*)shmem;
+
+   if (valid && atomic_compare_exchange_strong(&config->states[slot], &validation, STATE_FREE))
    {
-      return database; // Return original if no rule found
+      free_slot_add(slot);
+      return false;
    }
 
-   // Check if this database name is an alias
-   for (int j = 0; j < config->limits[best_rule].aliases_count; j++)
+   pgagroal_prometheus_connection_invalid();
+   pgagroal_tracking_event_slot(TRACKER_INVALID_CONNECTION, slot);
+   pgagroal_kill_connection(slot, NULL);
+
+   return true;
+}
+
+/**
+ * Release the accounting and the state of a slot whose backend is
+ * gone from this process
+ * @param slot The slot
+ */
+static void
+detach_connection(int slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->connections[slot].limit_rule >= 0)
    {
-      if (!strcmp(database, config->limits[best_rule].aliases[j]))
+      /* Release the rule's hard-cap reservation (issue #848). Unlike the
+       * per-rule active_connections below, backend_connections tracks live
+       * backends rather than checkouts, so it must be released on every kill
+       * of a rule-bound backend -- including idle/flush kills of pooled
+       * connections, where pid == -1 and the checkout counter was already
+       * decremented on return. */
+      atomic_fetch_sub(&config->limits[config->connections[slot].limit_rule].backend_connections, 1);
+   }
+
+   if (config->connections[slot].pid != -1)
+   {
+      if (config->connections[slot].limit_rule >= 0)
       {
-         return config->limits[best_rule].database; // Return real database name
+         atomic_fetch_sub(&config->limits[config->connections[slot].limit_rule].active_connections, 1);
       }
+
+      atomic_fetch_sub(&config->active_connections, 1);
+
+      // Check for graceful shutdown after killing connection
+      check_graceful_shutdown_trigger();
    }
 
-   // Not an alias, return original name
-   return database;
+   memset(&pgagroal_connection_info(slot)->username, 0, sizeof(pgagroal_connection_info(slot)->username));
+   memset(&pgagroal_connection_info(slot)->database, 0, sizeof(pgagroal_connection_info(slot)->database));
+   memset(&pgagroal_connection_info(slot)->appname, 0, sizeof(pgagroal_connection_info(slot)->appname));
+
+   if (config->connections[slot].server != -1)
+   {
+      atomic_fetch_sub(&config->servers[config->connections[slot].server].backends, 1);
+   }
+
+   config->connections[slot].new = true;
+   config->connections[slot].server = -1;
+   config->connections[slot].replica = false;
+   config->connections[slot].tx_mode = false;
+   config->connections[slot].reset = RESET_DISCARD;
+
+   config->connections[slot].has_security = SECURITY_INVALID;
+   pgagroal_security_release_messages(slot);
+   pgagroal_prepared_reset(slot);
+   pgagroal_parameters_reset(slot);
+
+   config->connections[slot].backend_pid = 0;
+   config->connections[slot].backend_secret = 0;
+
+   free_slot_clear(slot);
+
+   config->connections[slot].limit_rule = -1;
+   config->connections[slot].key = 0;
+   config->connections[slot].start_time = -1;
+   config->connections[slot].timestamp = -1;
+   config->connections[slot].fd = -1;
+   config->connections[slot].pid = -1;
+
+   atomic_store(&config->states[slot], STATE_NOTINIT);
+}
+
+static bool
+flush_target_gone(int slot, struct flush_target* target)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (atomic_load(&config->states[slot]) == STATE_NOTINIT)
+   {
+      return true;
+   }
+
+   /* The slot was killed and created again in between */
+   return config->connections[slot].backend_pid != target->backend_pid ||
+          config->connections[slot].start_time != target->start_time;
 }
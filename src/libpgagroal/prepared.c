@@ -0,0 +1,716 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <art.h>
+#include <logging.h>
+#include <memory.h>
+#include <message.h>
+#include <prepared.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUMBER_OF_PENDING 64
+
+/**
+ * A Parse or a Sync forwarded to the backend, and not answered yet
+ */
+struct pending
+{
+   char kind;      /**< P for a Parse, S for a Sync or a simple query */
+   uint64_t entry; /**< The statement of a Parse, 0 when it isn't tracked */
+};
+
+static struct art* statements = NULL;
+static struct pending pending[NUMBER_OF_PENDING];
+static int pending_start = 0;
+static int pending_count = 0;
+
+static char* statement_name(struct message_frame* frame);
+static uint32_t hash(char* data, int length);
+static uint64_t statement_entry(char* name, char* body, int length);
+static int find_name(int slot, uint64_t entry);
+static bool add_entry(int slot, uint64_t entry);
+static void remove_name(int slot, uint64_t entry);
+static bool is_full(int slot);
+static bool pending_add(char kind, uint64_t entry);
+static bool pending_name(uint64_t entry);
+static void pending_forget(uint64_t entry);
+static char pending_take(uint64_t* entry);
+static int ensure(int slot, int socket, bool idle, char* name);
+static int close_statement(int slot, int socket, char* name, char* parse, bool* failed);
+static int round_trip(int socket, char* data, size_t length, int syncs, bool* failed);
+
+int
+pgagroal_prepared_client(int slot, int socket, bool idle, struct message_frame* frame, bool* deallocate)
+{
+   bool failed = false;
+   char* name = NULL;
+   char* parse = NULL;
+   uint64_t entry;
+
+   if (slot == -1)
+   {
+      return 0;
+   }
+
+   if (statements == NULL)
+   {
+      if (pgagroal_art_create(&statements))
+      {
+         goto untracked;
+      }
+   }
+
+   if (frame->kind == 'S' || frame->kind == 'Q')
+   {
+      /* Either ends a batch, and is answered by a ReadyForQuery */
+      if (!pending_add('S', 0))
+      {
+         goto untracked;
+      }
+
+      return 0;
+   }
+
+   name = statement_name(frame);
+   if (name == NULL || *name == '\0')
+   {
+      if (frame->kind == 'P')
+      {
+         /* The ParseComplete of the unnamed statement must be accounted for too */
+         if (!pending_add('P', 0) || name == NULL)
+         {
+            goto untracked;
+         }
+      }
+
+      return 0;
+   }
+
+   switch (frame->kind)
+   {
+      case 'P':
+         if (frame->available != frame->length - 4)
+         {
+            /* Too large to replay, so the statement is left to the client */
+            pgagroal_art_delete(statements, name);
+            remove_name(slot, statement_entry(name, NULL, 0));
+            pgagroal_log_debug("prepared: %s spans more than one read", name);
+            pending_add('P', 0);
+            goto untracked;
+         }
+
+         parse = (char*)malloc(1 + frame->length);
+         if (parse == NULL)
+         {
+            pgagroal_art_delete(statements, name);
+            pending_add('P', 0);
+            goto untracked;
+         }
+
+         pgagroal_write_byte(parse, 'P');
+         pgagroal_write_int32(parse + 1, frame->length);
+         memcpy(parse + 5, frame->body, frame->length - 4);
+
+         entry = statement_entry(name, frame->body, frame->length - 4);
+
+         if (pgagroal_art_insert(statements, name, (uintptr_t)parse, ValueMem))
+         {
+            free(parse);
+            pending_add('P', 0);
+            goto untracked;
+         }
+
+         if (find_name(slot, entry) != -1 || is_full(slot))
+         {
+            if (!idle)
+            {
+               /* The backend can't be made ready for this Parse, so claim nothing about it */
+               remove_name(slot, entry);
+               pending_add('P', 0);
+               goto untracked;
+            }
+
+            if (close_statement(slot, socket, name, NULL, &failed))
+            {
+               return 1;
+            }
+         }
+
+         /* The statement is only recorded when the backend has completed the Parse */
+         if (!pending_add('P', entry))
+         {
+            goto untracked;
+         }
+         break;
+      case 'B':
+      case 'D':
+         return ensure(slot, socket, idle, name);
+      case 'C':
+         pgagroal_art_delete(statements, name);
+         remove_name(slot, statement_entry(name, NULL, 0));
+         pending_forget(statement_entry(name, NULL, 0));
+         break;
+      default:
+         break;
+   }
+
+   return 0;
+
+untracked:
+
+   /* The backend may get a statement that we don't know of */
+   *deallocate = true;
+
+   return 0;
+}
+
+void
+pgagroal_prepared_server(int slot, struct message_frame* frame, bool* deallocate)
+{
+   char kind;
+   uint64_t entry = 0;
+
+   if (slot == -1)
+   {
+      return;
+   }
+
+   switch (frame->kind)
+   {
+      case '1':
+         kind = pending_take(&entry);
+         if (kind != 'P')
+         {
+            pgagroal_log_debug("prepared: slot %d completed a Parse that wasn't seen", slot);
+            pending_count = 0;
+            *deallocate = true;
+         }
+         else if (entry != 0)
+         {
+            remove_name(slot, entry);
+            if (!add_entry(slot, entry))
+            {
+               *deallocate = true;
+            }
+         }
+         break;
+      case 'E':
+         /* The backend skips to the next Sync, so the Parse messages before it won't complete */
+         while (pending_count > 0 && pending[pending_start].kind == 'P')
+         {
+            pending_take(&entry);
+         }
+
+         /* invalid_sql_statement_name and duplicate_prepared_statement mean that a
+          * statement was added or removed behind our back */
+         if (memmem(frame->body, frame->available, "C26000", 7) != NULL ||
+             memmem(frame->body, frame->available, "C42P05", 7) != NULL)
+         {
+            pgagroal_log_debug("prepared: slot %d no longer matches its statements", slot);
+            pgagroal_prepared_reset(slot);
+            *deallocate = true;
+         }
+         break;
+      case 'Z':
+         do
+         {
+            kind = pending_take(&entry);
+         }
+         while (kind == 'P');
+         break;
+      default:
+         break;
+   }
+}
+
+void
+pgagroal_prepared_reset(int slot)
+{
+   memset(&pgagroal_connection_info(slot)->prepared_statements, 0,
+          sizeof(pgagroal_connection_info(slot)->prepared_statements));
+}
+
+void
+pgagroal_prepared_destroy(void)
+{
+   pgagroal_art_destroy(statements);
+   statements = NULL;
+   pending_start = 0;
+   pending_count = 0;
+}
+
+static char*
+statement_name(struct message_frame* frame)
+{
+   char* end = NULL;
+
+   if (frame->available <= 0)
+   {
+      return NULL;
+   }
+
+   switch (frame->kind)
+   {
+      case 'P':
+         end = memchr(frame->body, '\0', frame->available);
+         return end != NULL ? frame->body : NULL;
+      case 'B':
+         /* The portal comes first */
+         end = memchr(frame->body, '\0', frame->available);
+         if (end == NULL)
+         {
+            return NULL;
+         }
+         end++;
+         if (memchr(end, '\0', frame->available - (end - frame->body)) == NULL)
+         {
+            return NULL;
+         }
+         return end;
+      case 'D':
+      case 'C':
+         if (frame->body[0] != 'S' || memchr(frame->body + 1, '\0', frame->available - 1) == NULL)
+         {
+            return NULL;
+         }
+         return frame->body + 1;
+      default:
+         break;
+   }
+
+   return NULL;
+}
+
+static uint32_t
+hash(char* data, int length)
+{
+   uint32_t h = 2166136261U;
+
+   for (int i = 0; i < length; i++)
+   {
+      h = (h ^ ((unsigned char*)data)[i]) * 16777619U;
+   }
+
+   return h;
+}
+
+static uint64_t
+statement_entry(char* name, char* body, int length)
+{
+   /* The name in the upper half, the whole Parse body in the lower half */
+   return ((uint64_t)hash(name, strlen(name)) << 32) | (hash(body, length) | 1);
+}
+
+static int
+find_name(int slot, uint64_t entry)
+{
+   uint64_t* cache = pgagroal_connection_info(slot)->prepared_statements;
+
+   for (int i = 0; i < NUMBER_OF_PREPARED_STATEMENTS; i++)
+   {
+      if (cache[i] != 0 && (cache[i] >> 32) == (entry >> 32))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static bool
+add_entry(int slot, uint64_t entry)
+{
+   uint64_t* cache = pgagroal_connection_info(slot)->prepared_statements;
+
+   for (int i = 0; i < NUMBER_OF_PREPARED_STATEMENTS; i++)
+   {
+      if (cache[i] == 0)
+      {
+         cache[i] = entry;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+remove_name(int slot, uint64_t entry)
+{
+   int i = find_name(slot, entry);
+
+   if (i != -1)
+   {
+      pgagroal_connection_info(slot)->prepared_statements[i] = 0;
+   }
+}
+
+static bool
+is_full(int slot)
+{
+   uint64_t* cache = pgagroal_connection_info(slot)->prepared_statements;
+
+   for (int i = 0; i < NUMBER_OF_PREPARED_STATEMENTS; i++)
+   {
+      if (cache[i] == 0)
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static bool
+pending_add(char kind, uint64_t entry)
+{
+   if (pending_count == NUMBER_OF_PENDING)
+   {
+      return false;
+   }
+
+   pending[(pending_start + pending_count) % NUMBER_OF_PENDING].kind = kind;
+   pending[(pending_start + pending_count) % NUMBER_OF_PENDING].entry = entry;
+   pending_count++;
+
+   return true;
+}
+
+static bool
+pending_name(uint64_t entry)
+{
+   for (int i = 0; i < pending_count; i++)
+   {
+      struct pending* p = &pending[(pending_start + i) % NUMBER_OF_PENDING];
+
+      if (p->kind == 'P' && p->entry != 0 && (p->entry >> 32) == (entry >> 32))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+pending_forget(uint64_t entry)
+{
+   for (int i = 0; i < pending_count; i++)
+   {
+      struct pending* p = &pending[(pending_start + i) % NUMBER_OF_PENDING];
+
+      if (p->kind == 'P' && p->entry != 0 && (p->entry >> 32) == (entry >> 32))
+      {
+         p->entry = 0;
+      }
+   }
+}
+
+static char
+pending_take(uint64_t* entry)
+{
+   char kind;
+
+   if (pending_count == 0)
+   {
+      *entry = 0;
+      return '\0';
+   }
+
+   kind = pending[pending_start].kind;
+   *entry = pending[pending_start].entry;
+
+   pending_start = (pending_start + 1) % NUMBER_OF_PENDING;
+   pending_count--;
+
+   return kind;
+}
+
+static int
+ensure(int slot, int socket, bool idle, char* name)
+{
+   int i;
+   bool failed = false;
+   char* parse = NULL;
+   uint64_t entry;
+
+   parse = (char*)pgagroal_art_search(statements, name);
+   if (parse == NULL)
+   {
+      return 0;
+   }
+
+   entry = statement_entry(name, parse + 5, pgagroal_read_int32(parse + 1) - 4);
+
+   i = find_name(slot, entry);
+   if (i != -1 && pgagroal_connection_info(slot)->prepared_statements[i] == entry)
+   {
+      return 0;
+   }
+
+   /* A Parse of it is on its way to the backend */
+   if (pending_name(entry))
+   {
+      return 0;
+   }
+
+   if (!idle)
+   {
+      pgagroal_log_debug("prepared: %s isn't prepared on slot %d", name, slot);
+      return 0;
+   }
+
+   if (close_statement(slot, socket, name, parse, &failed))
+   {
+      return 1;
+   }
+
+   if (!failed)
+   {
+      add_entry(slot, entry);
+   }
+
+   return 0;
+}
+
+/**
+ * Close a statement on the backend, and Parse it again if a Parse message is given.
+ * A full cache is emptied with a DEALLOCATE ALL first
+ * @param slot The slot
+ * @param socket The descriptor of the backend
+ * @param name The name of the statement
+ * @param parse The Parse message, or NULL
+ * @param failed Did the backend answer with an error
+ * @return 0 upon success, otherwise 1 when the backend can't be used anymore
+ */
+static int
+close_statement(int slot, int socket, char* name, char* parse, bool* failed)
+{
+   bool full;
+   int syncs = 1;
+   size_t size;
+   size_t offset = 0;
+   char* data = NULL;
+   int32_t parse_length = parse != NULL ? pgagroal_read_int32(parse + 1) + 1 : 0;
+   char* deallocate = "DEALLOCATE ALL;";
+
+   full = is_full(slot);
+
+   size = (full ? 5 + strlen(deallocate) + 1 : 0) + 6 + strlen(name) + 1 + parse_length + 5;
+
+   data = (char*)malloc(size);
+   if (data == NULL)
+   {
+      /* Nothing was sent, so the backend is as it was */
+      *failed = true;
+      return 0;
+   }
+
+   if (full)
+   {
+      pgagroal_write_byte(data + offset, 'Q');
+      pgagroal_write_int32(data + offset + 1, 4 + strlen(deallocate) + 1);
+      pgagroal_write_string(data + offset + 5, deallocate);
+      offset += 5 + strlen(deallocate) + 1;
+      syncs++;
+   }
+
+   pgagroal_write_byte(data + offset, 'C');
+   pgagroal_write_int32(data + offset + 1, 4 + 1 + strlen(name) + 1);
+   pgagroal_write_byte(data + offset + 5, 'S');
+   pgagroal_write_string(data + offset + 6, name);
+   offset += 6 + strlen(name) + 1;
+
+   if (parse != NULL)
+   {
+      memcpy(data + offset, parse, parse_length);
+      offset += parse_length;
+   }
+
+   pgagroal_write_byte(data + offset, 'S');
+   pgagroal_write_int32(data + offset + 1, 4);
+   offset += 5;
+
+   if (full)
+   {
+      pgagroal_prepared_reset(slot);
+   }
+   else
+   {
+      remove_name(slot, statement_entry(name, NULL, 0));
+   }
+
+   if (round_trip(socket, data, offset, syncs, failed))
+   {
+      goto error;
+   }
+
+   if (*failed)
+   {
+      pgagroal_log_debug("prepared: unable to prepare %s on slot %d", name, slot);
+   }
+
+   free(data);
+
+   return 0;
+
+error:
+   free(data);
+
+   return 1;
+}
+
+/**
+ * Send messages to the backend and read the replies up to the given number
+ * of ReadyForQuery messages, waiting at most blocking_timeout for them
+ * @param socket The descriptor of the backend
+ * @param data The messages
+ * @param length The length of the messages
+ * @param syncs The number of ReadyForQuery messages
+ * @param failed Did the backend answer with an error
+ * @return 0 upon success, otherwise 1
+ */
+static int
+round_trip(int socket, char* data, size_t length, int syncs, bool* failed)
+{
+   int offset;
+   int timeout;
+   int left;
+   ssize_t numbytes;
+   struct timespec start;
+   struct pollfd pfd;
+   struct message request;
+   struct message* reply = NULL;
+   struct message_stream stream;
+   struct message_frame frame;
+   struct main_configuration* config = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&request, 0, sizeof(struct message));
+   memset(&stream, 0, sizeof(struct message_stream));
+
+   *failed = false;
+
+   if (pgagroal_time_is_valid(config->blocking_timeout))
+   {
+      timeout = (int)pgagroal_time_convert(config->blocking_timeout, FORMAT_TIME_S) * 1000;
+   }
+   else
+   {
+      timeout = DEFAULT_BLOCKING_TIMEOUT * 1000;
+   }
+
+   request.kind = (signed char)data[0];
+   request.length = length;
+   request.data = data;
+
+   if (pgagroal_write_socket_message(socket, &request) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   /* The replies must not land in the process buffer, which holds the client data */
+   reply = pgagroal_memory_message_alloc(DEFAULT_BUFFER_SIZE, false);
+   if (reply == NULL)
+   {
+      goto error;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   while (syncs > 0)
+   {
+      numbytes = read(socket, reply->data, DEFAULT_BUFFER_SIZE);
+
+      if (numbytes == 0)
+      {
+         goto error;
+      }
+      else if (numbytes < 0)
+      {
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+         {
+            left = timeout - (int)(pgagroal_time_elapsed_usec(&start) / 1000);
+
+            pfd.fd = socket;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+
+            if (left <= 0 || poll(&pfd, 1, left) == 0)
+            {
+               errno = ETIMEDOUT;
+               goto error;
+            }
+
+            errno = 0;
+            continue;
+         }
+
+         goto error;
+      }
+
+      reply->length = numbytes;
+      offset = 0;
+
+      while (pgagroal_message_stream_next(&stream, reply, &offset, "EZ", &frame))
+      {
+         if (frame.kind == 'E')
+         {
+            *failed = true;
+         }
+         else
+         {
+            syncs--;
+         }
+      }
+   }
+
+   pgagroal_free_message(reply);
+
+   return 0;
+
+error:
+   pgagroal_log_error("prepared: round trip failed: fd=%d errno=%d", socket, errno);
+   errno = 0;
+
+   pgagroal_free_message(reply);
+
+   return 1;
+}
@@ -29,6 +29,7 @@
 /* pgagroal */
 #include <security.h>
 #include <pgagroal.h>
+#include <activity.h>
 #include <art.h>
 #include <logging.h>
 #include <memory.h>
@@ -41,10 +42,13 @@
 
 /* system */
 #include <ev.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -54,6 +58,10 @@
 
 #define CHUNK_SIZE                   32768
 
+#define DATABASE_EMPTY               0
+#define DATABASE_INIT                1
+#define DATABASE_USED                2
+
 #define PAGE_UNKNOWN                 0
 #define PAGE_HOME                    1
 #define PAGE_METRICS                 2
@@ -109,14 +117,31 @@ typedef struct prometheus_metrics_container
    struct art* certificate_metrics_tree;
 } prometheus_metrics_container_t;
 
+/**
+ * A text buffer that knows its length, such that large metrics are built
+ * without rescanning what is already rendered
+ */
+struct exposition
+{
+   char* data;    /**< The text */
+   size_t length; /**< The length of the text */
+   size_t size;   /**< The allocated size */
+};
+
 static void prometheus_metric_value_destroy_cb(uintptr_t data);
 static char* prometheus_metric_value_string_cb(uintptr_t data, int32_t format, char* tag, int indent);
 static int create_metrics_container(prometheus_metrics_container_t** container);
 static void destroy_metrics_container(prometheus_metrics_container_t* container);
 static int add_metric_to_art(struct art* art_tree, char* key, char* value,
                              char* help, char* type, int sort_type);
-static void output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree);
+static void output_art_metrics(struct exposition* body, struct art* art_tree);
 static void output_all_metrics(SSL* client_ssl, int client_fd, prometheus_metrics_container_t* container);
+static void render_all_metrics(struct exposition* e, prometheus_metrics_container_t* container);
+static void collect_metrics(prometheus_metrics_container_t* container);
+static bool exposition_append(struct exposition* e, char* s, size_t length);
+static bool exposition_append_string(struct exposition* e, char* s);
+static char* connection_state_name(int state);
+static int exposition_send(SSL* client_ssl, int client_fd, struct exposition* e);
 
 static int resolve_page(struct message* msg);
 static int badrequest_page(SSL* client_ssl, int client_fd);
@@ -148,10 +173,86 @@ static int send_chunk(SSL* cilent_ssl, int client_fd, char* data);
 static bool is_metrics_cache_configured(void);
 static bool is_metrics_cache_valid(void);
 static bool metrics_cache_append(char* data);
+static bool metrics_cache_append_length(char* data, size_t length);
 static bool metrics_cache_finalize(void);
 static size_t metrics_cache_size_to_alloc(void);
 static void metrics_cache_invalidate(void);
 static bool is_prometheus_enabled(void);
+static void local_slot_publish(void);
+
+static void counter_add(struct prometheus_counter* counter, long long value);
+static unsigned long long counter_value(struct prometheus_counter* counter);
+static void counter_reset(struct prometheus_counter* counter);
+static void latency_add(struct prometheus_latency* latency, long long usec);
+static void latency_reset(struct prometheus_latency* latency);
+static char* append_latency(char* data, char* name, char* labels, struct prometheus_latency* latency);
+static char* append_labels(char* data, char* labels);
+static void wait_reset(struct prometheus_wait* wait);
+static void wait_information(prometheus_metrics_container_t* container);
+static void database_information(prometheus_metrics_container_t* container);
+static void count_reset(struct prometheus_count* count);
+static char* append_count(char* data, char* name, char* labels, struct prometheus_count* count);
+static void pipeline_reset(struct prometheus_pipeline* pipeline);
+static void pipeline_information(prometheus_metrics_container_t* container);
+static void backend_reset(struct prometheus_backend* backend);
+static void backend_information(prometheus_metrics_container_t* container);
+static void queries_reset(struct prometheus_queries* queries);
+static void query_information(prometheus_metrics_container_t* container);
+static int query_compare(const void* a, const void* b);
+static void escape_label(char* dst, size_t size, char* src);
+static int local_count_bucket(int64_t n);
+static void local_accounting_publish(void);
+static int64_t local_now(void);
+
+static struct exposition body = {0};
+static size_t cache_length = 0;
+
+static char* latency_bounds[LATENCY_HISTOGRAM_BUCKETS] = {
+   "0.0001", "0.0002", "0.0004", "0.0008", "0.0016", "0.0032", "0.0064", "0.0128", "0.0256", "0.0512",
+   "0.1024", "0.2048", "0.4096", "0.8192", "1.6384", "3.2768", "6.5536", "13.1072", "26.2144", "+Inf"
+};
+
+static char* count_bounds[COUNT_HISTOGRAM_BUCKETS] = {
+   "1", "2", "4", "8", "16", "32", "64", "128", "256", "512", "1024", "+Inf"
+};
+
+static char* pipeline_names[NUMBER_OF_PIPELINES] = {
+   "performance", "session", "transaction", "statement"
+};
+
+static char* phase_names[NUMBER_OF_BACKEND_PHASES] = {
+   "connect", "tls", "authentication", "parameters"
+};
+
+static char* reason_names[NUMBER_OF_CREATE_REASONS] = {
+   "demand", "prefill", "recycle"
+};
+
+/* The per message counters of this process, see pgagroal_prometheus_local_publish */
+static int64_t local_query_count = 0;
+static int64_t local_network_sent = 0;
+static int64_t local_network_received = 0;
+static int64_t local_client_write_blocked = 0;
+static int64_t local_server_write_blocked = 0;
+static int local_slot = -1;
+static int64_t local_slot_query_count = 0;
+
+/* The cost accounting of this process, see pgagroal_prometheus_local_accounting_start */
+static int local_pipeline = -1;
+static struct rusage local_rusage;
+static int64_t local_reads = 0;
+static int64_t local_writes = 0;
+static int64_t local_wakeups = 0;
+static int64_t local_server_since = 0;
+static int64_t local_client_since = 0;
+static int64_t local_server_blocked = 0;
+static int64_t local_client_blocked = 0;
+static uint64_t local_tx_reads[COUNT_HISTOGRAM_BUCKETS];
+static uint64_t local_tx_writes[COUNT_HISTOGRAM_BUCKETS];
+static uint64_t local_tx_wakeups[COUNT_HISTOGRAM_BUCKETS];
+static uint64_t local_tx_reads_sum = 0;
+static uint64_t local_tx_writes_sum = 0;
+static uint64_t local_tx_wakeups_sum = 0;
 
 void
 pgagroal_prometheus(SSL* client_ssl, int client_fd)
@@ -333,9 +434,52 @@ error:
    exit(1);
 }
 
+int
+pgagroal_prometheus_exposition(char** text, size_t* length)
+{
+   struct exposition e = {0};
+   prometheus_metrics_container_t* container = NULL;
+
+   *text = NULL;
+   *length = 0;
+
+   if (prometheus_shmem == NULL)
+   {
+      goto error;
+   }
+
+   if (create_metrics_container(&container))
+   {
+      pgagroal_log_error("Failed to create metrics container");
+      goto error;
+   }
+
+   collect_metrics(container);
+   render_all_metrics(&e, container);
+
+   destroy_metrics_container(container);
+
+   if (e.data == NULL)
+   {
+      goto error;
+   }
+
+   *text = e.data;
+   *length = e.length;
+
+   return 0;
+
+error:
+
+   free(e.data);
+
+   return 1;
+}
+
 int
 pgagroal_init_prometheus(size_t* p_size, void** p_shmem)
 {
+   int slots;
    size_t tmp_p_size = 0;
    void* tmp_p_shmem = NULL;
    struct main_prometheus* prometheus;
@@ -346,7 +490,11 @@ pgagroal_init_prometheus(size_t* p_size, void** p_shmem)
    *p_size = 0;
    *p_shmem = NULL;
 
-   tmp_p_size = sizeof(struct main_prometheus) + (config->max_connections * sizeof(struct prometheus_connection));
+   /* The configuration isn't validated yet, so the connection slots are
+    * sized from the values as read, which are never below the validated ones */
+   slots = MAX(config->max_connections, config->max_connections_reserve);
+
+   tmp_p_size = sizeof(struct main_prometheus) + (slots * sizeof(struct prometheus_connection));
    if (pgagroal_create_shared_memory(tmp_p_size, config->common.hugepage, &tmp_p_shmem))
    {
       goto error;
@@ -360,22 +508,41 @@ pgagroal_init_prometheus(size_t* p_size, void** p_shmem)
    }
    atomic_init(&prometheus->session_time_sum, 0);
 
+   for (int i = 0; i <= NUMBER_OF_LIMITS; i++)
+   {
+      wait_reset(&prometheus->connection_wait[i]);
+   }
+
+   for (int i = 0; i < NUMBER_OF_DATABASE_METRICS; i++)
+   {
+      atomic_init(&prometheus->databases[i].state, DATABASE_EMPTY);
+      memset(&prometheus->databases[i].database, 0, MAX_DATABASE_LENGTH);
+      latency_reset(&prometheus->databases[i].transaction);
+      latency_reset(&prometheus->databases[i].service);
+   }
+
+   for (int i = 0; i < NUMBER_OF_PIPELINES; i++)
+   {
+      pipeline_reset(&prometheus->pipelines[i]);
+   }
+
    atomic_init(&prometheus->connection_error, 0);
    atomic_init(&prometheus->connection_kill, 0);
    atomic_init(&prometheus->connection_remove, 0);
    atomic_init(&prometheus->connection_timeout, 0);
-   atomic_init(&prometheus->connection_return, 0);
+   counter_reset(&prometheus->connection_return);
    atomic_init(&prometheus->connection_invalid, 0);
-   atomic_init(&prometheus->connection_get, 0);
+   counter_reset(&prometheus->connection_get);
    atomic_init(&prometheus->connection_idletimeout, 0);
    atomic_init(&prometheus->connection_max_connection_age, 0);
    atomic_init(&prometheus->connection_flush, 0);
-   atomic_init(&prometheus->connection_success, 0);
+   counter_reset(&prometheus->connection_success);
 
    atomic_init(&prometheus->prometheus_base.logging_info, 0);
    atomic_init(&prometheus->prometheus_base.logging_warn, 0);
    atomic_init(&prometheus->prometheus_base.logging_error, 0);
    atomic_init(&prometheus->prometheus_base.logging_fatal, 0);
+   atomic_init(&prometheus->prometheus_base.logging_dropped, 0);
 
    // awating connections are those on hold due to
    // the `blocking_timeout` setting
@@ -389,16 +556,25 @@ pgagroal_init_prometheus(size_t* p_size, void** p_shmem)
    atomic_init(&prometheus->auth_user_success, 0);
    atomic_init(&prometheus->auth_user_bad_password, 0);
    atomic_init(&prometheus->auth_user_error, 0);
+   atomic_init(&prometheus->client_rate_limited, 0);
 
    atomic_init(&prometheus->client_wait, 0);
-   atomic_init(&prometheus->client_active, 0);
+   counter_reset(&prometheus->client_active);
    atomic_init(&prometheus->client_wait_time, 0);
 
-   atomic_init(&prometheus->query_count, 0);
-   atomic_init(&prometheus->tx_count, 0);
+   counter_reset(&prometheus->query_count);
+   counter_reset(&prometheus->tx_count);
+   for (int i = 0; i < NUMBER_OF_IDLE_TRANSACTION; i++)
+   {
+      atomic_init(&prometheus->idle_transaction_timeout[i], 0);
+   }
+   atomic_init(&prometheus->memory_pool_hits, 0);
+   atomic_init(&prometheus->memory_pool_misses, 0);
 
-   atomic_init(&prometheus->network_sent, 0);
-   atomic_init(&prometheus->network_received, 0);
+   counter_reset(&prometheus->network_sent);
+   counter_reset(&prometheus->network_received);
+   counter_reset(&prometheus->client_write_blocked);
+   counter_reset(&prometheus->server_write_blocked);
 
    atomic_init(&prometheus->prometheus_base.client_sockets, 0);
    atomic_init(&prometheus->prometheus_base.self_sockets, 0);
@@ -406,10 +582,16 @@ pgagroal_init_prometheus(size_t* p_size, void** p_shmem)
    for (int i = 0; i < NUMBER_OF_SERVERS; i++)
    {
       atomic_init(&prometheus->server_error[i], 0);
+      backend_reset(&prometheus->backends[i]);
    }
    atomic_init(&prometheus->failed_servers, 0);
 
-   for (int i = 0; i < config->max_connections; i++)
+   atomic_init(&prometheus->prefill_active, 0);
+   atomic_init(&prometheus->prefill_pending, 0);
+   atomic_init(&prometheus->prefill_created, 0);
+   atomic_init(&prometheus->prefill_failed, 0);
+
+   for (int i = 0; i < slots; i++)
    {
       memset(&prometheus->prometheus_connections[i], 0, sizeof(struct prometheus_connection));
       atomic_init(&prometheus->prometheus_connections[i].query_count, 0);
@@ -456,6 +638,7 @@ pgagroal_vault_init_prometheus(size_t* p_size, void** p_shmem)
    atomic_init(&prometheus->prometheus_base.logging_warn, 0);
    atomic_init(&prometheus->prometheus_base.logging_error, 0);
    atomic_init(&prometheus->prometheus_base.logging_fatal, 0);
+   atomic_init(&prometheus->prometheus_base.logging_dropped, 0);
 
    atomic_init(&prometheus->prometheus_base.client_sockets, 0);
    atomic_init(&prometheus->prometheus_base.self_sockets, 0);
@@ -605,6 +788,155 @@ pgagroal_prometheus_connection_remove(void)
    atomic_fetch_add(&prometheus->connection_remove, 1);
 }
 
+void
+pgagroal_prometheus_connection_wait(int limit_index, long long usec, int outcome)
+{
+   struct prometheus_wait* wait;
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+   wait = &prometheus->connection_wait[limit_index + 1];
+
+   latency_add(&wait->time, usec);
+
+   if (outcome == PROMETHEUS_WAIT_REUSE)
+   {
+      atomic_fetch_add(&wait->reuse, 1);
+   }
+   else if (outcome == PROMETHEUS_WAIT_CREATED)
+   {
+      atomic_fetch_add(&wait->created, 1);
+   }
+   else
+   {
+      atomic_fetch_add(&wait->timeout, 1);
+   }
+}
+
+int
+pgagroal_prometheus_database_index(char* database)
+{
+   signed char state;
+   struct prometheus_database* entry;
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return -1;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   for (int i = 0; i < NUMBER_OF_DATABASE_METRICS; i++)
+   {
+      entry = &prometheus->databases[i];
+      state = DATABASE_EMPTY;
+
+      if (atomic_compare_exchange_strong(&entry->state, &state, DATABASE_INIT))
+      {
+         memcpy(&entry->database, database, MIN(strlen(database), MAX_DATABASE_LENGTH - 1));
+         atomic_store(&entry->state, DATABASE_USED);
+
+         return i;
+      }
+
+      /* The entry is being added by another process */
+      while (state == DATABASE_INIT)
+      {
+         state = atomic_load(&entry->state);
+      }
+
+      if (!strncmp(&entry->database[0], database, MAX_DATABASE_LENGTH - 1))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+void
+pgagroal_prometheus_transaction_time(int index, long long usec, long long service_usec)
+{
+   struct main_prometheus* prometheus;
+
+   if (index < 0 || !is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   latency_add(&prometheus->databases[index].transaction, usec);
+   latency_add(&prometheus->databases[index].service, service_usec);
+}
+
+void
+pgagroal_prometheus_query_statistics(uint64_t fingerprint, char* query, long long usec, long long rows, int weight)
+{
+   int index = -1;
+   int victim = 0;
+   signed char isfree = STATE_FREE;
+   struct prometheus_query* entry;
+   struct prometheus_queries* queries;
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+   queries = &prometheus->queries;
+
+   if (!atomic_compare_exchange_strong(&queries->lock, &isfree, STATE_IN_USE))
+   {
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_QUERY_FINGERPRINTS; i++)
+   {
+      if (queries->fingerprints[i] == fingerprint)
+      {
+         index = i;
+         break;
+      }
+
+      if (queries->entries[i].calls < queries->entries[victim].calls)
+      {
+         victim = i;
+      }
+   }
+
+   if (index == -1)
+   {
+      /* The calls of the evicted fingerprint bound how much the new one is over counted */
+      index = victim;
+      entry = &queries->entries[index];
+
+      entry->fingerprint = fingerprint;
+      entry->error = entry->calls;
+      entry->usec = 0;
+      entry->rows = 0;
+      memset(&entry->query, 0, sizeof(entry->query));
+      memcpy(&entry->query, query, strnlen(query, QUERY_FINGERPRINT_LENGTH - 1));
+
+      queries->fingerprints[index] = fingerprint;
+   }
+
+   entry = &queries->entries[index];
+   entry->calls += weight;
+   entry->usec += usec * weight;
+   entry->rows += rows * weight;
+
+   atomic_store(&queries->lock, STATE_FREE);
+}
+
 void
 pgagroal_prometheus_connection_timeout(void)
 {
@@ -632,7 +964,7 @@ pgagroal_prometheus_connection_return(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->connection_return, 1);
+   counter_add(&prometheus->connection_return, 1);
 }
 
 void
@@ -662,7 +994,7 @@ pgagroal_prometheus_connection_get(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->connection_get, 1);
+   counter_add(&prometheus->connection_get, 1);
 }
 
 void
@@ -765,7 +1097,7 @@ pgagroal_prometheus_connection_success(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->connection_success, 1);
+   counter_add(&prometheus->connection_success, 1);
 }
 
 void
@@ -813,6 +1145,21 @@ pgagroal_prometheus_auth_user_error(void)
    atomic_fetch_add(&prometheus->auth_user_error, 1);
 }
 
+void
+pgagroal_prometheus_client_rate_limited(void)
+{
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->client_rate_limited, 1);
+}
+
 void
 pgagroal_prometheus_client_wait_add(void)
 {
@@ -855,7 +1202,7 @@ pgagroal_prometheus_client_active_add(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->client_active, 1);
+   counter_add(&prometheus->client_active, 1);
 }
 
 void
@@ -870,7 +1217,7 @@ pgagroal_prometheus_client_active_sub(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_sub(&prometheus->client_active, 1);
+   counter_add(&prometheus->client_active, -1);
 }
 
 void
@@ -885,7 +1232,7 @@ pgagroal_prometheus_query_count_add(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->query_count, 1);
+   counter_add(&prometheus->query_count, 1);
 }
 
 void
@@ -908,6 +1255,11 @@ pgagroal_prometheus_query_count_specified_reset(int slot)
 {
    struct main_prometheus* prometheus;
 
+   if (slot == local_slot)
+   {
+      local_slot_query_count = 0;
+   }
+
    if (!is_prometheus_enabled())
    {
       return;
@@ -930,27 +1282,29 @@ pgagroal_prometheus_tx_count_add(void)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->tx_count, 1);
+   counter_add(&prometheus->tx_count, 1);
 }
 
 void
-pgagroal_prometheus_network_sent_add(ssize_t s)
+pgagroal_prometheus_idle_transaction_timeout(int action)
 {
    struct main_prometheus* prometheus;
 
-   if (!is_prometheus_enabled())
+   if (!is_prometheus_enabled() || action < 0 || action >= NUMBER_OF_IDLE_TRANSACTION)
    {
       return;
    }
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->network_sent, s);
+   atomic_fetch_add(&prometheus->idle_transaction_timeout[action], 1);
 }
 
 void
-pgagroal_prometheus_network_received_add(ssize_t s)
+pgagroal_prometheus_memory_pool_add(void)
 {
+   uint64_t hits;
+   uint64_t misses;
    struct main_prometheus* prometheus;
 
    if (!is_prometheus_enabled())
@@ -960,148 +1314,443 @@ pgagroal_prometheus_network_received_add(ssize_t s)
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->network_received, s);
+   pgagroal_memory_stats(&hits, &misses);
+
+   atomic_fetch_add(&prometheus->memory_pool_hits, hits);
+   atomic_fetch_add(&prometheus->memory_pool_misses, misses);
 }
 
 void
-pgagroal_prometheus_client_sockets_add(void)
+pgagroal_prometheus_network_sent_add(ssize_t s)
 {
-   struct prometheus* prometheus;
+   struct main_prometheus* prometheus;
 
    if (!is_prometheus_enabled())
    {
       return;
    }
 
-   prometheus = (struct prometheus*)prometheus_shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_add(&prometheus->client_sockets, 1);
+   counter_add(&prometheus->network_sent, s);
 }
 
 void
-pgagroal_prometheus_client_sockets_sub(void)
+pgagroal_prometheus_network_received_add(ssize_t s)
 {
-   struct prometheus* prometheus;
+   struct main_prometheus* prometheus;
 
    if (!is_prometheus_enabled())
    {
       return;
    }
 
-   prometheus = (struct prometheus*)prometheus_shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
 
-   atomic_fetch_sub(&prometheus->client_sockets, 1);
+   counter_add(&prometheus->network_received, s);
 }
 
 void
-pgagroal_prometheus_self_sockets_add(void)
+pgagroal_prometheus_local_query_count_add(int slot)
 {
-   struct prometheus* prometheus;
-
-   if (!is_prometheus_enabled())
+   /* The transaction pipelines change slot between transactions */
+   if (slot != local_slot)
    {
-      return;
+      local_slot_publish();
+      local_slot = slot;
    }
 
-   prometheus = (struct prometheus*)prometheus_shmem;
+   local_query_count++;
+   local_slot_query_count++;
+}
 
-   atomic_fetch_add(&prometheus->self_sockets, 1);
+void
+pgagroal_prometheus_local_network_sent_add(ssize_t s)
+{
+   local_network_sent += s;
 }
 
 void
-pgagroal_prometheus_self_sockets_sub(void)
+pgagroal_prometheus_local_network_received_add(ssize_t s)
 {
-   struct prometheus* prometheus;
+   local_network_received += s;
+}
 
-   if (!is_prometheus_enabled())
+void
+pgagroal_prometheus_local_write_blocked_add(bool client, long long usec)
+{
+   if (client)
    {
-      return;
+      local_client_write_blocked += usec;
+   }
+   else
+   {
+      local_server_write_blocked += usec;
    }
-
-   prometheus = (struct prometheus*)prometheus_shmem;
-
-   atomic_fetch_sub(&prometheus->self_sockets, 1);
 }
 
 void
-pgagroal_prometheus_clear(void)
+pgagroal_prometheus_local_accounting_start(int pipeline)
 {
-   signed char cache_is_free;
-   struct main_configuration* config;
-   struct main_prometheus* prometheus;
-   struct prometheus_cache* cache;
+   struct main_configuration* config = (struct main_configuration*)shmem;
 
-   if (!is_prometheus_enabled())
+   local_pipeline = -1;
+
+   if (!config->metrics_accounting || !is_prometheus_enabled() ||
+       pipeline < 0 || pipeline >= NUMBER_OF_PIPELINES)
    {
       return;
    }
 
-   config = (struct main_configuration*)shmem;
-   prometheus = (struct main_prometheus*)prometheus_shmem;
-   cache = (struct prometheus_cache*)prometheus_cache_shmem;
-
-   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+   if (getrusage(RUSAGE_SELF, &local_rusage))
    {
-      atomic_store(&prometheus->session_time[i], 0);
+      return;
    }
-   atomic_store(&prometheus->session_time_sum, 0);
 
-   atomic_store(&prometheus->connection_error, 0);
-   atomic_store(&prometheus->connection_kill, 0);
-   atomic_store(&prometheus->connection_remove, 0);
-   atomic_store(&prometheus->connection_timeout, 0);
-   atomic_store(&prometheus->connection_return, 0);
-   atomic_store(&prometheus->connection_invalid, 0);
-   atomic_store(&prometheus->connection_get, 0);
-   atomic_store(&prometheus->connection_idletimeout, 0);
-   atomic_store(&prometheus->connection_max_connection_age, 0);
-   atomic_store(&prometheus->connection_flush, 0);
-   atomic_store(&prometheus->connection_success, 0);
+   local_reads = 0;
+   local_writes = 0;
+   local_wakeups = 0;
+   local_server_since = 0;
+   local_client_since = 0;
+   local_server_blocked = 0;
+   local_client_blocked = 0;
+   memset(&local_tx_reads, 0, sizeof(local_tx_reads));
+   memset(&local_tx_writes, 0, sizeof(local_tx_writes));
+   memset(&local_tx_wakeups, 0, sizeof(local_tx_wakeups));
+   local_tx_reads_sum = 0;
+   local_tx_writes_sum = 0;
+   local_tx_wakeups_sum = 0;
+
+   local_pipeline = pipeline;
+}
 
-   atomic_store(&prometheus->prometheus_base.logging_info, 0);
-   atomic_store(&prometheus->prometheus_base.logging_warn, 0);
-   atomic_store(&prometheus->prometheus_base.logging_error, 0);
-   atomic_store(&prometheus->prometheus_base.logging_fatal, 0);
+void
+pgagroal_prometheus_local_accounting_stop(void)
+{
+   struct rusage usage;
+   struct prometheus_pipeline* pipeline;
+   struct main_prometheus* prometheus;
 
-   // awaiting connections are on hold due to `blocking_timeout`
-   atomic_store(&prometheus->connections_awaiting_total, 0);
-   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
+   if (local_pipeline == -1)
    {
-      atomic_store(&prometheus->connections_awaiting[i], 0);
+      return;
    }
 
-   atomic_store(&prometheus->auth_user_success, 0);
-   atomic_store(&prometheus->auth_user_bad_password, 0);
-   atomic_store(&prometheus->auth_user_error, 0);
-
-   atomic_store(&prometheus->client_active, 0);
-   atomic_store(&prometheus->client_wait, 0);
-   atomic_store(&prometheus->client_wait_time, 0);
+   local_accounting_publish();
 
-   atomic_store(&prometheus->query_count, 0);
-   atomic_store(&prometheus->tx_count, 0);
+   if (is_prometheus_enabled() && !getrusage(RUSAGE_SELF, &usage))
+   {
+      prometheus = (struct main_prometheus*)prometheus_shmem;
+      pipeline = &prometheus->pipelines[local_pipeline];
 
-   atomic_store(&prometheus->network_sent, 0);
-   atomic_store(&prometheus->network_received, 0);
+      latency_add(&pipeline->user_cpu,
+                  (usage.ru_utime.tv_sec - local_rusage.ru_utime.tv_sec) * 1000000LL +
+                  (usage.ru_utime.tv_usec - local_rusage.ru_utime.tv_usec));
+      latency_add(&pipeline->system_cpu,
+                  (usage.ru_stime.tv_sec - local_rusage.ru_stime.tv_sec) * 1000000LL +
+                  (usage.ru_stime.tv_usec - local_rusage.ru_stime.tv_usec));
+   }
 
-   atomic_store(&prometheus->prometheus_base.client_sockets, 0);
-   atomic_store(&prometheus->prometheus_base.self_sockets, 0);
+   local_pipeline = -1;
+}
 
-   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+void
+pgagroal_prometheus_local_read_add(bool client)
+{
+   if (local_pipeline == -1)
    {
-      atomic_store(&prometheus->server_error[i], 0);
+      return;
    }
 
-   for (int i = 0; i < config->max_connections; i++)
+   local_reads++;
+
+   /* A read ends the wait for the peer that was written to */
+   if (client)
    {
-      atomic_store(&prometheus->prometheus_connections[i].query_count, 0);
+      if (local_client_since > 0)
+      {
+         local_client_blocked += local_now() - local_client_since;
+         local_client_since = 0;
+      }
    }
-
-retry_cache_locking:
-   cache_is_free = STATE_FREE;
-   if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
+   else if (local_server_since > 0)
    {
-      metrics_cache_invalidate();
+      local_server_blocked += local_now() - local_server_since;
+      local_server_since = 0;
+   }
+}
+
+void
+pgagroal_prometheus_local_write_add(bool client)
+{
+   if (local_pipeline == -1)
+   {
+      return;
+   }
+
+   local_writes++;
+
+   if (client)
+   {
+      if (local_client_since == 0)
+      {
+         local_client_since = local_now();
+      }
+   }
+   else if (local_server_since == 0)
+   {
+      local_server_since = local_now();
+   }
+}
+
+void
+pgagroal_prometheus_local_wakeup_add(void)
+{
+   if (local_pipeline == -1)
+   {
+      return;
+   }
+
+   local_wakeups++;
+}
+
+void
+pgagroal_prometheus_local_transaction_end(void)
+{
+   if (local_pipeline == -1)
+   {
+      return;
+   }
+
+   local_tx_reads[local_count_bucket(local_reads)]++;
+   local_tx_writes[local_count_bucket(local_writes)]++;
+   local_tx_wakeups[local_count_bucket(local_wakeups)]++;
+   local_tx_reads_sum += local_reads;
+   local_tx_writes_sum += local_writes;
+   local_tx_wakeups_sum += local_wakeups;
+
+   local_reads = 0;
+   local_writes = 0;
+   local_wakeups = 0;
+}
+
+void
+pgagroal_prometheus_local_publish(void)
+{
+   struct main_prometheus* prometheus;
+
+   local_slot_publish();
+   local_accounting_publish();
+
+   if (is_prometheus_enabled())
+   {
+      prometheus = (struct main_prometheus*)prometheus_shmem;
+
+      if (local_query_count > 0)
+      {
+         counter_add(&prometheus->query_count, local_query_count);
+      }
+
+      if (local_network_sent > 0)
+      {
+         counter_add(&prometheus->network_sent, local_network_sent);
+      }
+
+      if (local_network_received > 0)
+      {
+         counter_add(&prometheus->network_received, local_network_received);
+      }
+
+      if (local_client_write_blocked > 0)
+      {
+         counter_add(&prometheus->client_write_blocked, local_client_write_blocked);
+      }
+
+      if (local_server_write_blocked > 0)
+      {
+         counter_add(&prometheus->server_write_blocked, local_server_write_blocked);
+      }
+   }
+
+   local_query_count = 0;
+   local_network_sent = 0;
+   local_network_received = 0;
+   local_client_write_blocked = 0;
+   local_server_write_blocked = 0;
+}
+
+void
+pgagroal_prometheus_client_sockets_add(void)
+{
+   struct prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->client_sockets, 1);
+}
+
+void
+pgagroal_prometheus_client_sockets_sub(void)
+{
+   struct prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct prometheus*)prometheus_shmem;
+
+   atomic_fetch_sub(&prometheus->client_sockets, 1);
+}
+
+void
+pgagroal_prometheus_self_sockets_add(void)
+{
+   struct prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->self_sockets, 1);
+}
+
+void
+pgagroal_prometheus_self_sockets_sub(void)
+{
+   struct prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct prometheus*)prometheus_shmem;
+
+   atomic_fetch_sub(&prometheus->self_sockets, 1);
+}
+
+void
+pgagroal_prometheus_clear(void)
+{
+   signed char cache_is_free;
+   struct main_configuration* config;
+   struct main_prometheus* prometheus;
+   struct prometheus_cache* cache;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   config = (struct main_configuration*)shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+   cache = (struct prometheus_cache*)prometheus_cache_shmem;
+
+   for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_store(&prometheus->session_time[i], 0);
+   }
+   atomic_store(&prometheus->session_time_sum, 0);
+
+   atomic_store(&prometheus->connection_error, 0);
+   atomic_store(&prometheus->connection_kill, 0);
+   atomic_store(&prometheus->connection_remove, 0);
+   atomic_store(&prometheus->connection_timeout, 0);
+   counter_reset(&prometheus->connection_return);
+   atomic_store(&prometheus->connection_invalid, 0);
+   counter_reset(&prometheus->connection_get);
+   atomic_store(&prometheus->connection_idletimeout, 0);
+   atomic_store(&prometheus->connection_max_connection_age, 0);
+   atomic_store(&prometheus->connection_flush, 0);
+   counter_reset(&prometheus->connection_success);
+
+   atomic_store(&prometheus->prometheus_base.logging_info, 0);
+   atomic_store(&prometheus->prometheus_base.logging_warn, 0);
+   atomic_store(&prometheus->prometheus_base.logging_error, 0);
+   atomic_store(&prometheus->prometheus_base.logging_fatal, 0);
+   atomic_store(&prometheus->prometheus_base.logging_dropped, 0);
+
+   // awaiting connections are on hold due to `blocking_timeout`
+   atomic_store(&prometheus->connections_awaiting_total, 0);
+   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
+   {
+      atomic_store(&prometheus->connections_awaiting[i], 0);
+   }
+
+   for (int i = 0; i <= NUMBER_OF_LIMITS; i++)
+   {
+      wait_reset(&prometheus->connection_wait[i]);
+   }
+
+   for (int i = 0; i < NUMBER_OF_DATABASE_METRICS; i++)
+   {
+      latency_reset(&prometheus->databases[i].transaction);
+      latency_reset(&prometheus->databases[i].service);
+   }
+
+   for (int i = 0; i < NUMBER_OF_PIPELINES; i++)
+   {
+      pipeline_reset(&prometheus->pipelines[i]);
+   }
+
+   queries_reset(&prometheus->queries);
+
+   atomic_store(&prometheus->auth_user_success, 0);
+   atomic_store(&prometheus->auth_user_bad_password, 0);
+   atomic_store(&prometheus->auth_user_error, 0);
+   atomic_store(&prometheus->client_rate_limited, 0);
+
+   counter_reset(&prometheus->client_active);
+   atomic_store(&prometheus->client_wait, 0);
+   atomic_store(&prometheus->client_wait_time, 0);
+
+   counter_reset(&prometheus->query_count);
+   counter_reset(&prometheus->tx_count);
+   for (int i = 0; i < NUMBER_OF_IDLE_TRANSACTION; i++)
+   {
+      atomic_store(&prometheus->idle_transaction_timeout[i], 0);
+   }
+   atomic_store(&prometheus->memory_pool_hits, 0);
+   atomic_store(&prometheus->memory_pool_misses, 0);
+
+   counter_reset(&prometheus->network_sent);
+   counter_reset(&prometheus->network_received);
+   counter_reset(&prometheus->client_write_blocked);
+   counter_reset(&prometheus->server_write_blocked);
+
+   atomic_store(&prometheus->prometheus_base.client_sockets, 0);
+   atomic_store(&prometheus->prometheus_base.self_sockets, 0);
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      atomic_store(&prometheus->server_error[i], 0);
+      backend_reset(&prometheus->backends[i]);
+   }
+
+   /* The running prefill rounds are still in progress */
+   atomic_store(&prometheus->prefill_created, 0);
+   atomic_store(&prometheus->prefill_failed, 0);
+
+   for (int i = 0; i < config->connection_slots; i++)
+   {
+      atomic_store(&prometheus->prometheus_connections[i].query_count, 0);
+   }
+
+retry_cache_locking:
+   cache_is_free = STATE_FREE;
+   if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
+   {
+      metrics_cache_invalidate();
 
       atomic_store(&cache->lock, STATE_FREE);
    }
@@ -1127,6 +1776,92 @@ pgagroal_prometheus_server_error(int server)
    atomic_fetch_add(&prometheus->server_error[server], 1);
 }
 
+void
+pgagroal_prometheus_backend_phase(int server, int phase, long long usec)
+{
+   struct main_prometheus* prometheus;
+
+   if (server < 0 || server >= NUMBER_OF_SERVERS || !is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   latency_add(&prometheus->backends[server].phases[phase], usec);
+}
+
+void
+pgagroal_prometheus_backend_created(int server, int reason)
+{
+   struct main_prometheus* prometheus;
+
+   if (server < 0 || server >= NUMBER_OF_SERVERS || !is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->backends[server].created[reason], 1);
+}
+
+void
+pgagroal_prometheus_prefill_start(int missing)
+{
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->prefill_active, 1);
+   atomic_fetch_add(&prometheus->prefill_pending, missing);
+}
+
+void
+pgagroal_prometheus_prefill_connection(bool created)
+{
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   atomic_fetch_sub(&prometheus->prefill_pending, 1);
+
+   if (created)
+   {
+      atomic_fetch_add(&prometheus->prefill_created, 1);
+   }
+   else
+   {
+      atomic_fetch_add(&prometheus->prefill_failed, 1);
+   }
+}
+
+void
+pgagroal_prometheus_prefill_end(int unstarted)
+{
+   struct main_prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   atomic_fetch_sub(&prometheus->prefill_pending, unstarted);
+   atomic_fetch_sub(&prometheus->prefill_active, 1);
+}
+
 void
 pgagroal_prometheus_failed_servers(void)
 {
@@ -1187,6 +1922,21 @@ pgagroal_prometheus_logging(int type)
    }
 }
 
+void
+pgagroal_prometheus_logging_dropped(void)
+{
+   struct prometheus* prometheus;
+
+   if (!is_prometheus_enabled())
+   {
+      return;
+   }
+
+   prometheus = (struct prometheus*)prometheus_shmem;
+
+   atomic_fetch_add(&prometheus->logging_dropped, 1);
+}
+
 static int
 redirect_page(SSL* client_ssl, int client_fd, char* path)
 {
@@ -1461,6 +2211,9 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <h2>pgagroal_logging_fatal</h2>\n");
    data = pgagroal_append(data, "  The number of FATAL logging statements\n");
    data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_logging_dropped</h2>\n");
+   data = pgagroal_append(data, "  The number of logging statements dropped by the asynchronous ring\n");
+   data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_server_error</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Errors for servers\n");
@@ -1525,6 +2278,26 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   The number of transactions. Only session and transaction modes are supported\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_idle_transaction_timeout</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The number of transactions that waited for the client longer than idle_transaction_timeout\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <table border=\"1\">\n");
+   data = pgagroal_append(data, "    <tbody>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>action</td>\n");
+   data = pgagroal_append(data, "        <td>The idle_transaction_action taken</td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "    </tbody>\n");
+   data = pgagroal_append(data, "  </table>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_memory_pool_hits</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The number of messages served from the message pool of finished clients\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_memory_pool_misses</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The number of messages that needed an allocation in finished clients\n");
+   data = pgagroal_append(data, "  </p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_active_connections</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   The number of active connections\n");
@@ -1626,6 +2399,14 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Histogram of session times\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_database_transaction_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Histogram of transaction times per database in the transaction pipeline\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_database_service_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Histogram of the time the server spent on the transactions per database in the transaction pipeline\n");
+   data = pgagroal_append(data, "  </p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_connection_error</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of connection errors\n");
@@ -1670,6 +2451,61 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of connection successes\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_connection_wait_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Histogram of the time clients without a limit rule waited for a connection\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_connection_wait_outcome</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of waits served by a pooled connection, a new connection or timed out\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_limit_wait_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Histogram of the time clients waited for a connection per limit rule\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_limit_wait_outcome</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of waits per limit rule served by a pooled connection, a new connection or timed out\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_server_backend_phase_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Histogram of the time of each phase of the creation of a backend per server\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <table>\n");
+   data = pgagroal_append(data, "    <tbody>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>name</td>\n");
+   data = pgagroal_append(data, "        <td>The name of the server</td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>phase</td>\n");
+   data = pgagroal_append(data, "        <td>The phase\n");
+   data = pgagroal_append(data, "          <ul>\n");
+   data = pgagroal_append(data, "            <li>connect</li>\n");
+   data = pgagroal_append(data, "            <li>tls</li>\n");
+   data = pgagroal_append(data, "            <li>authentication</li>\n");
+   data = pgagroal_append(data, "            <li>parameters</li>\n");
+   data = pgagroal_append(data, "          </ul>\n");
+   data = pgagroal_append(data, "        </td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "    </tbody>\n");
+   data = pgagroal_append(data, "  </table>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_server_backends_created</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of backends created per server for a client (demand), by prefill or to replace an aged backend (recycle)\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_prefill_active</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of prefill rounds running\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_prefill_pending</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of connections the running prefill rounds still create\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_prefill_connections</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of connections prefill created or failed to create\n");
+   data = pgagroal_append(data, "  </p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_connection_awaiting</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of connection suspended due to <i>blocking_timeout</i>\n");
@@ -1686,6 +2522,10 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of errors during user authentication\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_client_rate_limited</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of clients rejected by client_connection_rate\n");
+   data = pgagroal_append(data, "  </p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_client_wait</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of waiting clients\n");
@@ -1694,6 +2534,18 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of active clients\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_client_state</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   Number of clients per state\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <table border=\"1\">\n");
+   data = pgagroal_append(data, "    <tbody>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>state</td>\n");
+   data = pgagroal_append(data, "        <td>The state of the client: starting, idle, active or idle_in_transaction</td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "    </tbody>\n");
+   data = pgagroal_append(data, "  </table>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_network_sent</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Bytes sent by clients. Only session and transaction modes are supported\n");
@@ -1702,6 +2554,70 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Bytes received from servers. Only session and transaction modes are supported\n");
    data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_client_write_blocked_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The time writes waited for clients to read\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_server_write_blocked_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The time writes waited for servers to read\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_user_cpu_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The user CPU time of the sessions per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_system_cpu_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The system CPU time of the sessions per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_transaction_reads</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The reads per transaction per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_transaction_writes</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The writes per transaction per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_transaction_wakeups</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The event loop wakeups per transaction per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_server_blocked_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The time waited for the server to reply per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_pipeline_client_blocked_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The time waited for the client to send per pipeline, with metrics_accounting\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_query_calls</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The estimated calls of the most called query fingerprints, with query_statistics\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <table border=\"1\">\n");
+   data = pgagroal_append(data, "    <tbody>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>fingerprint</td>\n");
+   data = pgagroal_append(data, "        <td>The fingerprint</td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "      <tr>\n");
+   data = pgagroal_append(data, "        <td>query</td>\n");
+   data = pgagroal_append(data, "        <td>The normalized query</td>\n");
+   data = pgagroal_append(data, "      </tr>\n");
+   data = pgagroal_append(data, "    </tbody>\n");
+   data = pgagroal_append(data, "  </table>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_query_calls_error</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The upper bound of the over counted calls of a query fingerprint, with query_statistics\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_query_seconds</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The estimated backend time of the most called query fingerprints, with query_statistics\n");
+   data = pgagroal_append(data, "  </p>\n");
+   data = pgagroal_append(data, "  <h2>pgagroal_query_rows</h2>\n");
+   data = pgagroal_append(data, "  <p>\n");
+   data = pgagroal_append(data, "   The estimated rows of the most called query fingerprints, with query_statistics\n");
+   data = pgagroal_append(data, "  </p>\n");
    data = pgagroal_append(data, "  <h2>pgagroal_client_sockets</h2>\n");
    data = pgagroal_append(data, "  <p>\n");
    data = pgagroal_append(data, "   Number of sockets the client used\n");
@@ -2080,17 +2996,7 @@ retry_cache_locking:
             goto error;
          }
 
-         general_information(container);
-         connection_information(container);
-         limit_information(container);
-         session_information(container);
-         pool_information(container);
-         auth_information(container);
-         client_information(container);
-         internal_information(container);
-         connection_awaiting_information(container);
-         write_os_kernel_version(container);
-         certificate_information(container);
+         collect_metrics(container);
 
          /* Output ART metrics */
          output_all_metrics(client_ssl, client_fd, container);
@@ -2298,7 +3204,9 @@ bad_request(SSL* client_ssl, int client_fd)
 static void
 general_information(prometheus_metrics_container_t* container)
 {
+   char line[MISC_LENGTH + MAX_USERNAME_LENGTH + MAX_DATABASE_LENGTH + MAX_APPLICATION_NAME];
    char* data = NULL;
+   struct exposition series = {0};
    struct main_configuration* config;
    struct main_prometheus* prometheus;
 
@@ -2415,6 +3323,15 @@ general_information(prometheus_metrics_container_t* container)
    free(data);
    data = NULL;
 
+   data = pgagroal_append(data, "#HELP pgagroal_logging_dropped The number of logging statements dropped by the asynchronous ring\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_logging_dropped counter\n");
+   data = pgagroal_append(data, "pgagroal_logging_dropped ");
+   data = pgagroal_append_ulong(data, atomic_load(&prometheus->prometheus_base.logging_dropped));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgagroal_logging_dropped", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
    data = pgagroal_append(data, "#HELP pgagroal_failed_servers The number of failed servers\n");
    data = pgagroal_append(data, "#TYPE pgagroal_failed_servers gauge\n");
    data = pgagroal_append(data, "pgagroal_failed_servers ");
@@ -2496,52 +3413,69 @@ general_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_query_count The number of queries\n");
    data = pgagroal_append(data, "#TYPE pgagroal_query_count counter\n");
    data = pgagroal_append(data, "pgagroal_query_count ");
-   data = pgagroal_append_ullong(data, atomic_load(&prometheus->query_count));
+   data = pgagroal_append_ullong(data, counter_value(&prometheus->query_count));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->general_metrics, "pgagroal_query_count", data, NULL, NULL, 0);
    free(data);
    data = NULL;
 
-   data = pgagroal_append(data, "#HELP pgagroal_connection_query_count The number of queries per connection\n");
-   data = pgagroal_append(data, "#TYPE pgagroal_connection_query_count counter\n");
+   exposition_append_string(&series, "#HELP pgagroal_connection_query_count The number of queries per connection\n");
+   exposition_append_string(&series, "#TYPE pgagroal_connection_query_count counter\n");
    for (int i = 0; i < config->max_connections; i++)
    {
-      data = pgagroal_append(data, "pgagroal_connection_query_count{");
-
-      data = pgagroal_append(data, "id=\"");
-      data = pgagroal_append_int(data, i);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "user=\"");
-      data = pgagroal_append(data, config->connections[i].username);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "database=\"");
-      data = pgagroal_append(data, config->connections[i].database);
-      data = pgagroal_append(data, "\",");
+      int length;
 
-      data = pgagroal_append(data, "application_name=\"");
-      data = pgagroal_append(data, config->connections[i].appname);
-      data = pgagroal_append(data, "\"} ");
+      length = pgagroal_snprintf(&line[0], sizeof(line),
+                                 "pgagroal_connection_query_count{id=\"%d\",user=\"%s\",database=\"%s\",application_name=\"%s\"} %llu\n",
+                                 i, pgagroal_connection_info(i)->username, pgagroal_connection_info(i)->database,
+                                 pgagroal_connection_info(i)->appname,
+                                 (unsigned long long)atomic_load(&prometheus->prometheus_connections[i].query_count));
 
-      data = pgagroal_append_ullong(data, atomic_load(&prometheus->prometheus_connections[i].query_count));
-      data = pgagroal_append(data, "\n");
-   }
-   if (data != NULL)
-   {
-      add_metric_to_art(container->general_metrics, "pgagroal_connection_query_count", data, NULL, NULL, 0);
-      free(data);
-      data = NULL;
+      exposition_append(&series, &line[0], MIN((size_t)length, sizeof(line) - 1));
    }
+   add_metric_to_art(container->general_metrics, "pgagroal_connection_query_count", series.data, NULL, NULL, 0);
+   free(series.data);
 
    data = pgagroal_append(data, "#HELP pgagroal_tx_count The number of transactions\n");
    data = pgagroal_append(data, "#TYPE pgagroal_tx_count counter\n");
    data = pgagroal_append(data, "pgagroal_tx_count ");
-   data = pgagroal_append_ullong(data, atomic_load(&prometheus->tx_count));
+   data = pgagroal_append_ullong(data, counter_value(&prometheus->tx_count));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->general_metrics, "pgagroal_tx_count", data, NULL, NULL, 0);
    free(data);
    data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_idle_transaction_timeout The number of transactions idle for longer than idle_transaction_timeout\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_idle_transaction_timeout counter\n");
+   for (int i = 0; i < NUMBER_OF_IDLE_TRANSACTION; i++)
+   {
+      data = pgagroal_append(data, "pgagroal_idle_transaction_timeout{action=\"");
+      data = pgagroal_append(data, i == IDLE_TRANSACTION_WARN ? "warn" : (i == IDLE_TRANSACTION_CANCEL ? "cancel" : "rollback"));
+      data = pgagroal_append(data, "\"} ");
+      data = pgagroal_append_ulong(data, atomic_load(&prometheus->idle_transaction_timeout[i]));
+      data = pgagroal_append(data, "\n");
+   }
+   add_metric_to_art(container->general_metrics, "pgagroal_idle_transaction_timeout", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_memory_pool_hits The number of messages served from the message pool\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_memory_pool_hits counter\n");
+   data = pgagroal_append(data, "pgagroal_memory_pool_hits ");
+   data = pgagroal_append_ullong(data, atomic_load(&prometheus->memory_pool_hits));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgagroal_memory_pool_hits", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_memory_pool_misses The number of messages that needed an allocation\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_memory_pool_misses counter\n");
+   data = pgagroal_append(data, "pgagroal_memory_pool_misses ");
+   data = pgagroal_append_ullong(data, atomic_load(&prometheus->memory_pool_misses));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgagroal_memory_pool_misses", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
 }
 
 static void
@@ -2592,7 +3526,9 @@ general_vault_information(prometheus_metrics_container_t* container)
 static void
 connection_information(prometheus_metrics_container_t* container)
 {
+   char line[MISC_LENGTH + MAX_USERNAME_LENGTH + MAX_DATABASE_LENGTH + MAX_APPLICATION_NAME];
    char* data = NULL;
+   struct exposition series = {0};
    int active;
    int total;
    struct main_configuration* config;
@@ -2605,146 +3541,105 @@ connection_information(prometheus_metrics_container_t* container)
    for (int i = 0; i < config->max_connections; i++)
    {
       int state = atomic_load(&config->states[i]);
-      switch (state)
-      {
-         case STATE_IN_USE:
-         case STATE_GRACEFULLY:
-            active++;
-            __attribute__((fallthrough));
-         case STATE_INIT:
-         case STATE_FREE:
-         case STATE_FLUSH:
-         case STATE_IDLE_CHECK:
-         case STATE_MAX_CONNECTION_AGE:
-         case STATE_VALIDATION:
-         case STATE_REMOVE:
-            total++;
-            break;
-         default:
-            break;
-      }
-   }
-
-   data = pgagroal_append(data, "#HELP pgagroal_active_connections The number of active connections\n");
-   data = pgagroal_append(data, "#TYPE pgagroal_active_connections gauge\n");
-   data = pgagroal_append(data, "pgagroal_active_connections ");
-   data = pgagroal_append_int(data, active);
-   data = pgagroal_append(data, "\n");
-   add_metric_to_art(container->connection_metrics, "pgagroal_active_connections", data, NULL, NULL, 0);
-   free(data);
-   data = NULL;
-
-   data = pgagroal_append(data, "#HELP pgagroal_total_connections The total number of connections\n");
-   data = pgagroal_append(data, "#TYPE pgagroal_total_connections gauge\n");
-   data = pgagroal_append(data, "pgagroal_total_connections ");
-   data = pgagroal_append_int(data, total);
-   data = pgagroal_append(data, "\n");
-   add_metric_to_art(container->connection_metrics, "pgagroal_total_connections", data, NULL, NULL, 0);
-   free(data);
-   data = NULL;
-
-   data = pgagroal_append(data, "#HELP pgagroal_max_connections The maximum number of connections\n");
-   data = pgagroal_append(data, "#TYPE pgagroal_max_connections counter\n");
-   data = pgagroal_append(data, "pgagroal_max_connections ");
-   data = pgagroal_append_int(data, config->max_connections);
-   data = pgagroal_append(data, "\n");
-   add_metric_to_art(container->connection_metrics, "pgagroal_max_connections", data, NULL, NULL, 0);
-   free(data);
-   data = NULL;
-
-   data = pgagroal_append(data, "#HELP pgagroal_connection The connection information\n");
-   data = pgagroal_append(data, "#TYPE pgagroal_connection gauge\n");
-   for (int i = 0; i < config->max_connections; i++)
-   {
-      int state = atomic_load(&config->states[i]);
-
-      data = pgagroal_append(data, "pgagroal_connection{");
-
-      data = pgagroal_append(data, "id=\"");
-      data = pgagroal_append_int(data, i);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "user=\"");
-      data = pgagroal_append(data, config->connections[i].username);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "database=\"");
-      data = pgagroal_append(data, config->connections[i].database);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "application_name=\"");
-      data = pgagroal_append(data, config->connections[i].appname);
-      data = pgagroal_append(data, "\",");
-
-      data = pgagroal_append(data, "state=\"");
-
-      switch (state)
-      {
-         case STATE_NOTINIT:
-            data = pgagroal_append(data, "not_init");
-            break;
-         case STATE_INIT:
-            data = pgagroal_append(data, "init");
-            break;
-         case STATE_FREE:
-            data = pgagroal_append(data, "free");
-            break;
-         case STATE_IN_USE:
-            data = pgagroal_append(data, "in_use");
-            break;
-         case STATE_GRACEFULLY:
-            data = pgagroal_append(data, "gracefully");
-            break;
-         case STATE_FLUSH:
-            data = pgagroal_append(data, "flush");
-            break;
-         case STATE_IDLE_CHECK:
-            data = pgagroal_append(data, "idle_check");
-            break;
-         case STATE_MAX_CONNECTION_AGE:
-            data = pgagroal_append(data, "max_connection_age");
-            break;
-         case STATE_VALIDATION:
-            data = pgagroal_append(data, "validation");
-            break;
-         case STATE_REMOVE:
-            data = pgagroal_append(data, "remove");
-            break;
-         default:
-            break;
-      }
-
-      data = pgagroal_append(data, "\"} ");
-
-      switch (state)
-      {
-         case STATE_NOTINIT:
-            data = pgagroal_append(data, "0");
-            break;
-         case STATE_INIT:
-         case STATE_FREE:
+      switch (state)
+      {
          case STATE_IN_USE:
          case STATE_GRACEFULLY:
+            active++;
+            __attribute__((fallthrough));
+         case STATE_INIT:
+         case STATE_FREE:
          case STATE_FLUSH:
          case STATE_IDLE_CHECK:
          case STATE_MAX_CONNECTION_AGE:
          case STATE_VALIDATION:
          case STATE_REMOVE:
-            data = pgagroal_append(data, "1");
+            total++;
             break;
          default:
             break;
       }
-
-      data = pgagroal_append(data, "\n");
    }
 
-   if (data != NULL)
+   data = pgagroal_append(data, "#HELP pgagroal_active_connections The number of active connections\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_active_connections gauge\n");
+   data = pgagroal_append(data, "pgagroal_active_connections ");
+   data = pgagroal_append_int(data, active);
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->connection_metrics, "pgagroal_active_connections", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_total_connections The total number of connections\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_total_connections gauge\n");
+   data = pgagroal_append(data, "pgagroal_total_connections ");
+   data = pgagroal_append_int(data, total);
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->connection_metrics, "pgagroal_total_connections", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_max_connections The maximum number of connections\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_max_connections counter\n");
+   data = pgagroal_append(data, "pgagroal_max_connections ");
+   data = pgagroal_append_int(data, config->max_connections);
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->connection_metrics, "pgagroal_max_connections", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   /* One line per connection, so the series are rendered with a known length */
+   exposition_append_string(&series, "#HELP pgagroal_connection The connection information\n");
+   exposition_append_string(&series, "#TYPE pgagroal_connection gauge\n");
+   for (int i = 0; i < config->max_connections; i++)
    {
-      add_metric_to_art(container->connection_metrics, "pgagroal_connection", data, NULL, NULL, 0);
-      free(data);
-      data = NULL;
+      int state = atomic_load(&config->states[i]);
+      char* name = connection_state_name(state);
+      int length;
+
+      length = pgagroal_snprintf(&line[0], sizeof(line),
+                                 "pgagroal_connection{id=\"%d\",user=\"%s\",database=\"%s\",application_name=\"%s\",state=\"%s\"} %s\n",
+                                 i, pgagroal_connection_info(i)->username, pgagroal_connection_info(i)->database,
+                                 pgagroal_connection_info(i)->appname, name,
+                                 state == STATE_NOTINIT ? "0" : (strlen(name) > 0 ? "1" : ""));
+
+      exposition_append(&series, &line[0], MIN((size_t)length, sizeof(line) - 1));
+   }
+
+   add_metric_to_art(container->connection_metrics, "pgagroal_connection", series.data, NULL, NULL, 0);
+   free(series.data);
+}
+
+static char*
+connection_state_name(int state)
+{
+   switch (state)
+   {
+      case STATE_NOTINIT:
+         return "not_init";
+      case STATE_INIT:
+         return "init";
+      case STATE_FREE:
+         return "free";
+      case STATE_IN_USE:
+         return "in_use";
+      case STATE_GRACEFULLY:
+         return "gracefully";
+      case STATE_FLUSH:
+         return "flush";
+      case STATE_IDLE_CHECK:
+         return "idle_check";
+      case STATE_MAX_CONNECTION_AGE:
+         return "max_connection_age";
+      case STATE_VALIDATION:
+         return "validation";
+      case STATE_REMOVE:
+         return "remove";
+      default:
+         break;
    }
+
+   return "";
 }
 
 static void
@@ -2830,6 +3725,20 @@ limit_information(prometheus_metrics_container_t* container)
          data = pgagroal_append(data, "type=\"backend\"} ");
          data = pgagroal_append_int(data, config->limits[i].backend_connections);
          data = pgagroal_append(data, "\n");
+
+         data = pgagroal_append(data, "pgagroal_limit{");
+
+         data = pgagroal_append(data, "user=\"");
+         data = pgagroal_append(data, config->limits[i].username);
+         data = pgagroal_append(data, "\",");
+
+         data = pgagroal_append(data, "database=\"");
+         data = pgagroal_append(data, config->limits[i].database);
+         data = pgagroal_append(data, "\",");
+
+         data = pgagroal_append(data, "type=\"adaptive\"} ");
+         data = pgagroal_append_int(data, atomic_load(&config->limit_demands[i].target));
+         data = pgagroal_append(data, "\n");
       }
 
       if (data != NULL)
@@ -3047,7 +3956,7 @@ pool_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_connection_return Number of connection returns\n");
    data = pgagroal_append(data, "#TYPE pgagroal_connection_return counter\n");
    data = pgagroal_append(data, "pgagroal_connection_return ");
-   data = pgagroal_append_ulong(data, atomic_load(&prometheus->connection_return));
+   data = pgagroal_append_ulong(data, (unsigned long)counter_value(&prometheus->connection_return));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->pool_metrics, "pgagroal_connection_return", data, NULL, NULL, 0);
    free(data);
@@ -3065,7 +3974,7 @@ pool_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_connection_get Number of connection gets\n");
    data = pgagroal_append(data, "#TYPE pgagroal_connection_get counter\n");
    data = pgagroal_append(data, "pgagroal_connection_get ");
-   data = pgagroal_append_ulong(data, atomic_load(&prometheus->connection_get));
+   data = pgagroal_append_ulong(data, (unsigned long)counter_value(&prometheus->connection_get));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->pool_metrics, "pgagroal_connection_get", data, NULL, NULL, 0);
    free(data);
@@ -3101,7 +4010,7 @@ pool_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_connection_success Number of connection successes\n");
    data = pgagroal_append(data, "#TYPE pgagroal_connection_success counter\n");
    data = pgagroal_append(data, "pgagroal_connection_success ");
-   data = pgagroal_append_ulong(data, atomic_load(&prometheus->connection_success));
+   data = pgagroal_append_ulong(data, (unsigned long)counter_value(&prometheus->connection_success));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->pool_metrics, "pgagroal_connection_success", data, NULL, NULL, 0);
    free(data);
@@ -3142,12 +4051,22 @@ auth_information(prometheus_metrics_container_t* container)
    add_metric_to_art(container->auth_metrics, "pgagroal_auth_user_error", data, NULL, NULL, 0);
    free(data);
    data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_client_rate_limited Number of clients rejected by client_connection_rate\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_client_rate_limited counter\n");
+   data = pgagroal_append(data, "pgagroal_client_rate_limited ");
+   data = pgagroal_append_ulong(data, atomic_load(&prometheus->client_rate_limited));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->auth_metrics, "pgagroal_client_rate_limited", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
 }
 
 static void
 client_information(prometheus_metrics_container_t* container)
 {
    char* data = NULL;
+   int counts[ACTIVITY_STATES];
    struct main_prometheus* prometheus;
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
@@ -3164,17 +4083,35 @@ client_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_client_active Number of active clients\n");
    data = pgagroal_append(data, "#TYPE pgagroal_client_active gauge\n");
    data = pgagroal_append(data, "pgagroal_client_active ");
-   data = pgagroal_append_ulong(data, atomic_load(&prometheus->client_active));
+   data = pgagroal_append_ulong(data, (unsigned long)counter_value(&prometheus->client_active));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->client_metrics, "pgagroal_client_active", data, NULL, NULL, 0);
    free(data);
    data = NULL;
+
+   pgagroal_activity_count(&counts[0]);
+
+   data = pgagroal_append(data, "#HELP pgagroal_client_state Number of clients per state\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_client_state gauge\n");
+   for (int i = 0; i < ACTIVITY_STATES; i++)
+   {
+      data = pgagroal_append(data, "pgagroal_client_state{state=\"");
+      data = pgagroal_append(data, pgagroal_activity_state_name(i));
+      data = pgagroal_append(data, "\"} ");
+      data = pgagroal_append_int(data, counts[i]);
+      data = pgagroal_append(data, "\n");
+   }
+   add_metric_to_art(container->client_metrics, "pgagroal_client_state", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
 }
 
 static void
 internal_information(prometheus_metrics_container_t* container)
 {
    char* data = NULL;
+   char seconds[64];
+   unsigned long long usec;
    struct main_prometheus* prometheus;
 
    prometheus = (struct main_prometheus*)prometheus_shmem;
@@ -3182,7 +4119,7 @@ internal_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_network_sent Bytes sent by clients\n");
    data = pgagroal_append(data, "#TYPE pgagroal_network_sent gauge\n");
    data = pgagroal_append(data, "pgagroal_network_sent ");
-   data = pgagroal_append_ullong(data, atomic_load(&prometheus->network_sent));
+   data = pgagroal_append_ullong(data, counter_value(&prometheus->network_sent));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->internal_metrics, "pgagroal_network_sent", data, NULL, NULL, 0);
    free(data);
@@ -3191,12 +4128,38 @@ internal_information(prometheus_metrics_container_t* container)
    data = pgagroal_append(data, "#HELP pgagroal_network_received Bytes received from servers\n");
    data = pgagroal_append(data, "#TYPE pgagroal_network_received gauge\n");
    data = pgagroal_append(data, "pgagroal_network_received ");
-   data = pgagroal_append_ullong(data, atomic_load(&prometheus->network_received));
+   data = pgagroal_append_ullong(data, counter_value(&prometheus->network_received));
    data = pgagroal_append(data, "\n");
    add_metric_to_art(container->internal_metrics, "pgagroal_network_received", data, NULL, NULL, 0);
    free(data);
    data = NULL;
 
+   usec = counter_value(&prometheus->client_write_blocked);
+   memset(&seconds, 0, sizeof(seconds));
+   pgagroal_snprintf(&seconds[0], sizeof(seconds), "%llu.%06llu", usec / 1000000, usec % 1000000);
+
+   data = pgagroal_append(data, "#HELP pgagroal_client_write_blocked_seconds The time writes waited for clients to read\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_client_write_blocked_seconds counter\n");
+   data = pgagroal_append(data, "pgagroal_client_write_blocked_seconds ");
+   data = pgagroal_append(data, &seconds[0]);
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->internal_metrics, "pgagroal_client_write_blocked_seconds", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   usec = counter_value(&prometheus->server_write_blocked);
+   memset(&seconds, 0, sizeof(seconds));
+   pgagroal_snprintf(&seconds[0], sizeof(seconds), "%llu.%06llu", usec / 1000000, usec % 1000000);
+
+   data = pgagroal_append(data, "#HELP pgagroal_server_write_blocked_seconds The time writes waited for servers to read\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_server_write_blocked_seconds counter\n");
+   data = pgagroal_append(data, "pgagroal_server_write_blocked_seconds ");
+   data = pgagroal_append(data, &seconds[0]);
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->internal_metrics, "pgagroal_server_write_blocked_seconds", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
    data = pgagroal_append(data, "#HELP pgagroal_client_sockets Number of sockets the client used\n");
    data = pgagroal_append(data, "#TYPE pgagroal_client_sockets gauge\n");
    data = pgagroal_append(data, "pgagroal_client_sockets ");
@@ -3284,17 +4247,481 @@ connection_awaiting_information(prometheus_metrics_container_t* container)
          data = pgagroal_append(data, config->limits[i].database);
          data = pgagroal_append(data, "\"} ");
 
-         data = pgagroal_append_ulong(data, atomic_load(&prometheus->connections_awaiting[i]));
-         data = pgagroal_append(data, "\n");
-      }
+         data = pgagroal_append_ulong(data, atomic_load(&prometheus->connections_awaiting[i]));
+         data = pgagroal_append(data, "\n");
+      }
+
+      if (data != NULL)
+      {
+         add_metric_to_art(container->awaiting_metrics, "pgagroal_limit_awaiting", data, NULL, NULL, 0);
+         free(data);
+         data = NULL;
+      }
+   }
+}
+
+static void
+wait_information(prometheus_metrics_container_t* container)
+{
+   char labels[MISC_LENGTH + MAX_USERNAME_LENGTH + MAX_DATABASE_LENGTH];
+   char* data = NULL;
+   struct prometheus_wait* wait;
+   struct main_configuration* config;
+   struct main_prometheus* prometheus;
+
+   config = (struct main_configuration*)shmem;
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   data = pgagroal_append(data, "#HELP pgagroal_connection_wait_seconds The time clients without a limit rule waited for a connection\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_connection_wait_seconds histogram\n");
+   data = append_latency(data, "pgagroal_connection_wait_seconds", "", &prometheus->connection_wait[0].time);
+   add_metric_to_art(container->awaiting_metrics, "pgagroal_connection_wait_seconds", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   wait = &prometheus->connection_wait[0];
+   data = pgagroal_append(data, "#HELP pgagroal_connection_wait_outcome The outcome of the waits of clients without a limit rule\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_connection_wait_outcome counter\n");
+   data = pgagroal_append(data, "pgagroal_connection_wait_outcome{outcome=\"reuse\"} ");
+   data = pgagroal_append_ulong(data, atomic_load(&wait->reuse));
+   data = pgagroal_append(data, "\n");
+   data = pgagroal_append(data, "pgagroal_connection_wait_outcome{outcome=\"new\"} ");
+   data = pgagroal_append_ulong(data, atomic_load(&wait->created));
+   data = pgagroal_append(data, "\n");
+   data = pgagroal_append(data, "pgagroal_connection_wait_outcome{outcome=\"timeout\"} ");
+   data = pgagroal_append_ulong(data, atomic_load(&wait->timeout));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->awaiting_metrics, "pgagroal_connection_wait_outcome", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   if (config->number_of_limits > 0)
+   {
+      data = pgagroal_append(data, "#HELP pgagroal_limit_wait_seconds The time clients waited for a connection per limit rule\n");
+      data = pgagroal_append(data, "#TYPE pgagroal_limit_wait_seconds histogram\n");
+      for (int i = 0; i < config->number_of_limits; i++)
+      {
+         memset(&labels, 0, sizeof(labels));
+         pgagroal_snprintf(&labels[0], sizeof(labels), "user=\"%s\",database=\"%s\"",
+                           config->limits[i].username, config->limits[i].database);
+
+         data = append_latency(data, "pgagroal_limit_wait_seconds", &labels[0], &prometheus->connection_wait[i + 1].time);
+      }
+      add_metric_to_art(container->awaiting_metrics, "pgagroal_limit_wait_seconds", data, NULL, NULL, 0);
+      free(data);
+      data = NULL;
+
+      data = pgagroal_append(data, "#HELP pgagroal_limit_wait_outcome The outcome of the waits per limit rule\n");
+      data = pgagroal_append(data, "#TYPE pgagroal_limit_wait_outcome counter\n");
+      for (int i = 0; i < config->number_of_limits; i++)
+      {
+         wait = &prometheus->connection_wait[i + 1];
+
+         memset(&labels, 0, sizeof(labels));
+         pgagroal_snprintf(&labels[0], sizeof(labels), "user=\"%s\",database=\"%s\"",
+                           config->limits[i].username, config->limits[i].database);
+
+         data = pgagroal_append(data, "pgagroal_limit_wait_outcome{");
+         data = pgagroal_append(data, &labels[0]);
+         data = pgagroal_append(data, ",outcome=\"reuse\"} ");
+         data = pgagroal_append_ulong(data, atomic_load(&wait->reuse));
+         data = pgagroal_append(data, "\n");
+         data = pgagroal_append(data, "pgagroal_limit_wait_outcome{");
+         data = pgagroal_append(data, &labels[0]);
+         data = pgagroal_append(data, ",outcome=\"new\"} ");
+         data = pgagroal_append_ulong(data, atomic_load(&wait->created));
+         data = pgagroal_append(data, "\n");
+         data = pgagroal_append(data, "pgagroal_limit_wait_outcome{");
+         data = pgagroal_append(data, &labels[0]);
+         data = pgagroal_append(data, ",outcome=\"timeout\"} ");
+         data = pgagroal_append_ulong(data, atomic_load(&wait->timeout));
+         data = pgagroal_append(data, "\n");
+      }
+      add_metric_to_art(container->awaiting_metrics, "pgagroal_limit_wait_outcome", data, NULL, NULL, 0);
+      free(data);
+      data = NULL;
+   }
+}
+
+static void
+database_information(prometheus_metrics_container_t* container)
+{
+   char labels[MAX_DATABASE_LENGTH + MISC_LENGTH];
+   char* transaction = NULL;
+   char* service = NULL;
+   struct prometheus_database* entry;
+   struct main_prometheus* prometheus;
+
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   for (int i = 0; i < NUMBER_OF_DATABASE_METRICS; i++)
+   {
+      entry = &prometheus->databases[i];
+
+      if (atomic_load(&entry->state) != DATABASE_USED)
+      {
+         continue;
+      }
+
+      if (transaction == NULL)
+      {
+         transaction = pgagroal_append(transaction, "#HELP pgagroal_database_transaction_seconds The transaction times per database\n");
+         transaction = pgagroal_append(transaction, "#TYPE pgagroal_database_transaction_seconds histogram\n");
+         service = pgagroal_append(service, "#HELP pgagroal_database_service_seconds The time the server spent on the transactions per database\n");
+         service = pgagroal_append(service, "#TYPE pgagroal_database_service_seconds histogram\n");
+      }
+
+      memset(&labels, 0, sizeof(labels));
+      pgagroal_snprintf(&labels[0], sizeof(labels), "database=\"%s\"", entry->database);
+
+      transaction = append_latency(transaction, "pgagroal_database_transaction_seconds", &labels[0], &entry->transaction);
+      service = append_latency(service, "pgagroal_database_service_seconds", &labels[0], &entry->service);
+   }
+
+   if (transaction != NULL)
+   {
+      add_metric_to_art(container->session_metrics, "pgagroal_database_transaction_seconds", transaction, NULL, NULL, 0);
+      add_metric_to_art(container->session_metrics, "pgagroal_database_service_seconds", service, NULL, NULL, 0);
+   }
+
+   free(transaction);
+   free(service);
+}
+
+static void
+pipeline_information(prometheus_metrics_container_t* container)
+{
+   char labels[MISC_LENGTH];
+   char seconds[64];
+   unsigned long long usec;
+   char* user_cpu = NULL;
+   char* system_cpu = NULL;
+   char* reads = NULL;
+   char* writes = NULL;
+   char* wakeups = NULL;
+   char* server_blocked = NULL;
+   char* client_blocked = NULL;
+   struct prometheus_pipeline* pipeline;
+   struct main_configuration* config;
+   struct main_prometheus* prometheus;
+
+   config = (struct main_configuration*)shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   if (!config->metrics_accounting)
+   {
+      return;
+   }
+
+   user_cpu = pgagroal_append(user_cpu, "#HELP pgagroal_pipeline_user_cpu_seconds The user CPU time of the sessions per pipeline\n");
+   user_cpu = pgagroal_append(user_cpu, "#TYPE pgagroal_pipeline_user_cpu_seconds histogram\n");
+   system_cpu = pgagroal_append(system_cpu, "#HELP pgagroal_pipeline_system_cpu_seconds The system CPU time of the sessions per pipeline\n");
+   system_cpu = pgagroal_append(system_cpu, "#TYPE pgagroal_pipeline_system_cpu_seconds histogram\n");
+   reads = pgagroal_append(reads, "#HELP pgagroal_pipeline_transaction_reads The reads per transaction per pipeline\n");
+   reads = pgagroal_append(reads, "#TYPE pgagroal_pipeline_transaction_reads histogram\n");
+   writes = pgagroal_append(writes, "#HELP pgagroal_pipeline_transaction_writes The writes per transaction per pipeline\n");
+   writes = pgagroal_append(writes, "#TYPE pgagroal_pipeline_transaction_writes histogram\n");
+   wakeups = pgagroal_append(wakeups, "#HELP pgagroal_pipeline_transaction_wakeups The event loop wakeups per transaction per pipeline\n");
+   wakeups = pgagroal_append(wakeups, "#TYPE pgagroal_pipeline_transaction_wakeups histogram\n");
+   server_blocked = pgagroal_append(server_blocked, "#HELP pgagroal_pipeline_server_blocked_seconds The time waited for the server to reply per pipeline\n");
+   server_blocked = pgagroal_append(server_blocked, "#TYPE pgagroal_pipeline_server_blocked_seconds counter\n");
+   client_blocked = pgagroal_append(client_blocked, "#HELP pgagroal_pipeline_client_blocked_seconds The time waited for the client to send per pipeline\n");
+   client_blocked = pgagroal_append(client_blocked, "#TYPE pgagroal_pipeline_client_blocked_seconds counter\n");
+
+   for (int i = 0; i < NUMBER_OF_PIPELINES; i++)
+   {
+      pipeline = &prometheus->pipelines[i];
+
+      memset(&labels, 0, sizeof(labels));
+      pgagroal_snprintf(&labels[0], sizeof(labels), "pipeline=\"%s\"", pipeline_names[i]);
+
+      user_cpu = append_latency(user_cpu, "pgagroal_pipeline_user_cpu_seconds", &labels[0], &pipeline->user_cpu);
+      system_cpu = append_latency(system_cpu, "pgagroal_pipeline_system_cpu_seconds", &labels[0], &pipeline->system_cpu);
+      reads = append_count(reads, "pgagroal_pipeline_transaction_reads", &labels[0], &pipeline->reads);
+      writes = append_count(writes, "pgagroal_pipeline_transaction_writes", &labels[0], &pipeline->writes);
+      wakeups = append_count(wakeups, "pgagroal_pipeline_transaction_wakeups", &labels[0], &pipeline->wakeups);
+
+      usec = atomic_load(&pipeline->server_blocked);
+      memset(&seconds, 0, sizeof(seconds));
+      pgagroal_snprintf(&seconds[0], sizeof(seconds), "%llu.%06llu", usec / 1000000, usec % 1000000);
+      server_blocked = pgagroal_append(server_blocked, "pgagroal_pipeline_server_blocked_seconds");
+      server_blocked = append_labels(server_blocked, &labels[0]);
+      server_blocked = pgagroal_append(server_blocked, &seconds[0]);
+      server_blocked = pgagroal_append(server_blocked, "\n");
+
+      usec = atomic_load(&pipeline->client_blocked);
+      memset(&seconds, 0, sizeof(seconds));
+      pgagroal_snprintf(&seconds[0], sizeof(seconds), "%llu.%06llu", usec / 1000000, usec % 1000000);
+      client_blocked = pgagroal_append(client_blocked, "pgagroal_pipeline_client_blocked_seconds");
+      client_blocked = append_labels(client_blocked, &labels[0]);
+      client_blocked = pgagroal_append(client_blocked, &seconds[0]);
+      client_blocked = pgagroal_append(client_blocked, "\n");
+   }
+
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_user_cpu_seconds", user_cpu, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_system_cpu_seconds", system_cpu, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_transaction_reads", reads, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_transaction_writes", writes, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_transaction_wakeups", wakeups, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_server_blocked_seconds", server_blocked, NULL, NULL, 0);
+   add_metric_to_art(container->internal_metrics, "pgagroal_pipeline_client_blocked_seconds", client_blocked, NULL, NULL, 0);
+
+   free(user_cpu);
+   free(system_cpu);
+   free(reads);
+   free(writes);
+   free(wakeups);
+   free(server_blocked);
+   free(client_blocked);
+}
+
+static void
+backend_information(prometheus_metrics_container_t* container)
+{
+   char labels[MISC_LENGTH];
+   char* phases = NULL;
+   char* created = NULL;
+   char* data = NULL;
+   struct prometheus_backend* backend;
+   struct main_configuration* config;
+   struct main_prometheus* prometheus;
+
+   config = (struct main_configuration*)shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   phases = pgagroal_append(phases, "#HELP pgagroal_server_backend_phase_seconds The time of each phase of the creation of a backend per server\n");
+   phases = pgagroal_append(phases, "#TYPE pgagroal_server_backend_phase_seconds histogram\n");
+   created = pgagroal_append(created, "#HELP pgagroal_server_backends_created The backends created per server and reason\n");
+   created = pgagroal_append(created, "#TYPE pgagroal_server_backends_created counter\n");
+
+   FOREACH_VALID_SERVER
+   {
+      backend = &prometheus->backends[i];
+
+      for (int j = 0; j < NUMBER_OF_BACKEND_PHASES; j++)
+      {
+         memset(&labels, 0, sizeof(labels));
+         pgagroal_snprintf(&labels[0], sizeof(labels), "name=\"%s\",phase=\"%s\"", config->servers[i].name, phase_names[j]);
+
+         phases = append_latency(phases, "pgagroal_server_backend_phase_seconds", &labels[0], &backend->phases[j]);
+      }
+
+      for (int j = 0; j < NUMBER_OF_CREATE_REASONS; j++)
+      {
+         memset(&labels, 0, sizeof(labels));
+         pgagroal_snprintf(&labels[0], sizeof(labels), "name=\"%s\",reason=\"%s\"", config->servers[i].name, reason_names[j]);
+
+         created = pgagroal_append(created, "pgagroal_server_backends_created");
+         created = append_labels(created, &labels[0]);
+         created = pgagroal_append_ulong(created, atomic_load(&backend->created[j]));
+         created = pgagroal_append(created, "\n");
+      }
+   }
+
+   add_metric_to_art(container->pool_metrics, "pgagroal_server_backend_phase_seconds", phases, NULL, NULL, 0);
+   add_metric_to_art(container->pool_metrics, "pgagroal_server_backends_created", created, NULL, NULL, 0);
+
+   free(phases);
+   free(created);
+
+   data = pgagroal_append(data, "#HELP pgagroal_prefill_active The number of prefill rounds running\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_prefill_active gauge\n");
+   data = pgagroal_append(data, "pgagroal_prefill_active ");
+   data = pgagroal_append_int(data, MAX(atomic_load(&prometheus->prefill_active), 0));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->pool_metrics, "pgagroal_prefill_active", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_prefill_pending The connections the running prefill rounds still create\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_prefill_pending gauge\n");
+   data = pgagroal_append(data, "pgagroal_prefill_pending ");
+   data = pgagroal_append_int(data, MAX(atomic_load(&prometheus->prefill_pending), 0));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->pool_metrics, "pgagroal_prefill_pending", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   data = pgagroal_append(data, "#HELP pgagroal_prefill_connections The connections prefill created or failed to create\n");
+   data = pgagroal_append(data, "#TYPE pgagroal_prefill_connections counter\n");
+   data = pgagroal_append(data, "pgagroal_prefill_connections{outcome=\"created\"} ");
+   data = pgagroal_append_ulong(data, atomic_load(&prometheus->prefill_created));
+   data = pgagroal_append(data, "\n");
+   data = pgagroal_append(data, "pgagroal_prefill_connections{outcome=\"failed\"} ");
+   data = pgagroal_append_ulong(data, atomic_load(&prometheus->prefill_failed));
+   data = pgagroal_append(data, "\n");
+   add_metric_to_art(container->pool_metrics, "pgagroal_prefill_connections", data, NULL, NULL, 0);
+   free(data);
+}
+
+static void
+queries_reset(struct prometheus_queries* queries)
+{
+   signed char isfree = STATE_FREE;
+
+   while (!atomic_compare_exchange_strong(&queries->lock, &isfree, STATE_IN_USE))
+   {
+      isfree = STATE_FREE;
+      SLEEP(1000L);
+   }
+
+   memset(&queries->fingerprints, 0, sizeof(queries->fingerprints));
+   memset(&queries->entries, 0, sizeof(queries->entries));
+
+   atomic_store(&queries->lock, STATE_FREE);
+}
+
+static void
+query_information(prometheus_metrics_container_t* container)
+{
+   int count = 0;
+   int top;
+   signed char isfree = STATE_FREE;
+   char query[2 * QUERY_FINGERPRINT_LENGTH];
+   char labels[2 * QUERY_FINGERPRINT_LENGTH + MISC_LENGTH];
+   char value[64];
+   char* calls = NULL;
+   char* error = NULL;
+   char* seconds = NULL;
+   char* rows = NULL;
+   struct prometheus_query* entries = NULL;
+   struct prometheus_query* entry;
+   struct main_configuration* config;
+   struct main_prometheus* prometheus;
+
+   config = (struct main_configuration*)shmem;
+   prometheus = (struct main_prometheus*)prometheus_shmem;
+
+   if (!config->query_statistics)
+   {
+      return;
+   }
+
+   entries = malloc(sizeof(prometheus->queries.entries));
+   if (entries == NULL)
+   {
+      return;
+   }
+
+   while (!atomic_compare_exchange_strong(&prometheus->queries.lock, &isfree, STATE_IN_USE))
+   {
+      isfree = STATE_FREE;
+      SLEEP(1000L);
+   }
+
+   for (int i = 0; i < NUMBER_OF_QUERY_FINGERPRINTS; i++)
+   {
+      if (prometheus->queries.entries[i].fingerprint != 0)
+      {
+         memcpy(&entries[count++], &prometheus->queries.entries[i], sizeof(struct prometheus_query));
+      }
+   }
+
+   atomic_store(&prometheus->queries.lock, STATE_FREE);
+
+   qsort(entries, count, sizeof(struct prometheus_query), query_compare);
+   top = MIN(count, config->query_statistics_top);
+
+   calls = pgagroal_append(calls, "#HELP pgagroal_query_calls The estimated calls of the most called query fingerprints\n");
+   calls = pgagroal_append(calls, "#TYPE pgagroal_query_calls counter\n");
+   error = pgagroal_append(error, "#HELP pgagroal_query_calls_error The upper bound of the over counted calls of a query fingerprint\n");
+   error = pgagroal_append(error, "#TYPE pgagroal_query_calls_error gauge\n");
+   seconds = pgagroal_append(seconds, "#HELP pgagroal_query_seconds The estimated backend time of the most called query fingerprints\n");
+   seconds = pgagroal_append(seconds, "#TYPE pgagroal_query_seconds counter\n");
+   rows = pgagroal_append(rows, "#HELP pgagroal_query_rows The estimated rows of the most called query fingerprints\n");
+   rows = pgagroal_append(rows, "#TYPE pgagroal_query_rows counter\n");
+
+   for (int i = 0; i < top; i++)
+   {
+      entry = &entries[i];
+      entry->query[QUERY_FINGERPRINT_LENGTH - 1] = '\0';
+
+      escape_label(&query[0], sizeof(query), &entry->query[0]);
+
+      memset(&labels, 0, sizeof(labels));
+      pgagroal_snprintf(&labels[0], sizeof(labels), "fingerprint=\"%016llx\",query=\"%s\"",
+                        (unsigned long long)entry->fingerprint, &query[0]);
+
+      memset(&value, 0, sizeof(value));
+      pgagroal_snprintf(&value[0], sizeof(value), "%llu", entry->calls);
+      calls = pgagroal_append(calls, "pgagroal_query_calls");
+      calls = append_labels(calls, &labels[0]);
+      calls = pgagroal_append(calls, &value[0]);
+      calls = pgagroal_append(calls, "\n");
+
+      memset(&value, 0, sizeof(value));
+      pgagroal_snprintf(&value[0], sizeof(value), "%llu", entry->error);
+      error = pgagroal_append(error, "pgagroal_query_calls_error");
+      error = append_labels(error, &labels[0]);
+      error = pgagroal_append(error, &value[0]);
+      error = pgagroal_append(error, "\n");
+
+      memset(&value, 0, sizeof(value));
+      pgagroal_snprintf(&value[0], sizeof(value), "%llu.%06llu", entry->usec / 1000000, entry->usec % 1000000);
+      seconds = pgagroal_append(seconds, "pgagroal_query_seconds");
+      seconds = append_labels(seconds, &labels[0]);
+      seconds = pgagroal_append(seconds, &value[0]);
+      seconds = pgagroal_append(seconds, "\n");
+
+      memset(&value, 0, sizeof(value));
+      pgagroal_snprintf(&value[0], sizeof(value), "%llu", entry->rows);
+      rows = pgagroal_append(rows, "pgagroal_query_rows");
+      rows = append_labels(rows, &labels[0]);
+      rows = pgagroal_append(rows, &value[0]);
+      rows = pgagroal_append(rows, "\n");
+   }
+
+   add_metric_to_art(container->session_metrics, "pgagroal_query_calls", calls, NULL, NULL, 0);
+   add_metric_to_art(container->session_metrics, "pgagroal_query_calls_error", error, NULL, NULL, 0);
+   add_metric_to_art(container->session_metrics, "pgagroal_query_seconds", seconds, NULL, NULL, 0);
+   add_metric_to_art(container->session_metrics, "pgagroal_query_rows", rows, NULL, NULL, 0);
+
+   free(calls);
+   free(error);
+   free(seconds);
+   free(rows);
+   free(entries);
+}
+
+static int
+query_compare(const void* a, const void* b)
+{
+   const struct prometheus_query* qa = (const struct prometheus_query*)a;
+   const struct prometheus_query* qb = (const struct prometheus_query*)b;
+
+   if (qa->calls != qb->calls)
+   {
+      return qa->calls > qb->calls ? -1 : 1;
+   }
+
+   return qa->fingerprint < qb->fingerprint ? -1 : (qa->fingerprint > qb->fingerprint ? 1 : 0);
+}
+
+static void
+escape_label(char* dst, size_t size, char* src)
+{
+   size_t length = 0;
 
-      if (data != NULL)
+   for (char* c = src; *c != '\0' && length + 2 < size; c++)
+   {
+      if (*c == '\\' || *c == '"')
       {
-         add_metric_to_art(container->awaiting_metrics, "pgagroal_limit_awaiting", data, NULL, NULL, 0);
-         free(data);
-         data = NULL;
+         dst[length++] = '\\';
+         dst[length++] = *c;
+      }
+      else if (*c == '\n')
+      {
+         dst[length++] = '\\';
+         dst[length++] = 'n';
+      }
+      else
+      {
+         dst[length++] = *c;
       }
    }
+
+   dst[length] = '\0';
 }
 
 static int
@@ -3396,7 +4823,6 @@ pgagroal_init_prometheus_cache(size_t* p_size, void** p_shmem)
       goto error;
    }
 
-   memset(cache, 0, struct_size + cache_size);
    cache->valid_until = 0;
    cache->size = cache_size;
    atomic_init(&cache->lock, STATE_FREE);
@@ -3465,6 +4891,7 @@ metrics_cache_invalidate(void)
 
    memset(cache->data, 0, cache->size);
    cache->valid_until = 0;
+   cache_length = 0;
 }
 
 /**
@@ -3487,8 +4914,24 @@ metrics_cache_invalidate(void)
 static bool
 metrics_cache_append(char* data)
 {
-   size_t origin_length = 0;
-   size_t append_length = 0;
+   return metrics_cache_append_length(data, strlen(data));
+}
+
+/**
+ * Appends data of a known length to the cache.
+ *
+ * Requires the caller to hold the lock on the cache!
+ *
+ * The length of the cache is tracked since the last
+ * invalidation, such that the cache isn't rescanned.
+ *
+ * @param data the data to append to the cache
+ * @param length the length of the data
+ * @return true on success
+ */
+static bool
+metrics_cache_append_length(char* data, size_t length)
+{
    struct prometheus_cache* cache;
 
    cache = (struct prometheus_cache*)prometheus_cache_shmem;
@@ -3498,23 +4941,22 @@ metrics_cache_append(char* data)
       return false;
    }
 
-   origin_length = strlen(cache->data);
-   append_length = strlen(data);
    // need to append the data to the cache
-   if (origin_length + append_length >= cache->size)
+   if (cache_length + length >= cache->size)
    {
       // cannot append new data, so invalidate cache
       pgagroal_log_debug("Cannot append %d bytes to the Prometheus cache because it will overflow the size of %d bytes (currently at %d bytes). HINT: try adjusting `metrics_cache_max_size`",
-                         append_length,
+                         length,
                          cache->size,
-                         origin_length);
+                         cache_length);
       metrics_cache_invalidate();
       return false;
    }
 
    // append the data to the data field
-   memcpy(cache->data + origin_length, data, append_length);
-   cache->data[origin_length + append_length + 1] = '\0';
+   memcpy(cache->data + cache_length, data, length);
+   cache_length += length;
+   cache->data[cache_length] = '\0';
    return true;
 }
 
@@ -3548,6 +4990,318 @@ metrics_cache_finalize(void)
    return cache->valid_until > now;
 }
 
+static void
+counter_add(struct prometheus_counter* counter, long long value)
+{
+   int shard = -1;
+
+   /* The shard of the CPU, such that the workers don't share the cache line */
+#if HAVE_LINUX
+   shard = sched_getcpu();
+#endif
+
+   if (shard < 0)
+   {
+      shard = (int)getpid();
+   }
+
+   /* A negative value wraps around, and the sum is still right */
+   atomic_fetch_add_explicit(&counter->shards[shard % PROMETHEUS_COUNTER_SHARDS].value, (unsigned long long)value, memory_order_relaxed);
+}
+
+static unsigned long long
+counter_value(struct prometheus_counter* counter)
+{
+   unsigned long long value = 0;
+
+   for (int i = 0; i < PROMETHEUS_COUNTER_SHARDS; i++)
+   {
+      value += atomic_load_explicit(&counter->shards[i].value, memory_order_relaxed);
+   }
+
+   return value;
+}
+
+static void
+counter_reset(struct prometheus_counter* counter)
+{
+   for (int i = 0; i < PROMETHEUS_COUNTER_SHARDS; i++)
+   {
+      atomic_store(&counter->shards[i].value, 0);
+   }
+}
+
+static void
+latency_add(struct prometheus_latency* latency, long long usec)
+{
+   int bucket = 0;
+
+   if (usec < 0)
+   {
+      usec = 0;
+   }
+
+   while (bucket < LATENCY_HISTOGRAM_BUCKETS - 1 && usec > (100LL << bucket))
+   {
+      bucket++;
+   }
+
+   atomic_fetch_add(&latency->buckets[bucket], 1);
+   atomic_fetch_add(&latency->sum, (unsigned long long)usec);
+}
+
+static void
+latency_reset(struct prometheus_latency* latency)
+{
+   for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_store(&latency->buckets[i], 0);
+   }
+   atomic_store(&latency->sum, 0);
+}
+
+static char*
+append_latency(char* data, char* name, char* labels, struct prometheus_latency* latency)
+{
+   char sum[64];
+   unsigned long long usec;
+   unsigned long counter = 0;
+
+   for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+   {
+      counter += atomic_load(&latency->buckets[i]);
+
+      data = pgagroal_append(data, name);
+      data = pgagroal_append(data, "_bucket{");
+      if (strlen(labels) > 0)
+      {
+         data = pgagroal_append(data, labels);
+         data = pgagroal_append(data, ",");
+      }
+      data = pgagroal_append(data, "le=\"");
+      data = pgagroal_append(data, latency_bounds[i]);
+      data = pgagroal_append(data, "\"} ");
+      data = pgagroal_append_ulong(data, counter);
+      data = pgagroal_append(data, "\n");
+   }
+
+   usec = atomic_load(&latency->sum);
+   memset(&sum, 0, sizeof(sum));
+   pgagroal_snprintf(&sum[0], sizeof(sum), "%llu.%06llu", usec / 1000000, usec % 1000000);
+
+   data = pgagroal_append(data, name);
+   data = pgagroal_append(data, "_sum");
+   data = append_labels(data, labels);
+   data = pgagroal_append(data, &sum[0]);
+   data = pgagroal_append(data, "\n");
+
+   data = pgagroal_append(data, name);
+   data = pgagroal_append(data, "_count");
+   data = append_labels(data, labels);
+   data = pgagroal_append_ulong(data, counter);
+   data = pgagroal_append(data, "\n");
+
+   return data;
+}
+
+static char*
+append_labels(char* data, char* labels)
+{
+   if (strlen(labels) > 0)
+   {
+      data = pgagroal_append(data, "{");
+      data = pgagroal_append(data, labels);
+      data = pgagroal_append(data, "}");
+   }
+
+   return pgagroal_append(data, " ");
+}
+
+static void
+count_reset(struct prometheus_count* count)
+{
+   for (int i = 0; i < COUNT_HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_store(&count->buckets[i], 0);
+   }
+   atomic_store(&count->sum, 0);
+}
+
+static char*
+append_count(char* data, char* name, char* labels, struct prometheus_count* count)
+{
+   unsigned long counter = 0;
+
+   for (int i = 0; i < COUNT_HISTOGRAM_BUCKETS; i++)
+   {
+      counter += atomic_load(&count->buckets[i]);
+
+      data = pgagroal_append(data, name);
+      data = pgagroal_append(data, "_bucket{");
+      if (strlen(labels) > 0)
+      {
+         data = pgagroal_append(data, labels);
+         data = pgagroal_append(data, ",");
+      }
+      data = pgagroal_append(data, "le=\"");
+      data = pgagroal_append(data, count_bounds[i]);
+      data = pgagroal_append(data, "\"} ");
+      data = pgagroal_append_ulong(data, counter);
+      data = pgagroal_append(data, "\n");
+   }
+
+   data = pgagroal_append(data, name);
+   data = pgagroal_append(data, "_sum");
+   data = append_labels(data, labels);
+   data = pgagroal_append_ullong(data, atomic_load(&count->sum));
+   data = pgagroal_append(data, "\n");
+
+   data = pgagroal_append(data, name);
+   data = pgagroal_append(data, "_count");
+   data = append_labels(data, labels);
+   data = pgagroal_append_ulong(data, counter);
+   data = pgagroal_append(data, "\n");
+
+   return data;
+}
+
+static void
+pipeline_reset(struct prometheus_pipeline* pipeline)
+{
+   latency_reset(&pipeline->user_cpu);
+   latency_reset(&pipeline->system_cpu);
+   count_reset(&pipeline->reads);
+   count_reset(&pipeline->writes);
+   count_reset(&pipeline->wakeups);
+   atomic_store(&pipeline->server_blocked, 0);
+   atomic_store(&pipeline->client_blocked, 0);
+}
+
+static void
+backend_reset(struct prometheus_backend* backend)
+{
+   for (int i = 0; i < NUMBER_OF_BACKEND_PHASES; i++)
+   {
+      latency_reset(&backend->phases[i]);
+   }
+
+   for (int i = 0; i < NUMBER_OF_CREATE_REASONS; i++)
+   {
+      atomic_store(&backend->created[i], 0);
+   }
+}
+
+static void
+wait_reset(struct prometheus_wait* wait)
+{
+   latency_reset(&wait->time);
+   atomic_store(&wait->reuse, 0);
+   atomic_store(&wait->created, 0);
+   atomic_store(&wait->timeout, 0);
+}
+
+static void
+local_slot_publish(void)
+{
+   struct main_prometheus* prometheus;
+
+   if (local_slot_query_count > 0 && local_slot >= 0 && is_prometheus_enabled())
+   {
+      prometheus = (struct main_prometheus*)prometheus_shmem;
+
+      atomic_fetch_add(&prometheus->prometheus_connections[local_slot].query_count, local_slot_query_count);
+   }
+
+   local_slot_query_count = 0;
+}
+
+static int
+local_count_bucket(int64_t n)
+{
+   int bucket = 0;
+
+   while (bucket < COUNT_HISTOGRAM_BUCKETS - 1 && n > (1LL << bucket))
+   {
+      bucket++;
+   }
+
+   return bucket;
+}
+
+static void
+local_accounting_publish(void)
+{
+   struct prometheus_pipeline* pipeline;
+   struct main_prometheus* prometheus;
+
+   if (local_pipeline == -1)
+   {
+      return;
+   }
+
+   if (is_prometheus_enabled())
+   {
+      prometheus = (struct main_prometheus*)prometheus_shmem;
+      pipeline = &prometheus->pipelines[local_pipeline];
+
+      for (int i = 0; i < COUNT_HISTOGRAM_BUCKETS; i++)
+      {
+         if (local_tx_reads[i] > 0)
+         {
+            atomic_fetch_add(&pipeline->reads.buckets[i], local_tx_reads[i]);
+         }
+         if (local_tx_writes[i] > 0)
+         {
+            atomic_fetch_add(&pipeline->writes.buckets[i], local_tx_writes[i]);
+         }
+         if (local_tx_wakeups[i] > 0)
+         {
+            atomic_fetch_add(&pipeline->wakeups.buckets[i], local_tx_wakeups[i]);
+         }
+      }
+
+      if (local_tx_reads_sum > 0)
+      {
+         atomic_fetch_add(&pipeline->reads.sum, local_tx_reads_sum);
+      }
+      if (local_tx_writes_sum > 0)
+      {
+         atomic_fetch_add(&pipeline->writes.sum, local_tx_writes_sum);
+      }
+      if (local_tx_wakeups_sum > 0)
+      {
+         atomic_fetch_add(&pipeline->wakeups.sum, local_tx_wakeups_sum);
+      }
+      if (local_server_blocked > 0)
+      {
+         atomic_fetch_add(&pipeline->server_blocked, local_server_blocked);
+      }
+      if (local_client_blocked > 0)
+      {
+         atomic_fetch_add(&pipeline->client_blocked, local_client_blocked);
+      }
+   }
+
+   memset(&local_tx_reads, 0, sizeof(local_tx_reads));
+   memset(&local_tx_writes, 0, sizeof(local_tx_writes));
+   memset(&local_tx_wakeups, 0, sizeof(local_tx_wakeups));
+   local_tx_reads_sum = 0;
+   local_tx_writes_sum = 0;
+   local_tx_wakeups_sum = 0;
+   local_server_blocked = 0;
+   local_client_blocked = 0;
+}
+
+static int64_t
+local_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 static bool
 is_prometheus_enabled(void)
 {
@@ -4484,7 +6238,7 @@ add_metric_to_art(struct art* art_tree, char* key, char* value,
 }
 
 static void
-output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree)
+output_art_metrics(struct exposition* body, struct art* art_tree)
 {
    struct art_iterator* iter = NULL;
 
@@ -4503,8 +6257,7 @@ output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree)
       prometheus_metric_value_t* mv = (prometheus_metric_value_t*)pgagroal_value_data(iter->value);
       if (mv != NULL && mv->value != NULL)
       {
-         send_chunk(client_ssl, client_fd, mv->value);
-         metrics_cache_append(mv->value);
+         exposition_append(body, mv->value, strlen(mv->value));
       }
    }
 
@@ -4519,15 +6272,163 @@ output_all_metrics(SSL* client_ssl, int client_fd, prometheus_metrics_container_
       return;
    }
 
-   output_art_metrics(client_ssl, client_fd, container->general_metrics);
-   output_art_metrics(client_ssl, client_fd, container->connection_metrics);
-   output_art_metrics(client_ssl, client_fd, container->limit_metrics);
-   output_art_metrics(client_ssl, client_fd, container->session_metrics);
-   output_art_metrics(client_ssl, client_fd, container->pool_metrics);
-   output_art_metrics(client_ssl, client_fd, container->auth_metrics);
-   output_art_metrics(client_ssl, client_fd, container->client_metrics);
-   output_art_metrics(client_ssl, client_fd, container->internal_metrics);
-   output_art_metrics(client_ssl, client_fd, container->awaiting_metrics);
-   output_art_metrics(client_ssl, client_fd, container->os_metrics);
-   output_art_metrics(client_ssl, client_fd, container->certificate_metrics_tree);
+   /* The metrics are sent as a single chunk */
+   body.length = 0;
+
+   render_all_metrics(&body, container);
+
+   if (body.length > 0)
+   {
+      metrics_cache_append_length(body.data, body.length);
+      exposition_send(client_ssl, client_fd, &body);
+   }
+}
+
+static void
+render_all_metrics(struct exposition* e, prometheus_metrics_container_t* container)
+{
+   output_art_metrics(e, container->general_metrics);
+   output_art_metrics(e, container->connection_metrics);
+   output_art_metrics(e, container->limit_metrics);
+   output_art_metrics(e, container->session_metrics);
+   output_art_metrics(e, container->pool_metrics);
+   output_art_metrics(e, container->auth_metrics);
+   output_art_metrics(e, container->client_metrics);
+   output_art_metrics(e, container->internal_metrics);
+   output_art_metrics(e, container->awaiting_metrics);
+   output_art_metrics(e, container->os_metrics);
+   output_art_metrics(e, container->certificate_metrics_tree);
+}
+
+static void
+collect_metrics(prometheus_metrics_container_t* container)
+{
+   general_information(container);
+   connection_information(container);
+   limit_information(container);
+   session_information(container);
+   pool_information(container);
+   auth_information(container);
+   client_information(container);
+   internal_information(container);
+   connection_awaiting_information(container);
+   wait_information(container);
+   database_information(container);
+   pipeline_information(container);
+   backend_information(container);
+   query_information(container);
+   write_os_kernel_version(container);
+   certificate_information(container);
+}
+
+static bool
+exposition_append(struct exposition* e, char* s, size_t length)
+{
+   char* n = NULL;
+   size_t size;
+
+   if (e->length + length + 1 > e->size)
+   {
+      size = e->size > 0 ? e->size : CHUNK_SIZE;
+      while (e->length + length + 1 > size)
+      {
+         size *= 2;
+      }
+
+      n = realloc(e->data, size);
+      if (n == NULL)
+      {
+         return false;
+      }
+
+      e->data = n;
+      e->size = size;
+   }
+
+   memcpy(e->data + e->length, s, length);
+   e->length += length;
+   e->data[e->length] = '\0';
+
+   return true;
+}
+
+static bool
+exposition_append_string(struct exposition* e, char* s)
+{
+   return exposition_append(e, s, strlen(s));
+}
+
+static int
+exposition_send(SSL* client_ssl, int client_fd, struct exposition* e)
+{
+   char header[20];
+   char trailer[] = "\r\n";
+   int header_length;
+   ssize_t written;
+   int first = 0;
+   struct iovec iov[3];
+   struct message msg;
+
+   header_length = pgagroal_snprintf(&header[0], sizeof(header), "%zX\r\n", e->length);
+
+   if (client_ssl != NULL)
+   {
+      memset(&msg, 0, sizeof(struct message));
+
+      msg.length = header_length;
+      msg.data = &header[0];
+      if (pgagroal_write_message(client_ssl, client_fd, &msg) != MESSAGE_STATUS_OK)
+      {
+         return MESSAGE_STATUS_ERROR;
+      }
+
+      msg.length = e->length;
+      msg.data = e->data;
+      if (pgagroal_write_message(client_ssl, client_fd, &msg) != MESSAGE_STATUS_OK)
+      {
+         return MESSAGE_STATUS_ERROR;
+      }
+
+      msg.length = 2;
+      msg.data = &trailer[0];
+      return pgagroal_write_message(client_ssl, client_fd, &msg);
+   }
+
+   iov[0].iov_base = &header[0];
+   iov[0].iov_len = header_length;
+   iov[1].iov_base = e->data;
+   iov[1].iov_len = e->length;
+   iov[2].iov_base = &trailer[0];
+   iov[2].iov_len = 2;
+
+   while (first < 3)
+   {
+      written = writev(client_fd, &iov[first], 3 - first);
+
+      if (written == -1)
+      {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+         {
+            errno = 0;
+            continue;
+         }
+
+         return MESSAGE_STATUS_ERROR;
+      }
+
+      /* Step over what a partial write sent */
+      while (first < 3 && (size_t)written >= iov[first].iov_len)
+      {
+         written -= iov[first].iov_len;
+         first++;
+      }
+
+      if (first < 3)
+      {
+         iov[first].iov_base = (char*)iov[first].iov_base + written;
+         iov[first].iov_len -= written;
+      }
+   }
+
+   return MESSAGE_STATUS_OK;
 }
@@ -31,6 +31,7 @@
 #include <deque.h>
 #include <logging.h>
 #include <network.h>
+#include <prometheus.h>
 #include <prometheus_client.h>
 #include <security.h>
 #include <tls.h>
@@ -48,18 +49,35 @@
 #include <time.h>
 
 #define PROMETHEUS_LABEL_LENGTH 1024
-
-static int parse_body_to_bridge(time_t timestamp, char* body, struct prometheus_bridge* bridge);
+#define PROMETHEUS_MAX_LABELS   32
+#define PROMETHEUS_MAX_VALUES   100
+#define PROMETHEUS_ARENA_SIZE   65536
+
+/**
+ * @struct prometheus_arena
+ * A block of the bridge arena, the blocks are chained and released
+ * together with the bridge
+ */
+struct prometheus_arena
+{
+   struct prometheus_arena* next; /**< The previous block */
+   size_t size;                   /**< The size of the data */
+   size_t used;                   /**< The used part of the data */
+   char data[];                   /**< The data */
+};
+
+static int parse_body_to_bridge(time_t timestamp, char* body, char* endpoint, struct prometheus_bridge* bridge);
+static void* arena_allocate(struct prometheus_bridge* bridge, size_t size);
+static char* intern(struct prometheus_bridge* bridge, char* s);
+static char* skip_space(char* p);
+static char* find_space(char* p);
 static int metric_find_create(struct prometheus_bridge* bridge, char* name, struct prometheus_metric** metric);
-static int metric_set_name(struct prometheus_metric* metric, char* name);
-static int metric_set_help(struct prometheus_metric* metric, char* help);
-static int metric_set_type(struct prometheus_metric* metric, char* type);
-static bool attributes_contains(struct deque* attributes, struct prometheus_attribute* attribute);
-static int attributes_find_create(struct deque* definitions, struct deque* input, struct prometheus_attributes** attributes, bool* is_new);
-static int add_attribute(struct deque* attributes, char* key, char* value);
-static int add_value(struct deque* values, time_t timestamp, char* value);
-static int add_line(struct main_configuration* config, struct prometheus_metric* metric, char* line, time_t timestamp);
-static int parse_metric_name_from_line(char* line, char* metric_name, size_t size);
+static int series_find_create(struct prometheus_bridge* bridge, struct prometheus_metric* metric, char* endpoint,
+                              char* labels, size_t length, struct prometheus_attributes** attributes);
+static int parse_labels(struct prometheus_bridge* bridge, char* p, char* end,
+                        struct prometheus_attribute* attributes, int* number_of_attributes);
+static int add_value(struct deque* values, time_t timestamp, double value);
+static int add_line(struct prometheus_bridge* bridge, struct prometheus_metric* metric, char* endpoint, char* p, time_t timestamp);
 static int fetch_metrics_body(const char* host, int port, bool secure, char** body);
 static int write_all(SSL* ssl, int fd, const char* buffer, size_t size);
 static int read_all(SSL* ssl, int fd, char** response, size_t* response_size);
@@ -73,8 +91,6 @@ static void prometheus_attributes_destroy_cb(uintptr_t data);
 static char* prometheus_attributes_string_cb(uintptr_t data, int32_t format, char* tag, int indent);
 static void prometheus_value_destroy_cb(uintptr_t data);
 static char* prometheus_value_string_cb(uintptr_t data, int32_t format, char* tag, int indent);
-static void prometheus_attribute_destroy_cb(uintptr_t data);
-static char* prometheus_attribute_string_cb(uintptr_t data, int32_t format, char* tag, int indent);
 
 int
 pgagroal_prometheus_client_create_bridge(struct prometheus_bridge** bridge)
@@ -103,6 +119,12 @@ pgagroal_prometheus_client_create_bridge(struct prometheus_bridge** bridge)
       goto error;
    }
 
+   if (pgagroal_art_create(&b->names))
+   {
+      pgagroal_log_error("Failed to create ART");
+      goto error;
+   }
+
    *bridge = b;
 
    return 0;
@@ -111,6 +133,7 @@ error:
    if (b != NULL)
    {
       pgagroal_art_destroy(b->metrics);
+      pgagroal_art_destroy(b->names);
       free(b);
    }
 
@@ -120,9 +143,21 @@ error:
 int
 pgagroal_prometheus_client_destroy_bridge(struct prometheus_bridge* bridge)
 {
+   struct prometheus_arena* a = NULL;
+   struct prometheus_arena* n = NULL;
+
    if (bridge != NULL)
    {
       pgagroal_art_destroy(bridge->metrics);
+      pgagroal_art_destroy(bridge->names);
+
+      a = bridge->arena;
+      while (a != NULL)
+      {
+         n = a->next;
+         free(a);
+         a = n;
+      }
    }
 
    free(bridge);
@@ -137,7 +172,9 @@ pgagroal_prometheus_client_get(int endpoint, struct prometheus_bridge* bridge)
    struct main_configuration* config = NULL;
    bool secure = false;
    char* body_copy = NULL;
+   char* endpoint_attr = NULL;
    char* host = NULL;
+   size_t length = 0;
 
    (void)endpoint;
 
@@ -147,36 +184,61 @@ pgagroal_prometheus_client_get(int endpoint, struct prometheus_bridge* bridge)
       goto error;
    }
 
-   if (config->common.metrics <= 0)
+   host = config->common.host;
+
+   if (prometheus_shmem != NULL)
    {
-      pgagroal_log_error("Metrics listener is not enabled");
-      goto error;
+      /* Inside the pool the metrics are read without going through the listener */
+      pgagroal_log_debug("Endpoint local, %s:%d", host, config->common.metrics);
+
+      if (pgagroal_prometheus_exposition(&body_copy, &length))
+      {
+         pgagroal_log_error("Failed to render the metrics");
+         goto error;
+      }
    }
+   else
+   {
+      if (config->common.metrics <= 0)
+      {
+         pgagroal_log_error("Metrics listener is not enabled");
+         goto error;
+      }
 
-   host = config->common.host;
+      secure = strlen(config->common.metrics_cert_file) > 0 && strlen(config->common.metrics_key_file) > 0;
 
-   secure = strlen(config->common.metrics_cert_file) > 0 && strlen(config->common.metrics_key_file) > 0;
+      pgagroal_log_debug("Endpoint %s://%s:%d/metrics", secure ? "https" : "http", host, config->common.metrics);
+
+      if (fetch_metrics_body(host, config->common.metrics, secure, &body_copy))
+      {
+         pgagroal_log_error("Failed to fetch /metrics from %s:%d", host, config->common.metrics);
+         goto error;
+      }
+   }
 
-   pgagroal_log_debug("Endpoint %s://%s:%d/metrics", secure ? "https" : "http", host, config->common.metrics);
+   endpoint_attr = pgagroal_append(endpoint_attr, host);
+   endpoint_attr = pgagroal_append_char(endpoint_attr, ':');
+   endpoint_attr = pgagroal_append_int(endpoint_attr, config->common.metrics);
 
-   if (fetch_metrics_body(host, config->common.metrics, secure, &body_copy))
+   if (endpoint_attr == NULL)
    {
-      pgagroal_log_error("Failed to fetch /metrics from %s:%d", host, config->common.metrics);
       goto error;
    }
 
    timestamp = time(NULL);
-   if (parse_body_to_bridge(timestamp, body_copy, bridge))
+   if (parse_body_to_bridge(timestamp, body_copy, endpoint_attr, bridge))
    {
       goto error;
    }
 
+   free(endpoint_attr);
    free(body_copy);
 
    return 0;
 
 error:
 
+   free(endpoint_attr);
    free(body_copy);
 
    return 1;
@@ -517,6 +579,91 @@ done:
    return status;
 }
 
+static void*
+arena_allocate(struct prometheus_bridge* bridge, size_t size)
+{
+   size_t block;
+   void* p = NULL;
+   struct prometheus_arena* a = NULL;
+
+   size = (size + 7) & ~((size_t)7);
+
+   a = bridge->arena;
+
+   if (a == NULL || a->used + size > a->size)
+   {
+      block = size > PROMETHEUS_ARENA_SIZE ? size : PROMETHEUS_ARENA_SIZE;
+
+      a = (struct prometheus_arena*)malloc(sizeof(struct prometheus_arena) + block);
+      if (a == NULL)
+      {
+         return NULL;
+      }
+
+      a->next = bridge->arena;
+      a->size = block;
+      a->used = 0;
+
+      bridge->arena = a;
+   }
+
+   p = a->data + a->used;
+   a->used += size;
+
+   return p;
+}
+
+static char*
+intern(struct prometheus_bridge* bridge, char* s)
+{
+   char* r = NULL;
+   size_t length;
+
+   r = (char*)pgagroal_art_search(bridge->names, s);
+
+   if (r == NULL)
+   {
+      length = strlen(s) + 1;
+
+      r = (char*)arena_allocate(bridge, length);
+      if (r == NULL)
+      {
+         return NULL;
+      }
+
+      memcpy(r, s, length);
+
+      if (pgagroal_art_insert(bridge->names, r, (uintptr_t)r, ValueRef))
+      {
+         return NULL;
+      }
+   }
+
+   return r;
+}
+
+static char*
+skip_space(char* p)
+{
+   while (*p != '\0' && isspace((unsigned char)*p))
+   {
+      p++;
+   }
+
+   return p;
+}
+
+static char*
+find_space(char* p)
+{
+   while (*p != '\0' && !isspace((unsigned char)*p))
+   {
+      p++;
+   }
+
+   return p;
+}
+
 static void
 prometheus_metric_destroy_cb(uintptr_t data)
 {
@@ -524,16 +671,12 @@ prometheus_metric_destroy_cb(uintptr_t data)
 
    m = (struct prometheus_metric*)data;
 
+   /* The metric and its strings live in the arena */
    if (m != NULL)
    {
-      free(m->name);
-      free(m->help);
-      free(m->type);
-
       pgagroal_deque_destroy(m->definitions);
+      pgagroal_art_destroy(m->index);
    }
-
-   free(m);
 }
 
 static char*
@@ -597,9 +740,7 @@ metric_find_create(struct prometheus_bridge* bridge, char* name,
 
    if (m == NULL)
    {
-      struct deque* defs = NULL;
-
-      m = (struct prometheus_metric*)malloc(sizeof(struct prometheus_metric));
+      m = (struct prometheus_metric*)arena_allocate(bridge, sizeof(struct prometheus_metric));
       if (m == NULL)
       {
          goto error;
@@ -607,21 +748,22 @@ metric_find_create(struct prometheus_bridge* bridge, char* name,
 
       memset(m, 0, sizeof(struct prometheus_metric));
 
-      if (pgagroal_deque_create(true, &defs))
+      m->name = intern(bridge, name);
+      if (m->name == NULL)
       {
-         free(m);
          goto error;
       }
 
-      m->name = strdup(name);
-      if (m->name == NULL)
+      if (pgagroal_deque_create(false, &m->definitions))
       {
-         pgagroal_deque_destroy(defs);
-         free(m);
          goto error;
       }
 
-      m->definitions = defs;
+      if (pgagroal_art_create(&m->index))
+      {
+         pgagroal_deque_destroy(m->definitions);
+         goto error;
+      }
 
       if (pgagroal_art_insert_with_config(bridge->metrics, (char*)name,
                                           (uintptr_t)m, &vc))
@@ -640,110 +782,6 @@ error:
    return 1;
 }
 
-static int
-metric_set_name(struct prometheus_metric* metric, char* name)
-{
-   if (metric == NULL || name == NULL)
-   {
-      return 1;
-   }
-
-   if (metric->name != NULL)
-   {
-      return 0;
-   }
-
-   metric->name = strdup(name);
-   if (metric->name == NULL)
-   {
-      errno = 0;
-      return 1;
-   }
-
-   return 0;
-}
-
-static int
-metric_set_help(struct prometheus_metric* metric, char* help)
-{
-   if (metric == NULL || help == NULL)
-   {
-      return 1;
-   }
-
-   if (metric->help != NULL)
-   {
-      free(metric->help);
-      metric->help = NULL;
-   }
-
-   metric->help = strdup(help);
-
-   if (metric->help == NULL)
-   {
-      errno = 0;
-      return 1;
-   }
-
-   return 0;
-}
-
-static int
-metric_set_type(struct prometheus_metric* metric, char* type)
-{
-   if (metric == NULL || type == NULL)
-   {
-      return 1;
-   }
-
-   if (metric->type != NULL)
-   {
-      free(metric->type);
-      metric->type = NULL;
-   }
-
-   metric->type = strdup(type);
-
-   if (metric->type == NULL)
-   {
-      errno = 0;
-      return 1;
-   }
-
-   return 0;
-}
-
-static bool
-attributes_contains(struct deque* attributes, struct prometheus_attribute* attribute)
-{
-   bool found = false;
-   struct deque_iterator* attributes_iterator = NULL;
-
-   if (!pgagroal_deque_empty(attributes))
-   {
-      if (pgagroal_deque_iterator_create(attributes, &attributes_iterator))
-      {
-         goto done;
-      }
-
-      while (!found && pgagroal_deque_iterator_next(attributes_iterator))
-      {
-         struct prometheus_attribute* a = (struct prometheus_attribute*)attributes_iterator->value->data;
-
-         if (!strcmp(a->key, attribute->key) && !strcmp(a->value, attribute->value))
-         {
-            found = true;
-         }
-      }
-   }
-
-done:
-
-   pgagroal_deque_iterator_destroy(attributes_iterator);
-
-   return found;
-}
-
 static void
 prometheus_attributes_destroy_cb(uintptr_t data)
 {
@@ -751,13 +789,11 @@ prometheus_attributes_destroy_cb(uintptr_t data)
 
    m = (struct prometheus_attributes*)data;
 
+   /* The label set lives in the arena */
    if (m != NULL)
    {
-      pgagroal_deque_destroy(m->attributes);
       pgagroal_deque_destroy(m->values);
    }
-
-   free(m);
 }
 
 static char*
@@ -765,6 +801,7 @@ prometheus_attributes_string_cb(uintptr_t data, int32_t format, char* tag, int i
 {
    char* s = NULL;
    struct art* a = NULL;
+   struct art* labels = NULL;
    struct value_config vc = {.destroy_data = NULL,
                              .to_string = &deque_string_cb};
    struct prometheus_attributes* m = NULL;
@@ -778,7 +815,17 @@ prometheus_attributes_string_cb(uintptr_t data, int32_t format, char* tag, int i
 
    if (m != NULL)
    {
-      pgagroal_art_insert_with_config(a, (char*)"Attributes", (uintptr_t)m->attributes, &vc);
+      if (pgagroal_art_create(&labels))
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < m->number_of_attributes; i++)
+      {
+         pgagroal_art_insert(labels, m->attributes[i].key, (uintptr_t)m->attributes[i].value, ValueString);
+      }
+
+      pgagroal_art_insert(a, (char*)"Attributes", (uintptr_t)labels, ValueART);
       pgagroal_art_insert_with_config(a, (char*)"Values", (uintptr_t)m->values, &vc);
 
       s = pgagroal_art_to_string(a, format, tag, indent);
@@ -796,218 +843,237 @@ error:
 }
 
 static int
-attributes_find_create(struct deque* definitions, struct deque* input,
-                       struct prometheus_attributes** attributes, bool* is_new)
+parse_labels(struct prometheus_bridge* bridge, char* p, char* end,
+             struct prometheus_attribute* attributes, int* number_of_attributes)
 {
-   bool found = false;
-   struct prometheus_attributes* m = NULL;
-   struct deque_iterator* definition_iterator = NULL;
-   struct deque_iterator* input_iterator = NULL;
-   struct value_config vc = {.destroy_data = &prometheus_attributes_destroy_cb,
-                             .to_string = &prometheus_attributes_string_cb};
-
-   *attributes = NULL;
-   *is_new = false;
+   char* key = NULL;
+   char* key_end = NULL;
+   char* value = NULL;
+   char* w = NULL;
 
-   if (!pgagroal_deque_empty(definitions))
+   /* The label text is unescaped in place, it only ever gets shorter */
+   while (p < end)
    {
-      if (pgagroal_deque_iterator_create(definitions, &definition_iterator))
+      while (p < end && isspace((unsigned char)*p))
+      {
+         p++;
+      }
+
+      if (p >= end)
+      {
+         break;
+      }
+
+      key = p;
+      while (p < end && *p != '=' && !isspace((unsigned char)*p))
+      {
+         p++;
+      }
+      key_end = p;
+
+      while (p < end && isspace((unsigned char)*p))
+      {
+         p++;
+      }
+
+      if (key_end == key || p >= end || *p != '=')
       {
          goto error;
       }
+      *key_end = '\0';
+      p++;
 
-      while (!found && pgagroal_deque_iterator_next(definition_iterator))
+      while (p < end && isspace((unsigned char)*p))
       {
-         bool match = true;
-         struct prometheus_attributes* a =
-            (struct prometheus_attributes*)definition_iterator->value->data;
+         p++;
+      }
 
-         if (pgagroal_deque_iterator_create(input, &input_iterator))
-         {
-            goto error;
-         }
+      if (p >= end || *p != '"')
+      {
+         goto error;
+      }
+      p++;
 
-         while (match && pgagroal_deque_iterator_next(input_iterator))
+      value = p;
+      w = p;
+      while (p < end && *p != '"')
+      {
+         if (*p == '\\' && (p + 1) < end)
          {
-            struct prometheus_attribute* i = (struct prometheus_attribute*)input_iterator->value->data;
+            p++;
 
-            if (!attributes_contains(a->attributes, i))
+            switch (*p)
             {
-               match = false;
+               case 'n':
+                  *w++ = '\n';
+                  break;
+               case 't':
+                  *w++ = '\t';
+                  break;
+               case 'r':
+                  *w++ = '\r';
+                  break;
+               default:
+                  *w++ = *p;
+                  break;
             }
          }
-
-         if (match)
+         else
          {
-            *attributes = a;
-            found = true;
+            *w++ = *p;
          }
 
-         pgagroal_deque_iterator_destroy(input_iterator);
-         input_iterator = NULL;
+         p++;
       }
-   }
 
-   if (!found)
-   {
-      m = (struct prometheus_attributes*)malloc(sizeof(struct prometheus_attributes));
-      if (m == NULL)
+      if (p >= end)
       {
          goto error;
       }
+      *w = '\0';
+      p++;
 
-      memset(m, 0, sizeof(struct prometheus_attributes));
-
-      if (pgagroal_deque_create(false, &m->values))
+      if (*number_of_attributes >= PROMETHEUS_MAX_LABELS)
       {
-         free(m);
          goto error;
       }
 
-      m->attributes = input;
+      attributes[*number_of_attributes].key = intern(bridge, key);
+      attributes[*number_of_attributes].value = intern(bridge, value);
 
-      if (pgagroal_deque_add_with_config(definitions, NULL, (uintptr_t)m, &vc))
+      if (attributes[*number_of_attributes].key == NULL || attributes[*number_of_attributes].value == NULL)
       {
-         prometheus_attributes_destroy_cb((uintptr_t)m);
          goto error;
       }
 
-      *attributes = m;
-      *is_new = true;
-   }
+      (*number_of_attributes)++;
+
+      while (p < end && isspace((unsigned char)*p))
+      {
+         p++;
+      }
 
-   pgagroal_deque_iterator_destroy(definition_iterator);
+      if (p < end)
+      {
+         if (*p != ',')
+         {
+            goto error;
+         }
+         p++;
+      }
+   }
 
    return 0;
 
 error:
 
-   pgagroal_deque_iterator_destroy(input_iterator);
-   pgagroal_deque_iterator_destroy(definition_iterator);
-
    return 1;
 }
 
-static void
-prometheus_value_destroy_cb(uintptr_t data)
+static int
+series_find_create(struct prometheus_bridge* bridge, struct prometheus_metric* metric, char* endpoint,
+                   char* labels, size_t length, struct prometheus_attributes** attributes)
 {
-   struct prometheus_value* m = NULL;
+   char key[PROMETHEUS_LABEL_LENGTH];
+   int number_of_attributes = 0;
+   struct prometheus_attribute input[PROMETHEUS_MAX_LABELS];
+   struct prometheus_attributes* a = NULL;
+   struct value_config vc = {.destroy_data = &prometheus_attributes_destroy_cb,
+                             .to_string = &prometheus_attributes_string_cb};
 
-   m = (struct prometheus_value*)data;
+   *attributes = NULL;
 
-   if (m != NULL)
+   /* A series is identified by the label text as it was scraped */
+   if (length == 0)
    {
-      free(m->value);
+      memcpy(key, "{}", 3);
    }
-
-   free(m);
-}
-
-static char*
-prometheus_value_string_cb(uintptr_t data, int32_t format, char* tag, int indent)
-{
-   char* s = NULL;
-   struct art* a = NULL;
-   struct prometheus_value* m = NULL;
-
-   m = (struct prometheus_value*)data;
-
-   if (pgagroal_art_create(&a))
+   else
    {
-      goto error;
+      if (length + 1 > sizeof(key))
+      {
+         goto error;
+      }
+
+      memcpy(key, labels, length);
+      key[length] = '\0';
    }
 
-   if (m != NULL)
+   a = (struct prometheus_attributes*)pgagroal_art_search(metric->index, key);
+
+   if (a == NULL)
    {
-      pgagroal_art_insert(a, (char*)"Timestamp", (uintptr_t)m->timestamp, ValueInt64);
-      pgagroal_art_insert(a, (char*)"Value", (uintptr_t)m->value, ValueString);
+      input[number_of_attributes].key = intern(bridge, (char*)"endpoint");
+      input[number_of_attributes].value = endpoint;
+      number_of_attributes++;
 
-      s = pgagroal_art_to_string(a, format, tag, indent);
-   }
-
-   pgagroal_art_destroy(a);
-
-   return s;
-
-error:
+      if (input[0].key == NULL)
+      {
+         goto error;
+      }
 
-   pgagroal_art_destroy(a);
+      if (length > 0 && parse_labels(bridge, labels + 1, labels + length - 1, &input[0], &number_of_attributes))
+      {
+         goto error;
+      }
 
-   return "Error";
-}
+      a = (struct prometheus_attributes*)arena_allocate(bridge, sizeof(struct prometheus_attributes));
+      if (a == NULL)
+      {
+         goto error;
+      }
 
-static int
-add_value(struct deque* values, time_t timestamp, char* value)
-{
-   struct value_config vc = {.destroy_data = &prometheus_value_destroy_cb,
-                             .to_string = &prometheus_value_string_cb};
-   struct prometheus_value* val = NULL;
+      memset(a, 0, sizeof(struct prometheus_attributes));
 
-   val = (struct prometheus_value*)malloc(sizeof(struct prometheus_value));
-   if (val == NULL)
-   {
-      goto error;
-   }
+      a->attributes = (struct prometheus_attribute*)arena_allocate(bridge, number_of_attributes * sizeof(struct prometheus_attribute));
+      if (a->attributes == NULL)
+      {
+         goto error;
+      }
 
-   memset(val, 0, sizeof(struct prometheus_value));
-   val->timestamp = timestamp;
-   val->value = strdup(value);
+      memcpy(a->attributes, &input[0], number_of_attributes * sizeof(struct prometheus_attribute));
+      a->number_of_attributes = number_of_attributes;
 
-   if (val->value == NULL)
-   {
-      goto error;
-   }
+      if (pgagroal_deque_create(false, &a->values))
+      {
+         goto error;
+      }
 
-   if (pgagroal_deque_size(values) >= 100)
-   {
-      struct prometheus_value* v = NULL;
+      if (pgagroal_deque_add_with_config(metric->definitions, NULL, (uintptr_t)a, &vc))
+      {
+         prometheus_attributes_destroy_cb((uintptr_t)a);
+         goto error;
+      }
 
-      v = (struct prometheus_value*)pgagroal_deque_poll(values, NULL);
-      prometheus_value_destroy_cb((uintptr_t)v);
+      if (pgagroal_art_insert(metric->index, key, (uintptr_t)a, ValueRef))
+      {
+         goto error;
+      }
    }
 
-   if (pgagroal_deque_add_with_config(values, NULL, (uintptr_t)val, &vc))
-   {
-      goto error;
-   }
+   *attributes = a;
 
    return 0;
 
 error:
 
-   if (val != NULL)
-   {
-      free(val->value);
-      free(val);
-   }
-
    return 1;
 }
 
 static void
-prometheus_attribute_destroy_cb(uintptr_t data)
+prometheus_value_destroy_cb(uintptr_t data)
 {
-   struct prometheus_attribute* m = NULL;
-
-   m = (struct prometheus_attribute*)data;
-
-   if (m != NULL)
-   {
-      free(m->key);
-      free(m->value);
-   }
-
-   free(m);
+   free((struct prometheus_value*)data);
 }
 
 static char*
-prometheus_attribute_string_cb(uintptr_t data, int32_t format, char* tag, int indent)
+prometheus_value_string_cb(uintptr_t data, int32_t format, char* tag, int indent)
 {
    char* s = NULL;
    struct art* a = NULL;
-   struct prometheus_attribute* m = NULL;
+   struct prometheus_value* m = NULL;
 
-   m = (struct prometheus_attribute*)data;
+   m = (struct prometheus_value*)data;
 
    if (pgagroal_art_create(&a))
    {
@@ -1016,8 +1082,8 @@ prometheus_attribute_string_cb(uintptr_t data, int32_t format, char* tag, int in
 
    if (m != NULL)
    {
-      pgagroal_art_insert(a, (char*)"Key", (uintptr_t)m->key, ValueString);
-      pgagroal_art_insert(a, (char*)"Value", (uintptr_t)m->value, ValueString);
+      pgagroal_art_insert(a, (char*)"Timestamp", (uintptr_t)m->timestamp, ValueInt64);
+      pgagroal_art_insert(a, (char*)"Value", pgagroal_value_from_double(m->value), ValueDouble);
 
       s = pgagroal_art_to_string(a, format, tag, indent);
    }
@@ -1034,32 +1100,30 @@ error:
 }
 
 static int
-add_attribute(struct deque* attributes, char* key, char* value)
+add_value(struct deque* values, time_t timestamp, double value)
 {
-   struct prometheus_attribute* attr = NULL;
-   struct value_config vc = {.destroy_data = &prometheus_attribute_destroy_cb,
-                             .to_string = &prometheus_attribute_string_cb};
+   struct value_config vc = {.destroy_data = &prometheus_value_destroy_cb,
+                             .to_string = &prometheus_value_string_cb};
+   struct prometheus_value* val = NULL;
 
-   attr = (struct prometheus_attribute*)malloc(sizeof(struct prometheus_attribute));
-   if (attr == NULL)
+   val = (struct prometheus_value*)malloc(sizeof(struct prometheus_value));
+   if (val == NULL)
    {
       goto error;
    }
-   memset(attr, 0, sizeof(struct prometheus_attribute));
 
-   attr->key = strdup(key);
-   if (attr->key == NULL)
-   {
-      goto error;
-   }
+   val->timestamp = timestamp;
+   val->value = value;
 
-   attr->value = strdup(value);
-   if (attr->value == NULL)
+   if (pgagroal_deque_size(values) >= PROMETHEUS_MAX_VALUES)
    {
-      goto error;
+      struct prometheus_value* v = NULL;
+
+      v = (struct prometheus_value*)pgagroal_deque_poll(values, NULL);
+      prometheus_value_destroy_cb((uintptr_t)v);
    }
 
-   if (pgagroal_deque_add_with_config(attributes, NULL, (uintptr_t)attr, &vc))
+   if (pgagroal_deque_add_with_config(values, NULL, (uintptr_t)val, &vc))
    {
       goto error;
    }
@@ -1068,68 +1132,28 @@ add_attribute(struct deque* attributes, char* key, char* value)
 
 error:
 
-   if (attr != NULL)
-   {
-      free(attr->key);
-      free(attr->value);
-      free(attr);
-   }
+   free(val);
 
    return 1;
 }
 
 static int
-add_line(struct main_configuration* config, struct prometheus_metric* metric, char* line, time_t timestamp)
+add_line(struct prometheus_bridge* bridge, struct prometheus_metric* metric, char* endpoint, char* p, time_t timestamp)
 {
-   char* endpoint_attr = NULL;
-   bool is_new = false;
-   char* line_value = NULL;
-   struct deque* line_attrs = NULL;
-   struct prometheus_attributes* attributes = NULL;
-   char* p = NULL;
+   double value;
+   char* labels = NULL;
    char* labels_end = NULL;
    char* value_start = NULL;
    char* value_end = NULL;
-   char* host = NULL;
-
-   if (line == NULL || metric == NULL || config == NULL)
-   {
-      goto error;
-   }
-
-   if (pgagroal_deque_create(false, &line_attrs))
-   {
-      goto error;
-   }
-
-   host = config->common.host;
-
-   endpoint_attr = pgagroal_append(endpoint_attr, host);
-   endpoint_attr = pgagroal_append_char(endpoint_attr, ':');
-   endpoint_attr = pgagroal_append_int(endpoint_attr, config->common.metrics);
-
-   if (add_attribute(line_attrs, (char*)"endpoint", endpoint_attr))
-   {
-      goto error;
-   }
-
-   p = line;
-
-   if (strncmp(p, metric->name, strlen(metric->name)))
-   {
-      goto error;
-   }
-
-   p += strlen(metric->name);
+   size_t length = 0;
+   struct prometheus_attributes* attributes = NULL;
 
    if (*p == '{')
    {
       bool in_quotes = false;
       bool escaped = false;
 
-      p++;
-
-      labels_end = p;
+      labels_end = p + 1;
       while (*labels_end != '\0')
       {
          if (!escaped && *labels_end == '"')
@@ -1158,127 +1182,8 @@ add_line(struct main_configuration* config, struct prometheus_metric* metric, ch
          goto error;
       }
 
-      while (p < labels_end)
-      {
-         char key[PROMETHEUS_LABEL_LENGTH] = {0};
-         char value[PROMETHEUS_LABEL_LENGTH] = {0};
-         size_t key_len = 0;
-         size_t value_len = 0;
-
-         while (p < labels_end && isspace((unsigned char)*p))
-         {
-            p++;
-         }
-
-         if (p >= labels_end)
-         {
-            break;
-         }
-
-         while (p < labels_end && *p != '=' && !isspace((unsigned char)*p))
-         {
-            if (key_len + 1 >= sizeof(key))
-            {
-               goto error;
-            }
-
-            key[key_len++] = *p;
-            p++;
-         }
-
-         while (p < labels_end && isspace((unsigned char)*p))
-         {
-            p++;
-         }
-
-         if (p >= labels_end || *p != '=')
-         {
-            goto error;
-         }
-         p++;
-
-         while (p < labels_end && isspace((unsigned char)*p))
-         {
-            p++;
-         }
-
-         if (p >= labels_end || *p != '"')
-         {
-            goto error;
-         }
-         p++;
-
-         while (p < labels_end)
-         {
-            if (*p == '"')
-            {
-               p++;
-               break;
-            }
-
-            if (*p == '\\' && (p + 1) < labels_end)
-            {
-               p++;
-
-               if (value_len + 1 >= sizeof(value))
-               {
-                  goto error;
-               }
-
-               switch (*p)
-               {
-                  case 'n':
-                     value[value_len++] = '\n';
-                     break;
-                  case 't':
-                     value[value_len++] = '\t';
-                     break;
-                  case 'r':
-                     value[value_len++] = '\r';
-                     break;
-                  default:
-                     value[value_len++] = *p;
-                     break;
-               }
-
-               p++;
-               continue;
-            }
-
-            if (value_len + 1 >= sizeof(value))
-            {
-               goto error;
-            }
-
-            value[value_len++] = *p;
-            p++;
-         }
-
-         if (key_len == 0)
-         {
-            goto error;
-         }
-
-         if (add_attribute(line_attrs, key, value))
-         {
-            goto error;
-         }
-
-         while (p < labels_end && isspace((unsigned char)*p))
-         {
-            p++;
-         }
-
-         if (p < labels_end)
-         {
-            if (*p != ',')
-            {
-               goto error;
-            }
-            p++;
-         }
-      }
-
+      labels = p;
+      length = (size_t)(labels_end - p) + 1;
       value_start = labels_end + 1;
    }
    else
@@ -1286,188 +1191,161 @@ add_line(struct main_configuration* config, struct prometheus_metric* metric, ch
       value_start = p;
    }
 
-   while (*value_start != '\0' && isspace((unsigned char)*value_start))
-   {
-      value_start++;
-   }
-
-   if (*value_start == '\0')
+   if (series_find_create(bridge, metric, endpoint, labels, length, &attributes))
    {
       goto error;
    }
 
-   value_end = value_start;
-   while (*value_end != '\0' && !isspace((unsigned char)*value_end))
-   {
-      value_end++;
-   }
+   value_start = skip_space(value_start);
 
+   value = strtod(value_start, &value_end);
    if (value_end == value_start)
    {
       goto error;
    }
 
-   line_value = strndup(value_start, (size_t)(value_end - value_start));
-   if (line_value == NULL)
-   {
-      goto error;
-   }
-
-   if (attributes_find_create(metric->definitions, line_attrs, &attributes, &is_new))
+   if (add_value(attributes->values, timestamp, value))
    {
       goto error;
    }
 
-   if (add_value(attributes->values, timestamp, line_value))
-   {
-      goto error;
-   }
-
-   if (!is_new)
-   {
-      pgagroal_deque_destroy(line_attrs);
-   }
-
-   free(endpoint_attr);
-   free(line_value);
-
    return 0;
 
 error:
 
-   pgagroal_deque_destroy(line_attrs);
-
-   free(endpoint_attr);
-   free(line_value);
-
    return 1;
 }
 
 static int
-parse_metric_name_from_line(char* line, char* metric_name, size_t size)
+parse_body_to_bridge(time_t timestamp, char* body, char* endpoint, struct prometheus_bridge* bridge)
 {
-   size_t idx = 0;
-   char* p = line;
+   char c;
+   char* p = NULL;
+   char* line = NULL;
+   char* end = NULL;
+   char* name = NULL;
+   char* text = NULL;
+   bool help = false;
+   struct prometheus_metric* metric = NULL;
 
-   if (line == NULL || metric_name == NULL || size == 0)
+   endpoint = intern(bridge, endpoint);
+   if (endpoint == NULL)
    {
-      return 1;
+      goto error;
    }
 
-   while (*p != '\0' && isspace((unsigned char)*p))
-   {
-      p++;
-   }
+   p = body;
 
-   if (*p == '\0')
+   while (*p != '\0')
    {
-      return 1;
-   }
+      line = p;
 
-   while (*p != '\0' && *p != '{' && !isspace((unsigned char)*p))
-   {
-      if (idx + 1 >= size)
+      end = strchr(line, '\n');
+      if (end != NULL)
       {
-         return 1;
+         *end = '\0';
+         p = end + 1;
+      }
+      else
+      {
+         end = line + strlen(line);
+         p = end;
       }
-      metric_name[idx++] = *p;
-      p++;
-   }
-
-   metric_name[idx] = '\0';
-
-   return idx == 0 ? 1 : 0;
-}
-
-static int
-parse_body_to_bridge(time_t timestamp, char* body, struct prometheus_bridge* bridge)
-{
-   char* line = NULL;
-   char* saveptr = NULL;
-   char name[MISC_LENGTH] = {0};
-   char help[MAX_PATH] = {0};
-   char type[MISC_LENGTH] = {0};
-   char sample_name[MISC_LENGTH] = {0};
-   struct prometheus_metric* metric = NULL;
-   struct main_configuration* config = NULL;
 
-   config = (struct main_configuration*)shmem;
-   if (config == NULL)
-   {
-      goto error;
-   }
+      if (end > line && *(end - 1) == '\r')
+      {
+         *(end - 1) = '\0';
+      }
 
-   line = strtok_r(body, "\n", &saveptr);
+      line = skip_space(line);
 
-   while (line != NULL)
-   {
-      if (line[0] == '\0' || !strcmp(line, "\r"))
+      if (*line == '\0')
       {
-         line = strtok_r(NULL, "\n", &saveptr);
          continue;
       }
 
-      if (line[0] == '#')
+      if (*line == '#')
       {
-         if (!strncmp(&line[1], "HELP", 4))
+         name = skip_space(line + 1);
+
+         if (!strncmp(name, "HELP", 4) && isspace((unsigned char)name[4]))
+         {
+            help = true;
+         }
+         else if (!strncmp(name, "TYPE", 4) && isspace((unsigned char)name[4]))
+         {
+            help = false;
+         }
+         else
          {
-            memset(name, 0, sizeof(name));
-            memset(help, 0, sizeof(help));
+            continue;
+         }
 
-            if (sscanf(line + 6, "%127s %1023[^\n]", name, help) == 2)
-            {
-               if (metric_find_create(bridge, name, &metric))
-               {
-                  goto error;
-               }
-
-               if (metric_set_name(metric, name) || metric_set_help(metric, help))
-               {
-                  goto error;
-               }
-            }
+         name = skip_space(name + 4);
+         text = find_space(name);
+
+         if (text == name || *text == '\0')
+         {
+            continue;
          }
-         else if (!strncmp(&line[1], "TYPE", 4))
+
+         *text = '\0';
+         text = skip_space(text + 1);
+
+         if (*text == '\0')
          {
-            memset(name, 0, sizeof(name));
-            memset(type, 0, sizeof(type));
+            continue;
+         }
 
-            if (sscanf(line + 6, "%127s %127[^\n]", name, type) == 2)
-            {
-               if (metric_find_create(bridge, name, &metric))
-               {
-                  goto error;
-               }
-
-               if (metric_set_type(metric, type))
-               {
-                  goto error;
-               }
-            }
+         if (metric_find_create(bridge, name, &metric))
+         {
+            goto error;
+         }
+
+         text = intern(bridge, text);
+         if (text == NULL)
+         {
+            goto error;
+         }
+
+         if (help)
+         {
+            metric->help = text;
+         }
+         else
+         {
+            metric->type = text;
          }
 
-         line = strtok_r(NULL, "\n", &saveptr);
          continue;
       }
 
-      memset(sample_name, 0, sizeof(sample_name));
-      if (parse_metric_name_from_line(line, sample_name, sizeof(sample_name)))
+      name = line;
+      text = name;
+      while (*text != '\0' && *text != '{' && !isspace((unsigned char)*text))
+      {
+         text++;
+      }
+
+      if (text == name)
       {
-         line = strtok_r(NULL, "\n", &saveptr);
          continue;
       }
 
-      if (metric_find_create(bridge, sample_name, &metric))
+      c = *text;
+      *text = '\0';
+
+      if (metric_find_create(bridge, name, &metric))
       {
          goto error;
       }
 
-      if (add_line(config, metric, line, timestamp))
+      *text = c;
+
+      if (add_line(bridge, metric, endpoint, text, timestamp))
       {
          goto error;
       }
-
-      line = strtok_r(NULL, "\n", &saveptr);
    }
 
    return 0;
@@ -1477,4 +1355,4 @@ error:
    bridge->metrics = NULL;
 
    return 1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,675 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <logging.h>
+#include <message.h>
+#include <query_cache.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static uint64_t key_hash(char* database, char* username, char* query, int length);
+static int key_write(char* key, char* database, char* username, char* query, int length);
+static struct query_cache_entry* entry_at(struct query_cache* cache, int index);
+static int skip_space(char* query, int length, int i);
+static int skip_quoted(char* query, int length, int i, char quote, bool backslash);
+static int skip_dollar(char* query, int length, int i);
+static bool word_is(char* word, int length, char* name);
+static bool word_in(char* word, int length, char** list);
+
+/* The words that may be followed by a parenthesis without being a function */
+static char* keywords[] = {
+   "all", "and", "any", "array", "as", "between", "by", "case", "cast", "distinct", "else", "except",
+   "exists", "filter", "from", "group", "having", "in", "intersect", "is", "join", "lateral", "like",
+   "limit", "not", "offset", "on", "or", "over", "row", "select", "some", "then", "union", "using",
+   "values", "when", "where", "within",
+   /* The type modifiers */
+   "bit", "char", "character", "decimal", "float", "interval", "numeric", "time", "timestamp",
+   "timestamptz", "timetz", "varbit", "varchar", "varying",
+   NULL};
+
+/* The functions without side effects whose result only depends on the arguments
+ * and the data. Any other function, a volatile one in particular, isn't cached */
+static char* functions[] = {
+   "abs", "array_agg", "array_length", "array_to_string", "avg", "bool_and", "bool_or", "btrim",
+   "ceil", "ceiling", "char_length", "character_length", "coalesce", "concat", "concat_ws", "count",
+   "date_part", "date_trunc", "dense_rank", "every", "exp", "extract", "first_value", "floor",
+   "format", "greatest", "initcap", "json_agg", "json_build_object", "jsonb_agg",
+   "jsonb_build_object", "lag", "last_value", "lead", "least", "left", "length", "ln", "log",
+   "lower", "lpad", "ltrim", "max", "md5", "min", "mod", "nullif", "octet_length", "position",
+   "power", "rank", "replace", "reverse", "right", "round", "row_number", "rpad", "rtrim", "sign",
+   "split_part", "sqrt", "string_agg", "strpos", "substr", "substring", "sum", "to_char",
+   "to_date", "to_number", "translate", "trim", "trunc", "unnest", "upper",
+   NULL};
+
+/* The hash of the startup parameters of the client that change the results */
+static uint64_t session = 0;
+
+int
+pgagroal_query_cache_init(size_t* p_size, void** p_shmem)
+{
+   size_t size;
+   int entries;
+   struct query_cache* cache = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   entries = config->query_cache_max_size / QUERY_CACHE_ENTRY_SIZE;
+   if (entries < QUERY_CACHE_PROBES)
+   {
+      entries = QUERY_CACHE_PROBES;
+   }
+
+   size = sizeof(struct query_cache) + (size_t)entries * QUERY_CACHE_ENTRY_SIZE;
+
+   if (pgagroal_create_shared_memory(size, config->common.hugepage, (void**)&cache))
+   {
+      goto error;
+   }
+
+   atomic_init(&cache->clock, 0);
+   cache->number_of_entries = entries;
+
+   for (int i = 0; i < entries; i++)
+   {
+      struct query_cache_entry* e = entry_at(cache, i);
+
+      atomic_init(&e->lock, 0);
+      atomic_init(&e->hash, 0);
+      atomic_init(&e->used, 0);
+   }
+
+   *p_shmem = cache;
+   *p_size = size;
+
+   return 0;
+
+error:
+
+   config->query_cache_max_size = 0;
+   pgagroal_log_error("Cannot allocate shared memory for the query cache");
+   *p_size = 0;
+   *p_shmem = NULL;
+
+   return 1;
+}
+
+bool
+pgagroal_query_cache_cacheable(char* query, int length)
+{
+   int i = 0;
+   int start;
+   int word;
+   int next;
+   bool first = true;
+
+   /* The query text of a Q message is zero terminated */
+   while (length > 0 && query[length - 1] == '\0')
+   {
+      length--;
+   }
+
+   while (true)
+   {
+      char c;
+
+      i = skip_space(query, length, i);
+      if (i < 0 || i >= length)
+      {
+         break;
+      }
+
+      c = query[i];
+
+      if (c == '\'')
+      {
+         i = skip_quoted(query, length, i, '\'', false);
+      }
+      else if (c == '"')
+      {
+         /* A quoted name is never a function we know */
+         i = skip_quoted(query, length, i, '"', false);
+         next = skip_space(query, length, i);
+         if (next >= 0 && next < length && query[next] == '(')
+         {
+            return false;
+         }
+      }
+      else if (c == '$' && i + 1 < length && !isdigit((unsigned char)query[i + 1]))
+      {
+         i = skip_dollar(query, length, i);
+      }
+      else if (c == '\0' || c == ';')
+      {
+         /* More than one statement */
+         return false;
+      }
+      else if (isalpha((unsigned char)c) || c == '_')
+      {
+         start = i;
+         while (i < length && (isalnum((unsigned char)query[i]) || query[i] == '_' || query[i] == '$'))
+         {
+            i++;
+         }
+         word = i - start;
+
+         if (first)
+         {
+            if (!word_is(query + start, word, "select"))
+            {
+               return false;
+            }
+            first = false;
+         }
+
+         /* SELECT INTO creates a table, and FOR UPDATE and FOR SHARE lock the rows */
+         if (word_is(query + start, word, "into") || word_is(query + start, word, "for"))
+         {
+            return false;
+         }
+
+         next = skip_space(query, length, i);
+
+         if (i < length && query[i] == '\'' && word_is(query + start, word, "e"))
+         {
+            i = skip_quoted(query, length, i, '\'', true);
+         }
+         else if (next >= 0 && next < length && query[next] == '(' &&
+                  !word_in(query + start, word, keywords) && !word_in(query + start, word, functions))
+         {
+            return false;
+         }
+      }
+      else
+      {
+         i++;
+      }
+
+      /* An unterminated literal */
+      if (i < 0)
+      {
+         break;
+      }
+   }
+
+   /* An unterminated literal or comment */
+   if (i < 0)
+   {
+      return false;
+   }
+
+   return !first;
+}
+
+bool
+pgagroal_query_cache_reply(int* state, struct message_frame* frame)
+{
+   switch (*state)
+   {
+      case QUERY_CACHE_REPLY_DESCRIPTION:
+         if (frame->kind != 'T')
+         {
+            return false;
+         }
+         *state = QUERY_CACHE_REPLY_ROWS;
+         return true;
+      case QUERY_CACHE_REPLY_ROWS:
+         if (frame->kind == 'D')
+         {
+            return true;
+         }
+
+         if (frame->kind != 'C' || frame->available < 7 || strncmp(frame->body, "SELECT ", 7))
+         {
+            return false;
+         }
+         *state = QUERY_CACHE_REPLY_READY;
+         return true;
+      case QUERY_CACHE_REPLY_READY:
+         if (frame->kind != 'Z' || frame->available < 1 || frame->body[0] != 'I')
+         {
+            return false;
+         }
+         *state = QUERY_CACHE_REPLY_DONE;
+         return true;
+      default:
+         break;
+   }
+
+   return false;
+}
+
+void
+pgagroal_query_cache_startup(struct message* msg)
+{
+   int i;
+   char* data = (char*)msg->data;
+   char* name = NULL;
+   char* value = NULL;
+
+   /* FNV-1a */
+   session = 14695981039346656037ULL;
+
+   /* The parameters start after the protocol version, and the message is zero terminated */
+   i = 8;
+   while (i < msg->length - 1 && data[i] != '\0')
+   {
+      name = data + i;
+      i += strlen(name) + 1;
+
+      if (i >= msg->length)
+      {
+         break;
+      }
+
+      value = data + i;
+      i += strlen(value) + 1;
+
+      /* The database and the user are in the key already */
+      if (!strcmp(name, "user") || !strcmp(name, "database") || !strcmp(name, "application_name"))
+      {
+         continue;
+      }
+
+      for (char* c = name; *c != '\0'; c++)
+      {
+         session = (session ^ (unsigned char)*c) * 1099511628211ULL;
+      }
+      session = (session ^ 0xFF) * 1099511628211ULL;
+      for (char* c = value; *c != '\0'; c++)
+      {
+         session = (session ^ (unsigned char)*c) * 1099511628211ULL;
+      }
+      session = (session ^ 0xFF) * 1099511628211ULL;
+   }
+}
+
+bool
+pgagroal_query_cache_session(char* query, int length)
+{
+   int i;
+   int start;
+
+   i = skip_space(query, length, 0);
+   if (i < 0)
+   {
+      return false;
+   }
+
+   start = i;
+   while (i < length && isalpha((unsigned char)query[i]))
+   {
+      i++;
+   }
+
+   if (word_is(query + start, i - start, "set") || word_is(query + start, i - start, "reset") ||
+       word_is(query + start, i - start, "discard") || word_is(query + start, i - start, "load"))
+   {
+      return true;
+   }
+
+   for (int j = 0; j + 10 <= length; j++)
+   {
+      if (!strncasecmp(query + j, "set_config", 10))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+int
+pgagroal_query_cache_get(char* database, char* username, char* query, int length, char* data, int* data_length)
+{
+   int lock;
+   uint64_t hash;
+   time_t now;
+   char key[QUERY_CACHE_ENTRY_SIZE];
+   int key_length;
+   struct query_cache* cache = NULL;
+   struct query_cache_entry* e = NULL;
+
+   cache = (struct query_cache*)query_cache_shmem;
+   *data_length = 0;
+
+   if (cache == NULL)
+   {
+      return 1;
+   }
+
+   key_length = key_write(&key[0], database, username, query, length);
+   if (key_length == 0)
+   {
+      return 1;
+   }
+
+   hash = key_hash(database, username, query, length);
+   now = time(NULL);
+
+   for (int i = 0; i < QUERY_CACHE_PROBES; i++)
+   {
+      e = entry_at(cache, (hash + i) % cache->number_of_entries);
+
+      if (atomic_load(&e->hash) != hash)
+      {
+         continue;
+      }
+
+      /* Readers share the entry, and a writer never waits for them */
+      lock = atomic_load(&e->lock);
+      if (lock < 0 || !atomic_compare_exchange_strong(&e->lock, &lock, lock + 1))
+      {
+         continue;
+      }
+
+      if (atomic_load(&e->hash) == hash && e->valid_until > now && e->key_length == key_length &&
+          !memcmp((char*)(e + 1), &key[0], key_length))
+      {
+         memcpy(data, (char*)(e + 1) + key_length, e->data_length);
+         *data_length = e->data_length;
+         atomic_store(&e->used, atomic_fetch_add(&cache->clock, 1) + 1);
+      }
+
+      atomic_fetch_sub(&e->lock, 1);
+
+      if (*data_length > 0)
+      {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+void
+pgagroal_query_cache_put(char* database, char* username, char* query, int length, char* data, int data_length)
+{
+   int lock;
+   uint64_t hash;
+   uint64_t used;
+   time_t now;
+   int key_length;
+   struct query_cache* cache = NULL;
+   struct query_cache_entry* e = NULL;
+   struct query_cache_entry* victim = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   cache = (struct query_cache*)query_cache_shmem;
+
+   if (cache == NULL || data_length <= 0)
+   {
+      return;
+   }
+
+   key_length = (int)strlen(database) + 1 + (int)strlen(username) + 1 + (int)sizeof(session) + length;
+   if (sizeof(struct query_cache_entry) + key_length + data_length > QUERY_CACHE_ENTRY_SIZE)
+   {
+      return;
+   }
+
+   hash = key_hash(database, username, query, length);
+   now = time(NULL);
+
+   /* The same key, an empty or expired entry, or else the least recently used */
+   for (int i = 0; i < QUERY_CACHE_PROBES; i++)
+   {
+      e = entry_at(cache, (hash + i) % cache->number_of_entries);
+      used = atomic_load(&e->hash);
+
+      if (used == hash || used == 0 || e->valid_until <= now)
+      {
+         victim = e;
+         break;
+      }
+
+      if (victim == NULL || atomic_load(&e->used) < atomic_load(&victim->used))
+      {
+         victim = e;
+      }
+   }
+
+   lock = 0;
+   if (!atomic_compare_exchange_strong(&victim->lock, &lock, -1))
+   {
+      return;
+   }
+
+   atomic_store(&victim->hash, 0);
+
+   key_write((char*)(victim + 1), database, username, query, length);
+   memcpy((char*)(victim + 1) + key_length, data, data_length);
+   victim->key_length = key_length;
+   victim->data_length = data_length;
+   victim->valid_until = now + pgagroal_time_convert(config->query_cache_max_age, FORMAT_TIME_S);
+   atomic_store(&victim->used, atomic_fetch_add(&cache->clock, 1) + 1);
+   atomic_store(&victim->hash, hash);
+
+   atomic_store(&victim->lock, 0);
+}
+
+static uint64_t
+key_hash(char* database, char* username, char* query, int length)
+{
+   uint64_t hash;
+
+   /* FNV-1a */
+   hash = 14695981039346656037ULL;
+   for (char* c = database; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+   }
+   hash = (hash ^ 0xFF) * 1099511628211ULL;
+   for (char* c = username; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+   }
+   hash = (hash ^ 0xFF) * 1099511628211ULL;
+   hash = (hash ^ session) * 1099511628211ULL;
+   for (int i = 0; i < length; i++)
+   {
+      hash = (hash ^ (unsigned char)query[i]) * 1099511628211ULL;
+   }
+
+   /* 0 marks an empty entry */
+   return hash != 0 ? hash : 1;
+}
+
+static int
+key_write(char* key, char* database, char* username, char* query, int length)
+{
+   size_t d = strlen(database) + 1;
+   size_t u = strlen(username) + 1;
+
+   size_t s = sizeof(session);
+
+   if (d + u + s + length > QUERY_CACHE_ENTRY_SIZE - sizeof(struct query_cache_entry))
+   {
+      return 0;
+   }
+
+   memcpy(key, database, d);
+   memcpy(key + d, username, u);
+   memcpy(key + d + u, &session, s);
+   memcpy(key + d + u + s, query, length);
+
+   return (int)(d + u + s + length);
+}
+
+static struct query_cache_entry*
+entry_at(struct query_cache* cache, int index)
+{
+   return (struct query_cache_entry*)(cache->entries + (size_t)index * QUERY_CACHE_ENTRY_SIZE);
+}
+
+static int
+skip_space(char* query, int length, int i)
+{
+   while (i >= 0 && i < length)
+   {
+      if (isspace((unsigned char)query[i]))
+      {
+         i++;
+      }
+      else if (query[i] == '-' && i + 1 < length && query[i + 1] == '-')
+      {
+         while (i < length && query[i] != '\n')
+         {
+            i++;
+         }
+      }
+      else if (query[i] == '/' && i + 1 < length && query[i + 1] == '*')
+      {
+         int depth = 0;
+
+         /* The block comments nest */
+         do
+         {
+            if (i + 1 >= length)
+            {
+               return -1;
+            }
+
+            if (query[i] == '/' && query[i + 1] == '*')
+            {
+               depth++;
+               i += 2;
+            }
+            else if (query[i] == '*' && query[i + 1] == '/')
+            {
+               depth--;
+               i += 2;
+            }
+            else
+            {
+               i++;
+            }
+         }
+         while (depth > 0);
+      }
+      else
+      {
+         break;
+      }
+   }
+
+   return i;
+}
+
+static int
+skip_quoted(char* query, int length, int i, char quote, bool backslash)
+{
+   i++;
+
+   while (i < length)
+   {
+      if (backslash && query[i] == '\\')
+      {
+         i += 2;
+      }
+      else if (query[i] == quote)
+      {
+         /* A doubled quote is part of the text */
+         if (i + 1 < length && query[i + 1] == quote)
+         {
+            i += 2;
+         }
+         else
+         {
+            return i + 1;
+         }
+      }
+      else
+      {
+         i++;
+      }
+   }
+
+   return -1;
+}
+
+static int
+skip_dollar(char* query, int length, int i)
+{
+   int tag;
+
+   /* $tag$ or $$ starts the text, and the same tag ends it */
+   tag = i + 1;
+   while (tag < length && (isalnum((unsigned char)query[tag]) || query[tag] == '_'))
+   {
+      tag++;
+   }
+
+   if (tag >= length || query[tag] != '$')
+   {
+      return i + 1;
+   }
+
+   tag = tag - i + 1;
+
+   for (int j = i + tag; j + tag <= length; j++)
+   {
+      if (!memcmp(query + j, query + i, tag))
+      {
+         return j + tag;
+      }
+   }
+
+   return -1;
+}
+
+static bool
+word_is(char* word, int length, char* name)
+{
+   return (int)strlen(name) == length && !strncasecmp(word, name, length);
+}
+
+static bool
+word_in(char* word, int length, char** list)
+{
+   for (int i = 0; list[i] != NULL; i++)
+   {
+      if (word_is(word, length, list[i]))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
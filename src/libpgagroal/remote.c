@@ -38,12 +38,18 @@
 #include <utils.h>
 
 /* system */
+#include <errno.h>
 #include <ev.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
+static int wait_request(SSL* ssl, int fd, int timeout);
+
 void
 pgagroal_remote_management(int client_fd, char* address)
 {
@@ -68,32 +74,42 @@ pgagroal_remote_management(int client_fd, char* address)
    auth_status = pgagroal_remote_management_auth(client_fd, address, &client_ssl);
    if (auth_status == AUTH_SUCCESS)
    {
-      if (pgagroal_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, &server_fd))
+      /* The session stays open, so any number of commands can be sent, or pipelined, after one authentication */
+      while (!wait_request(client_ssl, client_fd, (int)MIN(pgagroal_time_convert(config->management_timeout, FORMAT_TIME_S) * 1000, INT_MAX)))
       {
-         goto done;
-      }
-
-      if (pgagroal_management_read_json(client_ssl, client_fd, &compression, &encryption, &payload))
-      {
-         goto done;
-      }
-
-      if (pgagroal_management_write_json(NULL, server_fd, compression, encryption, payload))
-      {
-         goto done;
-      }
-
-      pgagroal_json_destroy(payload);
-      payload = NULL;
-
-      if (pgagroal_management_read_json(NULL, server_fd, &compression, &encryption, &payload))
-      {
-         goto done;
-      }
-
-      if (pgagroal_management_write_json(client_ssl, client_fd, compression, encryption, payload))
-      {
-         goto done;
+         if (pgagroal_management_read_json(client_ssl, client_fd, &compression, &encryption, &payload))
+         {
+            goto done;
+         }
+
+         if (pgagroal_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, &server_fd))
+         {
+            goto done;
+         }
+
+         if (pgagroal_management_write_json(NULL, server_fd, compression, encryption, payload))
+         {
+            goto done;
+         }
+
+         pgagroal_json_destroy(payload);
+         payload = NULL;
+
+         if (pgagroal_management_read_json(NULL, server_fd, &compression, &encryption, &payload))
+         {
+            goto done;
+         }
+
+         if (pgagroal_management_write_json(client_ssl, client_fd, compression, encryption, payload))
+         {
+            goto done;
+         }
+
+         pgagroal_json_destroy(payload);
+         payload = NULL;
+
+         pgagroal_disconnect(server_fd);
+         server_fd = -1;
       }
    }
    else
@@ -130,3 +146,43 @@ done:
 
    exit(exit_code);
 }
+
+static int
+wait_request(SSL* ssl, int fd, int timeout)
+{
+   int ret;
+   char b;
+   struct pollfd pfd;
+
+   if (ssl != NULL && SSL_pending(ssl) > 0)
+   {
+      return 0;
+   }
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   do
+   {
+      ret = poll(&pfd, 1, timeout > 0 ? timeout : -1);
+   }
+   while (ret == -1 && errno == EINTR);
+
+   if (ret <= 0)
+   {
+      if (ret == 0)
+      {
+         pgagroal_log_debug("pgagroal_remote_management: idle session %d", fd);
+      }
+      return 1;
+   }
+
+   /* A client ending the session is not a request */
+   if (ssl != NULL)
+   {
+      return SSL_peek(ssl, &b, 1) > 0 ? 0 : 1;
+   }
+
+   return recv(fd, &b, 1, MSG_PEEK) > 0 ? 0 : 1;
+}
@@ -33,10 +33,15 @@
 #include <memory.h>
 #include <message.h>
 #include <network.h>
+#include <parameters.h>
 #include <pool.h>
+#include <probes.h>
 #include <prometheus.h>
+#include <query_cache.h>
 #include <security.h>
 #include <server.h>
+#include <shmem.h>
+#include <slowlog.h>
 #include <tls.h>
 #include <tracker.h>
 #include <utils.h>
@@ -65,6 +70,7 @@
 #include <openssl/params.h>
 #include <openssl/core_names.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -75,6 +81,7 @@ static char CHARS[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L
                        '!', '@', '$', '%', '^', '&', '*', '(', ')', '-', '_', '=', '+', '[', '{', ']', '}', '\\', '|', ':',
                        '\'', '\"', ',', '<', '.', '>', '/', '?'};
 
+static int authenticate(int client_fd, char* address, int* slot, SSL** client_ssl, SSL** server_ssl);
 static int get_auth_type(struct message* msg, int* auth_type);
 static int compare_auth_response(struct message* orig, struct message* response, int auth_type);
 
@@ -93,15 +100,21 @@ static int server_password(char* username, char* password, int slot, SSL* server
 static int server_scram256(char* username, char* password, int slot, SSL* server_ssl);
 
 static bool is_allowed(char* username, char* database, char* address, int* hba_method);
-static bool is_allowed_username(char* username, char* entry);
-static bool is_allowed_database(char* database, char* entry);
-static bool is_allowed_address(char* address, char* entry);
+static int hba_lookup(char* username, char* database, bool all_databases, char* address);
+static int hba_compile_address(struct hba_matcher* matcher, int entry, char* address);
+static void hba_match_address(struct hba_matcher* matcher, char* address, uint64_t* candidates);
+static int hba_name_add(struct main_configuration* config, struct hba_name* names, int size, bool database,
+                        char* name, int hba, int limit, int alias, int entry);
+static struct hba_name* hba_name_find(struct main_configuration* config, struct hba_name* names, int size, bool database, char* name);
+static char* hba_name_string(struct main_configuration* config, struct hba_name* name, bool database);
+static unsigned int hba_name_hash(char* name);
 static bool is_disabled(char* database);
 
-static int get_hba_method(int index);
+static int get_hba_method(char* method);
 
 static char* get_frontend_password(char* username);
 static char* get_admin_password(char* username);
+static struct user* get_verifier(char* password);
 
 char* pgagroal_get_user_password(char* username);
 
@@ -112,6 +125,7 @@ static int generate_nounce(char** nounce);
 static int scram_parse_iterations(char* str, int* iterations);
 static int get_scram_attribute(char attribute, char* input, size_t size, char** value);
 static int client_proof(char* password, char* salt, int salt_length, int iterations,
+                        char* client_key, int client_key_length,
                         char* client_first_message_bare, size_t client_first_message_bare_length,
                         char* server_first_message, size_t server_first_message_length,
                         char* client_final_message_wo_proof, size_t client_final_message_wo_proof_length,
@@ -127,6 +141,11 @@ static int salted_password_key(unsigned char* salted_password, int salted_passwo
                                unsigned char** result, int* result_length);
 static int stored_key(unsigned char* client_key, int client_key_length, unsigned char** result, int* result_length);
 static int generate_salt(char** salt, int* size);
+static int scram_keys(char* username, char* password, char* salt, int salt_length, int iterations,
+                      char* client_key, char* server_key);
+static void scram_keys_invalidate(char* username, char* salt, int salt_length, int iterations);
+static unsigned int scram_keys_hash(char* username, char* salt, int salt_length, int iterations);
+static int scram_keys_digest(char* password, char* salt, int salt_length, char* digest);
 static int server_signature(char* password, char* salt, int salt_length, int iterations,
                             char* server_key, int server_key_length,
                             char* client_first_message_bare, size_t client_first_message_bare_length,
@@ -136,22 +155,48 @@ static int server_signature(char* password, char* salt, int salt_length, int ite
 
 static bool is_tls_user(char* username, char* database);
 static int establish_client_tls_connection(int server, int fd, SSL** ssl);
-static int create_client_tls_connection(int fd, SSL** ssl, char* tls_key_file, char* tls_cert_file, char* tls_ca_file);
+static bool is_direct_tls(int client_fd);
+static int accept_client_tls(int client_fd, bool direct, SSL** client_ssl);
+static int create_client_tls_connection(int server, int fd, SSL** ssl);
 
 static int auth_query(SSL* c_ssl, int client_fd, int slot, char* username, char* database, int hba_method);
 static int auth_query_get_connection(char* username, char* password, char* database, int* server_fd, SSL** server_ssl);
 
 static int auth_query_get_password(int socket, SSL* server_ssl, char* username, char* database, char** password);
 static int auth_query_client_scram256(SSL* c_ssl, int client_fd, char* username, char* shadow, int slot);
+static int auth_query_cache_get(char* username, char* database, bool* found, char** shadow);
+static void auth_query_cache_put(char* username, char* database, char* shadow);
+static unsigned int auth_query_cache_hash(char* username, char* database);
 static char* resolve_database_alias(char* username, char* database);
+static void security_store_lock(void);
+static void security_store_unlock(void);
+static void security_store_release(int entry);
+
+static int scratch_slot = -1;
+static char scratch[NUMBER_OF_SECURITY_MESSAGES][SECURITY_BUFFER_SIZE];
+static char scratch_none[SECURITY_BUFFER_SIZE];
 
 int
 pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl, SSL** server_ssl)
+{
+   int ret;
+   struct timespec start;
+
+   pgagroal_probe_clock(&start);
+   pgagroal_probe_authenticate_start(client_fd, address);
+
+   ret = authenticate(client_fd, address, slot, client_ssl, server_ssl);
+
+   pgagroal_probe_authenticate_done(client_fd, *slot, ret, &start);
+
+   return ret;
+}
+
+static int
+authenticate(int client_fd, char* address, int* slot, SSL** client_ssl, SSL** server_ssl)
 {
    int status = MESSAGE_STATUS_ERROR;
    int ret;
-   int server = 0;
-   int server_fd = -1;
    int hba_method;
    struct main_configuration* config;
    struct message* msg = NULL;
@@ -168,8 +213,20 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
    *client_ssl = NULL;
    *server_ssl = NULL;
 
+   /* A client with direct TLS starts the handshake instead of sending an SSLRequest */
+   if (config->common.tls && is_direct_tls(client_fd))
+   {
+      pgagroal_log_debug("Direct TLS from client: %d", client_fd);
+
+      if (accept_client_tls(client_fd, true, client_ssl))
+      {
+         goto error;
+      }
+      c_ssl = *client_ssl;
+   }
+
    /* Receive client calls - at any point if client exits return AUTH_ERROR */
-   status = pgagroal_read_timeout_message(NULL, client_fd, pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S), &msg);
+   status = pgagroal_read_timeout_message(c_ssl, client_fd, pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S), &msg);
    if (status != MESSAGE_STATUS_OK)
    {
       goto error;
@@ -182,45 +239,18 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
    {
       pgagroal_log_debug("Cancel request from client: %d", client_fd);
 
-      /* We need to find the server for the connection */
-      if (pgagroal_get_primary(&server))
-      {
-         pgagroal_log_error("pgagroal: No valid server available");
-         pgagroal_write_connection_refused(NULL, client_fd);
-         pgagroal_write_empty(NULL, client_fd);
-         goto error;
-      }
-
-      if (config->servers[server].host[0] == '/')
-      {
-         char pgsql[MISC_LENGTH];
-
-         memset(&pgsql, 0, sizeof(pgsql));
-         pgagroal_snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->servers[server].port);
-         ret = pgagroal_connect_unix_socket(config->servers[server].host, &pgsql[0], &server_fd);
-      }
-      else
-      {
-         ret = pgagroal_connect(config->servers[server].host, config->servers[server].port, &server_fd, config->keep_alive, config->nodelay);
-      }
-
-      if (ret)
+      if (msg->length < 16)
       {
-         pgagroal_log_error("pgagroal: No connection to %s:%d", config->servers[server].host, config->servers[server].port);
          goto error;
       }
 
-      status = pgagroal_write_message(NULL, server_fd, msg);
-      if (status != MESSAGE_STATUS_OK)
+      /* The client knows the key of the backend, which tells the server the backend is on */
+      if (pgagroal_cancel_request(pgagroal_read_int32(msg->data + 8), pgagroal_read_int32(msg->data + 12)))
       {
-         pgagroal_disconnect(server_fd);
-
          goto error;
       }
       pgagroal_clear_message(msg);
 
-      pgagroal_disconnect(server_fd);
-
       return AUTH_BAD_PASSWORD;
    }
 
@@ -244,51 +274,19 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
    }
 
    /* SSL request: 80877103 */
-   if (request == 80877103)
+   if (request == 80877103 && c_ssl == NULL)
    {
       pgagroal_log_debug("SSL request from client: %d", client_fd);
 
       if (config->common.tls)
       {
-         SSL_CTX* ctx = NULL;
-
-         /* We are acting as a server against the client */
-         if (pgagroal_create_ssl_ctx(false, &ctx))
-         {
-            goto error;
-         }
-
-         struct tls* c_tls = NULL;
-
-         if (pgagroal_tls_create_server(ctx, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file, &c_tls))
-         {
-            pgagroal_log_debug("authenticate: connection error");
-            pgagroal_write_connection_refused(NULL, client_fd);
-            pgagroal_write_empty(NULL, client_fd);
-            goto error;
-         }
-
-         pgagroal_tls_set_fd(c_tls, client_fd);
-         c_ssl = c_tls->ssl;
-         *client_ssl = c_ssl;
-
-         /* Switch to TLS mode */
-         status = pgagroal_write_tls(NULL, client_fd);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
          pgagroal_clear_message(msg);
 
-         /* Drive the handshake through the socket shim (memory BIOs) */
-         if (pgagroal_tls_socket_handshake(c_tls, client_fd) != PGAGROAL_TLS_OK)
+         if (accept_client_tls(client_fd, false, client_ssl))
          {
-            unsigned long err;
-
-            err = ERR_get_error();
-            pgagroal_log_error("SSL failed: %s", ERR_reason_error_string(err));
             goto error;
          }
+         c_ssl = *client_ssl;
 
          status = pgagroal_read_timeout_message(c_ssl, client_fd, pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S), &msg);
          if (status != MESSAGE_STATUS_OK)
@@ -324,6 +322,16 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
       pgagroal_log_trace("authenticate: username/database (%d)", client_fd);
       pgagroal_extract_username_database(request_msg, &username, &database, &appname);
 
+      if (config->track_session_parameters)
+      {
+         pgagroal_parameters_startup(request_msg);
+      }
+
+      if (query_cache_shmem != NULL)
+      {
+         pgagroal_query_cache_startup(request_msg);
+      }
+
       /* TLS scenario */
       if (is_tls_user(username, database) && c_ssl == NULL)
       {
@@ -372,7 +380,16 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
 
       /* Get connection */
       pgagroal_tracking_event_basic(TRACKER_AUTHENTICATE, username, database);
-      ret = pgagroal_get_connection(username, database, true, false, slot, server_ssl);
+      pgagroal_slowlog_application_name(appname);
+      if (strlen(config->replica_application_name) > 0 && appname != NULL &&
+          !strcmp(appname, config->replica_application_name))
+      {
+         ret = pgagroal_get_replica_connection(username, database, slot, server_ssl);
+      }
+      else
+      {
+         ret = pgagroal_get_connection(username, database, true, false, slot, server_ssl);
+      }
       if (ret != 0)
       {
          if (ret == 1)
@@ -396,8 +413,8 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
       /* Set the application_name on the connection */
       if (appname != NULL)
       {
-         memset(&config->connections[*slot].appname, 0, MAX_APPLICATION_NAME);
-         memcpy(&config->connections[*slot].appname, appname, strlen(appname));
+         memset(&pgagroal_connection_info(*slot)->appname, 0, MAX_APPLICATION_NAME);
+         memcpy(&pgagroal_connection_info(*slot)->appname, appname, strlen(appname));
       }
 
       if (config->connections[*slot].has_security != SECURITY_INVALID)
@@ -431,6 +448,11 @@ pgagroal_authenticate(int client_fd, char* address, int* slot, SSL** client_ssl,
             goto error;
          }
 
+         if (config->track_session_parameters)
+         {
+            pgagroal_parameters_created(*slot);
+         }
+
          pgagroal_log_debug("authenticate: created pooled connection (%d)", *slot);
       }
 
@@ -491,7 +513,7 @@ accept_ssl_vault(struct vault_configuration* config, int client_fd, SSL** client
    SSL_CTX* ctx = NULL;
    SSL* c_ssl = NULL;
 
-   /* We are acting as a server against the client */
+   /* We are acting as a server against the client, the shared contexts are in the main configuration only */
    if (pgagroal_create_ssl_ctx(false, &ctx))
    {
       goto error;
@@ -553,6 +575,7 @@ pgagroal_prefill_auth(char* username, char* password, char* database, int* slot,
    int ret = -1;
    int status = -1;
    char* real_database = NULL;
+   struct timespec phase_start;
 
    config = (struct main_configuration*)shmem;
 
@@ -575,6 +598,8 @@ pgagroal_prefill_auth(char* username, char* password, char* database, int* slot,
       goto error;
    }
 
+   clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
    status = pgagroal_write_message(*server_ssl, server_fd, startup_msg);
    if (status != MESSAGE_STATUS_OK)
    {
@@ -608,6 +633,9 @@ pgagroal_prefill_auth(char* username, char* password, char* database, int* slot,
       goto error;
    }
 
+   pgagroal_prometheus_backend_phase(config->connections[*slot].server, PROMETHEUS_PHASE_AUTHENTICATION,
+                                     pgagroal_time_elapsed_usec(&phase_start));
+
    server_state = atomic_load(&config->servers[config->connections[*slot].server].state);
    if (server_state == SERVER_NOTINIT || server_state == SERVER_NOTINIT_PRIMARY)
    {
@@ -683,12 +711,12 @@ pgagroal_remote_management_auth(int client_fd, char* address, SSL** client_ssl)
          SSL_CTX* ctx = NULL;
 
          /* We are acting as a server against the client */
-         if (pgagroal_create_ssl_ctx(false, &ctx))
+         if (pgagroal_tls_server_context(&ctx))
          {
             goto error;
          }
 
-         if (pgagroal_create_ssl_server(ctx, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file, client_fd, &c_ssl))
+         if (pgagroal_create_ssl_server(ctx, NULL, NULL, NULL, client_fd, &c_ssl))
          {
             goto error;
          }
@@ -1093,6 +1121,7 @@ pgagroal_remote_management_scram_sha256(char* username, char* password, int serv
    server_first_message = sasl_continue->data + 9;
 
    if (client_proof(password_prep, salt, salt_length, iteration,
+                    NULL, 0,
                     client_first_message_bare, sasl_response->length - 26,
                     server_first_message, sasl_continue->length - 9,
                     &wo_proof[0], strlen(wo_proof),
@@ -1411,8 +1440,8 @@ use_pooled_connection(SSL* c_ssl, int client_fd, int slot, char* username, char*
    else if (password == NULL)
    {
       /* We can only deal with SECURITY_TRUST and SECURITY_PASSWORD */
-      pgagroal_create_message(&config->connections[slot].security_messages[0],
-                              config->connections[slot].security_lengths[0],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 0),
+                              pgagroal_connection_info(slot)->security_lengths[0],
                               &auth_msg);
 
       status = pgagroal_write_message(c_ssl, client_fd, auth_msg);
@@ -1432,8 +1461,8 @@ use_pooled_connection(SSL* c_ssl, int client_fd, int slot, char* username, char*
             goto error;
          }
 
-         pgagroal_create_message(&config->connections[slot].security_messages[1],
-                                 config->connections[slot].security_lengths[1],
+         pgagroal_create_message(pgagroal_security_get_message(slot, 1),
+                                 pgagroal_connection_info(slot)->security_lengths[1],
                                  &auth_msg);
 
          if (compare_auth_response(auth_msg, msg, config->connections[slot].has_security))
@@ -1447,8 +1476,8 @@ use_pooled_connection(SSL* c_ssl, int client_fd, int slot, char* username, char*
          pgagroal_free_message(auth_msg);
          auth_msg = NULL;
 
-         pgagroal_create_message(&config->connections[slot].security_messages[2],
-                                 config->connections[slot].security_lengths[2],
+         pgagroal_create_message(pgagroal_security_get_message(slot, 2),
+                                 pgagroal_connection_info(slot)->security_lengths[2],
                                  &auth_msg);
 
          status = pgagroal_write_message(c_ssl, client_fd, auth_msg);
@@ -1541,6 +1570,8 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
    char* client_database = NULL;
    char* client_appname = NULL;
    char* real_database = NULL;
+   struct timespec phase_start;
+   long long startup_usec = 0;
 
    config = (struct main_configuration*)shmem;
    server_fd = config->connections[slot].fd;
@@ -1561,7 +1592,17 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
    }
 
    /* TLS support */
-   establish_client_tls_connection(config->connections[slot].server, server_fd, server_ssl);
+   clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
+   if (establish_client_tls_connection(config->connections[slot].server, server_fd, server_ssl) != AUTH_SUCCESS)
+   {
+      goto error;
+   }
+
+   if (*server_ssl != NULL)
+   {
+      pgagroal_prometheus_backend_phase(config->connections[slot].server, PROMETHEUS_PHASE_TLS, pgagroal_time_elapsed_usec(&phase_start));
+   }
 
    /* Send auth request to PostgreSQL */
    pgagroal_log_trace("authenticate: client auth request (%d)", client_fd);
@@ -1575,18 +1616,18 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
    // Store the extracted values in the connection slot
    if (client_username != NULL)
    {
-      memset(&config->connections[slot].username, 0, MAX_USERNAME_LENGTH);
-      memcpy(&config->connections[slot].username, client_username, strlen(client_username));
+      memset(&pgagroal_connection_info(slot)->username, 0, MAX_USERNAME_LENGTH);
+      memcpy(&pgagroal_connection_info(slot)->username, client_username, strlen(client_username));
    }
    if (client_database != NULL)
    {
-      memset(&config->connections[slot].database, 0, MAX_DATABASE_LENGTH);
-      memcpy(&config->connections[slot].database, client_database, strlen(client_database));
+      memset(&pgagroal_connection_info(slot)->database, 0, MAX_DATABASE_LENGTH);
+      memcpy(&pgagroal_connection_info(slot)->database, client_database, strlen(client_database));
    }
    if (client_appname != NULL)
    {
-      memset(&config->connections[slot].appname, 0, MAX_APPLICATION_NAME);
-      memcpy(&config->connections[slot].appname, client_appname, strlen(client_appname));
+      memset(&pgagroal_connection_info(slot)->appname, 0, MAX_APPLICATION_NAME);
+      memcpy(&pgagroal_connection_info(slot)->appname, client_appname, strlen(client_appname));
    }
 
    // Create startup message with the REAL database name for PostgreSQL
@@ -1596,6 +1637,8 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
       goto error;
    }
 
+   clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
    status = pgagroal_write_message(*server_ssl, server_fd, msg);
    if (status != MESSAGE_STATUS_OK)
    {
@@ -1611,6 +1654,8 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
       goto error;
    }
 
+   startup_usec = pgagroal_time_elapsed_usec(&phase_start);
+
    get_auth_type(msg, &auth_type);
    pgagroal_log_trace("authenticate: auth type %d", auth_type);
 
@@ -1687,6 +1732,9 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
          goto error;
       }
 
+      /* The authentication of the client isn't part of the time of the server */
+      clock_gettime(CLOCK_MONOTONIC, &phase_start);
+
       if (server_authenticate(auth_msg, auth_type, username, pgagroal_get_user_password(username), slot, *server_ssl))
       {
          if (pgagroal_socket_isvalid(client_fd))
@@ -1707,10 +1755,10 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
                sec_idx = 4;
             }
 
-            if (sec_idx >= 0 && config->connections[slot].security_lengths[sec_idx] > 0)
+            if (sec_idx >= 0 && pgagroal_connection_info(slot)->security_lengths[sec_idx] > 0)
             {
-               pgagroal_create_message(&config->connections[slot].security_messages[sec_idx],
-                                       config->connections[slot].security_lengths[sec_idx],
+               pgagroal_create_message(pgagroal_security_get_message(slot, sec_idx),
+                                       pgagroal_connection_info(slot)->security_lengths[sec_idx],
                                        &smsg_err);
                if (smsg_err != NULL)
                {
@@ -1736,6 +1784,9 @@ use_unpooled_connection(struct message* request_msg, SSL* c_ssl, int client_fd,
          goto error;
       }
 
+      pgagroal_prometheus_backend_phase(config->connections[slot].server, PROMETHEUS_PHASE_AUTHENTICATION,
+                                        startup_usec + pgagroal_time_elapsed_usec(&phase_start));
+
       if (client_ok(c_ssl, client_fd, slot))
       {
          goto error;
@@ -1872,6 +1923,7 @@ client_scram256(SSL* c_ssl, int client_fd, char* username __attribute__((unused)
 {
    int status;
    time_t start_time;
+   struct user* verifier = NULL;
    char* password_prep = NULL;
    char* client_first_message_bare = NULL;
    char* server_first_message = NULL;
@@ -1946,7 +1998,23 @@ retry:
    }
 
    generate_nounce(&server_nounce);
-   generate_salt(&salt, &salt_length);
+
+   /* A user with a verifier must be offered the salt the verifier was derived with */
+   verifier = get_verifier(password);
+   if (verifier != NULL)
+   {
+      salt = malloc(SCRAM_SALT_LENGTH);
+      if (salt == NULL)
+      {
+         goto error;
+      }
+      memcpy(salt, &verifier->salt[0], SCRAM_SALT_LENGTH);
+      salt_length = SCRAM_SALT_LENGTH;
+   }
+   else
+   {
+      generate_salt(&salt, &salt_length);
+   }
    pgagroal_base64_encode(salt, salt_length, &base64_salt, &base64_salt_length);
 
    server_first_message = calloc(1, 89);
@@ -1995,31 +2063,58 @@ retry:
 
    memcpy(client_final_message_without_proof, msg->data + 5, 57);
 
-   sasl_prep(password, &password_prep);
-
-   if (client_proof(password_prep, salt, salt_length, 4096,
-                    client_first_message_bare, strlen(client_first_message_bare),
-                    server_first_message, strlen(server_first_message),
-                    client_final_message_without_proof, strlen(client_final_message_without_proof),
-                    &client_proof_calc, &client_proof_calc_length))
+   if (verifier != NULL)
    {
-      goto error;
-   }
+      if (client_proof_received_length != SCRAM_KEY_LENGTH ||
+          verify_client_proof(&verifier->stored_key[0], SCRAM_KEY_LENGTH,
+                              client_proof_received, client_proof_received_length,
+                              salt, salt_length, 4096,
+                              client_first_message_bare, strlen(client_first_message_bare),
+                              server_first_message, strlen(server_first_message),
+                              client_final_message_without_proof, strlen(client_final_message_without_proof)))
+      {
+         goto bad_password;
+      }
 
-   if (client_proof_received_length != client_proof_calc_length ||
-       memcmp(client_proof_received, client_proof_calc, client_proof_calc_length) != 0)
-   {
-      goto bad_password;
+      if (server_signature(NULL, salt, salt_length, 4096,
+                           &verifier->server_key[0], SCRAM_KEY_LENGTH,
+                           client_first_message_bare, strlen(client_first_message_bare),
+                           server_first_message, strlen(server_first_message),
+                           client_final_message_without_proof, strlen(client_final_message_without_proof),
+                           &server_signature_calc, &server_signature_calc_length))
+      {
+         goto error;
+      }
    }
-
-   if (server_signature(password_prep, salt, salt_length, 4096,
-                        NULL, 0,
-                        client_first_message_bare, strlen(client_first_message_bare),
-                        server_first_message, strlen(server_first_message),
-                        client_final_message_without_proof, strlen(client_final_message_without_proof),
-                        &server_signature_calc, &server_signature_calc_length))
+   else
    {
-      goto error;
+      sasl_prep(password, &password_prep);
+
+      if (client_proof(password_prep, salt, salt_length, 4096,
+                       NULL, 0,
+                       client_first_message_bare, strlen(client_first_message_bare),
+                       server_first_message, strlen(server_first_message),
+                       client_final_message_without_proof, strlen(client_final_message_without_proof),
+                       &client_proof_calc, &client_proof_calc_length))
+      {
+         goto error;
+      }
+
+      if (client_proof_received_length != client_proof_calc_length ||
+          memcmp(client_proof_received, client_proof_calc, client_proof_calc_length) != 0)
+      {
+         goto bad_password;
+      }
+
+      if (server_signature(password_prep, salt, salt_length, 4096,
+                           NULL, 0,
+                           client_first_message_bare, strlen(client_first_message_bare),
+                           server_first_message, strlen(server_first_message),
+                           client_final_message_without_proof, strlen(client_final_message_without_proof),
+                           &server_signature_calc, &server_signature_calc_length))
+      {
+         goto error;
+      }
    }
 
    pgagroal_base64_encode((char*)server_signature_calc, server_signature_calc_length, &base64_server_signature_calc, &base64_server_signature_calc_length);
@@ -2119,33 +2214,33 @@ client_ok(SSL* c_ssl, int client_fd, int slot)
 
    if (config->connections[slot].has_security == SECURITY_TRUST)
    {
-      size = config->connections[slot].security_lengths[0];
+      size = pgagroal_connection_info(slot)->security_lengths[0];
       data = malloc(size);
       if (data == NULL)
       {
          goto error;
       }
-      memcpy(data, config->connections[slot].security_messages[0], size);
+      memcpy(data, pgagroal_security_get_message(slot, 0), size);
    }
    else if (config->connections[slot].has_security == SECURITY_PASSWORD)
    {
-      size = config->connections[slot].security_lengths[2];
+      size = pgagroal_connection_info(slot)->security_lengths[2];
       data = malloc(size);
       if (data == NULL)
       {
          goto error;
       }
-      memcpy(data, config->connections[slot].security_messages[2], size);
+      memcpy(data, pgagroal_security_get_message(slot, 2), size);
    }
    else if (config->connections[slot].has_security == SECURITY_SCRAM256)
    {
-      size = config->connections[slot].security_lengths[4] - 55;
+      size = pgagroal_connection_info(slot)->security_lengths[4] - 55;
       data = malloc(size);
       if (data == NULL)
       {
          goto error;
       }
-      memcpy(data, config->connections[slot].security_messages[4] + 55, size);
+      memcpy(data, pgagroal_security_get_message(slot, 4) + 55, size);
    }
    else
    {
@@ -2189,10 +2284,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
 
    pgagroal_log_trace("server_passthrough %d %d", auth_type, slot);
 
-   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-   {
-      memset(&config->connections[slot].security_messages[i], 0, SECURITY_BUFFER_SIZE);
-   }
+   pgagroal_security_release_messages(slot);
 
    if (msg->length > SECURITY_BUFFER_SIZE)
    {
@@ -2201,8 +2293,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = msg->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+   pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
    auth_index++;
 
    status = pgagroal_write_message(c_ssl, client_fd, msg);
@@ -2229,8 +2320,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
          goto error;
       }
 
-      config->connections[slot].security_lengths[auth_index] = msg->length;
-      memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+      pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
       auth_index++;
 
       status = pgagroal_write_message(s_ssl, server_fd, msg);
@@ -2255,8 +2345,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
             goto error;
          }
 
-         config->connections[slot].security_lengths[auth_index] = msg->length;
-         memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+         pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
          auth_index++;
 
          status = pgagroal_write_message(c_ssl, client_fd, msg);
@@ -2279,8 +2368,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
             goto error;
          }
 
-         config->connections[slot].security_lengths[auth_index] = msg->length;
-         memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+         pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
          auth_index++;
 
          status = pgagroal_write_message(NULL, server_fd, msg);
@@ -2310,8 +2398,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
             goto error;
          }
 
-         config->connections[slot].security_lengths[auth_index] = msg->length;
-         memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+         pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
 
          config->connections[slot].has_security = auth_type;
       }
@@ -2336,20 +2423,20 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
 
    if (config->connections[slot].has_security == SECURITY_TRUST)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[0],
-                              config->connections[slot].security_lengths[0],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 0),
+                              pgagroal_connection_info(slot)->security_lengths[0],
                               &smsg);
    }
    else if (config->connections[slot].has_security == SECURITY_PASSWORD)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[2],
-                              config->connections[slot].security_lengths[2],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 2),
+                              pgagroal_connection_info(slot)->security_lengths[2],
                               &smsg);
    }
    else if (config->connections[slot].has_security == SECURITY_SCRAM256)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[4],
-                              config->connections[slot].security_lengths[4],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 4),
+                              pgagroal_connection_info(slot)->security_lengths[4],
                               &smsg);
    }
 
@@ -2372,6 +2459,7 @@ server_passthrough(struct message* msg, int auth_type, SSL* c_ssl, SSL* s_ssl, i
       {
          config->connections[slot].backend_pid = pgagroal_read_int32(kmsg->data + 5);
          config->connections[slot].backend_secret = pgagroal_read_int32(kmsg->data + 9);
+         pgagroal_cancel_key_register(slot);
       }
    }
 
@@ -2398,10 +2486,7 @@ server_authenticate(struct message* msg, int auth_type, char* username, char* pa
 
    config = (struct main_configuration*)shmem;
 
-   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
-   {
-      memset(&config->connections[slot].security_messages[i], 0, SECURITY_BUFFER_SIZE);
-   }
+   pgagroal_security_release_messages(slot);
 
    if (msg->length > SECURITY_BUFFER_SIZE)
    {
@@ -2410,8 +2495,7 @@ server_authenticate(struct message* msg, int auth_type, char* username, char* pa
       goto error;
    }
 
-   config->connections[slot].security_lengths[0] = msg->length;
-   memcpy(&config->connections[slot].security_messages[0], msg->data, msg->length);
+   pgagroal_security_store_message(slot, 0, msg->data, msg->length);
 
    if (auth_type == SECURITY_TRUST)
    {
@@ -2428,20 +2512,20 @@ server_authenticate(struct message* msg, int auth_type, char* username, char* pa
 
    if (config->connections[slot].has_security == SECURITY_TRUST)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[0],
-                              config->connections[slot].security_lengths[0],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 0),
+                              pgagroal_connection_info(slot)->security_lengths[0],
                               &smsg);
    }
    else if (config->connections[slot].has_security == SECURITY_PASSWORD)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[2],
-                              config->connections[slot].security_lengths[2],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 2),
+                              pgagroal_connection_info(slot)->security_lengths[2],
                               &smsg);
    }
    else if (config->connections[slot].has_security == SECURITY_SCRAM256)
    {
-      pgagroal_create_message(&config->connections[slot].security_messages[4],
-                              config->connections[slot].security_lengths[4],
+      pgagroal_create_message(pgagroal_security_get_message(slot, 4),
+                              pgagroal_connection_info(slot)->security_lengths[4],
                               &smsg);
    }
 
@@ -2464,6 +2548,7 @@ server_authenticate(struct message* msg, int auth_type, char* username, char* pa
       {
          config->connections[slot].backend_pid = pgagroal_read_int32(kmsg->data + 5);
          config->connections[slot].backend_secret = pgagroal_read_int32(kmsg->data + 9);
+         pgagroal_cancel_key_register(slot);
       }
    }
 
@@ -2524,8 +2609,7 @@ server_password(char* username, char* password, int slot, SSL* server_ssl)
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = password_msg->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], password_msg->data, password_msg->length);
+   pgagroal_security_store_message(slot, auth_index, password_msg->data, password_msg->length);
    auth_index++;
 
    status = pgagroal_read_block_message(server_ssl, server_fd, &auth_msg);
@@ -2548,8 +2632,7 @@ server_password(char* username, char* password, int slot, SSL* server_ssl)
          goto error;
       }
 
-      config->connections[slot].security_lengths[auth_index] = auth_msg->length;
-      memcpy(&config->connections[slot].security_messages[auth_index], auth_msg->data, auth_msg->length);
+      pgagroal_security_store_message(slot, auth_index, auth_msg->data, auth_msg->length);
 
       config->connections[slot].has_security = SECURITY_PASSWORD;
    }
@@ -2589,6 +2672,9 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
    char* salt = NULL;
    size_t salt_length = 0;
    char* password_prep = NULL;
+   bool keys = false;
+   char client_key[SCRAM_KEY_LENGTH];
+   char server_key[SCRAM_KEY_LENGTH];
    char* client_nounce = NULL;
    char* combined_nounce = NULL;
    char* base64_salt = NULL;
@@ -2633,8 +2719,7 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = sasl_response->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], sasl_response->data, sasl_response->length);
+   pgagroal_security_store_message(slot, auth_index, sasl_response->data, sasl_response->length);
    auth_index++;
 
    status = pgagroal_write_message(server_ssl, server_fd, sasl_response);
@@ -2668,8 +2753,7 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = sasl_continue->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], sasl_continue->data, sasl_continue->length);
+   pgagroal_security_store_message(slot, auth_index, sasl_continue->data, sasl_continue->length);
    auth_index++;
 
    get_scram_attribute('r', (char*)(sasl_continue->data + 9), sasl_continue->length - 9, &combined_nounce);
@@ -2699,14 +2783,22 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
    pgagroal_snprintf(&wo_proof[0], sizeof(wo_proof), "c=biws,r=%s", combined_nounce);
 
    /* n=,r=... */
-   client_first_message_bare = config->connections[slot].security_messages[1] + 26;
+   client_first_message_bare = pgagroal_security_get_message(slot, 1) + 26;
 
    /* r=...,s=...,i=4096 */
-   server_first_message = config->connections[slot].security_messages[2] + 9;
+   server_first_message = pgagroal_security_get_message(slot, 2) + 9;
 
-   if (client_proof(password_prep, salt, salt_length, iteration,
-                    client_first_message_bare, config->connections[slot].security_lengths[1] - 26,
-                    server_first_message, config->connections[slot].security_lengths[2] - 9,
+   /* The keys only depend on the password, the salt and the iteration count */
+   if (scram_keys(username, password_prep, salt, salt_length, iteration, &client_key[0], &server_key[0]))
+   {
+      goto error;
+   }
+   keys = true;
+
+   if (client_proof(NULL, salt, salt_length, iteration,
+                    &client_key[0], SCRAM_KEY_LENGTH,
+                    client_first_message_bare, pgagroal_connection_info(slot)->security_lengths[1] - 26,
+                    server_first_message, pgagroal_connection_info(slot)->security_lengths[2] - 9,
                     &wo_proof[0], strlen(wo_proof),
                     &proof, &proof_length))
    {
@@ -2721,8 +2813,7 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = sasl_continue_response->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], sasl_continue_response->data, sasl_continue_response->length);
+   pgagroal_security_store_message(slot, auth_index, sasl_continue_response->data, sasl_continue_response->length);
    auth_index++;
 
    status = pgagroal_write_message(server_ssl, server_fd, sasl_continue_response);
@@ -2744,8 +2835,7 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
       goto error;
    }
 
-   config->connections[slot].security_lengths[auth_index] = msg->length;
-   memcpy(&config->connections[slot].security_messages[auth_index], msg->data, msg->length);
+   pgagroal_security_store_message(slot, auth_index, msg->data, msg->length);
    auth_index++;
 
    if (pgagroal_extract_message('R', msg, &sasl_final))
@@ -2764,10 +2854,10 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
    pgagroal_base64_decode(base64_server_signature, sasl_final->length - 11,
                           (void**)&server_signature_received, &server_signature_received_length);
 
-   if (server_signature(password_prep, salt, salt_length, iteration,
-                        NULL, 0,
-                        client_first_message_bare, config->connections[slot].security_lengths[1] - 26,
-                        server_first_message, config->connections[slot].security_lengths[2] - 9,
+   if (server_signature(NULL, salt, salt_length, iteration,
+                        &server_key[0], SCRAM_KEY_LENGTH,
+                        client_first_message_bare, pgagroal_connection_info(slot)->security_lengths[1] - 26,
+                        server_first_message, pgagroal_connection_info(slot)->security_lengths[2] - 9,
                         &wo_proof[0], strlen(wo_proof),
                         &server_signature_calc, &server_signature_calc_length))
    {
@@ -2782,6 +2872,9 @@ server_scram256(char* username, char* password, int slot, SSL* server_ssl)
 
    config->connections[slot].has_security = SECURITY_SCRAM256;
 
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -2805,6 +2898,13 @@ bad_password:
 
    pgagroal_log_warn("Wrong password for user: %s", username);
 
+   if (keys)
+   {
+      scram_keys_invalidate(username, salt, salt_length, iteration);
+   }
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -2826,6 +2926,13 @@ bad_password:
 
 error:
 
+   if (keys)
+   {
+      scram_keys_invalidate(username, salt, salt_length, iteration);
+   }
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -2849,200 +2956,316 @@ error:
 static bool
 is_allowed(char* username, char* database, char* address, int* hba_method)
 {
+   int entry;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   for (int i = 0; i < config->number_of_hbas; i++)
+   entry = hba_lookup(username, database, true, address);
+   if (entry == -1)
    {
-      if (is_allowed_address(address, config->hbas[i].address) &&
-          is_allowed_database(database, config->hbas[i].database) &&
-          is_allowed_username(username, config->hbas[i].username))
-      {
-         *hba_method = get_hba_method(i);
-
-         return true;
-      }
+      return false;
    }
 
-   return false;
+   *hba_method = config->hba_matcher.methods[entry];
+
+   return true;
 }
 
-static bool
-is_allowed_username(char* username, char* entry)
+static int
+hba_lookup(char* username, char* database, bool all_databases, char* address)
 {
-   if (!strcasecmp(entry, "all") || !strcmp(username, entry))
-   {
-      return true;
-   }
+   uint64_t candidates[NUMBER_OF_HBA_WORDS];
+   struct hba_name* name = NULL;
+   struct hba_matcher* matcher = NULL;
+   struct main_configuration* config;
 
-   return false;
-}
+   config = (struct main_configuration*)shmem;
+   matcher = &config->hba_matcher;
 
-static bool
-is_allowed_database(char* database, char* entry)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   memcpy(&candidates[0], &matcher->all_addresses[0], sizeof(candidates));
+   hba_match_address(matcher, address, &candidates[0]);
 
-   if (!strcasecmp(entry, "all") || !strcmp(database, entry))
+   name = hba_name_find(config, &matcher->databases[0], NUMBER_OF_HBA_DATABASES, true, database);
+   for (int i = 0; i < NUMBER_OF_HBA_WORDS; i++)
    {
-      return true;
+      candidates[i] &= (all_databases ? matcher->all_databases[i] : 0) | (name != NULL && name->used ? name->entries[i] : 0);
    }
 
-   // Check if the database is an alias in any limit entry
-   for (int i = 0; i < config->number_of_limits; i++)
+   name = hba_name_find(config, &matcher->usernames[0], NUMBER_OF_HBA_USERNAMES, false, username);
+   for (int i = 0; i < NUMBER_OF_HBA_WORDS; i++)
+   {
+      candidates[i] &= matcher->all_usernames[i] | (name != NULL && name->used ? name->entries[i] : 0);
+   }
+
+   for (int i = 0; i < NUMBER_OF_HBA_WORDS; i++)
    {
-      if (!strcmp(entry, config->limits[i].database))
+      if (candidates[i] != 0)
       {
-         // Check if database is an alias of this entry
-         for (int j = 0; j < config->limits[i].aliases_count; j++)
-         {
-            if (!strcmp(database, config->limits[i].aliases[j]))
-            {
-               pgagroal_log_debug("HBA: Database '%s' matched as alias of '%s'", database, entry);
-               return true;
-            }
-         }
+         return i * 64 + __builtin_ctzll(candidates[i]);
       }
    }
 
-   return false;
+   return -1;
 }
 
-static bool
-is_allowed_address(char* address, char* entry)
+int
+pgagroal_hba_entry(char* username, char* database, char* address)
 {
-   struct sockaddr_in address_sa4;
-   struct sockaddr_in6 address_sa6;
-   struct sockaddr_in entry_sa4;
-   struct sockaddr_in6 entry_sa6;
-   char addr[INET6_ADDRSTRLEN];
-   char s_mask[4];
-   int mask;
-   char* marker;
-   bool ipv4 = true;
+   return hba_lookup(username, database, true, address);
+}
 
-   memset(&addr, 0, sizeof(addr));
-   memset(&s_mask, 0, sizeof(s_mask));
+int
+pgagroal_hba_compile(struct main_configuration* config)
+{
+   struct hba* hba = NULL;
+   struct hba_matcher* matcher = NULL;
 
-   if (!strcasecmp(entry, "all"))
-   {
-      return true;
-   }
+   matcher = &config->hba_matcher;
 
-   marker = strchr(entry, '/');
-   if (!marker)
+   memset(matcher, 0, sizeof(struct hba_matcher));
+   for (int i = 0; i < 2; i++)
    {
-      pgagroal_log_warn("Invalid HBA entry: %s", entry);
-      return false;
+      matcher->nodes[i].child[0] = -1;
+      matcher->nodes[i].child[1] = -1;
    }
+   matcher->number_of_nodes = 2;
 
-   memcpy(&addr, entry, marker - entry);
-   marker += sizeof(char);
-   memcpy(&s_mask, marker, strlen(marker));
-   mask = atoi(s_mask);
-
-   if (strchr(addr, ':') == NULL)
+   for (int i = 0; i < config->number_of_hbas; i++)
    {
-      inet_pton(AF_INET, addr, &(entry_sa4.sin_addr));
+      hba = &config->hbas[i];
 
-      if (strchr(address, ':') == NULL)
+      matcher->methods[i] = get_hba_method(hba->method);
+
+      if (!strcasecmp(hba->address, "all"))
       {
-         inet_pton(AF_INET, address, &(address_sa4.sin_addr));
+         matcher->all_addresses[i / 64] |= 1ULL << (i % 64);
       }
-      else
+      else if (hba_compile_address(matcher, i, hba->address))
       {
-         return false;
+         goto error;
       }
-   }
-   else
-   {
-      ipv4 = false;
-
-      inet_pton(AF_INET6, addr, &(entry_sa6.sin6_addr));
 
-      if (strchr(address, ':') != NULL)
+      if (!strcasecmp(hba->database, "all"))
       {
-         inet_pton(AF_INET6, address, &(address_sa6.sin6_addr));
+         matcher->all_databases[i / 64] |= 1ULL << (i % 64);
       }
       else
       {
-         return false;
-      }
-   }
-
-   if (ipv4)
-   {
-      if (!strcmp(entry, "0.0.0.0/0"))
-      {
-         return true;
-      }
+         if (hba_name_add(config, &matcher->databases[0], NUMBER_OF_HBA_DATABASES, true, hba->database, i, -1, -1, i))
+         {
+            goto error;
+         }
 
-      if (mask < 0 || mask > 32)
-      {
-         pgagroal_log_warn("Invalid HBA entry: %s", entry);
-         return false;
+         /* The aliases of a limit entry are allowed by the HBA entries of its database */
+         for (int j = 0; j < config->number_of_limits; j++)
+         {
+            if (!strcmp(hba->database, config->limits[j].database))
+            {
+               for (int k = 0; k < config->limits[j].aliases_count; k++)
+               {
+                  if (hba_name_add(config, &matcher->databases[0], NUMBER_OF_HBA_DATABASES, true,
+                                   config->limits[j].aliases[k], -1, j, k, i))
+                  {
+                     goto error;
+                  }
+               }
+            }
+         }
       }
 
-      unsigned char a1 = (ntohl(address_sa4.sin_addr.s_addr) >> 24) & 0xff;
-      unsigned char a2 = (ntohl(address_sa4.sin_addr.s_addr) >> 16) & 0xff;
-      unsigned char a3 = (ntohl(address_sa4.sin_addr.s_addr) >> 8) & 0xff;
-      unsigned char a4 = (ntohl(address_sa4.sin_addr.s_addr)) & 0xff;
-
-      unsigned char e1 = (ntohl(entry_sa4.sin_addr.s_addr) >> 24) & 0xff;
-      unsigned char e2 = (ntohl(entry_sa4.sin_addr.s_addr) >> 16) & 0xff;
-      unsigned char e3 = (ntohl(entry_sa4.sin_addr.s_addr) >> 8) & 0xff;
-      unsigned char e4 = (ntohl(entry_sa4.sin_addr.s_addr)) & 0xff;
-
-      if (mask <= 8)
-      {
-         return a1 == e1;
-      }
-      else if (mask <= 16)
+      if (!strcasecmp(hba->username, "all"))
       {
-         return a1 == e1 && a2 == e2;
+         matcher->all_usernames[i / 64] |= 1ULL << (i % 64);
       }
-      else if (mask <= 24)
+      else if (hba_name_add(config, &matcher->usernames[0], NUMBER_OF_HBA_USERNAMES, false, hba->username, i, -1, -1, i))
       {
-         return a1 == e1 && a2 == e2 && a3 == e3;
-      }
-      else
-      {
-         return a1 == e1 && a2 == e2 && a3 == e3 && a4 == e4;
+         goto error;
       }
    }
-   else
-   {
-      if (!strcmp(entry, "::0/0"))
-      {
-         return true;
-      }
 
-      if (mask < 0 || mask > 128)
-      {
-         pgagroal_log_warn("Invalid HBA entry: %s", entry);
-         return false;
-      }
+   pgagroal_log_debug("HBA: %d entries compiled into %d address nodes", config->number_of_hbas, matcher->number_of_nodes);
 
-      struct sockaddr_in6 netmask;
-      bool result = false;
+   return 0;
 
-      memset(&netmask, 0, sizeof(struct sockaddr_in6));
+error:
 
-      for (long i = mask, j = 0; i > 0; i -= 8, ++j)
-      {
-         netmask.sin6_addr.s6_addr[j] = i >= 8 ? 0xff : (unsigned long int)((0xffU << (8 - i)) & 0xffU);
-      }
+   return 1;
+}
+
+static int
+hba_compile_address(struct hba_matcher* matcher, int entry, char* address)
+{
+   char addr[INET6_ADDRSTRLEN];
+   unsigned char bytes[16];
+   char* marker = NULL;
+   char* end = NULL;
+   long mask;
+   int node;
+   int bit;
+   bool ipv4;
+
+   memset(&addr, 0, sizeof(addr));
+   memset(&bytes, 0, sizeof(bytes));
+
+   marker = strchr(address, '/');
+   if (marker == NULL || (size_t)(marker - address) >= sizeof(addr))
+   {
+      pgagroal_log_warn("Invalid HBA entry: %s", address);
+      return 0;
+   }
+
+   memcpy(&addr, address, marker - address);
+   ipv4 = strchr(addr, ':') == NULL;
+
+   errno = 0;
+   mask = strtol(marker + 1, &end, 10);
+   if (errno != 0 || end == marker + 1 || *end != '\0' || mask < 0 || mask > (ipv4 ? 32 : 128) ||
+       inet_pton(ipv4 ? AF_INET : AF_INET6, addr, &bytes[0]) != 1)
+   {
+      pgagroal_log_warn("Invalid HBA entry: %s", address);
+      return 0;
+   }
+
+   node = ipv4 ? 0 : 1;
+   for (int i = 0; i < mask; i++)
+   {
+      bit = (bytes[i / 8] >> (7 - (i % 8))) & 1;
 
-      for (unsigned i = 0; i < 16; i++)
+      if (matcher->nodes[node].child[bit] == -1)
       {
-         result |= (0 != (address_sa6.sin6_addr.s6_addr[i] & !netmask.sin6_addr.s6_addr[i]));
+         if (matcher->number_of_nodes >= NUMBER_OF_HBA_NODES)
+         {
+            pgagroal_log_error("HBA: Too many address nodes");
+            return 1;
+         }
+
+         matcher->nodes[matcher->number_of_nodes].child[0] = -1;
+         matcher->nodes[matcher->number_of_nodes].child[1] = -1;
+         matcher->nodes[node].child[bit] = matcher->number_of_nodes;
+         matcher->number_of_nodes++;
       }
 
-      return result;
+      node = matcher->nodes[node].child[bit];
    }
 
-   return false;
+   matcher->nodes[node].entries[entry / 64] |= 1ULL << (entry % 64);
+
+   return 0;
+}
+
+static void
+hba_match_address(struct hba_matcher* matcher, char* address, uint64_t* candidates)
+{
+   unsigned char bytes[16];
+   int bits;
+   int node;
+   int bit;
+
+   if (inet_pton(AF_INET, address, &bytes[0]) == 1)
+   {
+      node = 0;
+      bits = 32;
+   }
+   else if (inet_pton(AF_INET6, address, &bytes[0]) == 1)
+   {
+      node = 1;
+      bits = 128;
+   }
+   else
+   {
+      return;
+   }
+
+   /* Every node on the path is a prefix of the address */
+   for (int i = 0; node != -1; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_HBA_WORDS; j++)
+      {
+         candidates[j] |= matcher->nodes[node].entries[j];
+      }
+
+      if (i == bits)
+      {
+         break;
+      }
+
+      bit = (bytes[i / 8] >> (7 - (i % 8))) & 1;
+      node = matcher->nodes[node].child[bit];
+   }
+}
+
+static int
+hba_name_add(struct main_configuration* config, struct hba_name* names, int size, bool database,
+             char* name, int hba, int limit, int alias, int entry)
+{
+   struct hba_name* n = NULL;
+
+   n = hba_name_find(config, names, size, database, name);
+   if (n == NULL)
+   {
+      pgagroal_log_error("HBA: Too many %s names", database ? "database" : "user");
+      return 1;
+   }
+
+   if (!n->used)
+   {
+      n->used = true;
+      n->hba = hba;
+      n->limit = limit;
+      n->alias = alias;
+   }
+
+   n->entries[entry / 64] |= 1ULL << (entry % 64);
+
+   return 0;
+}
+
+static struct hba_name*
+hba_name_find(struct main_configuration* config, struct hba_name* names, int size, bool database, char* name)
+{
+   unsigned int hash;
+   struct hba_name* n = NULL;
+
+   hash = hba_name_hash(name);
+
+   for (int i = 0; i < size; i++)
+   {
+      n = &names[(hash + i) % size];
+
+      if (!n->used || !strcmp(hba_name_string(config, n, database), name))
+      {
+         return n;
+      }
+   }
+
+   return NULL;
+}
+
+static char*
+hba_name_string(struct main_configuration* config, struct hba_name* name, bool database)
+{
+   if (name->hba >= 0)
+   {
+      return database ? config->hbas[name->hba].database : config->hbas[name->hba].username;
+   }
+
+   return config->limits[name->limit].aliases[name->alias];
+}
+
+static unsigned int
+hba_name_hash(char* name)
+{
+   unsigned int hash;
+
+   /* FNV-1a */
+   hash = 2166136261U;
+   for (char* c = name; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+
+   return hash;
 }
 
 static bool
@@ -3069,33 +3292,29 @@ is_disabled(char* database)
 }
 
 static int
-get_hba_method(int index)
+get_hba_method(char* method)
 {
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
-
-   if (!strcasecmp(config->hbas[index].method, "reject"))
+   if (!strcasecmp(method, "reject"))
    {
       return SECURITY_REJECT;
    }
 
-   if (!strcasecmp(config->hbas[index].method, "trust"))
+   if (!strcasecmp(method, "trust"))
    {
       return SECURITY_TRUST;
    }
 
-   if (!strcasecmp(config->hbas[index].method, "password"))
+   if (!strcasecmp(method, "password"))
    {
       return SECURITY_PASSWORD;
    }
 
-   if (!strcasecmp(config->hbas[index].method, "scram-sha-256"))
+   if (!strcasecmp(method, "scram-sha-256"))
    {
       return SECURITY_SCRAM256;
    }
 
-   if (!strcasecmp(config->hbas[index].method, "all"))
+   if (!strcasecmp(method, "all"))
    {
       return SECURITY_ALL;
    }
@@ -3144,6 +3363,46 @@ get_frontend_password(char* username)
    return NULL;
 }
 
+static struct user*
+get_verifier(char* password)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The password is one of the user entries, find the entry it belongs to */
+   if (config->superuser.verifier && password == &config->superuser.password[0])
+   {
+      return &config->superuser;
+   }
+
+   for (int i = 0; i < config->number_of_users; i++)
+   {
+      if (config->users[i].verifier && password == &config->users[i].password[0])
+      {
+         return &config->users[i];
+      }
+   }
+
+   for (int i = 0; i < config->number_of_frontend_users; i++)
+   {
+      if (config->frontend_users[i].verifier && password == &config->frontend_users[i].password[0])
+      {
+         return &config->frontend_users[i];
+      }
+   }
+
+   for (int i = 0; i < config->number_of_admins; i++)
+   {
+      if (config->admins[i].verifier && password == &config->admins[i].password[0])
+      {
+         return &config->admins[i];
+      }
+   }
+
+   return NULL;
+}
+
 static char*
 get_admin_password(char* username)
 {
@@ -3162,6 +3421,166 @@ get_admin_password(char* username)
    return NULL;
 }
 
+int
+pgagroal_scram_verifier(struct user* user)
+{
+   char* password_prep = NULL;
+   char* salt = NULL;
+   int salt_length = 0;
+   unsigned char* s_p = NULL;
+   int s_p_length = 0;
+   unsigned char* c_k = NULL;
+   int c_k_length = 0;
+   unsigned char* st_k = NULL;
+   int st_k_length = 0;
+   unsigned char* sv_k = NULL;
+   int sv_k_length = 0;
+
+   user->verifier = false;
+
+   if (strlen(user->password) == 0 || sasl_prep(user->password, &password_prep))
+   {
+      /* The password is checked the regular way */
+      goto error;
+   }
+
+   if (generate_salt(&salt, &salt_length) || salt_length != SCRAM_SALT_LENGTH)
+   {
+      goto error;
+   }
+
+   if (salted_password(password_prep, salt, salt_length, 4096, &s_p, &s_p_length))
+   {
+      goto error;
+   }
+
+   if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
+   {
+      goto error;
+   }
+
+   if (stored_key(c_k, c_k_length, &st_k, &st_k_length) || st_k_length != SCRAM_KEY_LENGTH)
+   {
+      goto error;
+   }
+
+   if (salted_password_key(s_p, s_p_length, "Server Key", &sv_k, &sv_k_length) || sv_k_length != SCRAM_KEY_LENGTH)
+   {
+      goto error;
+   }
+
+   memcpy(&user->salt[0], salt, SCRAM_SALT_LENGTH);
+   memcpy(&user->stored_key[0], st_k, SCRAM_KEY_LENGTH);
+   memcpy(&user->server_key[0], sv_k, SCRAM_KEY_LENGTH);
+   user->verifier = true;
+
+   pgagroal_cleanse(s_p, s_p_length);
+   pgagroal_cleanse(c_k, c_k_length);
+
+   free(password_prep);
+   free(salt);
+   free(s_p);
+   free(c_k);
+   free(st_k);
+   free(sv_k);
+
+   return 0;
+
+error:
+
+   if (s_p != NULL)
+   {
+      pgagroal_cleanse(s_p, s_p_length);
+   }
+   if (c_k != NULL)
+   {
+      pgagroal_cleanse(c_k, c_k_length);
+   }
+
+   free(password_prep);
+   free(salt);
+   free(s_p);
+   free(c_k);
+   free(st_k);
+   free(sv_k);
+
+   return 1;
+}
+
+void
+pgagroal_scram_verifiers(struct main_configuration* config)
+{
+   int count = 0;
+
+   for (int i = 0; i < config->number_of_users; i++)
+   {
+      count += config->users[i].verifier || pgagroal_scram_verifier(&config->users[i]) == 0 ? 1 : 0;
+   }
+
+   for (int i = 0; i < config->number_of_frontend_users; i++)
+   {
+      count += config->frontend_users[i].verifier || pgagroal_scram_verifier(&config->frontend_users[i]) == 0 ? 1 : 0;
+   }
+
+   for (int i = 0; i < config->number_of_admins; i++)
+   {
+      count += config->admins[i].verifier || pgagroal_scram_verifier(&config->admins[i]) == 0 ? 1 : 0;
+   }
+
+   if (strlen(config->superuser.username) > 0)
+   {
+      count += config->superuser.verifier || pgagroal_scram_verifier(&config->superuser) == 0 ? 1 : 0;
+   }
+
+   pgagroal_log_debug("SCRAM-SHA-256 verifiers: %d", count);
+}
+
+int
+pgagroal_auth_query_cache_clear(char* username)
+{
+   int count = 0;
+   signed char state;
+   struct auth_query_entry* e = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < NUMBER_OF_AUTH_QUERY_ENTRIES; i++)
+   {
+      e = &config->auth_query_entries[i];
+
+      state = STATE_FREE;
+      while (!atomic_compare_exchange_strong(&e->state, &state, STATE_INIT))
+      {
+         if (state == STATE_NOTINIT)
+         {
+            break;
+         }
+
+         /* Another process is updating the entry */
+         SLEEP(1000L)
+         state = STATE_FREE;
+      }
+
+      if (state == STATE_NOTINIT)
+      {
+         continue;
+      }
+
+      if (e->expires != 0 && (username == NULL || !strcmp(e->username, username)))
+      {
+         /* Entries stay in place for the probe sequence, an expired entry is reused */
+         e->expires = 0;
+         pgagroal_cleanse(&e->shadow[0], sizeof(e->shadow));
+         count++;
+      }
+
+      atomic_store(&e->state, STATE_FREE);
+   }
+
+   return count;
+}
+
 int
 pgagroal_get_master_key(char** masterkey)
 {
@@ -3291,6 +3710,24 @@ error:
    return 1;
 }
 
+bool
+pgagroal_tunnel_allowed(char* identity, char* address)
+{
+   int entry;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Like replication in PostgreSQL, the all database doesn't cover the tunnel */
+   entry = hba_lookup(identity, "tunnel", false, address);
+   if (entry == -1)
+   {
+      return false;
+   }
+
+   return config->hba_matcher.methods[entry] != SECURITY_REJECT;
+}
+
 bool
 pgagroal_user_known(char* user)
 {
@@ -3719,6 +4156,7 @@ error:
 
 static int
 client_proof(char* password, char* salt, int salt_length, int iterations,
+             char* client_key, int client_key_length,
              char* client_first_message_bare, size_t client_first_message_bare_length,
              char* server_first_message, size_t server_first_message_length,
              char* client_final_message_wo_proof, size_t client_final_message_wo_proof_length,
@@ -3750,14 +4188,27 @@ client_proof(char* password, char* salt, int salt_length, int iterations,
       goto error;
    }
 
-   if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
+   if (password != NULL)
    {
-      goto error;
-   }
+      if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
+      {
+         goto error;
+      }
 
-   if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
+      if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
+      {
+         goto error;
+      }
+   }
+   else
    {
-      goto error;
+      c_k = malloc(client_key_length);
+      if (c_k == NULL)
+      {
+         goto error;
+      }
+      memcpy(c_k, client_key, client_key_length);
+      c_k_length = client_key_length;
    }
 
    if (stored_key(c_k, c_k_length, &s_k, &s_k_length))
@@ -3958,6 +4409,285 @@ error:
    return 1;
 }
 
+static int
+scram_keys(char* username, char* password, char* salt, int salt_length, int iterations,
+           char* client_key, char* server_key)
+{
+   unsigned int hash;
+   signed char state;
+   char digest[SCRAM_KEY_LENGTH];
+   unsigned char* s_p = NULL;
+   int s_p_length = 0;
+   unsigned char* c_k = NULL;
+   int c_k_length = 0;
+   unsigned char* s_k = NULL;
+   int s_k_length = 0;
+   bool cache = true;
+   struct scram_key* k = NULL;
+   struct scram_key* entry = NULL;
+   struct scram_key* reuse = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (scram_keys_digest(password, salt, salt_length, &digest[0]))
+   {
+      goto error;
+   }
+
+   hash = scram_keys_hash(username, salt, salt_length, iterations);
+
+   if (strlen(username) < MAX_USERNAME_LENGTH && salt_length <= SCRAM_MAX_SALT_LENGTH)
+   {
+      /* Open addressing; the matching entry is the one for the key, otherwise the first
+       * entry left empty, or the first unused one */
+      for (int i = 0; i < NUMBER_OF_SCRAM_KEYS; i++)
+      {
+         k = &config->scram_keys[(hash + i) % NUMBER_OF_SCRAM_KEYS];
+
+         if (atomic_load(&k->state) == STATE_NOTINIT)
+         {
+            state = STATE_NOTINIT;
+            if (reuse == NULL && !atomic_compare_exchange_strong(&k->state, &state, STATE_INIT))
+            {
+               cache = false;
+            }
+            else if (reuse == NULL)
+            {
+               entry = k;
+            }
+
+            /* The end of the chain */
+            break;
+         }
+
+         state = STATE_FREE;
+         if (!atomic_compare_exchange_strong(&k->state, &state, STATE_INIT))
+         {
+            /* In use by another process, so the keys are derived without the cache */
+            cache = false;
+            break;
+         }
+
+         if (!strcmp(k->username, username) && k->salt_length == salt_length && k->iterations == iterations &&
+             !memcmp(&k->salt[0], salt, salt_length))
+         {
+            if (!memcmp(&k->password[0], &digest[0], SCRAM_KEY_LENGTH))
+            {
+               memcpy(client_key, &k->client_key[0], SCRAM_KEY_LENGTH);
+               memcpy(server_key, &k->server_key[0], SCRAM_KEY_LENGTH);
+               atomic_store(&k->state, STATE_FREE);
+
+               if (reuse != NULL)
+               {
+                  atomic_store(&reuse->state, STATE_FREE);
+               }
+
+               pgagroal_cleanse(&digest[0], sizeof(digest));
+
+               return 0;
+            }
+
+            /* The password changed */
+            entry = k;
+            break;
+         }
+
+         if (reuse == NULL && k->username[0] == '\0')
+         {
+            /* Left empty by a failed derivation, held until the chain is searched */
+            reuse = k;
+            continue;
+         }
+
+         atomic_store(&k->state, STATE_FREE);
+      }
+
+      if (entry != NULL || !cache)
+      {
+         if (reuse != NULL)
+         {
+            atomic_store(&reuse->state, STATE_FREE);
+         }
+      }
+      else if (reuse != NULL)
+      {
+         entry = reuse;
+      }
+      else
+      {
+         /* Every entry holds another key, so the home entry of this one is evicted */
+         k = &config->scram_keys[hash % NUMBER_OF_SCRAM_KEYS];
+
+         state = STATE_FREE;
+         if (atomic_compare_exchange_strong(&k->state, &state, STATE_INIT))
+         {
+            entry = k;
+         }
+      }
+   }
+
+   if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
+   {
+      goto error;
+   }
+
+   if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length) || c_k_length != SCRAM_KEY_LENGTH)
+   {
+      goto error;
+   }
+
+   if (salted_password_key(s_p, s_p_length, "Server Key", &s_k, &s_k_length) || s_k_length != SCRAM_KEY_LENGTH)
+   {
+      goto error;
+   }
+
+   memcpy(client_key, c_k, SCRAM_KEY_LENGTH);
+   memcpy(server_key, s_k, SCRAM_KEY_LENGTH);
+
+   if (entry != NULL)
+   {
+      memset(&entry->username[0], 0, sizeof(entry->username));
+      memcpy(&entry->username[0], username, strlen(username));
+      memcpy(&entry->password[0], &digest[0], SCRAM_KEY_LENGTH);
+      memcpy(&entry->salt[0], salt, salt_length);
+      entry->salt_length = salt_length;
+      entry->iterations = iterations;
+      memcpy(&entry->client_key[0], c_k, SCRAM_KEY_LENGTH);
+      memcpy(&entry->server_key[0], s_k, SCRAM_KEY_LENGTH);
+      atomic_store(&entry->state, STATE_FREE);
+   }
+
+   pgagroal_cleanse(&digest[0], sizeof(digest));
+   pgagroal_cleanse(s_p, s_p_length);
+   pgagroal_cleanse(c_k, c_k_length);
+   pgagroal_cleanse(s_k, s_k_length);
+
+   free(s_p);
+   free(c_k);
+   free(s_k);
+
+   return 0;
+
+error:
+
+   if (entry != NULL)
+   {
+      /* The entry may be half updated */
+      memset(&entry->username[0], 0, sizeof(entry->username));
+      atomic_store(&entry->state, STATE_FREE);
+   }
+
+   pgagroal_cleanse(&digest[0], sizeof(digest));
+
+   if (s_p != NULL)
+   {
+      pgagroal_cleanse(s_p, s_p_length);
+   }
+   if (c_k != NULL)
+   {
+      pgagroal_cleanse(c_k, c_k_length);
+   }
+   if (s_k != NULL)
+   {
+      pgagroal_cleanse(s_k, s_k_length);
+   }
+
+   free(s_p);
+   free(c_k);
+   free(s_k);
+
+   return 1;
+}
+
+static void
+scram_keys_invalidate(char* username, char* salt, int salt_length, int iterations)
+{
+   unsigned int hash;
+   signed char state;
+   struct scram_key* k = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   hash = scram_keys_hash(username, salt, salt_length, iterations);
+
+   for (int i = 0; i < NUMBER_OF_SCRAM_KEYS; i++)
+   {
+      k = &config->scram_keys[(hash + i) % NUMBER_OF_SCRAM_KEYS];
+
+      state = STATE_FREE;
+      if (!atomic_compare_exchange_strong(&k->state, &state, STATE_INIT))
+      {
+         return;
+      }
+
+      if (!strcmp(k->username, username) && k->salt_length == salt_length && k->iterations == iterations &&
+          !memcmp(&k->salt[0], salt, salt_length))
+      {
+         /* Entries are never removed, a cleared digest makes the next use derive the keys again */
+         memset(&k->password[0], 0, sizeof(k->password));
+         atomic_store(&k->state, STATE_FREE);
+         return;
+      }
+
+      atomic_store(&k->state, STATE_FREE);
+   }
+}
+
+static unsigned int
+scram_keys_hash(char* username, char* salt, int salt_length, int iterations)
+{
+   unsigned int hash;
+
+   /* FNV-1a */
+   hash = 2166136261U;
+   for (char* c = username; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+   hash = (hash ^ 0xFF) * 16777619U;
+   for (int i = 0; i < salt_length; i++)
+   {
+      hash = (hash ^ (unsigned char)salt[i]) * 16777619U;
+   }
+   hash = (hash ^ (unsigned int)iterations) * 16777619U;
+
+   return hash;
+}
+
+static int
+scram_keys_digest(char* password, char* salt, int salt_length, char* digest)
+{
+   unsigned int length = 0;
+   EVP_MD_CTX* ctx = NULL;
+
+   ctx = EVP_MD_CTX_new();
+   if (ctx == NULL)
+   {
+      goto error;
+   }
+
+   if (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1 ||
+       EVP_DigestUpdate(ctx, salt, salt_length) != 1 ||
+       EVP_DigestUpdate(ctx, password, strlen(password)) != 1 ||
+       EVP_DigestFinal_ex(ctx, (unsigned char*)digest, &length) != 1 ||
+       length != SCRAM_KEY_LENGTH)
+   {
+      goto error;
+   }
+
+   EVP_MD_CTX_free(ctx);
+
+   return 0;
+
+error:
+
+   EVP_MD_CTX_free(ctx);
+
+   return 1;
+}
+
 static int
 salted_password(char* password, char* salt, int salt_length, int iterations, unsigned char** result, int* result_length)
 {
@@ -4335,11 +5065,28 @@ auth_query(SSL* c_ssl, int client_fd, int slot, char* username, char* database,
    int su_socket;
    SSL* su_ssl = NULL;
    char* shadow = NULL;
+   bool found = false;
+   bool cached = false;
    int ret;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
+   if (!auth_query_cache_get(username, database, &found, &shadow))
+   {
+      cached = true;
+
+      if (!found)
+      {
+         pgagroal_log_debug("auth_query: %s / %s unknown (cached)", username, database);
+         pgagroal_write_connection_refused(c_ssl, client_fd);
+         pgagroal_write_empty(c_ssl, client_fd);
+         goto error;
+      }
+
+      goto client;
+   }
+
    /* Get connection to server using the superuser */
    ret = auth_query_get_connection(config->superuser.username, config->superuser.password, database, &su_socket, &su_ssl);
    if (ret == AUTH_BAD_PASSWORD)
@@ -4377,12 +5124,29 @@ auth_query(SSL* c_ssl, int client_fd, int slot, char* username, char* database,
    pgagroal_disconnect(su_socket);
    atomic_store(&config->su_connection, STATE_FREE);
 
+   auth_query_cache_put(username, database, shadow);
+
+   if (shadow == NULL)
+   {
+      pgagroal_log_debug("auth_query: %s / %s unknown", username, database);
+      pgagroal_write_connection_refused(c_ssl, client_fd);
+      pgagroal_write_empty(c_ssl, client_fd);
+      goto error;
+   }
+
+client:
    /* Client security */
    if (config->connections[slot].has_security == SECURITY_SCRAM256)
    {
       ret = auth_query_client_scram256(c_ssl, client_fd, username, shadow, slot);
       if (ret == AUTH_BAD_PASSWORD)
       {
+         if (cached)
+         {
+            /* The password may have changed, so the next login asks the database */
+            pgagroal_auth_query_cache_clear(username);
+         }
+
          pgagroal_write_bad_password(c_ssl, client_fd, username);
          pgagroal_write_empty(c_ssl, client_fd);
          goto bad_password;
@@ -4472,7 +5236,12 @@ retry:
       }
       else
       {
-         ret = pgagroal_connect(config->servers[server].host, config->servers[server].port, server_fd, config->keep_alive, config->nodelay);
+         ret = pgagroal_connect_server(server, server_fd, config->keep_alive, config->nodelay);
+
+         if (ret == 0)
+         {
+            pgagroal_tcp_keepalive(*server_fd);
+         }
       }
 
       if (ret)
@@ -4506,7 +5275,10 @@ retry:
    pgagroal_log_debug("connect: %s:%d using fd %d", config->servers[server].host, config->servers[server].port, *server_fd);
 
    /* TLS support */
-   establish_client_tls_connection(server, *server_fd, server_ssl);
+   if (establish_client_tls_connection(server, *server_fd, server_ssl) != AUTH_SUCCESS)
+   {
+      goto error;
+   }
 
    /* Startup message */
    status = pgagroal_create_startup_message(username, database, &startup_msg);
@@ -4631,6 +5403,9 @@ pgagroal_scram_client_auth(char* username, char* password, int socket, SSL* serv
    char* salt = NULL;
    size_t salt_length = 0;
    char* password_prep = NULL;
+   bool keys = false;
+   char client_key[SCRAM_KEY_LENGTH];
+   char server_key[SCRAM_KEY_LENGTH];
    char* client_nounce = NULL;
    char* combined_nounce = NULL;
    char* base64_salt = NULL;
@@ -4735,7 +5510,15 @@ pgagroal_scram_client_auth(char* username, char* password, int socket, SSL* serv
    /* r=...,s=...,i=4096 */
    server_first_message = sasl_continue->data + 9;
 
-   if (client_proof(password_prep, salt, salt_length, iteration,
+   /* The keys only depend on the password, the salt and the iteration count */
+   if (scram_keys(username, password_prep, salt, salt_length, iteration, &client_key[0], &server_key[0]))
+   {
+      goto error;
+   }
+   keys = true;
+
+   if (client_proof(NULL, salt, salt_length, iteration,
+                    &client_key[0], SCRAM_KEY_LENGTH,
                     client_first_message_bare, sasl_response->length - 26,
                     server_first_message, sasl_continue->length - 9,
                     &wo_proof[0], strlen(wo_proof),
@@ -4797,8 +5580,8 @@ pgagroal_scram_client_auth(char* username, char* password, int socket, SSL* serv
    pgagroal_base64_decode(base64_server_signature, sasl_final->length - 11,
                           (void**)&server_signature_received, &server_signature_received_length);
 
-   if (server_signature(password_prep, salt, salt_length, iteration,
-                        NULL, 0,
+   if (server_signature(NULL, salt, salt_length, iteration,
+                        &server_key[0], SCRAM_KEY_LENGTH,
                         client_first_message_bare, sasl_response->length - 26,
                         server_first_message, sasl_continue->length - 9,
                         &wo_proof[0], strlen(wo_proof),
@@ -4814,6 +5597,9 @@ pgagroal_scram_client_auth(char* username, char* password, int socket, SSL* serv
    }
 
    free(error);
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -4846,6 +5632,13 @@ bad_password:
    pgagroal_log_warn("Wrong password for user: %s", username);
 
    free(error);
+   if (keys)
+   {
+      scram_keys_invalidate(username, salt, salt_length, iteration);
+   }
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -4868,6 +5661,13 @@ bad_password:
 error:
 
    free(error);
+   if (keys)
+   {
+      scram_keys_invalidate(username, salt, salt_length, iteration);
+   }
+   pgagroal_cleanse(&client_key[0], sizeof(client_key));
+   pgagroal_cleanse(&server_key[0], sizeof(server_key));
+
    free(salt);
    free(err);
    free(password_prep);
@@ -4923,50 +5723,206 @@ auth_query_get_password(int socket, SSL* server_ssl, char* username, char* datab
       goto error;
    }
 
-   status = pgagroal_read_block_message(server_ssl, socket, &tmsg);
-   if (status != MESSAGE_STATUS_OK)
+   status = pgagroal_read_block_message(server_ssl, socket, &tmsg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   if (tmsg->kind == 'E')
+   {
+      goto error;
+   }
+
+   if (pgagroal_extract_message('D', tmsg, &dmsg))
+   {
+      /* A complete result without a row is an unknown user */
+      if (pgagroal_extract_message('C', tmsg, &dmsg))
+      {
+         goto error;
+      }
+
+      goto unknown;
+   }
+
+   /* 'D' + length + column count + column length */
+   if (dmsg->length < 11 || pgagroal_read_int32(dmsg->data + 7) == -1)
+   {
+      goto unknown;
+   }
+
+   result_size = dmsg->length - 11 + 1;
+   result = (char*)calloc(1, result_size);
+   memcpy(result, dmsg->data + 11, dmsg->length - 11);
+
+   *password = result;
+
+unknown:
+
+   free(aq);
+   pgagroal_clear_message(tmsg);
+   pgagroal_free_message(dmsg);
+
+   return 0;
+
+error:
+   pgagroal_log_trace("auth_query_get_password: socket (%d) status (%d)", socket, status);
+
+   if (tmsg->kind == 'E')
+   {
+      char* error = NULL;
+
+      if (pgagroal_extract_error_message(tmsg, &error))
+      {
+         goto error;
+      }
+
+      pgagroal_log_error("%s in %s", error, database);
+      free(error);
+   }
+
+   free(aq);
+   pgagroal_clear_message(tmsg);
+   pgagroal_free_message(dmsg);
+
+   return 1;
+}
+
+static int
+auth_query_cache_get(char* username, char* database, bool* found, char** shadow)
+{
+   unsigned int hash;
+   signed char state;
+   time_t now;
+   struct auth_query_entry* e = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *found = false;
+   *shadow = NULL;
+
+   if (!pgagroal_time_is_valid(config->auth_query_cache_timeout))
    {
-      goto error;
+      return 1;
    }
 
-   if (pgagroal_extract_message('D', tmsg, &dmsg))
+   now = time(NULL);
+   hash = auth_query_cache_hash(username, database);
+
+   for (int i = 0; i < NUMBER_OF_AUTH_QUERY_ENTRIES; i++)
    {
-      goto error;
+      e = &config->auth_query_entries[(hash + i) % NUMBER_OF_AUTH_QUERY_ENTRIES];
+
+      state = STATE_FREE;
+      if (!atomic_compare_exchange_strong(&e->state, &state, STATE_INIT))
+      {
+         if (state == STATE_NOTINIT)
+         {
+            /* End of the probe sequence */
+            return 1;
+         }
+
+         continue;
+      }
+
+      if (e->expires > now && !strcmp(e->username, username) && !strcmp(e->database, database))
+      {
+         *found = e->found;
+         if (e->found)
+         {
+            *shadow = strdup(&e->shadow[0]);
+         }
+
+         atomic_store(&e->state, STATE_FREE);
+
+         return (e->found && *shadow == NULL) ? 1 : 0;
+      }
+
+      atomic_store(&e->state, STATE_FREE);
    }
 
-   result_size = dmsg->length - 11 + 1;
-   result = (char*)calloc(1, result_size);
-   memcpy(result, dmsg->data + 11, dmsg->length - 11);
+   return 1;
+}
 
-   *password = result;
+static void
+auth_query_cache_put(char* username, char* database, char* shadow)
+{
+   unsigned int hash;
+   signed char state;
+   time_t now;
+   struct auth_query_entry* e = NULL;
+   struct main_configuration* config;
 
-   free(aq);
-   pgagroal_clear_message(tmsg);
-   pgagroal_free_message(dmsg);
+   config = (struct main_configuration*)shmem;
 
-   return 0;
+   if (!pgagroal_time_is_valid(config->auth_query_cache_timeout) ||
+       strlen(username) >= MAX_USERNAME_LENGTH || strlen(database) >= MAX_DATABASE_LENGTH ||
+       (shadow != NULL && strlen(shadow) >= AUTH_QUERY_SHADOW_LENGTH))
+   {
+      return;
+   }
 
-error:
-   pgagroal_log_trace("auth_query_get_password: socket (%d) status (%d)", socket, status);
+   now = time(NULL);
+   hash = auth_query_cache_hash(username, database);
 
-   if (tmsg->kind == 'E')
+   for (int i = 0; i < NUMBER_OF_AUTH_QUERY_ENTRIES; i++)
    {
-      char* error = NULL;
+      e = &config->auth_query_entries[(hash + i) % NUMBER_OF_AUTH_QUERY_ENTRIES];
 
-      if (pgagroal_extract_error_message(tmsg, &error))
+      state = STATE_NOTINIT;
+      if (!atomic_compare_exchange_strong(&e->state, &state, STATE_INIT))
       {
-         goto error;
+         state = STATE_FREE;
+         if (!atomic_compare_exchange_strong(&e->state, &state, STATE_INIT))
+         {
+            continue;
+         }
+
+         /* An entry of another user and database is only taken over once expired */
+         if (e->expires > now && (strcmp(e->username, username) || strcmp(e->database, database)))
+         {
+            atomic_store(&e->state, STATE_FREE);
+            continue;
+         }
       }
 
-      pgagroal_log_error("%s in %s", error, database);
-      free(error);
+      memset(&e->username[0], 0, sizeof(e->username));
+      memcpy(&e->username[0], username, strlen(username));
+      memset(&e->database[0], 0, sizeof(e->database));
+      memcpy(&e->database[0], database, strlen(database));
+      pgagroal_cleanse(&e->shadow[0], sizeof(e->shadow));
+      e->found = shadow != NULL;
+      if (shadow != NULL)
+      {
+         memcpy(&e->shadow[0], shadow, strlen(shadow));
+      }
+      e->expires = now + pgagroal_time_convert(config->auth_query_cache_timeout, FORMAT_TIME_S);
+
+      atomic_store(&e->state, STATE_FREE);
+
+      return;
    }
+}
 
-   free(aq);
-   pgagroal_clear_message(tmsg);
-   pgagroal_free_message(dmsg);
+static unsigned int
+auth_query_cache_hash(char* username, char* database)
+{
+   unsigned int hash;
 
-   return 1;
+   /* FNV-1a */
+   hash = 2166136261U;
+   for (char* c = username; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+   hash = (hash ^ 0xFF) * 16777619U;
+   for (char* c = database; *c != '\0'; c++)
+   {
+      hash = (hash ^ (unsigned char)*c) * 16777619U;
+   }
+
+   return hash;
 }
 
 static int
@@ -5237,7 +6193,21 @@ establish_client_tls_connection(int server, int fd, SSL** ssl)
 
    config = (struct main_configuration*)shmem;
 
-   if (config->servers[server].tls)
+   if (config->servers[server].tls_direct)
+   {
+      /* A PostgreSQL 17 server takes the handshake without the SSLRequest */
+      if (create_client_tls_connection(server, fd, ssl) != AUTH_SUCCESS)
+      {
+         goto error;
+      }
+
+      if (!pgagroal_tls_alpn_postgresql(*ssl))
+      {
+         pgagroal_log_error("Server %s didn't select ALPN postgresql for direct TLS", config->servers[server].name);
+         goto error;
+      }
+   }
+   else if (config->servers[server].tls)
    {
       status = pgagroal_create_ssl_message(&ssl_msg);
       if (status != MESSAGE_STATUS_OK)
@@ -5259,7 +6229,7 @@ establish_client_tls_connection(int server, int fd, SSL** ssl)
 
       if (msg->kind == 'S')
       {
-         create_client_tls_connection(fd, ssl, config->servers[server].tls_key_file, config->servers[server].tls_cert_file, config->servers[server].tls_ca_file);
+         create_client_tls_connection(server, fd, ssl);
       }
    }
 
@@ -5276,21 +6246,111 @@ error:
    return AUTH_ERROR;
 }
 
+static bool
+is_direct_tls(int client_fd)
+{
+   unsigned char first = 0;
+   struct pollfd pfd;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pfd.fd = client_fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, (int)pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S) * 1000) <= 0)
+   {
+      errno = 0;
+      return false;
+   }
+
+   /* A TLS handshake record, where a startup packet starts with its length */
+   if (recv(client_fd, &first, 1, MSG_PEEK) != 1)
+   {
+      errno = 0;
+      return false;
+   }
+
+   return first == 0x16;
+}
+
+static int
+accept_client_tls(int client_fd, bool direct, SSL** client_ssl)
+{
+   int status;
+   SSL_CTX* ctx = NULL;
+   struct tls* c_tls = NULL;
+
+   /* We are acting as a server against the client */
+   if (pgagroal_tls_server_context(&ctx))
+   {
+      goto error;
+   }
+
+   if (pgagroal_tls_create_server(ctx, NULL, NULL, NULL, &c_tls))
+   {
+      pgagroal_log_debug("authenticate: connection error");
+      if (!direct)
+      {
+         pgagroal_write_connection_refused(NULL, client_fd);
+         pgagroal_write_empty(NULL, client_fd);
+      }
+      goto error;
+   }
+
+   pgagroal_tls_set_fd(c_tls, client_fd);
+   *client_ssl = c_tls->ssl;
+
+   if (!direct)
+   {
+      /* Switch to TLS mode */
+      status = pgagroal_write_tls(NULL, client_fd);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         goto error;
+      }
+   }
+
+   /* Drive the handshake through the socket shim (memory BIOs) */
+   if (pgagroal_tls_socket_handshake(c_tls, client_fd) != PGAGROAL_TLS_OK)
+   {
+      unsigned long err;
+
+      err = ERR_get_error();
+      pgagroal_log_error("SSL failed: %s", ERR_reason_error_string(err));
+      goto error;
+   }
+
+   /* Direct TLS is only for clients that say they speak the protocol */
+   if (direct && !pgagroal_tls_alpn_postgresql(c_tls->ssl))
+   {
+      pgagroal_log_debug("authenticate: direct TLS without ALPN postgresql (%d)", client_fd);
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
-create_client_tls_connection(int fd, SSL** ssl, char* tls_key_file, char* tls_cert_file, char* tls_ca_file)
+create_client_tls_connection(int server, int fd, SSL** ssl)
 {
    SSL_CTX* ctx = NULL;
    struct tls* t = NULL;
 
-   /* We are acting as a client against the server */
-   if (pgagroal_create_ssl_ctx(true, &ctx))
+   /* We are acting as a client against the server, the context is configured already */
+   if (pgagroal_tls_client_context(server, &ctx))
    {
       pgagroal_log_error("CTX failed");
       goto error;
    }
 
    /* Create a socket-decoupled client context */
-   if (pgagroal_tls_create_client(ctx, tls_key_file, tls_cert_file, tls_ca_file, &t))
+   if (pgagroal_tls_create_client(ctx, NULL, NULL, NULL, &t))
    {
       pgagroal_log_error("Client failed");
       ctx = NULL; /* pgagroal_tls_create_client already released the context */
@@ -5383,10 +6443,10 @@ pgagroal_extract_server_parameters(int slot, struct deque** server_parameters)
    char* value = NULL;
    struct message* msg;
    struct deque* sp = NULL;
-   struct main_configuration* config;
+   struct connection_info* info;
 
    *server_parameters = NULL;
-   config = (struct main_configuration*)shmem;
+   info = pgagroal_connection_info(slot);
 
    if (pgagroal_deque_create(false, &sp))
    {
@@ -5395,15 +6455,15 @@ pgagroal_extract_server_parameters(int slot, struct deque** server_parameters)
 
    for (i = 0; i < NUMBER_OF_SECURITY_MESSAGES; ++i)
    {
-      if ((data_length = config->connections[slot].security_lengths[i]) > 0)
+      if ((data_length = info->security_lengths[i]) > 0)
       {
-         data = config->connections[slot].security_messages[i];
+         data = pgagroal_security_get_message(slot, i);
          offset = 0;
 
          while (offset < data_length)
          {
             offset = pgagroal_extract_message_offset(offset, data, &msg);
-            if (msg->kind == 'S')
+            if (msg != NULL && msg->kind == 'S')
             {
                name = pgagroal_read_string(msg->data + 5);
                value = pgagroal_read_string(msg->data + strlen(name) + 6);
@@ -5866,6 +6926,7 @@ pgagroal_scram_client_authenticate(char* username, char* password, int server_fd
    server_first_message = (char*)sasl_continue->data + 9;
 
    if (client_proof(password_prep, salt, salt_length, iteration,
+                    NULL, 0,
                     client_first_message_bare, sasl_response->length - 26,
                     server_first_message, sasl_continue->length - 9,
                     &wo_proof[0], strlen(wo_proof),
@@ -6009,3 +7070,231 @@ error:
 
    return AUTH_ERROR;
 }
+
+int
+pgagroal_security_store_message(int slot, int index, void* data, ssize_t length)
+{
+   int size;
+   int entry = -1;
+   int deleted = -1;
+   unsigned int hash;
+   struct connection* connection;
+   struct connection_info* info;
+   struct security_message* store;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   connection = &config->connections[slot];
+   info = pgagroal_connection_info(slot);
+   store = pgagroal_security_messages();
+   size = config->connection_slots * SECURITY_MESSAGES_PER_SLOT;
+
+   if (length < 0 || length > SECURITY_BUFFER_SIZE)
+   {
+      pgagroal_log_error("Security message too large: %zd", length);
+      return 1;
+   }
+
+   /* The authenticating process keeps its own copy, so its replay works
+    * even if the store is full */
+   if (scratch_slot != slot)
+   {
+      memset(&scratch, 0, sizeof(scratch));
+      scratch_slot = slot;
+   }
+   memset(&scratch[index], 0, SECURITY_BUFFER_SIZE);
+   memcpy(&scratch[index], data, length);
+
+   /* FNV-1a over the identity and the message */
+   hash = 2166136261U;
+   hash = (hash ^ (unsigned char)connection->server) * 16777619U;
+   hash = (hash ^ (unsigned int)connection->key) * 16777619U;
+   for (ssize_t i = 0; i < length; i++)
+   {
+      hash = (hash ^ ((unsigned char*)data)[i]) * 16777619U;
+   }
+
+   security_store_lock();
+
+   if (info->security_index[index] != 0)
+   {
+      security_store_release(info->security_index[index] - 1);
+      info->security_index[index] = 0;
+   }
+
+   for (int i = 0; entry == -1 && i < size; i++)
+   {
+      int e = (hash + i) % size;
+
+      if (store[e].state == SECURITY_ENTRY_EMPTY)
+      {
+         entry = deleted != -1 ? deleted : e;
+      }
+      else if (store[e].state == SECURITY_ENTRY_DELETED)
+      {
+         if (deleted == -1)
+         {
+            deleted = e;
+         }
+      }
+      else if (store[e].hash == hash && store[e].server == connection->server &&
+               store[e].key == connection->key && store[e].length == length &&
+               !memcmp(store[e].data, data, length))
+      {
+         store[e].references++;
+         info->security_index[index] = e + 1;
+         info->security_lengths[index] = length;
+         security_store_unlock();
+         return 0;
+      }
+   }
+
+   if (entry == -1)
+   {
+      entry = deleted;
+   }
+
+   if (entry == -1)
+   {
+      security_store_unlock();
+      info->security_lengths[index] = length;
+      pgagroal_log_debug("Security message store full (slot %d)", slot);
+      return 0;
+   }
+
+   store[entry].state = SECURITY_ENTRY_USED;
+   store[entry].server = connection->server;
+   store[entry].key = connection->key;
+   store[entry].references = 1;
+   store[entry].hash = hash;
+   store[entry].length = length;
+   memset(&store[entry].data, 0, SECURITY_BUFFER_SIZE);
+   memcpy(&store[entry].data, data, length);
+
+   info->security_index[index] = entry + 1;
+   info->security_lengths[index] = length;
+
+   security_store_unlock();
+
+   return 0;
+}
+
+char*
+pgagroal_security_get_message(int slot, int index)
+{
+   struct connection_info* info;
+
+   info = pgagroal_connection_info(slot);
+
+   if (info->security_index[index] != 0)
+   {
+      return pgagroal_security_messages()[info->security_index[index] - 1].data;
+   }
+
+   if (scratch_slot == slot)
+   {
+      return scratch[index];
+   }
+
+   return &scratch_none[0];
+}
+
+void
+pgagroal_security_release_messages(int slot)
+{
+   struct connection_info* info;
+
+   info = pgagroal_connection_info(slot);
+
+   security_store_lock();
+
+   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+   {
+      if (info->security_index[i] != 0)
+      {
+         security_store_release(info->security_index[i] - 1);
+         info->security_index[i] = 0;
+      }
+      info->security_lengths[i] = 0;
+   }
+
+   security_store_unlock();
+
+   if (scratch_slot == slot)
+   {
+      scratch_slot = -1;
+   }
+}
+
+bool
+pgagroal_security_messages_cached(int slot)
+{
+   struct connection_info* info;
+
+   info = pgagroal_connection_info(slot);
+
+   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+   {
+      if (info->security_lengths[i] > 0 && info->security_index[i] == 0)
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static void
+security_store_lock(void)
+{
+   signed char isfree;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+retry:
+   isfree = STATE_FREE;
+
+   if (!atomic_compare_exchange_strong(&config->security_lock, &isfree, STATE_IN_USE))
+   {
+      SLEEP(1000L)
+      goto retry;
+   }
+}
+
+static void
+security_store_unlock(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   atomic_store(&config->security_lock, STATE_FREE);
+}
+
+static void
+security_store_release(int entry)
+{
+   int size;
+   struct security_message* store;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   store = pgagroal_security_messages();
+   size = config->connection_slots * SECURITY_MESSAGES_PER_SLOT;
+
+   if (store[entry].state == SECURITY_ENTRY_USED && --store[entry].references <= 0)
+   {
+      store[entry].state = SECURITY_ENTRY_DELETED;
+      store[entry].references = 0;
+
+      /* A probe reaching a deleted entry followed by an empty one stops there
+       * anyway, so the deleted entries in front of an empty one become empty */
+      while (store[entry].state == SECURITY_ENTRY_DELETED &&
+             store[(entry + 1) % size].state == SECURITY_ENTRY_EMPTY)
+      {
+         store[entry].state = SECURITY_ENTRY_EMPTY;
+         entry = (entry + size - 1) % size;
+      }
+   }
+}
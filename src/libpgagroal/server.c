@@ -349,7 +349,7 @@ pgagroal_server_query_execute(int server_idx, char* user, char* database, char*
    config = (struct main_configuration*)shmem;
    srv = &config->servers[server_idx];
 
-   if (pgagroal_connect(srv->host, srv->port, &fd, true, false) != 0)
+   if (pgagroal_connect_server(server_idx, &fd, true, false) != 0)
    {
       pgagroal_log_debug("server_query: Failed to connect to server %d (%s:%d)",
                          server_idx, srv->host, srv->port);
@@ -797,6 +797,79 @@ error:
    return 1;
 }
 
+int
+pgagroal_get_replica(int* server)
+{
+   int replica;
+   int backends;
+   long long cost;
+   long long least;
+   struct main_configuration* config;
+
+   replica = -1;
+   least = 0;
+   config = (struct main_configuration*)shmem;
+
+   FOREACH_VALID_SERVER
+   {
+      if (!pgagroal_server_replica_eligible(i))
+      {
+         continue;
+      }
+
+      backends = atomic_load(&config->servers[i].backends);
+
+      if (config->servers[i].max_connections > 0 && backends >= config->servers[i].max_connections)
+      {
+         continue;
+      }
+
+      if (config->replica_balance)
+      {
+         /* A replica that is twice as far away should carry half the backends */
+         cost = (long long)(MAX(atomic_load(&config->servers[i].rtt), 0) + 1) * (backends + 1);
+      }
+      else
+      {
+         cost = atomic_load(&config->servers[i].lag);
+      }
+
+      if (replica == -1 || cost < least)
+      {
+         replica = i;
+         least = cost;
+      }
+   }
+
+   if (replica == -1)
+   {
+      *server = -1;
+      return 1;
+   }
+
+   pgagroal_log_trace("pgagroal_get_replica: server (%d) name (%s) cost (%lld)", replica, config->servers[replica].name, least);
+
+   *server = replica;
+
+   return 0;
+}
+
+bool
+pgagroal_server_replica_eligible(int server)
+{
+   long long lag;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The lag is only known for a replica that answered the last health check */
+   lag = atomic_load(&config->servers[server].lag);
+
+   return lag >= 0 && lag <= (long long)config->replica_max_lag &&
+          atomic_load(&config->servers[server].health_state) == SERVER_HEALTH_UP &&
+          atomic_load(&config->servers[server].state) != SERVER_FAILED;
+}
+
 int
 pgagroal_update_server_state(int slot, int socket, SSL* ssl)
 {
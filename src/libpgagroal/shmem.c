@@ -39,6 +39,11 @@ void* shmem = NULL;
 void* pipeline_shmem = NULL;
 void* prometheus_shmem = NULL;
 void* prometheus_cache_shmem = NULL;
+void* query_cache_shmem = NULL;
+void* tracker_shmem = NULL;
+void* slowlog_shmem = NULL;
+void* activity_shmem = NULL;
+void* log_shmem = NULL;
 
 int
 pgagroal_create_shared_memory(size_t size, unsigned char hp, void** shmem)
@@ -81,8 +86,6 @@ pgagroal_create_shared_memory(size_t size, unsigned char hp, void** shmem)
       }
    }
 
-   memset(s, 0, size);
-
    *shmem = s;
 
    return 0;
@@ -95,18 +98,38 @@ pgagroal_resize_shared_memory(size_t size, void* shmem, size_t* new_size, void**
 
    config = (struct main_configuration*)shmem;
 
-   *new_size = size + (config->max_connections * sizeof(struct connection));
+   *new_size = size + (config->connection_slots * (sizeof(struct connection) + sizeof(struct connection_info)));
+   *new_size += config->connection_slots * SECURITY_MESSAGES_PER_SLOT * sizeof(struct security_message);
    if (pgagroal_create_shared_memory(*new_size, config->common.hugepage, new_shmem))
    {
       return 1;
    }
 
-   memset(*new_shmem, 0, *new_size);
    memcpy(*new_shmem, shmem, size);
 
    return 0;
 }
 
+struct connection_info*
+pgagroal_connection_info(int slot)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   return (struct connection_info*)&config->connections[config->connection_slots] + slot;
+}
+
+struct security_message*
+pgagroal_security_messages(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   return (struct security_message*)(pgagroal_connection_info(config->connection_slots));
+}
+
 int
 pgagroal_destroy_shared_memory(void* shmem, size_t size)
 {
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <json.h>
+#include <logging.h>
+#include <management.h>
+#include <shmem.h>
+#include <slowlog.h>
+#include <utils.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static char application_name[SLOWLOG_NAME_LENGTH];
+
+static struct slowlog_entry* entry_claim(uint64_t* sequence);
+static void entry_publish(struct slowlog_entry* entry, uint64_t sequence);
+static void copy_name(char* dst, char* src);
+static char* kind_name(int kind);
+static char* outcome_name(int outcome);
+
+int
+pgagroal_slowlog_init(size_t* p_size, void** p_shmem)
+{
+   size_t size;
+   struct slowlog_ring* ring = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   size = sizeof(struct slowlog_ring);
+
+   if (pgagroal_create_shared_memory(size, config->common.hugepage, (void**)&ring))
+   {
+      goto error;
+   }
+
+   atomic_init(&ring->head, 0);
+
+   for (int i = 0; i < SLOWLOG_ENTRIES; i++)
+   {
+      atomic_init(&ring->entries[i].sequence, 0);
+   }
+
+   *p_shmem = ring;
+   *p_size = size;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+void
+pgagroal_slowlog_application_name(char* appname)
+{
+   copy_name(&application_name[0], appname);
+}
+
+void
+pgagroal_slowlog_acquire(int slot, int limit_rule, int outcome, char* username, char* database, struct timespec* start)
+{
+   long long duration;
+   uint64_t sequence;
+   struct slowlog_entry* e = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->slow_acquire_threshold <= 0)
+   {
+      return;
+   }
+
+   duration = pgagroal_time_elapsed_usec(start);
+
+   if (duration < (long long)config->slow_acquire_threshold * 1000LL)
+   {
+      return;
+   }
+
+   e = entry_claim(&sequence);
+   if (e == NULL)
+   {
+      return;
+   }
+
+   e->kind = SLOWLOG_ACQUIRE;
+   e->outcome = outcome;
+   e->duration = duration;
+   e->server_duration = 0;
+   e->slot = slot;
+   e->limit_rule = limit_rule;
+   e->server = slot != -1 ? config->connections[slot].server : -1;
+   copy_name(&e->username[0], username);
+   copy_name(&e->database[0], database);
+   copy_name(&e->appname[0], &application_name[0]);
+
+   entry_publish(e, sequence);
+}
+
+void
+pgagroal_slowlog_transaction(int slot, long long transaction_time, long long service_time)
+{
+   uint64_t sequence;
+   struct slowlog_entry* e = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->slow_transaction_threshold <= 0 ||
+       transaction_time < (long long)config->slow_transaction_threshold * 1000LL)
+   {
+      return;
+   }
+
+   e = entry_claim(&sequence);
+   if (e == NULL)
+   {
+      return;
+   }
+
+   e->kind = SLOWLOG_TRANSACTION;
+   e->outcome = SLOWLOG_DONE;
+   e->duration = transaction_time;
+   e->server_duration = service_time;
+   e->slot = slot;
+   e->limit_rule = config->connections[slot].limit_rule;
+   e->server = config->connections[slot].server;
+   copy_name(&e->username[0], &pgagroal_connection_info(slot)->username[0]);
+   copy_name(&e->database[0], &pgagroal_connection_info(slot)->database[0]);
+   copy_name(&e->appname[0], &pgagroal_connection_info(slot)->appname[0]);
+
+   entry_publish(e, sequence);
+}
+
+int
+pgagroal_slowlog_read(uint64_t since, struct json* response)
+{
+   uint64_t head;
+   uint64_t first;
+   struct slowlog_entry copy;
+   struct slowlog_entry* e = NULL;
+   struct slowlog_ring* ring = NULL;
+   struct json* entries = NULL;
+   struct json* entry = NULL;
+
+   ring = (struct slowlog_ring*)slowlog_shmem;
+
+   if (ring == NULL || pgagroal_json_create(&entries))
+   {
+      goto error;
+   }
+
+   head = atomic_load(&ring->head);
+
+   first = since + 1;
+   if (head > SLOWLOG_ENTRIES && first < head - SLOWLOG_ENTRIES + 1)
+   {
+      first = head - SLOWLOG_ENTRIES + 1;
+   }
+
+   for (uint64_t s = first; s <= head; s++)
+   {
+      e = &ring->entries[(s - 1) % SLOWLOG_ENTRIES];
+
+      if (atomic_load_explicit(&e->sequence, memory_order_acquire) != s)
+      {
+         /* Still being written, or already overwritten */
+         continue;
+      }
+
+      memcpy(&copy, e, sizeof(struct slowlog_entry));
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load_explicit(&e->sequence, memory_order_relaxed) != s)
+      {
+         continue;
+      }
+
+      copy.username[SLOWLOG_NAME_LENGTH - 1] = '\0';
+      copy.database[SLOWLOG_NAME_LENGTH - 1] = '\0';
+      copy.appname[SLOWLOG_NAME_LENGTH - 1] = '\0';
+
+      if (pgagroal_json_create(&entry))
+      {
+         goto error;
+      }
+
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)s, ValueUInt64);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_TIMESTAMP, (uintptr_t)copy.timestamp, ValueInt64);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_KIND, (uintptr_t)kind_name(copy.kind), ValueString);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_OUTCOME, (uintptr_t)outcome_name(copy.outcome), ValueString);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_DURATION, (uintptr_t)copy.duration, ValueInt64);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_SERVER_DURATION, (uintptr_t)copy.server_duration, ValueInt64);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_PID, (uintptr_t)copy.pid, ValueInt32);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_SLOT, (uintptr_t)copy.slot, ValueInt32);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)copy.server, ValueInt32);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_LIMIT_RULE, (uintptr_t)copy.limit_rule, ValueInt32);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)copy.username, ValueString);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)copy.database, ValueString);
+      pgagroal_json_put(entry, MANAGEMENT_ARGUMENT_APPNAME, (uintptr_t)copy.appname, ValueString);
+
+      pgagroal_json_append(entries, (uintptr_t)entry, ValueJSON);
+      entry = NULL;
+   }
+
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)head, ValueUInt64);
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_ENTRIES, (uintptr_t)entries, ValueJSON);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(entry);
+   pgagroal_json_destroy(entries);
+
+   return 1;
+}
+
+static struct slowlog_entry*
+entry_claim(uint64_t* sequence)
+{
+   struct timeval t;
+   struct slowlog_entry* e = NULL;
+   struct slowlog_ring* ring = NULL;
+
+   ring = (struct slowlog_ring*)slowlog_shmem;
+
+   if (ring == NULL)
+   {
+      return NULL;
+   }
+
+   *sequence = atomic_fetch_add(&ring->head, 1) + 1;
+
+   e = &ring->entries[(*sequence - 1) % SLOWLOG_ENTRIES];
+
+   /* Readers skip the entry until it is published under its new sequence */
+   atomic_store_explicit(&e->sequence, 0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   gettimeofday(&t, NULL);
+
+   e->timestamp = t.tv_sec * 1000 + t.tv_usec / 1000;
+   e->pid = getpid();
+
+   return e;
+}
+
+static void
+entry_publish(struct slowlog_entry* entry, uint64_t sequence)
+{
+   atomic_store_explicit(&entry->sequence, sequence, memory_order_release);
+}
+
+static void
+copy_name(char* dst, char* src)
+{
+   size_t length = 0;
+
+   if (src != NULL)
+   {
+      length = strnlen(src, SLOWLOG_NAME_LENGTH - 1);
+      memcpy(dst, src, length);
+   }
+
+   dst[length] = '\0';
+}
+
+static char*
+kind_name(int kind)
+{
+   switch (kind)
+   {
+      case SLOWLOG_ACQUIRE:
+         return "acquire";
+      case SLOWLOG_TRANSACTION:
+         return "transaction";
+      default:
+         break;
+   }
+
+   return "unknown";
+}
+
+static char*
+outcome_name(int outcome)
+{
+   switch (outcome)
+   {
+      case SLOWLOG_REUSE:
+         return "reuse";
+      case SLOWLOG_CREATED:
+         return "created";
+      case SLOWLOG_BUSY:
+         return "busy";
+      case SLOWLOG_TIMEOUT:
+         return "timeout";
+      case SLOWLOG_ERROR:
+         return "error";
+      case SLOWLOG_DONE:
+         return "done";
+      default:
+         break;
+   }
+
+   return "unknown";
+}
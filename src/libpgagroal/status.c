@@ -31,137 +31,127 @@
 #include <json.h>
 #include <logging.h>
 #include <management.h>
-#include <memory.h>
-#include <network.h>
 #include <server.h>
+#include <shmem.h>
 #include <status.h>
 #include <utils.h>
 
-static void status_details(bool details, struct json* response);
+static int status_write(bool details, struct json* payload, time_t start_time, struct json_writer* writer, struct management_stream* stream);
+static int status_flush(void* sink, char* data, size_t length);
+static void status_servers(struct json_writer* writer);
+static void status_limits(struct json_writer* writer);
+static void status_databases(struct json_writer* writer);
+static void status_connections(struct json_writer* writer);
 
-void
-pgagroal_status(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
+int
+pgagroal_status(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload, struct json_writer* writer)
 {
    char* elapsed = NULL;
    time_t start_time;
-   time_t end_time;
    int total_seconds;
-   struct json* response = NULL;
-
-   pgagroal_memory_init();
-   pgagroal_start_logging();
+   struct management_stream* stream = NULL;
 
    start_time = time(NULL);
 
-   if (pgagroal_management_create_response(payload, -1, &response))
+   if (pgagroal_management_stream_create(compression, encryption, &stream) ||
+       status_write(false, payload, start_time, writer, stream))
    {
+      pgagroal_management_response_error(ssl, client_fd, NULL, MANAGEMENT_ERROR_STATUS_NETWORK, compression, encryption, payload);
+      pgagroal_log_error("Status: Error creating response");
+
       goto error;
    }
 
-   status_details(false, response);
-
-   end_time = time(NULL);
-
-   if (pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload))
+   if (pgagroal_management_stream_send(ssl, client_fd, stream))
    {
-      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_STATUS_NETWORK, compression, encryption, payload);
       pgagroal_log_error("Status: Error sending response");
 
       goto error;
    }
 
-   elapsed = pgagroal_get_timestamp_string(start_time, end_time, &total_seconds);
+   pgagroal_management_stream_destroy(stream);
 
-   pgagroal_log_info("Status (Elapsed: %s)", elapsed);
-
-   pgagroal_json_destroy(payload);
+   elapsed = pgagroal_get_timestamp_string(start_time, time(NULL), &total_seconds);
 
-   pgagroal_disconnect(client_fd);
+   pgagroal_log_info("Status (Elapsed: %s)", elapsed);
 
-   pgagroal_stop_logging();
-   pgagroal_memory_destroy();
+   free(elapsed);
 
-   exit(0);
+   return 0;
 
 error:
 
-   pgagroal_json_destroy(payload);
+   pgagroal_management_stream_destroy(stream);
 
-   pgagroal_disconnect(client_fd);
-
-   pgagroal_stop_logging();
-   pgagroal_memory_destroy();
-
-   exit(1);
+   return 1;
 }
 
-void
-pgagroal_status_details(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
+int
+pgagroal_status_details(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload, struct json_writer* writer)
 {
    char* elapsed = NULL;
    time_t start_time;
-   time_t end_time;
    int total_seconds;
-   struct json* response = NULL;
-
-   pgagroal_memory_init();
-   pgagroal_start_logging();
+   struct management_stream* stream = NULL;
 
    start_time = time(NULL);
 
-   if (pgagroal_management_create_response(payload, -1, &response))
+   if (pgagroal_management_stream_create(compression, encryption, &stream) ||
+       status_write(true, payload, start_time, writer, stream))
    {
+      pgagroal_management_response_error(ssl, client_fd, NULL, MANAGEMENT_ERROR_STATUS_DETAILS_NETWORK, compression, encryption, payload);
+      pgagroal_log_error("Status details: Error creating response");
+
       goto error;
    }
 
-   status_details(true, response);
-
-   end_time = time(NULL);
-
-   if (pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload))
+   if (pgagroal_management_stream_send(ssl, client_fd, stream))
    {
-      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_STATUS_DETAILS_NETWORK, compression, encryption, payload);
       pgagroal_log_error("Status details: Error sending response");
 
       goto error;
    }
 
-   elapsed = pgagroal_get_timestamp_string(start_time, end_time, &total_seconds);
+   pgagroal_management_stream_destroy(stream);
 
-   pgagroal_log_info("Status details (Elapsed: %s)", elapsed);
-
-   pgagroal_json_destroy(payload);
+   elapsed = pgagroal_get_timestamp_string(start_time, time(NULL), &total_seconds);
 
-   pgagroal_disconnect(client_fd);
+   pgagroal_log_info("Status details (Elapsed: %s)", elapsed);
 
-   pgagroal_stop_logging();
-   pgagroal_memory_destroy();
+   free(elapsed);
 
-   exit(0);
+   return 0;
 
 error:
 
-   pgagroal_json_destroy(payload);
+   pgagroal_management_stream_destroy(stream);
 
-   pgagroal_disconnect(client_fd);
-
-   pgagroal_stop_logging();
-   pgagroal_memory_destroy();
-
-   exit(1);
+   return 1;
 }
 
-static void
-status_details(bool details, struct json* response)
+static int
+status_write(bool details, struct json* payload, time_t start_time, struct json_writer* writer, struct management_stream* stream)
 {
    int active = 0;
    int total = 0;
-   struct json* servers = NULL;
+   int32_t total_seconds = 0;
+   char* elapsed = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)(config->gracefully ? "Graceful shutdown" : "Running"), ValueString);
+   pgagroal_json_writer_reset(writer);
+   pgagroal_json_writer_sink(writer, status_flush, stream);
+
+   pgagroal_json_writer_begin_object(writer, NULL);
+
+   pgagroal_json_writer_json(writer, MANAGEMENT_CATEGORY_HEADER, (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_HEADER));
+   pgagroal_json_writer_json(writer, MANAGEMENT_CATEGORY_REQUEST, (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST));
+
+   pgagroal_json_writer_begin_object(writer, MANAGEMENT_CATEGORY_RESPONSE);
+
+   pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_SERVER_VERSION, PGAGROAL_VERSION);
+   pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_STATUS, config->gracefully ? "Graceful shutdown" : "Running");
 
    for (int i = 0; i < config->max_connections; i++)
    {
@@ -186,21 +176,59 @@ status_details(bool details, struct json* response)
       }
    }
 
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS, (uintptr_t)active, ValueUInt32);
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_TOTAL_CONNECTIONS, (uintptr_t)total, ValueUInt32);
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_MAX_CONNECTIONS, (uintptr_t)config->max_connections, ValueUInt32);
+   pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS, active);
+   pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_TOTAL_CONNECTIONS, total);
+   pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_MAX_CONNECTIONS, config->max_connections);
+
+   pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS, config->number_of_servers);
+
+   status_servers(writer);
+
+   if (details)
+   {
+      status_limits(writer);
+      status_databases(writer);
+      status_connections(writer);
+   }
+
+   pgagroal_json_writer_end_object(writer);
+
+   elapsed = pgagroal_get_timestamp_string(start_time, time(NULL), &total_seconds);
 
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS, (uintptr_t)config->number_of_servers, ValueInt32);
+   pgagroal_json_writer_begin_object(writer, MANAGEMENT_CATEGORY_OUTCOME);
+   pgagroal_json_writer_bool(writer, MANAGEMENT_ARGUMENT_STATUS, true);
+   pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_TIME, elapsed);
+   pgagroal_json_writer_end_object(writer);
 
-   pgagroal_json_create(&servers);
+   pgagroal_json_writer_end_object(writer);
+
+   free(elapsed);
+
+   return pgagroal_json_writer_finish(writer);
+}
+
+static int
+status_flush(void* sink, char* data, size_t length)
+{
+   return pgagroal_management_stream_write((struct management_stream*)sink, data, length);
+}
+
+static void
+status_servers(struct json_writer* writer)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_json_writer_begin_object(writer, MANAGEMENT_ARGUMENT_SERVERS);
 
    FOREACH_VALID_SERVER
    {
-      struct json* js = NULL;
       const char* health_str = "UNKNOWN";
       int health_state = atomic_load(&config->servers[i].health_state);
-      char* srv_status = NULL;
-      char* srv_primary = NULL;
+      signed char state = atomic_load(&config->servers[i].state);
+      char* srv_status = "Unknown";
+      char* srv_primary = "Unknown";
       int64_t behind_bytes = -1;
 
       if (strlen(config->servers[i].name) == 0)
@@ -208,144 +236,168 @@ status_details(bool details, struct json* response)
          continue;
       }
 
+      /* The connectivity is the one last seen by the health check, the
+       * servers are not queried from the main process */
       if (health_state == SERVER_HEALTH_UP)
+      {
          health_str = "UP";
+         srv_status = "Running";
+      }
       else if (health_state == SERVER_HEALTH_DOWN)
+      {
          health_str = "DOWN";
+         srv_status = "Down";
+      }
 
-      pgagroal_server_get_connectivity_info(i, &srv_status, &srv_primary, &behind_bytes);
-
-      pgagroal_json_create(&js);
+      if (state == SERVER_PRIMARY)
+      {
+         srv_primary = "Yes";
+      }
+      else if (state == SERVER_REPLICA)
+      {
+         srv_primary = "No";
+         behind_bytes = atomic_load(&config->servers[i].lag);
+      }
 
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->servers[i].name, ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_STATE, (uintptr_t)pgagroal_server_state_as_string(config->servers[i].state), ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_HEALTH, (uintptr_t)health_str, ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_MAJOR_VERSION, (uintptr_t)config->servers[i].version, ValueInt32);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_SYSTEM_IDENTIFIER, (uintptr_t)config->servers[i].system_identifier, ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)srv_status, ValueString);
-      pgagroal_json_put(js, MANAGEMENT_ARGUMENT_PRIMARY, (uintptr_t)srv_primary, ValueString);
+      pgagroal_json_writer_begin_object(writer, config->servers[i].name);
+
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_SERVER, config->servers[i].name);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_HOST, config->servers[i].host);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_PORT, config->servers[i].port);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_STATE, (char*)pgagroal_server_state_as_string(state));
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_HEALTH, (char*)health_str);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_MAJOR_VERSION, config->servers[i].version);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_SYSTEM_IDENTIFIER, config->servers[i].system_identifier);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_STATUS, srv_status);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_PRIMARY, srv_primary);
       if (behind_bytes >= 0)
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_BEHIND, (uintptr_t)behind_bytes, ValueInt64);
+      {
+         pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_BEHIND, behind_bytes);
+      }
 
-      pgagroal_json_put(servers, config->servers[i].name, (uintptr_t)js, ValueJSON);
+      pgagroal_json_writer_end_object(writer);
    }
 
-   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_SERVERS, (uintptr_t)servers, ValueJSON);
+   pgagroal_json_writer_end_object(writer);
 
    /* Show invalid servers separately */
-   {
-      struct json* invalid_servers = NULL;
-      pgagroal_json_create(&invalid_servers);
+   pgagroal_json_writer_begin_object(writer, "invalid_servers");
 
-      FOREACH_INVALID_SERVER
+   FOREACH_INVALID_SERVER
+   {
+      if (strlen(config->servers[i].name) == 0)
       {
-         struct json* js = NULL;
+         continue;
+      }
 
-         if (strlen(config->servers[i].name) == 0)
-         {
-            continue;
-         }
+      pgagroal_json_writer_begin_object(writer, config->servers[i].name);
 
-         pgagroal_json_create(&js);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_SERVER, config->servers[i].name);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_HOST, config->servers[i].host);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_PORT, config->servers[i].port);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_STATE, "Invalid");
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->servers[i].name, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_STATE, (uintptr_t)"Invalid", ValueString);
+      pgagroal_json_writer_end_object(writer);
+   }
 
-         pgagroal_json_put(invalid_servers, config->servers[i].name, (uintptr_t)js, ValueJSON);
-      }
+   pgagroal_json_writer_end_object(writer);
+}
 
-      pgagroal_json_put(response, "invalid_servers", (uintptr_t)invalid_servers, ValueJSON);
-   }
+static void
+status_limits(struct json_writer* writer)
+{
+   struct main_configuration* config;
 
-   if (details)
-   {
-      int number_of_disabled = 0;
-      struct json* limits = NULL;
-      struct json* databases = NULL;
-      struct json* connections = NULL;
+   config = (struct main_configuration*)shmem;
 
-      pgagroal_json_create(&limits);
-      pgagroal_json_create(&connections);
+   pgagroal_json_writer_begin_array(writer, MANAGEMENT_ARGUMENT_LIMITS);
 
-      for (int i = 0; i < config->number_of_limits; i++)
-      {
-         struct json* js = NULL;
+   for (int i = 0; i < config->number_of_limits; i++)
+   {
+      pgagroal_json_writer_begin_object(writer, NULL);
 
-         pgagroal_json_create(&js);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_DATABASE, config->limits[i].database);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_USERNAME, config->limits[i].username);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)config->limits[i].database, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)config->limits[i].username, ValueString);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS, atomic_load(&config->limits[i].active_connections));
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS, (uintptr_t)atomic_load(&config->limits[i].active_connections), ValueUInt32);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_MAX_CONNECTIONS, config->limits[i].max_size);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_INITIAL_CONNECTIONS, config->limits[i].initial_size);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_MIN_CONNECTIONS, config->limits[i].min_size);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_MAX_CONNECTIONS, (uintptr_t)config->limits[i].max_size, ValueUInt32);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_INITIAL_CONNECTIONS, (uintptr_t)config->limits[i].initial_size, ValueUInt32);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_MIN_CONNECTIONS, (uintptr_t)config->limits[i].min_size, ValueUInt32);
+      pgagroal_json_writer_end_object(writer);
+   }
 
-         pgagroal_json_append(limits, (uintptr_t)js, ValueJSON);
-      }
+   pgagroal_json_writer_end_array(writer);
+}
 
-      pgagroal_json_put(response, MANAGEMENT_ARGUMENT_LIMITS, (uintptr_t)limits, ValueJSON);
+static void
+status_databases(struct json_writer* writer)
+{
+   int number_of_disabled = 0;
+   struct main_configuration* config;
 
-      pgagroal_json_create(&databases);
+   config = (struct main_configuration*)shmem;
 
-      for (int i = 0; i < NUMBER_OF_DISABLED; i++)
-      {
-         struct json* js = NULL;
+   pgagroal_json_writer_begin_array(writer, MANAGEMENT_ARGUMENT_DATABASES);
 
-         if (strlen(config->disabled[i]) > 0)
-         {
-            pgagroal_json_create(&js);
+   for (int i = 0; i < NUMBER_OF_DISABLED; i++)
+   {
+      if (strlen(config->disabled[i]) > 0)
+      {
+         pgagroal_json_writer_begin_object(writer, NULL);
 
-            pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)config->disabled[i], ValueString);
-            pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+         pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_DATABASE, config->disabled[i]);
+         pgagroal_json_writer_bool(writer, MANAGEMENT_ARGUMENT_ENABLED, false);
 
-            pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+         pgagroal_json_writer_end_object(writer);
 
-            number_of_disabled++;
-         }
+         number_of_disabled++;
       }
+   }
 
-      if (number_of_disabled == 0)
-      {
-         struct json* js = NULL;
+   if (number_of_disabled == 0)
+   {
+      pgagroal_json_writer_begin_object(writer, NULL);
 
-         pgagroal_json_create(&js);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_DATABASE, "*");
+      pgagroal_json_writer_bool(writer, MANAGEMENT_ARGUMENT_ENABLED, !config->all_disabled);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)"*", ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)!config->all_disabled, ValueBool);
+      pgagroal_json_writer_end_object(writer);
+   }
 
-         pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
-      }
+   pgagroal_json_writer_end_array(writer);
+}
 
-      pgagroal_json_put(response, MANAGEMENT_ARGUMENT_DATABASES, (uintptr_t)databases, ValueJSON);
+static void
+status_connections(struct json_writer* writer)
+{
+   struct main_configuration* config;
 
-      for (int i = 0; i < config->max_connections; i++)
-      {
-         int state = atomic_load(&config->states[i]);
-         struct json* js = NULL;
+   config = (struct main_configuration*)shmem;
 
-         pgagroal_json_create(&js);
+   pgagroal_json_writer_begin_array(writer, MANAGEMENT_ARGUMENT_CONNECTIONS);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_STATE, (uintptr_t)pgagroal_connection_state_as_string(state), ValueString);
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      int state = atomic_load(&config->states[i]);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_START_TIME, (uintptr_t)config->connections[i].start_time, ValueInt64);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_TIMESTAMP, (uintptr_t)config->connections[i].timestamp, ValueInt64);
+      pgagroal_json_writer_begin_object(writer, NULL);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_PID, (uintptr_t)config->connections[i].pid, ValueInt32);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_FD, (uintptr_t)config->connections[i].fd, ValueInt32);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_STATE, (char*)pgagroal_connection_state_as_string(state));
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)config->connections[i].database, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)config->connections[i].username, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_APPNAME, (uintptr_t)config->connections[i].appname, ValueString);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_START_TIME, config->connections[i].start_time);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_TIMESTAMP, config->connections[i].timestamp);
 
-         pgagroal_json_append(connections, (uintptr_t)js, ValueJSON);
-      }
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_PID, config->connections[i].pid);
+      pgagroal_json_writer_int(writer, MANAGEMENT_ARGUMENT_FD, config->connections[i].fd);
+
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_DATABASE, pgagroal_connection_info(i)->database);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_USERNAME, pgagroal_connection_info(i)->username);
+      pgagroal_json_writer_string(writer, MANAGEMENT_ARGUMENT_APPNAME, pgagroal_connection_info(i)->appname);
 
-      pgagroal_json_put(response, MANAGEMENT_ARGUMENT_CONNECTIONS, (uintptr_t)connections, ValueJSON);
+      pgagroal_json_writer_end_object(writer);
    }
+
+   pgagroal_json_writer_end_array(writer);
 }
@@ -29,6 +29,7 @@
 #include <pgagroal.h>
 #include <tls.h>
 #include <logging.h>
+#include <shmem.h>
 
 #include <errno.h>
 #include <stddef.h>
@@ -37,9 +38,25 @@
 #include <unistd.h>
 
 #include <openssl/bio.h>
+#include <openssl/core_names.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/x509.h>
 
+static SSL_CTX* server_ctx = NULL;
+static SSL_CTX* client_ctx[NUMBER_OF_SERVERS];
+static unsigned int contexts_generation = 0;
+
+static int contexts_build(SSL_CTX** server, SSL_CTX** clients);
+static int client_ctx_build(char* key, char* cert, char* root, SSL_CTX** ctx);
+static void contexts_destroy(SSL_CTX* server, SSL_CTX** clients);
+static void contexts_refresh(void);
+static int alpn_select_cb(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg);
+
+/* The ALPN protocol of PostgreSQL 17, in the wire format */
+static const unsigned char alpn_postgresql[] = {10, 'p', 'o', 's', 't', 'g', 'r', 'e', 's', 'q', 'l'};
+
 static int
 classify(SSL* ssl, int rc)
 {
@@ -172,6 +189,17 @@ pgagroal_tls_from_ssl(SSL* ssl)
    return (struct tls*)SSL_get_app_data(ssl);
 }
 
+bool
+pgagroal_tls_ktls_send(SSL* ssl)
+{
+   if (ssl == NULL || pgagroal_tls_from_ssl(ssl) != NULL)
+   {
+      return false;
+   }
+
+   return BIO_get_ktls_send(SSL_get_wbio(ssl)) ? true : false;
+}
+
 int
 pgagroal_tls_feed(struct tls* tls, const void* buf, size_t len, size_t* consumed)
 {
@@ -609,7 +637,7 @@ error:
 int
 pgagroal_tls_create_server(SSL_CTX* ctx, char* key_file, char* cert_file, char* ca_file, struct tls** tls)
 {
-   if (pgagroal_tls_configure_server_ctx(ctx, key_file, cert_file, ca_file))
+   if (cert_file != NULL && pgagroal_tls_configure_server_ctx(ctx, key_file, cert_file, ca_file))
    {
       goto error;
    }
@@ -713,10 +741,288 @@ error:
    return 1;
 }
 
+static int
+ticket_key_cb(SSL* ssl __attribute__((unused)), unsigned char* key_name, unsigned char* iv,
+              EVP_CIPHER_CTX* cipher_ctx, EVP_MAC_CTX* mac_ctx, int enc)
+{
+   int current;
+   int index = -1;
+   struct tls_ticket_key* k = NULL;
+   OSSL_PARAM params[3];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   current = atomic_load(&config->tls_ticket_key);
+
+   if (enc)
+   {
+      k = &config->tls_ticket_keys[current];
+      if (!atomic_load(&k->valid))
+      {
+         /* No ticket */
+         return 0;
+      }
+
+      if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+      {
+         return -1;
+      }
+
+      memcpy(key_name, &k->name[0], sizeof(k->name));
+      index = current;
+   }
+   else
+   {
+      for (int i = 0; index == -1 && i < NUMBER_OF_TLS_TICKET_KEYS; i++)
+      {
+         if (atomic_load(&config->tls_ticket_keys[i].valid) &&
+             !memcmp(key_name, &config->tls_ticket_keys[i].name[0], sizeof(config->tls_ticket_keys[i].name)))
+         {
+            index = i;
+         }
+      }
+
+      if (index == -1)
+      {
+         /* Unknown or expired key, so a full handshake */
+         return 0;
+      }
+
+      k = &config->tls_ticket_keys[index];
+   }
+
+   params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, &k->hmac_key[0], sizeof(k->hmac_key));
+   params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+   params[2] = OSSL_PARAM_construct_end();
+
+   if (EVP_MAC_CTX_set_params(mac_ctx, params) != 1)
+   {
+      return -1;
+   }
+
+   if (enc)
+   {
+      if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, &k->aes_key[0], iv) != 1)
+      {
+         return -1;
+      }
+
+      return 1;
+   }
+
+   if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, &k->aes_key[0], iv) != 1)
+   {
+      return -1;
+   }
+
+   /* A ticket of the previous key is renewed */
+   return index == current ? 1 : 2;
+}
+
+int
+pgagroal_tls_session_tickets(SSL_CTX* ctx)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || !atomic_load(&config->tls_ticket_keys[atomic_load(&config->tls_ticket_key)].valid))
+   {
+      return 0;
+   }
+
+   SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+
+   if (SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"pgagroal", strlen("pgagroal")) != 1)
+   {
+      goto error;
+   }
+
+   /* A ticket of the previous key is accepted until the next rotation */
+   SSL_CTX_set_timeout(ctx, 2 * TLS_TICKET_KEY_ROTATION);
+   SSL_CTX_set_num_tickets(ctx, 1);
+
+   if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb) != 1)
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+
+   return 1;
+}
+
+bool
+pgagroal_tls_alpn_postgresql(SSL* ssl)
+{
+   const unsigned char* protocol = NULL;
+   unsigned int length = 0;
+
+   SSL_get0_alpn_selected(ssl, &protocol, &length);
+
+   return length == sizeof(alpn_postgresql) - 1 && !memcmp(protocol, &alpn_postgresql[1], length);
+}
+
+int
+pgagroal_tls_contexts_create(void)
+{
+   SSL_CTX* server = NULL;
+   SSL_CTX* clients[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (contexts_build(&server, &clients[0]))
+   {
+      /* The running contexts stay in place */
+      pgagroal_log_error("Unable to build the TLS contexts");
+      return 1;
+   }
+
+   contexts_destroy(server_ctx, &client_ctx[0]);
+
+   server_ctx = server;
+   memcpy(&client_ctx[0], &clients[0], sizeof(client_ctx));
+   contexts_generation = atomic_fetch_add(&config->tls_generation, 1) + 1;
+
+   return 0;
+}
+
+int
+pgagroal_tls_server_context(SSL_CTX** ctx)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *ctx = NULL;
+
+   contexts_refresh();
+
+   if (server_ctx != NULL)
+   {
+      if (SSL_CTX_up_ref(server_ctx) != 1)
+      {
+         goto error;
+      }
+
+      *ctx = server_ctx;
+
+      return 0;
+   }
+
+   /* No shared context, so one for this connection */
+   if (pgagroal_create_ssl_ctx(false, ctx))
+   {
+      goto error;
+   }
+
+   pgagroal_tls_session_tickets(*ctx);
+
+   if (pgagroal_tls_configure_server_ctx(*ctx, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (*ctx != NULL)
+   {
+      SSL_CTX_free(*ctx);
+      *ctx = NULL;
+   }
+
+   return 1;
+}
+
+int
+pgagroal_tls_client_context(int server, SSL_CTX** ctx)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *ctx = NULL;
+
+   if (server < 0 || server >= NUMBER_OF_SERVERS)
+   {
+      goto error;
+   }
+
+   contexts_refresh();
+
+   if (client_ctx[server] != NULL)
+   {
+      if (SSL_CTX_up_ref(client_ctx[server]) != 1)
+      {
+         goto error;
+      }
+
+      *ctx = client_ctx[server];
+
+      return 0;
+   }
+
+   if (client_ctx_build(config->servers[server].tls_key_file, config->servers[server].tls_cert_file,
+                        config->servers[server].tls_ca_file, ctx))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgagroal_tls_rotate_ticket_keys(void)
+{
+   int next;
+   struct tls_ticket_key* k = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The slot of the previous key is overwritten with the new key */
+   next = (atomic_load(&config->tls_ticket_key) + 1) % NUMBER_OF_TLS_TICKET_KEYS;
+   k = &config->tls_ticket_keys[next];
+
+   atomic_store(&k->valid, false);
+
+   if (RAND_bytes(&k->name[0], sizeof(k->name)) != 1 ||
+       RAND_bytes(&k->aes_key[0], sizeof(k->aes_key)) != 1 ||
+       RAND_bytes(&k->hmac_key[0], sizeof(k->hmac_key)) != 1)
+   {
+      pgagroal_log_error("Unable to generate a TLS session ticket key");
+      goto error;
+   }
+
+   atomic_store(&k->valid, true);
+   atomic_store(&config->tls_ticket_key, next);
+
+   pgagroal_log_debug("TLS session ticket key rotated");
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 int
 pgagroal_create_ssl_ctx(bool client, SSL_CTX** ctx)
 {
    SSL_CTX* c = NULL;
+   struct configuration* config = (struct configuration*)shmem;
 
    if (client)
    {
@@ -741,6 +1047,14 @@ pgagroal_create_ssl_ctx(bool client, SSL_CTX** ctx)
    SSL_CTX_set_options(c, SSL_OP_NO_TICKET);
    SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
 
+#ifdef SSL_OP_ENABLE_KTLS
+   /* OpenSSL falls back to user space when the kernel or the cipher can't be offloaded */
+   if (config != NULL && config->tls_ktls)
+   {
+      SSL_CTX_set_options(c, SSL_OP_ENABLE_KTLS);
+   }
+#endif
+
    *ctx = c;
 
    return 0;
@@ -760,7 +1074,7 @@ pgagroal_create_ssl_server(SSL_CTX* ctx, char* key_file, char* cert_file, char*
 {
    SSL* s = NULL;
 
-   if (pgagroal_tls_configure_server_ctx(ctx, key_file, cert_file, ca_file))
+   if (cert_file != NULL && pgagroal_tls_configure_server_ctx(ctx, key_file, cert_file, ca_file))
    {
       goto error;
    }
@@ -885,3 +1199,202 @@ error:
 
    return 1;
 }
+
+static int
+contexts_build(SSL_CTX** server, SSL_CTX** clients)
+{
+   SSL_CTX* s = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *server = NULL;
+   memset(clients, 0, NUMBER_OF_SERVERS * sizeof(SSL_CTX*));
+
+   if (config->common.tls)
+   {
+      if (pgagroal_create_ssl_ctx(false, &s))
+      {
+         goto error;
+      }
+
+      pgagroal_tls_session_tickets(s);
+      SSL_CTX_set_alpn_select_cb(s, alpn_select_cb, NULL);
+
+      if (pgagroal_tls_configure_server_ctx(s, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file))
+      {
+         goto error;
+      }
+   }
+
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      if (config->servers[i].tls)
+      {
+         if (client_ctx_build(config->servers[i].tls_key_file, config->servers[i].tls_cert_file,
+                              config->servers[i].tls_ca_file, &clients[i]))
+         {
+            goto error;
+         }
+      }
+   }
+
+   *server = s;
+
+   return 0;
+
+error:
+
+   contexts_destroy(s, clients);
+   memset(clients, 0, NUMBER_OF_SERVERS * sizeof(SSL_CTX*));
+
+   return 1;
+}
+
+static int
+client_ctx_build(char* key, char* cert, char* root, SSL_CTX** ctx)
+{
+   SSL_CTX* c = NULL;
+
+   *ctx = NULL;
+
+   if (pgagroal_create_ssl_ctx(true, &c))
+   {
+      goto error;
+   }
+
+   /* Servers before PostgreSQL 17 ignore the extension */
+   if (SSL_CTX_set_alpn_protos(c, &alpn_postgresql[0], sizeof(alpn_postgresql)) != 0)
+   {
+      goto error;
+   }
+
+   if (root != NULL && strlen(root) > 0)
+   {
+      if (SSL_CTX_load_verify_locations(c, root, NULL) != 1)
+      {
+         unsigned long err;
+
+         err = ERR_get_error();
+         pgagroal_log_error("Couldn't load TLS CA: %s", root);
+         pgagroal_log_error("Reason: %s", ERR_reason_error_string(err));
+         goto error;
+      }
+
+      SSL_CTX_set_verify(c, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, NULL);
+   }
+
+   if (cert != NULL && strlen(cert) > 0)
+   {
+      if (SSL_CTX_use_certificate_chain_file(c, cert) != 1)
+      {
+         unsigned long err;
+
+         err = ERR_get_error();
+         pgagroal_log_error("Couldn't load TLS certificate: %s", cert);
+         pgagroal_log_error("Reason: %s", ERR_reason_error_string(err));
+         goto error;
+      }
+
+      if (key != NULL && strlen(key) > 0)
+      {
+         if (SSL_CTX_use_PrivateKey_file(c, key, SSL_FILETYPE_PEM) != 1)
+         {
+            unsigned long err;
+
+            err = ERR_get_error();
+            pgagroal_log_error("Couldn't load TLS private key: %s", key);
+            pgagroal_log_error("Reason: %s", ERR_reason_error_string(err));
+            goto error;
+         }
+
+         if (SSL_CTX_check_private_key(c) != 1)
+         {
+            unsigned long err;
+
+            err = ERR_get_error();
+            pgagroal_log_error("TLS private key check failed: %s", key);
+            pgagroal_log_error("Reason: %s", ERR_reason_error_string(err));
+            goto error;
+         }
+      }
+   }
+
+   *ctx = c;
+
+   return 0;
+
+error:
+
+   if (c != NULL)
+   {
+      SSL_CTX_free(c);
+   }
+
+   return 1;
+}
+
+static void
+contexts_destroy(SSL_CTX* server, SSL_CTX** clients)
+{
+   /* Connections using a context keep their own reference */
+   if (server != NULL)
+   {
+      SSL_CTX_free(server);
+   }
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      if (clients[i] != NULL)
+      {
+         SSL_CTX_free(clients[i]);
+         clients[i] = NULL;
+      }
+   }
+}
+
+static void
+contexts_refresh(void)
+{
+   unsigned int generation;
+   SSL_CTX* server = NULL;
+   SSL_CTX* clients[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   generation = atomic_load(&config->tls_generation);
+   if (generation == contexts_generation)
+   {
+      return;
+   }
+
+   /* Forked before the contexts were replaced, so build them for this process */
+   contexts_generation = generation;
+
+   if (contexts_build(&server, &clients[0]))
+   {
+      return;
+   }
+
+   contexts_destroy(server_ctx, &client_ctx[0]);
+
+   server_ctx = server;
+   memcpy(&client_ctx[0], &clients[0], sizeof(client_ctx));
+}
+
+static int
+alpn_select_cb(SSL* ssl __attribute__((unused)), const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg __attribute__((unused)))
+{
+   unsigned char* selected = NULL;
+
+   /* A client that doesn't offer postgresql is only refused for direct TLS */
+   if (SSL_select_next_proto(&selected, outlen, &alpn_postgresql[0], sizeof(alpn_postgresql), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+   {
+      return SSL_TLSEXT_ERR_NOACK;
+   }
+
+   *out = selected;
+
+   return SSL_TLSEXT_ERR_OK;
+}
@@ -28,11 +28,15 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <json.h>
 #include <logging.h>
+#include <management.h>
 #include <server.h>
+#include <shmem.h>
 #include <tracker.h>
 
 /* system */
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,150 +44,359 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
-static int count_connections(void);
+static struct tracker_event* event_claim(uint64_t* sequence);
+static void event_publish(struct tracker_event* event, uint64_t sequence);
+static void copy_name(char* dst, char* src);
+static char* event_name(int id);
+
+int
+pgagroal_tracker_init(size_t* p_size, void** p_shmem)
+{
+   size_t size;
+   struct tracker_ring* ring = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   size = sizeof(struct tracker_ring);
+
+   if (pgagroal_create_shared_memory(size, config->common.hugepage, (void**)&ring))
+   {
+      goto error;
+   }
+
+   atomic_init(&ring->head, 0);
+
+   for (int i = 0; i < TRACKER_EVENTS; i++)
+   {
+      atomic_init(&ring->events[i].sequence, 0);
+   }
+
+   *p_shmem = ring;
+   *p_size = size;
+
+   return 0;
+
+error:
+
+   return 1;
+}
 
 void
 pgagroal_tracking_event_basic(int id, char* username, char* database)
 {
    int primary;
+   uint64_t sequence;
+   struct tracker_event* e = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
    if (config->tracker)
    {
-      struct timeval t;
-      long long milliseconds;
-
-      gettimeofday(&t, NULL);
-      milliseconds = t.tv_sec * 1000 + t.tv_usec / 1000;
-
-      if (username == NULL)
-      {
-         username = "";
-      }
-
-      if (database == NULL)
+      e = event_claim(&sequence);
+      if (e == NULL)
       {
-         database = "";
+         return;
       }
 
       pgagroal_get_primary(&primary);
 
-      pgagroal_log_info("PGAGROAL|%d|%d|%d|%lld|%d|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d|",
-                        id,
-                        -1,
-                        -3,
-                        milliseconds,
-                        getpid(),
-                        username,
-                        database,
-                        "",
-                        -1,
-                        primary,
-                        -1,
-                        -3,
-                        -1,
-                        -1,
-                        atomic_load(&config->active_connections),
-                        count_connections());
+      e->id = id;
+      e->slot = -1;
+      e->state = -3;
+      e->server = primary;
+      e->limit_rule = -1;
+      e->fd = -1;
+      copy_name(&e->username[0], username);
+      copy_name(&e->database[0], database);
+      copy_name(&e->appname[0], NULL);
+
+      event_publish(e, sequence);
    }
 }
 
 void
 pgagroal_tracking_event_slot(int id, int slot)
 {
+   uint64_t sequence;
+   struct tracker_event* e = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
    if (config->tracker)
    {
-      char* username = NULL;
-      char* database = NULL;
-      char* appname = NULL;
-      struct timeval t;
-      long long milliseconds;
+      e = event_claim(&sequence);
+      if (e == NULL)
+      {
+         return;
+      }
 
-      gettimeofday(&t, NULL);
-      milliseconds = t.tv_sec * 1000 + t.tv_usec / 1000;
+      e->id = id;
+      e->slot = slot;
 
       if (slot != -1)
       {
-         username = &config->connections[slot].username[0];
-         database = &config->connections[slot].database[0];
-         appname = &config->connections[slot].appname[0];
+         e->state = atomic_load(&config->states[slot]);
+         e->server = config->connections[slot].server;
+         e->limit_rule = config->connections[slot].limit_rule;
+         e->fd = config->connections[slot].fd;
+         copy_name(&e->username[0], &pgagroal_connection_info(slot)->username[0]);
+         copy_name(&e->database[0], &pgagroal_connection_info(slot)->database[0]);
+         copy_name(&e->appname[0], &pgagroal_connection_info(slot)->appname[0]);
       }
       else
       {
-         username = "";
-         database = "";
-         appname = "";
+         e->state = -3;
+         e->server = -1;
+         e->limit_rule = -1;
+         e->fd = -1;
+         copy_name(&e->username[0], NULL);
+         copy_name(&e->database[0], NULL);
+         copy_name(&e->appname[0], NULL);
       }
 
-      pgagroal_log_info("PGAGROAL|%d|%d|%d|%lld|%d|%s|%s|%s|%d|%d|%d|%d|%d|%d|%d|%d|",
-                        id,
-                        slot,
-                        atomic_load(&config->states[slot]),
-                        milliseconds,
-                        getpid(),
-                        username,
-                        database,
-                        appname,
-                        config->connections[slot].new,
-                        config->connections[slot].server,
-                        config->connections[slot].tx_mode,
-                        config->connections[slot].has_security,
-                        config->connections[slot].limit_rule,
-                        config->connections[slot].fd,
-                        atomic_load(&config->active_connections),
-                        count_connections());
+      event_publish(e, sequence);
    }
 }
 
 void
 pgagroal_tracking_event_socket(int id, int socket)
 {
+   uint64_t sequence;
+   struct tracker_event* e = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
    if (config->tracker)
    {
-      struct timeval t;
-      long long milliseconds;
+      e = event_claim(&sequence);
+      if (e == NULL)
+      {
+         return;
+      }
 
-      gettimeofday(&t, NULL);
-      milliseconds = t.tv_sec * 1000 + t.tv_usec / 1000;
+      e->id = id;
+      e->slot = -1;
+      e->state = -3;
+      e->server = -1;
+      e->limit_rule = -1;
+      e->fd = socket;
+      copy_name(&e->username[0], NULL);
+      copy_name(&e->database[0], NULL);
+      copy_name(&e->appname[0], NULL);
 
-      pgagroal_log_info("PGAGROAL|%d|%lld|%d|%d|",
-                        id,
-                        milliseconds,
-                        getpid(),
-                        socket);
+      event_publish(e, sequence);
    }
 }
 
-static int
-count_connections(void)
+int
+pgagroal_tracker_read(uint64_t since, struct json* response)
 {
-   int active = 0;
-   struct main_configuration* config;
+   uint64_t head;
+   uint64_t first;
+   struct tracker_event copy;
+   struct tracker_event* e = NULL;
+   struct tracker_ring* ring = NULL;
+   struct json* events = NULL;
+   struct json* event = NULL;
 
-   config = (struct main_configuration*)shmem;
+   ring = (struct tracker_ring*)tracker_shmem;
 
-   for (int i = 0; i < config->max_connections; i++)
+   if (ring == NULL || pgagroal_json_create(&events))
    {
-      int state = atomic_load(&config->states[i]);
-      switch (state)
+      goto error;
+   }
+
+   head = atomic_load(&ring->head);
+
+   first = since + 1;
+   if (head > TRACKER_EVENTS && first < head - TRACKER_EVENTS + 1)
+   {
+      first = head - TRACKER_EVENTS + 1;
+   }
+
+   for (uint64_t s = first; s <= head; s++)
+   {
+      e = &ring->events[(s - 1) % TRACKER_EVENTS];
+
+      if (atomic_load_explicit(&e->sequence, memory_order_acquire) != s)
+      {
+         /* Still being written, or already overwritten */
+         continue;
+      }
+
+      memcpy(&copy, e, sizeof(struct tracker_event));
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load_explicit(&e->sequence, memory_order_relaxed) != s)
       {
-         case STATE_IN_USE:
-         case STATE_GRACEFULLY:
-            active++;
-         default:
-            break;
+         continue;
       }
+
+      copy.username[TRACKER_NAME_LENGTH - 1] = '\0';
+      copy.database[TRACKER_NAME_LENGTH - 1] = '\0';
+      copy.appname[TRACKER_NAME_LENGTH - 1] = '\0';
+
+      if (pgagroal_json_create(&event))
+      {
+         goto error;
+      }
+
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)s, ValueUInt64);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_TIMESTAMP, (uintptr_t)copy.timestamp, ValueInt64);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_EVENT, (uintptr_t)event_name(copy.id), ValueString);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_PID, (uintptr_t)copy.pid, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_SLOT, (uintptr_t)copy.slot, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_STATE, (uintptr_t)copy.state, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)copy.server, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_LIMIT_RULE, (uintptr_t)copy.limit_rule, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_FD, (uintptr_t)copy.fd, ValueInt32);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)copy.username, ValueString);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)copy.database, ValueString);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_APPNAME, (uintptr_t)copy.appname, ValueString);
+      pgagroal_json_put(event, MANAGEMENT_ARGUMENT_ACTIVE_CONNECTIONS, (uintptr_t)copy.active_connections, ValueInt32);
+
+      pgagroal_json_append(events, (uintptr_t)event, ValueJSON);
+      event = NULL;
+   }
+
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_SEQUENCE, (uintptr_t)head, ValueUInt64);
+   pgagroal_json_put(response, MANAGEMENT_ARGUMENT_EVENTS, (uintptr_t)events, ValueJSON);
+
+   return 0;
+
+error:
+
+   pgagroal_json_destroy(event);
+   pgagroal_json_destroy(events);
+
+   return 1;
+}
+
+static struct tracker_event*
+event_claim(uint64_t* sequence)
+{
+   struct timeval t;
+   struct tracker_event* e = NULL;
+   struct tracker_ring* ring = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   ring = (struct tracker_ring*)tracker_shmem;
+
+   if (ring == NULL)
+   {
+      return NULL;
+   }
+
+   *sequence = atomic_fetch_add(&ring->head, 1) + 1;
+
+   e = &ring->events[(*sequence - 1) % TRACKER_EVENTS];
+
+   /* Readers skip the event until it is published under its new sequence */
+   atomic_store_explicit(&e->sequence, 0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   gettimeofday(&t, NULL);
+
+   e->timestamp = t.tv_sec * 1000 + t.tv_usec / 1000;
+   e->pid = getpid();
+   e->active_connections = atomic_load(&config->active_connections);
+
+   return e;
+}
+
+static void
+event_publish(struct tracker_event* event, uint64_t sequence)
+{
+   atomic_store_explicit(&event->sequence, sequence, memory_order_release);
+}
+
+static void
+copy_name(char* dst, char* src)
+{
+   size_t length = 0;
+
+   if (src != NULL)
+   {
+      length = strnlen(src, TRACKER_NAME_LENGTH - 1);
+      memcpy(dst, src, length);
+   }
+
+   dst[length] = '\0';
+}
+
+static char*
+event_name(int id)
+{
+   switch (id)
+   {
+      case TRACKER_CLIENT_START:
+         return "client_start";
+      case TRACKER_CLIENT_STOP:
+         return "client_stop";
+      case TRACKER_GET_CONNECTION_SUCCESS:
+         return "get_connection_success";
+      case TRACKER_GET_CONNECTION_TIMEOUT:
+         return "get_connection_timeout";
+      case TRACKER_GET_CONNECTION_ERROR:
+         return "get_connection_error";
+      case TRACKER_RETURN_CONNECTION_SUCCESS:
+         return "return_connection_success";
+      case TRACKER_RETURN_CONNECTION_KILL:
+         return "return_connection_kill";
+      case TRACKER_KILL_CONNECTION:
+         return "kill_connection";
+      case TRACKER_AUTHENTICATE:
+         return "authenticate";
+      case TRACKER_BAD_CONNECTION:
+         return "bad_connection";
+      case TRACKER_IDLE_TIMEOUT:
+         return "idle_timeout";
+      case TRACKER_MAX_CONNECTION_AGE:
+         return "max_connection_age";
+      case TRACKER_INVALID_CONNECTION:
+         return "invalid_connection";
+      case TRACKER_FLUSH:
+         return "flush";
+      case TRACKER_REMOVE_CONNECTION:
+         return "remove_connection";
+      case TRACKER_PREFILL:
+         return "prefill";
+      case TRACKER_PREFILL_RETURN:
+         return "prefill_return";
+      case TRACKER_PREFILL_KILL:
+         return "prefill_kill";
+      case TRACKER_WORKER_RETURN1:
+         return "worker_return1";
+      case TRACKER_WORKER_RETURN2:
+         return "worker_return2";
+      case TRACKER_WORKER_KILL1:
+         return "worker_kill1";
+      case TRACKER_WORKER_KILL2:
+         return "worker_kill2";
+      case TRACKER_TX_RETURN_CONNECTION_START:
+         return "tx_return_connection_start";
+      case TRACKER_TX_RETURN_CONNECTION_STOP:
+         return "tx_return_connection_stop";
+      case TRACKER_TX_GET_CONNECTION:
+         return "tx_get_connection";
+      case TRACKER_TX_RETURN_CONNECTION:
+         return "tx_return_connection";
+      case TRACKER_SOCKET_ASSOCIATE_CLIENT:
+         return "socket_associate_client";
+      case TRACKER_SOCKET_ASSOCIATE_SERVER:
+         return "socket_associate_server";
+      case TRACKER_SOCKET_DISASSOCIATE_CLIENT:
+         return "socket_disassociate_client";
+      case TRACKER_SOCKET_DISASSOCIATE_SERVER:
+         return "socket_disassociate_server";
+      default:
+         break;
    }
 
-   return active;
+   return "unknown";
 }
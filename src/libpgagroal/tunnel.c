@@ -0,0 +1,1295 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <connection.h>
+#include <ev.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <memory.h>
+#include <network.h>
+#include <security.h>
+#include <tls.h>
+#include <tunnel.h>
+#include <utils.h>
+#include <worker.h>
+#include <zstandard_compression.h>
+
+/* system */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define TUNNEL_VERSION        1
+#define TUNNEL_HEADER_SIZE    10
+#define TUNNEL_HELLO_SIZE     8
+#define TUNNEL_READ_SIZE      65536
+#define TUNNEL_MAX_PAYLOAD    (TUNNEL_READ_SIZE + 4)
+#define TUNNEL_MAX_STREAMS    65536
+#define TUNNEL_COMPRESS_SIZE  256
+#define TUNNEL_WRITE_TIMEOUT  10000 /* milliseconds */
+#define TUNNEL_RETRY_INTERVAL 1000  /* milliseconds */
+
+#define TUNNEL_FRAME_HELLO 'H'
+#define TUNNEL_FRAME_OPEN  'O'
+#define TUNNEL_FRAME_DATA  'D'
+#define TUNNEL_FRAME_CLOSE 'C'
+
+#define TUNNEL_FLAG_LZ4  1
+#define TUNNEL_FLAG_ZSTD 2
+
+/** @struct tunnel_stream
+ * Defines a client carried over a tunnel link
+ */
+struct tunnel_stream
+{
+   struct worker_io io;        /**< Receives from the client (always first) */
+   int32_t id;                 /**< The stream identifier */
+   int fd;                     /**< The client descriptor, or -1 when closed */
+   bool active;                /**< Is the watcher started */
+   bool sent_close;            /**< Has CLOSE been sent */
+   bool received_close;        /**< Has CLOSE been received */
+   struct tunnel_stream* next; /**< The next stream to free */
+};
+
+static void link_cb(struct io_watcher* watcher);
+static void stream_cb(struct io_watcher* watcher);
+static void accept_cb(struct io_watcher* watcher);
+static void shutdown_cb(void);
+static void retry_cb(void);
+static int link_connect(void);
+static int link_start(int fd);
+static void link_close(void);
+static int link_receive(void);
+static void link_process(void);
+static int link_frame(char kind, int flags, int32_t id, char* payload, int32_t length);
+static int link_send(char kind, int32_t id, void* data, size_t length, bool compress);
+static int link_write(void* data, size_t length);
+static int write_all(int fd, char* data, size_t length, bool link);
+static int input_append(char* data, size_t length);
+static struct tunnel_stream* stream_create(int32_t id, int fd);
+static int stream_open(int fd, char* address);
+static int stream_accept(int32_t id, char* address);
+static struct tunnel_stream* stream_find(int32_t id);
+static void stream_end(struct tunnel_stream* s);
+static void stream_release(struct tunnel_stream* s);
+static void reclaim_streams(bool all);
+
+static bool edge = false;
+static int unix_socket = -1;
+static char socket_name[MISC_LENGTH];
+static int link_fd = -1;
+static struct tls* link_tls = NULL;
+static struct worker_io link_io;
+static bool link_active = false;
+static bool link_hello = false;
+static int compression = TUNNEL_COMPRESSION_NONE;
+static char* input = NULL;
+static size_t input_size = 0;
+static size_t input_length = 0;
+static bool processing = false;
+static struct tunnel_stream** streams = NULL;
+static int32_t number_of_streams = 0;
+static struct tunnel_stream* closing = NULL;
+static struct tunnel_stream* reclaim = NULL;
+static char frame[TUNNEL_HEADER_SIZE + TUNNEL_MAX_PAYLOAD];
+static char chunk[TUNNEL_READ_SIZE];
+static char received[TUNNEL_READ_SIZE];
+static char plain[TUNNEL_READ_SIZE];
+static char cipher[TUNNEL_HEADER_SIZE + TUNNEL_MAX_PAYLOAD];
+static int next_link = 0;
+
+void
+pgagroal_tunnel_link(int index, char** argv)
+{
+   struct event_loop* loop = NULL;
+   struct io_watcher io_mgt;
+   struct signal_info signal_watcher;
+   struct periodic_watcher retry_watcher;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   edge = true;
+   compression = config->tunnel_compression;
+
+   pgagroal_set_proc_title(1, argv, "tunnel", config->tunnel);
+
+   memset(&socket_name, 0, sizeof(socket_name));
+   pgagroal_snprintf(&socket_name[0], sizeof(socket_name), "%s.%d", MAIN_UDS, (int)getpid());
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &socket_name[0], &unix_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &socket_name[0], config->common.port);
+      exit(1);
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal_tunnel: Failed to create loop");
+      exit(1);
+   }
+
+   memset(&io_mgt, 0, sizeof(struct io_watcher));
+   pgagroal_event_accept_init(&io_mgt, unix_socket, accept_cb);
+   pgagroal_io_start(&io_mgt);
+
+   pgagroal_signal_init(&signal_watcher.sig_w, shutdown_cb, SIGQUIT);
+   signal_watcher.slot = -1;
+   pgagroal_signal_start(&signal_watcher.sig_w);
+
+   pgagroal_periodic_init(&retry_watcher, retry_cb, TUNNEL_RETRY_INTERVAL, TUNNEL_RETRY_INTERVAL);
+   pgagroal_periodic_start(&retry_watcher);
+
+   pgagroal_log_debug("pgagroal_tunnel: Link %d (PID %d)", index, (int)getpid());
+
+   if (link_connect())
+   {
+      pgagroal_log_warn("pgagroal_tunnel: Could not connect to %s", config->tunnel);
+   }
+
+   pgagroal_event_loop_run();
+
+   link_close();
+   reclaim_streams(true);
+   free(streams);
+   free(input);
+
+   pgagroal_periodic_stop(&retry_watcher);
+   pgagroal_io_stop(&io_mgt);
+   pgagroal_disconnect(unix_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &socket_name[0]);
+   errno = 0;
+
+   pgagroal_event_loop_destroy();
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+}
+
+int
+pgagroal_tunnel_hand_off(int client_fd, char* address)
+{
+   int fd = -1;
+   pid_t pid = 0;
+   char buffer[MISC_LENGTH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* Spread the clients over the links, skipping a link that is restarting */
+   for (int i = 0; pid <= 0 && i < config->tunnel_links; i++)
+   {
+      pid = config->tunnel_pid[next_link];
+      next_link = (next_link + 1) % config->tunnel_links;
+   }
+
+   if (pid <= 0)
+   {
+      goto error;
+   }
+
+   if (pgagroal_connection_get_pid(pid, &fd))
+   {
+      goto error;
+   }
+
+   memset(&buffer, 0, sizeof(buffer));
+   memcpy(&buffer[0], address, MIN(strlen(address), sizeof(buffer) - 1));
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_TUNNEL) ||
+       pgagroal_connection_buffer_write(fd, &buffer[0], sizeof(buffer)) ||
+       pgagroal_connection_fd_write(fd, -1, client_fd))
+   {
+      goto error;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+void
+pgagroal_tunnel_serve(int fd, char* address, char** argv)
+{
+   struct event_loop* loop = NULL;
+   struct signal_info signal_watcher;
+   struct periodic_watcher retry_watcher;
+   SSL_CTX* ctx = NULL;
+   char* identity = NULL;
+   struct main_configuration* config;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   config = (struct main_configuration*)shmem;
+
+   edge = false;
+
+   pgagroal_set_proc_title(1, argv, "tunnel", address);
+
+   /* The client addresses of an edge are trusted, so only an edge with a verified
+    * certificate that the HBA entries of the tunnel database allow gets a link */
+   if (pgagroal_create_ssl_ctx(false, &ctx))
+   {
+      pgagroal_log_error("pgagroal_tunnel: Could not create the TLS context for %s", address);
+      goto error;
+   }
+
+   if (pgagroal_tls_create_server(ctx, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file, &link_tls))
+   {
+      /* The context is released already */
+      pgagroal_log_error("pgagroal_tunnel: Could not create the TLS server for %s", address);
+      goto error;
+   }
+   SSL_CTX_free(ctx);
+
+   SSL_set_verify(link_tls->ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT | SSL_VERIFY_CLIENT_ONCE, NULL);
+
+   if (pgagroal_tls_socket_handshake(link_tls, fd) != PGAGROAL_TLS_OK)
+   {
+      pgagroal_log_error("pgagroal_tunnel: TLS handshake with %s failed", address);
+      goto error;
+   }
+
+   identity = pgagroal_extract_cert_identity(link_tls->ssl);
+   if (identity == NULL)
+   {
+      pgagroal_log_error("pgagroal_tunnel: No certificate identity for %s", address);
+      goto error;
+   }
+
+   if (!pgagroal_tunnel_allowed(identity, address))
+   {
+      pgagroal_log_warn("pgagroal_tunnel: Link from %s (%s) not allowed", address, identity);
+      goto error;
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal_tunnel: Failed to create loop");
+      goto error;
+   }
+
+   pgagroal_signal_init(&signal_watcher.sig_w, shutdown_cb, SIGQUIT);
+   signal_watcher.slot = -1;
+   pgagroal_signal_start(&signal_watcher.sig_w);
+
+   pgagroal_periodic_init(&retry_watcher, retry_cb, TUNNEL_RETRY_INTERVAL, TUNNEL_RETRY_INTERVAL);
+   pgagroal_periodic_start(&retry_watcher);
+
+   if (link_start(fd))
+   {
+      pgagroal_log_error("pgagroal_tunnel: Could not serve %s", address);
+      goto error;
+   }
+
+   pgagroal_log_info("pgagroal_tunnel: Link from %s (%s)", address, identity);
+
+   pgagroal_event_loop_run();
+
+   link_close();
+   reclaim_streams(true);
+   free(streams);
+   free(input);
+
+   pgagroal_periodic_stop(&retry_watcher);
+
+   pgagroal_event_loop_destroy();
+
+   pgagroal_log_info("pgagroal_tunnel: Link from %s closed", address);
+
+   free(identity);
+   free(address);
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(0);
+
+error:
+
+   if (link_tls != NULL)
+   {
+      pgagroal_tls_free(link_tls);
+      link_tls = NULL;
+   }
+
+   pgagroal_disconnect(fd);
+
+   free(identity);
+   free(address);
+
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+
+   exit(1);
+}
+
+static void
+link_cb(struct io_watcher* watcher __attribute__((unused)))
+{
+   if (link_receive())
+   {
+      link_close();
+      return;
+   }
+
+   link_process();
+
+   /* The engine may have a reply of its own, like a key update */
+   if (link_active && link_tls != NULL && pgagroal_tls_pending(link_tls))
+   {
+      if (link_write(NULL, 0))
+      {
+         link_close();
+      }
+   }
+}
+
+static void
+stream_cb(struct io_watcher* watcher)
+{
+   ssize_t n;
+   struct tunnel_stream* s = NULL;
+
+   s = (struct tunnel_stream*)watcher;
+
+   n = read(s->fd, &chunk[0], sizeof(chunk));
+   if (n > 0)
+   {
+      if (link_send(TUNNEL_FRAME_DATA, s->id, &chunk[0], (size_t)n, true))
+      {
+         link_close();
+         return;
+      }
+   }
+   else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+   {
+      errno = 0;
+      stream_end(s);
+   }
+   else
+   {
+      errno = 0;
+   }
+
+   /* Frames read while the link was written */
+   link_process();
+}
+
+static void
+accept_cb(struct io_watcher* watcher)
+{
+   int client_fd = -1;
+   int id = -1;
+   int32_t slot = -1;
+   int fd = -1;
+   char address[MISC_LENGTH];
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      errno = 0;
+      return;
+   }
+
+   if (pgagroal_connection_id_read(client_fd, &id))
+   {
+      pgagroal_log_error("pgagroal_tunnel: Management client: ID: %d", id);
+      goto done;
+   }
+
+   if (id == CONNECTION_TUNNEL)
+   {
+      memset(&address, 0, sizeof(address));
+
+      if (pgagroal_connection_buffer_read(client_fd, &address[0], sizeof(address)) ||
+          pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal_tunnel: Hand-off: FD %d", fd);
+         goto done;
+      }
+
+      address[sizeof(address) - 1] = '\0';
+
+      if (!link_active && link_connect())
+      {
+         pgagroal_log_debug("pgagroal_tunnel: No link for %s", &address[0]);
+         pgagroal_disconnect(fd);
+      }
+      else if (stream_open(fd, &address[0]))
+      {
+         pgagroal_log_debug("pgagroal_tunnel: No stream for %s", &address[0]);
+      }
+
+      link_process();
+   }
+   else
+   {
+      pgagroal_log_debug("pgagroal_tunnel: Unsupported management id: %d", id);
+   }
+
+done:
+
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+shutdown_cb(void)
+{
+   pgagroal_event_loop_break();
+}
+
+static void
+retry_cb(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   reclaim_streams(false);
+
+   if (!config->keep_running)
+   {
+      pgagroal_event_loop_break();
+      return;
+   }
+
+   if (edge && !link_active)
+   {
+      if (link_connect())
+      {
+         pgagroal_log_debug("pgagroal_tunnel: Could not connect to %s", config->tunnel);
+      }
+   }
+}
+
+static int
+link_connect(void)
+{
+   int fd = -1;
+   char hello[TUNNEL_HELLO_SIZE];
+   SSL_CTX* ctx = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgagroal_connect(config->tunnel_host, config->tunnel_host_port, &fd, config->keep_alive, config->nodelay))
+   {
+      goto error;
+   }
+
+   if (config->tunnel_tls)
+   {
+      if (pgagroal_create_ssl_ctx(true, &ctx))
+      {
+         goto error;
+      }
+
+      if (pgagroal_tls_create_client(ctx, config->common.tls_key_file, config->common.tls_cert_file, config->common.tls_ca_file, &link_tls))
+      {
+         /* The context is released already */
+         ctx = NULL;
+         goto error;
+      }
+      SSL_CTX_free(ctx);
+      ctx = NULL;
+
+      if (pgagroal_tls_socket_handshake(link_tls, fd) != PGAGROAL_TLS_OK)
+      {
+         pgagroal_log_error("pgagroal_tunnel: TLS handshake with %s failed", config->tunnel);
+         goto error;
+      }
+   }
+
+   if (link_start(fd))
+   {
+      goto error;
+   }
+
+   pgagroal_write_int32(&hello[0], TUNNEL_VERSION);
+   pgagroal_write_int32(&hello[4], compression);
+
+   if (link_send(TUNNEL_FRAME_HELLO, 0, &hello[0], sizeof(hello), false))
+   {
+      link_close();
+      return 1;
+   }
+
+   pgagroal_log_info("pgagroal_tunnel: Link to %s", config->tunnel);
+
+   return 0;
+
+error:
+
+   if (ctx != NULL)
+   {
+      SSL_CTX_free(ctx);
+   }
+
+   if (link_tls != NULL)
+   {
+      pgagroal_tls_free(link_tls);
+      link_tls = NULL;
+   }
+
+   if (fd != -1)
+   {
+      pgagroal_disconnect(fd);
+   }
+
+   return 1;
+}
+
+static int
+link_start(int fd)
+{
+   if (pgagroal_socket_nonblocking(fd))
+   {
+      return 1;
+   }
+
+   link_fd = fd;
+   link_active = true;
+   /* The edge starts the link, so only the central waits for a HELLO */
+   link_hello = edge;
+   input_length = 0;
+
+   memset(&link_io, 0, sizeof(struct worker_io));
+   pgagroal_event_worker_init(&link_io.io, fd, fd, link_cb);
+   link_io.client_fd = fd;
+   link_io.server_fd = -1;
+   link_io.slot = -1;
+   pgagroal_io_start(&link_io.io);
+
+   return 0;
+}
+
+static void
+link_close(void)
+{
+   if (!link_active)
+   {
+      return;
+   }
+
+   pgagroal_io_stop(&link_io.io);
+   link_active = false;
+
+   /* The clients of a link can't outlive it */
+   for (int32_t i = 0; i < number_of_streams; i++)
+   {
+      struct tunnel_stream* s = streams[i];
+
+      if (s != NULL)
+      {
+         s->sent_close = true;
+         s->received_close = true;
+         stream_end(s);
+      }
+   }
+
+   if (link_tls != NULL)
+   {
+      pgagroal_tls_free(link_tls);
+      link_tls = NULL;
+   }
+
+   pgagroal_disconnect(link_fd);
+   link_fd = -1;
+   link_hello = false;
+   input_length = 0;
+
+   if (edge)
+   {
+      pgagroal_log_info("pgagroal_tunnel: Link closed");
+   }
+   else
+   {
+      pgagroal_event_loop_break();
+   }
+}
+
+static int
+link_receive(void)
+{
+   ssize_t n;
+   size_t offset = 0;
+   size_t consumed = 0;
+   size_t nread = 0;
+   int status;
+
+   n = read(link_fd, &received[0], sizeof(received));
+   if (n == 0)
+   {
+      return 1;
+   }
+   else if (n < 0)
+   {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      {
+         errno = 0;
+         return 0;
+      }
+
+      errno = 0;
+      return 1;
+   }
+
+   if (link_tls == NULL)
+   {
+      return input_append(&received[0], (size_t)n);
+   }
+
+   while (offset < (size_t)n)
+   {
+      if (pgagroal_tls_feed(link_tls, &received[offset], (size_t)n - offset, &consumed) != PGAGROAL_TLS_OK || consumed == 0)
+      {
+         return 1;
+      }
+      offset += consumed;
+
+      while ((status = pgagroal_tls_read(link_tls, &plain[0], sizeof(plain), &nread)) == PGAGROAL_TLS_OK)
+      {
+         if (input_append(&plain[0], nread))
+         {
+            return 1;
+         }
+      }
+
+      if (status != PGAGROAL_TLS_WANT_IO)
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static void
+link_process(void)
+{
+   size_t offset = 0;
+   char kind;
+   int flags;
+   int32_t id;
+   int32_t length;
+
+   /* Sending may read the link, the frames are processed by the outer call */
+   if (processing || !link_active)
+   {
+      return;
+   }
+
+   processing = true;
+
+   while (link_active && input_length - offset >= TUNNEL_HEADER_SIZE)
+   {
+      kind = (char)pgagroal_read_byte(input + offset);
+      flags = (unsigned char)pgagroal_read_byte(input + offset + 1);
+      id = pgagroal_read_int32(input + offset + 2);
+      length = pgagroal_read_int32(input + offset + 6);
+
+      if (length < 0 || length > TUNNEL_MAX_PAYLOAD)
+      {
+         pgagroal_log_error("pgagroal_tunnel: Invalid frame length %d", length);
+         link_close();
+         break;
+      }
+
+      if (input_length - offset - TUNNEL_HEADER_SIZE < (size_t)length)
+      {
+         break;
+      }
+
+      /* The payload is only valid until the first send, as the input can grow */
+      if (link_frame(kind, flags, id, input + offset + TUNNEL_HEADER_SIZE, length))
+      {
+         pgagroal_log_error("pgagroal_tunnel: Invalid frame '%c' for stream %d", kind, id);
+         link_close();
+         break;
+      }
+
+      offset += TUNNEL_HEADER_SIZE + length;
+   }
+
+   if (link_active && offset > 0)
+   {
+      memmove(input, input + offset, input_length - offset);
+      input_length -= offset;
+   }
+
+   processing = false;
+}
+
+static int
+link_frame(char kind, int flags, int32_t id, char* payload, int32_t length)
+{
+   int32_t size;
+   char* data = NULL;
+   char address[MISC_LENGTH];
+   struct tunnel_stream* s = NULL;
+
+   if (!link_hello)
+   {
+      if (kind != TUNNEL_FRAME_HELLO || length != TUNNEL_HELLO_SIZE ||
+          pgagroal_read_int32(payload) != TUNNEL_VERSION)
+      {
+         return 1;
+      }
+
+      compression = pgagroal_read_int32(payload + 4);
+      if (compression != TUNNEL_COMPRESSION_NONE && compression != TUNNEL_COMPRESSION_LZ4 &&
+          compression != TUNNEL_COMPRESSION_ZSTD)
+      {
+         return 1;
+      }
+
+      link_hello = true;
+      return 0;
+   }
+
+   switch (kind)
+   {
+      case TUNNEL_FRAME_OPEN:
+         if (edge || length <= 0 || length >= MISC_LENGTH)
+         {
+            return 1;
+         }
+
+         memset(&address, 0, sizeof(address));
+         memcpy(&address[0], payload, length);
+
+         return stream_accept(id, &address[0]);
+      case TUNNEL_FRAME_DATA:
+         s = stream_find(id);
+         if (s == NULL)
+         {
+            return 1;
+         }
+
+         /* Data still in flight for a stream we closed */
+         if (s->fd == -1)
+         {
+            return 0;
+         }
+
+         data = payload;
+         size = length;
+
+         if (flags & (TUNNEL_FLAG_LZ4 | TUNNEL_FLAG_ZSTD))
+         {
+            if (length < 4)
+            {
+               return 1;
+            }
+
+            size = pgagroal_read_int32(payload);
+            if (size <= 0 || size > TUNNEL_READ_SIZE)
+            {
+               return 1;
+            }
+
+            if ((flags & TUNNEL_FLAG_LZ4) && pgagroal_lz4d_buffer(payload + 4, length - 4, &plain[0], size))
+            {
+               return 1;
+            }
+
+            if ((flags & TUNNEL_FLAG_ZSTD) && pgagroal_zstdd_buffer(payload + 4, length - 4, &plain[0], size))
+            {
+               return 1;
+            }
+
+            data = &plain[0];
+         }
+
+         if (write_all(s->fd, data, (size_t)size, false))
+         {
+            pgagroal_log_debug("pgagroal_tunnel: Stream %d: Write failed", id);
+            stream_end(s);
+         }
+
+         return 0;
+      case TUNNEL_FRAME_CLOSE:
+         s = stream_find(id);
+         if (s == NULL)
+         {
+            return 1;
+         }
+
+         s->received_close = true;
+         stream_end(s);
+
+         return 0;
+      default:
+         break;
+   }
+
+   return 1;
+}
+
+static int
+link_send(char kind, int32_t id, void* data, size_t length, bool compress)
+{
+   int flags = 0;
+   size_t size = 0;
+   size_t payload = length;
+
+   if (compress && length >= TUNNEL_COMPRESS_SIZE && compression != TUNNEL_COMPRESSION_NONE)
+   {
+      /* Only sent compressed when it is smaller, including the original length */
+      if (compression == TUNNEL_COMPRESSION_LZ4 &&
+          !pgagroal_lz4c_buffer(data, length, &frame[TUNNEL_HEADER_SIZE + 4], length - 5, &size))
+      {
+         flags = TUNNEL_FLAG_LZ4;
+      }
+      else if (compression == TUNNEL_COMPRESSION_ZSTD &&
+               !pgagroal_zstdc_buffer(data, length, &frame[TUNNEL_HEADER_SIZE + 4], length - 5, &size))
+      {
+         flags = TUNNEL_FLAG_ZSTD;
+      }
+   }
+
+   if (flags != 0)
+   {
+      pgagroal_write_int32(&frame[TUNNEL_HEADER_SIZE], (int32_t)length);
+      payload = size + 4;
+   }
+   else if (length > 0)
+   {
+      memcpy(&frame[TUNNEL_HEADER_SIZE], data, length);
+   }
+
+   pgagroal_write_byte(&frame[0], kind);
+   pgagroal_write_byte(&frame[1], (signed char)flags);
+   pgagroal_write_int32(&frame[2], id);
+   pgagroal_write_int32(&frame[6], (int32_t)payload);
+
+   return link_write(&frame[0], TUNNEL_HEADER_SIZE + payload);
+}
+
+static int
+link_write(void* data, size_t length)
+{
+   size_t written = 0;
+   size_t produced = 0;
+
+   if (link_tls == NULL)
+   {
+      return write_all(link_fd, data, length, true);
+   }
+
+   while (written < length)
+   {
+      size_t n = 0;
+
+      if (pgagroal_tls_write(link_tls, (char*)data + written, length - written, &n) != PGAGROAL_TLS_OK)
+      {
+         return 1;
+      }
+      written += n;
+   }
+
+   while (pgagroal_tls_pending(link_tls))
+   {
+      if (pgagroal_tls_drain(link_tls, &cipher[0], sizeof(cipher), &produced) != PGAGROAL_TLS_OK)
+      {
+         return 1;
+      }
+
+      if (produced > 0 && write_all(link_fd, &cipher[0], produced, true))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static int
+write_all(int fd, char* data, size_t length, bool link)
+{
+   size_t offset = 0;
+   ssize_t n;
+   int r;
+   struct pollfd pfd;
+
+   while (offset < length)
+   {
+      n = send(fd, data + offset, length - offset, MSG_NOSIGNAL);
+      if (n > 0)
+      {
+         offset += (size_t)n;
+         continue;
+      }
+
+      if (n < 0 && errno == EINTR)
+      {
+         continue;
+      }
+
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         errno = 0;
+
+         /* Both ends of a link may write at the same time, so keep reading it while we wait */
+         pfd.fd = fd;
+         pfd.events = link ? POLLIN | POLLOUT : POLLOUT;
+         pfd.revents = 0;
+
+         r = poll(&pfd, 1, TUNNEL_WRITE_TIMEOUT);
+         if (r < 0 && errno == EINTR)
+         {
+            errno = 0;
+            continue;
+         }
+         else if (r <= 0)
+         {
+            errno = 0;
+            return 1;
+         }
+
+         if (link && (pfd.revents & POLLIN) && link_receive())
+         {
+            return 1;
+         }
+
+         if (pfd.revents & (POLLERR | POLLNVAL))
+         {
+            return 1;
+         }
+
+         continue;
+      }
+
+      errno = 0;
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+input_append(char* data, size_t length)
+{
+   size_t size;
+   char* i = NULL;
+
+   if (input_length + length > input_size)
+   {
+      size = MAX(input_size * 2, MAX(input_length + length, (size_t)TUNNEL_READ_SIZE));
+
+      i = realloc(input, size);
+      if (i == NULL)
+      {
+         pgagroal_log_error("pgagroal_tunnel: Out of memory for %zu bytes", size);
+         return 1;
+      }
+
+      input = i;
+      input_size = size;
+   }
+
+   memcpy(input + input_length, data, length);
+   input_length += length;
+
+   return 0;
+}
+
+static struct tunnel_stream*
+stream_create(int32_t id, int fd)
+{
+   int32_t n;
+   struct tunnel_stream* s = NULL;
+   struct tunnel_stream** ss = NULL;
+
+   if (id < 0 || id >= TUNNEL_MAX_STREAMS)
+   {
+      return NULL;
+   }
+
+   if (id >= number_of_streams)
+   {
+      n = MAX(MAX(number_of_streams * 2, id + 1), 64);
+
+      ss = realloc(streams, n * sizeof(struct tunnel_stream*));
+      if (ss == NULL)
+      {
+         return NULL;
+      }
+
+      for (int32_t i = number_of_streams; i < n; i++)
+      {
+         ss[i] = NULL;
+      }
+
+      streams = ss;
+      number_of_streams = n;
+   }
+
+   s = calloc(1, sizeof(struct tunnel_stream));
+   if (s == NULL)
+   {
+      return NULL;
+   }
+
+   s->id = id;
+   s->fd = fd;
+
+   if (fd != -1)
+   {
+      if (pgagroal_socket_nonblocking(fd))
+      {
+         free(s);
+         return NULL;
+      }
+
+      pgagroal_event_worker_init(&s->io.io, fd, link_fd, stream_cb);
+      s->io.client_fd = fd;
+      s->io.server_fd = link_fd;
+      s->io.slot = -1;
+      pgagroal_io_start(&s->io.io);
+      s->active = true;
+   }
+
+   streams[id] = s;
+
+   return s;
+}
+
+static int
+stream_open(int fd, char* address)
+{
+   int32_t id = 0;
+   struct tunnel_stream* s = NULL;
+
+   while (id < number_of_streams && streams[id] != NULL)
+   {
+      id++;
+   }
+
+   s = stream_create(id, fd);
+   if (s == NULL)
+   {
+      pgagroal_disconnect(fd);
+      return 1;
+   }
+
+   if (link_send(TUNNEL_FRAME_OPEN, id, address, strlen(address) + 1, false))
+   {
+      link_close();
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+stream_accept(int32_t id, char* address)
+{
+   int fd = -1;
+   int sv[2] = {-1, -1};
+   struct tunnel_stream* s = NULL;
+
+   if (id < 0 || id >= TUNNEL_MAX_STREAMS || stream_find(id) != NULL)
+   {
+      return 1;
+   }
+
+   /* The main process serves the client over one end, as if it had accepted it */
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+   {
+      pgagroal_log_error("pgagroal_tunnel: socketpair: %s", strerror(errno));
+      errno = 0;
+      goto refuse;
+   }
+
+   if (pgagroal_connection_get(&fd))
+   {
+      goto refuse;
+   }
+
+   if (pgagroal_connection_id_write(fd, CONNECTION_TUNNEL) ||
+       pgagroal_connection_buffer_write(fd, address, MISC_LENGTH) ||
+       pgagroal_connection_fd_write(fd, -1, sv[1]))
+   {
+      goto refuse;
+   }
+
+   pgagroal_connection_put(fd);
+   fd = -1;
+
+   pgagroal_disconnect(sv[1]);
+   sv[1] = -1;
+
+   s = stream_create(id, sv[0]);
+   if (s == NULL)
+   {
+      pgagroal_disconnect(sv[0]);
+      sv[0] = -1;
+      goto refuse;
+   }
+
+   pgagroal_log_debug("pgagroal_tunnel: Stream %d from %s", id, address);
+
+   return 0;
+
+refuse:
+
+   if (fd != -1)
+   {
+      pgagroal_connection_put(fd);
+   }
+
+   for (int i = 0; i < 2; i++)
+   {
+      if (sv[i] != -1)
+      {
+         pgagroal_disconnect(sv[i]);
+      }
+   }
+
+   /* The edge client is closed, and the identifier is kept until the edge confirms */
+   s = stream_create(id, -1);
+   if (s == NULL)
+   {
+      return 1;
+   }
+
+   stream_end(s);
+
+   return 0;
+}
+
+static struct tunnel_stream*
+stream_find(int32_t id)
+{
+   if (id < 0 || id >= number_of_streams)
+   {
+      return NULL;
+   }
+
+   return streams[id];
+}
+
+static void
+stream_end(struct tunnel_stream* s)
+{
+   if (s->active)
+   {
+      pgagroal_io_stop(&s->io.io);
+      s->active = false;
+   }
+
+   if (s->fd != -1)
+   {
+      pgagroal_disconnect(s->fd);
+      s->fd = -1;
+   }
+
+   if (!s->sent_close)
+   {
+      s->sent_close = true;
+
+      if (link_send(TUNNEL_FRAME_CLOSE, s->id, NULL, 0, false))
+      {
+         link_close();
+         return;
+      }
+   }
+
+   /* The identifier can be used again once both ends are done with it */
+   if (s->received_close)
+   {
+      stream_release(s);
+   }
+}
+
+static void
+stream_release(struct tunnel_stream* s)
+{
+   if (stream_find(s->id) != s)
+   {
+      return;
+   }
+
+   streams[s->id] = NULL;
+
+   s->next = closing;
+   closing = s;
+}
+
+static void
+reclaim_streams(bool all)
+{
+   struct tunnel_stream* s = NULL;
+
+   /* Streams closed before the previous tick can't have queued events anymore */
+   while (reclaim != NULL)
+   {
+      s = reclaim;
+      reclaim = s->next;
+      free(s);
+   }
+
+   reclaim = closing;
+   closing = NULL;
+
+   if (all)
+   {
+      while (reclaim != NULL)
+      {
+         s = reclaim;
+         reclaim = s->next;
+         free(s);
+      }
+   }
+}
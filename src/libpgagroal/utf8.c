@@ -35,6 +35,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static size_t ascii_length(const unsigned char* buf, size_t len);
 
 /**
  * Validates a single UTF-8 sequence (1-4 bytes) according to RFC 3629.
@@ -195,8 +202,20 @@ pgagroal_utf8_valid(const unsigned char* buf, size_t len)
 
    while (i < len)
    {
+      int seq_length;
+
+      /* Skip the run of ASCII bytes a block at a time */
+      if (buf[i] < 0x80)
+      {
+         i += ascii_length(&buf[i], len - i);
+         if (i == len)
+         {
+            break;
+         }
+      }
+
       /* Get expected sequence length */
-      int seq_length = pgagroal_utf8_sequence_length(buf[i]);
+      seq_length = pgagroal_utf8_sequence_length(buf[i]);
 
       if (seq_length < 0)
       {
@@ -280,12 +299,60 @@ pgagroal_utf8_char_length(const unsigned char* buf, size_t len)
 bool
 pgagroal_is_ascii(const char* str, size_t len)
 {
-   for (size_t i = 0; i < len; i++)
+   return ascii_length((const unsigned char*)str, len) == len;
+}
+
+/**
+ * Get the length of the leading run of ASCII bytes, 16 bytes are
+ * checked at a time with SSE2 or AArch64 NEON and 8 bytes at a time otherwise
+ *
+ * @param buf pointer to the byte buffer
+ * @param len length of the buffer in bytes
+ * @return the number of leading ASCII bytes
+ */
+static size_t
+ascii_length(const unsigned char* buf, size_t len)
+{
+   size_t i = 0;
+
+#if defined(__SSE2__)
+   while (i + 16 <= len)
    {
-      if ((unsigned char)str[i] > 127)
+      int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(buf + i)));
+
+      if (mask != 0)
       {
-         return false;
+         return i + __builtin_ctz(mask);
       }
+      i += 16;
    }
-   return true;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+   while (i + 16 <= len)
+   {
+      if (vmaxvq_u8(vld1q_u8(buf + i)) >= 0x80)
+      {
+         break;
+      }
+      i += 16;
+   }
+#else
+   while (i + 8 <= len)
+   {
+      uint64_t word;
+
+      memcpy(&word, buf + i, sizeof(word));
+      if (word & 0x8080808080808080ULL)
+      {
+         break;
+      }
+      i += 8;
+   }
+#endif
+
+   while (i < len && buf[i] < 0x80)
+   {
+      i++;
+   }
+
+   return i;
 }
\ No newline at end of file
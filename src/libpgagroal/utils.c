@@ -29,6 +29,7 @@
 /* pgagroal */
 #include <pgagroal.h>
 #include <logging.h>
+#include <memory.h>
 #include <utils.h>
 #include <server.h>
 
@@ -54,6 +55,13 @@
 #endif
 #include <errno.h>
 #include <inttypes.h>
+#ifdef HAVE_LINUX
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#define NUMA_NODE_MASK_WORDS 16
+#endif
 
 extern char** environ;
 #if defined(HAVE_LINUX) || defined(HAVE_OSX)
@@ -168,7 +176,6 @@ pgagroal_extract_message(char type, struct message* msg, struct message** extrac
 {
    int offset;
    int m_length;
-   void* data = NULL;
    struct message* result = NULL;
 
    offset = 0;
@@ -182,14 +189,16 @@ pgagroal_extract_message(char type, struct message* msg, struct message** extrac
       {
          m_length = pgagroal_read_int32(msg->data + offset + 1);
 
-         result = (struct message*)malloc(sizeof(struct message));
-         data = (void*)malloc(1 + m_length);
+         result = pgagroal_memory_message_alloc(1 + m_length, false);
+         if (result == NULL)
+         {
+            return 1;
+         }
 
-         memcpy(data, msg->data + offset, 1 + m_length);
+         memcpy(result->data, msg->data + offset, 1 + m_length);
 
-         result->kind = pgagroal_read_byte(data);
+         result->kind = pgagroal_read_byte(result->data);
          result->length = 1 + m_length;
-         result->data = data;
 
          *extracted = result;
 
@@ -210,7 +219,6 @@ pgagroal_extract_message_offset(size_t offset, void* data, struct message** extr
 {
    char type;
    int m_length;
-   void* m_data;
    struct message* result = NULL;
 
    *extracted = NULL;
@@ -218,14 +226,16 @@ pgagroal_extract_message_offset(size_t offset, void* data, struct message** extr
    type = (char)pgagroal_read_byte(data + offset);
    m_length = pgagroal_read_int32(data + offset + 1);
 
-   result = (struct message*)malloc(sizeof(struct message));
-   m_data = (void*)malloc(1 + m_length);
+   result = pgagroal_memory_message_alloc(1 + m_length, false);
+   if (result == NULL)
+   {
+      return offset + 1 + m_length;
+   }
 
-   memcpy(m_data, data + offset, 1 + m_length);
+   memcpy(result->data, data + offset, 1 + m_length);
 
    result->kind = type;
    result->length = 1 + m_length;
-   result->data = m_data;
 
    *extracted = result;
 
@@ -807,7 +817,7 @@ pgagroal_set_proc_title(int argc, char** argv, char* s1, char* s2)
 }
 
 void
-pgagroal_set_connection_proc_title(int argc, char** argv, struct connection* connection)
+pgagroal_set_connection_proc_title(int argc, char** argv, struct connection_info* connection)
 {
    struct main_configuration* config;
    int primary;
@@ -1339,6 +1349,35 @@ pgagroal_append_char(char* orig, char c)
    return orig;
 }
 
+int
+pgagroal_buffer_reserve(unsigned char** buffer, size_t* size, size_t needed)
+{
+   size_t s;
+   unsigned char* b = NULL;
+
+   if (needed <= *size)
+   {
+      return 0;
+   }
+
+   s = *size > 0 ? *size : 8192;
+   while (s < needed)
+   {
+      s *= 2;
+   }
+
+   b = (unsigned char*)realloc(*buffer, s);
+   if (b == NULL)
+   {
+      return 1;
+   }
+
+   *buffer = b;
+   *size = s;
+
+   return 0;
+}
+
 char*
 pgagroal_indent(char* str, char* tag, int indent)
 {
@@ -1629,6 +1668,102 @@ error:
    return 1;
 }
 
+int
+pgagroal_numa_bind(int node)
+{
+#if defined(HAVE_LINUX)
+   char path[MAX_PATH];
+   char list[MISC_LENGTH];
+   char* p = NULL;
+   FILE* file = NULL;
+   cpu_set_t cpus;
+   unsigned long mask[NUMA_NODE_MASK_WORDS];
+   int bits = NUMA_NODE_MASK_WORDS * sizeof(unsigned long) * 8;
+
+   if (node < 0 || node >= bits)
+   {
+      goto error;
+   }
+
+   memset(&list, 0, sizeof(list));
+   snprintf(&path[0], sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+   file = fopen(&path[0], "r");
+   if (file == NULL)
+   {
+      pgagroal_log_error("NUMA node %d not found", node);
+      goto error;
+   }
+
+   if (fgets(&list[0], sizeof(list), file) == NULL)
+   {
+      pgagroal_log_error("NUMA node %d: No CPU list", node);
+      goto error;
+   }
+
+   fclose(file);
+   file = NULL;
+
+   /* The list is ranges like 0-7,16-23 */
+   CPU_ZERO(&cpus);
+   p = &list[0];
+   while (isdigit((unsigned char)*p))
+   {
+      int first = (int)strtol(p, &p, 10);
+      int last = first;
+
+      if (*p == '-')
+      {
+         last = (int)strtol(p + 1, &p, 10);
+      }
+
+      for (int i = first; i <= last && i < CPU_SETSIZE; i++)
+      {
+         CPU_SET(i, &cpus);
+      }
+
+      if (*p == ',')
+      {
+         p++;
+      }
+   }
+
+   /* A node without CPUs only provides memory */
+   if (CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpu_set_t), &cpus))
+   {
+      pgagroal_log_warn("NUMA node %d: Unable to set the CPU affinity (%s)", node, strerror(errno));
+      errno = 0;
+   }
+
+   memset(&mask, 0, sizeof(mask));
+   mask[node / (bits / NUMA_NODE_MASK_WORDS)] = 1UL << (node % (bits / NUMA_NODE_MASK_WORDS));
+
+   /* Preferred, so the allocations fall back to the other nodes when the node is full */
+   if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask[0], bits + 1))
+   {
+      pgagroal_log_warn("NUMA node %d: Unable to set the memory policy (%s)", node, strerror(errno));
+      errno = 0;
+   }
+
+   pgagroal_log_debug("NUMA node %d: CPUs %d", node, CPU_COUNT(&cpus));
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+#else
+   pgagroal_log_warn("NUMA binding is only supported on Linux");
+
+   return 1;
+#endif
+}
+
 char*
 pgagroal_remove_all_whitespace(char* orig)
 {
@@ -2181,6 +2316,16 @@ pgagroal_time_format(pgagroal_time_t t, enum pgagroal_time_format_t fmt, char**
    return 0;
 }
 
+long long
+pgagroal_time_elapsed_usec(struct timespec* start)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
 int
 pgagroal_parse_seconds(const char* str, int64_t* out_seconds)
 {
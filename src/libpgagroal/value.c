@@ -67,7 +67,14 @@ int
 pgagroal_value_create(enum value_type type, uintptr_t data, struct value** value)
 {
    struct value* val = NULL;
-   val = (struct value*)malloc(sizeof(struct value));
+   size_t length = 0;
+
+   if ((type == ValueString || type == ValueBASE64) && data != 0)
+   {
+      length = strlen((char*)data) + 1;
+   }
+
+   val = (struct value*)malloc(sizeof(struct value) + length);
    if (val == NULL)
    {
       goto error;
@@ -144,15 +151,14 @@ pgagroal_value_create(enum value_type type, uintptr_t data, struct value** value
    switch (type)
    {
       case ValueString:
-      {
-         val->data = (uintptr_t)pgagroal_append(NULL, (char*)data);
-         val->destroy_data = free_destroy_cb;
-         break;
-      }
       case ValueBASE64:
       {
-         val->data = (uintptr_t)pgagroal_append(NULL, (char*)data);
-         val->destroy_data = free_destroy_cb;
+         if (length > 0)
+         {
+            memcpy(val->inline_data, (char*)data, length);
+            val->data = (uintptr_t)val->inline_data;
+         }
+         val->destroy_data = noop_destroy_cb;
          break;
       }
       case ValueMem:
@@ -216,6 +222,26 @@ pgagroal_value_destroy(struct value* value)
    return 0;
 }
 
+uintptr_t
+pgagroal_value_release(struct value* value)
+{
+   uintptr_t data = 0;
+
+   if (value == NULL)
+   {
+      return 0;
+   }
+
+   data = value->data;
+   if (data != 0 && data == (uintptr_t)value->inline_data)
+   {
+      data = (uintptr_t)pgagroal_append(NULL, value->inline_data);
+   }
+   free(value);
+
+   return data;
+}
+
 uintptr_t
 pgagroal_value_data(struct value* value)
 {
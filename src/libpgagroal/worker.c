@@ -28,16 +28,19 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <activity.h>
 #include <connection.h>
 #include <ev.h>
 #include <logging.h>
 #include <memory.h>
 #include <message.h>
+#include <multiplex.h>
 #include <network.h>
 #include <pipeline.h>
 #include <pool.h>
 #include <prometheus.h>
 #include <security.h>
+#include <shmem.h>
 #include <tracker.h>
 #include <worker.h>
 #include <utils.h>
@@ -52,12 +55,14 @@
 volatile int exit_code = WORKER_FAILURE;
 
 static void signal_callback(void);
+static void publish_callback(void);
 
 void
 pgagroal_worker(int client_fd, char* address, char** argv)
 {
    struct event_loop* loop = NULL;
    struct signal_info signal_watcher;
+   struct periodic_watcher publish_watcher;
    struct worker_io client_io;
    struct worker_io server_io;
    time_t start_time;
@@ -66,6 +71,7 @@ pgagroal_worker(int client_fd, char* address, char** argv)
    struct main_configuration* config;
    struct pipeline p;
    bool tx_pool = false;
+   bool multiplexed = false;
    int32_t slot = -1;
    int transfer_fd = -1;
    SSL* client_ssl = NULL;
@@ -84,6 +90,7 @@ pgagroal_worker(int client_fd, char* address, char** argv)
 
    start_time = time(NULL);
 
+   pgagroal_activity_start(address);
    pgagroal_tracking_event_basic(TRACKER_CLIENT_START, NULL, NULL);
    pgagroal_tracking_event_socket(TRACKER_SOCKET_ASSOCIATE_CLIENT, client_fd);
    pgagroal_set_proc_title(1, argv, "authenticating", NULL);
@@ -99,13 +106,18 @@ pgagroal_worker(int client_fd, char* address, char** argv)
 
       if (config->common.log_connections)
       {
-         pgagroal_log_info("connect: user=%s database=%s address=%s", config->connections[slot].username,
-                           config->connections[slot].database, address);
+         pgagroal_log_info("connect: user=%s database=%s address=%s", pgagroal_connection_info(slot)->username,
+                           pgagroal_connection_info(slot)->database, address);
       }
 
       pgagroal_prometheus_client_wait_sub();
       pgagroal_prometheus_client_active_add();
 
+      pgagroal_activity_client(pgagroal_connection_info(slot)->username, pgagroal_connection_info(slot)->database,
+                               pgagroal_connection_info(slot)->appname);
+      pgagroal_activity_slot(slot);
+      pgagroal_activity_state(ACTIVITY_IDLE, ACTIVITY_WAIT_CLIENT);
+
       pgagroal_pool_status();
 
       // do we have to update the process title?
@@ -114,79 +126,120 @@ pgagroal_worker(int client_fd, char* address, char** argv)
          case UPDATE_PROCESS_TITLE_MINIMAL:
          case UPDATE_PROCESS_TITLE_STRICT:
             // pgagroal_set_proc_title will check the policy
-            pgagroal_set_proc_title(1, argv, config->connections[slot].username, config->connections[slot].database);
+            pgagroal_set_proc_title(1, argv, pgagroal_connection_info(slot)->username, pgagroal_connection_info(slot)->database);
             break;
          case UPDATE_PROCESS_TITLE_VERBOSE:
-            pgagroal_set_connection_proc_title(1, argv, &config->connections[slot]);
+            pgagroal_set_connection_proc_title(1, argv, pgagroal_connection_info(slot));
             break;
       }
 
-      if (config->pipeline == PIPELINE_PERFORMANCE)
-      {
-         p = performance_pipeline();
-      }
-      else if (config->pipeline == PIPELINE_SESSION)
+      if (config->pipeline == PIPELINE_TRANSACTION && client_ssl == NULL &&
+          !pgagroal_multiplex_hand_off(client_fd, slot))
       {
-         p = session_pipeline();
-      }
-      else if (config->pipeline == PIPELINE_TRANSACTION)
-      {
-         p = transaction_pipeline();
-         tx_pool = true;
+         /* A multiplexer serves the client from here on */
+         pgagroal_tracking_event_slot(TRACKER_TX_RETURN_CONNECTION_START, slot);
+         pgagroal_return_connection(slot, server_ssl, true);
+
+         slot = -1;
+         multiplexed = true;
+         exit_code = WORKER_SUCCESS;
       }
       else
       {
-         pgagroal_log_error("pgagroal_worker: Unknown pipeline %d", config->pipeline);
-         p = session_pipeline();
-      }
+         if (config->pipeline == PIPELINE_PERFORMANCE)
+         {
+            p = performance_pipeline();
+         }
+         else if (config->pipeline == PIPELINE_SESSION)
+         {
+            p = session_pipeline();
+         }
+         else if (config->pipeline == PIPELINE_TRANSACTION)
+         {
+            p = transaction_pipeline();
+            tx_pool = true;
+         }
+         else if (config->pipeline == PIPELINE_STATEMENT)
+         {
+            p = statement_pipeline();
+            tx_pool = true;
+         }
+         else
+         {
+            pgagroal_log_error("pgagroal_worker: Unknown pipeline %d", config->pipeline);
+            p = session_pipeline();
+         }
 
-      /* client io_watcher receives from client and sends to server */
-      pgagroal_event_worker_init(&client_io.io, client_fd, config->connections[slot].fd, p.client);
-      client_io.client_fd = client_fd;
-      client_io.server_fd = config->connections[slot].fd;
-      client_io.slot = slot;
-      client_io.client_ssl = client_ssl;
-      client_io.server_ssl = server_ssl;
-      client_io.io.ssl = (client_ssl != NULL);
+         /* client io_watcher receives from client and sends to server */
+         pgagroal_event_worker_init(&client_io.io, client_fd, config->connections[slot].fd, p.client);
+         client_io.client_fd = client_fd;
+         client_io.server_fd = config->connections[slot].fd;
+         client_io.slot = slot;
+         client_io.client_ssl = client_ssl;
+         client_io.server_ssl = server_ssl;
+         client_io.io.ssl = (client_ssl != NULL);
 
-      if (config->pipeline != PIPELINE_TRANSACTION)
-      {
-         /* server io_watcher receives from server and sends to client */
-         pgagroal_event_worker_init(&server_io.io, config->connections[slot].fd, client_fd, p.server);
-         server_io.client_fd = client_fd;
-         server_io.server_fd = config->connections[slot].fd;
-         server_io.slot = slot;
-         server_io.client_ssl = client_ssl;
-         server_io.server_ssl = server_ssl;
-         server_io.io.ssl = (server_ssl != NULL);
-      }
+         if (config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+         {
+            /* server io_watcher receives from server and sends to client */
+            pgagroal_event_worker_init(&server_io.io, config->connections[slot].fd, client_fd, p.server);
+            server_io.client_fd = client_fd;
+            server_io.server_fd = config->connections[slot].fd;
+            server_io.slot = slot;
+            server_io.client_ssl = client_ssl;
+            server_io.server_ssl = server_ssl;
+            server_io.io.ssl = (server_ssl != NULL);
+         }
 
-      loop = pgagroal_event_loop_init();
-      if (!loop)
-      {
-         pgagroal_log_fatal("pgagroal_worker: Failed to create loop");
-         exit(1);
-      }
+         loop = pgagroal_event_loop_init();
+         if (!loop)
+         {
+            pgagroal_log_fatal("pgagroal_worker: Failed to create loop");
+            exit(1);
+         }
 
-      pgagroal_signal_init(&signal_watcher.sig_w, signal_callback, SIGQUIT);
-      signal_watcher.slot = slot;
-      pgagroal_signal_start(&signal_watcher.sig_w);
+         if (config->busy_poll > 0)
+         {
+            pgagroal_socket_busy_poll(client_fd);
+            pgagroal_event_loop_busy_poll(config->busy_poll);
+         }
 
-      p.start(loop, &client_io);
-      started = true;
+         pgagroal_signal_init(&signal_watcher.sig_w, signal_callback, SIGQUIT);
+         signal_watcher.slot = slot;
+         pgagroal_signal_start(&signal_watcher.sig_w);
 
-      pgagroal_io_start(&client_io.io);
-      if (config->pipeline != PIPELINE_TRANSACTION)
-      {
-         pgagroal_io_start(&server_io.io);
-      }
+         /* The per message counters are kept in the process, and published with a bounded staleness */
+         if (config->common.metrics > 0)
+         {
+            pgagroal_periodic_init(&publish_watcher, publish_callback, PROMETHEUS_PUBLISH_INTERVAL, PROMETHEUS_PUBLISH_INTERVAL);
+            pgagroal_periodic_start(&publish_watcher);
+         }
 
-      pgagroal_event_loop_run();
+         p.start(loop, &client_io);
+         started = true;
 
-      if (config->pipeline == PIPELINE_TRANSACTION)
-      {
-         /* The slot may have been updated */
-         slot = client_io.slot;
+         pgagroal_prometheus_local_accounting_start(config->pipeline);
+
+         pgagroal_io_start(&client_io.io);
+         if (config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
+         {
+            pgagroal_io_start(&server_io.io);
+         }
+
+         pgagroal_event_loop_run();
+
+         if (config->common.metrics > 0)
+         {
+            pgagroal_periodic_stop(&publish_watcher);
+         }
+         pgagroal_prometheus_local_publish();
+         pgagroal_prometheus_local_accounting_stop();
+
+         if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
+         {
+            /* The slot may have been updated */
+            slot = client_io.slot;
+         }
       }
 
       pgagroal_prometheus_client_active_sub();
@@ -200,12 +253,12 @@ pgagroal_worker(int client_fd, char* address, char** argv)
       pgagroal_prometheus_client_wait_sub();
    }
 
-   if (config->common.log_disconnections)
+   if (config->common.log_disconnections && !multiplexed)
    {
       if (auth_status == AUTH_SUCCESS)
       {
-         pgagroal_log_info("disconnect: user=%s database=%s address=%s", config->connections[slot].username,
-                           config->connections[slot].database, address);
+         pgagroal_log_info("disconnect: user=%s database=%s address=%s", pgagroal_connection_info(slot)->username,
+                           pgagroal_connection_info(slot)->database, address);
       }
       else
       {
@@ -213,6 +266,9 @@ pgagroal_worker(int client_fd, char* address, char** argv)
       }
    }
 
+   /* The return of the connection and the client done share one transfer connection */
+   pgagroal_connection_batch_begin();
+
    /* Return to pool */
    if (slot != -1)
    {
@@ -227,7 +283,7 @@ pgagroal_worker(int client_fd, char* address, char** argv)
           (exit_code == WORKER_SUCCESS || exit_code == WORKER_CLIENT_FAILURE ||
            (exit_code == WORKER_FAILURE && config->connections[slot].has_security != SECURITY_INVALID)))
       {
-         if (config->pipeline != PIPELINE_TRANSACTION)
+         if (config->pipeline != PIPELINE_TRANSACTION && config->pipeline != PIPELINE_STATEMENT)
          {
             pgagroal_tracking_event_socket(TRACKER_SOCKET_DISASSOCIATE_SERVER, config->connections[slot].fd);
             pgagroal_tracking_event_slot(TRACKER_WORKER_RETURN1, slot);
@@ -276,9 +332,11 @@ pgagroal_worker(int client_fd, char* address, char** argv)
          pgagroal_log_error("pgagroal_workers: Unable to write to a transfer connection");
       }
 
-      pgagroal_disconnect(transfer_fd);
+      pgagroal_connection_put(transfer_fd);
    }
 
+   pgagroal_connection_batch_end();
+
    if (client_ssl != NULL)
    {
       pgagroal_close_ssl(client_ssl);
@@ -301,20 +359,20 @@ pgagroal_worker(int client_fd, char* address, char** argv)
    free(address);
 
    pgagroal_tracking_event_basic(TRACKER_CLIENT_STOP, NULL, NULL);
+   pgagroal_activity_stop();
 
    if (client_io.io.msg)
    {
-      free(client_io.io.msg->data);
-      free(client_io.io.msg);
+      pgagroal_free_message(client_io.io.msg);
       client_io.io.msg = NULL;
    }
    if (server_io.io.msg)
    {
-      free(server_io.io.msg->data);
-      free(server_io.io.msg);
+      pgagroal_free_message(server_io.io.msg);
       server_io.io.msg = NULL;
    }
 
+   pgagroal_prometheus_memory_pool_add();
    pgagroal_memory_destroy();
    pgagroal_stop_logging();
 
@@ -327,3 +385,9 @@ signal_callback(void)
    exit_code = WORKER_SHUTDOWN;
    pgagroal_event_loop_break();
 }
+
+static void
+publish_callback(void)
+{
+   pgagroal_prometheus_local_publish();
+}
@@ -44,6 +44,14 @@
 
 #define ZSTD_DEFAULT_NUMBER_OF_WORKERS 4
 
+static int zstdd_stream(unsigned char* compressed_buffer, size_t compressed_size, char** output_string);
+static ZSTD_DCtx* dctx_acquire(void);
+static void dctx_release(ZSTD_DCtx* dctx);
+
+/* One context of each kind is kept between messages, as they are costly to set up */
+static _Thread_local ZSTD_CCtx* cctx_cache = NULL;
+static _Thread_local ZSTD_DCtx* dctx_cache = NULL;
+
 int
 pgagroal_zstdc_string(char* s, unsigned char** buffer, size_t* buffer_size)
 {
@@ -79,6 +87,7 @@ pgagroal_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size,
 {
    size_t decompressed_size;
    size_t result;
+   ZSTD_DCtx* dctx = NULL;
 
    decompressed_size = ZSTD_getFrameContentSize(compressed_buffer, compressed_size);
 
@@ -89,8 +98,8 @@ pgagroal_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size,
    }
    if (decompressed_size == ZSTD_CONTENTSIZE_UNKNOWN)
    {
-      pgagroal_log_error("ZSTD: Unknown decompressed size");
-      return 1;
+      /* Streamed frames don't carry their size */
+      return zstdd_stream(compressed_buffer, compressed_size, output_string);
    }
 
    *output_string = (char*)malloc(decompressed_size + 1);
@@ -100,7 +109,16 @@ pgagroal_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size,
       return 1;
    }
 
-   result = ZSTD_decompress(*output_string, decompressed_size, compressed_buffer, compressed_size);
+   dctx = dctx_acquire();
+   if (dctx == NULL)
+   {
+      pgagroal_log_error("ZSTD: Could not create decompression context");
+      free(*output_string);
+      return 1;
+   }
+
+   result = ZSTD_decompressDCtx(dctx, *output_string, decompressed_size, compressed_buffer, compressed_size);
+   dctx_release(dctx);
    if (ZSTD_isError(result))
    {
       pgagroal_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(result));
@@ -112,3 +130,228 @@ pgagroal_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size,
 
    return 0;
 }
+
+int
+pgagroal_zstdc_buffer(void* source, size_t source_size, void* destination, size_t capacity, size_t* size)
+{
+   size_t compressed_size;
+
+   *size = 0;
+
+   if (cctx_cache == NULL)
+   {
+      cctx_cache = ZSTD_createCCtx();
+      if (cctx_cache == NULL)
+      {
+         pgagroal_log_error("ZSTD: Could not create compression context");
+         return 1;
+      }
+   }
+
+   /* Data that doesn't fit is sent as it is, so that isn't an error to log */
+   compressed_size = ZSTD_compressCCtx(cctx_cache, destination, capacity, source, source_size, 1);
+   if (ZSTD_isError(compressed_size))
+   {
+      return 1;
+   }
+
+   *size = compressed_size;
+
+   return 0;
+}
+
+int
+pgagroal_zstdd_buffer(void* source, size_t source_size, void* destination, size_t size)
+{
+   size_t result;
+   ZSTD_DCtx* dctx = NULL;
+
+   dctx = dctx_acquire();
+   if (dctx == NULL)
+   {
+      pgagroal_log_error("ZSTD: Could not create decompression context");
+      return 1;
+   }
+
+   result = ZSTD_decompressDCtx(dctx, destination, size, source, source_size);
+   dctx_release(dctx);
+   if (ZSTD_isError(result) || result != size)
+   {
+      pgagroal_log_error("ZSTD: Decompress failed");
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgagroal_zstd_stream_create(void** stream)
+{
+   ZSTD_CCtx* cctx = NULL;
+
+   *stream = NULL;
+
+   if (cctx_cache != NULL)
+   {
+      /* The compression level survives the reset in destroy */
+      *stream = cctx_cache;
+      cctx_cache = NULL;
+      return 0;
+   }
+
+   cctx = ZSTD_createCCtx();
+   if (cctx == NULL)
+   {
+      pgagroal_log_error("ZSTD: Could not create compression context");
+      return 1;
+   }
+
+   if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 1)))
+   {
+      ZSTD_freeCCtx(cctx);
+      pgagroal_log_error("ZSTD: Could not set the compression level");
+      return 1;
+   }
+
+   *stream = cctx;
+
+   return 0;
+}
+
+int
+pgagroal_zstd_stream_compress(void* stream, char* data, size_t length, bool last, unsigned char** buffer, size_t* buffer_size, size_t* buffer_length)
+{
+   size_t remaining;
+   ZSTD_inBuffer in = {data, length, 0};
+   ZSTD_outBuffer out;
+
+   do
+   {
+      if (pgagroal_buffer_reserve(buffer, buffer_size, *buffer_length + ZSTD_CStreamOutSize()))
+      {
+         pgagroal_log_error("ZSTD: Allocation error");
+         return 1;
+      }
+
+      out.dst = *buffer;
+      out.size = *buffer_size;
+      out.pos = *buffer_length;
+
+      remaining = ZSTD_compressStream2((ZSTD_CCtx*)stream, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining))
+      {
+         pgagroal_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(remaining));
+         return 1;
+      }
+
+      *buffer_length = out.pos;
+   }
+   while (in.pos < in.size || (last && remaining != 0));
+
+   return 0;
+}
+
+void
+pgagroal_zstd_stream_destroy(void* stream)
+{
+   if (stream != NULL)
+   {
+      if (cctx_cache == NULL && !ZSTD_isError(ZSTD_CCtx_reset((ZSTD_CCtx*)stream, ZSTD_reset_session_only)))
+      {
+         cctx_cache = (ZSTD_CCtx*)stream;
+         return;
+      }
+
+      ZSTD_freeCCtx((ZSTD_CCtx*)stream);
+   }
+}
+
+static int
+zstdd_stream(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
+{
+   size_t result = 1;
+   unsigned char* buffer = NULL;
+   size_t buffer_size = 0;
+   ZSTD_DCtx* dctx = NULL;
+   ZSTD_inBuffer in = {compressed_buffer, compressed_size, 0};
+   ZSTD_outBuffer out = {NULL, 0, 0};
+
+   *output_string = NULL;
+
+   dctx = dctx_acquire();
+   if (dctx == NULL)
+   {
+      pgagroal_log_error("ZSTD: Could not create decompression context");
+      goto error;
+   }
+
+   while (result != 0)
+   {
+      if (pgagroal_buffer_reserve(&buffer, &buffer_size, out.pos + ZSTD_DStreamOutSize() + 1))
+      {
+         pgagroal_log_error("ZSTD: Allocation failed");
+         goto error;
+      }
+
+      out.dst = buffer;
+      out.size = buffer_size - 1;
+
+      result = ZSTD_decompressStream(dctx, &out, &in);
+      if (ZSTD_isError(result))
+      {
+         pgagroal_log_error("ZSTD: Decompression error: %s", ZSTD_getErrorName(result));
+         goto error;
+      }
+
+      if (result != 0 && in.pos == in.size && out.pos < out.size)
+      {
+         pgagroal_log_error("ZSTD: Truncated compressed buffer");
+         goto error;
+      }
+   }
+
+   buffer[out.pos] = '\0';
+   *output_string = (char*)buffer;
+
+   dctx_release(dctx);
+
+   return 0;
+
+error:
+
+   dctx_release(dctx);
+   free(buffer);
+
+   return 1;
+}
+
+static ZSTD_DCtx*
+dctx_acquire(void)
+{
+   ZSTD_DCtx* dctx = dctx_cache;
+
+   if (dctx != NULL)
+   {
+      dctx_cache = NULL;
+      return dctx;
+   }
+
+   return ZSTD_createDCtx();
+}
+
+static void
+dctx_release(ZSTD_DCtx* dctx)
+{
+   if (dctx == NULL)
+   {
+      return;
+   }
+
+   if (dctx_cache == NULL && !ZSTD_isError(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only)))
+   {
+      dctx_cache = dctx;
+      return;
+   }
+
+   ZSTD_freeDCtx(dctx);
+}
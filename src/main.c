@@ -28,6 +28,8 @@
 
 /* pgagroal */
 #include <pgagroal.h>
+#include <activity.h>
+#include <cluster.h>
 #include <configuration.h>
 #include <connection.h>
 #include <console.h>
@@ -37,16 +39,22 @@
 #include <health.h>
 #include <management.h>
 #include <memory.h>
+#include <multiplex.h>
+#include <notify.h>
 #include <network.h>
 #include <pipeline.h>
 #include <pool.h>
 #include <prometheus.h>
+#include <query_cache.h>
 #include <remote.h>
 #include <security.h>
 #include <server.h>
 #include <shmem.h>
+#include <slowlog.h>
 #include <status.h>
 #include <tls.h>
+#include <tracker.h>
+#include <tunnel.h>
 #include <utils.h>
 #include <worker.h>
 
@@ -58,6 +66,7 @@
 #include <getopt.h>
 #include <netinet/in.h>
 #include <openssl/crypto.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -67,6 +76,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -80,9 +90,11 @@
 static void accept_main_cb(struct io_watcher* watcher);
 static void accept_mgt_cb(struct io_watcher* watcher);
 static void accept_transfer_cb(struct io_watcher* watcher);
+static bool transfer_pending(int client_fd);
 static void accept_metrics_cb(struct io_watcher* watcher);
 static void accept_console_cb(struct io_watcher* watcher);
 static void accept_management_cb(struct io_watcher* watcher);
+static void accept_tunnel_cb(struct io_watcher* watcher);
 static void shutdown_cb(void);
 static void reload_cb(void);
 static void service_reload_cb(void);
@@ -90,26 +102,71 @@ static void graceful_cb(void);
 static void coredump_cb(void);
 static void sigchld_cb(void);
 static void idle_timeout_cb(void);
+static void adaptive_pool_cb(void);
 static void max_connection_age_cb(void);
 static void rotate_frontend_password_cb(void);
+static void rotate_tls_ticket_keys_cb(void);
 static void validation_cb(void);
 static void disconnect_client_cb(void);
 static void shutdown_timeout_cb(void);
 static void flush_alarm_cb(void);
+static void cluster_cb(void);
 static void arm_flush_timeout(int64_t seconds, const char* database);
 static void rearm_flush_alarm(void);
 static void frontend_user_password_startup(struct main_configuration* config);
 static bool accept_fatal(int error);
 static void add_client(pid_t pid);
 static void remove_client(pid_t pid);
+static void clean_clients(int index);
 static void refresh_periodic_watchers(void);
 static void start_periodic_watcher(struct periodic_watcher* watcher, bool* started, periodic_cb cb, int64_t timeout_ms, int64_t repeat_ms);
 static void stop_periodic_watcher(struct periodic_watcher* watcher, bool* started);
 static bool reload_configuration(bool* restart);
 static void reload_set_configuration(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
-static void create_pidfile_or_exit(void);
+static void create_pidfile_or_exit(bool takeover);
 static void remove_pidfile(void);
 static void shutdown_ports(bool remove);
+static void client_keepalive(void);
+static void start_prefork(void);
+static void shutdown_prefork(void);
+static int prefork_spawn(int index);
+static bool prefork_dispatch(int client_fd);
+static void prefork_remove(pid_t pid);
+static void prefork_refill(void);
+static void prefork_cb(void);
+static void prefork_run(int fd) __attribute__((noreturn));
+static void start_cancel(void);
+static void shutdown_cancel(void);
+static bool cancel_dispatch(int client_fd);
+static void cancel_run(int fd) __attribute__((noreturn));
+static void start_startup_gate(void);
+static void shutdown_startup_gate(void);
+static bool startup_gate_add(int client_fd, char* address);
+static void startup_gate_cb(struct io_watcher* watcher);
+static void startup_gate_timeout_cb(void);
+static void dispatch_client(int client_fd, char* address);
+static void start_multiplex(int index);
+static void start_notify(void);
+static void start_console_cache(void);
+static void start_tunnel_link(int index);
+static void start_tunnel(void);
+static void shutdown_tunnel(void);
+static void start_acceptor(int index);
+static void acceptor_run(int index) __attribute__((noreturn));
+static void accept_acceptor_cb(struct io_watcher* watcher);
+static void acceptor_shutdown_cb(void);
+static int send_fd(pid_t pid, int32_t id, int32_t slot);
+static int send_slot_fd(pid_t pid, int32_t id, int32_t slot, int fd);
+static int forget_fd(int slot);
+static int reserve_fd(int slot, int fd);
+static void hand_over(int client_fd);
+static void shutdown_hand_over(void);
+static void hand_over_drained(void);
+static int number_of_clients(void);
+static int hand_over_sockets(int client_fd, int* fds, int length);
+static int take_over(bool* has_unix_socket, bool* has_main_sockets);
+static int take_over_sockets(int client_fd, int port, int** fds, int* length);
+static bool socket_has_port(int fd, int port);
 
 static char** argv_ptr;
 static int main_argc;
@@ -132,25 +189,50 @@ static int console_fds_length = -1;
 static struct accept_io io_management[MAX_FDS];
 static int* management_fds = NULL;
 static int management_fds_length = -1;
+static struct accept_io io_tunnel[MAX_FDS];
+static int* tunnel_fds = NULL;
+static int tunnel_fds_length = -1;
+
+static struct json_writer status_writer = {0};
 static struct pipeline main_pipeline;
 static int known_fds[MAX_NUMBER_OF_CONNECTIONS];
-static struct client* clients = NULL;
+static int reserved_fds = -1;
+static uint64_t known_fds_generation = 0;
+static pid_t acceptor_pids[NUMBER_OF_ACCEPTORS];
+static bool acceptor = false;
+static struct prefork* preforks = NULL;
+static pid_t cancel_pid = 0;
+static int cancel_fd = -1;
+static struct startup_client* startup_clients = NULL;
+static int number_of_startup_clients = 0;
 static struct accept_io io_transfer;
+static struct accept_io io_hand_over;
+static int unix_hand_over_socket = -1;
 static struct periodic_watcher idle_timeout_watcher;
+static struct periodic_watcher adaptive_pool_watcher;
 static struct periodic_watcher max_connection_age_watcher;
 static struct periodic_watcher validation_watcher;
 static struct periodic_watcher disconnect_client_watcher;
 static struct periodic_watcher rotate_frontend_password_watcher;
+static struct periodic_watcher rotate_tls_ticket_keys_watcher;
 static struct periodic_watcher shutdown_timeout_watcher;
 static struct periodic_watcher flush_alarm;
+static struct periodic_watcher startup_gate_watcher;
+static struct periodic_watcher cluster_watcher;
+static struct periodic_watcher prefork_watcher;
 static struct flush_timeout_slot flush_timeouts[NUMBER_OF_LIMITS];
 static bool idle_timeout_started = false;
+static bool adaptive_pool_started = false;
 static bool max_connection_age_started = false;
 static bool validation_started = false;
 static bool disconnect_client_started = false;
 static bool rotate_frontend_password_started = false;
+static bool rotate_tls_ticket_keys_started = false;
 static bool shutdown_timeout_started = false;
 static bool flush_alarm_started = false;
+static bool cluster_started = false;
+static bool startup_gate_started = false;
+static bool prefork_started = false;
 
 static void
 start_mgt(void)
@@ -263,1384 +345,3412 @@ shutdown_io(void)
 }
 
 static void
-start_metrics(void)
+start_prefork(void)
 {
-   for (int i = 0; i < metrics_fds_length; i++)
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->prefork_workers <= 0)
    {
-      int sockfd = *(metrics_fds + i);
+      return;
+   }
 
-      memset(&io_metrics[i], 0, sizeof(struct accept_io));
-      pgagroal_event_accept_init(&io_metrics[i].watcher, sockfd, accept_metrics_cb);
-      io_metrics[i].socket = sockfd;
-      io_metrics[i].argv = argv_ptr;
-      pgagroal_io_start(&io_metrics[i].watcher);
+   if (preforks == NULL)
+   {
+      preforks = (struct prefork*)calloc(config->prefork_workers, sizeof(struct prefork));
+      if (preforks == NULL)
+      {
+         pgagroal_log_error("pgagroal: Unable to allocate pre-forked workers");
+         return;
+      }
+
+      for (int i = 0; i < config->prefork_workers; i++)
+      {
+         preforks[i].fd = -1;
+      }
    }
-}
 
-static void
-shutdown_metrics(void)
-{
-   for (int i = 0; i < metrics_fds_length; i++)
+   for (int i = 0; i < config->prefork_workers; i++)
    {
-      pgagroal_disconnect(io_metrics[i].socket);
-      errno = 0;
+      if (preforks[i].pid == 0)
+      {
+         prefork_spawn(i);
+      }
    }
 }
 
 static void
-start_management(void)
+shutdown_prefork(void)
 {
-   for (int i = 0; i < management_fds_length; i++)
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   stop_periodic_watcher(&prefork_watcher, &prefork_started);
+
+   if (preforks == NULL)
    {
-      int sockfd = *(management_fds + i);
+      return;
+   }
 
-      memset(&io_management[i], 0, sizeof(struct accept_io));
-      pgagroal_event_accept_init(&io_management[i].watcher, sockfd, accept_management_cb);
-      io_management[i].socket = sockfd;
-      io_management[i].argv = argv_ptr;
-      pgagroal_io_start(&io_management[i].watcher);
+   /* Idle workers see end-of-file on their hand-off socket and exit */
+   for (int i = 0; i < config->prefork_workers; i++)
+   {
+      if (preforks[i].fd != -1)
+      {
+         pgagroal_disconnect(preforks[i].fd);
+      }
+      preforks[i].pid = 0;
+      preforks[i].fd = -1;
    }
+
+   free(preforks);
+   preforks = NULL;
 }
 
-static void
-shutdown_management(bool remove __attribute__((unused)))
+static int
+prefork_spawn(int index)
 {
-   for (int i = 0; i < management_fds_length; i++)
+   int sv[2];
+   pid_t pid;
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
    {
-      pgagroal_disconnect(io_management[i].socket);
+      pgagroal_log_error("pgagroal: Pre-fork socketpair: %s", strerror(errno));
       errno = 0;
+      goto error;
    }
-}
 
-static void
-start_console(void)
-{
-   for (int i = 0; i < console_fds_length; i++)
+   pid = fork();
+   if (pid == -1)
    {
-      int sockfd = *(console_fds + i);
+      pgagroal_log_error("pgagroal: Pre-fork: Cannot create process");
+      pgagroal_disconnect(sv[0]);
+      pgagroal_disconnect(sv[1]);
+      goto error;
+   }
+   else if (pid == 0)
+   {
+      pgagroal_disconnect(sv[0]);
 
-      memset(&io_console[i], 0, sizeof(struct accept_io));
-      pgagroal_event_accept_init(&io_console[i].watcher, sockfd, accept_console_cb);
-      io_console[i].socket = sockfd;
-      io_console[i].argv = argv_ptr;
-      pgagroal_io_start(&io_console[i].watcher);
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
+      {
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
+      }
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      prefork_run(sv[1]);
    }
+
+   pgagroal_disconnect(sv[1]);
+
+   preforks[index].pid = pid;
+   preforks[index].fd = sv[0];
+   preforks[index].generation = known_fds_generation;
+
+   pgagroal_log_debug("pgagroal: Pre-forked worker %d (PID %d)", index, (int)pid);
+
+   return 0;
+
+error:
+
+   return 1;
 }
 
-static void
-shutdown_console(void)
+static bool
+prefork_dispatch(int client_fd)
 {
-   for (int i = 0; i < console_fds_length; i++)
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (preforks == NULL)
    {
-      pgagroal_disconnect(io_console[i].socket);
-      errno = 0;
+      return false;
+   }
+
+   for (int i = 0; i < config->prefork_workers; i++)
+   {
+      struct pollfd pfd;
+      pid_t pid = preforks[i].pid;
+
+      if (pid == 0)
+      {
+         continue;
+      }
+
+      /* An idle worker never writes, so any event means it went away. A worker
+       * forked before the server descriptors changed doesn't hold them */
+      pfd.fd = preforks[i].fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      if (preforks[i].generation == known_fds_generation &&
+          poll(&pfd, 1, 0) == 0 &&
+          !pgagroal_connection_fd_write(preforks[i].fd, -1, client_fd))
+      {
+         add_client(pid);
+
+         pgagroal_disconnect(preforks[i].fd);
+         preforks[i].pid = 0;
+         preforks[i].fd = -1;
+
+         prefork_refill();
+
+         return true;
+      }
+
+      pgagroal_log_debug("pgagroal: Pre-forked worker %d (PID %d) unavailable", i, (int)pid);
+
+      pgagroal_disconnect(preforks[i].fd);
+      preforks[i].pid = 0;
+      preforks[i].fd = -1;
+
+      prefork_refill();
    }
+
+   return false;
 }
 
 static void
-version(void)
+prefork_remove(pid_t pid)
 {
-   printf("pgagroal %s\n", PGAGROAL_VERSION);
-   exit(1);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (preforks == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < config->prefork_workers; i++)
+   {
+      if (preforks[i].pid == pid)
+      {
+         pgagroal_disconnect(preforks[i].fd);
+         preforks[i].pid = 0;
+         preforks[i].fd = -1;
+
+         prefork_refill();
+         return;
+      }
+   }
 }
 
+/**
+ * Replace the pre-forked workers that are gone from the event loop, so the
+ * fork isn't done while a client is being accepted
+ */
 static void
-usage(void)
+prefork_refill(void)
 {
-   printf("pgagroal %s\n", PGAGROAL_VERSION);
-   printf("  High-performance connection pool for PostgreSQL\n");
-   printf("\n");
+   struct main_configuration* config;
 
-   printf("Usage:\n");
-   printf("  pgagroal [ -c CONFIG_FILE ] [ -a HBA_FILE ] [ -d ]\n");
-   printf("\n");
-   printf("Options:\n");
-   printf("  -c, --config CONFIG_FILE           Set the path to the pgagroal.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_CONF_FILE);
-   printf("  -a, --hba HBA_FILE                 Set the path to the pgagroal_hba.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_HBA_FILE);
-   printf("  -l, --limit LIMIT_FILE             Set the path to the pgagroal_databases.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_LIMIT_FILE);
-   printf("  -u, --users USERS_FILE             Set the path to the pgagroal_users.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_USERS_FILE);
-   printf("  -F, --frontend FRONTEND_USERS_FILE Set the path to the pgagroal_frontend_users.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_FRONTEND_USERS_FILE);
-   printf("  -A, --admins ADMINS_FILE           Set the path to the pgagroal_admins.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_ADMINS_FILE);
-   printf("  -S, --superuser SUPERUSER_FILE     Set the path to the pgagroal_superuser.conf file\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_SUPERUSER_FILE);
-   printf("  -D, --directory DIRECTORY_PATH     Set the directory path to load configuration files\n");
-   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_CONFIGURATION_PATH);
-   printf("                                     Can also be set via PGAGROAL_CONFIG_DIR environment variable\n");
-   printf("  -d, --daemon                       Run as a daemon\n");
-   printf("  -V, --version                      Display version information\n");
-   printf("  -?, --help                         Display help\n");
-   printf("\n");
-   printf("pgagroal: %s\n", PGAGROAL_HOMEPAGE);
-   printf("Report bugs: %s\n", PGAGROAL_ISSUES);
+   config = (struct main_configuration*)shmem;
+
+   if (config->keep_running && !prefork_started)
+   {
+      start_periodic_watcher(&prefork_watcher, &prefork_started, prefork_cb, 1, 0);
+   }
 }
 
-int
-main(int argc, char** argv)
+static void
+prefork_cb(void)
 {
-   main_argc = argc;
-   main_argv = argv;
-   char* configuration_path = NULL;
-   char* hba_path = NULL;
-   char* limit_path = NULL;
-   char* users_path = NULL;
-   char* frontend_users_path = NULL;
-   char* admins_path = NULL;
-   char* superuser_path = NULL;
-   char* directory_path = NULL;
-   bool daemon = false;
-   pid_t pid, sid;
-   char config_path_buffer[MAX_PATH];
-   char hba_path_buffer[MAX_PATH];
-   char limit_path_buffer[MAX_PATH];
-   char users_path_buffer[MAX_PATH];
-   char frontend_users_path_buffer[MAX_PATH];
-   char admins_path_buffer[MAX_PATH];
-   char superuser_path_buffer[MAX_PATH];
-#ifdef HAVE_SYSTEMD
-   int sds;
-#endif
-   bool has_unix_socket = false;
-   bool has_main_sockets = false;
-   void* tmp_shmem = NULL;
-   struct signal_info signal_watcher[SIGNALS_NUMBER];
-   struct rlimit flimit;
-   size_t shmem_size;
-   size_t pipeline_shmem_size = 0;
-   size_t prometheus_shmem_size = 0;
-   size_t prometheus_cache_shmem_size = 0;
-   size_t tmp_size;
-   struct main_configuration* config = NULL;
-   int ret;
-   int c;
-   char* os = NULL;
+   struct main_configuration* config;
 
-   int kernel_major, kernel_minor, kernel_patch;
-   bool conf_file_mandatory;
-   char message[MISC_LENGTH]; // a generic message used for errors
-   argv_ptr = argv;
+   config = (struct main_configuration*)shmem;
 
-   struct stat path_stat = {0};
-   char* adjusted_dir_path = NULL;
+   stop_periodic_watcher(&prefork_watcher, &prefork_started);
 
-   while (1)
+   if (!config->keep_running || preforks == NULL)
    {
-      // clang-format off
-      static struct option long_options[] =
-      {
-         {"config", required_argument, 0, 'c'},
-         {"hba", required_argument, 0, 'a'},
-         {"limit", required_argument, 0, 'l'},
-         {"users", required_argument, 0, 'u'},
-         {"frontend", required_argument, 0, 'F'},
-         {"admins", required_argument, 0, 'A'},
-         {"superuser", required_argument, 0, 'S'},
-         {"directory", required_argument, 0, 'D'},
-         {"daemon", no_argument, 0, 'd'},
-         {"version", no_argument, 0, 'V'},
-         {"help", no_argument, 0, '?'}
-      };
-      // clang-format on
-      int option_index = 0;
+      return;
+   }
 
-      c = getopt_long(argc, argv, "dV?a:c:l:u:F:A:S:D:",
-                      long_options, &option_index);
+   start_prefork();
 
-      if (c == -1)
+   /* A worker that couldn't be forked is tried again later */
+   for (int i = 0; i < config->prefork_workers; i++)
+   {
+      if (preforks[i].pid == 0)
       {
-         break;
+         start_periodic_watcher(&prefork_watcher, &prefork_started, prefork_cb, 1000, 0);
+         return;
       }
+   }
+}
 
-      switch (c)
-      {
-         case 'a':
-            hba_path = optarg;
-            break;
-         case 'c':
-            configuration_path = optarg;
-            break;
-         case 'l':
-            limit_path = optarg;
-            break;
-         case 'u':
-            users_path = optarg;
-            break;
-         case 'F':
-            frontend_users_path = optarg;
-            break;
-         case 'A':
-            admins_path = optarg;
-            break;
-         case 'S':
-            superuser_path = optarg;
-            break;
-         case 'D':
-            directory_path = optarg;
-            break;
-         case 'd':
-            daemon = true;
-            break;
-         case 'V':
-            version();
-            break;
-         case '?':
-            usage();
-            exit(1);
-            break;
-         default:
-            break;
-      }
-   }
+static void
+prefork_run(int fd)
+{
+   struct sockaddr_in6 client_addr;
+   socklen_t client_addr_length;
+   char address[INET6_ADDRSTRLEN];
+   char* addr = NULL;
+   int32_t slot = -1;
+   int client_fd = -1;
 
-   if (getuid() == 0)
+   pgagroal_set_proc_title(1, argv_ptr, "idle", NULL);
+
+   /* Block until the main process hands over an accepted client */
+   if (pgagroal_connection_transfer_read(fd, &slot, &client_fd) || client_fd == -1)
    {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Using the root account is not allowed");
-#endif
-      errx(1, "Using the root account is not allowed");
+      exit(0);
    }
 
-   shmem_size = sizeof(struct main_configuration);
-   if (pgagroal_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   pgagroal_disconnect(fd);
+
+   memset(&address, 0, sizeof(address));
+   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
+   client_addr_length = sizeof(struct sockaddr_in6);
+   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
+
+   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
+
+   addr = calloc(1, strlen(address) + 1);
+   if (addr == NULL)
    {
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Error in creating shared memory");
-#endif
-      errx(1, "Error in creating shared memory");
+      pgagroal_log_fatal("Cannot allocate memory for client address");
+      exit(1);
    }
+   memcpy(addr, address, strlen(address));
 
-   pgagroal_init_configuration(shmem);
-   config = (struct main_configuration*)shmem;
+   pgagroal_worker(client_fd, addr, argv_ptr);
+   exit(0);
+}
 
-   memset(&known_fds, 0, sizeof(known_fds));
-   memset(message, 0, MISC_LENGTH);
+static void
+start_cancel(void)
+{
+   int sv[2];
+   pid_t pid;
 
-   if (directory_path == NULL)
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
    {
-      // Check for environment variable if no -D flag provided
-      directory_path = getenv("PGAGROAL_CONFIG_DIR");
-      if (directory_path != NULL)
-      {
-         pgagroal_log_info("Configuration directory set via PGAGROAL_CONFIG_DIR environment variable: %s", directory_path);
-      }
+      pgagroal_log_error("pgagroal: Cancel socketpair: %s", strerror(errno));
+      errno = 0;
+      return;
    }
 
-   if (directory_path != NULL)
+   pid = fork();
+   if (pid == -1)
    {
-      if (!strcmp(directory_path, PGAGROAL_DEFAULT_CONFIGURATION_PATH))
-      {
-         pgagroal_log_warn("Using the default configuration directory %s, -D can be omitted.", directory_path);
-      }
+      pgagroal_log_error("pgagroal: Cancel: Cannot create process");
+      pgagroal_disconnect(sv[0]);
+      pgagroal_disconnect(sv[1]);
+      return;
+   }
+   else if (pid == 0)
+   {
+      pgagroal_disconnect(sv[0]);
 
-      if (access(directory_path, F_OK) != 0)
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
       {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Configuration directory not found: %s", directory_path);
-#endif
-         pgagroal_log_error("Configuration directory not found: %s", directory_path);
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
          exit(1);
       }
 
-      if (stat(directory_path, &path_stat) == 0)
-      {
-         if (!S_ISDIR(path_stat.st_mode))
-         {
-#ifdef HAVE_SYSTEMD
-            sd_notifyf(0, "STATUS=Path is not a directory: %s", directory_path);
-#endif
-            pgagroal_log_error("Path is not a directory: %s", directory_path);
-            exit(1);
-         }
-      }
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
 
-      if (access(directory_path, R_OK | X_OK) != 0)
-      {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Insufficient permissions for directory: %s", directory_path);
-#endif
-         pgagroal_log_error("Insufficient permissions for directory: %s", directory_path);
-         exit(1);
-      }
+      cancel_run(sv[1]);
+   }
 
-      if (directory_path[strlen(directory_path) - 1] != '/')
-      {
-         adjusted_dir_path = pgagroal_append(strdup(directory_path), "/");
-      }
-      else
-      {
-         adjusted_dir_path = strdup(directory_path);
-      }
+   pgagroal_disconnect(sv[1]);
 
-      if (adjusted_dir_path == NULL)
-      {
-         pgagroal_log_error("Memory allocation failed while copying directory path.");
-         exit(1);
-      }
+   cancel_pid = pid;
+   cancel_fd = sv[0];
 
-      if (!configuration_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal.conf", PGAGROAL_DEFAULT_CONF_FILE, config_path_buffer, sizeof(config_path_buffer)) == 0 && strlen(config_path_buffer) > 0)
-      {
-         configuration_path = config_path_buffer;
-      }
+   pgagroal_log_debug("pgagroal: Cancel handler (PID %d)", (int)pid);
+}
 
-      if (!hba_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_hba.conf", PGAGROAL_DEFAULT_HBA_FILE, hba_path_buffer, sizeof(hba_path_buffer)) == 0 && strlen(hba_path_buffer) > 0)
-      {
-         hba_path = hba_path_buffer;
-      }
+static void
+shutdown_cancel(void)
+{
+   /* The handler sees end-of-file on its hand-off socket and exits */
+   if (cancel_fd != -1)
+   {
+      pgagroal_disconnect(cancel_fd);
+   }
+   cancel_pid = 0;
+   cancel_fd = -1;
+}
 
-      if (!limit_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_databases.conf", PGAGROAL_DEFAULT_LIMIT_FILE, limit_path_buffer, sizeof(limit_path_buffer)) == 0 && strlen(limit_path_buffer) > 0)
-      {
-         limit_path = limit_path_buffer;
-      }
+static bool
+cancel_dispatch(int client_fd)
+{
+   char request[16];
+   struct pollfd pfd;
 
-      if (!users_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_users.conf", PGAGROAL_DEFAULT_USERS_FILE, users_path_buffer, sizeof(users_path_buffer)) == 0 && strlen(users_path_buffer) > 0)
-      {
-         users_path = users_path_buffer;
-      }
+   if (cancel_fd == -1)
+   {
+      return false;
+   }
 
-      if (!frontend_users_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_frontend_users.conf", PGAGROAL_DEFAULT_FRONTEND_USERS_FILE, frontend_users_path_buffer, sizeof(frontend_users_path_buffer)) == 0 && strlen(frontend_users_path_buffer) > 0)
-      {
-         frontend_users_path = frontend_users_path_buffer;
-      }
+   /* Only a cancel request that has fully arrived is taken, anything else goes to a worker */
+   if (recv(client_fd, &request[0], sizeof(request), MSG_PEEK | MSG_DONTWAIT) != (ssize_t)sizeof(request) ||
+       pgagroal_read_int32(&request[0]) != 16 || pgagroal_read_int32(&request[4]) != 80877102)
+   {
+      errno = 0;
+      return false;
+   }
 
-      if (!admins_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_admins.conf", PGAGROAL_DEFAULT_ADMINS_FILE, admins_path_buffer, sizeof(admins_path_buffer)) == 0 && strlen(admins_path_buffer) > 0)
-      {
-         admins_path = admins_path_buffer;
-      }
+   /* The handler never writes, so any event means it went away */
+   pfd.fd = cancel_fd;
+   pfd.events = POLLOUT;
+   pfd.revents = 0;
 
-      if (!superuser_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_superuser.conf", PGAGROAL_DEFAULT_SUPERUSER_FILE, superuser_path_buffer, sizeof(superuser_path_buffer)) == 0 && strlen(superuser_path_buffer) > 0)
+   if (poll(&pfd, 1, 0) != 1 || pfd.revents != POLLOUT ||
+       pgagroal_connection_fd_write(cancel_fd, -1, client_fd))
+   {
+      pgagroal_log_debug("pgagroal: Cancel handler (PID %d) unavailable", (int)cancel_pid);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+cancel_run(int fd)
+{
+   char request[16];
+   int32_t slot = -1;
+   int client_fd = -1;
+
+   pgagroal_set_proc_title(1, argv_ptr, "cancel", NULL);
+
+   /* Forward the cancel requests one by one until the main process goes away */
+   while (!pgagroal_connection_transfer_read(fd, &slot, &client_fd) && client_fd != -1)
+   {
+      if (recv(client_fd, &request[0], sizeof(request), MSG_WAITALL) == (ssize_t)sizeof(request))
       {
-         superuser_path = superuser_path_buffer;
+         pgagroal_cancel_request(pgagroal_read_int32(&request[8]), pgagroal_read_int32(&request[12]));
       }
 
-      free(adjusted_dir_path);
+      pgagroal_disconnect(client_fd);
+      client_fd = -1;
    }
 
-   // the main configuration file is mandatory!
-   configuration_path = configuration_path != NULL ? configuration_path : PGAGROAL_DEFAULT_CONF_FILE;
+   exit(0);
+}
 
-   int cfg_ret = pgagroal_validate_config_file(configuration_path);
+static void
+start_startup_gate(void)
+{
+   struct main_configuration* config;
 
-   if (cfg_ret)
-   {
-      switch (cfg_ret)
-      {
-         case ENOENT:
-#ifdef HAVE_SYSTEMD
-            sd_notifyf(0, "STATUS=Configuration file not found or not a regular file: %s", configuration_path);
-#endif
-            errx(1, "Configuration file not found or not a regular file: %s", configuration_path);
-            break;
+   config = (struct main_configuration*)shmem;
 
-         case EACCES:
-#ifdef HAVE_SYSTEMD
-            sd_notifyf(0, "STATUS=Can't read configuration file: %s", configuration_path);
-#endif
-            errx(1, "Can't read configuration file: %s", configuration_path);
-            break;
+   if (!config->startup_gate || startup_clients != NULL)
+   {
+      return;
+   }
 
-         case EINVAL:
-#ifdef HAVE_SYSTEMD
-            sd_notifyf(0, "STATUS=Configuration file contains binary data or invalid path: %s", configuration_path);
-#endif
-            errx(1, "Configuration file contains binary data or invalid path: %s", configuration_path);
-            break;
+   startup_clients = (struct startup_client*)calloc(MAX_NUMBER_OF_CONNECTIONS, sizeof(struct startup_client));
+   if (startup_clients == NULL)
+   {
+      pgagroal_log_error("pgagroal: Startup gate: Cannot allocate memory");
+      return;
+   }
 
-         default:
-#ifdef HAVE_SYSTEMD
-            sd_notifyf(0, "STATUS=Configuration file validation failed: %s", configuration_path);
-#endif
-            errx(1, "Configuration file validation failed: %s", configuration_path);
-      }
+   number_of_startup_clients = MAX_NUMBER_OF_CONNECTIONS;
+   for (int i = 0; i < number_of_startup_clients; i++)
+   {
+      startup_clients[i].fd = -1;
    }
 
-   if ((ret = pgagroal_read_configuration(shmem, configuration_path, true)) != PGAGROAL_CONFIGURATION_STATUS_OK)
+   start_periodic_watcher(&startup_gate_watcher, &startup_gate_started, startup_gate_timeout_cb, 1000, 1000);
+}
+
+static void
+shutdown_startup_gate(void)
+{
+   /* Only the descriptors are closed, a child must not hold on to the clients of the main process */
+   for (int i = 0; i < number_of_startup_clients; i++)
    {
-      // the configuration has some problem, build up a descriptive message
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
-      {
-         pgagroal_snprintf(message, MISC_LENGTH, "Configuration file not found");
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
-      {
-         pgagroal_snprintf(message, MISC_LENGTH, "Too many sections");
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_KO)
-      {
-         pgagroal_snprintf(message, MISC_LENGTH, "Invalid configuration file");
-      }
-      else if (ret > 0)
+      if (startup_clients[i].fd != -1)
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "%d problematic or duplicated section%c",
-                           ret,
-                           ret > 1 ? 's' : ' ');
+         pgagroal_disconnect(startup_clients[i].fd);
+         startup_clients[i].fd = -1;
       }
-
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=%s: %s", message, configuration_path);
-#endif
-      errx(1, "%s (file <%s>)", message, configuration_path);
    }
+}
 
-   memcpy(config->common.configuration_path, configuration_path, MIN(strlen(configuration_path), MAX_PATH - 1));
+static bool
+startup_gate_add(int client_fd, char* address)
+{
+   for (int i = 0; i < number_of_startup_clients; i++)
+   {
+      struct startup_client* client = &startup_clients[i];
 
-   // the HBA file is mandatory!
-   hba_path = hba_path != NULL ? hba_path : PGAGROAL_DEFAULT_HBA_FILE;
-   memset(message, 0, MISC_LENGTH);
-   ret = pgagroal_read_hba_configuration(shmem, hba_path);
-   if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
-   {
-      pgagroal_snprintf(message, MISC_LENGTH, "HBA configuration file not found");
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=%s: %s", message, hba_path);
-#endif
-      errx(1, "%s (file <%s>)", message, hba_path);
+      if (client->fd == -1)
+      {
+         memset(client, 0, sizeof(struct startup_client));
+         client->fd = client_fd;
+         client->accepted = time(NULL);
+         memcpy(&client->address[0], address, MIN(strlen(address), sizeof(client->address) - 1));
+
+         pgagroal_event_worker_init(&client->watcher, client_fd, client_fd, startup_gate_cb);
+         if (pgagroal_io_start(&client->watcher))
+         {
+            client->fd = -1;
+            return false;
+         }
+
+         return true;
+      }
    }
-   else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+
+   /* Full, the client gets its worker right away */
+   return false;
+}
+
+static void
+startup_gate_cb(struct io_watcher* watcher)
+{
+   char header[8];
+   char address[MISC_LENGTH];
+   ssize_t n;
+   int client_fd;
+   int32_t length;
+   int32_t code;
+   struct startup_client* client;
+
+   client = (struct startup_client*)watcher;
+   client_fd = client->fd;
+
+   if (client_fd == -1)
    {
-      pgagroal_snprintf(message, MISC_LENGTH, "HBA too many entries (max %d)", NUMBER_OF_HBAS);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=%s: %s", message, hba_path);
-#endif
+      return;
+   }
 
-      errx(1, "%s (file <%s>)", message, hba_path);
+   n = recv(client_fd, &header[0], sizeof(header), MSG_PEEK | MSG_DONTWAIT);
+   if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+   {
+      errno = 0;
+      return;
    }
+   errno = 0;
 
-   memcpy(&config->hba_path[0], hba_path, MIN(strlen(hba_path), MAX_PATH - 1));
+   pgagroal_io_stop(watcher);
+   client->fd = -1;
 
-   conf_file_mandatory = true;
-read_limit_path:
-   if (limit_path != NULL)
+   memcpy(&address[0], &client->address[0], sizeof(address));
+
+   /* A TLS handshake for direct TLS, or a packet the worker reads the rest of */
+   if (n > 0 && ((unsigned char)header[0] == 0x16 || n < (ssize_t)sizeof(header)))
    {
-      memset(message, 0, MISC_LENGTH);
-      ret = pgagroal_read_limit_configuration(shmem, limit_path);
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
-      {
-         memcpy(&config->limit_path[0], limit_path, MIN(strlen(limit_path), MAX_PATH - 1));
-      }
-      else if (conf_file_mandatory && ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
+      dispatch_client(client_fd, &address[0]);
+      return;
+   }
+
+   if (n == (ssize_t)sizeof(header))
+   {
+      length = pgagroal_read_int32(&header[0]);
+      code = pgagroal_read_int32(&header[4]);
+
+      /* A startup packet of protocol 3, or a cancel, SSL or GSS request */
+      if (length >= 8 && length <= MAX_STARTUP_PACKET_LENGTH &&
+          ((code >> 16) == 3 || code == 80877102 || code == 80877103 || code == 80877104))
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "LIMIT configuration file not found");
-         printf("pgagroal: %s (file <%s>)\n", message, limit_path);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, limit_path);
-#endif
-         exit(1);
+         dispatch_client(client_fd, &address[0]);
+         return;
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+   }
+
+   pgagroal_log_debug("startup_gate: no startup packet from %s", &address[0]);
+   pgagroal_prometheus_client_sockets_sub();
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+startup_gate_timeout_cb(void)
+{
+   time_t now;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   now = time(NULL);
+
+   for (int i = 0; i < number_of_startup_clients; i++)
+   {
+      struct startup_client* client = &startup_clients[i];
+
+      if (client->fd != -1 &&
+          difftime(now, client->accepted) >= (double)pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S))
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "Too many limit entries");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, limit_path);
-#endif
-         errx(1, "%s (file <%s>)", message, limit_path);
+         pgagroal_log_debug("startup_gate: timeout for %s", &client->address[0]);
+
+         pgagroal_io_stop(&client->watcher);
+         pgagroal_prometheus_client_sockets_sub();
+         pgagroal_disconnect(client->fd);
+         client->fd = -1;
       }
    }
-   else
+}
+
+static void
+start_multiplex(int index)
+{
+   pid_t pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   config->multiplex_pid[index] = 0;
+
+   pid = fork();
+   if (pid == -1)
    {
-      // the user did not specify a file on the command line
-      // so try the default one and allow it to be missing
-      limit_path = PGAGROAL_DEFAULT_LIMIT_FILE;
-      conf_file_mandatory = false;
-      goto read_limit_path;
+      pgagroal_log_error("pgagroal: Multiplexer: Cannot create process");
+      return;
    }
-
-   conf_file_mandatory = true;
-read_users_path:
-   if (users_path != NULL)
+   else if (pid == 0)
    {
-      memset(message, 0, MISC_LENGTH);
-      ret = pgagroal_read_users_configuration(shmem, users_path);
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
-      {
-         memcpy(&config->users_path[0], users_path, MIN(strlen(users_path), MAX_PATH - 1));
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
-      {
-         pgagroal_snprintf(message, MISC_LENGTH, "USERS configuration file not found");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s : %s", message, users_path);
-#endif
-         errx(1, "%s  (file <%s>)", message, users_path);
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_KO || ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT)
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "Invalid master key file");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: <%s>", message, users_path);
-#endif
-         errx(1, "%s (file <%s>)", message, users_path);
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
-      {
-         pgagroal_snprintf(message, MISC_LENGTH, "USERS: too many users defined (%d, max %d)", config->number_of_users, NUMBER_OF_USERS);
 
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, users_path);
-#endif
-         errx(1, "%s (file <%s>)", message, users_path);
-      }
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      pgagroal_multiplex(index, argv_ptr);
    }
-   else
+
+   /* Receives the server descriptors just like a client worker */
+   add_client(pid);
+   config->multiplex_pid[index] = pid;
+}
+
+static void
+start_notify(void)
+{
+   pid_t pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   config->notify_pid = 0;
+
+   pid = fork();
+   if (pid == -1)
    {
-      // the user did not specify a file on the command line
-      // so try the default one and allow it to be missing
-      users_path = PGAGROAL_DEFAULT_USERS_FILE;
-      conf_file_mandatory = false;
-      goto read_users_path;
+      pgagroal_log_error("pgagroal: Notification relay: Cannot create process");
+      return;
    }
-
-   conf_file_mandatory = true;
-read_frontend_users_path:
-   if (frontend_users_path != NULL)
+   else if (pid == 0)
    {
-      ret = pgagroal_read_frontend_users_configuration(shmem, frontend_users_path);
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
-      {
-         memset(message, 0, MISC_LENGTH);
-         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS configuration file not found");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, frontend_users_path);
-#endif
-         errx(1, "%s (file <%s>)", message, frontend_users_path);
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
-      {
-#ifdef HAVE_SYSTEMD
-         memset(message, 0, MISC_LENGTH);
-         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS Invalid master key file");
-         sd_notifyf(0, "STATUS=%s: <%s>", message, frontend_users_path);
-#endif
-         errx(1, "%s (file <%s>)", message, frontend_users_path);
-      }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
       {
-         memset(message, 0, MISC_LENGTH);
-         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS: Too many users defined %d (max %d)",
-                           config->number_of_frontend_users, NUMBER_OF_USERS);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, frontend_users_path);
-#endif
-         errx(1, "%s (file <%s>)", message, frontend_users_path);
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      pgagroal_notify_relay(argv_ptr);
+   }
+
+   /* The relay makes its own connections, so it doesn't receive the server descriptors */
+   config->notify_pid = pid;
+}
+
+static void
+start_console_cache(void)
+{
+   pid_t pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   config->console_pid = 0;
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgagroal_log_error("pgagroal: Console: Cannot create process");
+      return;
+   }
+   else if (pid == 0)
+   {
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
       {
-         memcpy(&config->frontend_users_path[0], frontend_users_path, MIN(strlen(frontend_users_path), MAX_PATH - 1));
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
       }
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      pgagroal_console_cache(argv_ptr);
    }
-   else
+
+   /* The console scrapes the metrics port, so it doesn't receive the server descriptors */
+   config->console_pid = pid;
+}
+
+static void
+start_tunnel_link(int index)
+{
+   pid_t pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   config->tunnel_pid[index] = 0;
+
+   pid = fork();
+   if (pid == -1)
    {
-      // the user did not specify a file on the command line
-      // so try the default one and allow it to be missing
-      frontend_users_path = PGAGROAL_DEFAULT_FRONTEND_USERS_FILE;
-      conf_file_mandatory = false;
-      goto read_frontend_users_path;
+      pgagroal_log_error("pgagroal: Tunnel link: Cannot create process");
+      return;
    }
-
-   conf_file_mandatory = true;
-read_admins_path:
-   if (admins_path != NULL)
+   else if (pid == 0)
    {
-      memset(message, 0, MISC_LENGTH);
-      ret = pgagroal_read_admins_configuration(shmem, admins_path);
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "ADMINS configuration file not found");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, admins_path);
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
+      }
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      pgagroal_tunnel_link(index, argv_ptr);
+   }
+
+   /* The link has no servers of its own, so it doesn't receive the server descriptors */
+   config->tunnel_pid[index] = pid;
+}
+
+static void
+start_acceptor(int index)
+{
+   pid_t pid;
+
+   acceptor_pids[index] = 0;
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgagroal_log_error("pgagroal: Acceptor: Cannot create process");
+      return;
+   }
+   else if (pid == 0)
+   {
+      signal(SIGINT, SIG_IGN);
+
+      if (setpgid(0, 0) == -1)
+      {
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
+      }
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+
+      acceptor_run(index);
+   }
+
+   acceptor_pids[index] = pid;
+}
+
+static void
+acceptor_run(int index)
+{
+   char name[MISC_LENGTH];
+   int unix_socket = -1;
+   struct event_loop* loop = NULL;
+   struct accept_io io_notify;
+   struct signal_info signal_watcher[2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   acceptor = true;
+   memset(&acceptor_pids, 0, sizeof(acceptor_pids));
+
+   pgagroal_set_proc_title(1, argv_ptr, "acceptor", NULL);
+
+   /* The listening sockets of the main process stay with it; we bind our own */
+   for (int i = 0; i < main_fds_length; i++)
+   {
+      pgagroal_disconnect(*(main_fds + i));
+   }
+   free(main_fds);
+   main_fds = NULL;
+   main_fds_length = 0;
+
+   if (pgagroal_bind(config->common.host, config->common.port, &main_fds, &main_fds_length, config->nodelay, config->backlog, true))
+   {
+      pgagroal_log_fatal("pgagroal: Acceptor %d: Could not bind to %s:%d", index, config->common.host, config->common.port);
+      exit(1);
+   }
+
+   if (main_fds_length > MAX_FDS)
+   {
+      pgagroal_log_fatal("pgagroal: Acceptor %d: Too many descriptors %d", index, main_fds_length);
+      exit(1);
+   }
+
+   client_keepalive();
+
+   memset(&name, 0, sizeof(name));
+   pgagroal_snprintf(&name[0], sizeof(name), "%s.%d", MAIN_UDS, (int)getpid());
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &name[0], &unix_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &name[0], config->common.port);
+      exit(1);
+   }
+
+   loop = pgagroal_event_loop_init();
+   if (!loop)
+   {
+      pgagroal_log_fatal("pgagroal: Acceptor %d: Failed to create loop", index);
+      exit(1);
+   }
+
+   memset(&io_notify, 0, sizeof(struct accept_io));
+   pgagroal_event_accept_init(&io_notify.watcher, unix_socket, accept_acceptor_cb);
+   io_notify.socket = unix_socket;
+   io_notify.argv = argv_ptr;
+   pgagroal_io_start(&io_notify.watcher);
+
+   start_io();
+   start_startup_gate();
+
+   pgagroal_signal_init(&signal_watcher[0].sig_w, acceptor_shutdown_cb, SIGQUIT);
+   pgagroal_signal_init(&signal_watcher[1].sig_w, sigchld_cb, SIGCHLD);
+
+   for (int i = 0; i < 2; i++)
+   {
+      signal_watcher[i].slot = -1;
+      pgagroal_signal_start(&signal_watcher[i].sig_w);
+   }
+
+   pgagroal_log_debug("pgagroal: Acceptor %d (PID %d)", index, (int)getpid());
+
+   pgagroal_event_loop_run();
+
+   shutdown_io();
+   pgagroal_io_stop(&io_notify.watcher);
+   pgagroal_disconnect(unix_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &name[0]);
+   errno = 0;
+
+   pgagroal_event_loop_destroy();
+
+   exit(0);
+}
+
+static void
+accept_acceptor_cb(struct io_watcher* watcher)
+{
+   int client_fd = -1;
+   int id = -1;
+   int32_t slot = -1;
+   int fd = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      errno = 0;
+      return;
+   }
+
+   if (pgagroal_connection_id_read(client_fd, &id))
+   {
+      pgagroal_log_error("pgagroal: Acceptor: ID: %d", id);
+      goto done;
+   }
+
+   if (id == CONNECTION_CLIENT_FD)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal: Acceptor client_fd: Slot %d FD %d", slot, fd);
+         goto done;
+      }
+
+      /* Workers forked from here look the descriptor up under the number the main process uses */
+      fd = reserve_fd(slot, fd);
+      if (fd == -1)
+      {
+         goto done;
+      }
+
+      if (fd != config->connections[slot].fd)
+      {
+         pgagroal_log_error("pgagroal: Acceptor client_fd: Slot %d FD %d (%d)", slot, fd, config->connections[slot].fd);
+         pgagroal_disconnect(fd);
+         goto done;
+      }
+
+      known_fds[slot] = fd;
+   }
+   else if (id == CONNECTION_REMOVE_FD)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+      {
+         pgagroal_log_error("pgagroal: Acceptor remove_fd: Slot %d FD %d", slot, fd);
+         goto done;
+      }
+
+      pgagroal_disconnect(fd);
+
+      if (known_fds[slot] > 0)
+      {
+         pgagroal_disconnect(known_fds[slot]);
+         known_fds[slot] = 0;
+      }
+   }
+   else
+   {
+      pgagroal_log_debug("pgagroal: Acceptor: Unsupported id: %d", id);
+   }
+
+done:
+
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+acceptor_shutdown_cb(void)
+{
+   pgagroal_event_loop_break();
+}
+
+static void
+start_metrics(void)
+{
+   for (int i = 0; i < metrics_fds_length; i++)
+   {
+      int sockfd = *(metrics_fds + i);
+
+      memset(&io_metrics[i], 0, sizeof(struct accept_io));
+      pgagroal_event_accept_init(&io_metrics[i].watcher, sockfd, accept_metrics_cb);
+      io_metrics[i].socket = sockfd;
+      io_metrics[i].argv = argv_ptr;
+      pgagroal_io_start(&io_metrics[i].watcher);
+   }
+}
+
+static void
+shutdown_metrics(void)
+{
+   for (int i = 0; i < metrics_fds_length; i++)
+   {
+      pgagroal_disconnect(io_metrics[i].socket);
+      errno = 0;
+   }
+}
+
+static void
+start_management(void)
+{
+   for (int i = 0; i < management_fds_length; i++)
+   {
+      int sockfd = *(management_fds + i);
+
+      memset(&io_management[i], 0, sizeof(struct accept_io));
+      pgagroal_event_accept_init(&io_management[i].watcher, sockfd, accept_management_cb);
+      io_management[i].socket = sockfd;
+      io_management[i].argv = argv_ptr;
+      pgagroal_io_start(&io_management[i].watcher);
+   }
+}
+
+static void
+shutdown_management(bool remove __attribute__((unused)))
+{
+   for (int i = 0; i < management_fds_length; i++)
+   {
+      pgagroal_disconnect(io_management[i].socket);
+      errno = 0;
+   }
+}
+
+static void
+start_console(void)
+{
+   for (int i = 0; i < console_fds_length; i++)
+   {
+      int sockfd = *(console_fds + i);
+
+      memset(&io_console[i], 0, sizeof(struct accept_io));
+      pgagroal_event_accept_init(&io_console[i].watcher, sockfd, accept_console_cb);
+      io_console[i].socket = sockfd;
+      io_console[i].argv = argv_ptr;
+      pgagroal_io_start(&io_console[i].watcher);
+   }
+}
+
+static void
+shutdown_console(void)
+{
+   for (int i = 0; i < console_fds_length; i++)
+   {
+      pgagroal_disconnect(io_console[i].socket);
+      errno = 0;
+   }
+}
+
+static void
+start_tunnel(void)
+{
+   for (int i = 0; i < tunnel_fds_length; i++)
+   {
+      int sockfd = *(tunnel_fds + i);
+
+      memset(&io_tunnel[i], 0, sizeof(struct accept_io));
+      pgagroal_event_accept_init(&io_tunnel[i].watcher, sockfd, accept_tunnel_cb);
+      io_tunnel[i].socket = sockfd;
+      io_tunnel[i].argv = argv_ptr;
+      pgagroal_io_start(&io_tunnel[i].watcher);
+   }
+}
+
+static void
+shutdown_tunnel(void)
+{
+   for (int i = 0; i < tunnel_fds_length; i++)
+   {
+      pgagroal_disconnect(io_tunnel[i].socket);
+      errno = 0;
+   }
+}
+
+static void
+version(void)
+{
+   printf("pgagroal %s\n", PGAGROAL_VERSION);
+   exit(1);
+}
+
+static void
+usage(void)
+{
+   printf("pgagroal %s\n", PGAGROAL_VERSION);
+   printf("  High-performance connection pool for PostgreSQL\n");
+   printf("\n");
+
+   printf("Usage:\n");
+   printf("  pgagroal [ -c CONFIG_FILE ] [ -a HBA_FILE ] [ -d ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -c, --config CONFIG_FILE           Set the path to the pgagroal.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_CONF_FILE);
+   printf("  -a, --hba HBA_FILE                 Set the path to the pgagroal_hba.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_HBA_FILE);
+   printf("  -l, --limit LIMIT_FILE             Set the path to the pgagroal_databases.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_LIMIT_FILE);
+   printf("  -u, --users USERS_FILE             Set the path to the pgagroal_users.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_USERS_FILE);
+   printf("  -F, --frontend FRONTEND_USERS_FILE Set the path to the pgagroal_frontend_users.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_FRONTEND_USERS_FILE);
+   printf("  -A, --admins ADMINS_FILE           Set the path to the pgagroal_admins.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_ADMINS_FILE);
+   printf("  -S, --superuser SUPERUSER_FILE     Set the path to the pgagroal_superuser.conf file\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_SUPERUSER_FILE);
+   printf("  -D, --directory DIRECTORY_PATH     Set the directory path to load configuration files\n");
+   printf("                                     Default: %s\n", PGAGROAL_DEFAULT_CONFIGURATION_PATH);
+   printf("                                     Can also be set via PGAGROAL_CONFIG_DIR environment variable\n");
+   printf("  -d, --daemon                       Run as a daemon\n");
+   printf("  -T, --takeover                     Take over the ports and the idle connections of a running pgagroal\n");
+   printf("  -V, --version                      Display version information\n");
+   printf("  -?, --help                         Display help\n");
+   printf("\n");
+   printf("pgagroal: %s\n", PGAGROAL_HOMEPAGE);
+   printf("Report bugs: %s\n", PGAGROAL_ISSUES);
+}
+
+int
+main(int argc, char** argv)
+{
+   main_argc = argc;
+   main_argv = argv;
+   char* configuration_path = NULL;
+   char* hba_path = NULL;
+   char* limit_path = NULL;
+   char* users_path = NULL;
+   char* frontend_users_path = NULL;
+   char* admins_path = NULL;
+   char* superuser_path = NULL;
+   char* directory_path = NULL;
+   bool daemon = false;
+   bool takeover = false;
+   pid_t pid, sid;
+   char config_path_buffer[MAX_PATH];
+   char hba_path_buffer[MAX_PATH];
+   char limit_path_buffer[MAX_PATH];
+   char users_path_buffer[MAX_PATH];
+   char frontend_users_path_buffer[MAX_PATH];
+   char admins_path_buffer[MAX_PATH];
+   char superuser_path_buffer[MAX_PATH];
+#ifdef HAVE_SYSTEMD
+   int sds;
+#endif
+   bool has_unix_socket = false;
+   bool has_main_sockets = false;
+   void* tmp_shmem = NULL;
+   struct signal_info signal_watcher[SIGNALS_NUMBER];
+   struct rlimit flimit;
+   size_t shmem_size;
+   size_t pipeline_shmem_size = 0;
+   size_t prometheus_shmem_size = 0;
+   size_t prometheus_cache_shmem_size = 0;
+   size_t query_cache_shmem_size = 0;
+   size_t tracker_shmem_size = 0;
+   size_t slowlog_shmem_size = 0;
+   size_t activity_shmem_size = 0;
+   size_t log_shmem_size = 0;
+   size_t tmp_size;
+   struct main_configuration* config = NULL;
+   int ret;
+   int c;
+   char* os = NULL;
+
+   int kernel_major, kernel_minor, kernel_patch;
+   bool conf_file_mandatory;
+   char message[MISC_LENGTH]; // a generic message used for errors
+   argv_ptr = argv;
+
+   struct stat path_stat = {0};
+   char* adjusted_dir_path = NULL;
+
+   while (1)
+   {
+      // clang-format off
+      static struct option long_options[] =
+      {
+         {"config", required_argument, 0, 'c'},
+         {"hba", required_argument, 0, 'a'},
+         {"limit", required_argument, 0, 'l'},
+         {"users", required_argument, 0, 'u'},
+         {"frontend", required_argument, 0, 'F'},
+         {"admins", required_argument, 0, 'A'},
+         {"superuser", required_argument, 0, 'S'},
+         {"directory", required_argument, 0, 'D'},
+         {"daemon", no_argument, 0, 'd'},
+         {"takeover", no_argument, 0, 'T'},
+         {"version", no_argument, 0, 'V'},
+         {"help", no_argument, 0, '?'}
+      };
+      // clang-format on
+      int option_index = 0;
+
+      c = getopt_long(argc, argv, "dTV?a:c:l:u:F:A:S:D:",
+                      long_options, &option_index);
+
+      if (c == -1)
+      {
+         break;
+      }
+
+      switch (c)
+      {
+         case 'a':
+            hba_path = optarg;
+            break;
+         case 'c':
+            configuration_path = optarg;
+            break;
+         case 'l':
+            limit_path = optarg;
+            break;
+         case 'u':
+            users_path = optarg;
+            break;
+         case 'F':
+            frontend_users_path = optarg;
+            break;
+         case 'A':
+            admins_path = optarg;
+            break;
+         case 'S':
+            superuser_path = optarg;
+            break;
+         case 'D':
+            directory_path = optarg;
+            break;
+         case 'd':
+            daemon = true;
+            break;
+         case 'T':
+            takeover = true;
+            break;
+         case 'V':
+            version();
+            break;
+         case '?':
+            usage();
+            exit(1);
+            break;
+         default:
+            break;
+      }
+   }
+
+   if (getuid() == 0)
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Using the root account is not allowed");
+#endif
+      errx(1, "Using the root account is not allowed");
+   }
+
+   shmem_size = sizeof(struct main_configuration);
+   if (pgagroal_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in creating shared memory");
+#endif
+      errx(1, "Error in creating shared memory");
+   }
+
+   pgagroal_init_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+
+   memset(&known_fds, 0, sizeof(known_fds));
+   memset(message, 0, MISC_LENGTH);
+
+   if (directory_path == NULL)
+   {
+      // Check for environment variable if no -D flag provided
+      directory_path = getenv("PGAGROAL_CONFIG_DIR");
+      if (directory_path != NULL)
+      {
+         pgagroal_log_info("Configuration directory set via PGAGROAL_CONFIG_DIR environment variable: %s", directory_path);
+      }
+   }
+
+   if (directory_path != NULL)
+   {
+      if (!strcmp(directory_path, PGAGROAL_DEFAULT_CONFIGURATION_PATH))
+      {
+         pgagroal_log_warn("Using the default configuration directory %s, -D can be omitted.", directory_path);
+      }
+
+      if (access(directory_path, F_OK) != 0)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Configuration directory not found: %s", directory_path);
+#endif
+         pgagroal_log_error("Configuration directory not found: %s", directory_path);
+         exit(1);
+      }
+
+      if (stat(directory_path, &path_stat) == 0)
+      {
+         if (!S_ISDIR(path_stat.st_mode))
+         {
+#ifdef HAVE_SYSTEMD
+            sd_notifyf(0, "STATUS=Path is not a directory: %s", directory_path);
+#endif
+            pgagroal_log_error("Path is not a directory: %s", directory_path);
+            exit(1);
+         }
+      }
+
+      if (access(directory_path, R_OK | X_OK) != 0)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Insufficient permissions for directory: %s", directory_path);
+#endif
+         pgagroal_log_error("Insufficient permissions for directory: %s", directory_path);
+         exit(1);
+      }
+
+      if (directory_path[strlen(directory_path) - 1] != '/')
+      {
+         adjusted_dir_path = pgagroal_append(strdup(directory_path), "/");
+      }
+      else
+      {
+         adjusted_dir_path = strdup(directory_path);
+      }
+
+      if (adjusted_dir_path == NULL)
+      {
+         pgagroal_log_error("Memory allocation failed while copying directory path.");
+         exit(1);
+      }
+
+      if (!configuration_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal.conf", PGAGROAL_DEFAULT_CONF_FILE, config_path_buffer, sizeof(config_path_buffer)) == 0 && strlen(config_path_buffer) > 0)
+      {
+         configuration_path = config_path_buffer;
+      }
+
+      if (!hba_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_hba.conf", PGAGROAL_DEFAULT_HBA_FILE, hba_path_buffer, sizeof(hba_path_buffer)) == 0 && strlen(hba_path_buffer) > 0)
+      {
+         hba_path = hba_path_buffer;
+      }
+
+      if (!limit_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_databases.conf", PGAGROAL_DEFAULT_LIMIT_FILE, limit_path_buffer, sizeof(limit_path_buffer)) == 0 && strlen(limit_path_buffer) > 0)
+      {
+         limit_path = limit_path_buffer;
+      }
+
+      if (!users_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_users.conf", PGAGROAL_DEFAULT_USERS_FILE, users_path_buffer, sizeof(users_path_buffer)) == 0 && strlen(users_path_buffer) > 0)
+      {
+         users_path = users_path_buffer;
+      }
+
+      if (!frontend_users_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_frontend_users.conf", PGAGROAL_DEFAULT_FRONTEND_USERS_FILE, frontend_users_path_buffer, sizeof(frontend_users_path_buffer)) == 0 && strlen(frontend_users_path_buffer) > 0)
+      {
+         frontend_users_path = frontend_users_path_buffer;
+      }
+
+      if (!admins_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_admins.conf", PGAGROAL_DEFAULT_ADMINS_FILE, admins_path_buffer, sizeof(admins_path_buffer)) == 0 && strlen(admins_path_buffer) > 0)
+      {
+         admins_path = admins_path_buffer;
+      }
+
+      if (!superuser_path && pgagroal_normalize_path(adjusted_dir_path, "pgagroal_superuser.conf", PGAGROAL_DEFAULT_SUPERUSER_FILE, superuser_path_buffer, sizeof(superuser_path_buffer)) == 0 && strlen(superuser_path_buffer) > 0)
+      {
+         superuser_path = superuser_path_buffer;
+      }
+
+      free(adjusted_dir_path);
+   }
+
+   // the main configuration file is mandatory!
+   configuration_path = configuration_path != NULL ? configuration_path : PGAGROAL_DEFAULT_CONF_FILE;
+
+   int cfg_ret = pgagroal_validate_config_file(configuration_path);
+
+   if (cfg_ret)
+   {
+      switch (cfg_ret)
+      {
+         case ENOENT:
+#ifdef HAVE_SYSTEMD
+            sd_notifyf(0, "STATUS=Configuration file not found or not a regular file: %s", configuration_path);
+#endif
+            errx(1, "Configuration file not found or not a regular file: %s", configuration_path);
+            break;
+
+         case EACCES:
+#ifdef HAVE_SYSTEMD
+            sd_notifyf(0, "STATUS=Can't read configuration file: %s", configuration_path);
+#endif
+            errx(1, "Can't read configuration file: %s", configuration_path);
+            break;
+
+         case EINVAL:
+#ifdef HAVE_SYSTEMD
+            sd_notifyf(0, "STATUS=Configuration file contains binary data or invalid path: %s", configuration_path);
+#endif
+            errx(1, "Configuration file contains binary data or invalid path: %s", configuration_path);
+            break;
+
+         default:
+#ifdef HAVE_SYSTEMD
+            sd_notifyf(0, "STATUS=Configuration file validation failed: %s", configuration_path);
+#endif
+            errx(1, "Configuration file validation failed: %s", configuration_path);
+      }
+   }
+
+   if ((ret = pgagroal_read_configuration(shmem, configuration_path, true)) != PGAGROAL_CONFIGURATION_STATUS_OK)
+   {
+      // the configuration has some problem, build up a descriptive message
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Configuration file not found");
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Too many sections");
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Invalid configuration file");
+      }
+      else if (ret > 0)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "%d problematic or duplicated section%c",
+                           ret,
+                           ret > 1 ? 's' : ' ');
+      }
+
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=%s: %s", message, configuration_path);
+#endif
+      errx(1, "%s (file <%s>)", message, configuration_path);
+   }
+
+   memcpy(config->common.configuration_path, configuration_path, MIN(strlen(configuration_path), MAX_PATH - 1));
+
+   // the HBA file is mandatory!
+   hba_path = hba_path != NULL ? hba_path : PGAGROAL_DEFAULT_HBA_FILE;
+   memset(message, 0, MISC_LENGTH);
+   ret = pgagroal_read_hba_configuration(shmem, hba_path);
+   if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
+   {
+      pgagroal_snprintf(message, MISC_LENGTH, "HBA configuration file not found");
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=%s: %s", message, hba_path);
+#endif
+      errx(1, "%s (file <%s>)", message, hba_path);
+   }
+   else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+   {
+      pgagroal_snprintf(message, MISC_LENGTH, "HBA too many entries (max %d)", NUMBER_OF_HBAS);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=%s: %s", message, hba_path);
+#endif
+
+      errx(1, "%s (file <%s>)", message, hba_path);
+   }
+
+   memcpy(&config->hba_path[0], hba_path, MIN(strlen(hba_path), MAX_PATH - 1));
+
+   conf_file_mandatory = true;
+read_limit_path:
+   if (limit_path != NULL)
+   {
+      memset(message, 0, MISC_LENGTH);
+      ret = pgagroal_read_limit_configuration(shmem, limit_path);
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      {
+         memcpy(&config->limit_path[0], limit_path, MIN(strlen(limit_path), MAX_PATH - 1));
+      }
+      else if (conf_file_mandatory && ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "LIMIT configuration file not found");
+         printf("pgagroal: %s (file <%s>)\n", message, limit_path);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, limit_path);
+#endif
+         exit(1);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Too many limit entries");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, limit_path);
+#endif
+         errx(1, "%s (file <%s>)", message, limit_path);
+      }
+   }
+   else
+   {
+      // the user did not specify a file on the command line
+      // so try the default one and allow it to be missing
+      limit_path = PGAGROAL_DEFAULT_LIMIT_FILE;
+      conf_file_mandatory = false;
+      goto read_limit_path;
+   }
+
+   conf_file_mandatory = true;
+read_users_path:
+   if (users_path != NULL)
+   {
+      memset(message, 0, MISC_LENGTH);
+      ret = pgagroal_read_users_configuration(shmem, users_path);
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      {
+         memcpy(&config->users_path[0], users_path, MIN(strlen(users_path), MAX_PATH - 1));
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "USERS configuration file not found");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s : %s", message, users_path);
+#endif
+         errx(1, "%s  (file <%s>)", message, users_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_KO || ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Invalid master key file");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: <%s>", message, users_path);
+#endif
+         errx(1, "%s (file <%s>)", message, users_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "USERS: too many users defined (%d, max %d)", config->number_of_users, NUMBER_OF_USERS);
+
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, users_path);
+#endif
+         errx(1, "%s (file <%s>)", message, users_path);
+      }
+   }
+   else
+   {
+      // the user did not specify a file on the command line
+      // so try the default one and allow it to be missing
+      users_path = PGAGROAL_DEFAULT_USERS_FILE;
+      conf_file_mandatory = false;
+      goto read_users_path;
+   }
+
+   conf_file_mandatory = true;
+read_frontend_users_path:
+   if (frontend_users_path != NULL)
+   {
+      ret = pgagroal_read_frontend_users_configuration(shmem, frontend_users_path);
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      {
+         memset(message, 0, MISC_LENGTH);
+         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS configuration file not found");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, frontend_users_path);
+#endif
+         errx(1, "%s (file <%s>)", message, frontend_users_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      {
+#ifdef HAVE_SYSTEMD
+         memset(message, 0, MISC_LENGTH);
+         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS Invalid master key file");
+         sd_notifyf(0, "STATUS=%s: <%s>", message, frontend_users_path);
+#endif
+         errx(1, "%s (file <%s>)", message, frontend_users_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         memset(message, 0, MISC_LENGTH);
+         pgagroal_snprintf(message, MISC_LENGTH, "FRONTEND USERS: Too many users defined %d (max %d)",
+                           config->number_of_frontend_users, NUMBER_OF_USERS);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, frontend_users_path);
+#endif
+         errx(1, "%s (file <%s>)", message, frontend_users_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      {
+         memcpy(&config->frontend_users_path[0], frontend_users_path, MIN(strlen(frontend_users_path), MAX_PATH - 1));
+      }
+   }
+   else
+   {
+      // the user did not specify a file on the command line
+      // so try the default one and allow it to be missing
+      frontend_users_path = PGAGROAL_DEFAULT_FRONTEND_USERS_FILE;
+      conf_file_mandatory = false;
+      goto read_frontend_users_path;
+   }
+
+   conf_file_mandatory = true;
+read_admins_path:
+   if (admins_path != NULL)
+   {
+      memset(message, 0, MISC_LENGTH);
+      ret = pgagroal_read_admins_configuration(shmem, admins_path);
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "ADMINS configuration file not found");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, admins_path);
+#endif
+         errx(1, "%s (file <%s>)", message, admins_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Invalid master key file: <%s>", admins_path);
+#endif
+         errx(1, "Invalid master key file (file <%s>)", admins_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "Too many admins defined %d (max %d)", config->number_of_admins, NUMBER_OF_ADMINS);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s %s", message, admins_path);
+#endif
+         errx(1, "%s (file <%s>)", message, admins_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      {
+         memcpy(&config->admins_path[0], admins_path, MIN(strlen(admins_path), MAX_PATH - 1));
+      }
+   }
+   else
+   {
+      // the user did not specify a file on the command line
+      // so try the default one and allow it to be missing
+      admins_path = PGAGROAL_DEFAULT_ADMINS_FILE;
+      conf_file_mandatory = false;
+      goto read_admins_path;
+   }
+
+   conf_file_mandatory = true;
+read_superuser_path:
+   if (superuser_path != NULL)
+   {
+      ret = pgagroal_read_superuser_configuration(shmem, superuser_path);
+      memset(message, 0, MISC_LENGTH);
+      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "SUPERUSER configuration file not found");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, superuser_path);
+#endif
+         errx(1, "%s (file <%s>)", message, superuser_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Invalid master key file: <%s>", superuser_path);
+#endif
+         errx(1, "Invalid master key file (file <%s>)", superuser_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      {
+         pgagroal_snprintf(message, MISC_LENGTH, "SUPERUSER: Too many superusers defined (max 1)");
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=%s: %s", message, superuser_path);
+#endif
+         errx(1, "%s (file <%s>)", message, superuser_path);
+      }
+      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      {
+         memcpy(&config->superuser_path[0], superuser_path, MIN(strlen(superuser_path), MAX_PATH - 1));
+      }
+   }
+   else
+   {
+      // the user did not specify a file on the command line
+      // so try the default one and allow it to be missing
+      superuser_path = PGAGROAL_DEFAULT_SUPERUSER_FILE;
+      conf_file_mandatory = false;
+      goto read_superuser_path;
+   }
+
+   /* systemd sockets */
+#ifdef HAVE_SYSTEMD
+   sds = sd_listen_fds(0);
+   if (sds > 0)
+   {
+      int m = 0;
+
+      main_fds_length = 0;
+
+      for (int i = 0; i < sds; i++)
+      {
+         int fd = SD_LISTEN_FDS_START + i;
+
+         if (sd_is_socket(fd, AF_INET, 0, -1) || sd_is_socket(fd, AF_INET6, 0, -1))
+         {
+            main_fds_length++;
+         }
+      }
+
+      if (main_fds_length > 0)
+      {
+         main_fds = malloc(main_fds_length * sizeof(int));
+      }
+
+      for (int i = 0; i < sds; i++)
+      {
+         int fd = SD_LISTEN_FDS_START + i;
+
+         if (sd_is_socket(fd, AF_UNIX, 0, -1))
+         {
+            unix_pgsql_socket = fd;
+            has_unix_socket = true;
+            pgagroal_socket_nonblocking(fd);
+         }
+         else if (sd_is_socket(fd, AF_INET, 0, -1) || sd_is_socket(fd, AF_INET6, 0, -1))
+         {
+            main_fds[m] = fd;
+            has_main_sockets = true;
+            pgagroal_socket_nonblocking(fd);
+            m++;
+         }
+      }
+   }
+#endif
+
+   if (pgagroal_init_logging())
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Failed to init logging");
+#endif
+      exit(1);
+   }
+
+   if (pgagroal_start_logging())
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Failed to start logging");
+#endif
+      errx(1, "Failed to start logging");
+   }
+
+   /* Before the shared memory is touched, so it is allocated on the node */
+   if (config->numa_node >= 0 && pgagroal_numa_bind(config->numa_node))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Unable to bind to NUMA node %d", config->numa_node);
+#endif
+      errx(1, "Unable to bind to NUMA node %d", config->numa_node);
+   }
+
+   if (config->common.metrics > 0)
+   {
+      if (pgagroal_init_prometheus(&prometheus_shmem_size, &prometheus_shmem))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Error in creating and initializing prometheus shared memory");
+#endif
+         errx(1, "Error in creating and initializing prometheus shared memory");
+      }
+
+      if (pgagroal_init_prometheus_cache(&prometheus_cache_shmem_size, &prometheus_cache_shmem))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Error in creating and initializing prometheus cache shared memory");
+#endif
+         errx(1, "Error in creating and initializing prometheus cache shared memory");
+      }
+   }
+
+   if (pgagroal_validate_configuration(shmem, has_unix_socket, has_main_sockets))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid configuration");
+#endif
+      errx(1, "Invalid configuration");
+   }
+
+   if (config->query_cache_max_size > 0)
+   {
+      if (pgagroal_query_cache_init(&query_cache_shmem_size, &query_cache_shmem))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Error in creating and initializing query cache shared memory");
+#endif
+         errx(1, "Error in creating and initializing query cache shared memory");
+      }
+   }
+
+   /* The tracker can be enabled by a reload, so the ring always exists */
+   if (pgagroal_tracker_init(&tracker_shmem_size, &tracker_shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in creating and initializing tracker shared memory");
+#endif
+      errx(1, "Error in creating and initializing tracker shared memory");
+   }
+
+   /* The thresholds can be changed by a reload, so the ring always exists */
+   if (pgagroal_slowlog_init(&slowlog_shmem_size, &slowlog_shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in creating and initializing slow log shared memory");
+#endif
+      errx(1, "Error in creating and initializing slow log shared memory");
+   }
+
+   if (pgagroal_activity_init(&activity_shmem_size, &activity_shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in creating and initializing activity shared memory");
+#endif
+      errx(1, "Error in creating and initializing activity shared memory");
+   }
+
+   if (config->log_async)
+   {
+      if (pgagroal_log_ring_init(&log_shmem_size, &log_shmem))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Error in creating and initializing log shared memory");
+#endif
+         errx(1, "Error in creating and initializing log shared memory");
+      }
+   }
+
+   frontend_user_password_startup(config);
+
+   if (pgagroal_validate_hba_configuration(shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid HBA configuration");
+#endif
+      errx(1, "Invalid HBA configuration");
+   }
+   if (pgagroal_validate_limit_configuration(shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid LIMIT configuration");
+#endif
+      errx(1, "Invalid LIMIT configuration");
+   }
+   if (pgagroal_validate_users_configuration(shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid USERS configuration");
+#endif
+      errx(1, "Invalid USERS configuration");
+   }
+   if (pgagroal_validate_frontend_users_configuration(shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid FRONTEND USERS configuration");
+#endif
+      errx(1, "Invalid FRONTEND USERS configuration");
+   }
+   if (pgagroal_validate_admins_configuration(shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid ADMINS configuration");
+#endif
+      errx(1, "Invalid ADMINS configuration");
+   }
+   if (pgagroal_hba_compile(config))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Invalid HBA configuration");
+#endif
+      errx(1, "Invalid HBA configuration");
+   }
+
+   pgagroal_scram_verifiers(config);
+
+   if (pgagroal_resize_shared_memory(shmem_size, shmem, &tmp_size, &tmp_shmem))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in creating shared memory");
+#endif
+      errx(1, "Error in creating shared memory");
+   }
+   if (pgagroal_destroy_shared_memory(shmem, shmem_size) == -1)
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Error in destroying shared memory");
+#endif
+      errx(1, "Error in destroying shared memory");
+   }
+   shmem_size = tmp_size;
+   shmem = tmp_shmem;
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_memory_init();
+
+   if (getrlimit(RLIMIT_NOFILE, &flimit) == -1)
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Unable to find limit due to %s", strerror(errno));
+#endif
+      err(1, "Unable to find limit");
+   }
+
+   /* We are "reserving" 30 file descriptors for pgagroal main */
+   if (config->max_connections > (flimit.rlim_cur - 30))
+   {
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0,
+                 "STATUS=max_connections is larger than the file descriptor limit (%ld available)",
+                 (long)(flimit.rlim_cur - 30));
+#endif
+      errx(1, "max_connections is larger than the file descriptor limit (%ld available)", (long)(flimit.rlim_cur - 30));
+   }
+
+   /* The acceptors keep the descriptors of the slots at the top of the limit */
+   if (config->acceptors > 1)
+   {
+      if (config->connection_slots > (flimit.rlim_cur - 30) / 2)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0,
+                    "STATUS=acceptors requires a file descriptor limit of at least %ld",
+                    (long)config->connection_slots * 2 + 30);
+#endif
+         errx(1, "acceptors requires a file descriptor limit of at least %ld", (long)config->connection_slots * 2 + 30);
+      }
+
+      reserved_fds = (int)(flimit.rlim_cur - config->connection_slots);
+   }
+
+   if (daemon)
+   {
+      if (config->common.log_type == PGAGROAL_LOGGING_TYPE_CONSOLE)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Daemon mode can't be used with console logging");
+#endif
+         errx(1, "Daemon mode can't be used with console logging");
+      }
+
+      pid = fork();
+
+      if (pid < 0)
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Daemon mode failed");
+#endif
+         errx(1, "Daemon mode failed");
+      }
+
+      if (pid > 0)
+      {
+         exit(0);
+      }
+
+      /* We are a daemon now */
+      umask(0);
+      sid = setsid();
+
+      if (sid < 0)
+      {
+         exit(1);
+      }
+   }
+
+   /* The running pgagroal keeps its PID file until we have taken over */
+   if (!takeover)
+   {
+      create_pidfile_or_exit(false);
+   }
+
+   if (pgagroal_log_ring_start())
+   {
+      pgagroal_log_warn("pgagroal: Logging synchronously");
+   }
+
+   pgagroal_pool_init();
+   pgagroal_cluster_reset();
+
+   if (config->common.tls)
+   {
+      pgagroal_tls_rotate_ticket_keys();
+   }
+
+   if (pgagroal_tls_contexts_create())
+   {
+      pgagroal_log_warn("pgagroal: TLS contexts are created for each connection");
+   }
+
+   pgagroal_set_proc_title(argc, argv, "main", NULL);
+
+   free(os);
+
+   /* Take over before the shared Unix Domain Sockets are bound again */
+   if (takeover)
+   {
+      if (take_over(&has_unix_socket, &has_main_sockets))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Could not take over");
+#endif
+         exit(1);
+      }
+
+      create_pidfile_or_exit(true);
+   }
+
+   /* Bind Unix Domain Socket: Main */
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, MAIN_UDS, &unix_management_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
+#endif
+      goto error;
+   }
+
+   /* Bind Unix Domain Socket: Transfer */
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &unix_transfer_socket))
+   {
+      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
+#endif
+      goto error;
+   }
+
+   if (!has_unix_socket)
+   {
+      char pgsql[MISC_LENGTH];
+
+      memset(&pgsql, 0, sizeof(pgsql));
+      pgagroal_snprintf(&pgsql[0], sizeof(pgsql), PG_UDS);
+
+      if (pgagroal_bind_unix_socket(config->unix_socket_dir, &pgsql[0], &unix_pgsql_socket))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
+#endif
+         goto error;
+      }
+   }
+
+   /* Bind main socket */
+   if (!has_main_sockets)
+   {
+      if (pgagroal_bind(config->common.host, config->common.port, &main_fds, &main_fds_length, config->nodelay, config->backlog, config->acceptors > 1))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.port);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->common.port);
+#endif
+         goto error;
+      }
+   }
+
+   if (main_fds_length > MAX_FDS)
+   {
+      pgagroal_log_fatal("pgagroal: Too many descriptors %d", main_fds_length);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Too many descriptors %d", main_fds_length);
+#endif
+      goto error;
+   }
+
+   client_keepalive();
+   pgagroal_event_set_context(PGAGROAL_CONTEXT_MAIN);
+   main_loop = pgagroal_event_loop_init();
+   if (!main_loop)
+   {
+      goto error;
+   }
+
+   pgagroal_signal_init(&signal_watcher[0].sig_w, shutdown_cb, SIGTERM);
+   pgagroal_signal_init(&signal_watcher[1].sig_w, reload_cb, SIGHUP);
+   pgagroal_signal_init(&signal_watcher[2].sig_w, shutdown_cb, SIGINT);
+   pgagroal_signal_init(&signal_watcher[3].sig_w, graceful_cb, SIGTRAP);
+   pgagroal_signal_init(&signal_watcher[4].sig_w, coredump_cb, SIGABRT);
+   pgagroal_signal_init(&signal_watcher[5].sig_w, shutdown_cb, SIGALRM);
+   pgagroal_signal_init(&signal_watcher[6].sig_w, sigchld_cb, SIGCHLD);
+   pgagroal_signal_init(&signal_watcher[7].sig_w, service_reload_cb, SIGUSR1);
+
+   signal_watcher[7].slot = -1;
+   pgagroal_signal_start(&signal_watcher[7].sig_w);
+
+   for (int i = 0; i < SIGNALS_NUMBER; i++)
+   {
+      signal_watcher[i].slot = -1;
+      pgagroal_signal_start(&signal_watcher[i].sig_w);
+   }
+
+   if (config->pipeline == PIPELINE_PERFORMANCE)
+   {
+      main_pipeline = performance_pipeline();
+   }
+   else if (config->pipeline == PIPELINE_SESSION)
+   {
+      if (pgagroal_tls_valid())
+      {
+         pgagroal_log_fatal("pgagroal: Invalid TLS configuration");
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Invalid TLS configuration");
 #endif
-         errx(1, "%s (file <%s>)", message, admins_path);
+         goto error;
+      }
+
+      main_pipeline = session_pipeline();
+   }
+   else if (config->pipeline == PIPELINE_TRANSACTION)
+   {
+      if (pgagroal_tls_valid())
+      {
+         pgagroal_log_fatal("pgagroal: Invalid TLS configuration");
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Invalid TLS configuration");
+#endif
+         goto error;
+      }
+
+      main_pipeline = transaction_pipeline();
+   }
+   else if (config->pipeline == PIPELINE_STATEMENT)
+   {
+      if (pgagroal_tls_valid())
+      {
+         pgagroal_log_fatal("pgagroal: Invalid TLS configuration");
+#ifdef HAVE_SYSTEMD
+         sd_notify(0, "STATUS=Invalid TLS configuration");
+#endif
+         goto error;
+      }
+
+      main_pipeline = statement_pipeline();
+   }
+   else
+   {
+      pgagroal_log_fatal("pgagroal: Unknown pipeline identifier (%d)", config->pipeline);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Unknown pipeline identifier (%d)", config->pipeline);
+#endif
+      goto error;
+   }
+
+   if (main_pipeline.initialize(shmem, &pipeline_shmem, &pipeline_shmem_size))
+   {
+      pgagroal_log_fatal("pgagroal: Pipeline initialize error (%d)", config->pipeline);
+#ifdef HAVE_SYSTEMD
+      sd_notifyf(0, "STATUS=Pipeline initialize error (%d)", config->pipeline);
+#endif
+      goto error;
+   }
+
+   start_transfer();
+   start_mgt();
+   start_uds();
+   start_io();
+
+   if (config->health_check)
+   {
+      pgagroal_health_check(argc, argv);
+   }
+
+   if (pgagroal_check_server_identifiers(true))
+   {
+      pgagroal_log_fatal("pgagroal: Duplicate server system identifiers detected");
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Duplicate server system identifiers detected");
+#endif
+      goto error;
+   }
+
+   refresh_periodic_watchers();
+
+   if (config->common.metrics > 0)
+   {
+      /* Bind metrics socket, unless it was taken over */
+      if (metrics_fds == NULL && pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, config->nodelay, config->backlog, false))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->common.metrics);
+#endif
+         goto error;
+      }
+
+      if (metrics_fds_length > MAX_FDS)
+      {
+         pgagroal_log_fatal("pgagroal: Too many descriptors %d", metrics_fds_length);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Too many descriptors %d", metrics_fds_length);
+#endif
+         goto error;
+      }
+
+      start_metrics();
+   }
+
+   if (config->management > 0)
+   {
+      /* Bind management socket, unless it was taken over */
+      if (management_fds == NULL && pgagroal_bind(config->common.host, config->management, &management_fds, &management_fds_length, config->nodelay, config->backlog, false))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->management);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->management);
+#endif
+         goto error;
+      }
+
+      if (management_fds_length > MAX_FDS)
+      {
+         pgagroal_log_fatal("pgagroal: Too many descriptors %d", management_fds_length);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Too many descriptors %d", management_fds_length);
+#endif
+         goto error;
+      }
+
+      start_management();
+   }
+
+   if (config->console > 0)
+   {
+      /* Bind console socket, unless it was taken over */
+      if (console_fds == NULL && pgagroal_bind(config->common.host, config->console, &console_fds, &console_fds_length, config->nodelay, config->backlog, false))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->console);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->console);
+#endif
+         goto error;
+      }
+
+      if (console_fds_length > MAX_FDS)
+      {
+         pgagroal_log_fatal("pgagroal: Too many descriptors %d", console_fds_length);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Too many descriptors %d", console_fds_length);
+#endif
+         goto error;
+      }
+
+      start_console();
+   }
+
+   if (config->tunnel_port > 0)
+   {
+      /* Bind tunnel socket, unless it was taken over */
+      if (tunnel_fds == NULL && pgagroal_bind(config->common.host, config->tunnel_port, &tunnel_fds, &tunnel_fds_length, config->nodelay, config->backlog, false))
+      {
+         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->tunnel_port);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->tunnel_port);
+#endif
+         goto error;
+      }
+
+      if (tunnel_fds_length > MAX_FDS)
+      {
+         pgagroal_log_fatal("pgagroal: Too many descriptors %d", tunnel_fds_length);
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Too many descriptors %d", tunnel_fds_length);
+#endif
+         goto error;
+      }
+
+      start_tunnel();
+   }
+
+   pgagroal_log_info("pgagroal: %s started on %s:%d",
+                     PGAGROAL_VERSION,
+                     config->common.host,
+                     config->common.port);
+   for (int i = 0; i < main_fds_length; i++)
+   {
+      pgagroal_log_debug("Socket: %d", *(main_fds + i));
+   }
+   pgagroal_log_debug("Unix Domain Socket: %d", unix_pgsql_socket);
+   pgagroal_log_debug("Management: %d", unix_management_socket);
+   pgagroal_log_debug("Transfer: %d", unix_transfer_socket);
+   for (int i = 0; i < metrics_fds_length; i++)
+   {
+      pgagroal_log_debug("Metrics: %d", *(metrics_fds + i));
+   }
+   for (int i = 0; i < management_fds_length; i++)
+   {
+      pgagroal_log_debug("Remote management: %d", *(management_fds + i));
+   }
+   for (int i = 0; i < console_fds_length; i++)
+   {
+      pgagroal_log_debug("Console: %d", *(console_fds + i));
+   }
+   for (int i = 0; i < tunnel_fds_length; i++)
+   {
+      pgagroal_log_debug("Tunnel: %d", *(tunnel_fds + i));
+   }
+
+   pgagroal_log_debug("Pipeline: %d", config->pipeline);
+   pgagroal_log_debug("Pipeline size: %lu", pipeline_shmem_size);
+   pgagroal_log_debug("%s", OpenSSL_version(OPENSSL_VERSION));
+   pgagroal_log_debug("Configuration size: %lu", shmem_size);
+   pgagroal_log_debug("Max connections: %d", config->max_connections);
+   pgagroal_log_debug("Known users: %d", config->number_of_users);
+   pgagroal_log_debug("Known frontend users: %d", config->number_of_frontend_users);
+   pgagroal_log_debug("Known admins: %d", config->number_of_admins);
+   pgagroal_log_debug("Known superuser: %s", strlen(config->superuser.username) > 0 ? "Yes" : "No");
+
+   /* Retrieve and log the OS kernel version; this has no effect on Pgagroal's operation */
+   pgagroal_os_kernel_version(&os, &kernel_major, &kernel_minor, &kernel_patch);
+
+   if (!config->allow_unknown_users && config->number_of_users == 0)
+   {
+      pgagroal_log_warn("No users allowed");
+   }
+
+   if (pgagroal_can_prefill())
+   {
+      if (!fork())
+      {
+         pgagroal_event_loop_fork();
+         shutdown_ports(false);
+         pgagroal_prefill_if_can(false, true);
+         /* Without a primary there is nothing to prefill, and we return */
+         exit(0);
+      }
+   }
+
+   for (int i = 0; i < config->multiplex_workers; i++)
+   {
+      start_multiplex(i);
+   }
+
+   if (config->notify_relay)
+   {
+      start_notify();
+   }
+
+   if (config->console > 0)
+   {
+      start_console_cache();
+   }
+
+   if (strlen(config->tunnel) > 0)
+   {
+      for (int i = 0; i < config->tunnel_links; i++)
+      {
+         start_tunnel_link(i);
+      }
+   }
+
+   for (int i = 1; i < config->acceptors; i++)
+   {
+      start_acceptor(i);
+   }
+
+   start_prefork();
+   start_cancel();
+   start_startup_gate();
+
+#ifdef HAVE_SYSTEMD
+   sd_notifyf(0,
+              "READY=1\n"
+              "STATUS=Running\n"
+              "MAINPID=%lu",
+              (unsigned long)getpid());
+#endif
+
+   pgagroal_event_loop_run();
+
+   pgagroal_log_info("pgagroal: shutdown");
+#ifdef HAVE_SYSTEMD
+   sd_notify(0, "STOPPING=1");
+#endif
+
+   config->keep_running = false;
+
+   pgagroal_pool_shutdown();
+
+   for (int i = 1; i < config->acceptors; i++)
+   {
+      if (acceptor_pids[i] > 0 && kill(acceptor_pids[i], SIGQUIT))
+      {
+         pgagroal_log_debug("kill: %s", strerror(errno));
+      }
+   }
+
+   if (config->notify_pid > 0 && kill(config->notify_pid, SIGQUIT))
+   {
+      pgagroal_log_debug("kill: %s", strerror(errno));
+   }
+
+   if (config->console_pid > 0 && kill(config->console_pid, SIGQUIT))
+   {
+      pgagroal_log_debug("kill: %s", strerror(errno));
+   }
+
+   for (int i = 0; i < config->tunnel_links; i++)
+   {
+      if (config->tunnel_pid[i] > 0 && kill(config->tunnel_pid[i], SIGQUIT))
+      {
+         pgagroal_log_debug("kill: %s", strerror(errno));
+      }
+   }
+
+   for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
+   {
+      pid_t pid = (pid_t)atomic_load(&config->clients[i]);
+
+      if (pid > 0 && kill(pid, SIGQUIT))
+      {
+         pgagroal_log_debug("kill: %s", strerror(errno));
+      }
+   }
+
+   for (int i = 0; i < management_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_management[i].watcher);
+   }
+   pgagroal_health_check_stop();
+   shutdown_management(true);
+
+   for (int i = 0; i < console_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_console[i].watcher);
+   }
+   shutdown_console();
+
+   for (int i = 0; i < tunnel_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_tunnel[i].watcher);
+   }
+   shutdown_tunnel();
+
+   for (int i = 0; i < metrics_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_metrics[i].watcher);
+   }
+   shutdown_metrics();
+
+   shutdown_prefork();
+   shutdown_cancel();
+
+   /* The shared names belong to the process that took over */
+   shutdown_mgt(config->handed_over == 0);
+   shutdown_transfer(config->handed_over == 0);
+   shutdown_hand_over();
+   shutdown_io();
+
+   if (unix_pgsql_socket != -1)
+   {
+      pgagroal_io_stop(&io_uds.watcher);
+      shutdown_uds(true);
+   }
+
+   pgagroal_event_loop_destroy();
+
+   free(os);
+   free(main_fds);
+   free(metrics_fds);
+   free(management_fds);
+   free(console_fds);
+   free(tunnel_fds);
+   pgagroal_json_writer_destroy(&status_writer);
+
+   main_pipeline.destroy(pipeline_shmem, pipeline_shmem_size);
+
+   if (config->handed_over == 0)
+   {
+      remove_pidfile();
+   }
+
+   pgagroal_log_ring_stop();
+   pgagroal_stop_logging();
+   pgagroal_destroy_shared_memory(prometheus_shmem, prometheus_shmem_size);
+   pgagroal_destroy_shared_memory(prometheus_cache_shmem, prometheus_cache_shmem_size);
+   pgagroal_destroy_shared_memory(query_cache_shmem, query_cache_shmem_size);
+   pgagroal_destroy_shared_memory(tracker_shmem, tracker_shmem_size);
+   pgagroal_destroy_shared_memory(slowlog_shmem, slowlog_shmem_size);
+   pgagroal_destroy_shared_memory(activity_shmem, activity_shmem_size);
+   pgagroal_destroy_shared_memory(log_shmem, log_shmem_size);
+   pgagroal_destroy_shared_memory(shmem, shmem_size);
+
+   pgagroal_memory_destroy();
+
+   return 0;
+
+error:
+
+   free(os);
+   remove_pidfile();
+   pgagroal_log_ring_stop();
+   exit(1);
+}
+
+static void
+accept_main_cb(struct io_watcher* watcher)
+{
+   struct sockaddr_in6 client_addr;
+   int client_fd;
+   char address[INET6_ADDRSTRLEN];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   errno = 0;
+
+   memset(&address, 0, sizeof(address));
+
+   client_fd = watcher->fds.main.client_fd;
+   if (client_fd == -1)
+   {
+      if (!acceptor && accept_fatal(errno) && config->keep_running)
+      {
+         char pgsql[MISC_LENGTH];
+
+         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
+
+         shutdown_io();
+         pgagroal_io_stop(&io_uds.watcher);
+         shutdown_uds(true);
+
+         memset(&pgsql, 0, sizeof(pgsql));
+         pgagroal_snprintf(&pgsql[0], sizeof(pgsql), PG_UDS);
+
+         if (pgagroal_bind_unix_socket(config->unix_socket_dir, &pgsql[0], &unix_pgsql_socket))
+         {
+            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
+            exit(1);
+         }
+
+         free(main_fds);
+         main_fds = NULL;
+         main_fds_length = 0;
+
+         if (pgagroal_bind(config->common.host, config->common.port, &main_fds, &main_fds_length, config->nodelay, config->backlog, config->acceptors > 1))
+         {
+            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.port);
+            exit(1);
+         }
+
+         if (main_fds_length > MAX_FDS)
+         {
+            pgagroal_log_fatal("pgagroal: Too many descriptors %d", main_fds_length);
+            exit(1);
+         }
+
+         client_keepalive();
+
+         if (!fork())
+         {
+            shutdown_ports(false);
+            pgagroal_flush(FLUSH_GRACEFULLY, "*");
+            exit(0);
+         }
+
+         start_io();
+         start_uds();
+
+         for (int i = 0; i < main_fds_length; i++)
+         {
+            pgagroal_log_debug("Socket: %d", *(main_fds + i));
+         }
+         pgagroal_log_debug("Unix Domain Socket: %d", unix_pgsql_socket);
+      }
+      else
+      {
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      }
+      errno = 0;
+      return;
+   }
+
+   pgagroal_prometheus_client_sockets_add();
+
+   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
+   socklen_t client_addr_length = sizeof(struct sockaddr_in6);
+   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
+
+   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
+
+   pgagroal_log_trace("accept_main_cb: client address: %s", address);
+
+   if (client_addr.sin6_family != AF_UNIX && pgagroal_client_throttled(address))
+   {
+      pgagroal_log_debug("accept_main_cb: client_connection_rate exceeded for %s", address);
+      pgagroal_write_connection_refused(NULL, client_fd);
+      pgagroal_prometheus_client_rate_limited();
+      pgagroal_prometheus_client_sockets_sub();
+      pgagroal_disconnect(client_fd);
+      return;
+   }
+
+   if (startup_clients != NULL && startup_gate_add(client_fd, &address[0]))
+   {
+      return;
+   }
+
+   dispatch_client(client_fd, &address[0]);
+}
+
+static void
+dispatch_client(int client_fd, char* address)
+{
+   pid_t pid;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* An edge passes everything, cancel requests too, on to the central pgagroal */
+   if (strlen(config->tunnel) > 0)
+   {
+      if (pgagroal_tunnel_hand_off(client_fd, address))
+      {
+         pgagroal_log_warn("pgagroal: Tunnel: No link for %s", address);
+      }
+
+      pgagroal_prometheus_client_sockets_sub();
+      pgagroal_disconnect(client_fd);
+      return;
+   }
+
+   if (cancel_dispatch(client_fd))
+   {
+      pgagroal_prometheus_client_sockets_sub();
+      pgagroal_disconnect(client_fd);
+      return;
+   }
+
+   if (prefork_dispatch(client_fd))
+   {
+      pgagroal_disconnect(client_fd);
+      return;
+   }
+
+   pid = fork();
+   if (pid == -1)
+   {
+      /* No process */
+      pgagroal_log_error("Cannot create process");
+   }
+   else if (pid > 0)
+   {
+      add_client(pid);
+   }
+   else
+   {
+      char* addr = calloc(1, strlen(address) + 1);
+      if (addr == NULL)
+      {
+         pgagroal_log_fatal("Cannot allocate memory for client address");
+         return;
+      }
+      memcpy(addr, address, strlen(address));
+
+      /* Prevent SIGINT sent to the parent's controlling terminal
+       * from irradiating to the children. pgagroal wants the
+       * children processes to be independent. */
+      if (setpgid(0, 0) == -1)
+      {
+         pgagroal_log_error("setpgid error: %s", __func__, strerror(errno));
+         exit(1);
+      }
+
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      /* We are leaving the socket descriptor valid such that the client won't reuse it */
+      pgagroal_worker(client_fd, addr, argv_ptr);
+   }
+   pgagroal_disconnect(client_fd);
+}
+
+static void
+accept_mgt_cb(struct io_watcher* watcher)
+{
+   int client_fd;
+   int32_t id;
+   pid_t pid;
+   char* str = NULL;
+   time_t start_time;
+   time_t end_time;
+   uint8_t compression = MANAGEMENT_COMPRESSION_NONE;
+   uint8_t encryption = MANAGEMENT_ENCRYPTION_NONE;
+   struct accept_io* ai;
+   struct json* payload = NULL;
+   struct json* header = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   ai = (struct accept_io*)watcher;
+
+   errno = 0;
+
+   client_fd = watcher->fds.main.client_fd;
+
+   pgagroal_prometheus_self_sockets_add();
+
+   if (client_fd == -1)
+   {
+      if (accept_fatal(errno) && config->keep_running)
+      {
+         pgagroal_log_warn("Restarting management due to: %s (%d)", strerror(errno), client_fd);
+
+         shutdown_mgt(false);
+
+         if (pgagroal_bind_unix_socket(config->unix_socket_dir, MAIN_UDS, &unix_management_socket))
+         {
+            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
+            exit(1);
+         }
+
+         start_mgt();
+
+         pgagroal_log_debug("Management: %d", unix_management_socket);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      else
       {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Invalid master key file: <%s>", admins_path);
-#endif
-         errx(1, "Invalid master key file (file <%s>)", admins_path);
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+      errno = 0;
+      return;
+   }
+
+   /* Process management request */
+   if (pgagroal_management_read_json(NULL, client_fd, &compression, &encryption, &payload))
+   {
+      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_BAD_PAYLOAD, compression, encryption, NULL);
+      pgagroal_log_error("Management: Bad payload (%d)", MANAGEMENT_ERROR_BAD_PAYLOAD);
+      goto error;
+   }
+
+   header = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_HEADER);
+   id = (int32_t)pgagroal_json_get(header, MANAGEMENT_ARGUMENT_COMMAND);
+
+   str = pgagroal_json_to_string(payload, FORMAT_JSON, NULL, 0);
+   pgagroal_log_debug("Management %d: %s", id, str);
+
+   if (id == MANAGEMENT_FLUSH)
+   {
+      struct json* req = NULL;
+      int flush_mode = -1;
+      int64_t req_timeout = -1;
+      char* req_database = NULL;
+
+      pgagroal_log_debug("pgagroal: Management flush");
+
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      if (req != NULL)
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "Too many admins defined %d (max %d)", config->number_of_admins, NUMBER_OF_ADMINS);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s %s", message, admins_path);
-#endif
-         errx(1, "%s (file <%s>)", message, admins_path);
+         flush_mode = (int)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_MODE);
+         req_timeout = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_TIMEOUT);
+         req_database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+
+      pid = fork();
+      if (pid == -1)
       {
-         memcpy(&config->admins_path[0], admins_path, MIN(strlen(admins_path), MAX_PATH - 1));
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_FLUSH_NOFORK, compression, encryption, payload);
+         pgagroal_log_error("Flush: No fork (%d)", MANAGEMENT_ERROR_FLUSH_NOFORK);
+         goto error;
+      }
+      else if (pid == 0)
+      {
+         struct json* pyl = NULL;
+
+         shutdown_ports(true);
+
+         pgagroal_json_clone(payload, &pyl);
+
+         pgagroal_set_proc_title(1, ai->argv, "flush", NULL);
+         pgagroal_request_flush(NULL, client_fd, compression, encryption, pyl);
+      }
+      else
+      {
+         if (flush_mode == FLUSH_GRACEFULLY)
+         {
+            int64_t conf_secs = pgagroal_time_is_valid(config->flush_timeout)
+                                   ? pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S)
+                                   : 0;
+            int64_t secs = (req_timeout >= 0) ? req_timeout : conf_secs;
+            if (secs > 0 && atomic_load(&config->active_connections) > 0)
+            {
+               arm_flush_timeout(secs, req_database);
+            }
+         }
       }
    }
-   else
+   else if (id == MANAGEMENT_ENABLEDB)
    {
-      // the user did not specify a file on the command line
-      // so try the default one and allow it to be missing
-      admins_path = PGAGROAL_DEFAULT_ADMINS_FILE;
-      conf_file_mandatory = false;
-      goto read_admins_path;
-   }
+      struct json* req = NULL;
+      struct json* res = NULL;
+      struct json* databases = NULL;
+      char* database = NULL;
 
-   conf_file_mandatory = true;
-read_superuser_path:
-   if (superuser_path != NULL)
+      pgagroal_log_debug("pgagroal: Management enabledb: ");
+      pgagroal_pool_status();
+
+      start_time = time(NULL);
+
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
+
+      pgagroal_management_create_response(payload, -1, &res);
+      pgagroal_json_create(&databases);
+
+      if (!strcmp("all", database))
+      {
+         struct json* js = NULL;
+
+         config->all_disabled = false;
+         memset(&config->disabled, 0, sizeof(config->disabled));
+
+         pgagroal_json_create(&js);
+
+         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
+         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)true, ValueBool);
+
+         pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+      }
+      else
+      {
+         bool found = false;
+         for (int i = 0; !found && i < NUMBER_OF_DISABLED; i++)
+         {
+            struct json* js = NULL;
+
+            if (!strcmp(config->disabled[i], database))
+            {
+               memset(&config->disabled[i], 0, MAX_DATABASE_LENGTH);
+
+               pgagroal_json_create(&js);
+
+               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
+               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)true, ValueBool);
+
+               pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+
+               found = true;
+            }
+         }
+      }
+
+      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_DATABASES, (uintptr_t)databases, ValueJSON);
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_DISABLEDB)
    {
-      ret = pgagroal_read_superuser_configuration(shmem, superuser_path);
-      memset(message, 0, MISC_LENGTH);
-      if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_NOT_FOUND && conf_file_mandatory)
+      struct json* req = NULL;
+      struct json* res = NULL;
+      struct json* databases = NULL;
+      char* database = NULL;
+
+      pgagroal_log_debug("pgagroal: Management disabledb: ");
+      pgagroal_pool_status();
+
+      start_time = time(NULL);
+
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
+
+      pgagroal_management_create_response(payload, -1, &res);
+      pgagroal_json_create(&databases);
+
+      config->all_disabled = false;
+
+      if (!strcmp("*", database) || !strcmp("all", database))
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "SUPERUSER configuration file not found");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, superuser_path);
-#endif
-         errx(1, "%s (file <%s>)", message, superuser_path);
+         struct json* js = NULL;
+
+         config->all_disabled = true;
+         memset(&config->disabled, 0, sizeof(config->disabled));
+
+         pgagroal_json_create(&js);
+
+         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
+         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+
+         pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_CANNOT_DECRYPT || ret == PGAGROAL_CONFIGURATION_STATUS_KO)
+      else
       {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Invalid master key file: <%s>", superuser_path);
-#endif
-         errx(1, "Invalid master key file (file <%s>)", superuser_path);
+         bool inserted = false;
+         for (int i = 0; !inserted && i < NUMBER_OF_DISABLED; i++)
+         {
+            struct json* js = NULL;
+
+            if (strlen(config->disabled[i]) == 0)
+            {
+               memcpy(&config->disabled[i], database, strlen(database) > MAX_DATABASE_LENGTH ? MAX_DATABASE_LENGTH : strlen(database));
+
+               pgagroal_json_create(&js);
+
+               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
+               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+
+               pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+
+               inserted = true;
+            }
+         }
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_FILE_TOO_BIG)
+
+      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_DATABASES, (uintptr_t)databases, ValueJSON);
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_GRACEFULLY)
+   {
+      struct json* req = NULL;
+      int64_t req_timeout = -1;
+      int64_t secs = 0;
+
+      pgagroal_log_debug("pgagroal: Management gracefully");
+      pgagroal_pool_status();
+
+      start_time = time(NULL);
+
+      config->gracefully = true;
+
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      if (req != NULL)
       {
-         pgagroal_snprintf(message, MISC_LENGTH, "SUPERUSER: Too many superusers defined (max 1)");
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=%s: %s", message, superuser_path);
-#endif
-         errx(1, "%s (file <%s>)", message, superuser_path);
+         req_timeout = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_TIMEOUT);
+      }
+      {
+         int64_t conf_secs = pgagroal_time_is_valid(config->flush_timeout)
+                                ? pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S)
+                                : 0;
+         secs = (req_timeout >= 0) ? req_timeout : conf_secs;
       }
-      else if (ret == PGAGROAL_CONFIGURATION_STATUS_OK)
+      if (secs > 0 && atomic_load(&config->active_connections) > 0)
       {
-         memcpy(&config->superuser_path[0], superuser_path, MIN(strlen(superuser_path), MAX_PATH - 1));
+         start_periodic_watcher(&shutdown_timeout_watcher, &shutdown_timeout_started,
+                                shutdown_timeout_cb, secs * 1000, 0);
       }
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-   else
+   else if (id == MANAGEMENT_SHUTDOWN)
    {
-      // the user did not specify a file on the command line
-      // so try the default one and allow it to be missing
-      superuser_path = PGAGROAL_DEFAULT_SUPERUSER_FILE;
-      conf_file_mandatory = false;
-      goto read_superuser_path;
+      pgagroal_log_debug("pgagroal: Management shutdown");
+      pgagroal_pool_status();
+
+      start_time = time(NULL);
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+
+      config->keep_running = false;
+
+      pgagroal_event_loop_break();
    }
+   else if (id == MANAGEMENT_CANCEL_SHUTDOWN)
+   {
+      pgagroal_log_debug("pgagroal: Management cancel shutdown");
+      pgagroal_pool_status();
 
-   /* systemd sockets */
-#ifdef HAVE_SYSTEMD
-   sds = sd_listen_fds(0);
-   if (sds > 0)
+      start_time = time(NULL);
+      stop_periodic_watcher(&shutdown_timeout_watcher, &shutdown_timeout_started);
+      config->gracefully = false;
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_STATUS)
    {
-      int m = 0;
+      struct timeval tv;
 
-      main_fds_length = 0;
+      pgagroal_log_debug("pgagroal: Management status");
+      pgagroal_pool_status();
 
-      for (int i = 0; i < sds; i++)
-      {
-         int fd = SD_LISTEN_FDS_START + i;
+      /* Served from shared memory, so frequent polling doesn't fork the main process.
+       * A client that doesn't read the response only holds us up until the send timeout */
+      tv.tv_sec = MAX(pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S), 1);
+      tv.tv_usec = 0;
 
-         if (sd_is_socket(fd, AF_INET, 0, -1) || sd_is_socket(fd, AF_INET6, 0, -1))
-         {
-            main_fds_length++;
-         }
+      if (setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+      {
+         pgagroal_log_debug("Status: %s", strerror(errno));
+         errno = 0;
       }
 
-      if (main_fds_length > 0)
+      pgagroal_status(NULL, client_fd, compression, encryption, payload, &status_writer);
+   }
+   else if (id == MANAGEMENT_DETAILS)
+   {
+      pgagroal_log_debug("pgagroal: Management details");
+      pgagroal_pool_status();
+
+      /* The details grow with the connections, so they are sent from a process of their own */
+      pid = fork();
+      if (pid == -1)
       {
-         main_fds = malloc(main_fds_length * sizeof(int));
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_STATUS_NOFORK, compression, encryption, payload);
+         pgagroal_log_error("Status: No fork %s (%d)", NULL, MANAGEMENT_ERROR_STATUS_NOFORK);
+         goto error;
       }
-
-      for (int i = 0; i < sds; i++)
+      else if (pid == 0)
       {
-         int fd = SD_LISTEN_FDS_START + i;
+         struct json* pyl = NULL;
 
-         if (sd_is_socket(fd, AF_UNIX, 0, -1))
-         {
-            unix_pgsql_socket = fd;
-            has_unix_socket = true;
-            pgagroal_socket_nonblocking(fd);
-         }
-         else if (sd_is_socket(fd, AF_INET, 0, -1) || sd_is_socket(fd, AF_INET6, 0, -1))
+         shutdown_ports(true);
+
+         pgagroal_json_clone(payload, &pyl);
+
+         pgagroal_set_proc_title(1, ai->argv, "status", NULL);
+
+         if (pgagroal_status_details(NULL, client_fd, compression, encryption, pyl, &status_writer))
          {
-            main_fds[m] = fd;
-            has_main_sockets = true;
-            pgagroal_socket_nonblocking(fd);
-            m++;
+            exit(1);
          }
+
+         exit(0);
       }
    }
-#endif
-
-   if (pgagroal_init_logging())
+   else if (id == MANAGEMENT_PING)
    {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Failed to init logging");
-#endif
-      exit(1);
-   }
+      struct json* response = NULL;
+      struct json* servers = NULL;
 
-   if (pgagroal_start_logging())
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Failed to start logging");
-#endif
-      errx(1, "Failed to start logging");
-   }
+      pgagroal_log_debug("pgagroal: Management ping");
 
-   if (config->common.metrics > 0)
-   {
-      if (pgagroal_init_prometheus(&prometheus_shmem_size, &prometheus_shmem))
-      {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Error in creating and initializing prometheus shared memory");
-#endif
-         errx(1, "Error in creating and initializing prometheus shared memory");
-      }
+      start_time = time(NULL);
 
-      if (pgagroal_init_prometheus_cache(&prometheus_cache_shmem_size, &prometheus_cache_shmem))
+      pgagroal_management_create_response(payload, -1, &response);
+      pgagroal_json_create(&servers);
+
+      FOREACH_VALID_SERVER
       {
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Error in creating and initializing prometheus cache shared memory");
-#endif
-         errx(1, "Error in creating and initializing prometheus cache shared memory");
-      }
-   }
+         struct json* sobj = NULL;
+         char* srv_status = NULL;
+         char* srv_primary = NULL;
+         int64_t behind_bytes = -1;
 
-   if (pgagroal_validate_configuration(shmem, has_unix_socket, has_main_sockets))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid configuration");
-#endif
-      errx(1, "Invalid configuration");
-   }
+         if (strlen(config->servers[i].name) == 0)
+         {
+            continue;
+         }
 
-   frontend_user_password_startup(config);
+         pgagroal_server_get_connectivity_info(i, &srv_status, &srv_primary, &behind_bytes);
 
-   if (pgagroal_validate_hba_configuration(shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid HBA configuration");
-#endif
-      errx(1, "Invalid HBA configuration");
-   }
-   if (pgagroal_validate_limit_configuration(shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid LIMIT configuration");
-#endif
-      errx(1, "Invalid LIMIT configuration");
-   }
-   if (pgagroal_validate_users_configuration(shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid USERS configuration");
-#endif
-      errx(1, "Invalid USERS configuration");
-   }
-   if (pgagroal_validate_frontend_users_configuration(shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid FRONTEND USERS configuration");
-#endif
-      errx(1, "Invalid FRONTEND USERS configuration");
-   }
-   if (pgagroal_validate_admins_configuration(shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Invalid ADMINS configuration");
-#endif
-      errx(1, "Invalid ADMINS configuration");
-   }
+         pgagroal_json_create(&sobj);
+         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
+         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
+         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)srv_status, ValueString);
+         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PRIMARY, (uintptr_t)srv_primary, ValueString);
+         if (behind_bytes >= 0)
+         {
+            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_BEHIND, (uintptr_t)behind_bytes, ValueInt64);
+         }
 
-   if (pgagroal_resize_shared_memory(shmem_size, shmem, &tmp_size, &tmp_shmem))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Error in creating shared memory");
-#endif
-      errx(1, "Error in creating shared memory");
-   }
-   if (pgagroal_destroy_shared_memory(shmem, shmem_size) == -1)
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Error in destroying shared memory");
-#endif
-      errx(1, "Error in destroying shared memory");
-   }
-   shmem_size = tmp_size;
-   shmem = tmp_shmem;
-   config = (struct main_configuration*)shmem;
+         pgagroal_json_put(servers, config->servers[i].name, (uintptr_t)sobj, ValueJSON);
+      }
 
-   pgagroal_memory_init();
+      pgagroal_json_put(response, MANAGEMENT_ARGUMENT_SERVERS, (uintptr_t)servers, ValueJSON);
 
-   if (getrlimit(RLIMIT_NOFILE, &flimit) == -1)
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Unable to find limit due to %s", strerror(errno));
-#endif
-      err(1, "Unable to find limit");
-   }
+      /* Show invalid servers */
+      {
+         struct json* invalid_servers = NULL;
+         pgagroal_json_create(&invalid_servers);
 
-   /* We are "reserving" 30 file descriptors for pgagroal main */
-   if (config->max_connections > (flimit.rlim_cur - 30))
-   {
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0,
-                 "STATUS=max_connections is larger than the file descriptor limit (%ld available)",
-                 (long)(flimit.rlim_cur - 30));
-#endif
-      errx(1, "max_connections is larger than the file descriptor limit (%ld available)", (long)(flimit.rlim_cur - 30));
-   }
+         FOREACH_INVALID_SERVER
+         {
+            struct json* sobj = NULL;
 
-   if (daemon)
-   {
-      if (config->common.log_type == PGAGROAL_LOGGING_TYPE_CONSOLE)
-      {
-#ifdef HAVE_SYSTEMD
-         sd_notify(0, "STATUS=Daemon mode can't be used with console logging");
-#endif
-         errx(1, "Daemon mode can't be used with console logging");
-      }
+            if (strlen(config->servers[i].name) == 0)
+            {
+               continue;
+            }
+
+            pgagroal_json_create(&sobj);
+            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
+            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
+            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)"Invalid", ValueString);
 
-      pid = fork();
+            pgagroal_json_put(invalid_servers, config->servers[i].name, (uintptr_t)sobj, ValueJSON);
+         }
 
-      if (pid < 0)
-      {
-#ifdef HAVE_SYSTEMD
-         sd_notify(0, "STATUS=Daemon mode failed");
-#endif
-         errx(1, "Daemon mode failed");
+         pgagroal_json_put(response, "invalid_servers", (uintptr_t)invalid_servers, ValueJSON);
       }
 
-      if (pid > 0)
-      {
-         exit(0);
-      }
+      end_time = time(NULL);
 
-      /* We are a daemon now */
-      umask(0);
-      sid = setsid();
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_CLEAR)
+   {
+      pgagroal_log_debug("pgagroal: Management clear");
 
-      if (sid < 0)
-      {
-         exit(1);
-      }
+      start_time = time(NULL);
+
+      pgagroal_prometheus_clear();
+
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
+   else if (id == MANAGEMENT_CLEAR_SERVER)
+   {
+      pgagroal_log_debug("pgagroal: Management clear server");
+      char* server = NULL;
+      struct json* req = NULL;
 
-   create_pidfile_or_exit();
+      start_time = time(NULL);
 
-   pgagroal_pool_init();
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      server = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SERVER);
 
-   pgagroal_set_proc_title(argc, argv, "main", NULL);
+      pgagroal_server_clear(server);
+      pgagroal_prometheus_failed_servers();
 
-   free(os);
+      end_time = time(NULL);
 
-   /* Bind Unix Domain Socket: Main */
-   if (pgagroal_bind_unix_socket(config->unix_socket_dir, MAIN_UDS, &unix_management_socket))
-   {
-      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
-#endif
-      goto error;
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-
-   /* Bind Unix Domain Socket: Transfer */
-   if (pgagroal_bind_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &unix_transfer_socket))
+   else if (id == MANAGEMENT_CLEAR_AUTH_QUERY)
    {
-      pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
-#endif
-      goto error;
-   }
+      pgagroal_log_debug("pgagroal: Management clear auth_query");
+      char* username = NULL;
+      struct json* req = NULL;
+      int count;
 
-   if (!has_unix_socket)
-   {
-      char pgsql[MISC_LENGTH];
+      start_time = time(NULL);
 
-      memset(&pgsql, 0, sizeof(pgsql));
-      pgagroal_snprintf(&pgsql[0], sizeof(pgsql), PG_UDS);
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      username = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_USERNAME);
 
-      if (pgagroal_bind_unix_socket(config->unix_socket_dir, &pgsql[0], &unix_pgsql_socket))
+      if (username != NULL && !strcmp(username, "all"))
       {
-         pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
-#endif
-         goto error;
+         username = NULL;
       }
-   }
 
-   /* Bind main socket */
-   if (!has_main_sockets)
-   {
-      if (pgagroal_bind(config->common.host, config->common.port, &main_fds, &main_fds_length, config->nodelay, config->backlog))
-      {
-         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.port);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->common.port);
-#endif
-         goto error;
-      }
-   }
+      count = pgagroal_auth_query_cache_clear(username);
+      pgagroal_log_debug("pgagroal: Cleared %d authentication query entries", count);
 
-   if (main_fds_length > MAX_FDS)
-   {
-      pgagroal_log_fatal("pgagroal: Too many descriptors %d", main_fds_length);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Too many descriptors %d", main_fds_length);
-#endif
-      goto error;
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-   pgagroal_event_set_context(PGAGROAL_CONTEXT_MAIN);
-   main_loop = pgagroal_event_loop_init();
-   if (!main_loop)
+   else if (id == MANAGEMENT_SWITCH_TO)
    {
-      goto error;
-   }
-
-   pgagroal_signal_init(&signal_watcher[0].sig_w, shutdown_cb, SIGTERM);
-   pgagroal_signal_init(&signal_watcher[1].sig_w, reload_cb, SIGHUP);
-   pgagroal_signal_init(&signal_watcher[2].sig_w, shutdown_cb, SIGINT);
-   pgagroal_signal_init(&signal_watcher[3].sig_w, graceful_cb, SIGTRAP);
-   pgagroal_signal_init(&signal_watcher[4].sig_w, coredump_cb, SIGABRT);
-   pgagroal_signal_init(&signal_watcher[5].sig_w, shutdown_cb, SIGALRM);
-   pgagroal_signal_init(&signal_watcher[6].sig_w, sigchld_cb, SIGCHLD);
-   pgagroal_signal_init(&signal_watcher[7].sig_w, service_reload_cb, SIGUSR1);
+      pgagroal_log_debug("pgagroal: Management switch to");
+      int old_primary = -1;
+      signed char server_state;
+      char* server = NULL;
+      struct json* req = NULL;
 
-   signal_watcher[7].slot = -1;
-   pgagroal_signal_start(&signal_watcher[7].sig_w);
+      start_time = time(NULL);
 
-   for (int i = 0; i < SIGNALS_NUMBER; i++)
-   {
-      signal_watcher[i].slot = -1;
-      pgagroal_signal_start(&signal_watcher[i].sig_w);
-   }
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      server = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SERVER);
 
-   if (config->pipeline == PIPELINE_PERFORMANCE)
-   {
-      main_pipeline = performance_pipeline();
-   }
-   else if (config->pipeline == PIPELINE_SESSION)
-   {
-      if (pgagroal_tls_valid())
+      pgagroal_log_debug("pgagroal: Attempting to switch to server: %s", server);
+      for (int i = 0; old_primary == -1 && i < config->number_of_servers; i++)
       {
-         pgagroal_log_fatal("pgagroal: Invalid TLS configuration");
-#ifdef HAVE_SYSTEMD
-         sd_notify(0, "STATUS=Invalid TLS configuration");
-#endif
-         goto error;
+         server_state = atomic_load(&config->servers[i].state);
+         if (server_state == SERVER_PRIMARY)
+         {
+            old_primary = i;
+         }
       }
 
-      main_pipeline = session_pipeline();
-   }
-   else if (config->pipeline == PIPELINE_TRANSACTION)
-   {
-      if (pgagroal_tls_valid())
+      if (!pgagroal_server_switch(server))
       {
-         pgagroal_log_fatal("pgagroal: Invalid TLS configuration");
-#ifdef HAVE_SYSTEMD
-         sd_notify(0, "STATUS=Invalid TLS configuration");
-#endif
-         goto error;
+         pgagroal_log_info("pgagroal: Successfully switched to server: %s", server);
+         if (!fork())
+         {
+            shutdown_ports(false);
+            if (old_primary != -1)
+            {
+               pgagroal_flush_server(old_primary);
+            }
+            else
+            {
+               pgagroal_flush(FLUSH_GRACEFULLY, "*");
+               exit(0);
+            }
+         }
+         pgagroal_prometheus_failed_servers();
+         end_time = time(NULL);
+         pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+      }
+      else
+      {
+         pgagroal_log_warn("pgagroal: Failed to switch to server: %s (server not found or invalid)", server);
+         end_time = time(NULL);
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_SWITCH_TO_FAILED, compression, encryption, payload);
       }
-
-      main_pipeline = transaction_pipeline();
    }
-   else
+   else if (id == MANAGEMENT_RELOAD)
    {
-      pgagroal_log_fatal("pgagroal: Unknown pipeline identifier (%d)", config->pipeline);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Unknown pipeline identifier (%d)", config->pipeline);
-#endif
-      goto error;
-   }
+      bool restart = false;
+      struct json* res = NULL;
 
-   if (main_pipeline.initialize(shmem, &pipeline_shmem, &pipeline_shmem_size))
-   {
-      pgagroal_log_fatal("pgagroal: Pipeline initialize error (%d)", config->pipeline);
-#ifdef HAVE_SYSTEMD
-      sd_notifyf(0, "STATUS=Pipeline initialize error (%d)", config->pipeline);
-#endif
-      goto error;
-   }
+      pgagroal_log_debug("pgagroal: Management reload");
 
-   start_transfer();
-   start_mgt();
-   start_uds();
-   start_io();
+      start_time = time(NULL);
 
-   if (config->health_check)
-   {
-      pgagroal_health_check(argc, argv);
-   }
+      reload_configuration(&restart);
 
-   if (pgagroal_check_server_identifiers(true))
-   {
-      pgagroal_log_fatal("pgagroal: Duplicate server system identifiers detected");
-#ifdef HAVE_SYSTEMD
-      sd_notify(0, "STATUS=Duplicate server system identifiers detected");
-#endif
-      goto error;
-   }
+      pgagroal_management_create_response(payload, -1, &res);
 
-   refresh_periodic_watchers();
+      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_RESTART, (uintptr_t)restart, ValueBool);
 
-   if (config->common.metrics > 0)
+      end_time = time(NULL);
+
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_CONFIG_LS)
    {
-      /* Bind metrics socket */
-      if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, config->nodelay, config->backlog))
-      {
-         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->common.metrics);
-#endif
-         goto error;
-      }
+      struct json* response = NULL;
+
+      start_time = time(NULL);
+
+      pgagroal_management_create_response(payload, -1, &response);
+
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_MAIN_CONF_PATH, (uintptr_t)config->common.configuration_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_HBA_CONF_PATH, (uintptr_t)config->hba_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_LIMIT_CONF_PATH, (uintptr_t)config->limit_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_USER_CONF_PATH, (uintptr_t)config->users_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_FRONTEND_USERS_CONF_PATH, (uintptr_t)config->frontend_users_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_ADMIN_CONF_PATH, (uintptr_t)config->admins_path, ValueString);
+      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_SUPERUSER_CONF_PATH, (uintptr_t)config->superuser_path, ValueString);
 
-      if (metrics_fds_length > MAX_FDS)
-      {
-         pgagroal_log_fatal("pgagroal: Too many descriptors %d", metrics_fds_length);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Too many descriptors %d", metrics_fds_length);
-#endif
-         goto error;
-      }
+      end_time = time(NULL);
 
-      start_metrics();
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-
-   if (config->management > 0)
+   else if (id == MANAGEMENT_TRACKER)
    {
-      /* Bind management socket */
-      if (pgagroal_bind(config->common.host, config->management, &management_fds, &management_fds_length, config->nodelay, config->backlog))
-      {
-         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->management);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->management);
-#endif
-         goto error;
-      }
+      int64_t sequence = 0;
+      struct json* req = NULL;
+      struct json* response = NULL;
 
-      if (management_fds_length > MAX_FDS)
-      {
-         pgagroal_log_fatal("pgagroal: Too many descriptors %d", management_fds_length);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Too many descriptors %d", management_fds_length);
-#endif
-         goto error;
-      }
+      start_time = time(NULL);
 
-      start_management();
-   }
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      sequence = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SEQUENCE);
 
-   if (config->console > 0)
-   {
-      /* Bind console socket */
-      if (pgagroal_bind(config->common.host, config->console, &console_fds, &console_fds_length, config->nodelay, config->backlog))
-      {
-         pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->console);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Could not bind to %s:%d", config->common.host, config->console);
-#endif
-         goto error;
-      }
+      pgagroal_management_create_response(payload, -1, &response);
 
-      if (console_fds_length > MAX_FDS)
+      if (pgagroal_tracker_read(sequence > 0 ? (uint64_t)sequence : 0, response))
       {
-         pgagroal_log_fatal("pgagroal: Too many descriptors %d", console_fds_length);
-#ifdef HAVE_SYSTEMD
-         sd_notifyf(0, "STATUS=Too many descriptors %d", console_fds_length);
-#endif
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_TRACKER_ERROR, compression, encryption, payload);
+         pgagroal_log_error("Tracker: Error (%d)", MANAGEMENT_ERROR_TRACKER_ERROR);
          goto error;
       }
 
-      start_console();
-   }
+      end_time = time(NULL);
 
-   pgagroal_log_info("pgagroal: %s started on %s:%d",
-                     PGAGROAL_VERSION,
-                     config->common.host,
-                     config->common.port);
-   for (int i = 0; i < main_fds_length; i++)
-   {
-      pgagroal_log_debug("Socket: %d", *(main_fds + i));
-   }
-   pgagroal_log_debug("Unix Domain Socket: %d", unix_pgsql_socket);
-   pgagroal_log_debug("Management: %d", unix_management_socket);
-   pgagroal_log_debug("Transfer: %d", unix_transfer_socket);
-   for (int i = 0; i < metrics_fds_length; i++)
-   {
-      pgagroal_log_debug("Metrics: %d", *(metrics_fds + i));
-   }
-   for (int i = 0; i < management_fds_length; i++)
-   {
-      pgagroal_log_debug("Remote management: %d", *(management_fds + i));
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-   for (int i = 0; i < console_fds_length; i++)
+   else if (id == MANAGEMENT_SLOWLOG)
    {
-      pgagroal_log_debug("Console: %d", *(console_fds + i));
-   }
+      int64_t sequence = 0;
+      struct json* req = NULL;
+      struct json* response = NULL;
 
-   pgagroal_log_debug("Pipeline: %d", config->pipeline);
-   pgagroal_log_debug("Pipeline size: %lu", pipeline_shmem_size);
-   pgagroal_log_debug("%s", OpenSSL_version(OPENSSL_VERSION));
-   pgagroal_log_debug("Configuration size: %lu", shmem_size);
-   pgagroal_log_debug("Max connections: %d", config->max_connections);
-   pgagroal_log_debug("Known users: %d", config->number_of_users);
-   pgagroal_log_debug("Known frontend users: %d", config->number_of_frontend_users);
-   pgagroal_log_debug("Known admins: %d", config->number_of_admins);
-   pgagroal_log_debug("Known superuser: %s", strlen(config->superuser.username) > 0 ? "Yes" : "No");
+      start_time = time(NULL);
 
-   /* Retrieve and log the OS kernel version; this has no effect on Pgagroal's operation */
-   pgagroal_os_kernel_version(&os, &kernel_major, &kernel_minor, &kernel_patch);
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      sequence = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SEQUENCE);
 
-   if (!config->allow_unknown_users && config->number_of_users == 0)
-   {
-      pgagroal_log_warn("No users allowed");
-   }
+      pgagroal_management_create_response(payload, -1, &response);
 
-   if (pgagroal_can_prefill())
-   {
-      if (!fork())
+      if (pgagroal_slowlog_read(sequence > 0 ? (uint64_t)sequence : 0, response))
       {
-         pgagroal_event_loop_fork();
-         shutdown_ports(false);
-         pgagroal_prefill_if_can(false, true);
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_SLOWLOG_ERROR, compression, encryption, payload);
+         pgagroal_log_error("Slow log: Error (%d)", MANAGEMENT_ERROR_SLOWLOG_ERROR);
+         goto error;
       }
-   }
-
-#ifdef HAVE_SYSTEMD
-   sd_notifyf(0,
-              "READY=1\n"
-              "STATUS=Running\n"
-              "MAINPID=%lu",
-              (unsigned long)getpid());
-#endif
 
-   pgagroal_event_loop_run();
+      end_time = time(NULL);
 
-   pgagroal_log_info("pgagroal: shutdown");
-#ifdef HAVE_SYSTEMD
-   sd_notify(0, "STOPPING=1");
-#endif
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_ACTIVITY)
+   {
+      struct json* response = NULL;
 
-   config->keep_running = false;
+      start_time = time(NULL);
 
-   pgagroal_pool_shutdown();
+      pgagroal_management_create_response(payload, -1, &response);
 
-   if (clients != NULL)
-   {
-      struct client* c = clients;
-      while (c != NULL)
+      if (pgagroal_activity_read(response))
       {
-         if (kill(c->pid, SIGQUIT))
-         {
-            pgagroal_log_debug("kill: %s", strerror(errno));
-         }
-         c = c->next;
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_ACTIVITY_ERROR, compression, encryption, payload);
+         pgagroal_log_error("Activity: Error (%d)", MANAGEMENT_ERROR_ACTIVITY_ERROR);
+         goto error;
       }
-   }
 
-   for (int i = 0; i < management_fds_length; i++)
-   {
-      pgagroal_io_stop(&io_management[i].watcher);
-   }
-   pgagroal_health_check_stop();
-   shutdown_management(true);
+      end_time = time(NULL);
 
-   for (int i = 0; i < console_fds_length; i++)
-   {
-      pgagroal_io_stop(&io_console[i].watcher);
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
    }
-   shutdown_console();
-
-   for (int i = 0; i < metrics_fds_length; i++)
+   else if (id == MANAGEMENT_CLUSTER)
    {
-      pgagroal_io_stop(&io_metrics[i].watcher);
-   }
-   shutdown_metrics();
-
-   shutdown_mgt(true);
-   shutdown_transfer(true);
-   shutdown_io();
-
-   pgagroal_io_stop(&io_uds.watcher);
-   shutdown_uds(true);
+      struct json* response = NULL;
 
-   pgagroal_event_loop_destroy();
+      start_time = time(NULL);
 
-   free(os);
-   free(main_fds);
-   free(metrics_fds);
-   free(management_fds);
-   free(console_fds);
+      pgagroal_management_create_response(payload, -1, &response);
 
-   main_pipeline.destroy(pipeline_shmem, pipeline_shmem_size);
+      if (pgagroal_cluster_report(response))
+      {
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CLUSTER_ERROR, compression, encryption, payload);
+         pgagroal_log_error("Cluster: Error (%d)", MANAGEMENT_ERROR_CLUSTER_ERROR);
+         goto error;
+      }
 
-   remove_pidfile();
+      end_time = time(NULL);
 
-   pgagroal_stop_logging();
-   pgagroal_destroy_shared_memory(prometheus_shmem, prometheus_shmem_size);
-   pgagroal_destroy_shared_memory(prometheus_cache_shmem, prometheus_cache_shmem_size);
-   pgagroal_destroy_shared_memory(shmem, shmem_size);
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_CONFIG_GET)
+   {
+      pid = fork();
+      if (pid == -1)
+      {
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_GET_NOFORK, compression, encryption, payload);
+         pgagroal_log_error("Conf Get: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_GET_NOFORK);
+         goto error;
+      }
+      else if (pid == 0)
+      {
+         struct json* pyl = NULL;
 
-   pgagroal_memory_destroy();
+         shutdown_ports(true);
 
-   return 0;
+         pgagroal_json_clone(payload, &pyl);
 
-error:
+         pgagroal_set_proc_title(1, ai->argv, "conf get", NULL);
+         pgagroal_conf_get(NULL, client_fd, compression, encryption, pyl);
+         pgagroal_json_destroy(pyl);
+         exit(0);
+      }
+   }
+   else if (id == MANAGEMENT_CONFIG_SET)
+   {
+      pid = fork();
+      if (pid == -1)
+      {
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_SET_NOFORK, compression, encryption, payload);
+         pgagroal_log_error("Conf Set: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_SET_NOFORK);
+         goto error;
+      }
+      else if (pid == 0)
+      {
+         struct json* pyl = NULL;
 
-   free(os);
-   remove_pidfile();
-   exit(1);
-}
+         shutdown_ports(true);
 
-static void
-accept_main_cb(struct io_watcher* watcher)
-{
-   struct sockaddr_in6 client_addr;
-   int client_fd;
-   char address[INET6_ADDRSTRLEN];
-   pid_t pid;
-   struct accept_io* ai;
-   struct main_configuration* config;
+         pgagroal_json_clone(payload, &pyl);
 
-   ai = (struct accept_io*)watcher;
-   config = (struct main_configuration*)shmem;
+         pgagroal_set_proc_title(1, ai->argv, "conf set", NULL);
+         reload_set_configuration(NULL, client_fd, compression, encryption, pyl);
+         pgagroal_json_destroy(pyl);
+         exit(0);
+      }
+   }
+   else if (id == MANAGEMENT_CONFIG_ALIAS)
+   {
+      pid = fork();
+      if (pid == -1)
+      {
+         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_ALIAS_NOFORK, compression, encryption, payload);
+         pgagroal_log_error("Config Alias: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_ALIAS_NOFORK);
+         goto error;
+      }
+      else if (pid == 0)
+      {
+         struct json* pyl = NULL;
 
-   errno = 0;
+         shutdown_ports(true);
 
-   memset(&address, 0, sizeof(address));
+         pgagroal_json_clone(payload, &pyl);
 
-   client_fd = watcher->fds.main.client_fd;
-   if (client_fd == -1)
+         pgagroal_set_proc_title(1, ai->argv, "conf alias", NULL);
+         pgagroal_management_config_alias(NULL, client_fd, compression, encryption, pyl);
+         // Add cleanup - this is needed because we're in a child process
+         pgagroal_json_destroy(pyl);
+         exit(0);
+      }
+   }
+   else if (id == MANAGEMENT_GET_PASSWORD)
    {
-      if (accept_fatal(errno) && config->keep_running)
-      {
-         char pgsql[MISC_LENGTH];
-
-         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
+      int index = -1;
+      char* username = NULL;
+      struct json* req = NULL;
+      struct json* res = NULL;
 
-         shutdown_io();
-         pgagroal_io_stop(&io_uds.watcher);
-         shutdown_uds(true);
+      start_time = time(NULL);
 
-         memset(&pgsql, 0, sizeof(pgsql));
-         pgagroal_snprintf(&pgsql[0], sizeof(pgsql), PG_UDS);
+      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+      username = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_USERNAME);
 
-         if (pgagroal_bind_unix_socket(config->unix_socket_dir, &pgsql[0], &unix_pgsql_socket))
+      for (int i = 0; index == -1 && i < config->number_of_frontend_users; i++)
+      {
+         if (!strcmp(&config->frontend_users[i].username[0], username))
          {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &pgsql[0], config->common.port);
-            exit(1);
+            index = i;
          }
+      }
 
-         free(main_fds);
-         main_fds = NULL;
-         main_fds_length = 0;
+      pgagroal_management_create_response(payload, -1, &res);
 
-         if (pgagroal_bind(config->common.host, config->common.port, &main_fds, &main_fds_length, config->nodelay, config->backlog))
-         {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.port);
-            exit(1);
-         }
+      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)username, ValueString);
 
-         if (main_fds_length > MAX_FDS)
-         {
-            pgagroal_log_fatal("pgagroal: Too many descriptors %d", main_fds_length);
-            exit(1);
-         }
+      if (index != -1)
+      {
+         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_PASSWORD, (uintptr_t)config->frontend_users[index].password, ValueString);
+      }
+      else
+      {
+         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_PASSWORD, (uintptr_t)NULL, ValueString);
+      }
 
-         if (!fork())
-         {
-            shutdown_ports(false);
-            pgagroal_flush(FLUSH_GRACEFULLY, "*");
-            exit(0);
-         }
+      end_time = time(NULL);
 
-         start_io();
-         start_uds();
+      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   }
+   else
+   {
+      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_UNKNOWN_COMMAND, compression, encryption, payload);
+      pgagroal_log_error("Unknown: %s (%d)", pgagroal_json_to_string(payload, FORMAT_JSON, NULL, 0), MANAGEMENT_ERROR_UNKNOWN_COMMAND);
+      goto error;
+   }
 
-         for (int i = 0; i < main_fds_length; i++)
+   if (config->gracefully)
+   {
+      if (config->keep_running)
+      {
+         if (atomic_load(&config->active_connections) == 0)
          {
-            pgagroal_log_debug("Socket: %d", *(main_fds + i));
+            pgagroal_log_debug("pgagroal: graceful shutdown triggered  - connections=0, gracefully=true, keep_running=true");
+            pgagroal_pool_status();
+            pgagroal_event_loop_break();
          }
-         pgagroal_log_debug("Unix Domain Socket: %d", unix_pgsql_socket);
       }
       else
       {
-         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+         pgagroal_log_info("pgagroal: graceful shutdown check skipped - server shutdown already in progress (keep_running=false)");
       }
-      errno = 0;
-      return;
    }
 
-   pgagroal_prometheus_client_sockets_add();
+   free(str);
 
-   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
-   socklen_t client_addr_length = sizeof(struct sockaddr_in6);
-   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
+   pgagroal_json_destroy(payload);
 
-   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
+   pgagroal_disconnect(client_fd);
 
-   pgagroal_log_trace("accept_main_cb: client address: %s", address);
+   pgagroal_prometheus_self_sockets_sub();
 
-   pid = fork();
-   if (pid == -1)
-   {
-      /* No process */
-      pgagroal_log_error("Cannot create process");
-   }
-   else if (pid > 0)
-   {
-      add_client(pid);
-   }
-   else
-   {
-      char* addr = calloc(1, strlen(address) + 1);
-      if (addr == NULL)
-      {
-         pgagroal_log_fatal("Cannot allocate memory for client address");
-         return;
-      }
-      memcpy(addr, address, strlen(address));
+   return;
 
-      /* Prevent SIGINT sent to the parent's controlling terminal
-       * from irradiating to the children. pgagroal wants the
-       * children processes to be independent. */
-      if (setpgid(0, 0) == -1)
-      {
-         pgagroal_log_error("setpgid error: %s", __func__, strerror(errno));
-         exit(1);
-      }
+error:
+
+   free(str);
 
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      /* We are leaving the socket descriptor valid such that the client won't reuse it */
-      pgagroal_worker(client_fd, addr, ai->argv);
-   }
    pgagroal_disconnect(client_fd);
+
+   pgagroal_prometheus_self_sockets_sub();
+
+   return;
 }
 
 static void
-accept_mgt_cb(struct io_watcher* watcher)
+accept_transfer_cb(struct io_watcher* watcher)
 {
    int client_fd;
-   int32_t id;
-   pid_t pid;
-   char* str = NULL;
-   time_t start_time;
-   time_t end_time;
-   uint8_t compression = MANAGEMENT_COMPRESSION_NONE;
-   uint8_t encryption = MANAGEMENT_ENCRYPTION_NONE;
-   struct accept_io* ai;
-   struct json* payload = NULL;
-   struct json* header = NULL;
+   int id = -1;
+   pid_t pid = 0;
+   int32_t slot = -1;
+   int fd = -1;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
-   ai = (struct accept_io*)watcher;
 
    errno = 0;
 
@@ -1652,19 +3762,19 @@ accept_mgt_cb(struct io_watcher* watcher)
    {
       if (accept_fatal(errno) && config->keep_running)
       {
-         pgagroal_log_warn("Restarting management due to: %s (%d)", strerror(errno), client_fd);
+         pgagroal_log_warn("Restarting transfer due to: %s (%d)", strerror(errno), client_fd);
 
          shutdown_mgt(false);
 
-         if (pgagroal_bind_unix_socket(config->unix_socket_dir, MAIN_UDS, &unix_management_socket))
+         if (pgagroal_bind_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &unix_transfer_socket))
          {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, MAIN_UDS, config->common.port);
+            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
             exit(1);
          }
 
          start_mgt();
 
-         pgagroal_log_debug("Management: %d", unix_management_socket);
+         pgagroal_log_debug("Transfer: %d", unix_transfer_socket);
       }
       else
       {
@@ -1674,1367 +3784,1580 @@ accept_mgt_cb(struct io_watcher* watcher)
       return;
    }
 
-   /* Process management request */
-   if (pgagroal_management_read_json(NULL, client_fd, &compression, &encryption, &payload))
-   {
-      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_BAD_PAYLOAD, compression, encryption, NULL);
-      pgagroal_log_error("Management: Bad payload (%d)", MANAGEMENT_ERROR_BAD_PAYLOAD);
-      goto error;
-   }
-
-   header = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_HEADER);
-   id = (int32_t)pgagroal_json_get(header, MANAGEMENT_ARGUMENT_COMMAND);
-
-   str = pgagroal_json_to_string(payload, FORMAT_JSON, NULL, 0);
-   pgagroal_log_debug("Management %d: %s", id, str);
-
-   if (id == MANAGEMENT_FLUSH)
+   /* Process transfer requests, a worker sends a batch of them on one connection */
+   while (transfer_pending(client_fd))
    {
-      struct json* req = NULL;
-      int flush_mode = -1;
-      int64_t req_timeout = -1;
-      char* req_database = NULL;
-
-      pgagroal_log_debug("pgagroal: Management flush");
-
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      if (req != NULL)
-      {
-         flush_mode = (int)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_MODE);
-         req_timeout = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_TIMEOUT);
-         req_database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
-      }
-
-      pid = fork();
-      if (pid == -1)
+      if (pgagroal_connection_id_read(client_fd, &id))
       {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_FLUSH_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Flush: No fork (%d)", MANAGEMENT_ERROR_FLUSH_NOFORK);
          goto error;
       }
-      else if (pid == 0)
+
+      if (id == CONNECTION_TRANSFER)
       {
-         struct json* pyl = NULL;
+         pgagroal_log_trace("pgagroal: Transfer connection");
 
-         shutdown_ports(true);
+         if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+         {
+            pgagroal_log_error("pgagroal: Transfer connection: Slot %d FD %d", slot, fd);
+            goto error;
+         }
 
-         pgagroal_json_clone(payload, &pyl);
+         fd = reserve_fd(slot, fd);
+         if (fd == -1)
+         {
+            goto error;
+         }
 
-         pgagroal_set_proc_title(1, ai->argv, "flush", NULL);
-         pgagroal_request_flush(NULL, client_fd, compression, encryption, pyl);
-      }
-      else
-      {
-         if (flush_mode == FLUSH_GRACEFULLY)
+         config->connections[slot].fd = fd;
+         known_fds[slot] = config->connections[slot].fd;
+         known_fds_generation++;
+
+         /* Acceptors fork workers too, so they must hold the same descriptors as we do */
+         for (int i = 1; i < config->acceptors; i++)
          {
-            int64_t conf_secs = pgagroal_time_is_valid(config->flush_timeout)
-                                   ? pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S)
-                                   : 0;
-            int64_t secs = (req_timeout >= 0) ? req_timeout : conf_secs;
-            if (secs > 0 && atomic_load(&config->active_connections) > 0)
+            if (acceptor_pids[i] > 0 && send_fd(acceptor_pids[i], CONNECTION_CLIENT_FD, slot))
             {
-               arm_flush_timeout(secs, req_database);
+               goto error;
             }
          }
-      }
-   }
-   else if (id == MANAGEMENT_ENABLEDB)
-   {
-      struct json* req = NULL;
-      struct json* res = NULL;
-      struct json* databases = NULL;
-      char* database = NULL;
 
-      pgagroal_log_debug("pgagroal: Management enabledb: ");
-      pgagroal_pool_status();
+         if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
+         {
+            for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
+            {
+               pid_t pid = (pid_t)atomic_load(&config->clients[i]);
 
-      start_time = time(NULL);
+               if (pid > 0 && send_fd(pid, CONNECTION_CLIENT_FD, slot))
+               {
+                  goto error;
+               }
+            }
+         }
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
+         pgagroal_log_debug("pgagroal: Transfer connection: Slot %d FD %d", slot, fd);
+      }
+      else if (id == CONNECTION_RETURN)
+      {
+         pgagroal_log_trace("pgagroal: Transfer return connection");
 
-      pgagroal_management_create_response(payload, -1, &res);
-      pgagroal_json_create(&databases);
+         if (pgagroal_connection_slot_read(client_fd, &slot))
+         {
+            pgagroal_log_error("pgagroal: Transfer return connection: Slot %d", slot);
+            goto error;
+         }
 
-      if (!strcmp("all", database))
+         pgagroal_log_debug("pgagroal: Transfer return connection: Slot %d", slot);
+      }
+      else if (id == CONNECTION_KILL)
       {
-         struct json* js = NULL;
+         pgagroal_log_trace("pgagroal: Transfer kill connection");
 
-         config->all_disabled = false;
-         memset(&config->disabled, 0, sizeof(config->disabled));
-
-         pgagroal_json_create(&js);
+         if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+         {
+            pgagroal_log_error("pgagroal: Transfer kill connection: Slot %d FD %d", slot, fd);
+            goto error;
+         }
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)true, ValueBool);
+         if (known_fds[slot] == fd)
+         {
+            if (forget_fd(slot))
+            {
+               goto error;
+            }
+         }
 
-         pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+         pgagroal_log_debug("pgagroal: Transfer kill connection: Slot %d FD %d", slot, fd);
       }
-      else
+      else if (id == CONNECTION_CLIENT_DONE)
       {
-         bool found = false;
-         for (int i = 0; !found && i < NUMBER_OF_DISABLED; i++)
+         pgagroal_log_debug("pgagroal: Transfer client done");
+
+         if (pgagroal_connection_pid_read(client_fd, &pid))
          {
-            struct json* js = NULL;
+            pgagroal_log_error("pgagroal: Transfer client done: PID %d", (int)pid);
+            goto error;
+         }
 
-            if (!strcmp(config->disabled[i], database))
-            {
-               memset(&config->disabled[i], 0, MAX_DATABASE_LENGTH);
+         remove_client(pid);
+         hand_over_drained();
 
-               pgagroal_json_create(&js);
+         pgagroal_log_debug("pgagroal: Transfer client done: PID %d", (int)pid);
+      }
+      else if (id == CONNECTION_TAKEOVER)
+      {
+         pgagroal_log_debug("pgagroal: Transfer takeover");
 
-               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
-               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)true, ValueBool);
+         hand_over(client_fd);
+         break;
+      }
+      else if (id == CONNECTION_TUNNEL)
+      {
+         char address[MISC_LENGTH];
 
-               pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+         memset(&address, 0, sizeof(address));
 
-               found = true;
-            }
+         if (pgagroal_connection_buffer_read(client_fd, &address[0], sizeof(address)) ||
+             pgagroal_connection_transfer_read(client_fd, &slot, &fd))
+         {
+            pgagroal_log_error("pgagroal: Transfer tunnel client: FD %d", fd);
+            goto error;
          }
-      }
 
-      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_DATABASES, (uintptr_t)databases, ValueJSON);
+         address[sizeof(address) - 1] = '\0';
 
-      end_time = time(NULL);
+         pgagroal_log_debug("pgagroal: Transfer tunnel client: %s", &address[0]);
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+         /* The client of an edge, served as if it was accepted here */
+         pgagroal_prometheus_client_sockets_add();
+         dispatch_client(fd, &address[0]);
+      }
+      else
+      {
+         goto error;
+      }
    }
-   else if (id == MANAGEMENT_DISABLEDB)
-   {
-      struct json* req = NULL;
-      struct json* res = NULL;
-      struct json* databases = NULL;
-      char* database = NULL;
 
-      pgagroal_log_debug("pgagroal: Management disabledb: ");
-      pgagroal_pool_status();
+   pgagroal_disconnect(client_fd);
 
-      start_time = time(NULL);
+   pgagroal_prometheus_self_sockets_sub();
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      database = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_DATABASE);
+   return;
 
-      pgagroal_management_create_response(payload, -1, &res);
-      pgagroal_json_create(&databases);
+error:
 
-      config->all_disabled = false;
+   pgagroal_disconnect(client_fd);
 
-      if (!strcmp("*", database) || !strcmp("all", database))
-      {
-         struct json* js = NULL;
+   pgagroal_prometheus_self_sockets_sub();
+}
 
-         config->all_disabled = true;
-         memset(&config->disabled, 0, sizeof(config->disabled));
+/**
+ * Wait for the next transfer request on a connection
+ * @param client_fd The descriptor
+ * @return true if there is a request, false if the peer is done
+ */
+static bool
+transfer_pending(int client_fd)
+{
+   char peek;
+   ssize_t r;
 
-         pgagroal_json_create(&js);
+   do
+   {
+      r = recv(client_fd, &peek, 1, MSG_PEEK);
+   }
+   while (r == -1 && errno == EINTR);
 
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
-         pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+   errno = 0;
 
-         pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
-      }
-      else
-      {
-         bool inserted = false;
-         for (int i = 0; !inserted && i < NUMBER_OF_DISABLED; i++)
-         {
-            struct json* js = NULL;
+   return r > 0;
+}
 
-            if (strlen(config->disabled[i]) == 0)
-            {
-               memcpy(&config->disabled[i], database, strlen(database) > MAX_DATABASE_LENGTH ? MAX_DATABASE_LENGTH : strlen(database));
+static void
+accept_metrics_cb(struct io_watcher* watcher)
+{
+   int client_fd;
+   struct main_configuration* config;
+   SSL_CTX* ctx = NULL;
+   SSL* client_ssl = NULL;
 
-               pgagroal_json_create(&js);
+   config = (struct main_configuration*)shmem;
 
-               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_DATABASE, (uintptr_t)database, ValueString);
-               pgagroal_json_put(js, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+   errno = 0;
 
-               pgagroal_json_append(databases, (uintptr_t)js, ValueJSON);
+   client_fd = watcher->fds.main.client_fd;
 
-               inserted = true;
-            }
-         }
-      }
+   pgagroal_prometheus_self_sockets_add();
 
-      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_DATABASES, (uintptr_t)databases, ValueJSON);
+   if (client_fd == -1)
+   {
+      if (accept_fatal(errno) && config->keep_running)
+      {
+         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
 
-      end_time = time(NULL);
+         for (int i = 0; i < metrics_fds_length; i++)
+         {
+            pgagroal_io_stop(&io_metrics[i].watcher);
+         }
+         shutdown_metrics();
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_GRACEFULLY)
-   {
-      struct json* req = NULL;
-      int64_t req_timeout = -1;
-      int64_t secs = 0;
+         free(metrics_fds);
+         metrics_fds = NULL;
+         metrics_fds_length = 0;
 
-      pgagroal_log_debug("pgagroal: Management gracefully");
-      pgagroal_pool_status();
+         if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, config->nodelay, config->backlog, false))
+         {
+            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
+            exit(1);
+         }
 
-      start_time = time(NULL);
+         if (metrics_fds_length > MAX_FDS)
+         {
+            pgagroal_log_fatal("pgagroal: Too many descriptors %d", metrics_fds_length);
+            exit(1);
+         }
 
-      config->gracefully = true;
+         start_metrics();
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      if (req != NULL)
-      {
-         req_timeout = (int64_t)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_TIMEOUT);
+         for (int i = 0; i < metrics_fds_length; i++)
+         {
+            pgagroal_log_debug("Metrics: %d", *(metrics_fds + i));
+         }
       }
+      else
       {
-         int64_t conf_secs = pgagroal_time_is_valid(config->flush_timeout)
-                                ? pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S)
-                                : 0;
-         secs = (req_timeout >= 0) ? req_timeout : conf_secs;
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
       }
-      if (secs > 0 && atomic_load(&config->active_connections) > 0)
+      errno = 0;
+      return;
+   }
+
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      if (strlen(config->common.metrics_cert_file) > 0 && strlen(config->common.metrics_key_file) > 0)
       {
-         start_periodic_watcher(&shutdown_timeout_watcher, &shutdown_timeout_started,
-                                shutdown_timeout_cb, secs * 1000, 0);
+         if (pgagroal_create_ssl_ctx(false, &ctx))
+         {
+            pgagroal_log_error("Could not create metrics SSL context");
+            pgagroal_disconnect(client_fd);
+            exit(1);
+         }
+
+         if (pgagroal_create_ssl_server(ctx, config->common.metrics_key_file, config->common.metrics_cert_file, config->common.metrics_ca_file, client_fd, &client_ssl))
+         {
+            pgagroal_log_error("Could not create metrics SSL server");
+            pgagroal_disconnect(client_fd);
+            exit(1);
+         }
       }
+      /* We are leaving the socket descriptor valid such that the client won't reuse it */
+      pgagroal_prometheus(client_ssl, client_fd);
+   }
 
-      end_time = time(NULL);
+   pgagroal_close_ssl(client_ssl);
+   pgagroal_disconnect(client_fd);
+   pgagroal_prometheus_self_sockets_sub();
+}
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_SHUTDOWN)
-   {
-      pgagroal_log_debug("pgagroal: Management shutdown");
-      pgagroal_pool_status();
+static void
+accept_management_cb(struct io_watcher* watcher)
+{
+   struct sockaddr_in6 client_addr;
+   int client_fd;
+   char address[INET6_ADDRSTRLEN];
+   struct main_configuration* config;
 
-      start_time = time(NULL);
+   memset(&address, 0, sizeof(address));
 
-      end_time = time(NULL);
+   config = (struct main_configuration*)shmem;
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
+   client_fd = watcher->fds.main.client_fd;
 
-      config->keep_running = false;
+   pgagroal_prometheus_self_sockets_add();
 
-      pgagroal_event_loop_break();
-   }
-   else if (id == MANAGEMENT_CANCEL_SHUTDOWN)
+   if (client_fd == -1)
    {
-      pgagroal_log_debug("pgagroal: Management cancel shutdown");
-      pgagroal_pool_status();
+      if (accept_fatal(errno) && config->keep_running)
+      {
+         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
 
-      start_time = time(NULL);
-      stop_periodic_watcher(&shutdown_timeout_watcher, &shutdown_timeout_started);
-      config->gracefully = false;
+         for (int i = 0; i < management_fds_length; i++)
+         {
+            pgagroal_io_stop(&io_management[i].watcher);
+         }
+         shutdown_management(false);
 
-      end_time = time(NULL);
+         free(management_fds);
+         management_fds = NULL;
+         management_fds_length = 0;
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_STATUS)
-   {
-      pgagroal_log_debug("pgagroal: Management status");
-      pgagroal_pool_status();
+         if (pgagroal_bind(config->common.host, config->management, &management_fds, &management_fds_length, config->nodelay, config->backlog, false))
+         {
+            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->management);
+            exit(1);
+         }
 
-      pid = fork();
-      if (pid == -1)
-      {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_STATUS_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Status: No fork %s (%d)", NULL, MANAGEMENT_ERROR_STATUS_NOFORK);
-         goto error;
+         if (management_fds_length > MAX_FDS)
+         {
+            pgagroal_log_fatal("pgagroal: Too many descriptors %d", management_fds_length);
+            exit(1);
+         }
+
+         start_management();
+
+         for (int i = 0; i < management_fds_length; i++)
+         {
+            pgagroal_log_debug("Remote management: %d", *(management_fds + i));
+         }
       }
-      else if (pid == 0)
+      else
       {
-         struct json* pyl = NULL;
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      }
+      errno = 0;
+      return;
+   }
 
-         shutdown_ports(true);
+   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
+   socklen_t client_addr_length = sizeof(struct sockaddr_in6);
+   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
 
-         pgagroal_json_clone(payload, &pyl);
+   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
 
-         pgagroal_set_proc_title(1, ai->argv, "status", NULL);
-         pgagroal_status(NULL, client_fd, compression, encryption, pyl);
-      }
-   }
-   else if (id == MANAGEMENT_DETAILS)
+   if (!fork())
    {
-      pgagroal_log_debug("pgagroal: Management details");
-      pgagroal_pool_status();
-
-      pid = fork();
-      if (pid == -1)
+      char* addr = calloc(1, strlen(address) + 1);
+      if (addr == NULL)
       {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_STATUS_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Status: No fork %s (%d)", NULL, MANAGEMENT_ERROR_STATUS_NOFORK);
-         goto error;
+         pgagroal_log_fatal("Couldn't allocate address");
+         return;
       }
-      else if (pid == 0)
-      {
-         struct json* pyl = NULL;
-
-         shutdown_ports(true);
-
-         pgagroal_json_clone(payload, &pyl);
+      memcpy(addr, address, strlen(address));
 
-         pgagroal_set_proc_title(1, ai->argv, "status", NULL);
-         pgagroal_status_details(NULL, client_fd, compression, encryption, pyl);
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      /* A session can stay open past a restart, so it doesn't keep the main port bound */
+      for (int i = 0; i < main_fds_length; i++)
+      {
+         pgagroal_disconnect(io_main[i].socket);
       }
+      /* We are leaving the socket descriptor valid such that the client won't reuse it */
+      pgagroal_remote_management(client_fd, addr);
+      exit(0);
    }
-   else if (id == MANAGEMENT_PING)
-   {
-      struct json* response = NULL;
-      struct json* servers = NULL;
 
-      pgagroal_log_debug("pgagroal: Management ping");
+   pgagroal_disconnect(client_fd);
+   pgagroal_prometheus_self_sockets_sub();
+}
 
-      start_time = time(NULL);
+static void
+accept_tunnel_cb(struct io_watcher* watcher)
+{
+   struct sockaddr_in6 client_addr;
+   int client_fd;
+   char address[INET6_ADDRSTRLEN];
+   struct main_configuration* config;
 
-      pgagroal_management_create_response(payload, -1, &response);
-      pgagroal_json_create(&servers);
+   memset(&address, 0, sizeof(address));
 
-      FOREACH_VALID_SERVER
+   config = (struct main_configuration*)shmem;
+
+   client_fd = watcher->fds.main.client_fd;
+
+   if (client_fd == -1)
+   {
+      if (accept_fatal(errno) && config->keep_running)
       {
-         struct json* sobj = NULL;
-         char* srv_status = NULL;
-         char* srv_primary = NULL;
-         int64_t behind_bytes = -1;
+         pgagroal_log_warn("Restarting tunnel port due to: %s (%d)", strerror(errno), client_fd);
 
-         if (strlen(config->servers[i].name) == 0)
+         for (int i = 0; i < tunnel_fds_length; i++)
          {
-            continue;
+            pgagroal_io_stop(&io_tunnel[i].watcher);
          }
+         shutdown_tunnel();
 
-         pgagroal_server_get_connectivity_info(i, &srv_status, &srv_primary, &behind_bytes);
+         free(tunnel_fds);
+         tunnel_fds = NULL;
+         tunnel_fds_length = 0;
 
-         pgagroal_json_create(&sobj);
-         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
-         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
-         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)srv_status, ValueString);
-         pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PRIMARY, (uintptr_t)srv_primary, ValueString);
-         if (behind_bytes >= 0)
+         if (pgagroal_bind(config->common.host, config->tunnel_port, &tunnel_fds, &tunnel_fds_length, config->nodelay, config->backlog, false))
          {
-            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_BEHIND, (uintptr_t)behind_bytes, ValueInt64);
+            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->tunnel_port);
+            exit(1);
          }
 
-         pgagroal_json_put(servers, config->servers[i].name, (uintptr_t)sobj, ValueJSON);
-      }
-
-      pgagroal_json_put(response, MANAGEMENT_ARGUMENT_SERVERS, (uintptr_t)servers, ValueJSON);
-
-      /* Show invalid servers */
-      {
-         struct json* invalid_servers = NULL;
-         pgagroal_json_create(&invalid_servers);
-
-         FOREACH_INVALID_SERVER
+         if (tunnel_fds_length > MAX_FDS)
          {
-            struct json* sobj = NULL;
-
-            if (strlen(config->servers[i].name) == 0)
-            {
-               continue;
-            }
+            pgagroal_log_fatal("pgagroal: Too many descriptors %d", tunnel_fds_length);
+            exit(1);
+         }
 
-            pgagroal_json_create(&sobj);
-            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_HOST, (uintptr_t)config->servers[i].host, ValueString);
-            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_PORT, (uintptr_t)config->servers[i].port, ValueInt32);
-            pgagroal_json_put(sobj, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)"Invalid", ValueString);
+         start_tunnel();
 
-            pgagroal_json_put(invalid_servers, config->servers[i].name, (uintptr_t)sobj, ValueJSON);
+         for (int i = 0; i < tunnel_fds_length; i++)
+         {
+            pgagroal_log_debug("Tunnel: %d", *(tunnel_fds + i));
          }
-
-         pgagroal_json_put(response, "invalid_servers", (uintptr_t)invalid_servers, ValueJSON);
       }
+      else
+      {
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+      }
+      errno = 0;
+      return;
+   }
 
-      end_time = time(NULL);
+   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
+   socklen_t client_addr_length = sizeof(struct sockaddr_in6);
+   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_CLEAR)
+   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
+
+   if (!fork())
    {
-      pgagroal_log_debug("pgagroal: Management clear");
+      char* addr = calloc(1, strlen(address) + 1);
+      if (addr == NULL)
+      {
+         pgagroal_log_fatal("Couldn't allocate address");
+         exit(1);
+      }
+      memcpy(addr, address, strlen(address));
 
-      start_time = time(NULL);
+      if (setpgid(0, 0) == -1)
+      {
+         pgagroal_log_error("setpgid error: %s", strerror(errno));
+         exit(1);
+      }
 
-      pgagroal_prometheus_clear();
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      /* A link stays open past a restart, so it doesn't keep the main port bound */
+      for (int i = 0; i < main_fds_length; i++)
+      {
+         pgagroal_disconnect(io_main[i].socket);
+      }
+      pgagroal_tunnel_serve(client_fd, addr, argv_ptr);
+   }
 
-      end_time = time(NULL);
+   pgagroal_disconnect(client_fd);
+}
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_CLEAR_SERVER)
-   {
-      pgagroal_log_debug("pgagroal: Management clear server");
-      char* server = NULL;
-      struct json* req = NULL;
+static void
+accept_console_cb(struct io_watcher* watcher)
+{
+   int client_fd;
+   struct main_configuration* config;
 
-      start_time = time(NULL);
+   config = (struct main_configuration*)shmem;
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      server = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SERVER);
+   errno = 0;
 
-      pgagroal_server_clear(server);
-      pgagroal_prometheus_failed_servers();
+   client_fd = watcher->fds.main.client_fd;
 
-      end_time = time(NULL);
+   pgagroal_prometheus_self_sockets_add();
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_SWITCH_TO)
+   if (client_fd == -1)
    {
-      pgagroal_log_debug("pgagroal: Management switch to");
-      int old_primary = -1;
-      signed char server_state;
-      char* server = NULL;
-      struct json* req = NULL;
+      if (accept_fatal(errno) && config->keep_running)
+      {
+         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
 
-      start_time = time(NULL);
+         for (int i = 0; i < console_fds_length; i++)
+         {
+            pgagroal_io_stop(&io_console[i].watcher);
+         }
+         shutdown_console();
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      server = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_SERVER);
+         free(console_fds);
+         console_fds = NULL;
+         console_fds_length = 0;
 
-      pgagroal_log_debug("pgagroal: Attempting to switch to server: %s", server);
-      for (int i = 0; old_primary == -1 && i < config->number_of_servers; i++)
-      {
-         server_state = atomic_load(&config->servers[i].state);
-         if (server_state == SERVER_PRIMARY)
+         if (pgagroal_bind(config->common.host, config->console, &console_fds, &console_fds_length, config->nodelay, config->backlog, false))
          {
-            old_primary = i;
+            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->console);
+            exit(1);
          }
-      }
 
-      if (!pgagroal_server_switch(server))
-      {
-         pgagroal_log_info("pgagroal: Successfully switched to server: %s", server);
-         if (!fork())
+         if (console_fds_length > MAX_FDS)
          {
-            shutdown_ports(false);
-            if (old_primary != -1)
-            {
-               pgagroal_flush_server(old_primary);
-            }
-            else
-            {
-               pgagroal_flush(FLUSH_GRACEFULLY, "*");
-               exit(0);
-            }
+            pgagroal_log_fatal("pgagroal: Too many descriptors %d", console_fds_length);
+            exit(1);
+         }
+
+         start_console();
+
+         for (int i = 0; i < console_fds_length; i++)
+         {
+            pgagroal_log_debug("Console: %d", *(console_fds + i));
          }
-         pgagroal_prometheus_failed_servers();
-         end_time = time(NULL);
-         pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
       }
       else
       {
-         pgagroal_log_warn("pgagroal: Failed to switch to server: %s (server not found or invalid)", server);
-         end_time = time(NULL);
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_SWITCH_TO_FAILED, compression, encryption, payload);
+         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
       }
+      errno = 0;
+      return;
    }
-   else if (id == MANAGEMENT_RELOAD)
-   {
-      bool restart = false;
-      struct json* res = NULL;
-
-      pgagroal_log_debug("pgagroal: Management reload");
-
-      start_time = time(NULL);
-
-      reload_configuration(&restart);
-
-      pgagroal_management_create_response(payload, -1, &res);
 
-      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_RESTART, (uintptr_t)restart, ValueBool);
-
-      end_time = time(NULL);
-
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_CONFIG_LS)
+   /* The console process serves from its cached page, otherwise the request renders its own */
+   if (pgagroal_console_hand_off(client_fd) && !fork())
    {
-      struct json* response = NULL;
-
-      start_time = time(NULL);
-
-      pgagroal_management_create_response(payload, -1, &response);
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      /* We are leaving the socket descriptor valid such that the client won't reuse it */
+      pgagroal_console(NULL, client_fd);
+   }
 
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_MAIN_CONF_PATH, (uintptr_t)config->common.configuration_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_HBA_CONF_PATH, (uintptr_t)config->hba_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_LIMIT_CONF_PATH, (uintptr_t)config->limit_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_USER_CONF_PATH, (uintptr_t)config->users_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_FRONTEND_USERS_CONF_PATH, (uintptr_t)config->frontend_users_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_ADMIN_CONF_PATH, (uintptr_t)config->admins_path, ValueString);
-      pgagroal_json_put(response, CONFIGURATION_ARGUMENT_SUPERUSER_CONF_PATH, (uintptr_t)config->superuser_path, ValueString);
+   pgagroal_disconnect(client_fd);
+   pgagroal_prometheus_self_sockets_sub();
+}
 
-      end_time = time(NULL);
+static void
+shutdown_cb(void)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else if (id == MANAGEMENT_CONFIG_GET)
-   {
-      pid = fork();
-      if (pid == -1)
-      {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_GET_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Conf Get: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_GET_NOFORK);
-         goto error;
-      }
-      else if (pid == 0)
-      {
-         struct json* pyl = NULL;
+   pgagroal_log_debug("pgagroal: shutdown requested");
+   config->keep_running = false;
+   pgagroal_pool_status();
+   pgagroal_health_check_stop();
+   pgagroal_event_loop_break();
+}
 
-         shutdown_ports(true);
+static void
+reload_cb(void)
+{
+   bool restart = false;
+   pgagroal_log_debug("pgagroal: reload requested");
+   reload_configuration(&restart);
+}
 
-         pgagroal_json_clone(payload, &pyl);
+static void
+graceful_cb(void)
+{
+   struct main_configuration* config;
 
-         pgagroal_set_proc_title(1, ai->argv, "conf get", NULL);
-         pgagroal_conf_get(NULL, client_fd, compression, encryption, pyl);
-         pgagroal_json_destroy(pyl);
-         exit(0);
-      }
-   }
-   else if (id == MANAGEMENT_CONFIG_SET)
-   {
-      pid = fork();
-      if (pid == -1)
-      {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_SET_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Conf Set: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_SET_NOFORK);
-         goto error;
-      }
-      else if (pid == 0)
-      {
-         struct json* pyl = NULL;
+   config = (struct main_configuration*)shmem;
 
-         shutdown_ports(true);
+   pgagroal_log_debug("pgagroal: gracefully requested");
 
-         pgagroal_json_clone(payload, &pyl);
+   pgagroal_pool_status();
+   config->gracefully = true;
 
-         pgagroal_set_proc_title(1, ai->argv, "conf set", NULL);
-         reload_set_configuration(NULL, client_fd, compression, encryption, pyl);
-         pgagroal_json_destroy(pyl);
-         exit(0);
-      }
+   /* After a hand over the clients without a connection are waited for too */
+   if (config->handed_over > 0)
+   {
+      hand_over_drained();
    }
-   else if (id == MANAGEMENT_CONFIG_ALIAS)
+   else if (atomic_load(&config->active_connections) == 0)
    {
-      pid = fork();
-      if (pid == -1)
-      {
-         pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_CONF_ALIAS_NOFORK, compression, encryption, payload);
-         pgagroal_log_error("Config Alias: No fork %s (%d)", NULL, MANAGEMENT_ERROR_CONF_ALIAS_NOFORK);
-         goto error;
-      }
-      else if (pid == 0)
-      {
-         struct json* pyl = NULL;
+      pgagroal_pool_status();
 
-         shutdown_ports(true);
+      pgagroal_event_loop_break();
+   }
+}
 
-         pgagroal_json_clone(payload, &pyl);
+static void
+coredump_cb(void)
+{
+   pgagroal_log_info("pgagroal: core dump requested");
+   pgagroal_pool_status();
+   remove_pidfile();
+   abort();
+}
 
-         pgagroal_set_proc_title(1, ai->argv, "conf alias", NULL);
-         pgagroal_management_config_alias(NULL, client_fd, compression, encryption, pyl);
-         // Add cleanup - this is needed because we're in a child process
-         pgagroal_json_destroy(pyl);
-         exit(0);
-      }
-   }
-   else if (id == MANAGEMENT_GET_PASSWORD)
-   {
-      int index = -1;
-      char* username = NULL;
-      struct json* req = NULL;
-      struct json* res = NULL;
+static void
+sigchld_cb(void)
+{
+   pid_t pid;
+   struct log_ring* ring;
+   struct main_configuration* config;
 
-      start_time = time(NULL);
+   config = (struct main_configuration*)shmem;
+   ring = (struct log_ring*)log_shmem;
 
-      req = (struct json*)pgagroal_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
-      username = (char*)pgagroal_json_get(req, MANAGEMENT_ARGUMENT_USERNAME);
+   while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+   {
+      /* A worker that exited without telling us is no longer sent the descriptors */
+      remove_client(pid);
+      prefork_remove(pid);
+      hand_over_drained();
 
-      for (int i = 0; index == -1 && i < config->number_of_frontend_users; i++)
+      if (pid == cancel_pid)
       {
-         if (!strcmp(&config->frontend_users[i].username[0], username))
+         shutdown_cancel();
+
+         if (config->keep_running)
          {
-            index = i;
+            pgagroal_log_warn("pgagroal: Cancel handler (PID %d) exited", (int)pid);
+            start_cancel();
          }
       }
 
-      pgagroal_management_create_response(payload, -1, &res);
+      if (ring != NULL && atomic_load(&ring->pid) == pid)
+      {
+         atomic_store(&ring->pid, 0);
 
-      pgagroal_json_put(res, MANAGEMENT_ARGUMENT_USERNAME, (uintptr_t)username, ValueString);
+         if (config->keep_running && atomic_load(&ring->running))
+         {
+            pgagroal_log_warn("pgagroal: Logger (PID %d) exited", (int)pid);
+            pgagroal_log_ring_start();
+         }
+      }
 
-      if (index != -1)
+      for (int i = 0; i < config->multiplex_workers; i++)
       {
-         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_PASSWORD, (uintptr_t)config->frontend_users[index].password, ValueString);
+         if (config->multiplex_pid[i] == pid)
+         {
+            pgagroal_log_warn("pgagroal: Multiplexer %d (PID %d) exited", i, (int)pid);
+            config->multiplex_pid[i] = 0;
+
+            if (config->keep_running)
+            {
+               start_multiplex(i);
+            }
+         }
       }
-      else
+
+      for (int i = 0; i < config->tunnel_links; i++)
       {
-         pgagroal_json_put(res, MANAGEMENT_ARGUMENT_PASSWORD, (uintptr_t)NULL, ValueString);
+         if (config->tunnel_pid[i] == pid)
+         {
+            pgagroal_log_warn("pgagroal: Tunnel link %d (PID %d) exited", i, (int)pid);
+            config->tunnel_pid[i] = 0;
+
+            if (config->keep_running && strlen(config->tunnel) > 0)
+            {
+               start_tunnel_link(i);
+            }
+         }
       }
 
-      end_time = time(NULL);
+      if (config->notify_pid == pid)
+      {
+         pgagroal_log_warn("pgagroal: Notification relay (PID %d) exited", (int)pid);
+         config->notify_pid = 0;
 
-      pgagroal_management_response_ok(NULL, client_fd, start_time, end_time, compression, encryption, payload);
-   }
-   else
-   {
-      pgagroal_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_UNKNOWN_COMMAND, compression, encryption, payload);
-      pgagroal_log_error("Unknown: %s (%d)", pgagroal_json_to_string(payload, FORMAT_JSON, NULL, 0), MANAGEMENT_ERROR_UNKNOWN_COMMAND);
-      goto error;
-   }
+         if (config->keep_running)
+         {
+            start_notify();
+         }
+      }
 
-   if (config->gracefully)
-   {
-      if (config->keep_running)
+      if (config->console_pid == pid)
       {
-         if (atomic_load(&config->active_connections) == 0)
+         pgagroal_log_warn("pgagroal: Console (PID %d) exited", (int)pid);
+         config->console_pid = 0;
+
+         if (config->keep_running && config->console > 0)
          {
-            pgagroal_log_debug("pgagroal: graceful shutdown triggered  - connections=0, gracefully=true, keep_running=true");
-            pgagroal_pool_status();
-            pgagroal_event_loop_break();
+            start_console_cache();
          }
       }
-      else
+
+      for (int i = 1; i < config->acceptors; i++)
       {
-         pgagroal_log_info("pgagroal: graceful shutdown check skipped - server shutdown already in progress (keep_running=false)");
+         if (acceptor_pids[i] == pid)
+         {
+            pgagroal_log_warn("pgagroal: Acceptor %d (PID %d) exited", i, (int)pid);
+            acceptor_pids[i] = 0;
+
+            if (config->keep_running)
+            {
+               start_acceptor(i);
+            }
+         }
       }
    }
+}
 
-   free(str);
-
-   pgagroal_json_destroy(payload);
-
-   pgagroal_disconnect(client_fd);
+static void
+idle_timeout_cb(void)
+{
+   /* pgagroal_idle_timeout() is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      pgagroal_idle_timeout();
+   }
+}
 
-   pgagroal_prometheus_self_sockets_sub();
+static void
+adaptive_pool_cb(void)
+{
+   /* pgagroal_adaptive_pool() is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      pgagroal_adaptive_pool();
+   }
+}
 
-   return;
+static void
+cluster_cb(void)
+{
+   /* pgagroal_cluster_exchange() is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      pgagroal_cluster_exchange();
+   }
+}
 
-error:
+static void
+max_connection_age_cb(void)
+{
+   /* max_connection_age() is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      pgagroal_max_connection_age();
+   }
+}
 
-   free(str);
+static void
+validation_cb(void)
+{
+   /* pgagroal_validation() is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      pgagroal_validation();
+   }
+}
 
-   pgagroal_disconnect(client_fd);
+static void
+disconnect_client_cb(void)
+{
+   /* main_pipeline.periodic is always in a fork() */
+   if (!fork())
+   {
+      pgagroal_event_loop_fork();
+      shutdown_ports(false);
+      main_pipeline.periodic();
+   }
+}
 
-   pgagroal_prometheus_self_sockets_sub();
+static void
+shutdown_timeout_cb(void)
+{
+   struct main_configuration* config = (struct main_configuration*)shmem;
 
-   return;
+   pgagroal_log_warn("pgagroal: shutdown timeout expired - forcing immediate shutdown");
+   config->gracefully = false;
+   config->keep_running = false;
+   pgagroal_event_loop_break();
 }
 
 static void
-accept_transfer_cb(struct io_watcher* watcher)
+flush_alarm_cb(void)
 {
-   int client_fd;
-   int id = -1;
-   pid_t pid = 0;
-   int32_t slot = -1;
-   int fd = -1;
+   struct timespec now;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
+   bool fired = false;
 
-   errno = 0;
-
-   client_fd = watcher->fds.main.client_fd;
+   stop_periodic_watcher(&flush_alarm, &flush_alarm_started);
 
-   pgagroal_prometheus_self_sockets_add();
+   clock_gettime(CLOCK_MONOTONIC, &now);
 
-   if (client_fd == -1)
+   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
    {
-      if (accept_fatal(errno) && config->keep_running)
+      char db[MAX_DATABASE_LENGTH];
+
+      if (!flush_timeouts[i].in_use)
       {
-         pgagroal_log_warn("Restarting transfer due to: %s (%d)", strerror(errno), client_fd);
+         continue;
+      }
 
-         shutdown_mgt(false);
+      if (flush_timeouts[i].expires_at.tv_sec > now.tv_sec ||
+          (flush_timeouts[i].expires_at.tv_sec == now.tv_sec &&
+           flush_timeouts[i].expires_at.tv_nsec > now.tv_nsec))
+      {
+         continue;
+      }
 
-         if (pgagroal_bind_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &unix_transfer_socket))
+      memcpy(db, flush_timeouts[i].database, sizeof(db));
+      flush_timeouts[i].in_use = false;
+      memset(flush_timeouts[i].database, 0, sizeof(flush_timeouts[i].database));
+      fired = true;
+
+      if (atomic_load(&config->active_connections) > 0)
+      {
+         pgagroal_log_warn("pgagroal: flush timeout expired - forcing FLUSH_ALL on database '%s'",
+                           db[0] ? db : "*");
+         if (!fork())
          {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
-            exit(1);
+            pgagroal_flush(FLUSH_ALL, db[0] ? db : "*");
+            exit(0);
          }
-
-         start_mgt();
-
-         pgagroal_log_debug("Transfer: %d", unix_transfer_socket);
       }
       else
       {
-         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+         pgagroal_log_info("pgagroal: flush timeout fired but no active connections remain, skipping");
       }
-      errno = 0;
-      return;
    }
 
-   /* Process transfer request */
-   if (pgagroal_connection_id_read(client_fd, &id))
+   if (fired)
    {
-      goto error;
+      pgagroal_pool_status();
    }
 
-   if (id == CONNECTION_TRANSFER)
-   {
-      pgagroal_log_trace("pgagroal: Transfer connection");
+   rearm_flush_alarm();
+}
 
-      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
-      {
-         pgagroal_log_error("pgagroal: Transfer connection: Slot %d FD %d", slot, fd);
-         goto error;
-      }
+static void
+rotate_frontend_password_cb(void)
+{
+   char* pwd;
+   struct main_configuration* config;
 
-      config->connections[slot].fd = fd;
-      known_fds[slot] = config->connections[slot].fd;
+   config = (struct main_configuration*)shmem;
 
-      if (config->pipeline == PIPELINE_TRANSACTION)
+   for (int i = 0; i < config->number_of_frontend_users; i++)
+   {
+      if (pgagroal_generate_password(config->rotate_frontend_password_length, &pwd))
       {
-         struct client* c = clients;
-         while (c != NULL)
-         {
-            int c_fd = -1;
+         pgagroal_log_debug("rotate_frontend_password_cb: unable to rotate password");
+         return;
+      }
+      config->frontend_users[i].verifier = false;
+      memcpy(&config->frontend_users[i].password, pwd, strlen(pwd) + 1);
+      pgagroal_scram_verifier(&config->frontend_users[i]);
+      pgagroal_log_trace("rotate_frontend_password_cb: current pass for username=%s:%s", config->frontend_users[i].username, config->frontend_users[i].password);
+      free(pwd);
+   }
+}
 
-            if (pgagroal_connection_get_pid(c->pid, &c_fd))
-            {
-               goto error;
-            }
+static void
+rotate_tls_ticket_keys_cb(void)
+{
+   pgagroal_tls_rotate_ticket_keys();
+}
 
-            if (pgagroal_connection_id_write(c_fd, CONNECTION_CLIENT_FD))
-            {
-               goto error;
-            }
+static bool
+accept_fatal(int error)
+{
+   switch (error)
+   {
+      case EAGAIN:
+      case ENETDOWN:
+      case EPROTO:
+      case ENOPROTOOPT:
+      case EHOSTDOWN:
+#ifdef HAVE_LINUX
+      case ENONET:
+#endif
+      case EHOSTUNREACH:
+      case EOPNOTSUPP:
+      case ENETUNREACH:
+         return false;
+         break;
+   }
 
-            if (pgagroal_connection_transfer_write(c_fd, slot))
-            {
-               goto error;
-            }
+   return true;
+}
 
-            pgagroal_disconnect(c_fd);
+static void
+frontend_user_password_startup(struct main_configuration* config)
+{
+   char* pwd = NULL;
 
-            c = c->next;
+   if (config->number_of_frontend_users == 0 && pgagroal_time_is_valid(config->rotate_frontend_password_timeout))
+   {
+      for (int i = 0; i < config->number_of_users; i++)
+      {
+         memcpy(&config->frontend_users[i].username, config->users[i].username, strlen(config->users[i].username));
+         if (pgagroal_generate_password(config->rotate_frontend_password_length, &pwd))
+         {
+            pgagroal_log_debug("frontend_user_password_startup: unable to generate random password at startup");
+            return;
          }
+         memcpy(&config->frontend_users[i].password, pwd, strlen(pwd) + 1);
+         pgagroal_log_trace("frontend_user_password_startup: frontend user with username=%s initiated", config->frontend_users[i].username);
+         free(pwd);
       }
-
-      pgagroal_log_debug("pgagroal: Transfer connection: Slot %d FD %d", slot, fd);
+      config->number_of_frontend_users = config->number_of_users;
    }
-   else if (id == CONNECTION_RETURN)
-   {
-      pgagroal_log_trace("pgagroal: Transfer return connection");
+}
 
-      if (pgagroal_connection_slot_read(client_fd, &slot))
-      {
-         pgagroal_log_error("pgagroal: Transfer return connection: Slot %d", slot);
-         goto error;
-      }
+static void
+add_client(pid_t pid)
+{
+   int index;
+   struct main_configuration* config;
 
-      pgagroal_log_debug("pgagroal: Transfer return connection: Slot %d", slot);
-   }
-   else if (id == CONNECTION_KILL)
-   {
-      pgagroal_log_trace("pgagroal: Transfer kill connection");
+   config = (struct main_configuration*)shmem;
 
-      if (pgagroal_connection_transfer_read(client_fd, &slot, &fd))
-      {
-         pgagroal_log_error("pgagroal: Transfer kill connection: Slot %d FD %d", slot, fd);
-         goto error;
-      }
+   /* Acceptors register their workers as well, so claim a free or deleted entry with
+    * a CAS. An entry is only left once it holds a PID, such that a lookup that stops
+    * at a free entry never misses a PID placed after it */
+   index = (int)(pid % NUMBER_OF_CLIENTS);
+
+   for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
+   {
+      int expected;
 
-      if (known_fds[slot] == fd)
+      while ((expected = atomic_load(&config->clients[index])) <= CLIENT_ENTRY_FREE)
       {
-         struct client* c = clients;
-         while (c != NULL)
+         if (atomic_compare_exchange_strong(&config->clients[index], &expected, (int)pid))
          {
-            int c_fd = -1;
-
-            if (pgagroal_connection_get_pid(c->pid, &c_fd))
-            {
-               goto error;
-            }
+            return;
+         }
+      }
 
-            if (pgagroal_connection_id_write(c_fd, CONNECTION_REMOVE_FD))
-            {
-               goto error;
-            }
+      index = (index + 1) % NUMBER_OF_CLIENTS;
+   }
 
-            if (pgagroal_connection_transfer_write(c_fd, slot))
-            {
-               goto error;
-            }
+   pgagroal_log_warn("pgagroal: Client table full, PID %d is not tracked", (int)pid);
+}
 
-            pgagroal_disconnect(c_fd);
+static void
+remove_client(pid_t pid)
+{
+   int index;
+   struct main_configuration* config;
 
-            c = c->next;
-         }
+   config = (struct main_configuration*)shmem;
 
-         pgagroal_disconnect(fd);
-         known_fds[slot] = 0;
-      }
+   index = (int)(pid % NUMBER_OF_CLIENTS);
 
-      pgagroal_log_debug("pgagroal: Transfer kill connection: Slot %d FD %d", slot, fd);
-   }
-   else if (id == CONNECTION_CLIENT_DONE)
+   for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
    {
-      pgagroal_log_debug("pgagroal: Transfer client done");
+      int expected = (int)pid;
 
-      if (pgagroal_connection_pid_read(client_fd, &pid))
+      if (atomic_compare_exchange_strong(&config->clients[index], &expected, CLIENT_ENTRY_DELETED))
       {
-         pgagroal_log_error("pgagroal: Transfer client done: PID %d", (int)pid);
-         goto error;
+         clean_clients(index);
+         return;
       }
 
-      remove_client(pid);
+      /* The PID would have been placed before a free entry */
+      if (expected == CLIENT_ENTRY_FREE)
+      {
+         return;
+      }
 
-      pgagroal_log_debug("pgagroal: Transfer client done: PID %d", (int)pid);
+      index = (index + 1) % NUMBER_OF_CLIENTS;
    }
-
-   pgagroal_disconnect(client_fd);
-
-   pgagroal_prometheus_self_sockets_sub();
-
-   return;
-
-error:
-
-   pgagroal_disconnect(client_fd);
-
-   pgagroal_prometheus_self_sockets_sub();
 }
 
 static void
-accept_metrics_cb(struct io_watcher* watcher)
+clean_clients(int index)
 {
-   int client_fd;
    struct main_configuration* config;
-   SSL_CTX* ctx = NULL;
-   SSL* client_ssl = NULL;
 
    config = (struct main_configuration*)shmem;
 
-   errno = 0;
-
-   client_fd = watcher->fds.main.client_fd;
-
-   pgagroal_prometheus_self_sockets_add();
-
-   if (client_fd == -1)
+   /* A deleted entry followed by a free entry ends no lookup, so it is free too,
+    * which keeps the lookups short when the clients come and go */
+   for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
    {
-      if (accept_fatal(errno) && config->keep_running)
+      int expected = CLIENT_ENTRY_DELETED;
+
+      if (atomic_load(&config->clients[(index + 1) % NUMBER_OF_CLIENTS]) != CLIENT_ENTRY_FREE ||
+          !atomic_compare_exchange_strong(&config->clients[index], &expected, CLIENT_ENTRY_FREE))
       {
-         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
+         return;
+      }
 
-         for (int i = 0; i < metrics_fds_length; i++)
-         {
-            pgagroal_io_stop(&io_metrics[i].watcher);
-         }
-         shutdown_metrics();
+      index = (index + NUMBER_OF_CLIENTS - 1) % NUMBER_OF_CLIENTS;
+   }
+}
 
-         free(metrics_fds);
-         metrics_fds = NULL;
-         metrics_fds_length = 0;
+static int
+send_fd(pid_t pid, int32_t id, int32_t slot)
+{
+   struct main_configuration* config;
 
-         if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, config->nodelay, config->backlog))
-         {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
-            exit(1);
-         }
+   config = (struct main_configuration*)shmem;
 
-         if (metrics_fds_length > MAX_FDS)
-         {
-            pgagroal_log_fatal("pgagroal: Too many descriptors %d", metrics_fds_length);
-            exit(1);
-         }
+   return send_slot_fd(pid, id, slot, config->connections[slot].fd);
+}
 
-         start_metrics();
+static int
+send_slot_fd(pid_t pid, int32_t id, int32_t slot, int fd)
+{
+   int c_fd = -1;
 
-         for (int i = 0; i < metrics_fds_length; i++)
-         {
-            pgagroal_log_debug("Metrics: %d", *(metrics_fds + i));
-         }
-      }
-      else
-      {
-         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
-      }
-      errno = 0;
-      return;
+   if (pgagroal_connection_get_pid(pid, &c_fd))
+   {
+      goto error;
    }
 
-   if (!fork())
+   if (pgagroal_connection_id_write(c_fd, id))
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      if (strlen(config->common.metrics_cert_file) > 0 && strlen(config->common.metrics_key_file) > 0)
-      {
-         if (pgagroal_create_ssl_ctx(false, &ctx))
-         {
-            pgagroal_log_error("Could not create metrics SSL context");
-            pgagroal_disconnect(client_fd);
-            exit(1);
-         }
+      goto error;
+   }
 
-         if (pgagroal_create_ssl_server(ctx, config->common.metrics_key_file, config->common.metrics_cert_file, config->common.metrics_ca_file, client_fd, &client_ssl))
-         {
-            pgagroal_log_error("Could not create metrics SSL server");
-            pgagroal_disconnect(client_fd);
-            exit(1);
-         }
-      }
-      /* We are leaving the socket descriptor valid such that the client won't reuse it */
-      pgagroal_prometheus(client_ssl, client_fd);
+   if (pgagroal_connection_fd_write(c_fd, slot, fd))
+   {
+      goto error;
    }
 
-   pgagroal_close_ssl(client_ssl);
-   pgagroal_disconnect(client_fd);
-   pgagroal_prometheus_self_sockets_sub();
+   pgagroal_disconnect(c_fd);
+
+   return 0;
+
+error:
+
+   if (c_fd != -1)
+   {
+      pgagroal_disconnect(c_fd);
+   }
+
+   return 1;
 }
 
-static void
-accept_management_cb(struct io_watcher* watcher)
+/**
+ * Tell the acceptors and the clients to close their copy of the descriptor
+ * of a slot, and close our own
+ * @param slot The slot
+ * @return 0 upon success, otherwise 1
+ */
+static int
+forget_fd(int slot)
 {
-   struct sockaddr_in6 client_addr;
-   int client_fd;
-   char address[INET6_ADDRSTRLEN];
    struct main_configuration* config;
 
-   memset(&address, 0, sizeof(address));
-
    config = (struct main_configuration*)shmem;
 
-   client_fd = watcher->fds.main.client_fd;
-
-   pgagroal_prometheus_self_sockets_add();
+   for (int i = 1; i < config->acceptors; i++)
+   {
+      if (acceptor_pids[i] > 0 && send_slot_fd(acceptor_pids[i], CONNECTION_REMOVE_FD, slot, known_fds[slot]))
+      {
+         return 1;
+      }
+   }
 
-   if (client_fd == -1)
+   if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
    {
-      if (accept_fatal(errno) && config->keep_running)
+      for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
       {
-         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
+         pid_t pid = (pid_t)atomic_load(&config->clients[i]);
 
-         for (int i = 0; i < management_fds_length; i++)
+         if (pid > 0 && send_slot_fd(pid, CONNECTION_REMOVE_FD, slot, known_fds[slot]))
          {
-            pgagroal_io_stop(&io_management[i].watcher);
+            return 1;
          }
-         shutdown_management(false);
-
-         free(management_fds);
-         management_fds = NULL;
-         management_fds_length = 0;
+      }
+   }
 
-         if (pgagroal_bind(config->common.host, config->management, &management_fds, &management_fds_length, config->nodelay, config->backlog))
-         {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->management);
-            exit(1);
-         }
+   pgagroal_disconnect(known_fds[slot]);
+   known_fds[slot] = 0;
+   known_fds_generation++;
 
-         if (management_fds_length > MAX_FDS)
-         {
-            pgagroal_log_fatal("pgagroal: Too many descriptors %d", management_fds_length);
-            exit(1);
-         }
+   return 0;
+}
 
-         start_management();
+/**
+ * Move the descriptor of a slot to its number in the reserved range, so the
+ * main process, the acceptors and the workers they fork all use the number
+ * in the shared memory. The number is only taken over when it is free, or
+ * already holds our copy of the slot
+ * @param slot The slot
+ * @param fd The descriptor
+ * @return The descriptor of the slot, or -1 upon error
+ */
+static int
+reserve_fd(int slot, int fd)
+{
+   int target;
 
-         for (int i = 0; i < management_fds_length; i++)
-         {
-            pgagroal_log_debug("Remote management: %d", *(management_fds + i));
-         }
-      }
-      else
-      {
-         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
-      }
-      errno = 0;
-      return;
+   if (reserved_fds == -1 || fd < 0)
+   {
+      return fd;
    }
 
-   memset(&client_addr, 0, sizeof(struct sockaddr_in6));
-   socklen_t client_addr_length = sizeof(struct sockaddr_in6);
-   getpeername(client_fd, (struct sockaddr*)&client_addr, &client_addr_length);
+   target = reserved_fds + slot;
 
-   pgagroal_get_address((struct sockaddr*)&client_addr, (char*)&address, sizeof(address));
+   if (fd == target)
+   {
+      return fd;
+   }
 
-   if (!fork())
+   if (known_fds[slot] != target)
    {
-      char* addr = calloc(1, strlen(address) + 1);
-      if (addr == NULL)
+      if (fcntl(target, F_GETFD) != -1)
       {
-         pgagroal_log_fatal("Couldn't allocate address");
-         return;
+         pgagroal_log_error("pgagroal: Reserved descriptor in use: Slot %d FD %d", slot, target);
+         pgagroal_disconnect(fd);
+         return -1;
       }
-      memcpy(addr, address, strlen(address));
 
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      /* We are leaving the socket descriptor valid such that the client won't reuse it */
-      pgagroal_remote_management(client_fd, addr);
-      exit(0);
+      errno = 0;
    }
 
-   pgagroal_disconnect(client_fd);
-   pgagroal_prometheus_self_sockets_sub();
+   if (dup2(fd, target) == -1)
+   {
+      pgagroal_log_error("pgagroal: Reserved descriptor: Slot %d FD %d (%s)", slot, target, strerror(errno));
+      pgagroal_disconnect(fd);
+      errno = 0;
+      return -1;
+   }
+
+   pgagroal_disconnect(fd);
+
+   return target;
 }
 
+/**
+ * Hand the listening sockets and the idle connections over to a new
+ * pgagroal process, and then shut down gracefully once our own clients
+ * are done
+ * @param client_fd The descriptor of the process taking over
+ */
 static void
-accept_console_cb(struct io_watcher* watcher)
+hand_over(int client_fd)
 {
-   int client_fd;
+   char name[MISC_LENGTH];
+   char buf4[4];
+   int uds_fds[1];
+   int number_of_connections = 0;
+   int reserved = 0;
+   bool handed_over = false;
+   struct ucred cred;
+   socklen_t length;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   errno = 0;
-
-   client_fd = watcher->fds.main.client_fd;
+   /* The listening sockets and the backends only go to a process of our own user */
+   memset(&cred, 0, sizeof(cred));
+   length = sizeof(cred);
+   if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) || cred.uid != getuid())
+   {
+      pgagroal_log_warn("pgagroal: Takeover refused for UID %d", (int)cred.uid);
+      errno = 0;
+      return;
+   }
 
-   pgagroal_prometheus_self_sockets_add();
+   if (config->handed_over > 0)
+   {
+      pgagroal_log_warn("pgagroal: Takeover refused for PID %d, already handed over", (int)cred.pid);
+      return;
+   }
 
-   if (client_fd == -1)
+   /* The process taking over binds the shared transfer socket again, so our
+    * workers move to one of our own */
+   if (unix_hand_over_socket == -1)
    {
-      if (accept_fatal(errno) && config->keep_running)
+      memset(&name, 0, sizeof(name));
+      pgagroal_snprintf(&name[0], sizeof(name), "%s.%d", TRANSFER_UDS, (int)getpid());
+
+      if (pgagroal_bind_unix_socket(config->unix_socket_dir, &name[0], &unix_hand_over_socket))
       {
-         pgagroal_log_warn("Restarting listening port due to: %s (%d)", strerror(errno), client_fd);
+         pgagroal_log_error("pgagroal: Could not bind to %s/%s.%d", config->unix_socket_dir, &name[0], config->common.port);
+         unix_hand_over_socket = -1;
+         return;
+      }
 
-         for (int i = 0; i < console_fds_length; i++)
-         {
-            pgagroal_io_stop(&io_console[i].watcher);
-         }
-         shutdown_console();
+      memset(&io_hand_over, 0, sizeof(struct accept_io));
+      pgagroal_event_accept_init(&io_hand_over.watcher, unix_hand_over_socket, accept_transfer_cb);
+      io_hand_over.socket = unix_hand_over_socket;
+      io_hand_over.argv = argv_ptr;
+      pgagroal_io_start(&io_hand_over.watcher);
+   }
 
-         free(console_fds);
-         console_fds = NULL;
-         console_fds_length = 0;
+   config->handed_over = getpid();
 
-         if (pgagroal_bind(config->common.host, config->console, &console_fds, &console_fds_length, config->nodelay, config->backlog))
-         {
-            pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->console);
-            exit(1);
-         }
+   uds_fds[0] = unix_pgsql_socket;
 
-         if (console_fds_length > MAX_FDS)
-         {
-            pgagroal_log_fatal("pgagroal: Too many descriptors %d", console_fds_length);
-            exit(1);
-         }
+   if (hand_over_sockets(client_fd, main_fds, main_fds_length) ||
+       hand_over_sockets(client_fd, metrics_fds, metrics_fds_length) ||
+       hand_over_sockets(client_fd, management_fds, management_fds_length) ||
+       hand_over_sockets(client_fd, console_fds, console_fds_length) ||
+       hand_over_sockets(client_fd, tunnel_fds, tunnel_fds_length) ||
+       hand_over_sockets(client_fd, &uds_fds[0], unix_pgsql_socket != -1 ? 1 : 0))
+   {
+      goto error;
+   }
 
-         start_console();
+   /* The transaction pipeline never creates a connection for a transaction,
+    * so our clients keep one idle connection each until they are done */
+   if (config->pipeline == PIPELINE_TRANSACTION || config->pipeline == PIPELINE_STATEMENT)
+   {
+      reserved = number_of_clients();
+   }
 
-         for (int i = 0; i < console_fds_length; i++)
-         {
-            pgagroal_log_debug("Console: %d", *(console_fds + i));
-         }
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      if (known_fds[i] <= 0)
+      {
+         continue;
       }
-      else
+
+      if (reserved > 0 && atomic_load(&config->states[i]) == STATE_FREE)
       {
-         pgagroal_log_debug("accept: %s (%d)", strerror(errno), client_fd);
+         reserved--;
+         continue;
+      }
+
+      if (pgagroal_pool_hand_over(client_fd, i, &handed_over))
+      {
+         goto error;
+      }
+
+      if (handed_over)
+      {
+         if (forget_fd(i))
+         {
+            pgagroal_log_warn("pgagroal: Takeover: Slot %d could not be removed from the clients", i);
+         }
+         number_of_connections++;
       }
-      errno = 0;
-      return;
    }
 
-   if (!fork())
+   memset(&buf4, 0, sizeof(buf4));
+   if (pgagroal_connection_buffer_write(client_fd, &buf4, sizeof(buf4)))
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      /* We are leaving the socket descriptor valid such that the client won't reuse it */
-      pgagroal_console(NULL, client_fd);
+      goto error;
    }
 
-   pgagroal_disconnect(client_fd);
-   pgagroal_prometheus_self_sockets_sub();
-}
+   /* Stop accepting, the new process has the listening sockets now */
+   shutdown_io();
+   main_fds_length = 0;
 
-static void
-shutdown_cb(void)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   if (unix_pgsql_socket != -1)
+   {
+      pgagroal_io_stop(&io_uds.watcher);
+      shutdown_uds(false);
+      unix_pgsql_socket = -1;
+   }
 
-   pgagroal_log_debug("pgagroal: shutdown requested");
-   config->keep_running = false;
-   pgagroal_pool_status();
-   pgagroal_health_check_stop();
-   pgagroal_event_loop_break();
-}
+   for (int i = 0; i < metrics_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_metrics[i].watcher);
+   }
+   shutdown_metrics();
+   metrics_fds_length = 0;
 
-static void
-reload_cb(void)
-{
-   bool restart = false;
-   pgagroal_log_debug("pgagroal: reload requested");
-   reload_configuration(&restart);
-}
+   for (int i = 0; i < management_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_management[i].watcher);
+   }
+   shutdown_management(false);
+   management_fds_length = 0;
 
-static void
-graceful_cb(void)
-{
-   struct main_configuration* config;
+   for (int i = 0; i < console_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_console[i].watcher);
+   }
+   shutdown_console();
+   console_fds_length = 0;
 
-   config = (struct main_configuration*)shmem;
+   for (int i = 0; i < tunnel_fds_length; i++)
+   {
+      pgagroal_io_stop(&io_tunnel[i].watcher);
+   }
+   shutdown_tunnel();
+   tunnel_fds_length = 0;
 
-   pgagroal_log_debug("pgagroal: gracefully requested");
+   for (int i = 1; i < config->acceptors; i++)
+   {
+      if (acceptor_pids[i] > 0 && kill(acceptor_pids[i], SIGQUIT))
+      {
+         pgagroal_log_debug("kill: %s", strerror(errno));
+         errno = 0;
+      }
+   }
+
+   pgagroal_log_info("pgagroal: Handed over to PID %d with %d connections", (int)cred.pid, number_of_connections);
 
-   pgagroal_pool_status();
    config->gracefully = true;
 
-   if (atomic_load(&config->active_connections) == 0)
+   if (atomic_load(&config->active_connections) == 0 && number_of_clients() == 0)
    {
-      pgagroal_pool_status();
-
       pgagroal_event_loop_break();
    }
-}
-
-static void
-coredump_cb(void)
-{
-   pgagroal_log_info("pgagroal: core dump requested");
-   pgagroal_pool_status();
-   remove_pidfile();
-   abort();
-}
-
-static void
-sigchld_cb(void)
-{
-   while (waitpid(-1, NULL, WNOHANG) > 0)
+   else if (pgagroal_time_is_valid(config->flush_timeout))
    {
-      ;
+      start_periodic_watcher(&shutdown_timeout_watcher, &shutdown_timeout_started, shutdown_timeout_cb,
+                             pgagroal_time_convert(config->flush_timeout, FORMAT_TIME_S) * 1000, 0);
    }
+
+   return;
+
+error:
+
+   /* Anything that was detached is gone, but we keep serving what we have */
+   config->handed_over = 0;
+
+   pgagroal_log_error("pgagroal: Takeover by PID %d failed after %d connections", (int)cred.pid, number_of_connections);
+   errno = 0;
 }
 
 static void
-idle_timeout_cb(void)
+shutdown_hand_over(void)
 {
-   /* pgagroal_idle_timeout() is always in a fork() */
-   if (!fork())
+   char name[MISC_LENGTH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (unix_hand_over_socket == -1)
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      pgagroal_idle_timeout();
+      return;
    }
+
+   memset(&name, 0, sizeof(name));
+   pgagroal_snprintf(&name[0], sizeof(name), "%s.%d", TRANSFER_UDS, (int)getpid());
+
+   pgagroal_io_stop(&io_hand_over.watcher);
+   pgagroal_disconnect(unix_hand_over_socket);
+   pgagroal_remove_unix_socket(config->unix_socket_dir, &name[0]);
+   unix_hand_over_socket = -1;
+   errno = 0;
 }
 
+/**
+ * Shut down once the clients that stayed with us after a hand over are done
+ */
 static void
-max_connection_age_cb(void)
+hand_over_drained(void)
 {
-   /* max_connection_age() is always in a fork() */
-   if (!fork())
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->handed_over > 0 && config->keep_running &&
+       atomic_load(&config->active_connections) == 0 && number_of_clients() == 0)
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      pgagroal_max_connection_age();
+      pgagroal_log_debug("pgagroal: Clients done after the hand over");
+      pgagroal_event_loop_break();
    }
 }
 
-static void
-validation_cb(void)
+/**
+ * Count the clients that our workers still serve
+ * @return The number of clients
+ */
+static int
+number_of_clients(void)
 {
-   /* pgagroal_validation() is always in a fork() */
-   if (!fork())
+   int number = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < NUMBER_OF_CLIENTS; i++)
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      pgagroal_validation();
+      if (atomic_load(&config->clients[i]) > 0)
+      {
+         number++;
+      }
    }
+
+   return number;
 }
 
-static void
-disconnect_client_cb(void)
+static int
+hand_over_sockets(int client_fd, int* fds, int length)
 {
-   /* main_pipeline.periodic is always in a fork() */
-   if (!fork())
+   char buf4[4];
+
+   length = MAX(length, 0);
+
+   memset(&buf4, 0, sizeof(buf4));
+   pgagroal_write_int32(&buf4, length);
+
+   if (pgagroal_connection_buffer_write(client_fd, &buf4, sizeof(buf4)))
    {
-      pgagroal_event_loop_fork();
-      shutdown_ports(false);
-      main_pipeline.periodic();
+      return 1;
    }
-}
 
-static void
-shutdown_timeout_cb(void)
-{
-   struct main_configuration* config = (struct main_configuration*)shmem;
+   for (int i = 0; i < length; i++)
+   {
+      if (pgagroal_connection_fd_write(client_fd, i, *(fds + i)))
+      {
+         return 1;
+      }
+   }
 
-   pgagroal_log_warn("pgagroal: shutdown timeout expired - forcing immediate shutdown");
-   config->gracefully = false;
-   config->keep_running = false;
-   pgagroal_event_loop_break();
+   return 0;
 }
 
-static void
-flush_alarm_cb(void)
+/**
+ * Take the listening sockets and the idle connections over from the
+ * running pgagroal process
+ * @param has_unix_socket Set to true if the Unix Domain Socket was taken over
+ * @param has_main_sockets Set to true if the main sockets were taken over
+ * @return 0 upon success, otherwise 1
+ */
+static int
+take_over(bool* has_unix_socket, bool* has_main_sockets)
 {
-   struct timespec now;
+   int fd = -1;
+   int slot = -1;
+   int* uds_fds = NULL;
+   int uds_fds_length = -1;
+   int number_of_connections = 0;
+   bool done = false;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
-   bool fired = false;
-
-   stop_periodic_watcher(&flush_alarm, &flush_alarm_started);
 
-   clock_gettime(CLOCK_MONOTONIC, &now);
+   if (pgagroal_connect_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &fd))
+   {
+      pgagroal_log_fatal("pgagroal: No pgagroal to take over at %s/%s.%d", config->unix_socket_dir, TRANSFER_UDS, config->common.port);
+      goto error;
+   }
 
-   for (int i = 0; i < NUMBER_OF_LIMITS; i++)
+   if (pgagroal_connection_id_write(fd, CONNECTION_TAKEOVER))
    {
-      char db[MAX_DATABASE_LENGTH];
+      goto error;
+   }
 
-      if (!flush_timeouts[i].in_use)
-      {
-         continue;
-      }
+   /* The sockets of a port that changed are closed and bound again */
+   if (take_over_sockets(fd, config->common.port, &main_fds, &main_fds_length) ||
+       take_over_sockets(fd, config->common.metrics, &metrics_fds, &metrics_fds_length) ||
+       take_over_sockets(fd, config->management, &management_fds, &management_fds_length) ||
+       take_over_sockets(fd, config->console, &console_fds, &console_fds_length) ||
+       take_over_sockets(fd, config->tunnel_port, &tunnel_fds, &tunnel_fds_length) ||
+       take_over_sockets(fd, config->common.port, &uds_fds, &uds_fds_length))
+   {
+      goto error;
+   }
 
-      if (flush_timeouts[i].expires_at.tv_sec > now.tv_sec ||
-          (flush_timeouts[i].expires_at.tv_sec == now.tv_sec &&
-           flush_timeouts[i].expires_at.tv_nsec > now.tv_nsec))
-      {
-         continue;
-      }
+   if (main_fds_length > 0)
+   {
+      *has_main_sockets = true;
+   }
 
-      memcpy(db, flush_timeouts[i].database, sizeof(db));
-      flush_timeouts[i].in_use = false;
-      memset(flush_timeouts[i].database, 0, sizeof(flush_timeouts[i].database));
-      fired = true;
+   if (uds_fds_length == 1)
+   {
+      unix_pgsql_socket = *uds_fds;
+      *has_unix_socket = true;
+   }
 
-      if (atomic_load(&config->active_connections) > 0)
+   while (!done)
+   {
+      if (pgagroal_pool_take_over(fd, &done, &slot))
       {
-         pgagroal_log_warn("pgagroal: flush timeout expired - forcing FLUSH_ALL on database '%s'",
-                           db[0] ? db : "*");
-         if (!fork())
-         {
-            pgagroal_flush(FLUSH_ALL, db[0] ? db : "*");
-            exit(0);
-         }
+         goto error;
       }
-      else
+
+      if (slot != -1)
       {
-         pgagroal_log_info("pgagroal: flush timeout fired but no active connections remain, skipping");
+         config->connections[slot].fd = reserve_fd(slot, config->connections[slot].fd);
+         known_fds[slot] = config->connections[slot].fd;
+         known_fds_generation++;
+         number_of_connections++;
       }
    }
 
-   if (fired)
+   pgagroal_disconnect(fd);
+   free(uds_fds);
+
+   pgagroal_log_info("pgagroal: Took over %d connections", number_of_connections);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
    {
-      pgagroal_pool_status();
+      pgagroal_disconnect(fd);
    }
+   free(uds_fds);
 
-   rearm_flush_alarm();
+   return 1;
 }
 
-static void
-rotate_frontend_password_cb(void)
+static int
+take_over_sockets(int client_fd, int port, int** fds, int* length)
 {
-   char* pwd;
-   struct main_configuration* config;
+   char buf4[4];
+   int32_t number;
+   int32_t index;
+   int fd;
+   int taken = 0;
+   int* sockets = NULL;
 
-   config = (struct main_configuration*)shmem;
+   memset(&buf4, 0, sizeof(buf4));
+   if (pgagroal_connection_buffer_read(client_fd, &buf4, sizeof(buf4)))
+   {
+      goto error;
+   }
 
-   for (int i = 0; i < config->number_of_frontend_users; i++)
+   number = pgagroal_read_int32(&buf4);
+   if (number < 0 || number > MAX_FDS)
    {
-      if (pgagroal_generate_password(config->rotate_frontend_password_length, &pwd))
-      {
-         pgagroal_log_debug("rotate_frontend_password_cb: unable to rotate password");
-         return;
-      }
-      memcpy(&config->frontend_users[i].password, pwd, strlen(pwd) + 1);
-      pgagroal_log_trace("rotate_frontend_password_cb: current pass for username=%s:%s", config->frontend_users[i].username, config->frontend_users[i].password);
-      free(pwd);
+      goto error;
    }
-}
 
-static bool
-accept_fatal(int error)
-{
-   switch (error)
+   if (number == 0)
    {
-      case EAGAIN:
-      case ENETDOWN:
-      case EPROTO:
-      case ENOPROTOOPT:
-      case EHOSTDOWN:
-#ifdef HAVE_LINUX
-      case ENONET:
-#endif
-      case EHOSTUNREACH:
-      case EOPNOTSUPP:
-      case ENETUNREACH:
-         return false;
-         break;
+      return 0;
    }
 
-   return true;
-}
+   sockets = calloc(number, sizeof(int));
+   if (sockets == NULL)
+   {
+      goto error;
+   }
 
-static void
-frontend_user_password_startup(struct main_configuration* config)
-{
-   char* pwd = NULL;
+   for (int i = 0; i < number; i++)
+   {
+      if (pgagroal_connection_transfer_read(client_fd, &index, &fd))
+      {
+         goto error;
+      }
 
-   if (config->number_of_frontend_users == 0 && pgagroal_time_is_valid(config->rotate_frontend_password_timeout))
+      sockets[taken++] = fd;
+   }
+
+   for (int i = 0; i < taken; i++)
    {
-      for (int i = 0; i < config->number_of_users; i++)
+      if (port <= 0 || !socket_has_port(sockets[i], port))
       {
-         memcpy(&config->frontend_users[i].username, config->users[i].username, strlen(config->users[i].username));
-         if (pgagroal_generate_password(config->rotate_frontend_password_length, &pwd))
+         for (int j = 0; j < taken; j++)
          {
-            pgagroal_log_debug("frontend_user_password_startup: unable to generate random password at startup");
-            return;
+            pgagroal_disconnect(sockets[j]);
          }
-         memcpy(&config->frontend_users[i].password, pwd, strlen(pwd) + 1);
-         pgagroal_log_trace("frontend_user_password_startup: frontend user with username=%s initiated", config->frontend_users[i].username);
-         free(pwd);
+         free(sockets);
+
+         return 0;
       }
-      config->number_of_frontend_users = config->number_of_users;
    }
-}
 
-static void
-add_client(pid_t pid)
-{
-   struct client* c = NULL;
+   free(*fds);
+   *fds = sockets;
+   *length = taken;
+
+   return 0;
 
-   c = (struct client*)malloc(sizeof(struct client));
-   c->pid = pid;
-   c->next = NULL;
+error:
 
-   if (clients == NULL)
+   for (int i = 0; i < taken; i++)
    {
-      clients = c;
+      pgagroal_disconnect(sockets[i]);
    }
-   else
-   {
-      struct client* last = NULL;
-
-      last = clients;
+   free(sockets);
 
-      while (last->next != NULL)
-      {
-         last = last->next;
-      }
-
-      last->next = c;
-   }
+   return 1;
 }
 
-static void
-remove_client(pid_t pid)
+static bool
+socket_has_port(int fd, int port)
 {
-   struct client* c = NULL;
-   struct client* p = NULL;
+   char suffix[MISC_LENGTH];
+   struct sockaddr_storage addr;
+   socklen_t length;
 
-   c = clients;
-   p = NULL;
+   memset(&addr, 0, sizeof(addr));
+   length = sizeof(addr);
 
-   if (c != NULL)
+   if (getsockname(fd, (struct sockaddr*)&addr, &length))
    {
-      while (c->pid != pid)
-      {
-         p = c;
-         c = c->next;
-
-         if (c == NULL)
-         {
-            return;
-         }
-      }
+      errno = 0;
+      return false;
+   }
 
-      if (c == clients)
-      {
-         clients = c->next;
-      }
-      else
-      {
-         p->next = c->next;
-      }
+   if (addr.ss_family == AF_INET)
+   {
+      return ntohs(((struct sockaddr_in*)&addr)->sin_port) == port;
+   }
+   else if (addr.ss_family == AF_INET6)
+   {
+      return ntohs(((struct sockaddr_in6*)&addr)->sin6_port) == port;
+   }
+   else if (addr.ss_family == AF_UNIX)
+   {
+      memset(&suffix, 0, sizeof(suffix));
+      pgagroal_snprintf(&suffix[0], sizeof(suffix), "%s.%d", PG_UDS, port);
 
-      free(c);
+      return pgagroal_ends_with(((struct sockaddr_un*)&addr)->sun_path, &suffix[0]);
    }
+
+   return false;
 }
 
 static void
@@ -3185,10 +5508,13 @@ refresh_periodic_watchers(void)
    config = (struct main_configuration*)shmem;
 
    stop_periodic_watcher(&idle_timeout_watcher, &idle_timeout_started);
+   stop_periodic_watcher(&adaptive_pool_watcher, &adaptive_pool_started);
    stop_periodic_watcher(&max_connection_age_watcher, &max_connection_age_started);
    stop_periodic_watcher(&validation_watcher, &validation_started);
    stop_periodic_watcher(&disconnect_client_watcher, &disconnect_client_started);
    stop_periodic_watcher(&rotate_frontend_password_watcher, &rotate_frontend_password_started);
+   stop_periodic_watcher(&rotate_tls_ticket_keys_watcher, &rotate_tls_ticket_keys_started);
+   stop_periodic_watcher(&cluster_watcher, &cluster_started);
 
    if (pgagroal_time_is_valid(config->idle_timeout))
    {
@@ -3196,9 +5522,16 @@ refresh_periodic_watchers(void)
       start_periodic_watcher(&idle_timeout_watcher, &idle_timeout_started, idle_timeout_cb, t, t);
    }
 
+   if (pgagroal_time_is_valid(config->adaptive_pool_interval) && pgagroal_can_prefill())
+   {
+      int64_t t = 1000 * (int64_t)MAX(pgagroal_time_convert(config->adaptive_pool_interval, FORMAT_TIME_S), 1);
+      start_periodic_watcher(&adaptive_pool_watcher, &adaptive_pool_started, adaptive_pool_cb, t, t);
+   }
+
    if (pgagroal_time_is_valid(config->max_connection_age))
    {
-      int64_t t = 1000 * (int64_t)MAX(1. * pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S) / 2., 5.);
+      /* Several runs within the window that the deadlines are spread over */
+      int64_t t = 1000 * (int64_t)MAX(1. * pgagroal_time_convert(config->max_connection_age, FORMAT_TIME_S) / (2. * MAX_CONNECTION_AGE_JITTER), 5.);
       start_periodic_watcher(&max_connection_age_watcher, &max_connection_age_started, max_connection_age_cb, t, t);
    }
 
@@ -3219,6 +5552,19 @@ refresh_periodic_watchers(void)
       int64_t t = 1000 * pgagroal_time_convert(config->rotate_frontend_password_timeout, FORMAT_TIME_S);
       start_periodic_watcher(&rotate_frontend_password_watcher, &rotate_frontend_password_started, rotate_frontend_password_cb, t, t);
    }
+
+   if (config->common.tls)
+   {
+      int64_t t = 1000 * (int64_t)TLS_TICKET_KEY_ROTATION;
+      start_periodic_watcher(&rotate_tls_ticket_keys_watcher, &rotate_tls_ticket_keys_started, rotate_tls_ticket_keys_cb, t, t);
+   }
+
+   if (config->number_of_cluster_peers > 0)
+   {
+      /* Several exchanges within a lease, so a lost report doesn't expire it */
+      int64_t t = 1000 * (int64_t)MAX(pgagroal_time_convert(config->cluster_lease, FORMAT_TIME_S) / CLUSTER_EXCHANGES, 1);
+      start_periodic_watcher(&cluster_watcher, &cluster_started, cluster_cb, t, t);
+   }
 }
 
 static void
@@ -3250,6 +5596,10 @@ reload_configuration(bool* restart)
    if (!*restart)
    {
       refresh_periodic_watchers();
+      client_keepalive();
+
+      /* Picks up renewed certificates, the running connections keep the previous contexts */
+      pgagroal_tls_contexts_create();
 
       if (health_check_changed)
       {
@@ -3330,9 +5680,10 @@ service_reload_cb(void)
  * If a pid file already exists, or if the file cannot be written,
  * the function kills (exits) the current process.
  *
+ * @param takeover Replace the pid file of the pgagroal taken over
  */
 static void
-create_pidfile_or_exit(void)
+create_pidfile_or_exit(bool takeover)
 {
    char buffer[64];
    pid_t pid;
@@ -3346,7 +5697,8 @@ create_pidfile_or_exit(void)
    {
       pid = getpid();
 
-      fd = open(config->pidfile, O_WRONLY | O_CREAT | O_EXCL, 0640);
+      /* When taking over, the PID file of the running pgagroal is now ours */
+      fd = open(config->pidfile, O_WRONLY | O_CREAT | (takeover ? O_TRUNC : O_EXCL), 0640);
       if (errno == EEXIST)
       {
          errx(1, "PID file <%s> exists, is there another instance running ?", config->pidfile);
@@ -3388,6 +5740,19 @@ remove_pidfile(void)
    }
 }
 
+/**
+ * Apply the TCP timeouts to the main sockets, the clients accepted
+ * on them inherit the settings
+ */
+static void
+client_keepalive(void)
+{
+   for (int i = 0; i < main_fds_length; i++)
+   {
+      pgagroal_tcp_keepalive(*(main_fds + i));
+   }
+}
+
 static void
 shutdown_ports(bool remove)
 {
@@ -3396,6 +5761,9 @@ shutdown_ports(bool remove)
    config = (struct main_configuration*)shmem;
 
    shutdown_uds(remove);
+   shutdown_prefork();
+   shutdown_cancel();
+   shutdown_startup_gate();
 
    if (config->common.metrics > 0)
    {
@@ -3411,4 +5779,9 @@ shutdown_ports(bool remove)
    {
       shutdown_console();
    }
+
+   if (config->tunnel_port > 0)
+   {
+      shutdown_tunnel();
+   }
 }
@@ -46,17 +46,22 @@
 #include <arpa/inet.h>
 #include <err.h>
 #include <getopt.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_SYSTEMD
@@ -69,6 +74,17 @@
 #define CLIENTSSL_OFF_SERVERSSL_OFF 3
 
 #define MAX_FDS                     64
+#define PASSWORD_CACHE_SIZE         64
+
+/** @struct password_entry
+ * A password received from pgagroal, served again until it expires
+ */
+struct password_entry
+{
+   char username[MAX_USERNAME_LENGTH]; /**< The user name */
+   char password[MAX_PASSWORD_LENGTH]; /**< The password */
+   time_t expires;                     /**< The monotonic time the entry expires */
+};
 
 static void accept_vault_cb(struct io_watcher* watcher);
 static void accept_metrics_cb(struct io_watcher* watcher);
@@ -84,6 +100,12 @@ static int router(SSL* ccl, SSL* ssl, int client_fd);
 static void route_status(char** response);
 static bool test_pgagroal_connectivity(struct vault_configuration* config);
 static int get_connection_state(struct vault_configuration* config, int client_fd);
+static int wait_client(int client_fd, int timeout);
+static int request_password(struct vault_configuration* config, char* username, struct json** read);
+static void disconnect_pgagroal(void);
+static time_t monotonic_seconds(void);
+static char* cached_password(struct vault_configuration* config, char* username);
+static void cache_password(struct vault_configuration* config, char* username, char* password);
 
 static char** argv_ptr;
 static struct event_loop* main_loop = NULL;
@@ -93,6 +115,9 @@ static int* metrics_fds = NULL;
 static int metrics_fds_length = -1;
 static int* server_fds = NULL;
 static int server_fds_length = -1;
+static int management_fd = -1;
+static SSL* management_ssl = NULL;
+static struct password_entry password_cache[PASSWORD_CACHE_SIZE];
 
 static int
 router(SSL* c_ssl, SSL* s_ssl, int client_fd)
@@ -102,8 +127,8 @@ router(SSL* c_ssl, SSL* s_ssl, int client_fd)
    ssize_t bytes_write;
    struct vault_configuration* config;
    char* response = NULL;
-   char method[8];
-   char path[128];
+   char method[8] = {0};
+   char path[128] = {0};
    char buffer[HTTP_BUFFER_SIZE];
    char username[MAX_USERNAME_LENGTH + 1]; // Assuming username is less than 128 characters
    char* redirect_link = NULL;
@@ -112,6 +137,13 @@ router(SSL* c_ssl, SSL* s_ssl, int client_fd)
    memset(&response, 0, sizeof(response));
    memset(&buffer, 0, sizeof(buffer));
 
+   /* The request is served by the vault process, so a silent client must not hold it */
+   if (wait_client(client_fd, (int)MIN(pgagroal_time_convert(config->common.authentication_timeout, FORMAT_TIME_S) * 1000, INT_MAX)))
+   {
+      exit_code = 1;
+      goto cleanup;
+   }
+
    connection_state = get_connection_state(config, client_fd);
    switch (connection_state)
    {
@@ -122,11 +154,11 @@ router(SSL* c_ssl, SSL* s_ssl, int client_fd)
             exit_code = 1;
             goto cleanup;
          }
-         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer));
+         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer) - 1);
          sscanf(buffer, "%7s %127s", method, path);
          break;
       case CLIENTSSL_OFF_SERVERSSL_ON:
-         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer));
+         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer) - 1);
          sscanf(buffer, "%7s %127s", method, path);
          redirect_link = pgagroal_append(redirect_link, "https://");
          redirect_link = pgagroal_append(redirect_link, config->common.host);
@@ -137,7 +169,7 @@ router(SSL* c_ssl, SSL* s_ssl, int client_fd)
          pgagroal_log_error("client must initiate tls handshake");
          goto send;
       case CLIENTSSL_OFF_SERVERSSL_OFF:
-         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer));
+         pgagroal_read_socket(c_ssl, client_fd, buffer, sizeof(buffer) - 1);
          sscanf(buffer, "%7s %127s", method, path);
          break;
       case CLIENTSSL_ON_SERVERSSL_OFF:
@@ -254,39 +286,28 @@ static void
 route_users(char* username, char** response, SSL* s_ssl __attribute__((unused)), int client_fd __attribute__((unused)))
 {
    struct vault_configuration* config = (struct vault_configuration*)shmem;
-   int client_pgagroal_fd = -1;
-   SSL* mgmt_ssl = NULL;
    struct json* read = NULL;
    struct json* res = NULL;
    char* password = NULL;
 
-   // Connect to pgagroal management port
-   if (connect_pgagroal(config, config->vault_server.user.username, config->vault_server.user.password, &mgmt_ssl, &client_pgagroal_fd))
+   password = cached_password(config, username);
+   if (password != NULL)
    {
-      pgagroal_log_error("pgagroal-vault: Couldn't connect to %s:%d", config->vault_server.server.host, config->vault_server.server.port);
-      // Send Error Response
-      route_not_found(response);
+      pgagroal_log_debug("pgagroal-vault: Cached password for %s", username);
+      route_found(response, password);
       return;
    }
 
    // Call GET_PASSWORD at management port
-   if (pgagroal_management_request_get_password(mgmt_ssl, client_pgagroal_fd, username, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_AES256_GCM, MANAGEMENT_OUTPUT_FORMAT_JSON))
+   if (request_password(config, username, &read))
    {
       pgagroal_log_error("pgagroal-vault: Couldn't get password from the management");
       route_not_found(response);
-      goto cleanup;
+      return;
    }
 
-   if (pgagroal_management_read_json(mgmt_ssl, client_pgagroal_fd, NULL, NULL, &read))
-   {
-      pgagroal_log_warn("pgagroal-vault: Couldn't receive the result");
-   }
-
-   if (read != NULL)
-   {
-      res = (struct json*)pgagroal_json_get(read, MANAGEMENT_CATEGORY_RESPONSE);
-      password = (char*)pgagroal_json_get(res, MANAGEMENT_ARGUMENT_PASSWORD);
-   }
+   res = (struct json*)pgagroal_json_get(read, MANAGEMENT_CATEGORY_RESPONSE);
+   password = (char*)pgagroal_json_get(res, MANAGEMENT_ARGUMENT_PASSWORD);
 
    if (password == NULL || strlen(password) == 0) // user not found
    {
@@ -295,21 +316,10 @@ route_users(char* username, char** response, SSL* s_ssl __attribute__((unused)),
    }
    else
    {
+      cache_password(config, username, password);
       route_found(response, password);
    }
 
-cleanup:
-   // Cleanup management SSL connection
-   if (mgmt_ssl != NULL)
-   {
-      SSL_shutdown(mgmt_ssl);
-      SSL_free(mgmt_ssl);
-   }
-   if (client_pgagroal_fd != -1)
-   {
-      pgagroal_disconnect(client_pgagroal_fd);
-   }
-
    pgagroal_json_destroy(read);
 }
 
@@ -552,8 +562,6 @@ connect_pgagroal(struct vault_configuration* config, char* username, char* passw
 static bool
 test_pgagroal_connectivity(struct vault_configuration* config)
 {
-   int client_pgagroal_fd = -1;
-   SSL* mgmt_ssl = NULL;
    struct json* read = NULL;
    bool is_connected = false;
 
@@ -561,45 +569,144 @@ test_pgagroal_connectivity(struct vault_configuration* config)
                       config->vault_server.server.host,
                       config->vault_server.server.port);
 
-   if (connect_pgagroal(config, config->vault_server.user.username, config->vault_server.user.password, &mgmt_ssl, &client_pgagroal_fd))
+   // Make a request for a non-existent user - this tests the full protocol
+   if (!request_password(config, "__vault_test_nonexistent_user__", &read))
    {
-      pgagroal_log_debug("test_pgagroal_connectivity: Connection failed");
-      return false;
+      // We got a response (success or failure doesn't matter - server is responding)
+      is_connected = true;
    }
 
-   // Make a request for a non-existent user - this tests the full protocol
-   if (pgagroal_management_request_get_password(mgmt_ssl, client_pgagroal_fd, "__vault_test_nonexistent_user__", MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_AES256_GCM, MANAGEMENT_OUTPUT_FORMAT_JSON))
+   pgagroal_log_debug("test_pgagroal_connectivity: %s", is_connected ? "Ok - server responded" : "Failure - cannot read response");
+
+   pgagroal_json_destroy(read);
+
+   return is_connected;
+}
+
+/**
+ * Send GET_PASSWORD over the management session, the session is kept
+ * open between requests and opened again when pgagroal closed it
+ */
+static int
+request_password(struct vault_configuration* config, char* username, struct json** read)
+{
+   bool reused;
+
+   *read = NULL;
+
+   do
    {
-      pgagroal_log_debug("test_pgagroal_connectivity: Failed to send test request");
-      goto cleanup;
+      reused = management_fd != -1;
+
+      if (!reused)
+      {
+         if (connect_pgagroal(config, config->vault_server.user.username, config->vault_server.user.password, &management_ssl, &management_fd))
+         {
+            pgagroal_log_error("pgagroal-vault: Couldn't connect to %s:%d", config->vault_server.server.host, config->vault_server.server.port);
+            management_ssl = NULL;
+            management_fd = -1;
+            return 1;
+         }
+      }
+
+      if (!pgagroal_management_request_get_password(management_ssl, management_fd, username, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_AES256_GCM, MANAGEMENT_OUTPUT_FORMAT_JSON) &&
+          !pgagroal_management_read_json(management_ssl, management_fd, NULL, NULL, read))
+      {
+         return 0;
+      }
+
+      pgagroal_json_destroy(*read);
+      *read = NULL;
+
+      pgagroal_log_debug("pgagroal-vault: Management session to %s:%d closed", config->vault_server.server.host, config->vault_server.server.port);
+      disconnect_pgagroal();
    }
+   while (reused);
 
-   // Try to read the response - even if user doesn't exist, we should get a response
-   if (pgagroal_management_read_json(mgmt_ssl, client_pgagroal_fd, NULL, NULL, &read) == 0)
+   return 1;
+}
+
+static void
+disconnect_pgagroal(void)
+{
+   if (management_ssl != NULL)
    {
-      // We got a response (success or failure doesn't matter - server is responding)
-      is_connected = true;
+      SSL_shutdown(management_ssl);
+      SSL_free(management_ssl);
+      management_ssl = NULL;
+   }
+   if (management_fd != -1)
+   {
+      pgagroal_disconnect(management_fd);
+      management_fd = -1;
    }
+}
 
-   pgagroal_log_debug("test_pgagroal_connectivity: %s", is_connected ? "Ok - server responded" : "Failure - cannot read response");
+static time_t
+monotonic_seconds(void)
+{
+   struct timespec now;
 
-cleanup:
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return now.tv_sec;
+}
+
+static char*
+cached_password(struct vault_configuration* config, char* username)
+{
+   time_t now;
 
-   if (mgmt_ssl != NULL)
+   if (pgagroal_time_convert(config->password_cache_timeout, FORMAT_TIME_S) <= 0)
    {
-      SSL_shutdown(mgmt_ssl);
-      SSL_free(mgmt_ssl);
+      return NULL;
    }
-   if (client_pgagroal_fd != -1)
+
+   now = monotonic_seconds();
+
+   for (int i = 0; i < PASSWORD_CACHE_SIZE; i++)
+   {
+      if (password_cache[i].expires > now && !strncmp(password_cache[i].username, username, MAX_USERNAME_LENGTH))
+      {
+         return password_cache[i].password;
+      }
+   }
+
+   return NULL;
+}
+
+static void
+cache_password(struct vault_configuration* config, char* username, char* password)
+{
+   int64_t timeout;
+   int entry = 0;
+
+   timeout = (int64_t)pgagroal_time_convert(config->password_cache_timeout, FORMAT_TIME_S);
+
+   if (timeout <= 0 || strlen(username) >= MAX_USERNAME_LENGTH || strlen(password) >= MAX_PASSWORD_LENGTH)
    {
-      pgagroal_disconnect(client_pgagroal_fd);
+      return;
    }
-   if (read != NULL)
+
+   /* The entry of the user, or else the one that expires first */
+   for (int i = 0; i < PASSWORD_CACHE_SIZE; i++)
    {
-      pgagroal_json_destroy(read);
+      if (!strncmp(password_cache[i].username, username, MAX_USERNAME_LENGTH))
+      {
+         entry = i;
+         break;
+      }
+
+      if (password_cache[i].expires < password_cache[entry].expires)
+      {
+         entry = i;
+      }
    }
 
-   return is_connected;
+   OPENSSL_cleanse(&password_cache[entry], sizeof(struct password_entry));
+   memcpy(&password_cache[entry].username[0], username, strlen(username));
+   memcpy(&password_cache[entry].password[0], password, strlen(password));
+   password_cache[entry].expires = monotonic_seconds() + timeout;
 }
 
 static int
@@ -624,6 +731,40 @@ get_connection_state(struct vault_configuration* config, int client_fd)
    return CLIENTSSL_OFF_SERVERSSL_OFF;
 }
 
+/**
+ * Wait for the first bytes of the request, the socket timeouts
+ * bound the rest of the exchange
+ */
+static int
+wait_client(int client_fd, int timeout)
+{
+   struct pollfd pfd;
+   struct timeval tv;
+   char c;
+
+   tv.tv_sec = timeout / 1000;
+   tv.tv_usec = (timeout % 1000) * 1000;
+
+   if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) || setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+   {
+      pgagroal_log_debug("wait_client: %s", strerror(errno));
+      errno = 0;
+   }
+
+   pfd.fd = client_fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, timeout) != 1 || recv(client_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+   {
+      pgagroal_log_debug("wait_client: No request from %d", client_fd);
+      errno = 0;
+      return 1;
+   }
+
+   return 0;
+}
+
 static void
 start_vault_io(void)
 {
@@ -918,7 +1059,7 @@ read_users_path:
 
    // -- Bind & Listen at the given hostname and port --
 
-   if (pgagroal_bind(config->common.host, config->common.port, &server_fds, &server_fds_length, false, -1))
+   if (pgagroal_bind(config->common.host, config->common.port, &server_fds, &server_fds_length, false, -1, false))
    {
       errx(1, "pgagroal-vault: Could not bind to %s:%d", config->common.host, config->common.port);
    }
@@ -942,6 +1083,9 @@ read_users_path:
 
    pgagroal_signal_init((struct signal_watcher*)&signal_watcher[0], shutdown_cb, SIGTERM);
 
+   /* A client or pgagroal closing its side is seen as a failed write */
+   signal(SIGPIPE, SIG_IGN);
+
    for (int i = 0; i < 1; i++)
    {
       signal_watcher[i].slot = -1;
@@ -953,7 +1097,7 @@ read_users_path:
    if (config->common.metrics > 0)
    {
       /* Bind metrics socket */
-      if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, false, -1))
+      if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, false, -1, false))
       {
          pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
 #ifdef HAVE_SYSTEMD
@@ -991,6 +1135,9 @@ read_users_path:
 
    pgagroal_log_info("pgagroal-vault: shutdown");
 
+   disconnect_pgagroal();
+   OPENSSL_cleanse(&password_cache[0], sizeof(password_cache));
+
    shutdown_ports();
 
    pgagroal_event_loop_destroy();
@@ -1018,7 +1165,6 @@ accept_vault_cb(struct io_watcher* watcher)
 
    int client_fd;
    char address[INET6_ADDRSTRLEN];
-   pid_t pid;
    SSL* c_ssl = NULL;
    SSL* s_ssl = NULL;
    struct vault_configuration* config;
@@ -1040,7 +1186,7 @@ accept_vault_cb(struct io_watcher* watcher)
          free(server_fds);
          server_fds = NULL;
 
-         if (pgagroal_bind(config->common.host, config->common.port, &server_fds, &server_fds_length, false, -1))
+         if (pgagroal_bind(config->common.host, config->common.port, &server_fds, &server_fds_length, false, -1, false))
          {
             pgagroal_log_fatal("pgagroal-vault: Could not bind to %s:%d", config->common.host, config->common.port);
             exit(1);
@@ -1073,34 +1219,10 @@ accept_vault_cb(struct io_watcher* watcher)
 
    pgagroal_log_trace("accept_vault_cb: client address: %s", address);
 
-   pid = fork();
-   if (pid == -1)
-   {
-      /* No process */
-      pgagroal_log_error("accept_vault_cb: Couldn't create process");
-   }
-   else if (pid == 0)
+   /* Handle the http request in the vault process, so the management session and the password cache are kept */
+   if (router(c_ssl, s_ssl, client_fd))
    {
-      char* addr = calloc(1, strlen(address) + 1);
-      if (addr == NULL)
-      {
-         pgagroal_log_fatal("accept_vault_cb: Couldn't allocate memory for client address");
-         return;
-      }
-      memcpy(addr, address, strlen(address));
-
-      pgagroal_event_loop_fork();
-      shutdown_ports();
-
-      // Handle http request
-      if (router(c_ssl, s_ssl, client_fd))
-      {
-         pgagroal_log_error("Couldn't write to client");
-         pgagroal_disconnect(client_fd);
-         exit(1);
-      }
-
-      exit(0);
+      pgagroal_log_error("Couldn't write to client");
    }
 
    pgagroal_disconnect(client_fd);
@@ -1135,7 +1257,7 @@ accept_metrics_cb(struct io_watcher* watcher)
          metrics_fds = NULL;
          metrics_fds_length = 0;
 
-         if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, false, -1))
+         if (pgagroal_bind(config->common.host, config->common.metrics, &metrics_fds, &metrics_fds_length, false, -1, false))
          {
             pgagroal_log_fatal("pgagroal: Could not bind to %s:%d", config->common.host, config->common.metrics);
             exit(1);
@@ -60,6 +60,24 @@ pgagroal_test_assert_conf_section_set_ok(char* section, char* key, char* value);
 void
 pgagroal_test_assert_conf_set_fail(char* key, char* value);
 
+/**
+ * Swap the shared memory for a private copy of the main configuration, so that
+ * a test can change it while keeping the logging settings of the suite
+ * @param config The private configuration
+ * @param saved The shared memory to restore
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgagroal_test_private_configuration(struct main_configuration** config, void** saved);
+
+/**
+ * Restore the shared memory swapped by pgagroal_test_private_configuration
+ * @param config The private configuration
+ * @param saved The shared memory to restore
+ */
+void
+pgagroal_test_restore_configuration(struct main_configuration* config, void* saved);
+
 #ifdef __cplusplus
 }
 #endif
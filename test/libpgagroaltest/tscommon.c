@@ -72,3 +72,37 @@ pgagroal_test_assert_conf_set_ok(char* key, char* value)
       mctf_errmsg = mctf_format_error("Expected conf set to succeed for key='%s' value='%s', but it failed with %d", key, value, ret);
    }
 }
+
+int
+pgagroal_test_private_configuration(struct main_configuration** config, void** saved)
+{
+   struct main_configuration* c = NULL;
+
+   *config = NULL;
+   *saved = NULL;
+
+   c = (struct main_configuration*)malloc(sizeof(struct main_configuration));
+   if (c == NULL)
+   {
+      return 1;
+   }
+
+   memcpy(c, shmem, sizeof(struct main_configuration));
+
+   *config = c;
+   *saved = shmem;
+   shmem = c;
+
+   return 0;
+}
+
+void
+pgagroal_test_restore_configuration(struct main_configuration* config, void* saved)
+{
+   if (saved != NULL)
+   {
+      shmem = saved;
+   }
+
+   free(config);
+}
@@ -27,29 +27,33 @@
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #
 # Aggregate and compare pgbench A/B results (base vs PR, measured on the same
-# runner). Each input file is one measurement: {workload: {tps, p99_ms}}. Several
-# files per side are aggregated by median, then PR is compared to base per
-# workload.
+# runner). Each input file is one measurement:
+#   {workload: {tps, p50_ms, p99_ms, p999_ms, cpu_us_per_tx, rss_mb}}
+# where cpu_us_per_tx and rss_mb are the pooler's CPU time per transaction and
+# peak memory. The workloads are the ones of the first base file, and every
+# file has to have them. Several files per side are aggregated by median, then
+# PR is compared to base per workload and metric.
 #
 # Exit codes (the central distinction — see PR #918):
 #   0  valid comparison (even if a regression is flagged, in advisory mode)
 #   1  valid comparison with a regression AND --fail-on-regression (blocking mode)
 #   2  DATA-INTEGRITY failure: missing/empty inputs, missing workload, or a
-#      non-positive/None tps or p99 — i.e. we could not actually measure.
+#      non-positive/None metric — i.e. we could not actually measure.
 #
 # "Fail loudly when you cannot measure; be advisory only when you measured an
 # apparent regression."
 #
 # Usage:
 #   compare.py --base b1.json [b2.json ...] --pr p1.json [p2.json ...]
-#              [--tps-drop PCT] [--p99-rise PCT] [--fail-on-regression]
+#              [--tps-drop PCT] [--p99-rise PCT] [--p999-rise PCT]
+#              [--cpu-rise PCT] [--rss-rise PCT] [--fail-on-regression]
 
 import argparse
 import json
 import statistics
 import sys
 
-WORKLOADS = ["read_only", "read_write", "connect"]
+METRICS = ["tps", "p50_ms", "p99_ms", "p999_ms", "cpu_us_per_tx", "rss_mb"]
 INTEGRITY_EXIT = 2
 REGRESSION_EXIT = 1
 
@@ -58,9 +62,10 @@ class IntegrityError(Exception):
     pass
 
 
-def load_side(label, paths):
-    """Load + validate one side's measurement files. Raises IntegrityError on any
-    missing file, malformed JSON, missing workload, or non-positive metric."""
+def load_side(label, paths, workloads=None):
+    """Load + validate one side's measurement files against the workloads (those
+    of the first file when None). Raises IntegrityError on any missing file,
+    malformed JSON, missing workload, or non-positive metric."""
     if not paths:
         raise IntegrityError(f"{label}: no measurement files provided")
     runs = []
@@ -70,17 +75,21 @@ def load_side(label, paths):
                 data = json.load(f)
         except (OSError, json.JSONDecodeError) as e:
             raise IntegrityError(f"{label}: cannot read/parse {p}: {e}")
-        for wl in WORKLOADS:
-            if wl not in data:
+        if not isinstance(data, dict) or not data:
+            raise IntegrityError(f"{label}: {p} has no workloads")
+        if workloads is None:
+            workloads = list(data)
+        for wl in workloads:
+            if wl not in data or not isinstance(data[wl], dict):
                 raise IntegrityError(f"{label}: {p} missing workload '{wl}'")
-            for metric in ("tps", "p99_ms"):
+            for metric in METRICS:
                 v = data[wl].get(metric)
                 if not isinstance(v, (int, float)) or isinstance(v, bool):
                     raise IntegrityError(f"{label}: {p} {wl}.{metric} is not numeric ({v!r})")
                 if v <= 0:
                     raise IntegrityError(f"{label}: {p} {wl}.{metric} is non-positive ({v})")
         runs.append(data)
-    return runs
+    return runs, workloads
 
 
 def median_metric(runs, wl, metric):
@@ -93,12 +102,15 @@ def main():
     ap.add_argument("--pr", nargs="+", required=True)
     ap.add_argument("--tps-drop", type=float, default=5.0)
     ap.add_argument("--p99-rise", type=float, default=10.0)
+    ap.add_argument("--p999-rise", type=float, default=20.0)
+    ap.add_argument("--cpu-rise", type=float, default=10.0)
+    ap.add_argument("--rss-rise", type=float, default=10.0)
     ap.add_argument("--fail-on-regression", action="store_true")
     args = ap.parse_args()
 
     try:
-        base_runs = load_side("base", args.base)
-        pr_runs = load_side("pr", args.pr)
+        base_runs, workloads = load_side("base", args.base)
+        pr_runs, _ = load_side("pr", args.pr, workloads)
     except IntegrityError as e:
         print(f"PERF INTEGRITY FAILURE: {e}", file=sys.stderr)
         # Also emit a Markdown note so the summary explains the failure.
@@ -109,30 +121,37 @@ def main():
         "### Performance A/B — PR vs base (same runner, median of "
         f"{len(base_runs)} base / {len(pr_runs)} PR runs)",
         "",
-        "| Workload | TPS (base → PR) | ΔTPS | p99 ms (base → PR) | Δp99 | |",
-        "|---|---|---|---|---|:--:|",
+        "| Workload | TPS (base → PR) | ΔTPS | p50 ms | p99 ms | Δp99 | p99.9 ms | Δp99.9 "
+        "| CPU µs/tx | ΔCPU | RSS MB | ΔRSS | |",
+        "|---|---|---|---|---|---|---|---|---|---|---|---|:--:|",
     ]
     flagged = False
-    for wl in WORKLOADS:
-        bt = median_metric(base_runs, wl, "tps")
-        pt = median_metric(pr_runs, wl, "tps")
-        bp = median_metric(base_runs, wl, "p99_ms")
-        pp = median_metric(pr_runs, wl, "p99_ms")
-        td = (pt - bt) / bt * 100.0
-        pd = (pp - bp) / bp * 100.0
-        row_flag = td < -args.tps_drop or pd > args.p99_rise
+    for wl in workloads:
+        b = {m: median_metric(base_runs, wl, m) for m in METRICS}
+        p = {m: median_metric(pr_runs, wl, m) for m in METRICS}
+        d = {m: (p[m] - b[m]) / b[m] * 100.0 for m in METRICS}
+        row_flag = (d["tps"] < -args.tps_drop or d["p99_ms"] > args.p99_rise
+                    or d["p999_ms"] > args.p999_rise or d["cpu_us_per_tx"] > args.cpu_rise
+                    or d["rss_mb"] > args.rss_rise)
         flagged = flagged or row_flag
         mark = "⚠️" if row_flag else "✅"
         lines.append(
-            f"| {wl} | {bt:.0f} → {pt:.0f} | {td:+.1f}% "
-            f"| {bp:.2f} → {pp:.2f} | {pd:+.1f}% | {mark} |"
+            f"| {wl} | {b['tps']:.0f} → {p['tps']:.0f} | {d['tps']:+.1f}% "
+            f"| {b['p50_ms']:.2f} → {p['p50_ms']:.2f} "
+            f"| {b['p99_ms']:.2f} → {p['p99_ms']:.2f} | {d['p99_ms']:+.1f}% "
+            f"| {b['p999_ms']:.2f} → {p['p999_ms']:.2f} | {d['p999_ms']:+.1f}% "
+            f"| {b['cpu_us_per_tx']:.1f} → {p['cpu_us_per_tx']:.1f} | {d['cpu_us_per_tx']:+.1f}% "
+            f"| {b['rss_mb']:.1f} → {p['rss_mb']:.1f} | {d['rss_mb']:+.1f}% | {mark} |"
         )
 
+    thresholds = (f"TPS drop > {args.tps_drop:g}%, p99 rise > {args.p99_rise:g}%, "
+                  f"p99.9 rise > {args.p999_rise:g}%, CPU rise > {args.cpu_rise:g}%, "
+                  f"RSS rise > {args.rss_rise:g}%")
     lines.append("")
     if flagged:
-        lines.append(f"⚠️ **Apparent regression** (TPS drop > {args.tps_drop:g}% or p99 rise > {args.p99_rise:g}%).")
+        lines.append(f"⚠️ **Apparent regression** ({thresholds}).")
     else:
-        lines.append(f"✅ Within thresholds (TPS drop > {args.tps_drop:g}%, p99 rise > {args.p99_rise:g}%).")
+        lines.append(f"✅ Within thresholds ({thresholds}).")
     mode = "blocking" if args.fail_on_regression else "advisory (informational while variance is calibrated)"
     lines.append(f"\n_Mode: {mode}. Measured PR-vs-base back-to-back on the same runner._")
 
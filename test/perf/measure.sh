@@ -32,10 +32,22 @@
 # if the workload fails), the port is freed before starting, and an unreachable
 # pgagroal fails the run with its log.
 #
+# The workloads need different pooler configurations, so pgagroal is started
+# once per profile and the per-profile results are merged into <out.json>:
+#   plain        performance pipeline: read_only read_write connect storm
+#   transaction  transaction pipeline with track_prepared_statements and a users
+#                file: prepared fanin
+#   tls          session pipeline, TLS towards the clients: tls
+#   tls_server   session pipeline, TLS towards the clients and PostgreSQL
+#                (which needs ssl = on): tls_server
+#
 # Usage: measure.sh <pgagroal_bindir> <label> <out.json>
-#   bindir = .../build/src ; label names the per-run log (/tmp/pgagroal-<label>.log)
-# Env: PGA_PORT, PGHOST, PGPORT, PGUSER, PGDATABASE, PERF_DURATION, PERF_CLIENTS,
-#      PGAGROAL_RUN_AS (run pgagroal as this user when current uid is 0).
+#   bindir = .../build/src ; label names the per-run logs (/tmp/pgagroal-<label>-<profile>.log)
+# Env: PGA_PORT, PGHOST, PGPORT, PGUSER, PGDATABASE, PGPASSWORD, PERF_DURATION,
+#      PERF_CLIENTS, PERF_WORKLOADS (subset of the workloads, default all),
+#      PGAGROAL_RUN_AS (run pgagroal as this user when current uid is 0),
+#      PERF_PREFORK_WORKERS (set prefork_workers; unset keeps fork-per-client),
+#      plus the run_bench.sh variables.
 
 set -uo pipefail
 
@@ -49,23 +61,96 @@ BACKEND_HOST="${PGHOST:-localhost}"
 BACKEND_PORT="${PGPORT:-5432}"
 DUR="${PERF_DURATION:-20}"
 CLIENTS="${PERF_CLIENTS:-16}"
-LOG="/tmp/pgagroal-${LABEL}.log"
+PREFORK="${PERF_PREFORK_WORKERS:-}"
+SELECTED=" ${PERF_WORKLOADS:-read_only read_write connect storm prepared fanin tls tls_server} "
+LOG=""
+
+fail() { echo "PERF MEASURE FAILURE: $*" >&2; [ -n "$LOG" ] && [ -f "$LOG" ] && sed 's/^/  log| /' "$LOG" >&2; exit 1; }
 
-fail() { echo "PERF MEASURE FAILURE: $*" >&2; [ -f "$LOG" ] && sed 's/^/  log| /' "$LOG" >&2; exit 1; }
+CFG="$(mktemp -d)"
+chmod 755 "$CFG"
+mkdir -p "$CFG/home" "$CFG/results"
 
 # pgagroal refuses root; run as PGAGROAL_RUN_AS when we are root, else directly.
+# The master key of the users file lives in the private HOME.
 run_pgagroal() {
    if [ -n "${PGAGROAL_RUN_AS:-}" ] && [ "$(id -u)" = "0" ]; then
-      sudo -u "$PGAGROAL_RUN_AS" env "LD_LIBRARY_PATH=$BINDIR" "$@"
+      sudo -u "$PGAGROAL_RUN_AS" env "LD_LIBRARY_PATH=$BINDIR" "HOME=$CFG/home" "$@"
    else
-      LD_LIBRARY_PATH="$BINDIR" "$@"
+      LD_LIBRARY_PATH="$BINDIR" HOME="$CFG/home" "$@"
    fi
 }
 
-CFG="$(mktemp -d)"
-chmod 755 "$CFG"
+# Files pgagroal reads must be owned by the user it runs as
+own() {
+   if [ -n "${PGAGROAL_RUN_AS:-}" ] && [ "$(id -u)" = "0" ]; then
+      chown -R "$PGAGROAL_RUN_AS" "$@"
+   fi
+}
+own "$CFG/home"
+
+stop_pgagroal() {
+   [ -f "$CFG/pgagroal.conf" ] || return 0
+   run_pgagroal "$BINDIR/pgagroal-cli" -c "$CFG/pgagroal.conf" shutdown >/dev/null 2>&1 || true
+   # Belt and braces: kill anything still bound to our config, then wait for the port.
+   pkill -f "$CFG/pgagroal.conf" 2>/dev/null || true
+   for _ in $(seq 1 10); do pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1 || break; sleep 1; done
+}
+trap 'stop_pgagroal; rm -rf "$CFG"' EXIT
+
+# A self-signed certificate for the TLS profiles
+make_certificate() {
+   [ -f "$CFG/server.crt" ] && return 0
+   openssl req -new -x509 -days 1 -nodes -subj "/CN=localhost" \
+      -keyout "$CFG/server.key" -out "$CFG/server.crt" >/dev/null 2>&1 \
+      || fail "could not create a TLS certificate ($LABEL)"
+   chmod 600 "$CFG/server.key"
+   own "$CFG/server.key" "$CFG/server.crt"
+}
+
+# The users file the transaction pipeline needs, encrypted with a fresh master key
+make_users() {
+   [ -f "$CFG/pgagroal_users.conf" ] && return 0
+   [ -n "${PGPASSWORD:-}" ] || fail "PGPASSWORD is required for the transaction profile ($LABEL)"
+   run_pgagroal "$BINDIR/pgagroal-admin" -g master-key >/dev/null 2>&1 \
+      || fail "could not create a master key ($LABEL)"
+   touch "$CFG/pgagroal_users.conf"
+   chmod 644 "$CFG/pgagroal_users.conf"
+   own "$CFG/pgagroal_users.conf"
+   run_pgagroal "$BINDIR/pgagroal-admin" -f "$CFG/pgagroal_users.conf" -U "$PGUSER" -P "$PGPASSWORD" user add >/dev/null 2>&1 \
+      || fail "could not add $PGUSER to the users file ($LABEL)"
+}
 
-cat > "$CFG/pgagroal.conf" <<EOF
+# Run the selected workloads of a profile: <profile> <workload> ...
+measure_profile() {
+   local profile="$1"; shift
+   local workloads=() wl pid extra="" server="" users=()
+
+   for wl in "$@"; do
+      case "$SELECTED" in *" $wl "*) workloads+=("$wl") ;; esac
+   done
+   [ "${#workloads[@]}" -gt 0 ] || return 0
+
+   LOG="/tmp/pgagroal-${LABEL}-${profile}.log"
+
+   case "$profile" in
+      plain)
+         extra="pipeline = performance" ;;
+      transaction)
+         make_users
+         users=(-u "$CFG/pgagroal_users.conf")
+         extra="pipeline = transaction
+track_prepared_statements = on" ;;
+      tls|tls_server)
+         make_certificate
+         extra="pipeline = session
+tls = on
+tls_cert_file = $CFG/server.crt
+tls_key_file = $CFG/server.key"
+         [ "$profile" = "tls_server" ] && server="tls = on" ;;
+   esac
+
+   cat > "$CFG/pgagroal.conf" <<EOF
 [pgagroal]
 host = localhost
 port = $PGA_PORT
@@ -73,41 +158,64 @@ log_type = file
 log_path = $LOG
 log_level = warn
 max_connections = 100
-pipeline = performance
 unix_socket_dir = /tmp/
+pidfile = $CFG/pgagroal.pid
+$extra
+${PREFORK:+prefork_workers = $PREFORK}
 
 [primary]
 host = $BACKEND_HOST
 port = $BACKEND_PORT
+$server
 EOF
-printf 'host all all all all\n' > "$CFG/pgagroal_hba.conf"
-chmod 644 "$CFG"/*.conf
+   printf 'host all all all all\n' > "$CFG/pgagroal_hba.conf"
+   chmod 644 "$CFG"/*.conf
 
-stop_pgagroal() {
-   run_pgagroal "$BINDIR/pgagroal-cli" -c "$CFG/pgagroal.conf" shutdown >/dev/null 2>&1 || true
-   # Belt and braces: kill anything still bound to our config, then wait for the port.
-   pkill -f "$CFG/pgagroal.conf" 2>/dev/null || true
-   for _ in $(seq 1 10); do pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1 || break; sleep 1; done
+   # Ensure the port is free before we start (a previous run may not have released it).
+   if pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1; then
+      fail "port $PGA_PORT already in use before starting pgagroal ($LABEL, $profile)"
+   fi
+
+   # Do not pre-create the log: pgagroal runs as the unprivileged PGAGROAL_RUN_AS
+   # user and must own the file it writes (a root-created log is not writable by it).
+   # Remove any stale file from a prior run so pgagroal creates it fresh.
+   rm -f "$LOG" "$CFG/pgagroal.pid" 2>/dev/null || true
+   run_pgagroal "$BINDIR/pgagroal" -c "$CFG/pgagroal.conf" -a "$CFG/pgagroal_hba.conf" "${users[@]}" -d \
+      || fail "pgagroal failed to launch ($LABEL, $profile)"
+
+   reachable=0
+   for _ in $(seq 1 30); do
+      if pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1; then reachable=1; break; fi
+      sleep 1
+   done
+   [ "$reachable" = "1" ] || fail "pgagroal did not become reachable on port $PGA_PORT ($LABEL, $profile)"
+
+   pid="$(cat "$CFG/pgagroal.pid" 2>/dev/null)"
+   [ -n "$pid" ] && kill -0 "$pid" 2>/dev/null || fail "no pid file from pgagroal ($LABEL, $profile)"
+
+   PERF_POOLER_PID="$pid" "$HERE/run_bench.sh" localhost "$PGA_PORT" "$PGUSER" "$PGDATABASE" "$DUR" "$CLIENTS" \
+      "$CFG/results/$profile.json" "${workloads[@]}" || fail "workloads of the $profile profile failed ($LABEL)"
+
+   stop_pgagroal
 }
-trap 'stop_pgagroal; rm -rf "$CFG"' EXIT
 
-# Ensure the port is free before we start (a previous run may not have released it).
-if pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1; then
-   fail "port $PGA_PORT already in use before starting pgagroal ($LABEL)"
-fi
-
-# Do not pre-create the log: pgagroal runs as the unprivileged PGAGROAL_RUN_AS
-# user and must own the file it writes (a root-created log is not writable by it).
-# Remove any stale file from a prior run so pgagroal creates it fresh.
-rm -f "$LOG" 2>/dev/null || true
-run_pgagroal "$BINDIR/pgagroal" -c "$CFG/pgagroal.conf" -a "$CFG/pgagroal_hba.conf" -d \
-   || fail "pgagroal failed to launch ($LABEL)"
-
-reachable=0
-for _ in $(seq 1 30); do
-   if pg_isready -h localhost -p "$PGA_PORT" >/dev/null 2>&1; then reachable=1; break; fi
-   sleep 1
-done
-[ "$reachable" = "1" ] || fail "pgagroal did not become reachable on port $PGA_PORT ($LABEL)"
-
-"$HERE/run_bench.sh" localhost "$PGA_PORT" "$PGUSER" "$PGDATABASE" "$DUR" "$CLIENTS" "$OUT"
+measure_profile plain read_only read_write connect storm
+measure_profile transaction prepared fanin
+measure_profile tls tls
+measure_profile tls_server tls_server
+
+ls "$CFG"/results/*.json >/dev/null 2>&1 || fail "no workloads selected ($LABEL)"
+
+python3 - "$OUT" "$CFG"/results/*.json <<'EOF' || fail "could not merge the results ($LABEL)"
+import json
+import sys
+
+merged = {}
+for path in sys.argv[2:]:
+    with open(path) as f:
+        merged.update(json.load(f))
+with open(sys.argv[1], "w") as f:
+    json.dump(merged, f)
+    f.write("\n")
+print(json.dumps(merged))
+EOF
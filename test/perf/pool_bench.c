@@ -0,0 +1,639 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Pool contention microbenchmark: pgagroal_get_connection() and
+ * pgagroal_return_connection() against a synthetic main_configuration,
+ * without PostgreSQL in the loop.
+ *
+ * The backends are Unix Domain Socket connections to a sink process that
+ * also stands in for the main process on the transfer socket. They are all
+ * created before the contenders are forked, so the contenders share them
+ * like client workers forked from the main process do.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <configuration.h>
+#include <logging.h>
+#include <memory.h>
+#include <network.h>
+#include <pool.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BENCH_PORT        6432
+#define BENCH_SERVER_PORT 5432
+#define BENCH_USER        "bench"
+#define HISTOGRAM_SIZE    1024
+#define MAX_CONTENDERS    1024
+
+/** @struct contender_result
+ * The result of a contender, in memory shared with the parent
+ */
+struct contender_result
+{
+   uint64_t ops;                        /**< The completed acquire/return pairs */
+   uint64_t errors;                     /**< The failed acquires */
+   uint64_t acquire[HISTOGRAM_SIZE];    /**< The acquire latency histogram */
+   uint64_t release[HISTOGRAM_SIZE];    /**< The return latency histogram */
+};
+
+static int sink(int transfer_fd, int server_fd, int max);
+static int prefill(int rules, int max);
+static void contend(int id, int rules, bool transaction_mode, int hold, int64_t end, struct contender_result* result);
+static int64_t now_ns(void);
+static int histogram_index(uint64_t ns);
+static uint64_t histogram_value(int index);
+static uint64_t percentile(uint64_t* histogram, uint64_t total, double p);
+static void report(char* name, uint64_t* histogram, uint64_t total);
+static void usage(void);
+
+int
+main(int argc, char** argv)
+{
+   int c;
+   int contenders = 4;
+   int max = 8;
+   int rules = 0;
+   int duration = 5;
+   int hold = 0;
+   bool transaction_mode = false;
+   int transfer_fd = -1;
+   int server_fd = -1;
+   int status;
+   int64_t end;
+   pid_t sink_pid = -1;
+   pid_t* pids = NULL;
+   size_t shmem_size;
+   size_t tmp_size;
+   void* tmp_shmem = NULL;
+   size_t results_size;
+   struct contender_result* results = NULL;
+   uint64_t ops = 0;
+   uint64_t errors = 0;
+   uint64_t acquire[HISTOGRAM_SIZE];
+   uint64_t release[HISTOGRAM_SIZE];
+   char directory[] = "/tmp/pgagroal-bench.XXXXXX";
+   char server_file[MISC_LENGTH];
+   struct main_configuration* config;
+
+   while ((c = getopt(argc, argv, "n:m:r:d:w:th")) != -1)
+   {
+      switch (c)
+      {
+         case 'n':
+            contenders = atoi(optarg);
+            break;
+         case 'm':
+            max = atoi(optarg);
+            break;
+         case 'r':
+            rules = atoi(optarg);
+            break;
+         case 'd':
+            duration = atoi(optarg);
+            break;
+         case 'w':
+            hold = atoi(optarg);
+            break;
+         case 't':
+            transaction_mode = true;
+            break;
+         case 'h':
+         default:
+            usage();
+            return c == 'h' ? 0 : 1;
+      }
+   }
+
+   if (contenders < 1 || contenders > MAX_CONTENDERS || max < 1 || max > MAX_NUMBER_OF_CONNECTIONS ||
+       rules < 0 || rules > NUMBER_OF_LIMITS || (rules > 0 && max < rules) || duration < 1 || hold < 0)
+   {
+      usage();
+      return 1;
+   }
+
+   memset(&server_file[0], 0, sizeof(server_file));
+   pgagroal_snprintf(&server_file[0], sizeof(server_file), ".s.PGSQL.%d", BENCH_SERVER_PORT);
+
+   if (mkdtemp(directory) == NULL)
+   {
+      fprintf(stderr, "pool_bench: mkdtemp: %s\n", strerror(errno));
+      return 1;
+   }
+
+   shmem_size = sizeof(struct main_configuration);
+   if (pgagroal_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+      fprintf(stderr, "pool_bench: Error in creating shared memory\n");
+      goto error;
+   }
+
+   pgagroal_init_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+
+   config->common.port = BENCH_PORT;
+   config->common.log_level = PGAGROAL_LOGGING_LEVEL_WARN;
+   config->max_connections = max;
+   config->connection_slots = max;
+   memcpy(&config->unix_socket_dir[0], directory, strlen(directory));
+
+   /* The backends are Unix Domain Socket connections to the sink */
+   memcpy(&config->servers[0].name[0], "sink", strlen("sink"));
+   memcpy(&config->servers[0].host[0], directory, strlen(directory));
+   config->servers[0].port = BENCH_SERVER_PORT;
+   config->servers[0].valid = true;
+   atomic_store(&config->servers[0].state, SERVER_PRIMARY);
+   config->number_of_servers = 1;
+
+   /* One database per rule, the rules share max_connections */
+   for (int i = 0; i < rules; i++)
+   {
+      pgagroal_snprintf(&config->limits[i].database[0], MAX_DATABASE_LENGTH, "db%d", i);
+      memcpy(&config->limits[i].username[0], "all", strlen("all"));
+      config->limits[i].max_size = max / rules;
+      config->limits[i].lineno = i + 1;
+   }
+   config->number_of_limits = rules;
+
+   if (pgagroal_resize_shared_memory(shmem_size, shmem, &tmp_size, &tmp_shmem))
+   {
+      fprintf(stderr, "pool_bench: Error in creating shared memory\n");
+      goto error;
+   }
+   pgagroal_destroy_shared_memory(shmem, shmem_size);
+   shmem_size = tmp_size;
+   shmem = tmp_shmem;
+   config = (struct main_configuration*)shmem;
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+   pgagroal_pool_init();
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, TRANSFER_UDS, &transfer_fd))
+   {
+      fprintf(stderr, "pool_bench: Could not bind to %s/%s\n", config->unix_socket_dir, TRANSFER_UDS);
+      goto error;
+   }
+
+   if (pgagroal_bind_unix_socket(config->unix_socket_dir, &server_file[0], &server_fd))
+   {
+      fprintf(stderr, "pool_bench: Could not bind to %s/%s\n", config->unix_socket_dir, &server_file[0]);
+      goto error;
+   }
+
+   sink_pid = fork();
+   if (sink_pid == -1)
+   {
+      fprintf(stderr, "pool_bench: Couldn't create process\n");
+      goto error;
+   }
+   else if (sink_pid == 0)
+   {
+      exit(sink(transfer_fd, server_fd, max));
+   }
+
+   pgagroal_disconnect(transfer_fd);
+   transfer_fd = -1;
+   pgagroal_disconnect(server_fd);
+   server_fd = -1;
+
+   if (prefill(rules, max))
+   {
+      fprintf(stderr, "pool_bench: Couldn't create the backends\n");
+      goto error;
+   }
+
+   results_size = contenders * sizeof(struct contender_result);
+   results = mmap(NULL, results_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   pids = calloc(contenders, sizeof(pid_t));
+   if (results == MAP_FAILED || pids == NULL)
+   {
+      results = NULL;
+      fprintf(stderr, "pool_bench: Out of memory\n");
+      goto error;
+   }
+   memset(results, 0, results_size);
+
+   end = now_ns() + (int64_t)duration * 1000000000LL;
+
+   for (int i = 0; i < contenders; i++)
+   {
+      pids[i] = fork();
+      if (pids[i] == -1)
+      {
+         fprintf(stderr, "pool_bench: Couldn't create process\n");
+         goto error;
+      }
+      else if (pids[i] == 0)
+      {
+         contend(i, rules, transaction_mode, hold, end, &results[i]);
+         exit(0);
+      }
+   }
+
+   for (int i = 0; i < contenders; i++)
+   {
+      waitpid(pids[i], &status, 0);
+      pids[i] = 0;
+   }
+
+   memset(&acquire[0], 0, sizeof(acquire));
+   memset(&release[0], 0, sizeof(release));
+   for (int i = 0; i < contenders; i++)
+   {
+      ops += results[i].ops;
+      errors += results[i].errors;
+      for (int j = 0; j < HISTOGRAM_SIZE; j++)
+      {
+         acquire[j] += results[i].acquire[j];
+         release[j] += results[i].release[j];
+      }
+   }
+
+   printf("contenders %d max_connections %d rules %d mode %s hold %dus duration %ds\n",
+          contenders, max, rules, transaction_mode ? "transaction" : "session", hold, duration);
+   printf("throughput %.0f ops/s (%llu ops, %llu errors)\n",
+          (double)ops / duration, (unsigned long long)ops, (unsigned long long)errors);
+   report("acquire", &acquire[0], ops);
+   report("return", &release[0], ops);
+
+   kill(sink_pid, SIGTERM);
+   waitpid(sink_pid, &status, 0);
+
+   pgagroal_remove_unix_socket(directory, TRANSFER_UDS);
+   pgagroal_remove_unix_socket(directory, &server_file[0]);
+   rmdir(directory);
+
+   munmap(results, results_size);
+   free(pids);
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+   pgagroal_destroy_shared_memory(shmem, shmem_size);
+
+   return errors > 0 ? 1 : 0;
+
+error:
+
+   if (pids != NULL)
+   {
+      for (int i = 0; i < contenders; i++)
+      {
+         if (pids[i] > 0)
+         {
+            kill(pids[i], SIGTERM);
+            waitpid(pids[i], &status, 0);
+         }
+      }
+   }
+   if (sink_pid > 0)
+   {
+      kill(sink_pid, SIGTERM);
+      waitpid(sink_pid, &status, 0);
+   }
+
+   if (shmem != NULL)
+   {
+      pgagroal_disconnect(transfer_fd);
+      pgagroal_disconnect(server_fd);
+      pgagroal_remove_unix_socket(directory, TRANSFER_UDS);
+      pgagroal_remove_unix_socket(directory, &server_file[0]);
+   }
+   rmdir(directory);
+
+   if (results != NULL)
+   {
+      munmap(results, results_size);
+   }
+   free(pids);
+
+   return 1;
+}
+
+/**
+ * Accept the backends and the transfer messages. A backend answers the
+ * DISCARD ALL of a session return like PostgreSQL does
+ */
+static int
+sink(int transfer_fd, int server_fd, int max)
+{
+   int n = 2;
+   int size = max + 64;
+   int fd;
+   ssize_t r;
+   char buffer[8192];
+   struct pollfd* fds = NULL;
+   struct pollfd* tmp = NULL;
+   static const char reply[] = {
+      'C', 0x00, 0x00, 0x00, 0x10, 'D', 'I', 'S', 'C', 'A', 'R', 'D', ' ', 'A', 'L', 'L', 0x00,
+      'Z', 0x00, 0x00, 0x00, 0x05, 'I'
+   };
+
+   fds = calloc(size, sizeof(struct pollfd));
+   if (fds == NULL)
+   {
+      return 1;
+   }
+
+   /* The backends are marked with POLLPRI next to POLLIN */
+   fds[0].fd = transfer_fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = server_fd;
+   fds[1].events = POLLIN | POLLPRI;
+
+   while (poll(fds, n, -1) >= 0)
+   {
+      for (int i = n - 1; i >= 0; i--)
+      {
+         if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+         {
+            continue;
+         }
+
+         if (i < 2)
+         {
+            fd = accept(fds[i].fd, NULL, NULL);
+            if (fd == -1)
+            {
+               continue;
+            }
+
+            if (n == size)
+            {
+               tmp = realloc(fds, size * 2 * sizeof(struct pollfd));
+               if (tmp == NULL)
+               {
+                  free(fds);
+                  return 1;
+               }
+               fds = tmp;
+               size *= 2;
+            }
+
+            fds[n].fd = fd;
+            fds[n].events = fds[i].events;
+            fds[n].revents = 0;
+            n++;
+         }
+         else
+         {
+            r = read(fds[i].fd, &buffer[0], sizeof(buffer));
+            if (r <= 0)
+            {
+               close(fds[i].fd);
+               fds[i] = fds[n - 1];
+               n--;
+            }
+            else if ((fds[i].events & POLLPRI) && write(fds[i].fd, &reply[0], sizeof(reply)) != sizeof(reply))
+            {
+               close(fds[i].fd);
+               fds[i] = fds[n - 1];
+               n--;
+            }
+         }
+      }
+   }
+
+   free(fds);
+
+   return 0;
+}
+
+/**
+ * Create every backend through pgagroal_get_connection() and return them,
+ * so they are free and known to the free slot index
+ */
+static int
+prefill(int rules, int max)
+{
+   int slot;
+   int n = 0;
+   int* slots = NULL;
+   SSL* ssl = NULL;
+   char database[MAX_DATABASE_LENGTH];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   slots = calloc(max, sizeof(int));
+   if (slots == NULL)
+   {
+      return 1;
+   }
+
+   for (int r = 0; r < (rules > 0 ? rules : 1); r++)
+   {
+      int size = rules > 0 ? config->limits[r].max_size : max;
+
+      memset(&database[0], 0, sizeof(database));
+      pgagroal_snprintf(&database[0], sizeof(database), rules > 0 ? "db%d" : "bench", r);
+
+      for (int i = 0; i < size; i++)
+      {
+         if (pgagroal_get_connection(BENCH_USER, &database[0], true, false, &slot, &ssl))
+         {
+            goto error;
+         }
+
+         config->connections[slot].has_security = SECURITY_TRUST;
+         config->connections[slot].start_time = time(NULL);
+         slots[n++] = slot;
+      }
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      if (pgagroal_return_connection(slots[i], NULL, false))
+      {
+         goto error;
+      }
+   }
+
+   free(slots);
+
+   return 0;
+
+error:
+
+   free(slots);
+
+   return 1;
+}
+
+static void
+contend(int id, int rules, bool transaction_mode, int hold, int64_t end, struct contender_result* result)
+{
+   int slot;
+   int64_t start;
+   int64_t acquired;
+   int64_t released;
+   SSL* ssl = NULL;
+   char database[MAX_DATABASE_LENGTH];
+
+   memset(&database[0], 0, sizeof(database));
+   pgagroal_snprintf(&database[0], sizeof(database), rules > 0 ? "db%d" : "bench", rules > 0 ? id % rules : 0);
+
+   while ((start = now_ns()) < end)
+   {
+      if (pgagroal_get_connection(BENCH_USER, &database[0], true, transaction_mode, &slot, &ssl))
+      {
+         result->errors++;
+         continue;
+      }
+
+      acquired = now_ns();
+      result->acquire[histogram_index(acquired - start)]++;
+
+      /* Busy wait, so the slot is held for the client work */
+      while (hold > 0 && now_ns() - acquired < (int64_t)hold * 1000)
+      {
+      }
+
+      acquired = now_ns();
+      pgagroal_return_connection(slot, ssl, transaction_mode);
+      released = now_ns();
+
+      result->release[histogram_index(released - acquired)]++;
+      result->ops++;
+   }
+}
+
+static int64_t
+now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Log-linear buckets, 16 per power of two
+ */
+static int
+histogram_index(uint64_t ns)
+{
+   int e;
+
+   if (ns < 16)
+   {
+      return (int)ns;
+   }
+
+   e = 63 - __builtin_clzll(ns);
+
+   return (e - 3) * 16 + (int)((ns >> (e - 4)) & 15);
+}
+
+static uint64_t
+histogram_value(int index)
+{
+   int e;
+
+   if (index < 16)
+   {
+      return (uint64_t)index;
+   }
+
+   e = index / 16 + 3;
+
+   return ((uint64_t)(16 + index % 16 + 1) << (e - 4)) - 1;
+}
+
+static uint64_t
+percentile(uint64_t* histogram, uint64_t total, double p)
+{
+   uint64_t count = 0;
+   uint64_t wanted;
+
+   wanted = (uint64_t)(p * total);
+   if (wanted == 0)
+   {
+      wanted = 1;
+   }
+
+   for (int i = 0; i < HISTOGRAM_SIZE; i++)
+   {
+      count += histogram[i];
+      if (count >= wanted)
+      {
+         return histogram_value(i);
+      }
+   }
+
+   return 0;
+}
+
+static void
+report(char* name, uint64_t* histogram, uint64_t total)
+{
+   printf("%-8s p50 %.2fus p90 %.2fus p99 %.2fus p99.9 %.2fus max %.2fus\n", name,
+          percentile(histogram, total, 0.50) / 1000.0,
+          percentile(histogram, total, 0.90) / 1000.0,
+          percentile(histogram, total, 0.99) / 1000.0,
+          percentile(histogram, total, 0.999) / 1000.0,
+          percentile(histogram, total, 1.0) / 1000.0);
+}
+
+static void
+usage(void)
+{
+   printf("pgagroal_pool_bench\n");
+   printf("  Pool acquire/return microbenchmark without a database\n");
+   printf("\n");
+   printf("Usage:\n");
+   printf("  pgagroal_pool_bench [ -n CONTENDERS ] [ -m MAX_CONNECTIONS ] [ -r RULES ] [ -d SECONDS ] [ -w MICROSECONDS ] [ -t ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -n CONTENDERS      The number of forked contenders (default 4)\n");
+   printf("  -m MAX_CONNECTIONS The number of backends (default 8)\n");
+   printf("  -r RULES           The number of limit rules sharing the backends, 0 for none (default 0)\n");
+   printf("  -d SECONDS         The duration (default 5)\n");
+   printf("  -w MICROSECONDS    The time a contender holds a connection (default 0)\n");
+   printf("  -t                 Transaction mode\n");
+   printf("  -h                 Display help\n");
+}
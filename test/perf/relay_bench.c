@@ -0,0 +1,865 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Protocol framing and relay microbenchmark.
+ *
+ * The traces are PostgreSQL wire streams in one direction: built-in ones
+ * for a simple query workload, extended protocol batches, a large DataRow
+ * stream and a COPY, or a recorded one given with -f. The framing part
+ * steps pgagroal_message_stream_next() over a trace cut in read sized
+ * chunks. The relay part forwards a trace over socketpairs with
+ * pgagroal_recv_message() and pgagroal_send_message() from an event loop
+ * of each backend, framing every chunk like the transaction pipeline does.
+ */
+
+/* pgagroal */
+#include <pgagroal.h>
+#include <configuration.h>
+#include <ev.h>
+#include <logging.h>
+#include <memory.h>
+#include <message.h>
+#include <shmem.h>
+#include <utils.h>
+#include <worker.h>
+
+/* system */
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NUMBER_OF_TRACES 6
+
+/** @struct trace
+ * A protocol stream in one direction
+ */
+struct trace
+{
+   char* name;       /**< The name of the trace */
+   char* kinds;      /**< The kinds the pipeline looks for in this direction */
+   char* data;       /**< The stream */
+   size_t length;    /**< The length of the stream */
+   size_t size;      /**< The capacity of the stream */
+   uint64_t messages; /**< The number of messages in the stream */
+};
+
+/** @struct relay_result
+ * The result of a relay, in memory shared with the parent
+ */
+struct relay_result
+{
+   uint64_t bytes;    /**< The bytes forwarded */
+   uint64_t reads;    /**< The chunks received */
+   uint64_t frames;   /**< The messages reported by the framing */
+   uint64_t drained;  /**< The bytes that reached the other end */
+   uint64_t errors;   /**< The failed sends */
+   int64_t cpu_ns;    /**< The CPU time of the relaying process */
+   int64_t wall_ns;   /**< The wall clock time of the relay */
+};
+
+static struct message_stream relay_stream;
+static struct trace* relay_trace = NULL;
+static struct relay_result* relay_result = NULL;
+
+static int append(struct trace* trace, signed char kind, void* body, int32_t length);
+static int build_simple_query(struct trace* trace);
+static int build_simple_reply(struct trace* trace);
+static int build_extended_batch(struct trace* trace);
+static int build_datarow_stream(struct trace* trace);
+static int build_copy_in(struct trace* trace);
+static int load_trace(char* path, char* kinds, struct trace* trace);
+static void framing(struct trace* trace, int iterations);
+static int relay(int backend, struct trace* trace, int iterations, struct relay_result* result);
+static void relay_cb(struct io_watcher* watcher);
+static int feed(int fd, struct trace* trace, int iterations);
+static uint64_t drain(int fd);
+static int64_t now_ns(void);
+static int64_t cpu_ns(void);
+static char* backend_name(int backend);
+static void usage(void);
+
+int
+main(int argc, char** argv)
+{
+   int c;
+   int iterations = 50;
+   int number_of_traces = 0;
+   int number_of_backends = 0;
+   int backends[3];
+   int status = 0;
+   char* only = NULL;
+   char* path = NULL;
+   char* kinds = NULL;
+   char* backend = "all";
+   size_t shmem_size;
+   struct relay_result* result = NULL;
+   struct trace traces[NUMBER_OF_TRACES];
+   struct main_configuration* config;
+
+   while ((c = getopt(argc, argv, "i:w:b:f:k:h")) != -1)
+   {
+      switch (c)
+      {
+         case 'i':
+            iterations = atoi(optarg);
+            break;
+         case 'w':
+            only = optarg;
+            break;
+         case 'b':
+            backend = optarg;
+            break;
+         case 'f':
+            path = optarg;
+            break;
+         case 'k':
+            kinds = optarg;
+            break;
+         case 'h':
+         default:
+            usage();
+            return c == 'h' ? 0 : 1;
+      }
+   }
+
+   if (iterations < 1)
+   {
+      usage();
+      return 1;
+   }
+
+#if HAVE_LINUX
+#if HAVE_IO_URING
+   if (!strcmp(backend, "all") || !strcmp(backend, "io_uring"))
+   {
+      backends[number_of_backends++] = PGAGROAL_EVENT_BACKEND_IO_URING;
+   }
+#endif
+   if (!strcmp(backend, "all") || !strcmp(backend, "epoll"))
+   {
+      backends[number_of_backends++] = PGAGROAL_EVENT_BACKEND_EPOLL;
+   }
+#else
+   if (!strcmp(backend, "all") || !strcmp(backend, "kqueue"))
+   {
+      backends[number_of_backends++] = PGAGROAL_EVENT_BACKEND_KQUEUE;
+   }
+#endif
+
+   if (number_of_backends == 0)
+   {
+      fprintf(stderr, "relay_bench: Unsupported backend: %s\n", backend);
+      return 1;
+   }
+
+   memset(&traces[0], 0, sizeof(traces));
+
+   if (path != NULL)
+   {
+      if (load_trace(path, kinds, &traces[number_of_traces++]))
+      {
+         fprintf(stderr, "relay_bench: Could not load %s\n", path);
+         goto error;
+      }
+   }
+   else
+   {
+      traces[number_of_traces].name = "simple_query";
+      traces[number_of_traces].kinds = "QE";
+      if (build_simple_query(&traces[number_of_traces++]))
+      {
+         goto oom;
+      }
+
+      traces[number_of_traces].name = "simple_reply";
+      traces[number_of_traces].kinds = "GHWZ";
+      if (build_simple_reply(&traces[number_of_traces++]))
+      {
+         goto oom;
+      }
+
+      traces[number_of_traces].name = "extended_batch";
+      traces[number_of_traces].kinds = "QE";
+      if (build_extended_batch(&traces[number_of_traces++]))
+      {
+         goto oom;
+      }
+
+      traces[number_of_traces].name = "datarow_stream";
+      traces[number_of_traces].kinds = "GHWZ";
+      if (build_datarow_stream(&traces[number_of_traces++]))
+      {
+         goto oom;
+      }
+
+      traces[number_of_traces].name = "copy_in";
+      traces[number_of_traces].kinds = "cf";
+      if (build_copy_in(&traces[number_of_traces++]))
+      {
+         goto oom;
+      }
+   }
+
+   shmem_size = sizeof(struct main_configuration);
+   if (pgagroal_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+      fprintf(stderr, "relay_bench: Error in creating shared memory\n");
+      goto error;
+   }
+
+   pgagroal_init_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+   config->common.log_level = PGAGROAL_LOGGING_LEVEL_WARN;
+
+   result = mmap(NULL, sizeof(struct relay_result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (result == MAP_FAILED)
+   {
+      result = NULL;
+      goto oom;
+   }
+
+   pgagroal_start_logging();
+   pgagroal_memory_init();
+
+   printf("iterations %d\n", iterations);
+
+   for (int i = 0; i < number_of_traces; i++)
+   {
+      if (only != NULL && strcmp(only, traces[i].name))
+      {
+         continue;
+      }
+
+      printf("%-16s %8zu bytes %7llu messages\n", traces[i].name, traces[i].length,
+             (unsigned long long)traces[i].messages);
+
+      framing(&traces[i], iterations);
+
+      for (int j = 0; j < number_of_backends; j++)
+      {
+         memset(result, 0, sizeof(struct relay_result));
+
+         if (relay(backends[j], &traces[i], iterations, result))
+         {
+            fprintf(stderr, "relay_bench: The %s relay of %s failed\n", backend_name(backends[j]), traces[i].name);
+            status = 1;
+            continue;
+         }
+
+         if (result->errors > 0 || result->drained != (uint64_t)traces[i].length * iterations)
+         {
+            fprintf(stderr, "relay_bench: The %s relay of %s lost data (%llu of %llu bytes)\n",
+                    backend_name(backends[j]), traces[i].name, (unsigned long long)result->drained,
+                    (unsigned long long)traces[i].length * iterations);
+            status = 1;
+         }
+
+         printf("  relay %-10s %8.1f ns/message (cpu) %8.1f MB/s %6.1f KB/read\n", backend_name(backends[j]),
+                (double)result->cpu_ns / (traces[i].messages * iterations),
+                result->bytes / 1048576.0 / (result->wall_ns / 1000000000.0),
+                result->reads > 0 ? result->bytes / 1024.0 / result->reads : 0.0);
+      }
+   }
+
+   munmap(result, sizeof(struct relay_result));
+   for (int i = 0; i < number_of_traces; i++)
+   {
+      free(traces[i].data);
+   }
+   pgagroal_memory_destroy();
+   pgagroal_stop_logging();
+   pgagroal_destroy_shared_memory(shmem, shmem_size);
+
+   return status;
+
+oom:
+
+   fprintf(stderr, "relay_bench: Out of memory\n");
+
+error:
+
+   for (int i = 0; i < number_of_traces; i++)
+   {
+      free(traces[i].data);
+   }
+
+   return 1;
+}
+
+/**
+ * Append a message to a trace
+ */
+static int
+append(struct trace* trace, signed char kind, void* body, int32_t length)
+{
+   size_t size;
+   char* data = NULL;
+
+   if (trace->length + MESSAGE_HEADER_SIZE + length > trace->size)
+   {
+      size = trace->size > 0 ? trace->size : 65536;
+      while (trace->length + MESSAGE_HEADER_SIZE + length > size)
+      {
+         size *= 2;
+      }
+
+      data = realloc(trace->data, size);
+      if (data == NULL)
+      {
+         return 1;
+      }
+
+      trace->data = data;
+      trace->size = size;
+   }
+
+   pgagroal_write_byte(trace->data + trace->length, kind);
+   pgagroal_write_int32(trace->data + trace->length + 1, length + 4);
+   if (length > 0)
+   {
+      memcpy(trace->data + trace->length + MESSAGE_HEADER_SIZE, body, length);
+   }
+
+   trace->length += MESSAGE_HEADER_SIZE + length;
+   trace->messages++;
+
+   return 0;
+}
+
+/**
+ * pgbench -S queries
+ */
+static int
+build_simple_query(struct trace* trace)
+{
+   char query[128];
+   int length;
+
+   for (int i = 0; i < 1000; i++)
+   {
+      memset(&query[0], 0, sizeof(query));
+      length = pgagroal_snprintf(&query[0], sizeof(query),
+                                 "SELECT abalance FROM pgbench_accounts WHERE aid = %d;", i + 1) + 1;
+
+      if (append(trace, 'Q', &query[0], length))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * The replies to pgbench -S queries
+ */
+static int
+build_simple_reply(struct trace* trace)
+{
+   char description[] = "\x00\x01" "abalance\0" "\x00\x00\x40\x01" "\x00\x03" "\x00\x00\x00\x17" "\x00\x04" "\xff\xff\xff\xff" "\x00\x00";
+   char row[] = "\x00\x01" "\x00\x00\x00\x04" "1234";
+   char complete[] = "SELECT 1";
+   char ready = 'I';
+
+   for (int i = 0; i < 1000; i++)
+   {
+      if (append(trace, 'T', &description[0], sizeof(description) - 1) ||
+          append(trace, 'D', &row[0], sizeof(row) - 1) ||
+          append(trace, 'C', &complete[0], sizeof(complete)) ||
+          append(trace, 'Z', &ready, 1))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * Batches of unnamed Parse/Bind/Describe/Execute ended by a Sync
+ */
+static int
+build_extended_batch(struct trace* trace)
+{
+   char parse[] = "\0" "SELECT abalance FROM pgbench_accounts WHERE aid = $1\0" "\x00\x01" "\x00\x00\x00\x17";
+   char bind[] = "\0\0" "\x00\x00" "\x00\x01" "\x00\x00\x00\x04" "1234" "\x00\x00";
+   char describe[] = "P";
+   char execute[] = "\0" "\x00\x00\x00\x00";
+
+   for (int i = 0; i < 100; i++)
+   {
+      for (int j = 0; j < 10; j++)
+      {
+         if (append(trace, 'P', &parse[0], sizeof(parse) - 1) ||
+             append(trace, 'B', &bind[0], sizeof(bind) - 1) ||
+             append(trace, 'D', &describe[0], sizeof(describe)) ||
+             append(trace, 'E', &execute[0], sizeof(execute) - 1))
+         {
+            return 1;
+         }
+      }
+
+      if (append(trace, 'S', NULL, 0))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * A large result set of 200 byte DataRow messages
+ */
+static int
+build_datarow_stream(struct trace* trace)
+{
+   char description[] = "\x00\x01" "filler\0" "\x00\x00\x40\x01" "\x00\x04" "\x00\x00\x04\x12" "\xff\xff" "\x00\x00\x00\xc4" "\x00\x00";
+   char row[200];
+   char complete[] = "SELECT 10000";
+   char ready = 'I';
+
+   memset(&row[0], 'x', sizeof(row));
+   row[0] = 0x00;
+   row[1] = 0x01;
+   pgagroal_write_int32(&row[2], sizeof(row) - 6);
+
+   if (append(trace, 'T', &description[0], sizeof(description) - 1))
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < 10000; i++)
+   {
+      if (append(trace, 'D', &row[0], sizeof(row)))
+      {
+         return 1;
+      }
+   }
+
+   if (append(trace, 'C', &complete[0], sizeof(complete)) ||
+       append(trace, 'Z', &ready, 1))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+/**
+ * A COPY FROM STDIN of 1 KB CopyData messages ended by a CopyDone
+ */
+static int
+build_copy_in(struct trace* trace)
+{
+   char data[1024];
+
+   memset(&data[0], 'x', sizeof(data));
+   data[sizeof(data) - 1] = '\n';
+
+   for (int i = 0; i < 2000; i++)
+   {
+      if (append(trace, 'd', &data[0], sizeof(data)))
+      {
+         return 1;
+      }
+   }
+
+   return append(trace, 'c', NULL, 0);
+}
+
+/**
+ * Load a recorded stream of one direction, starting at a message boundary
+ */
+static int
+load_trace(char* path, char* kinds, struct trace* trace)
+{
+   FILE* file = NULL;
+   struct stat st;
+   size_t offset = 0;
+   int32_t length;
+
+   if (stat(path, &st) || st.st_size < MESSAGE_HEADER_SIZE)
+   {
+      goto error;
+   }
+
+   trace->data = malloc(st.st_size);
+   if (trace->data == NULL)
+   {
+      goto error;
+   }
+
+   file = fopen(path, "r");
+   if (file == NULL || fread(trace->data, 1, st.st_size, file) != (size_t)st.st_size)
+   {
+      goto error;
+   }
+
+   trace->name = "recorded";
+   trace->kinds = kinds;
+   trace->length = st.st_size;
+   trace->size = st.st_size;
+
+   while (offset + MESSAGE_HEADER_SIZE <= trace->length)
+   {
+      length = pgagroal_read_int32(trace->data + offset + 1);
+      if (length < 4)
+      {
+         goto error;
+      }
+
+      offset += 1 + length;
+      trace->messages++;
+   }
+
+   if (offset != trace->length)
+   {
+      goto error;
+   }
+
+   fclose(file);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(trace->data);
+   trace->data = NULL;
+
+   return 1;
+}
+
+/**
+ * Step the framing over the trace in read sized chunks, without I/O
+ */
+static void
+framing(struct trace* trace, int iterations)
+{
+   int offset;
+   uint64_t frames = 0;
+   uint64_t chunks = 0;
+   int64_t start;
+   int64_t elapsed;
+   size_t position;
+   struct message msg;
+   struct message_frame frame;
+   struct message_stream stream;
+
+   memset(&stream, 0, sizeof(struct message_stream));
+
+   start = cpu_ns();
+
+   for (int i = 0; i < iterations; i++)
+   {
+      position = 0;
+      while (position < trace->length)
+      {
+         msg.data = trace->data + position;
+         msg.length = trace->length - position < MESSAGE_PARSE_BUFFER_SIZE ? trace->length - position : MESSAGE_PARSE_BUFFER_SIZE;
+         msg.kind = *(char*)msg.data;
+
+         offset = 0;
+         while (pgagroal_message_stream_next(&stream, &msg, &offset, trace->kinds, &frame))
+         {
+            frames++;
+         }
+
+         position += msg.length;
+         chunks++;
+      }
+   }
+
+   elapsed = cpu_ns() - start;
+
+   printf("  framing          %8.1f ns/message       %8.1f MB/s %6llu frames/iteration\n",
+          (double)elapsed / (trace->messages * iterations),
+          trace->length * (double)iterations / 1048576.0 / (elapsed / 1000000000.0),
+          (unsigned long long)(frames / iterations));
+}
+
+/**
+ * Forward the trace through an event loop of the backend. The event
+ * backend is chosen once per process, so each relay runs in its own
+ */
+static int
+relay(int backend, struct trace* trace, int iterations, struct relay_result* result)
+{
+   int in[2] = {-1, -1};
+   int out[2] = {-1, -1};
+   int status;
+   pid_t pid;
+   pid_t feeder = -1;
+   pid_t drainer = -1;
+   int64_t start;
+   int64_t cpu;
+   struct worker_io wi;
+   struct main_configuration* config = (struct main_configuration*)shmem;
+
+   fflush(stdout);
+
+   pid = fork();
+   if (pid == -1)
+   {
+      return 1;
+   }
+   else if (pid > 0)
+   {
+      waitpid(pid, &status, 0);
+      return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+   }
+
+   config->ev_backend = backend;
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) || socketpair(AF_UNIX, SOCK_STREAM, 0, out))
+   {
+      goto error;
+   }
+
+   feeder = fork();
+   if (feeder == 0)
+   {
+      close(in[1]);
+      close(out[0]);
+      close(out[1]);
+      exit(feed(in[0], trace, iterations));
+   }
+
+   drainer = fork();
+   if (drainer == 0)
+   {
+      close(in[0]);
+      close(in[1]);
+      close(out[1]);
+      result->drained = drain(out[0]);
+      exit(0);
+   }
+
+   close(in[0]);
+   close(out[0]);
+   in[0] = -1;
+   out[0] = -1;
+
+   if (feeder == -1 || drainer == -1 || pgagroal_event_loop_init() == NULL)
+   {
+      goto error;
+   }
+
+   memset(&wi, 0, sizeof(struct worker_io));
+   memset(&relay_stream, 0, sizeof(struct message_stream));
+   relay_trace = trace;
+   relay_result = result;
+
+   wi.client_fd = in[1];
+   wi.server_fd = out[1];
+   wi.slot = -1;
+   pgagroal_event_worker_init(&wi.io, in[1], out[1], relay_cb);
+
+   start = now_ns();
+   cpu = cpu_ns();
+
+   pgagroal_io_start(&wi.io);
+   pgagroal_event_loop_run();
+   pgagroal_event_flush_sends();
+
+   result->cpu_ns = cpu_ns() - cpu;
+   result->wall_ns = now_ns() - start;
+
+   pgagroal_io_stop(&wi.io);
+   pgagroal_event_loop_destroy();
+
+   close(in[1]);
+   close(out[1]);
+
+   waitpid(feeder, &status, 0);
+   waitpid(drainer, &status, 0);
+
+   exit(0);
+
+error:
+
+   if (feeder > 0)
+   {
+      kill(feeder, SIGTERM);
+      waitpid(feeder, &status, 0);
+   }
+   if (drainer > 0)
+   {
+      kill(drainer, SIGTERM);
+      waitpid(drainer, &status, 0);
+   }
+
+   exit(1);
+}
+
+/**
+ * Receive a chunk, frame it like the transaction pipeline and send it on
+ */
+static void
+relay_cb(struct io_watcher* watcher)
+{
+   int offset = 0;
+   int status;
+   struct message* msg = NULL;
+   struct message_frame frame;
+
+   status = pgagroal_recv_message(watcher, &msg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      pgagroal_event_loop_break();
+      return;
+   }
+
+   while (pgagroal_message_stream_next(&relay_stream, msg, &offset, relay_trace->kinds, &frame))
+   {
+      relay_result->frames++;
+   }
+
+   relay_result->reads++;
+   relay_result->bytes += msg->length;
+
+   if (pgagroal_send_message(watcher, msg) != MESSAGE_STATUS_OK)
+   {
+      relay_result->errors++;
+      pgagroal_event_loop_break();
+   }
+}
+
+static int
+feed(int fd, struct trace* trace, int iterations)
+{
+   ssize_t written;
+   size_t position;
+
+   for (int i = 0; i < iterations; i++)
+   {
+      position = 0;
+      while (position < trace->length)
+      {
+         written = write(fd, trace->data + position, trace->length - position);
+         if (written <= 0)
+         {
+            return 1;
+         }
+         position += written;
+      }
+   }
+
+   close(fd);
+
+   return 0;
+}
+
+static uint64_t
+drain(int fd)
+{
+   ssize_t r;
+   uint64_t total = 0;
+   char buffer[65536];
+
+   while ((r = read(fd, &buffer[0], sizeof(buffer))) > 0)
+   {
+      total += r;
+   }
+
+   close(fd);
+
+   return total;
+}
+
+static int64_t
+now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t
+cpu_ns(void)
+{
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+
+   return ((int64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+          ((int64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+static char*
+backend_name(int backend)
+{
+   switch (backend)
+   {
+      case PGAGROAL_EVENT_BACKEND_IO_URING:
+         return "io_uring";
+      case PGAGROAL_EVENT_BACKEND_EPOLL:
+         return "epoll";
+      case PGAGROAL_EVENT_BACKEND_KQUEUE:
+         return "kqueue";
+      default:
+         return "unknown";
+   }
+}
+
+static void
+usage(void)
+{
+   printf("pgagroal_relay_bench\n");
+   printf("  Protocol framing and relay microbenchmark without a database\n");
+   printf("\n");
+   printf("Usage:\n");
+   printf("  pgagroal_relay_bench [ -i ITERATIONS ] [ -w TRACE ] [ -b BACKEND ] [ -f FILE [ -k KINDS ] ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -i ITERATIONS The number of times each trace is replayed (default 50)\n");
+   printf("  -w TRACE      Only run simple_query, simple_reply, extended_batch, datarow_stream or copy_in\n");
+   printf("  -b BACKEND    The event backend: io_uring, epoll, kqueue or all (default all)\n");
+   printf("  -f FILE       Replay a recorded stream of one direction instead of the built-in traces\n");
+   printf("  -k KINDS      The message kinds to frame in the recorded stream (default all)\n");
+   printf("  -h            Display help\n");
+}
@@ -26,15 +26,26 @@
 # TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #
-# Run pgbench workloads through a running pgagroal and emit TPS + p99 latency as
-# JSON: one measurement. A short warm-up precedes each recorded workload.
+# Run pgbench workloads through a running pgagroal and emit, per workload, TPS,
+# p50/p99/p99.9 latency and the CPU time and peak memory of the pooler as JSON:
+# one measurement. A short warm-up precedes each recorded workload.
 #
 # This script FAILS LOUDLY (non-zero exit, nothing written to <out.json>) on any
 # integrity fault — pgbench error, timeout, missing output, missing/empty latency
-# log, or a non-numeric result. It must never emit null/placeholder values: an
-# inability to measure is an error, not a result (see PR #918).
+# log, an unreadable pooler, or a non-numeric result. It must never emit
+# null/placeholder values: an inability to measure is an error, not a result
+# (see PR #918).
 #
-# Usage: run_bench.sh <host> <port> <user> <db> <duration_s> <clients> <out.json>
+# The pooler has to be configured for the workloads asked for; measure.sh
+# starts it once per configuration:
+#   read_only, read_write, connect, storm   any pipeline
+#   prepared, fanin                         transaction pipeline, track_prepared_statements
+#   tls, tls_server                         tls = on on the client side / also on the server
+#
+# Usage: run_bench.sh <host> <port> <user> <db> <duration_s> <clients> <out.json> [workload ...]
+#   workloads default to read_only read_write connect
+# Env: PERF_POOLER_PID (pgagroal main process, required), PERF_STORM_CLIENTS,
+#      PERF_FANIN_CLIENTS, PERF_FANIN_RATE.
 
 set -uo pipefail
 
@@ -45,23 +56,83 @@ DB="${4:?db}"
 DUR="${5:?duration_s}"
 CLIENTS="${6:?clients}"
 OUT="${7:?out.json}"
+shift 7
+WORKLOADS=("$@")
+[ "${#WORKLOADS[@]}" -gt 0 ] || WORKLOADS=(read_only read_write connect)
 
 JOBS="$(nproc 2>/dev/null || echo 2)"
 WARMUP="${PERF_WARMUP:-3}"
 CAP=$((DUR + WARMUP + 60))     # hard timeout per pgbench invocation
+STORM_CLIENTS="${PERF_STORM_CLIENTS:-200}"
+FANIN_CLIENTS="${PERF_FANIN_CLIENTS:-1000}"
+FANIN_RATE="${PERF_FANIN_RATE:-1000}"
 TMP="$(mktemp -d)"
 trap 'rm -rf "$TMP"' EXIT
 
 fail() { echo "PERF MEASURE FAILURE: $*" >&2; exit 1; }
 
-# Echo one JSON member: "name": {tps, p99_ms}. Warm-up first (discarded), then
-# the measured run. Any fault exits non-zero (caught by the caller's `|| exit`).
+# The fan-in clients each need a descriptor
+ulimit -n "$(ulimit -Hn)" 2>/dev/null || true
+
+# CPU ticks of the pooler: the main process with its reaped children, plus the
+# live children. Process names can't contain ')' here, so the fields after the
+# last one are positional.
+pooler_ticks()
+{
+   local pid="$1" total child
+
+   total="$(sed 's/.*) //' "/proc/$pid/stat" 2>/dev/null | awk '{print $12 + $13 + $14 + $15}')"
+   [ -n "$total" ] || return 1
+   for child in $(pgrep -P "$pid"); do
+      total=$((total + $(sed 's/.*) //' "/proc/$child/stat" 2>/dev/null | awk '{print $12 + $13}') + 0))
+   done
+   echo "$total"
+}
+
+# Memory of the pooler in kB: the proportional set size so the shared memory
+# segment is counted once, or the resident set size where smaps_rollup can't be
+# read.
+pooler_kb()
+{
+   local pid="$1" total=0 kb p
+
+   for p in "$pid" $(pgrep -P "$pid"); do
+      kb="$(awk '/^Pss:/ {print $2}' "/proc/$p/smaps_rollup" 2>/dev/null)"
+      [ -n "$kb" ] || kb="$(awk '/^VmRSS:/ {print $2}' "/proc/$p/status" 2>/dev/null)"
+      total=$((total + ${kb:-0}))
+   done
+   echo "$total"
+}
+
+# Sample the peak pooler memory into $1 until killed
+sample_memory()
+{
+   local out="$1" peak=0 kb
+
+   while :; do
+      kb="$(pooler_kb "$PERF_POOLER_PID")"
+      [ "$kb" -gt "$peak" ] && { peak="$kb"; echo "$peak" > "$out"; }
+      sleep 0.5
+   done
+}
+
+PERF_POOLER_PID="${PERF_POOLER_PID:-}"
+[ -n "$PERF_POOLER_PID" ] || fail "PERF_POOLER_PID is not set"
+CLK_TCK="$(getconf CLK_TCK 2>/dev/null || echo 100)"
+pooler_ticks "$PERF_POOLER_PID" >/dev/null || fail "cannot read /proc/$PERF_POOLER_PID/stat of the pooler"
+
+# Echo one JSON member: "name": {tps, p50_ms, p99_ms, p999_ms, cpu_us_per_tx,
+# rss_mb}. Warm-up first (discarded), then the measured run. Any fault exits
+# non-zero (caught by the caller's `|| exit`). Under -R the latency is counted
+# from the scheduled start, so the schedule lag is added to it.
 run_one()
 {
    local name="$1"; shift
    local pfx="$TMP/$name"
    local out="$TMP/$name.out"
-   local rc tps p99
+   local rc tps txs lat ticks_before ticks_after cpu kb sampler lag=0
+
+   case " $* " in *" -R "*) lag=1 ;; esac
 
    # Warm-up (pool fill, page cache); results discarded but failures still fatal.
    timeout "$CAP" pgbench -h "$HOST" -p "$PORT" -U "$USER" -d "$DB" \
@@ -70,26 +141,62 @@ run_one()
    [ "$rc" -eq 124 ] && fail "$name warm-up timed out"
    [ "$rc" -ne 0 ] && fail "$name warm-up failed (pgbench exit $rc)"
 
+   rm -f "$TMP/$name.kb"
+   sample_memory "$TMP/$name.kb" &
+   sampler=$!
+   ticks_before="$(pooler_ticks "$PERF_POOLER_PID")"
+
    timeout "$CAP" pgbench -h "$HOST" -p "$PORT" -U "$USER" -d "$DB" \
       -T "$DUR" -c "$CLIENTS" -j "$JOBS" -l --log-prefix="$pfx" "$@" > "$out" 2>&1
    rc=$?
+
+   ticks_after="$(pooler_ticks "$PERF_POOLER_PID")"
+   kill "$sampler" 2>/dev/null
+   wait "$sampler" 2>/dev/null
+
    [ "$rc" -eq 124 ] && { sed 's/^/  | /' "$out" >&2; fail "$name measured run timed out"; }
    [ "$rc" -ne 0 ] && { sed 's/^/  | /' "$out" >&2; fail "$name pgbench exited $rc"; }
 
    tps="$(grep -oE 'tps = [0-9.]+' "$out" | head -1 | awk '{print $3}')"
    [ -n "$tps" ] || { sed 's/^/  | /' "$out" >&2; fail "$name produced no TPS"; }
+   txs="$(grep -oE 'number of transactions actually processed: [0-9]+' "$out" | awk '{print $NF}')"
+   [ -n "$txs" ] && [ "$txs" -gt 0 ] || { sed 's/^/  | /' "$out" >&2; fail "$name processed no transactions"; }
 
    ls "$pfx".* >/dev/null 2>&1 || fail "$name produced no latency log"
-   p99="$(cat "$pfx".* | awk '{print $3}' | sort -n \
-      | awk 'END {if (NR == 0) exit 1} {a[NR]=$1} END {printf "%.3f", a[int(NR*0.99)]/1000.0}')" \
+   lat="$(cat "$pfx".* | awk -v lag="$lag" '{print $3 + (lag ? $7 : 0)}' | sort -n \
+      | awk 'function at(p,  i) {i = int(NR * p); if (i < 1) i = 1; return a[i] / 1000.0}
+             {a[NR]=$1}
+             END {if (NR == 0) exit 1; printf "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f", at(0.50), at(0.99), at(0.999)}')" \
       || fail "$name latency log was empty"
 
-   printf '"%s": {"tps": %s, "p99_ms": %s}' "$name" "$tps" "$p99"
+   [ -n "$ticks_before" ] && [ -n "$ticks_after" ] || fail "$name lost the pooler (pid $PERF_POOLER_PID)"
+   cpu="$(awk -v t=$((ticks_after - ticks_before)) -v hz="$CLK_TCK" -v n="$txs" 'BEGIN {printf "%.3f", t / hz * 1000000.0 / n}')"
+   awk -v c="$cpu" 'BEGIN {exit !(c > 0)}' || fail "$name measured no pooler CPU time"
+
+   kb="$(cat "$TMP/$name.kb" 2>/dev/null)"
+   [ -n "$kb" ] && [ "$kb" -gt 0 ] || fail "$name measured no pooler memory"
+
+   printf '"%s": {"tps": %s, %s, "cpu_us_per_tx": %s, "rss_mb": %.1f}' "$name" "$tps" "$lat" "$cpu" \
+      "$(awk -v k="$kb" 'BEGIN {printf "%.1f", k / 1024.0}')"
 }
 
-m_ro="$(run_one read_only -S)" || exit 1
-m_rw="$(run_one read_write)" || exit 1
-m_co="$(run_one connect -C -S)" || exit 1
+members=()
+for wl in "${WORKLOADS[@]}"; do
+   case "$wl" in
+      read_only)  m="$(run_one read_only -S)" || exit 1 ;;
+      read_write) m="$(run_one read_write)" || exit 1 ;;
+      connect)    m="$(run_one connect -C -S)" || exit 1 ;;
+      # A connection storm: more reconnecting clients than server connections
+      storm)      m="$(run_one storm -C -S -c "$STORM_CLIENTS")" || exit 1 ;;
+      prepared)   m="$(run_one prepared -M prepared -S)" || exit 1 ;;
+      # Many mostly idle clients fanning in on few server connections
+      fanin)      m="$(run_one fanin -S -c "$FANIN_CLIENTS" -R "$FANIN_RATE")" || exit 1 ;;
+      tls)        m="$(PGSSLMODE=require run_one tls -S)" || exit 1 ;;
+      tls_server) m="$(PGSSLMODE=require run_one tls_server -S)" || exit 1 ;;
+      *)          fail "unknown workload '$wl'" ;;
+   esac
+   members+=("$m")
+done
 
-printf '{%s, %s, %s}\n' "$m_ro" "$m_rw" "$m_co" > "$OUT"
+( IFS=,; printf '{%s}\n' "${members[*]}" ) | sed 's/},"/}, "/g' > "$OUT"
 cat "$OUT"
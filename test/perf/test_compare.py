@@ -40,9 +40,10 @@ HERE = os.path.dirname(os.path.abspath(__file__))
 COMPARE = os.path.join(HERE, "compare.py")
 
 GOOD = {
-    "read_only": {"tps": 1000, "p99_ms": 2.0},
-    "read_write": {"tps": 500, "p99_ms": 4.0},
-    "connect": {"tps": 200, "p99_ms": 9.0},
+    "read_only": {"tps": 1000, "p50_ms": 0.8, "p99_ms": 2.0, "p999_ms": 3.0, "cpu_us_per_tx": 40.0, "rss_mb": 30.0},
+    "read_write": {"tps": 500, "p50_ms": 1.9, "p99_ms": 4.0, "p999_ms": 6.0, "cpu_us_per_tx": 60.0, "rss_mb": 30.0},
+    "connect": {"tps": 200, "p50_ms": 4.5, "p99_ms": 9.0, "p999_ms": 14.0, "cpu_us_per_tx": 900.0, "rss_mb": 35.0},
+    "tls": {"tps": 800, "p50_ms": 1.0, "p99_ms": 2.5, "p999_ms": 4.0, "cpu_us_per_tx": 70.0, "rss_mb": 32.0},
 }
 
 _tmp = tempfile.mkdtemp()
@@ -133,6 +134,37 @@ rc, out = run(["--base", write(b1), write(b2), "--pr", write(pr_a), write(pr_b)]
 check("median aggregation: exit 0 within thresholds", rc == 0 and "Within thresholds" in out)
 check("median aggregation: reports 2 base / 2 PR runs", "2 base / 2 PR" in out)
 
+# 11. p99.9 regression (+50%) -> flagged, p99.9 is compared on its own
+pr3 = deepcopy(GOOD); pr3["read_only"]["p999_ms"] = 4.5
+rc, out = run(["--base", write(GOOD), "--pr", write(pr3)])
+check("p999 regression: flagged", "Apparent regression" in out and rc == 0)
+
+# 12. pooler CPU and memory regressions -> flagged
+pr4 = deepcopy(GOOD); pr4["tls"]["cpu_us_per_tx"] = 84.0
+rc, out = run(["--base", write(GOOD), "--pr", write(pr4)])
+check("cpu regression: flagged", "Apparent regression" in out and rc == 0)
+pr5 = deepcopy(GOOD); pr5["connect"]["rss_mb"] = 40.0
+rc, out = run(["--base", write(GOOD), "--pr", write(pr5)])
+check("rss regression: flagged", "Apparent regression" in out and rc == 0)
+
+# 13. a p50 change alone is reported, not flagged
+pr6 = deepcopy(GOOD); pr6["read_write"]["p50_ms"] = 3.0
+rc, out = run(["--base", write(GOOD), "--pr", write(pr6)])
+check("p50 change: within thresholds", rc == 0 and "Within thresholds" in out)
+
+# 14. missing metric -> integrity exit 2
+bad = deepcopy(GOOD); del bad["tls"]["rss_mb"]
+rc, out = run(["--base", write(GOOD), "--pr", write(bad)])
+check("missing rss: integrity exit 2", rc == 2)
+
+# 15. the workloads are those of the base: a subset on both sides compares,
+# a workload only the base has is missing on the PR side
+sub = deepcopy(GOOD); del sub["tls"]
+rc, out = run(["--base", write(sub), "--pr", write(sub)])
+check("workload subset: exit 0", rc == 0 and "| tls |" not in out and "| connect |" in out)
+rc, out = run(["--base", write(GOOD), "--pr", write(sub)])
+check("workload missing on pr: integrity exit 2", rc == 2)
+
 print()
 if failures:
     print(f"FAILED ({len(failures)}): {failures}")
@@ -52,7 +52,8 @@ STUB
 chmod +x "$TMP/pgbench"
 
 OUT="$TMP/out.json"
-PATH="$TMP:$PATH" bash "$HERE/run_bench.sh" localhost 6432 u d 1 1 "$OUT" >/dev/null 2>&1
+# The pooler is this shell, so it is the failing pgbench that is seen
+PERF_POOLER_PID=$$ PATH="$TMP:$PATH" bash "$HERE/run_bench.sh" localhost 6432 u d 1 1 "$OUT" >/dev/null 2>&1
 rc=$?
 
 fail=0
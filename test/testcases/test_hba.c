@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pgagroal.h>
+#include <security.h>
+#include <mctf.h>
+#include <tscommon.h>
+
+#include <arpa/inet.h>
+#include <string.h>
+
+/*
+ * Unit tests for the compiled HBA matcher.
+ *
+ * pgagroal_hba_entry() must return the same line as a linear scan that takes
+ * the first entry matching the address, the database (or one of its limit
+ * aliases) and the user, with the masks taken as bit prefixes.
+ */
+
+struct hba_test_entry
+{
+   char* database;
+   char* username;
+   char* address;
+   char* method;
+};
+
+static struct hba_test_entry entries[] = {
+   {"db1", "alice", "10.0.0.0/8", "trust"},
+   {"all", "bob", "10.1.0.0/16", "reject"},
+   {"db2", "all", "10.1.2.0/24", "password"},
+   {"all", "all", "192.168.1.128/25", "scram-sha-256"},
+   {"db1", "all", "2001:db8::/32", "trust"},
+   {"all", "carol", "2001:db8:1::/48", "reject"},
+   {"pgbench", "all", "10.1.2.3/32", "all"},
+   {"all", "all", "172.16.0.0/12", "trust"},
+   {"all", "all", "all", "reject"},
+};
+
+static char* addresses[] = {
+   "10.0.0.1", "10.1.2.3", "10.1.2.200", "10.1.3.1", "10.2.0.1", "11.0.0.1",
+   "192.168.1.1", "192.168.1.127", "192.168.1.128", "192.168.1.255",
+   "172.16.5.4", "172.31.255.255", "172.32.0.1", "127.0.0.1",
+   "2001:db8::1", "2001:db8:1::5", "2001:db8:2::5", "2001:db9::1", "::1",
+};
+
+static char* databases[] = {"db1", "db2", "alias1", "pgbench", "other"};
+
+static char* usernames[] = {"alice", "bob", "carol", "dave"};
+
+static int setup(struct main_configuration** config, void** saved, int number_of_entries);
+static int linear_entry(struct main_configuration* config, char* username, char* database, char* address);
+static bool linear_address(char* address, char* entry);
+
+/* Every combination agrees with the linear scan */
+MCTF_TEST(test_hba_matches_linear)
+{
+   int expected;
+   int actual;
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved, sizeof(entries) / sizeof(entries[0])), 0, cleanup, "HBA compilation failed");
+
+   for (size_t a = 0; a < sizeof(addresses) / sizeof(addresses[0]); a++)
+   {
+      for (size_t d = 0; d < sizeof(databases) / sizeof(databases[0]); d++)
+      {
+         for (size_t u = 0; u < sizeof(usernames) / sizeof(usernames[0]); u++)
+         {
+            expected = linear_entry(config, usernames[u], databases[d], addresses[a]);
+            actual = pgagroal_hba_entry(usernames[u], databases[d], addresses[a]);
+
+            MCTF_ASSERT_INT_EQ(actual, expected, cleanup, "%s@%s from %s should match line %d",
+                               usernames[u], databases[d], addresses[a], expected);
+         }
+      }
+   }
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+/* The first matching line wins over a more specific later one */
+MCTF_TEST(test_hba_first_line)
+{
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved, sizeof(entries) / sizeof(entries[0])), 0, cleanup, "HBA compilation failed");
+
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("alice", "db1", "10.1.2.3"), 0, cleanup, "the /8 line comes first");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("bob", "pgbench", "10.1.2.3"), 1, cleanup, "the /16 line comes before the /32");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db2", "10.1.2.3"), 2, cleanup, "the /24 line comes before the /32");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "pgbench", "10.1.2.3"), 6, cleanup, "the /32 line");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("alice", "alias1", "10.0.0.1"), 0, cleanup, "an alias matches its database");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("carol", "db1", "2001:db8:1::5"), 4, cleanup, "the /32 line comes before the /48");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("carol", "db2", "2001:db8:1::5"), 5, cleanup, "the /48 line");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "::1"), 8, cleanup, "the catch-all line");
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+/* Masks are bit prefixes, not whole octets */
+MCTF_TEST(test_hba_bit_masks)
+{
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved, sizeof(entries) / sizeof(entries[0])), 0, cleanup, "HBA compilation failed");
+
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "192.168.1.127"), 8, cleanup, "below the /25");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "192.168.1.128"), 3, cleanup, "within the /25");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "172.31.255.255"), 7, cleanup, "within the /12");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "172.32.0.1"), 8, cleanup, "above the /12");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("carol", "db2", "2001:db8:2::5"), 8, cleanup, "outside the /48");
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+/* Without a catch-all line a login can match nothing */
+MCTF_TEST(test_hba_no_match)
+{
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved, sizeof(entries) / sizeof(entries[0]) - 1), 0, cleanup, "HBA compilation failed");
+
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "127.0.0.1"), -1, cleanup, "no line for the address");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "other", "10.0.0.1"), -1, cleanup, "no line for the database");
+   MCTF_ASSERT_INT_EQ(pgagroal_hba_entry("dave", "db1", "not an address"), -1, cleanup, "an invalid address");
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+static int
+setup(struct main_configuration** config, void** saved, int number_of_entries)
+{
+   struct main_configuration* c = NULL;
+
+   if (pgagroal_test_private_configuration(config, saved))
+   {
+      return 1;
+   }
+
+   c = *config;
+
+   memset(&c->hbas[0], 0, sizeof(c->hbas));
+   for (int i = 0; i < number_of_entries; i++)
+   {
+      strcpy(c->hbas[i].type, "host");
+      strcpy(c->hbas[i].database, entries[i].database);
+      strcpy(c->hbas[i].username, entries[i].username);
+      strcpy(c->hbas[i].address, entries[i].address);
+      strcpy(c->hbas[i].method, entries[i].method);
+      c->hbas[i].lineno = i + 1;
+   }
+   c->number_of_hbas = number_of_entries;
+
+   memset(&c->limits[0], 0, sizeof(c->limits));
+   strcpy(c->limits[0].database, "db1");
+   strcpy(c->limits[0].aliases[0], "alias1");
+   c->limits[0].aliases_count = 1;
+   c->number_of_limits = 1;
+
+   return pgagroal_hba_compile(c);
+}
+
+static int
+linear_entry(struct main_configuration* config, char* username, char* database, char* address)
+{
+   bool database_match;
+
+   for (int i = 0; i < config->number_of_hbas; i++)
+   {
+      database_match = !strcasecmp(config->hbas[i].database, "all") || !strcmp(config->hbas[i].database, database);
+
+      for (int j = 0; !database_match && j < config->number_of_limits; j++)
+      {
+         if (!strcmp(config->hbas[i].database, config->limits[j].database))
+         {
+            for (int k = 0; !database_match && k < config->limits[j].aliases_count; k++)
+            {
+               database_match = !strcmp(config->limits[j].aliases[k], database);
+            }
+         }
+      }
+
+      if (database_match &&
+          (!strcasecmp(config->hbas[i].username, "all") || !strcmp(config->hbas[i].username, username)) &&
+          linear_address(address, config->hbas[i].address))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static bool
+linear_address(char* address, char* entry)
+{
+   char addr[INET6_ADDRSTRLEN];
+   unsigned char a[16];
+   unsigned char e[16];
+   char* marker = NULL;
+   int family;
+   int mask;
+
+   if (!strcasecmp(entry, "all"))
+   {
+      return true;
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   marker = strchr(entry, '/');
+   memcpy(&addr, entry, marker - entry);
+   mask = atoi(marker + 1);
+   family = strchr(addr, ':') == NULL ? AF_INET : AF_INET6;
+
+   if (inet_pton(family, address, &a[0]) != 1 || inet_pton(family, addr, &e[0]) != 1)
+   {
+      return false;
+   }
+
+   for (int i = 0; i < mask; i++)
+   {
+      if (((a[i / 8] ^ e[i / 8]) >> (7 - (i % 8))) & 1)
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pgagroal.h>
+#include <message.h>
+#include <utils.h>
+#include <mctf.h>
+
+#include <string.h>
+
+/*
+ * Unit tests for the message boundary tracking of forwarded chunks.
+ *
+ * However a reply is cut into chunks, pgagroal_message_stream_next() must
+ * report the same messages, each with its kind, its length and a body that
+ * starts at the first body byte, and the stream must know whether a chunk
+ * ended inside a message.
+ */
+
+#define STREAM_SIZE     128
+#define NUMBER_OF_FOUND 16
+
+struct found
+{
+   signed char kind; /**< The kind of the message */
+   int32_t length;   /**< The length of the message */
+   int body;         /**< The offset of the body in the stream */
+   int available;    /**< The number of body bytes in the chunk */
+};
+
+static int build_stream(char* data, struct found* expected, int* number_of_expected, bool* boundaries);
+static int add_message(char* data, int offset, signed char kind, char* body, int body_length,
+                       struct found* expected, int* number_of_expected, bool* boundaries);
+static int stream_chunks(char* data, int length, int* cuts, int number_of_cuts, char* kinds,
+                         bool* boundaries, struct found* found, bool* partial_ok, bool* ready);
+static bool same_frames(struct found* expected, int number_of_expected, struct found* found, int number_of_found, char* kinds);
+
+/* The whole reply in one chunk */
+MCTF_TEST(test_message_stream_single_chunk)
+{
+   char data[STREAM_SIZE];
+   int length;
+   int number_of_expected = 0;
+   int number_of_found;
+   bool boundaries[STREAM_SIZE + 1];
+   bool partial_ok;
+   bool ready;
+   struct found expected[NUMBER_OF_FOUND];
+   struct found found[NUMBER_OF_FOUND];
+
+   length = build_stream(&data[0], &expected[0], &number_of_expected, &boundaries[0]);
+
+   number_of_found = stream_chunks(&data[0], length, NULL, 0, NULL, &boundaries[0], &found[0], &partial_ok, &ready);
+
+   MCTF_ASSERT_INT_EQ(number_of_found, number_of_expected, cleanup, "every message should be reported");
+   MCTF_ASSERT(same_frames(&expected[0], number_of_expected, &found[0], number_of_found, NULL), cleanup,
+               "the messages should be reported as built");
+   MCTF_ASSERT(partial_ok, cleanup, "the stream should end at a message boundary");
+   MCTF_ASSERT(ready, cleanup, "the stream should end with a ReadyForQuery");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* Every cut into two and three chunks, including inside the headers */
+MCTF_TEST(test_message_stream_every_split)
+{
+   char data[STREAM_SIZE];
+   int length;
+   int cuts[2];
+   int number_of_expected = 0;
+   int number_of_found;
+   bool boundaries[STREAM_SIZE + 1];
+   bool partial_ok;
+   bool ready;
+   struct found expected[NUMBER_OF_FOUND];
+   struct found found[NUMBER_OF_FOUND];
+
+   length = build_stream(&data[0], &expected[0], &number_of_expected, &boundaries[0]);
+
+   for (int i = 1; i < length; i++)
+   {
+      for (int j = i; j < length; j++)
+      {
+         cuts[0] = i;
+         cuts[1] = j;
+
+         number_of_found = stream_chunks(&data[0], length, &cuts[0], i == j ? 1 : 2, NULL, &boundaries[0], &found[0], &partial_ok, &ready);
+
+         MCTF_ASSERT_INT_EQ(number_of_found, number_of_expected, cleanup, "every message should be reported (cuts %d, %d)", i, j);
+         MCTF_ASSERT(same_frames(&expected[0], number_of_expected, &found[0], number_of_found, NULL), cleanup,
+                     "the messages should be reported as built (cuts %d, %d)", i, j);
+         MCTF_ASSERT(partial_ok, cleanup, "a chunk end inside a message should be partial (cuts %d, %d)", i, j);
+         MCTF_ASSERT(ready, cleanup, "the stream should end with a ReadyForQuery (cuts %d, %d)", i, j);
+      }
+   }
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* One byte per chunk */
+MCTF_TEST(test_message_stream_byte_by_byte)
+{
+   char data[STREAM_SIZE];
+   int length;
+   int cuts[STREAM_SIZE];
+   int number_of_expected = 0;
+   int number_of_found;
+   bool boundaries[STREAM_SIZE + 1];
+   bool partial_ok;
+   bool ready;
+   struct found expected[NUMBER_OF_FOUND];
+   struct found found[NUMBER_OF_FOUND];
+
+   length = build_stream(&data[0], &expected[0], &number_of_expected, &boundaries[0]);
+
+   for (int i = 1; i < length; i++)
+   {
+      cuts[i - 1] = i;
+   }
+
+   number_of_found = stream_chunks(&data[0], length, &cuts[0], length - 1, NULL, &boundaries[0], &found[0], &partial_ok, &ready);
+
+   MCTF_ASSERT_INT_EQ(number_of_found, number_of_expected, cleanup, "every message should be reported");
+   MCTF_ASSERT(same_frames(&expected[0], number_of_expected, &found[0], number_of_found, NULL), cleanup,
+               "the messages should be reported as built");
+   MCTF_ASSERT(partial_ok, cleanup, "a chunk end inside a message should be partial");
+   MCTF_ASSERT(ready, cleanup, "the stream should end with a ReadyForQuery");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* Only the requested kinds are reported, the others are stepped over */
+MCTF_TEST(test_message_stream_kinds)
+{
+   char data[STREAM_SIZE];
+   int length;
+   int number_of_expected = 0;
+   int number_of_found;
+   bool boundaries[STREAM_SIZE + 1];
+   bool partial_ok;
+   bool ready;
+   struct found expected[NUMBER_OF_FOUND];
+   struct found found[NUMBER_OF_FOUND];
+
+   length = build_stream(&data[0], &expected[0], &number_of_expected, &boundaries[0]);
+
+   for (int i = 0; i < length; i++)
+   {
+      number_of_found = stream_chunks(&data[0], length, &i, i == 0 ? 0 : 1, "CZ", &boundaries[0], &found[0], &partial_ok, &ready);
+
+      MCTF_ASSERT_INT_EQ(number_of_found, 2, cleanup, "CommandComplete and ReadyForQuery should be reported (cut %d)", i);
+      MCTF_ASSERT(same_frames(&expected[0], number_of_expected, &found[0], number_of_found, "CZ"), cleanup,
+                  "the requested messages should be reported as built (cut %d)", i);
+      MCTF_ASSERT(partial_ok, cleanup, "a chunk end inside a message should be partial (cut %d)", i);
+      MCTF_ASSERT(ready, cleanup, "the stream should end with a ReadyForQuery (cut %d)", i);
+   }
+
+cleanup:
+   MCTF_FINISH();
+}
+
+static int
+build_stream(char* data, struct found* expected, int* number_of_expected, bool* boundaries)
+{
+   int offset = 0;
+   char row[24];
+
+   memset(boundaries, 0, (STREAM_SIZE + 1) * sizeof(bool));
+   memset(&row[0], 'r', sizeof(row));
+
+   boundaries[0] = true;
+
+   /* A reply with a body shorter than a header, an empty body and a long body */
+   offset = add_message(data, offset, 'T', "ab", 2, expected, number_of_expected, boundaries);
+   offset = add_message(data, offset, 'n', NULL, 0, expected, number_of_expected, boundaries);
+   offset = add_message(data, offset, 'D', &row[0], sizeof(row), expected, number_of_expected, boundaries);
+   offset = add_message(data, offset, 'D', "x", 1, expected, number_of_expected, boundaries);
+   offset = add_message(data, offset, 'C', "SELECT 2", 9, expected, number_of_expected, boundaries);
+   offset = add_message(data, offset, 'Z', "I", 1, expected, number_of_expected, boundaries);
+
+   return offset;
+}
+
+static int
+add_message(char* data, int offset, signed char kind, char* body, int body_length,
+            struct found* expected, int* number_of_expected, bool* boundaries)
+{
+   pgagroal_write_byte(data + offset, kind);
+   pgagroal_write_int32(data + offset + 1, body_length + 4);
+   if (body_length > 0)
+   {
+      memcpy(data + offset + MESSAGE_HEADER_SIZE, body, body_length);
+   }
+
+   expected[*number_of_expected].kind = kind;
+   expected[*number_of_expected].length = body_length + 4;
+   expected[*number_of_expected].body = offset + MESSAGE_HEADER_SIZE;
+   expected[*number_of_expected].available = body_length;
+   (*number_of_expected)++;
+
+   offset += MESSAGE_HEADER_SIZE + body_length;
+   boundaries[offset] = true;
+
+   return offset;
+}
+
+static int
+stream_chunks(char* data, int length, int* cuts, int number_of_cuts, char* kinds,
+              bool* boundaries, struct found* found, bool* partial_ok, bool* ready)
+{
+   int start = 0;
+   int end;
+   int offset;
+   int number_of_found = 0;
+   struct message msg;
+   struct message_stream stream;
+   struct message_frame frame;
+
+   memset(&stream, 0, sizeof(struct message_stream));
+   *partial_ok = true;
+
+   for (int c = 0; c <= number_of_cuts; c++)
+   {
+      end = c < number_of_cuts ? cuts[c] : length;
+
+      memset(&msg, 0, sizeof(struct message));
+      msg.kind = data[start];
+      msg.length = end - start;
+      msg.data = data + start;
+
+      offset = 0;
+      while (pgagroal_message_stream_next(&stream, &msg, &offset, kinds, &frame))
+      {
+         if (number_of_found < NUMBER_OF_FOUND)
+         {
+            found[number_of_found].kind = frame.kind;
+            found[number_of_found].length = frame.length;
+            found[number_of_found].body = start + (int)(frame.body - (char*)msg.data);
+            found[number_of_found].available = frame.available;
+         }
+         number_of_found++;
+      }
+
+      if (pgagroal_message_stream_partial(&stream) == boundaries[end])
+      {
+         *partial_ok = false;
+      }
+
+      start = end;
+   }
+
+   *ready = pgagroal_message_stream_ready(&stream);
+
+   return number_of_found;
+}
+
+static bool
+same_frames(struct found* expected, int number_of_expected, struct found* found, int number_of_found, char* kinds)
+{
+   int n = 0;
+
+   for (int i = 0; i < number_of_expected; i++)
+   {
+      if (kinds != NULL && strchr(kinds, expected[i].kind) == NULL)
+      {
+         continue;
+      }
+
+      if (n >= number_of_found || n >= NUMBER_OF_FOUND)
+      {
+         return false;
+      }
+
+      /* The body is reported from its first byte, as much of it as is in the chunk */
+      if (found[n].kind != expected[i].kind || found[n].length != expected[i].length ||
+          found[n].body != expected[i].body || found[n].available < (expected[i].available > 0 ? 1 : 0) ||
+          found[n].available > expected[i].available)
+      {
+         return false;
+      }
+
+      n++;
+   }
+
+   return n == number_of_found;
+}
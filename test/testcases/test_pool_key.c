@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pgagroal.h>
+#include <pool.h>
+#include <mctf.h>
+#include <tscommon.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Unit tests for the interned pool keys.
+ *
+ * Two slots may only be reused for each other when they have the same limit
+ * rule, user name and real database, so equal triples must share a key and
+ * different triples must not. A triple that can't be interned gets 0, which
+ * makes the pool compare the names instead.
+ */
+
+static int setup(struct main_configuration** config, void** saved);
+
+/* Equal triples share a key, different ones don't */
+MCTF_TEST(test_pool_key_intern)
+{
+   int key;
+   int other_user;
+   int other_database;
+   int other_rule;
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved), 0, cleanup, "setup failed");
+
+   key = pgagroal_pool_key(0, "intern_user", "intern_db");
+   MCTF_ASSERT(key > 0, cleanup, "the triple should be interned");
+
+   other_user = pgagroal_pool_key(0, "intern_other", "intern_db");
+   other_database = pgagroal_pool_key(0, "intern_user", "intern_other");
+   other_rule = pgagroal_pool_key(1, "intern_user", "intern_db");
+
+   MCTF_ASSERT(other_user > 0 && other_user != key, cleanup, "another user should get another key");
+   MCTF_ASSERT(other_database > 0 && other_database != key, cleanup, "another database should get another key");
+   MCTF_ASSERT(other_rule > 0 && other_rule != key, cleanup, "another limit rule should get another key");
+   MCTF_ASSERT(other_user != other_database && other_user != other_rule && other_database != other_rule, cleanup,
+               "the keys should be distinct");
+
+   /* Not the last key asked for, so it is found in the table */
+   MCTF_ASSERT_INT_EQ(pgagroal_pool_key(0, "intern_user", "intern_db"), key, cleanup, "the key should be stable");
+   MCTF_ASSERT_INT_EQ(pgagroal_pool_key(0, "intern_other", "intern_db"), other_user, cleanup, "the key should be stable");
+
+   /* The user and database names don't run into each other */
+   MCTF_ASSERT(pgagroal_pool_key(0, "ab", "c") != pgagroal_pool_key(0, "a", "bc"), cleanup,
+               "a split of the same characters should get another key");
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+/* Names too long for the table and a full table give no key */
+MCTF_TEST(test_pool_key_no_key)
+{
+   int first;
+   int last;
+   char name[MAX_USERNAME_LENGTH + 1];
+   void* saved = NULL;
+   struct main_configuration* config = NULL;
+
+   MCTF_ASSERT_INT_EQ(setup(&config, &saved), 0, cleanup, "setup failed");
+
+   memset(&name[0], 'u', sizeof(name) - 1);
+   name[sizeof(name) - 1] = '\0';
+   MCTF_ASSERT_INT_EQ(pgagroal_pool_key(0, name, "full_db"), 0, cleanup, "a user name too long should get no key");
+
+   first = pgagroal_pool_key(0, "full_0", "full_db");
+   MCTF_ASSERT(first > 0, cleanup, "the first triple should be interned");
+
+   for (int i = 1; i < NUMBER_OF_POOL_KEYS; i++)
+   {
+      snprintf(&name[0], sizeof(name), "full_%d", i);
+      MCTF_ASSERT(pgagroal_pool_key(0, name, "full_db") > 0, cleanup, "triple %d should be interned", i);
+   }
+
+   last = pgagroal_pool_key(0, "full_more", "full_db");
+   MCTF_ASSERT_INT_EQ(last, 0, cleanup, "a full table should give no key");
+   MCTF_ASSERT_INT_EQ(pgagroal_pool_key(0, "full_0", "full_db"), first, cleanup, "an interned triple should keep its key");
+
+cleanup:
+   pgagroal_test_restore_configuration(config, saved);
+   MCTF_FINISH();
+}
+
+static int
+setup(struct main_configuration** config, void** saved)
+{
+   if (pgagroal_test_private_configuration(config, saved))
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < NUMBER_OF_POOL_KEYS; i++)
+   {
+      atomic_init(&(*config)->pool_keys[i].state, STATE_NOTINIT);
+   }
+
+   return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pgagroal.h>
+#include <message.h>
+#include <query_cache.h>
+#include <mctf.h>
+
+#include <string.h>
+
+/*
+ * Unit tests for the query cache decisions.
+ *
+ * Only a single SELECT without side effects may be cached, only a plain row set
+ * reply may be stored, and a client changing its session state stops using the
+ * cache. A false positive serves a wrong reply, so the counter-examples matter
+ * more than the accepted queries.
+ */
+
+static bool cacheable(char* query);
+static bool session(char* query);
+
+/* Plain SELECTs, including ones whose literals and comments look like more */
+MCTF_TEST(test_query_cache_cacheable)
+{
+   MCTF_ASSERT(cacheable("SELECT 1"), cleanup, "a constant");
+   MCTF_ASSERT(cacheable("  select * from t where id = 1"), cleanup, "lower case with leading space");
+   MCTF_ASSERT(cacheable("SELECT count(*), max(id) FROM t WHERE id IN (1, 2)"), cleanup, "known functions");
+   MCTF_ASSERT(cacheable("SELECT lower(name) FROM t GROUP BY lower(name)"), cleanup, "a known function twice");
+   MCTF_ASSERT(cacheable("SELECT 'a;b'"), cleanup, "a ';' in a literal");
+   MCTF_ASSERT(cacheable("SELECT 'it''s; fine'"), cleanup, "a doubled quote in a literal");
+   MCTF_ASSERT(cacheable("SELECT E'it\\'s; fine'"), cleanup, "an escaped quote in an escape literal");
+   MCTF_ASSERT(cacheable("SELECT $$;nextval('s')$$"), cleanup, "a dollar quoted literal");
+   MCTF_ASSERT(cacheable("SELECT $tag$;$$;$tag$"), cleanup, "a tagged dollar quoted literal");
+   MCTF_ASSERT(cacheable("SELECT 1 /* ; now() */"), cleanup, "a block comment");
+   MCTF_ASSERT(cacheable("SELECT 1 -- ; now()\n"), cleanup, "a line comment");
+   MCTF_ASSERT(cacheable("SELECT \"for\" FROM t"), cleanup, "a quoted column named like a keyword");
+   MCTF_ASSERT(cacheable("SELECT CAST(x AS numeric(10, 2)) FROM t"), cleanup, "a type modifier");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* Everything that has or may have a side effect, or isn't a single SELECT */
+MCTF_TEST(test_query_cache_not_cacheable)
+{
+   MCTF_ASSERT(!cacheable(""), cleanup, "an empty query");
+   MCTF_ASSERT(!cacheable("INSERT INTO t VALUES (1)"), cleanup, "an INSERT");
+   MCTF_ASSERT(!cacheable("WITH d AS (DELETE FROM t RETURNING *) SELECT * FROM d"), cleanup, "a WITH");
+   MCTF_ASSERT(!cacheable("SELECT 1; DELETE FROM t"), cleanup, "two statements");
+   MCTF_ASSERT(!cacheable("SELECT 1;"), cleanup, "a trailing ';'");
+   MCTF_ASSERT(!cacheable("SELECT 'it\\'; DELETE FROM t; --'"), cleanup, "a backslash doesn't escape a standard literal");
+   MCTF_ASSERT(!cacheable("SELECT nextval('s')"), cleanup, "nextval");
+   MCTF_ASSERT(!cacheable("SELECT now()"), cleanup, "now");
+   MCTF_ASSERT(!cacheable("SELECT random() FROM t"), cleanup, "random");
+   MCTF_ASSERT(!cacheable("SELECT pg_sleep (1)"), cleanup, "a space before the arguments");
+   MCTF_ASSERT(!cacheable("SELECT set_config('a', 'b', false)"), cleanup, "set_config");
+   MCTF_ASSERT(!cacheable("SELECT \"lower\"(name) FROM t"), cleanup, "a quoted function name");
+   MCTF_ASSERT(!cacheable("SELECT lower(my_func(x)) FROM t"), cleanup, "an unknown function in a known one");
+   MCTF_ASSERT(!cacheable("SELECT * INTO t2 FROM t"), cleanup, "SELECT INTO");
+   MCTF_ASSERT(!cacheable("SELECT * FROM t FOR UPDATE"), cleanup, "FOR UPDATE");
+   MCTF_ASSERT(!cacheable("select * from t for share"), cleanup, "FOR SHARE");
+   MCTF_ASSERT(!cacheable("SELECT 'unterminated"), cleanup, "an unterminated literal");
+   MCTF_ASSERT(!cacheable("SELECT $$unterminated"), cleanup, "an unterminated dollar quoted literal");
+   MCTF_ASSERT(!cacheable("SELECT 1 /* unterminated"), cleanup, "an unterminated comment");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* Only RowDescription, DataRow*, CommandComplete SELECT and an idle ReadyForQuery */
+MCTF_TEST(test_query_cache_reply)
+{
+   int state;
+   struct message_frame t = {'T', 6, "\0\0", 2};
+   struct message_frame d = {'D', 6, "\0\0", 2};
+   struct message_frame c = {'C', 13, "SELECT 1", 9};
+   struct message_frame c_insert = {'C', 17, "INSERT 0 1", 11};
+   struct message_frame n = {'N', 5, "", 0};
+   struct message_frame z_idle = {'Z', 5, "I", 1};
+   struct message_frame z_tx = {'Z', 5, "T", 1};
+
+   state = QUERY_CACHE_REPLY_DESCRIPTION;
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &t), cleanup, "RowDescription first");
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &d), cleanup, "a DataRow");
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &d), cleanup, "another DataRow");
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &c), cleanup, "CommandComplete SELECT");
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &z_idle), cleanup, "an idle ReadyForQuery");
+   MCTF_ASSERT_INT_EQ(state, QUERY_CACHE_REPLY_DONE, cleanup, "the reply should be complete");
+
+   state = QUERY_CACHE_REPLY_DESCRIPTION;
+   MCTF_ASSERT(!pgagroal_query_cache_reply(&state, &d), cleanup, "a DataRow without RowDescription");
+
+   state = QUERY_CACHE_REPLY_DESCRIPTION;
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &t), cleanup, "RowDescription first");
+   MCTF_ASSERT(!pgagroal_query_cache_reply(&state, &n), cleanup, "a NoticeResponse");
+
+   state = QUERY_CACHE_REPLY_DESCRIPTION;
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &t), cleanup, "RowDescription first");
+   MCTF_ASSERT(!pgagroal_query_cache_reply(&state, &c_insert), cleanup, "CommandComplete of an INSERT");
+
+   state = QUERY_CACHE_REPLY_DESCRIPTION;
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &t), cleanup, "RowDescription first");
+   MCTF_ASSERT(pgagroal_query_cache_reply(&state, &c), cleanup, "CommandComplete SELECT");
+   MCTF_ASSERT(!pgagroal_query_cache_reply(&state, &z_tx), cleanup, "a ReadyForQuery in a transaction");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+/* The statements that change the session state the replies depend on */
+MCTF_TEST(test_query_cache_session)
+{
+   MCTF_ASSERT(session("SET search_path TO s"), cleanup, "SET");
+   MCTF_ASSERT(session("  reset all"), cleanup, "RESET");
+   MCTF_ASSERT(session("DISCARD ALL"), cleanup, "DISCARD");
+   MCTF_ASSERT(session("LOAD 'auto_explain'"), cleanup, "LOAD");
+   MCTF_ASSERT(session("SELECT SET_CONFIG('search_path', 's', false)"), cleanup, "set_config");
+   MCTF_ASSERT(!session("SELECT 1"), cleanup, "a SELECT");
+   MCTF_ASSERT(!session("SELECT settings FROM t"), cleanup, "a word starting with set");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+static bool
+cacheable(char* query)
+{
+   /* As in a Query message, with the terminating zero */
+   return pgagroal_query_cache_cacheable(query, strlen(query) + 1);
+}
+
+static bool
+session(char* query)
+{
+   return pgagroal_query_cache_session(query, strlen(query) + 1);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2026 The pgagroal community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#include <pgagroal.h>
+#include <pool.h>
+#include <mctf.h>
+
+#include <stdlib.h>
+
+/*
+ * Unit tests for the idle_timeout and max_connection_age timer wheels.
+ *
+ * A slot must never be reported before its due time, must be reported once
+ * the bucket holding its due time has elapsed, and only once.
+ */
+
+#define TIMEOUT 60
+
+static bool is_due(unsigned long long* due, int slot);
+static int count_due(unsigned long long* due);
+
+/* A slot expires after its due time, within one bucket */
+MCTF_TEST(test_timer_wheel_expiry)
+{
+   time_t start = 100000;
+   time_t deadline = start + TIMEOUT;
+   time_t expired = 0;
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
+   struct timer_wheel* wheel = NULL;
+
+   wheel = (struct timer_wheel*)calloc(1, sizeof(struct timer_wheel));
+   MCTF_ASSERT_PTR_NONNULL(wheel, cleanup, "timer wheel allocation failed");
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start, &due[0]);
+   pgagroal_timer_wheel_add(wheel, TIMEOUT, deadline, 5);
+
+   for (time_t now = start + 1; now <= deadline + TIMEOUT && expired == 0; now++)
+   {
+      pgagroal_timer_wheel_advance(wheel, TIMEOUT, now, &due[0]);
+      if (is_due(&due[0], 5))
+      {
+         expired = now;
+      }
+      MCTF_ASSERT_INT_EQ(count_due(&due[0]), expired != 0 ? 1 : 0, cleanup, "only slot 5 can be due at %ld", (long)now);
+   }
+
+   MCTF_ASSERT(expired > deadline, cleanup, "slot expired at %ld, before its due time %ld", (long)expired, (long)deadline);
+   MCTF_ASSERT(expired <= deadline + 2 * ((TIMEOUT + 31) / 32), cleanup, "slot expired at %ld, more than a bucket after %ld",
+               (long)expired, (long)deadline);
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, expired + 1, &due[0]);
+   MCTF_ASSERT_INT_EQ(count_due(&due[0]), 0, cleanup, "a slot is only reported once");
+
+cleanup:
+   free(wheel);
+   MCTF_FINISH();
+}
+
+/* A removed slot is never reported */
+MCTF_TEST(test_timer_wheel_remove)
+{
+   time_t start = 100000;
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
+   struct timer_wheel* wheel = NULL;
+
+   wheel = (struct timer_wheel*)calloc(1, sizeof(struct timer_wheel));
+   MCTF_ASSERT_PTR_NONNULL(wheel, cleanup, "timer wheel allocation failed");
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start, &due[0]);
+   pgagroal_timer_wheel_add(wheel, TIMEOUT, start + TIMEOUT, 3);
+   pgagroal_timer_wheel_add(wheel, TIMEOUT, start + TIMEOUT, 70);
+   pgagroal_timer_wheel_remove(wheel, TIMEOUT, start + TIMEOUT, 3);
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start + 2 * TIMEOUT, &due[0]);
+   MCTF_ASSERT(!is_due(&due[0], 3), cleanup, "the removed slot should not be due");
+   MCTF_ASSERT(is_due(&due[0], 70), cleanup, "the other slot of the bucket should be due");
+   MCTF_ASSERT_INT_EQ(count_due(&due[0]), 1, cleanup, "only slot 70 should be due");
+
+cleanup:
+   free(wheel);
+   MCTF_FINISH();
+}
+
+/* A slot added with a due time already processed goes into the next bucket */
+MCTF_TEST(test_timer_wheel_already_due)
+{
+   time_t start = 100000;
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
+   struct timer_wheel* wheel = NULL;
+
+   wheel = (struct timer_wheel*)calloc(1, sizeof(struct timer_wheel));
+   MCTF_ASSERT_PTR_NONNULL(wheel, cleanup, "timer wheel allocation failed");
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start, &due[0]);
+   pgagroal_timer_wheel_add(wheel, TIMEOUT, start - TIMEOUT, MAX_NUMBER_OF_CONNECTIONS - 1);
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start + 2 * ((TIMEOUT + 31) / 32), &due[0]);
+   MCTF_ASSERT(is_due(&due[0], MAX_NUMBER_OF_CONNECTIONS - 1), cleanup, "the overdue slot should be due in the next bucket");
+
+   /* Removing with the same due time finds the bucket it went into */
+   pgagroal_timer_wheel_add(wheel, TIMEOUT, start - TIMEOUT, 1);
+   pgagroal_timer_wheel_remove(wheel, TIMEOUT, start - TIMEOUT, 1);
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start + 4 * TIMEOUT, &due[0]);
+   MCTF_ASSERT_INT_EQ(count_due(&due[0]), 0, cleanup, "the removed overdue slot should not be due");
+
+cleanup:
+   free(wheel);
+   MCTF_FINISH();
+}
+
+/* After a gap longer than the wheel every slot is reported */
+MCTF_TEST(test_timer_wheel_gap)
+{
+   time_t start = 100000;
+   unsigned long long due[NUMBER_OF_FREE_SLOT_WORDS];
+   struct timer_wheel* wheel = NULL;
+
+   wheel = (struct timer_wheel*)calloc(1, sizeof(struct timer_wheel));
+   MCTF_ASSERT_PTR_NONNULL(wheel, cleanup, "timer wheel allocation failed");
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start, &due[0]);
+   for (int i = 0; i < 10; i++)
+   {
+      pgagroal_timer_wheel_add(wheel, TIMEOUT, start + TIMEOUT + i * 7, i * 100);
+   }
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start + 100 * TIMEOUT, &due[0]);
+   MCTF_ASSERT_INT_EQ(count_due(&due[0]), 10, cleanup, "all the slots should be due");
+
+   pgagroal_timer_wheel_advance(wheel, TIMEOUT, start + 101 * TIMEOUT, &due[0]);
+   MCTF_ASSERT_INT_EQ(count_due(&due[0]), 0, cleanup, "the slots should only be reported once");
+
+cleanup:
+   free(wheel);
+   MCTF_FINISH();
+}
+
+static bool
+is_due(unsigned long long* due, int slot)
+{
+   return (due[slot / 64] & (1ULL << (slot % 64))) != 0;
+}
+
+static int
+count_due(unsigned long long* due)
+{
+   int count = 0;
+
+   for (int i = 0; i < NUMBER_OF_FREE_SLOT_WORDS; i++)
+   {
+      count += __builtin_popcountll(due[i]);
+   }
+
+   return count;
+}